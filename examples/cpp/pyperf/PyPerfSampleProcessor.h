@@ -18,6 +18,16 @@ class PyPerfSampleProcessor {
  public:
   virtual void processSamples(const std::vector<PyPerfSample>& samples,
                               PyPerfUtil* util) = 0;
+
+  // Streaming interface: a processor returning true from wantsStreaming()
+  // receives periodic batches via processBatch() while the profiling window
+  // is still open, with identical stacks already merged (see
+  // PyPerfSample::count). The end-of-window processSamples() call then only
+  // covers samples that arrived after the last batch, so the final flush is
+  // proportional to new data instead of the whole window.
+  virtual bool wantsStreaming() const { return false; }
+  virtual void processBatch(const std::vector<PyPerfSample>& samples,
+                            PyPerfUtil* util) {}
 };
 
 }  // namespace pyperf
@@ -113,6 +113,9 @@ struct PyPerfSample {
   uint8_t pthreadIDMatch;
   uint8_t stackStatus;
   std::vector<int32_t> pyStackIds;
+  // identical samples merged by PyPerfUtil's incremental aggregation are
+  // carried as one record with their occurrence count
+  uint32_t count;
 
   explicit PyPerfSample(const Event* raw, int rawSize)
       : pid(raw->pid),
@@ -122,7 +125,8 @@ struct PyPerfSample {
         gilState(raw->gil_state),
         pthreadIDMatch(raw->pthread_id_match),
         stackStatus(raw->stack_status),
-        pyStackIds(raw->stack, raw->stack + raw->stack_len) {}
+        pyStackIds(raw->stack, raw->stack + raw->stack_len),
+        count(1) {}
 };
 
 }  // namespace pyperf
@@ -7,6 +7,7 @@
 #include <cerrno>
 #include <chrono>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <exception>
 
@@ -29,6 +30,7 @@ extern OffsetConfig kPy36OffsetConfig;
 extern std::string PYPERF_BPF_PROGRAM;
 
 const static int kPerfBufSizePages = 32;
+const static int64_t kStreamFlushIntervalMs = 1000;
 
 const static std::string kPidCfgTableName("pid_config");
 const static std::string kProgsTableName("progs");
@@ -84,14 +86,15 @@ bool getRunningPids(std::vector<int>& output) {
   return true;
 }
 
-typedef struct {
+struct FindPythonPathHelper {
   int pid;
   bool found;
   uint64_t st;
   uint64_t en;
-} FindPythonPathHelper;
+  std::string libName;
+};
 
-const static std::string kPy36LibName = "libpython3.6";
+const static std::string kPyLibName = "libpython3.";
 
 int findPythonPathCallback(mod_info *mod, int, void* payload) {
   auto helper = static_cast<FindPythonPathHelper*>(payload);
@@ -100,17 +103,140 @@ int findPythonPathCallback(mod_info *mod, int, void* payload) {
   if (pos != std::string::npos) {
     file = file.substr(pos + 1);
   }
-  if (file.find(kPy36LibName) == 0) {
+  if (file.find(kPyLibName) == 0) {
     logInfo(1, "Found Python library %s loaded at %lx-%lx for PID %d\n", mod->name,
             mod->start_addr, mod->end_addr, helper->pid);
     helper->found = true;
     helper->st = mod->start_addr;
     helper->en = mod->end_addr;
+    helper->libName = file;
     return -1;
   }
   return 0;
 }
 
+// Struct offset resolution. Offsets are looked up from an on-disk cache
+// keyed by the interpreter's build-id first, then from the built-in
+// per-version tables; a table hit is written back to the cache. The cache
+// lives under BCC_PYPERF_OFFSET_CACHE_DIR (no caching when unset) as one
+// "<build-id>.offsets" text file per interpreter build, one "name offset"
+// pair per line, so offsets for a build without a built-in table can be
+// dropped in externally (e.g. extracted from debug info on a build host).
+
+struct OffsetField {
+  const char* name;
+  int64_t OffsetConfig::*field;
+};
+
+const static OffsetField kOffsetFields[] = {
+    {"PyObject_type", &OffsetConfig::PyObject_type},
+    {"PyTypeObject_name", &OffsetConfig::PyTypeObject_name},
+    {"PyThreadState_frame", &OffsetConfig::PyThreadState_frame},
+    {"PyThreadState_thread", &OffsetConfig::PyThreadState_thread},
+    {"PyFrameObject_back", &OffsetConfig::PyFrameObject_back},
+    {"PyFrameObject_code", &OffsetConfig::PyFrameObject_code},
+    {"PyFrameObject_lineno", &OffsetConfig::PyFrameObject_lineno},
+    {"PyFrameObject_localsplus", &OffsetConfig::PyFrameObject_localsplus},
+    {"PyCodeObject_filename", &OffsetConfig::PyCodeObject_filename},
+    {"PyCodeObject_name", &OffsetConfig::PyCodeObject_name},
+    {"PyCodeObject_varnames", &OffsetConfig::PyCodeObject_varnames},
+    {"PyTupleObject_item", &OffsetConfig::PyTupleObject_item},
+    {"String_data", &OffsetConfig::String_data},
+    {"String_size", &OffsetConfig::String_size},
+};
+const static size_t kNumOffsetFields =
+    sizeof(kOffsetFields) / sizeof(kOffsetFields[0]);
+
+std::string offsetCachePath(const std::string& libPath) {
+  const char* dir = ::getenv("BCC_PYPERF_OFFSET_CACHE_DIR");
+  if (!dir) {
+    return "";
+  }
+  char buildid[128] = {};
+  if (bcc_elf_get_buildid(libPath.c_str(), buildid) != 0) {
+    return "";
+  }
+  return std::string(dir) + "/" + buildid + ".offsets";
+}
+
+bool loadCachedOffsets(const std::string& libPath, OffsetConfig& out) {
+  auto cachePath = offsetCachePath(libPath);
+  if (cachePath.empty()) {
+    return false;
+  }
+  std::FILE* f = std::fopen(cachePath.c_str(), "r");
+  if (!f) {
+    return false;
+  }
+  size_t found = 0;
+  char name[64];
+  long long value;
+  while (std::fscanf(f, "%63s %lld", name, &value) == 2) {
+    for (const auto& field : kOffsetFields) {
+      if (std::strcmp(name, field.name) == 0) {
+        out.*(field.field) = value;
+        found++;
+        break;
+      }
+    }
+  }
+  std::fclose(f);
+  if (found != kNumOffsetFields) {
+    return false;
+  }
+  logInfo(1, "Loaded Python struct offsets from %s\n", cachePath.c_str());
+  return true;
+}
+
+void storeCachedOffsets(const std::string& libPath, const OffsetConfig& cfg) {
+  auto cachePath = offsetCachePath(libPath);
+  if (cachePath.empty()) {
+    return;
+  }
+  // write-to-temp plus rename so a concurrent profiler never reads a
+  // partially written file
+  auto tmpPath = cachePath + ".tmp." + std::to_string(::getpid());
+  std::FILE* f = std::fopen(tmpPath.c_str(), "w");
+  if (!f) {
+    return;
+  }
+  for (const auto& field : kOffsetFields) {
+    std::fprintf(f, "%s %lld\n", field.name,
+                 static_cast<long long>(cfg.*(field.field)));
+  }
+  std::fclose(f);
+  if (::rename(tmpPath.c_str(), cachePath.c_str()) != 0) {
+    ::unlink(tmpPath.c_str());
+  }
+}
+
+// Built-in offset tables by CPython minor version, selected from the
+// library name ("libpython3.<minor>..."). Only 3.6 is known today; the BPF
+// stack walker follows the PyThreadState/PyFrameObject chain of that era,
+// so a new entry is only valid for versions that keep this shape.
+bool offsetsForLibrary(const std::string& libName, OffsetConfig& out) {
+  int minor = std::atoi(libName.c_str() + kPyLibName.size());
+  switch (minor) {
+    case 6:
+      out = kPy36OffsetConfig;
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool resolveOffsetConfig(const std::string& libPath,
+                         const std::string& libName, OffsetConfig& out) {
+  if (loadCachedOffsets(libPath, out)) {
+    return true;
+  }
+  if (offsetsForLibrary(libName, out)) {
+    storeCachedOffsets(libPath, out);
+    return true;
+  }
+  return false;
+}
+
 bool allAddrFound(const PidData& data) {
   return (data.current_state_addr > 0) && (data.tls_key_addr > 0) &&
          (data.gil_locked_addr > 0) && (data.gil_last_holder_addr > 0);
@@ -261,9 +387,16 @@ PyPerfUtil::PyPerfResult PyPerfUtil::profile(int64_t sampleRate,
   }
   logInfo(2, "Started polling Perf Buffer\n");
   auto start = std::chrono::steady_clock::now();
+  auto lastFlush = start;
   while (std::chrono::steady_clock::now() <
          start + std::chrono::milliseconds(durationMs)) {
     perfBuffer->poll(50 /* 50ms timeout */);
+    auto now = std::chrono::steady_clock::now();
+    if (processor->wantsStreaming() &&
+        now >= lastFlush + std::chrono::milliseconds(kStreamFlushIntervalMs)) {
+      flushBatch(processor);
+      lastFlush = now;
+    }
   }
   logInfo(2, "Profiling duration finished\n");
 
@@ -282,21 +415,68 @@ PyPerfUtil::PyPerfResult PyPerfUtil::profile(int64_t sampleRate,
   }
   logInfo(2, "Finished draining remaining samples\n");
 
+  if (processor->wantsStreaming()) {
+    // only the tail since the last batch is left here, so this final pass
+    // is proportional to new data rather than the whole window
+    aggregateSamples(samples_);
+  }
   processor->processSamples(samples_, this);
 
   return PyPerfResult::SUCCESS;
 }
 
+void PyPerfUtil::flushBatch(PyPerfSampleProcessor* processor) {
+  if (samples_.empty()) {
+    return;
+  }
+  aggregateSamples(samples_);
+  std::vector<PyPerfSample> batch;
+  batch.swap(samples_);
+  processor->processBatch(batch, this);
+}
+
+// Merge identical stacks within a batch so repeated samples are carried as
+// one record with a count. First-occurrence order is preserved.
+void PyPerfUtil::aggregateSamples(std::vector<PyPerfSample>& samples) {
+  std::unordered_map<std::string, size_t> index;
+  std::vector<PyPerfSample> merged;
+  merged.reserve(samples.size());
+  for (auto& sample : samples) {
+    std::string key = std::to_string(sample.pid) + "|" +
+                      std::to_string(sample.tid) + "|" + sample.comm + "|" +
+                      std::to_string(sample.threadStateMatch) + "|" +
+                      std::to_string(sample.gilState) + "|" +
+                      std::to_string(sample.pthreadIDMatch) + "|" +
+                      std::to_string(sample.stackStatus) + "|";
+    for (const auto stackId : sample.pyStackIds) {
+      key += std::to_string(stackId);
+      key += ",";
+    }
+    auto it = index.find(key);
+    if (it == index.end()) {
+      index.emplace(std::move(key), merged.size());
+      merged.push_back(std::move(sample));
+    } else {
+      merged[it->second].count += sample.count;
+    }
+  }
+  samples.swap(merged);
+}
+
 std::unordered_map<int32_t, std::string> PyPerfUtil::getSymbolMapping() {
   auto symbolTable = bpf_.get_hash_table<Symbol, int32_t>("symbols");
-  std::unordered_map<int32_t, std::string> symbols;
   for (auto& x : symbolTable.get_table_offline()) {
+    // ids already interned keep their cached name; only new symbols pay
+    // for name assembly
+    if (symbolCache_.find(x.second) != symbolCache_.end()) {
+      continue;
+    }
     auto symbolName = getSymbolName(x.first);
     logInfo(2, "Symbol ID %d is %s\n", x.second, symbolName.c_str());
-    symbols.emplace(x.second, std::move(symbolName));
+    symbolCache_.emplace(x.second, std::move(symbolName));
   }
-  logInfo(1, "Total %d unique Python symbols\n", symbols.size());
-  return symbols;
+  logInfo(1, "Total %d unique Python symbols\n", symbolCache_.size());
+  return symbolCache_;
 }
 
 std::string PyPerfUtil::getSymbolName(Symbol& sym) const {
@@ -325,7 +505,7 @@ std::string PyPerfUtil::getSymbolName(Symbol& sym) const {
 }
 
 bool PyPerfUtil::tryTargetPid(int pid, PidData& data) {
-  FindPythonPathHelper helper{pid, false, 0, 0};
+  FindPythonPathHelper helper{pid, false, 0, 0, ""};
   bcc_procutils_each_module(pid, &findPythonPathCallback, &helper);
   if (!helper.found) {
     logInfo(2, "PID %d does not contain Python library\n", pid);
@@ -339,6 +519,15 @@ bool PyPerfUtil::tryTargetPid(int pid, PidData& data) {
     return false;
   }
 
+  OffsetConfig offsets;
+  if (!resolveOffsetConfig(path, helper.libName, offsets)) {
+    logInfo(1,
+            "PID %d: no struct offsets known for %s; provide a "
+            "<build-id>.offsets file under BCC_PYPERF_OFFSET_CACHE_DIR\n",
+            pid, helper.libName.c_str());
+    return false;
+  }
+
   if (!getAddrOfPythonBinary(path, data)) {
     std::fprintf(
         stderr,
@@ -346,7 +535,7 @@ bool PyPerfUtil::tryTargetPid(int pid, PidData& data) {
         pid);
     return false;
   }
-  data.offsets = kPy36OffsetConfig;
+  data.offsets = offsets;
   data.current_state_addr += helper.st;
   logInfo(2, "PID %d has _PyThreadState_Current at %lx\n", pid,
           data.current_state_addr);
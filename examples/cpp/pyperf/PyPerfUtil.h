@@ -57,6 +57,13 @@ class PyPerfUtil {
   std::string getSymbolName(Symbol& sym) const;
 
   bool tryTargetPid(int pid, PidData& data);
+
+  void flushBatch(PyPerfSampleProcessor* processor);
+  static void aggregateSamples(std::vector<PyPerfSample>& samples);
+
+  // interned symbol names, grown incrementally so repeated symbol mapping
+  // requests only pay for ids not seen before
+  std::unordered_map<int32_t, std::string> symbolCache_;
 };
 }  // namespace pyperf
 }  // namespace ebpf
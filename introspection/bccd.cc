@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) PLUMgrid, Inc.
+ * Licensed under the Apache License, Version 2.0 (the "License")
+ */
+
+// bccd: host-local BPF compile daemon.
+//
+// A long-lived process that keeps Clang/LLVM warm and serves compile
+// requests from libbcc clients over a unix stream socket. Clients opt in
+// by pointing BCC_COMPILE_DAEMON at the socket; on an object-cache miss
+// libbcc ships {flags, text, cflags} here instead of starting a compiler
+// of its own, and gets back a relocatable artifact in the object-cache
+// format. The client performs only map creation and instruction loading,
+// so ad-hoc CLI tools start in tens of milliseconds while only this
+// process pays compiler memory.
+//
+// Compiled artifacts are spooled on disk keyed on the request and the
+// kernel identity (release + vmlinux BTF), so repeated requests are
+// served without recompiling even across daemon restarts.
+//
+// Protocol (all integers host-endian, strings length-prefixed with u64):
+//   request: u32 magic, u32 version, u32 flags, u32 ncflags,
+//            str text, str cflag * ncflags
+//   reply:   u32 status, str payload
+// status 0 carries the artifact; any other status carries diagnostic text.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "bpf_module.h"
+
+static const uint32_t COMPILE_DAEMON_MAGIC = 0xb0ccdae1;
+static const uint32_t COMPILE_DAEMON_VERSION = 1;
+
+static const size_t MAX_TEXT = 16 << 20;
+static const size_t MAX_CFLAG = 1 << 20;
+static const uint32_t MAX_NCFLAGS = 1024;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int) { stop_requested = 1; }
+
+static bool io_full(int fd, void *buf, size_t len, bool do_write) {
+  char *p = static_cast<char *>(buf);
+  while (len > 0) {
+    ssize_t n = do_write ? write(fd, p, len) : read(fd, p, len);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR)
+        continue;
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool read_str(int fd, size_t max_len, std::string *s) {
+  uint64_t len;
+  if (!io_full(fd, &len, sizeof(len), false) || len > max_len)
+    return false;
+  s->resize(len);
+  return len == 0 || io_full(fd, &(*s)[0], len, false);
+}
+
+static void reply(int fd, uint32_t status, const std::string &payload) {
+  uint64_t len = payload.size();
+  io_full(fd, &status, sizeof(status), true);
+  io_full(fd, &len, sizeof(len), true);
+  if (len > 0)
+    io_full(fd, const_cast<char *>(payload.data()), len, true);
+}
+
+// 128-bit FNV-1a-style key over the request and the kernel identity. Not
+// cryptographic — the spool is host-local and owned by this daemon — but
+// wide enough that accidental collisions are not a practical concern.
+static std::string spool_key(uint32_t flags, const std::string &text,
+                             const std::vector<std::string> &cflags) {
+  uint64_t h[2] = {0xcbf29ce484222325ull, 0x84222325cbf29ce4ull};
+  auto mix = [&h](const void *data, size_t len) {
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < len; i++) {
+      h[0] = (h[0] ^ p[i]) * 0x100000001b3ull;
+      h[1] = (h[1] ^ p[i]) * 0x00000100000001b3ull + 0x9e3779b9ull;
+    }
+  };
+  mix(&flags, sizeof(flags));
+  mix(text.data(), text.size());
+  for (const auto &f : cflags)
+    mix(f.data(), f.size() + 1);
+
+  struct utsname un;
+  if (uname(&un) == 0)
+    mix(un.release, strlen(un.release));
+  struct stat st;
+  if (stat("/sys/kernel/btf/vmlinux", &st) == 0) {
+    mix(&st.st_size, sizeof(st.st_size));
+    mix(&st.st_mtime, sizeof(st.st_mtime));
+  }
+
+  char buf[33];
+  snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)h[0],
+           (unsigned long long)h[1]);
+  return buf;
+}
+
+static bool slurp(const std::string &path, std::string *out) {
+  std::ifstream is(path, std::ios::binary | std::ios::ate);
+  if (!is.is_open())
+    return false;
+  out->resize(is.tellg());
+  is.seekg(0);
+  is.read(&(*out)[0], out->size());
+  return !is.fail();
+}
+
+static void handle_request(int cfd, const std::string &spool_dir,
+                           bool verbose) {
+  uint32_t hdr[4];
+  if (!io_full(cfd, hdr, sizeof(hdr), false) ||
+      hdr[0] != COMPILE_DAEMON_MAGIC || hdr[1] != COMPILE_DAEMON_VERSION ||
+      hdr[3] > MAX_NCFLAGS) {
+    reply(cfd, 1, "bad request header");
+    return;
+  }
+  uint32_t flags = hdr[2], ncflags = hdr[3];
+
+  std::string text;
+  std::vector<std::string> cflags(ncflags);
+  if (!read_str(cfd, MAX_TEXT, &text)) {
+    reply(cfd, 1, "bad request text");
+    return;
+  }
+  for (uint32_t i = 0; i < ncflags; i++) {
+    if (!read_str(cfd, MAX_CFLAG, &cflags[i])) {
+      reply(cfd, 1, "bad request cflags");
+      return;
+    }
+  }
+
+  std::string path =
+      spool_dir + "/bccd_" + spool_key(flags, text, cflags) + ".cache";
+  std::string blob;
+  if (slurp(path, &blob)) {
+    if (verbose)
+      fprintf(stderr, "bccd: spool hit %s (%zu bytes)\n", path.c_str(),
+              blob.size());
+    reply(cfd, 0, blob);
+    return;
+  }
+
+  std::vector<const char *> cfl;
+  for (const auto &f : cflags)
+    cfl.push_back(f.c_str());
+
+  // compile into a private file first so a failed compile never leaves a
+  // partial spool entry behind
+  std::string tmp_path = path + ".tmp";
+  ebpf::BPFModule mod(flags, nullptr, false /* rw_engine */);
+  if (mod.set_object_output(tmp_path) != 0 ||
+      mod.load_string(text, cfl.data(), cfl.size()) != 0 ||
+      !slurp(tmp_path, &blob)) {
+    unlink(tmp_path.c_str());
+    reply(cfd, 1, "compile failed (see daemon stderr)");
+    return;
+  }
+  rename(tmp_path.c_str(), path.c_str());
+  if (verbose)
+    fprintf(stderr, "bccd: compiled %s (%zu bytes)\n", path.c_str(),
+            blob.size());
+  reply(cfd, 0, blob);
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "Usage: %s [-s SOCKET] [-d SPOOL_DIR] [-v]\n"
+          "  -s SOCKET     unix socket to listen on (default %s)\n"
+          "  -d SPOOL_DIR  artifact spool directory (default %s)\n"
+          "  -v            log one line per served request\n"
+          "Point BCC_COMPILE_DAEMON at SOCKET to make libbcc clients use "
+          "the daemon.\n",
+          argv0, "/var/run/bccd.sock", "/var/cache/bccd");
+}
+
+int main(int argc, char **argv) {
+  const char *sock_path = "/var/run/bccd.sock";
+  const char *spool_dir = "/var/cache/bccd";
+  bool verbose = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "s:d:vh")) != -1) {
+    switch (opt) {
+      case 's':
+        sock_path = optarg;
+        break;
+      case 'd':
+        spool_dir = optarg;
+        break;
+      case 'v':
+        verbose = true;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  if (mkdir(spool_dir, 0700) != 0 && errno != EEXIST) {
+    fprintf(stderr, "bccd: cannot create spool dir %s: %s\n", spool_dir,
+            strerror(errno));
+    return 1;
+  }
+
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (strlen(sock_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "bccd: socket path too long\n");
+    return 1;
+  }
+  strcpy(addr.sun_path, sock_path);
+
+  int sfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sfd < 0) {
+    perror("bccd: socket");
+    return 1;
+  }
+  unlink(sock_path);
+  if (bind(sfd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) <
+          0 ||
+      listen(sfd, 16) < 0) {
+    perror("bccd: bind/listen");
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  if (verbose)
+    fprintf(stderr, "bccd: listening on %s, spool %s\n", sock_path,
+            spool_dir);
+
+  // requests are served sequentially: one warm compiler, one compile at a
+  // time, which also naturally coalesces a thundering herd of identical
+  // requests into one compile plus spool hits
+  while (!stop_requested) {
+    int cfd = accept(sfd, nullptr, nullptr);
+    if (cfd < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("bccd: accept");
+      break;
+    }
+    handle_request(cfd, spool_dir, verbose);
+    close(cfd);
+  }
+
+  close(sfd);
+  unlink(sock_path);
+  return 0;
+}
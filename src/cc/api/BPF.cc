@@ -15,23 +15,37 @@
  */
 
 #include <linux/bpf.h>
+#include <linux/if_link.h>
 #include <linux/perf_event.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
+#include <linux/limits.h>
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
 #include <cstdio>
 #include <cstring>
+#include <dirent.h>
 #include <exception>
 #include <fcntl.h>
+#include <functional>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <set>
 #include <sstream>
+#include <sys/file.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <utility>
 #include <vector>
 
 #include "bcc_exception.h"
 #include "bcc_elf.h"
+#include "bcc_stats.h"
 #include "bcc_syms.h"
+#include "bcc_btf.h"
 #include "bpf_module.h"
 #include "common.h"
 #include "libbpf.h"
@@ -42,43 +56,16 @@
 
 #include "BPF.h"
 
-namespace {
-/*
- * Kernels ~4.20 and later support specifying the ref_ctr_offset as an argument
- * to attaching a uprobe, which negates the need to seek to this memory offset
- * in userspace to manage semaphores, as the kernel will do it for us.  This
- * helper function checks if this support is available by reading the uprobe
- * format for this value, added in a6ca88b241d5e929e6e60b12ad8cd288f0ffa
-*/
-bool uprobe_ref_ctr_supported() {
-  const char *ref_ctr_pmu_path =
-      "/sys/bus/event_source/devices/uprobe/format/ref_ctr_offset";
-  const char *ref_ctr_pmu_expected = "config:32-63\0";
-  char ref_ctr_pmu_fmt[64];  // in Linux source this buffer is compared vs
-                             // PAGE_SIZE, but 64 is probably ample
-  int fd = open(ref_ctr_pmu_path, O_RDONLY);
-  if (fd < 0)
-    return false;
-
-  int ret = read(fd, ref_ctr_pmu_fmt, sizeof(ref_ctr_pmu_fmt));
-  close(fd);
-  if (ret < 0) {
-    return false;
-  }
-  if (strncmp(ref_ctr_pmu_expected, ref_ctr_pmu_fmt,
-              strlen(ref_ctr_pmu_expected)) == 0) {
-    return true;
-  }
-  return false;
-}
-} // namespace
-
 namespace ebpf {
 
+// the support probe lives with the USDT machinery now that both layers
+// gate semaphore handling on it
+using ::USDT::uprobe_ref_ctr_supported;
+
 std::string uint_to_hex(uint64_t value) {
-  std::stringstream ss;
-  ss << std::hex << value;
-  return ss.str();
+  char buf[17];
+  ::snprintf(buf, sizeof(buf), "%" PRIx64, value);
+  return buf;
 }
 
 std::string sanitize_str(std::string str, bool (*validator)(char),
@@ -89,6 +76,64 @@ std::string sanitize_str(std::string str, bool (*validator)(char),
   return str;
 }
 
+namespace {
+
+constexpr size_t kEventNameSizeLimit = 224;
+
+std::string shorten_event_name(const std::string& name) {
+  std::string hash = uint_to_hex(std::hash<std::string>{}(name));
+  return name.substr(0, kEventNameSizeLimit - hash.size()) + hash;
+}
+
+// Builds probe event names in a fixed stack buffer so the attach fast path
+// performs a single allocation (the returned map key) instead of a chain of
+// string temporaries. Sized for the worst case of a PATH_MAX binary path
+// plus prefix, offset and pid suffixes; names over kEventNameSizeLimit are
+// hashed down by finish() the same way oversized names always were.
+class EventNameBuilder {
+ public:
+  EventNameBuilder& append(char c) {
+    if (len_ < sizeof(buf_))
+      buf_[len_] = c;
+    len_++;
+    return *this;
+  }
+  EventNameBuilder& append(const char* s) {
+    for (; *s; s++)
+      append(*s);
+    return *this;
+  }
+  EventNameBuilder& append_sanitized(const std::string& s,
+                                     bool (*validator)(char),
+                                     char replacement = '_') {
+    for (char c : s)
+      append(validator(c) ? c : replacement);
+    return *this;
+  }
+  EventNameBuilder& append_hex(uint64_t value) {
+    char tmp[17];
+    ::snprintf(tmp, sizeof(tmp), "%" PRIx64, value);
+    return append(tmp);
+  }
+  EventNameBuilder& append_dec(uint64_t value) {
+    char tmp[21];
+    ::snprintf(tmp, sizeof(tmp), "%" PRIu64, value);
+    return append(tmp);
+  }
+  std::string finish() const {
+    size_t len = std::min(len_, sizeof(buf_));
+    if (len > kEventNameSizeLimit)
+      return shorten_event_name(std::string(buf_, len));
+    return std::string(buf_, len);
+  }
+
+ private:
+  char buf_[PATH_MAX + 64];
+  size_t len_ = 0;
+};
+
+}  // namespace
+
 StatusTuple BPF::init_usdt(const USDT& usdt) {
   USDT u(usdt);
   StatusTuple init_stp = u.init();
@@ -109,13 +154,19 @@ void BPF::init_fail_reset() {
 StatusTuple BPF::init(const std::string& bpf_program,
                       const std::vector<std::string>& cflags,
                       const std::vector<USDT>& usdt) {
-  usdt_.reserve(usdt.size());
-  for (const auto& u : usdt) {
-    StatusTuple init_stp = init_usdt(u);
-    if (!init_stp.ok()) {
-      init_fail_reset();
-      return init_stp;
+  uint64_t span;
+
+  if (!usdt.empty()) {
+    span = bcc_trace_begin();
+    usdt_.reserve(usdt.size());
+    for (const auto& u : usdt) {
+      StatusTuple init_stp = init_usdt(u);
+      if (!init_stp.ok()) {
+        init_fail_reset();
+        return init_stp;
+      }
     }
+    bcc_trace_end("usdt_init", span);
   }
 
   std::vector<const char*> flags;
@@ -123,16 +174,85 @@ StatusTuple BPF::init(const std::string& bpf_program,
     flags.push_back(c.c_str());
 
   all_bpf_program_ += bpf_program;
+  span = bcc_trace_begin();
   if (bpf_module_->load_string(all_bpf_program_,
                                flags.data(),
                                flags.size()) != 0) {
     init_fail_reset();
     return StatusTuple(-1, "Unable to initialize BPF program");
   }
+  bcc_trace_end("load_string", span);
 
   return StatusTuple::OK();
 };
 
+StatusTuple BPF::init_with_artifact(const std::string& bpf_program,
+                                    const std::string& artifact_path,
+                                    const std::vector<std::string>& cflags) {
+  if (bpf_module_->set_object_output(artifact_path) != 0)
+    return StatusTuple(-1,
+                       "Unable to emit artifact to %s (requires "
+                       "rw_engine_enabled = false)",
+                       artifact_path.c_str());
+  TRY2(init(bpf_program, cflags, {}));
+  // shared/extern tables reference maps outside this module and cannot be
+  // replayed from an artifact; emission is skipped for them, so verify the
+  // file actually landed
+  if (::access(artifact_path.c_str(), R_OK) != 0)
+    return StatusTuple(-1, "Artifact %s was not written",
+                       artifact_path.c_str());
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::set_map_tuning(const std::string& name,
+                                const BPFModule::MapTuning& tuning) {
+  if (bpf_module_->set_map_tuning(name, tuning) != 0)
+    return StatusTuple(-1, "set_map_tuning for %s must precede init()",
+                       name.c_str());
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::set_config(const std::string& name, uint64_t value) {
+  if (bpf_module_->set_config(name, value) != 0)
+    return StatusTuple(-1, "Unable to set config %s", name.c_str());
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::init_from_artifact(const std::string& artifact_path) {
+  if (bpf_module_->load_object(artifact_path) != 0)
+    return StatusTuple(-1, "Unable to load BPF artifact %s",
+                       artifact_path.c_str());
+  return StatusTuple::OK();
+}
+
+std::vector<StatusTuple> BPF::init_batch(
+    const std::vector<std::pair<BPF*, std::string>>& jobs,
+    const std::vector<std::string>& cflags) {
+  std::vector<StatusTuple> results(jobs.size(), StatusTuple::OK());
+  if (jobs.empty())
+    return results;
+
+  // each BPFModule owns its LLVMContext, so whole programs can compile
+  // concurrently; the first one runs alone to get the one-time LLVM target
+  // and Clang setup out of the way before threads race through it
+  results[0] = jobs[0].first->init(jobs[0].second, cflags);
+  if (jobs.size() == 1)
+    return results;
+
+  std::atomic<size_t> next(1);
+  size_t nworkers = std::min(jobs.size() - 1, (size_t)4);
+  std::vector<std::thread> workers;
+  workers.reserve(nworkers);
+  for (size_t i = 0; i < nworkers; i++)
+    workers.emplace_back([&] {
+      for (size_t idx = next++; idx < jobs.size(); idx = next++)
+        results[idx] = jobs[idx].first->init(jobs[idx].second, cflags);
+    });
+  for (auto& w : workers)
+    w.join();
+  return results;
+}
+
 BPF::~BPF() {
   auto res = detach_all();
   if (!res.ok())
@@ -142,7 +262,255 @@ BPF::~BPF() {
   bsymcache_ = NULL;
 }
 
+BPF::AsyncPool::~AsyncPool() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  for (auto& w : workers_)
+    w.join();
+}
+
+std::future<StatusTuple> BPF::AsyncPool::submit(
+    std::function<StatusTuple()> task) {
+  std::packaged_task<StatusTuple()> pt(std::move(task));
+  auto fut = pt.get_future();
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (workers_.empty())
+      // first submission; start the workers
+      for (size_t i = 0; i < kWorkers; i++)
+        workers_.emplace_back([this] {
+          while (true) {
+            std::packaged_task<StatusTuple()> t;
+            {
+              std::unique_lock<std::mutex> lock(mutex_);
+              cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+              if (tasks_.empty())
+                return;
+              t = std::move(tasks_.front());
+              tasks_.pop_front();
+            }
+            t();
+          }
+        });
+    tasks_.push_back(std::move(pt));
+  }
+  cv_.notify_one();
+  return fut;
+}
+
+std::future<StatusTuple> BPF::attach_kprobe_async(
+    const std::string& kernel_func, const std::string& probe_func,
+    uint64_t kernel_func_offset, bpf_probe_attach_type attach_type,
+    int maxactive) {
+  return async_pool_.submit([=] {
+    return attach_kprobe(kernel_func, probe_func, kernel_func_offset,
+                         attach_type, maxactive);
+  });
+}
+
+std::future<StatusTuple> BPF::attach_uprobe_async(
+    const std::string& binary_path, const std::string& symbol,
+    const std::string& probe_func, uint64_t symbol_addr,
+    bpf_probe_attach_type attach_type, pid_t pid, uint64_t symbol_offset,
+    uint32_t ref_ctr_offset) {
+  return async_pool_.submit([=] {
+    return attach_uprobe(binary_path, symbol, probe_func, symbol_addr,
+                         attach_type, pid, symbol_offset, ref_ctr_offset);
+  });
+}
+
+std::future<StatusTuple> BPF::detach_all_async() {
+  return async_pool_.submit([this] { return detach_all_parallel(); });
+}
+
+// detach_all(), but the independent per-probe detaches run on a scoped team
+// of worker threads so a shutdown with thousands of probes takes roughly the
+// time of the slowest single detach.
+StatusTuple BPF::detach_all_parallel() {
+  std::vector<std::function<StatusTuple()>> tasks;
+  {
+    std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
+
+    for (auto& it : kprobes_) {
+      std::string event = it.first;
+      open_probe_t attr = it.second;
+      tasks.emplace_back([this, event, attr]() mutable {
+        auto res = detach_kprobe_event(event, attr);
+        if (!res.ok())
+          return StatusTuple(-1, "Failed to detach kprobe event %s: %s",
+                             event.c_str(), res.msg().c_str());
+        return StatusTuple::OK();
+      });
+    }
+    kprobes_.clear();
+
+    for (auto& it : kprobe_multi_links_) {
+      std::string name = it.first;
+      int fd = it.second;
+      tasks.emplace_back([name, fd] {
+        if (close(fd) != 0)
+          return StatusTuple(-1, "Failed to close kprobe_multi link for %s",
+                             name.c_str());
+        return StatusTuple::OK();
+      });
+    }
+    kprobe_multi_links_.clear();
+
+    for (auto& it : uprobes_) {
+      std::string event = it.first;
+      open_probe_t attr = it.second;
+      tasks.emplace_back([this, event, attr]() mutable {
+        auto res = detach_uprobe_event(event, attr);
+        if (!res.ok())
+          return StatusTuple(-1, "Failed to detach uprobe event %s: %s",
+                             event.c_str(), res.msg().c_str());
+        return StatusTuple::OK();
+      });
+    }
+    uprobes_.clear();
+    uprobe_ref_counts_.clear();
+
+    for (auto& it : tracepoints_) {
+      std::string name = it.first;
+      open_probe_t attr = it.second;
+      tasks.emplace_back([this, name, attr]() mutable {
+        auto res = detach_tracepoint_event(name, attr);
+        if (!res.ok())
+          return StatusTuple(-1, "Failed to detach Tracepoint %s: %s",
+                             name.c_str(), res.msg().c_str());
+        return StatusTuple::OK();
+      });
+    }
+    tracepoints_.clear();
+
+    for (auto& it : raw_tracepoints_) {
+      std::string name = it.first;
+      open_probe_t attr = it.second;
+      tasks.emplace_back([this, name, attr]() mutable {
+        auto res = detach_raw_tracepoint_event(name, attr);
+        if (!res.ok())
+          return StatusTuple(-1, "Failed to detach Raw tracepoint %s: %s",
+                             name.c_str(), res.msg().c_str());
+        return StatusTuple::OK();
+      });
+    }
+    raw_tracepoints_.clear();
+
+    for (auto& it : xdp_probes_) {
+      std::string ifname = it.first;
+      open_xdp_t attr = it.second;
+      tasks.emplace_back([this, ifname, attr]() mutable {
+        auto res = detach_xdp_event(ifname, attr);
+        if (!res.ok())
+          return StatusTuple(-1, "Failed to detach XDP program from %s: %s",
+                             ifname.c_str(), res.msg().c_str());
+        return StatusTuple::OK();
+      });
+    }
+    xdp_probes_.clear();
+
+    std::lock_guard<std::mutex> buffers_gate(buffers_gate_);
+  std::unique_lock<std::shared_timed_mutex> buffers_lock(buffers_mutex_);
+    for (auto& it : perf_buffers_) {
+      std::string name = it.first;
+      BPFPerfBuffer* buf = it.second;
+      tasks.emplace_back([name, buf] {
+        auto res = buf->close_all_cpu();
+        delete buf;
+        if (!res.ok())
+          return StatusTuple(-1, "Failed to close perf buffer %s: %s",
+                             name.c_str(), res.msg().c_str());
+        return StatusTuple::OK();
+      });
+    }
+    perf_buffers_.clear();
+
+    for (auto& it : ring_buffers_) {
+      std::string name = it.first;
+      BPFRingBuffer* buf = it.second;
+      tasks.emplace_back([name, buf] {
+        auto res = buf->close_ring_buffer();
+        delete buf;
+        if (!res.ok())
+          return StatusTuple(-1, "Failed to close ring buffer %s: %s",
+                             name.c_str(), res.msg().c_str());
+        return StatusTuple::OK();
+      });
+    }
+    ring_buffers_.clear();
+
+    for (auto& it : perf_event_arrays_) {
+      std::string name = it.first;
+      BPFPerfEventArray* arr = it.second;
+      tasks.emplace_back([name, arr] {
+        auto res = arr->close_all_cpu();
+        delete arr;
+        if (!res.ok())
+          return StatusTuple(-1, "Failed to close perf event array %s: %s",
+                             name.c_str(), res.msg().c_str());
+        return StatusTuple::OK();
+      });
+    }
+    perf_event_arrays_.clear();
+
+    for (auto& it : perf_events_) {
+      open_probe_t attr = it.second;
+      tasks.emplace_back(
+          [this, attr]() mutable { return detach_perf_event_all_cpu(attr); });
+    }
+    perf_events_.clear();
+  }
+
+  // each worker writes only its own result slots, so no result locking
+  std::vector<StatusTuple> results(tasks.size(), StatusTuple::OK());
+  size_t nworkers = std::min(tasks.size(), (size_t)8);
+  if (nworkers > 1) {
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    workers.reserve(nworkers);
+    for (size_t i = 0; i < nworkers; i++)
+      workers.emplace_back([&] {
+        for (size_t idx = next++; idx < tasks.size(); idx = next++)
+          results[idx] = tasks[idx]();
+      });
+    for (auto& w : workers)
+      w.join();
+  } else {
+    for (size_t i = 0; i < tasks.size(); i++)
+      results[i] = tasks[i]();
+  }
+
+  bool has_error = false;
+  std::string error_msg;
+  for (auto& res : results)
+    if (!res.ok()) {
+      error_msg += res.msg() + "\n";
+      has_error = true;
+    }
+
+  // the detaches above unload the programs they own; close whatever remains
+  {
+    std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
+    for (auto& it : funcs_) {
+      if (close(it.second) != 0) {
+        error_msg += "Failed to unload BPF program for " + it.first + ": ";
+        error_msg += std::string(std::strerror(errno)) + "\n";
+        has_error = true;
+      }
+    }
+    funcs_.clear();
+  }
+
+  if (has_error)
+    return StatusTuple(-1, error_msg);
+  return StatusTuple::OK();
+}
+
 StatusTuple BPF::detach_all() {
+  std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
   bool has_error = false;
   std::string error_msg;
 
@@ -155,6 +523,14 @@ StatusTuple BPF::detach_all() {
     }
   }
 
+  for (auto& it : kprobe_multi_links_) {
+    if (close(it.second) != 0) {
+      error_msg += "Failed to close kprobe_multi link for " + it.first + "\n";
+      has_error = true;
+    }
+  }
+  kprobe_multi_links_.clear();
+
   for (auto& it : uprobes_) {
     auto res = detach_uprobe_event(it.first, it.second);
     if (!res.ok()) {
@@ -182,6 +558,17 @@ StatusTuple BPF::detach_all() {
     }
   }
 
+  for (auto& it : xdp_probes_) {
+    auto res = detach_xdp_event(it.first, it.second);
+    if (!res.ok()) {
+      error_msg += "Failed to detach XDP program from " + it.first + ": ";
+      error_msg += res.msg() + "\n";
+      has_error = true;
+    }
+  }
+
+  std::lock_guard<std::mutex> buffers_gate(buffers_gate_);
+  std::unique_lock<std::shared_timed_mutex> buffers_lock(buffers_mutex_);
   for (auto& it : perf_buffers_) {
     auto res = it.second->close_all_cpu();
     if (!res.ok()) {
@@ -192,6 +579,16 @@ StatusTuple BPF::detach_all() {
     delete it.second;
   }
 
+  for (auto& it : ring_buffers_) {
+    auto res = it.second->close_ring_buffer();
+    if (!res.ok()) {
+      error_msg += "Failed to close ring buffer " + it.first + ": ";
+      error_msg += res.msg() + "\n";
+      has_error = true;
+    }
+    delete it.second;
+  }
+
   for (auto& it : perf_event_arrays_) {
     auto res = it.second->close_all_cpu();
     if (!res.ok()) {
@@ -225,33 +622,702 @@ StatusTuple BPF::detach_all() {
     return StatusTuple::OK();
 }
 
+namespace {
+
+// close a sorted slab of fds, one close_range(2) per contiguous run where
+// the kernel supports it; returns the number of failed closes
+size_t close_fd_slab(std::vector<int>& fds) {
+  std::sort(fds.begin(), fds.end());
+  fds.erase(std::unique(fds.begin(), fds.end()), fds.end());
+
+  size_t failures = 0;
+  size_t i = 0;
+  while (i < fds.size()) {
+    size_t j = i;
+    while (j + 1 < fds.size() && fds[j + 1] == fds[j] + 1)
+      j++;
+#ifdef __NR_close_range
+    if (j > i && ::syscall(__NR_close_range, (unsigned int)fds[i],
+                           (unsigned int)fds[j], 0) == 0) {
+      i = j + 1;
+      continue;
+    }
+#endif
+    if (::close(fds[i]) != 0)
+      failures++;
+    i++;
+  }
+  return failures;
+}
+
+}  // namespace
+
+StatusTuple BPF::detach_all_fast() {
+  std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
+  size_t failures = 0;
+
+  // contiguous slab of every raw fd we own; one batched close pass replaces
+  // the per-probe disable/close/unload round trips of detach_all()
+  std::vector<int> fds;
+  fds.reserve(kprobes_.size() + uprobes_.size() + tracepoints_.size() +
+              raw_tracepoints_.size() + kprobe_multi_links_.size() +
+              perf_events_.size() + funcs_.size());
+
+  auto collect = [&fds](std::map<std::string, open_probe_t>& probes) {
+    for (auto& it : probes) {
+      if (it.second.perf_event_fd >= 0)
+        fds.push_back(it.second.perf_event_fd);
+      if (it.second.per_cpu_fd) {
+        for (auto& cpu_fd : *it.second.per_cpu_fd)
+          fds.push_back(cpu_fd.second);
+        delete it.second.per_cpu_fd;
+        it.second.per_cpu_fd = nullptr;
+      }
+    }
+  };
+  collect(kprobes_);
+  collect(uprobes_);
+  collect(tracepoints_);
+  collect(raw_tracepoints_);
+  for (auto& it : perf_events_) {
+    if (it.second.perf_event_fd >= 0)
+      fds.push_back(it.second.perf_event_fd);
+    if (it.second.per_cpu_fd) {
+      for (auto& cpu_fd : *it.second.per_cpu_fd)
+        fds.push_back(cpu_fd.second);
+      delete it.second.per_cpu_fd;
+      it.second.per_cpu_fd = nullptr;
+    }
+  }
+  for (auto& it : kprobe_multi_links_)
+    fds.push_back(it.second);
+  for (auto& it : funcs_)
+    fds.push_back(it.second);
+
+  failures += close_fd_slab(fds);
+
+  // legacy kernels track probes in debugfs; removing those entries still
+  // takes one write per event, but is a no-op on PMU-based kernels
+  for (auto& it : kprobes_)
+    if (bpf_detach_kprobe(it.first.c_str()) < 0)
+      failures++;
+  for (auto& it : uprobes_)
+    if (bpf_detach_uprobe(it.first.c_str()) < 0)
+      failures++;
+
+  // XDP attachments are netlink-based, not fd-based; the program fds went
+  // into the slab with funcs_, but each interface still needs a detach
+  for (auto& it : xdp_probes_)
+    if (bpf_try_attach_xdp(it.first.c_str(), -1, it.second.mode) != 0)
+      failures++;
+
+  std::lock_guard<std::mutex> buffers_gate(buffers_gate_);
+  std::unique_lock<std::shared_timed_mutex> buffers_lock(buffers_mutex_);
+  for (auto& it : perf_buffers_) {
+    if (!it.second->close_all_cpu().ok())
+      failures++;
+    delete it.second;
+  }
+  for (auto& it : ring_buffers_) {
+    if (!it.second->close_ring_buffer().ok())
+      failures++;
+    delete it.second;
+  }
+  for (auto& it : perf_event_arrays_) {
+    if (!it.second->close_all_cpu().ok())
+      failures++;
+    delete it.second;
+  }
+
+  kprobes_.clear();
+  uprobes_.clear();
+  uprobe_ref_counts_.clear();
+  tracepoints_.clear();
+  raw_tracepoints_.clear();
+  kprobe_multi_links_.clear();
+  xdp_probes_.clear();
+  perf_events_.clear();
+  perf_buffers_.clear();
+  ring_buffers_.clear();
+  perf_event_arrays_.clear();
+  funcs_.clear();
+
+  if (failures)
+    return StatusTuple(-1, "detach_all_fast: %zu operations failed",
+                       failures);
+  return StatusTuple::OK();
+}
+
+// Load probe_func as a BPF_PROG_TYPE_TRACING program targeting kernel_func
+// and attach it via a BTF trampoline. The synthesized load name carries the
+// attach target so bcc_prog_load resolves the attach_btf_id; the verifier is
+// the eligibility gate -- the target must be in vmlinux BTF and the program
+// body must verify against the trampoline context (a body reading pt_regs
+// through the ctx pointer is rejected), in which case the caller falls back
+// to a regular kprobe.
+StatusTuple BPF::attach_kprobe_as_trampoline(const std::string& kernel_func,
+                                             const std::string& probe_func,
+                                             bpf_probe_attach_type attach_type) {
+  std::string probe_event = get_kprobe_event(kernel_func, attach_type);
+  std::string load_name = (attach_type == BPF_PROBE_ENTRY
+                               ? "kfunc__vmlinux__"
+                               : "kretfunc__vmlinux__") +
+                          kernel_func;
+
+  std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
+  if (kprobes_.find(probe_event) != kprobes_.end())
+    return StatusTuple(-1, "kprobe %s already attached", probe_event.c_str());
+
+  int probe_fd;
+  if (funcs_.find(load_name) != funcs_.end()) {
+    probe_fd = funcs_[load_name];
+  } else {
+    uint8_t* func_start = bpf_module_->function_start(probe_func);
+    if (!func_start)
+      return StatusTuple(-1, "Can't find start of function %s",
+                         probe_func.c_str());
+    size_t func_size = bpf_module_->function_size(probe_func);
+    probe_fd = bpf_module_->bcc_func_load(
+        BPF_PROG_TYPE_TRACING, load_name.c_str(),
+        reinterpret_cast<struct bpf_insn*>(func_start), func_size,
+        bpf_module_->license(), bpf_module_->kern_version(), 0, nullptr, 0);
+    if (probe_fd < 0)
+      return StatusTuple(-1, "Unable to load %s as fentry/fexit for %s",
+                         probe_func.c_str(), kernel_func.c_str());
+    funcs_[load_name] = probe_fd;
+  }
+
+  int link_fd = bpf_attach_kfunc(probe_fd);
+  if (link_fd < 0) {
+    TRY2(unload_func(load_name));
+    return StatusTuple(-1, "Unable to attach trampoline for %s",
+                       kernel_func.c_str());
+  }
+
+  open_probe_t p = {};
+  p.perf_event_fd = link_fd;
+  p.func = load_name;
+  p.is_trampoline = true;
+  kprobes_[probe_event] = std::move(p);
+  return StatusTuple::OK();
+}
+
+// Shared kprobe dispatch (BCC_KPROBE_MUX): when several tools probe the
+// same hot kernel function, each normally pays for its own independent
+// kprobe entry. With BCC_KPROBE_MUX set to a bpffs directory, the first
+// tool to arrive attaches one dispatcher program per attach point and
+// later tools only register their (lightly rewritten) programs in a
+// pinned prog array the dispatcher tail-calls through, so a hit costs one
+// trampoline plus one direct jump per tool. Registered programs form a
+// chain: each slot's trailer tail-calls the next occupied slot, read from
+// a pinned "chain" array, with kMuxMaxSlots as the list terminator (an
+// out-of-range tail call falls through to exit). Registry mutation runs
+// under flock() of the directory, and the dispatcher attachment is held
+// by a pinned BPF link, so it survives the process that created it.
+namespace {
+
+constexpr unsigned kMuxMaxSlots = 64;
+// chain entry holding the first occupied slot
+constexpr unsigned kMuxHeadKey = kMuxMaxSlots;
+
+// flock guard on the mux directory; closing the fd drops the lock
+struct MuxLock {
+  int fd;
+  explicit MuxLock(const std::string& dir)
+      : fd(::open(dir.c_str(), O_RDONLY | O_DIRECTORY)) {
+    if (fd >= 0 && ::flock(fd, LOCK_EX) < 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+  ~MuxLock() {
+    if (fd >= 0)
+      ::close(fd);
+  }
+};
+
+int mux_chain_get(int chain_fd, unsigned key, unsigned* val) {
+  return bpf_lookup_elem(chain_fd, &key, val);
+}
+
+int mux_chain_set(int chain_fd, unsigned key, unsigned val) {
+  return bpf_update_elem(chain_fd, &key, &val, 0);
+}
+
+struct bpf_insn mux_insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off,
+                         int32_t imm) {
+  struct bpf_insn in = {};
+  in.code = code;
+  in.dst_reg = dst;
+  in.src_reg = src;
+  in.off = off;
+  in.imm = imm;
+  return in;
+}
+
+// Rewrite one tool program for chained dispatch from slot `slot`: a
+// prologue spills the ctx pointer to a stack slot below everything the
+// program itself touches, and every exit is redirected to a trailer that
+// looks up the next occupied slot in the chain map and tail-calls it,
+// falling through to exit at the end of the chain. The stack floor comes
+// from a conservative flow-insensitive scan of frame-pointer uses; if it
+// ever under-estimates, the spilled slot can only hold the same ctx
+// pointer again (harmless) or a non-ctx value the verifier rejects at
+// load time, so a bad estimate degrades to the plain per-tool attach,
+// never to wrong dispatch.
+bool mux_rewrite_chain(const struct bpf_insn* insns, size_t cnt, int chain_fd,
+                       int progs_fd, unsigned slot,
+                       std::vector<struct bpf_insn>& out) {
+  // bpf-to-bpf callees have their own frames and their exits are returns,
+  // not program exits; bcc programs are fully inlined, so just refuse
+  for (size_t i = 0; i < cnt; i++) {
+    if (insns[i].code == (BPF_JMP | BPF_CALL) &&
+        insns[i].src_reg == BPF_PSEUDO_CALL)
+      return false;
+    if (insns[i].code == (BPF_LD | BPF_DW | BPF_IMM))
+      i++;
+  }
+
+  // stack floor: direct r10-relative accesses, plus the most pessimistic
+  // combination of constants added to registers copied from r10 and
+  // memory offsets used through such registers
+  int32_t direct = 0, min_add = 0, min_memoff = 0;
+  uint16_t derived = 0;
+  bool grew = true;
+  while (grew) {
+    grew = false;
+    for (size_t i = 0; i < cnt; i++) {
+      const struct bpf_insn& in = insns[i];
+      if (in.code == (BPF_LD | BPF_DW | BPF_IMM)) {
+        i++;
+        continue;
+      }
+      uint8_t cls = BPF_CLASS(in.code);
+      if ((cls == BPF_ALU64 || cls == BPF_ALU) && BPF_OP(in.code) == BPF_MOV &&
+          BPF_SRC(in.code) == BPF_X &&
+          (in.src_reg == 10 || (derived & (1 << in.src_reg))) &&
+          !(derived & (1 << in.dst_reg))) {
+        derived |= 1 << in.dst_reg;
+        grew = true;
+      }
+    }
+  }
+  for (size_t i = 0; i < cnt; i++) {
+    const struct bpf_insn& in = insns[i];
+    if (in.code == (BPF_LD | BPF_DW | BPF_IMM)) {
+      i++;
+      continue;
+    }
+    uint8_t cls = BPF_CLASS(in.code);
+    if ((cls == BPF_ALU64 || cls == BPF_ALU) &&
+        (BPF_OP(in.code) == BPF_ADD || BPF_OP(in.code) == BPF_SUB) &&
+        BPF_SRC(in.code) == BPF_K && (derived & (1 << in.dst_reg))) {
+      int32_t delta = BPF_OP(in.code) == BPF_ADD ? in.imm : -in.imm;
+      if (delta < min_add)
+        min_add = delta;
+    } else if (cls == BPF_LDX || cls == BPF_STX || cls == BPF_ST) {
+      uint8_t base = cls == BPF_LDX ? in.src_reg : in.dst_reg;
+      if (base == 10 && in.off < direct)
+        direct = in.off;
+      else if ((derived & (1 << base)) && in.off < min_memoff)
+        min_memoff = in.off;
+    }
+  }
+  int32_t floor = std::min(direct, min_add + min_memoff);
+
+  int32_t base_off = (floor - 16) & ~7;  // [base] key, [base + 8] saved ctx
+  if (base_off < -512)
+    return false;
+  int32_t key_off = base_off, ctx_off = base_off + 8;
+
+  size_t trailer = 1 + cnt;
+  out.clear();
+  out.reserve(cnt + 15);
+  // prologue: *(u64 *)(r10 + ctx_off) = r1
+  out.push_back(mux_insn(BPF_STX | BPF_MEM | BPF_DW, 10, 1, ctx_off, 0));
+  for (size_t i = 0; i < cnt; i++) {
+    struct bpf_insn in = insns[i];
+    // relative jumps and pseudo calls keep working because the whole body
+    // shifts by one as a block; only program exits are redirected
+    if (in.code == (BPF_JMP | BPF_EXIT))
+      in = mux_insn(BPF_JMP | BPF_JA, 0, 0, (int16_t)(trailer - (1 + i) - 1),
+                    0);
+    out.push_back(in);
+  }
+  // trailer: r3 = chain[slot]; tail_call(ctx, progs, r3); exit
+  out.push_back(mux_insn(BPF_ST | BPF_MEM | BPF_W, 10, 0, key_off, slot));
+  out.push_back(mux_insn(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0));
+  out.push_back(mux_insn(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, key_off));
+  out.push_back(
+      mux_insn(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, chain_fd));
+  out.push_back(mux_insn(0, 0, 0, 0, 0));
+  out.push_back(mux_insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem));
+  out.push_back(mux_insn(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 5, 0));
+  out.push_back(mux_insn(BPF_LDX | BPF_MEM | BPF_W, 3, 0, 0, 0));
+  out.push_back(mux_insn(BPF_LDX | BPF_MEM | BPF_DW, 1, 10, ctx_off, 0));
+  out.push_back(
+      mux_insn(BPF_LD | BPF_DW | BPF_IMM, 2, BPF_PSEUDO_MAP_FD, 0, progs_fd));
+  out.push_back(mux_insn(0, 0, 0, 0, 0));
+  out.push_back(mux_insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_tail_call));
+  out.push_back(mux_insn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, 0));
+  out.push_back(mux_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+  return true;
+}
+
+// dispatcher: tail-call the head of the chain, or do nothing when empty
+void mux_dispatcher_insns(int chain_fd, int progs_fd,
+                          std::vector<struct bpf_insn>& out) {
+  out.clear();
+  out.push_back(mux_insn(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0));
+  out.push_back(mux_insn(BPF_ST | BPF_MEM | BPF_W, 10, 0, -4, kMuxHeadKey));
+  out.push_back(mux_insn(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0));
+  out.push_back(mux_insn(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -4));
+  out.push_back(
+      mux_insn(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, chain_fd));
+  out.push_back(mux_insn(0, 0, 0, 0, 0));
+  out.push_back(mux_insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem));
+  out.push_back(mux_insn(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 5, 0));
+  out.push_back(mux_insn(BPF_LDX | BPF_MEM | BPF_W, 3, 0, 0, 0));
+  out.push_back(mux_insn(BPF_ALU64 | BPF_MOV | BPF_X, 1, 6, 0, 0));
+  out.push_back(
+      mux_insn(BPF_LD | BPF_DW | BPF_IMM, 2, BPF_PSEUDO_MAP_FD, 0, progs_fd));
+  out.push_back(mux_insn(0, 0, 0, 0, 0));
+  out.push_back(mux_insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_tail_call));
+  out.push_back(mux_insn(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, 0));
+  out.push_back(mux_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+}
+
+}  // namespace
+
+StatusTuple BPF::attach_kprobe_as_mux(const std::string& kernel_func,
+                                      const std::string& probe_func,
+                                      bpf_probe_attach_type attach_type,
+                                      const std::string& mux_dir) {
+  std::string probe_event = get_kprobe_event(kernel_func, attach_type);
+  std::string progs_path = mux_dir + "/" + probe_event + "_progs";
+  std::string chain_path = mux_dir + "/" + probe_event + "_chain";
+  std::string link_path = mux_dir + "/" + probe_event + "_link";
+
+  std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
+  if (kprobes_.find(probe_event) != kprobes_.end())
+    return StatusTuple(-1, "kprobe %s already attached", probe_event.c_str());
+
+  uint8_t* func_start = bpf_module_->function_start(probe_func);
+  if (!func_start)
+    return StatusTuple(-1, "Can't find start of function %s",
+                       probe_func.c_str());
+  size_t func_size = bpf_module_->function_size(probe_func);
+
+  ::mkdir(mux_dir.c_str(), 0700);
+  MuxLock mux_lock(mux_dir);
+  if (mux_lock.fd < 0)
+    return StatusTuple(-1, "Unable to lock mux directory %s", mux_dir.c_str());
+
+  FileDesc progs_fd(bpf_obj_get(progs_path.c_str()));
+  FileDesc chain_fd(bpf_obj_get(chain_path.c_str()));
+  if (progs_fd < 0 || chain_fd < 0) {
+    // first tool on this attach point: create and pin the dispatch
+    // tables, then attach the dispatcher behind a pinned link
+    progs_fd = FileDesc(bcc_create_map(BPF_MAP_TYPE_PROG_ARRAY,
+                                       "bcc_mux_progs", sizeof(uint32_t),
+                                       sizeof(uint32_t), kMuxMaxSlots, 0));
+    chain_fd = FileDesc(bcc_create_map(BPF_MAP_TYPE_ARRAY, "bcc_mux_chain",
+                                       sizeof(uint32_t), sizeof(uint32_t),
+                                       kMuxMaxSlots + 1, 0));
+    if (progs_fd < 0 || chain_fd < 0)
+      return StatusTuple(-1, "Unable to create mux maps for %s",
+                         kernel_func.c_str());
+    for (unsigned i = 0; i <= kMuxMaxSlots; i++)
+      mux_chain_set(chain_fd, i, kMuxMaxSlots);
+
+    std::vector<struct bpf_insn> disp;
+    mux_dispatcher_insns(chain_fd, progs_fd, disp);
+    int disp_fd = bcc_prog_load(
+        BPF_PROG_TYPE_KPROBE, "bcc_mux_dispatch", disp.data(),
+        disp.size() * sizeof(struct bpf_insn), "GPL",
+        bpf_module_->kern_version(), 0, nullptr, 0);
+    if (disp_fd < 0)
+      return StatusTuple(-1, "Unable to load mux dispatcher for %s",
+                         kernel_func.c_str());
+    int link_fd =
+        bpf_attach_kprobe_link(disp_fd, attach_type, kernel_func.c_str());
+    ::close(disp_fd);  // the link holds the program
+    if (link_fd < 0)
+      return StatusTuple(
+          -1, "kprobe mux needs BPF perf-event links (kernel v5.15+)");
+    if (bpf_obj_pin(link_fd, link_path.c_str()) < 0 ||
+        bpf_obj_pin(progs_fd, progs_path.c_str()) < 0 ||
+        bpf_obj_pin(chain_fd, chain_path.c_str()) < 0) {
+      ::close(link_fd);
+      ::unlink(link_path.c_str());
+      ::unlink(progs_path.c_str());
+      ::unlink(chain_path.c_str());
+      return StatusTuple(-1, "Unable to pin mux objects under %s",
+                         mux_dir.c_str());
+    }
+    ::close(link_fd);  // the pin keeps the attachment alive
+  }
+
+  int slot = -1;
+  for (unsigned i = 0; i < kMuxMaxSlots; i++) {
+    uint32_t prog_id;
+    if (bpf_lookup_elem(progs_fd, &i, &prog_id) < 0) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0)
+    return StatusTuple(-1, "kprobe mux for %s is full", kernel_func.c_str());
+
+  std::vector<struct bpf_insn> chained;
+  if (!mux_rewrite_chain(reinterpret_cast<struct bpf_insn*>(func_start),
+                         func_size / sizeof(struct bpf_insn), chain_fd,
+                         progs_fd, slot, chained))
+    return StatusTuple(-1, "%s cannot be rewritten for mux dispatch",
+                       probe_func.c_str());
+  std::string load_name = probe_func + "_mux";
+  int prog_fd = bpf_module_->bcc_func_load(
+      BPF_PROG_TYPE_KPROBE, load_name.c_str(), chained.data(),
+      chained.size() * sizeof(struct bpf_insn), bpf_module_->license(),
+      bpf_module_->kern_version(), 0, nullptr, 0);
+  if (prog_fd < 0)
+    return StatusTuple(-1, "Failed to load %s for mux dispatch: %d",
+                       probe_func.c_str(), prog_fd);
+
+  // publish: terminate our own next pointer, insert the program, then
+  // link it in after the current tail, so in-flight dispatches never
+  // follow a dangling slot
+  mux_chain_set(chain_fd, slot, kMuxMaxSlots);
+  unsigned uslot = slot;
+  if (bpf_update_elem(progs_fd, &uslot, &prog_fd, 0) < 0) {
+    ::close(prog_fd);
+    return StatusTuple(-1, "Unable to register %s in mux prog array",
+                       probe_func.c_str());
+  }
+  ::close(prog_fd);  // the prog array holds the program
+  unsigned prev = kMuxHeadKey, next;
+  for (unsigned n = 0; n <= kMuxMaxSlots; n++) {
+    if (mux_chain_get(chain_fd, prev, &next) < 0 || next >= kMuxMaxSlots)
+      break;
+    prev = next;
+  }
+  mux_chain_set(chain_fd, prev, slot);
+
+  open_probe_t p = {};
+  p.perf_event_fd = -1;
+  p.func = probe_func;
+  p.is_mux = true;
+  p.mux_slot = slot;
+  kprobes_[probe_event] = std::move(p);
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::detach_kprobe_mux(const std::string& event,
+                                   open_probe_t& attr) {
+  const char* dir = ::getenv("BCC_KPROBE_MUX");
+  if (!dir || !dir[0])
+    return StatusTuple(-1, "BCC_KPROBE_MUX no longer set; cannot unregister %s",
+                       event.c_str());
+  std::string progs_path = std::string(dir) + "/" + event + "_progs";
+  std::string chain_path = std::string(dir) + "/" + event + "_chain";
+  std::string link_path = std::string(dir) + "/" + event + "_link";
+
+  MuxLock mux_lock(dir);
+  if (mux_lock.fd < 0)
+    return StatusTuple(-1, "Unable to lock mux directory %s", dir);
+  FileDesc progs_fd(bpf_obj_get(progs_path.c_str()));
+  FileDesc chain_fd(bpf_obj_get(chain_path.c_str()));
+  if (progs_fd < 0 || chain_fd < 0)
+    return StatusTuple(-1, "mux registry for %s is gone", event.c_str());
+
+  // unlink our slot from the chain, then drop the program
+  unsigned slot = attr.mux_slot;
+  unsigned prev = kMuxHeadKey, next = kMuxMaxSlots;
+  for (unsigned n = 0; n <= kMuxMaxSlots; n++) {
+    if (mux_chain_get(chain_fd, prev, &next) < 0 || next >= kMuxMaxSlots) {
+      next = kMuxMaxSlots;
+      break;
+    }
+    if (next == slot)
+      break;
+    prev = next;
+  }
+  if (next == slot) {
+    unsigned after = kMuxMaxSlots;
+    mux_chain_get(chain_fd, slot, &after);
+    mux_chain_set(chain_fd, prev, after);
+  }
+  bpf_delete_elem(progs_fd, &slot);
+  mux_chain_set(chain_fd, slot, kMuxMaxSlots);
+
+  // last one out tears the whole attach point down; unpinning the link
+  // destroys it, which detaches the dispatcher
+  unsigned head = kMuxMaxSlots;
+  mux_chain_get(chain_fd, kMuxHeadKey, &head);
+  if (head >= kMuxMaxSlots) {
+    ::unlink(link_path.c_str());
+    ::unlink(progs_path.c_str());
+    ::unlink(chain_path.c_str());
+  }
+  return StatusTuple::OK();
+}
+
 StatusTuple BPF::attach_kprobe(const std::string& kernel_func,
                                const std::string& probe_func,
                                uint64_t kernel_func_offset,
                                bpf_probe_attach_type attach_type,
                                int maxactive) {
+  // Opt-in upgrade (BCC_KPROBE_FENTRY): fentry/fexit trampolines have
+  // several times lower per-hit overhead than kprobes on BTF-enabled
+  // kernels. Any load or attach failure falls through to the regular
+  // kprobe below, so ineligible targets or program bodies cost one
+  // extra attempt but keep working unchanged.
+  static bool try_fentry = [] {
+    const char *env = ::getenv("BCC_KPROBE_FENTRY");
+    return env && env[0] && strcmp(env, "0") != 0;
+  }();
+  if (try_fentry && kernel_func_offset == 0 && maxactive == 0 &&
+      (attach_type == BPF_PROBE_ENTRY || attach_type == BPF_PROBE_RETURN)) {
+    auto res =
+        attach_kprobe_as_trampoline(kernel_func, probe_func, attach_type);
+    if (res.ok())
+      return res;
+  }
+
+  // Opt-in shared dispatch (BCC_KPROBE_MUX=<bpffs directory>): co-attached
+  // tools on the same function share one kprobe through a tail-call
+  // dispatcher (see attach_kprobe_as_mux above). Any failure -- old
+  // kernel, full registry, un-rewritable program -- falls through to the
+  // plain per-tool attach below.
+  static const char* mux_dir = [] {
+    const char* env = ::getenv("BCC_KPROBE_MUX");
+    return (env && env[0]) ? env : static_cast<const char*>(nullptr);
+  }();
+  if (mux_dir && kernel_func_offset == 0 && maxactive == 0 &&
+      (attach_type == BPF_PROBE_ENTRY || attach_type == BPF_PROBE_RETURN)) {
+    auto res =
+        attach_kprobe_as_mux(kernel_func, probe_func, attach_type, mux_dir);
+    if (res.ok())
+      return res;
+  }
+
   std::string probe_event = get_kprobe_event(kernel_func, attach_type);
-  if (kprobes_.find(probe_event) != kprobes_.end())
-    return StatusTuple(-1, "kprobe %s already attached", probe_event.c_str());
 
   int probe_fd;
-  TRY2(load_func(probe_func, BPF_PROG_TYPE_KPROBE, probe_fd));
+  {
+    std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
+    if (kprobes_.find(probe_event) != kprobes_.end())
+      return StatusTuple(-1, "kprobe %s already attached",
+                         probe_event.c_str());
+    TRY2(load_func(probe_func, BPF_PROG_TYPE_KPROBE, probe_fd));
+    // reserve the event so concurrent async attaches see it as taken while
+    // the syscall below runs unlocked
+    open_probe_t p = {};
+    p.perf_event_fd = -1;
+    p.func = probe_func;
+    kprobes_[probe_event] = std::move(p);
+  }
 
   int res_fd = bpf_attach_kprobe(probe_fd, attach_type, probe_event.c_str(),
                                  kernel_func.c_str(), kernel_func_offset,
                                  maxactive);
 
+  std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
   if (res_fd < 0) {
+    kprobes_.erase(probe_event);
     TRY2(unload_func(probe_func));
     return StatusTuple(-1, "Unable to attach %skprobe for %s using %s",
                        attach_type_debug(attach_type).c_str(),
                        kernel_func.c_str(), probe_func.c_str());
   }
 
-  open_probe_t p = {};
-  p.perf_event_fd = res_fd;
-  p.func = probe_func;
-  kprobes_[probe_event] = std::move(p);
+  kprobes_[probe_event].perf_event_fd = res_fd;
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::attach_kprobes_batch(
+    const std::vector<std::pair<std::string, std::string>>& probes,
+    bpf_probe_attach_type attach_type) {
+  // validate the whole set up front: no duplicates, nothing already attached
+  std::map<std::string, std::vector<std::string>> funcs_by_prog;
+  std::set<std::string> events;
+  for (auto& it : probes) {
+    std::string probe_event = get_kprobe_event(it.first, attach_type);
+    if (kprobes_.find(probe_event) != kprobes_.end() ||
+        !events.insert(probe_event).second)
+      return StatusTuple(-1, "kprobe %s already attached",
+                         probe_event.c_str());
+    // wildcard-derived candidate lists routinely contain functions the
+    // kernel cannot probe; drop those here against the tracefs index
+    // instead of paying a failed attach round trip for each (-1 means the
+    // index is unavailable, so the attach is attempted as before)
+    if (bcc_kprobe_exists(it.first.c_str()) == 0)
+      continue;
+    funcs_by_prog[it.second].push_back(it.first);
+  }
+
+  for (auto& grp : funcs_by_prog) {
+    if (attach_kprobe_multi(grp.first, grp.second, attach_type).ok())
+      continue;
+    // kernel without kprobe_multi: one perf kprobe per function
+    for (auto& kernel_func : grp.second)
+      TRY2(attach_kprobe(kernel_func, grp.first, 0, attach_type));
+  }
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::attach_kprobe_multi(
+    const std::string& probe_func, const std::vector<std::string>& kernel_funcs,
+    bpf_probe_attach_type attach_type) {
+  if (attach_type != BPF_PROBE_ENTRY && attach_type != BPF_PROBE_RETURN)
+    return StatusTuple(-1, "kprobe_multi supports entry/return probes only");
+  if (kernel_funcs.empty())
+    return StatusTuple(-1, "No kernel functions given for %s",
+                       probe_func.c_str());
+  if (kprobe_multi_links_.find(probe_func) != kprobe_multi_links_.end())
+    return StatusTuple(-1, "kprobe_multi link for %s already attached",
+                       probe_func.c_str());
+
+  int probe_fd;
+  TRY2(load_func(probe_func, BPF_PROG_TYPE_KPROBE, probe_fd, 0,
+                 BPF_TRACE_KPROBE_MULTI));
+
+  // kprobe_multi is fprobe/ftrace based, so names absent from
+  // available_filter_functions are guaranteed to fail the whole link;
+  // filter them out up front (kept as-is when the index is unavailable)
+  std::vector<const char*> syms;
+  syms.reserve(kernel_funcs.size());
+  for (auto& kernel_func : kernel_funcs)
+    if (bcc_kprobe_exists(kernel_func.c_str()) != 0)
+      syms.push_back(kernel_func.c_str());
+  if (syms.empty()) {
+    TRY2(unload_func(probe_func));
+    return StatusTuple(-1, "No probeable kernel functions for %s",
+                       probe_func.c_str());
+  }
+
+  int link_fd =
+      bpf_attach_kprobe_multi(probe_fd, attach_type, syms.data(), syms.size());
+  if (link_fd < 0) {
+    TRY2(unload_func(probe_func));
+    return StatusTuple(-1, "Unable to attach %skprobe_multi for %s: %s",
+                       attach_type_debug(attach_type).c_str(),
+                       probe_func.c_str(), std::strerror(errno));
+  }
+
+  kprobe_multi_links_[probe_func] = link_fd;
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::detach_kprobe_multi(const std::string& probe_func) {
+  auto it = kprobe_multi_links_.find(probe_func);
+  if (it == kprobe_multi_links_.end())
+    return StatusTuple(-1, "No kprobe_multi link for %s", probe_func.c_str());
+  if (close(it->second) != 0)
+    return StatusTuple(-1, "Unable to close kprobe_multi link for %s: %s",
+                       probe_func.c_str(), std::strerror(errno));
+  kprobe_multi_links_.erase(it);
+  TRY2(unload_func(probe_func));
   return StatusTuple::OK();
 }
 
@@ -261,7 +1327,8 @@ StatusTuple BPF::attach_uprobe(const std::string& binary_path,
                                uint64_t symbol_addr,
                                bpf_probe_attach_type attach_type, pid_t pid,
                                uint64_t symbol_offset,
-                               uint32_t ref_ctr_offset) {
+                               uint32_t ref_ctr_offset,
+                               bool pid_filter_in_bpf) {
 
   if (symbol_addr != 0 && symbol_offset != 0)
     return StatusTuple(-1,
@@ -273,18 +1340,78 @@ StatusTuple BPF::attach_uprobe(const std::string& binary_path,
   TRY2(check_binary_symbol(binary_path, symbol, symbol_addr, module, offset,
                            symbol_offset));
 
+  if (pid_filter_in_bpf) {
+    // One kernel probe per inode and offset serves every process mapping
+    // the module; the program is expected to filter on pid itself. A
+    // repeated attachment only takes a reference on the shared probe.
+    std::string probe_event =
+        get_shared_uprobe_event(module, offset, attach_type);
+
+    int probe_fd;
+    {
+      std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
+      auto it = uprobes_.find(probe_event);
+      if (it != uprobes_.end()) {
+        if (it->second.func != probe_func)
+          return StatusTuple(-1,
+                             "shared uprobe %s already attached with function %s",
+                             probe_event.c_str(), it->second.func.c_str());
+        uprobe_ref_counts_[probe_event]++;
+        return StatusTuple::OK();
+      }
+      TRY2(load_func(probe_func, BPF_PROG_TYPE_KPROBE, probe_fd));
+      // reserve the event; see attach_kprobe
+      open_probe_t p = {};
+      p.perf_event_fd = -1;
+      p.func = probe_func;
+      uprobes_[probe_event] = std::move(p);
+      uprobe_ref_counts_[probe_event] = 1;
+    }
+
+    int res_fd = bpf_attach_uprobe(probe_fd, attach_type, probe_event.c_str(),
+                                   binary_path.c_str(), offset, -1,
+                                   ref_ctr_offset);
+
+    std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
+    if (res_fd < 0) {
+      uprobes_.erase(probe_event);
+      uprobe_ref_counts_.erase(probe_event);
+      TRY2(unload_func(probe_func));
+      return StatusTuple(
+          -1,
+          "Unable to attach shared %suprobe for binary %s symbol %s addr %lx "
+          "offset %lx using %s\n",
+          attach_type_debug(attach_type).c_str(), binary_path.c_str(),
+          symbol.c_str(), symbol_addr, symbol_offset, probe_func.c_str());
+    }
+
+    uprobes_[probe_event].perf_event_fd = res_fd;
+    return StatusTuple::OK();
+  }
+
   std::string probe_event = get_uprobe_event(module, offset, attach_type, pid);
-  if (uprobes_.find(probe_event) != uprobes_.end())
-    return StatusTuple(-1, "uprobe %s already attached", probe_event.c_str());
 
   int probe_fd;
-  TRY2(load_func(probe_func, BPF_PROG_TYPE_KPROBE, probe_fd));
+  {
+    std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
+    if (uprobes_.find(probe_event) != uprobes_.end())
+      return StatusTuple(-1, "uprobe %s already attached",
+                         probe_event.c_str());
+    TRY2(load_func(probe_func, BPF_PROG_TYPE_KPROBE, probe_fd));
+    // reserve the event; see attach_kprobe
+    open_probe_t p = {};
+    p.perf_event_fd = -1;
+    p.func = probe_func;
+    uprobes_[probe_event] = std::move(p);
+  }
 
   int res_fd = bpf_attach_uprobe(probe_fd, attach_type, probe_event.c_str(),
                                  binary_path.c_str(), offset, pid,
                                  ref_ctr_offset);
 
+  std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
   if (res_fd < 0) {
+    uprobes_.erase(probe_event);
     TRY2(unload_func(probe_func));
     return StatusTuple(
         -1,
@@ -294,10 +1421,7 @@ StatusTuple BPF::attach_uprobe(const std::string& binary_path,
         symbol.c_str(), symbol_addr, symbol_offset, probe_func.c_str());
   }
 
-  open_probe_t p = {};
-  p.perf_event_fd = res_fd;
-  p.func = probe_func;
-  uprobes_[probe_event] = std::move(p);
+  uprobes_[probe_event].perf_event_fd = res_fd;
   return StatusTuple::OK();
 }
 
@@ -346,17 +1470,86 @@ StatusTuple BPF::attach_usdt(const USDT& usdt, pid_t pid) {
 }
 
 StatusTuple BPF::attach_usdt_all() {
-  for (const auto& u : usdt_) {
-    auto res = attach_usdt_without_validation(u, -1);
-    if (!res.ok()) {
-      return res;
+  if (usdt_.empty())
+    return StatusTuple::OK();
+
+  // partition by target pid: probe enabling writes semaphores in the target
+  // process and uprobe resolution walks its address space, so one worker
+  // handles a given process serially while distinct processes attach in
+  // parallel; attach_uprobe itself is serialized on probes_mutex_
+  std::map<pid_t, std::vector<const USDT*>> by_pid;
+  for (const auto& u : usdt_)
+    by_pid[u.pid()].push_back(&u);
+
+  std::vector<std::vector<const USDT*>> groups;
+  groups.reserve(by_pid.size());
+  for (auto& it : by_pid)
+    groups.push_back(std::move(it.second));
+
+  // per-group error strings, one slot per worker-owned group, so a dead pid
+  // only fails its own probes and the rest keep going
+  std::vector<std::string> errors(groups.size());
+  auto attach_group = [this, &groups, &errors](size_t idx) {
+    for (const USDT* u : groups[idx]) {
+      auto res = attach_usdt_without_validation(*u, -1);
+      if (!res.ok())
+        errors[idx] += res.msg() + "\n";
     }
+  };
+
+  size_t nworkers = std::min(groups.size(), (size_t)8);
+  if (nworkers > 1) {
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    workers.reserve(nworkers);
+    for (size_t i = 0; i < nworkers; i++)
+      workers.emplace_back([&] {
+        for (size_t idx = next++; idx < groups.size(); idx = next++)
+          attach_group(idx);
+      });
+    for (auto& w : workers)
+      w.join();
+  } else {
+    for (size_t idx = 0; idx < groups.size(); idx++)
+      attach_group(idx);
   }
 
+  std::string error_msg;
+  for (auto& err : errors)
+    error_msg += err;
+  if (!error_msg.empty())
+    return StatusTuple(-1, error_msg);
   return StatusTuple::OK();
 }
 
 
+// Attach the module's RAW_TRACEPOINT_PROBE handler for tp_name instead of a
+// classic tracepoint, bookkept under the classic "category:name" key so
+// detach_tracepoint keeps working. Raw tracepoints skip the stable-format
+// marshaling the kernel performs for classic tracepoints, at roughly half
+// the per-hit cost.
+StatusTuple BPF::attach_tracepoint_as_raw(const std::string& tp_name,
+                                          const std::string& tracepoint) {
+  std::string raw_func = "raw_tracepoint__" + tp_name;
+
+  int probe_fd;
+  TRY2(load_func(raw_func, BPF_PROG_TYPE_RAW_TRACEPOINT, probe_fd));
+
+  int res_fd = bpf_attach_raw_tracepoint(probe_fd, tp_name.c_str());
+  if (res_fd < 0) {
+    TRY2(unload_func(raw_func));
+    return StatusTuple(-1, "Unable to attach Raw tracepoint %s using %s",
+                       tp_name.c_str(), raw_func.c_str());
+  }
+
+  open_probe_t p = {};
+  p.perf_event_fd = res_fd;
+  p.func = raw_func;
+  p.is_trampoline = true;
+  tracepoints_[tracepoint] = std::move(p);
+  return StatusTuple::OK();
+}
+
 StatusTuple BPF::attach_tracepoint(const std::string& tracepoint,
                                    const std::string& probe_func) {
   if (tracepoints_.find(tracepoint) != tracepoints_.end())
@@ -369,6 +1562,37 @@ StatusTuple BPF::attach_tracepoint(const std::string& tracepoint,
   std::string tp_category = tracepoint.substr(0, pos);
   std::string tp_name = tracepoint.substr(pos + 1);
 
+  // Opt-in upgrade (BCC_TRACEPOINT_RAW): when the program also carries a
+  // RAW_TRACEPOINT_PROBE(<name>) handler and the kernel supports raw
+  // tracepoints, attach that one instead of the classic handler. Failures
+  // fall through to the classic tracepoint below, so the same source works
+  // unchanged on kernels without raw tracepoint support.
+  static bool try_raw = [] {
+    const char *env = ::getenv("BCC_TRACEPOINT_RAW");
+    return env && *env && std::string(env) != "0";
+  }();
+  if (try_raw && bpf_module_->function_start("raw_tracepoint__" + tp_name)) {
+    static bool kernel_supported = [] {
+      // mirrors the python-side support_raw_tracepoint() probe
+      std::ifstream kallsyms("/proc/kallsyms");
+      std::string line;
+      while (std::getline(kallsyms, line)) {
+        if (line.size() >= 24 &&
+            (line.compare(line.size() - 23, 23, " bpf_get_raw_tracepoint") ==
+                 0 ||
+             line.compare(line.size() - 24, 24, " bpf_find_raw_tracepoint") ==
+                 0))
+          return true;
+      }
+      return false;
+    }();
+    if (kernel_supported) {
+      auto res = attach_tracepoint_as_raw(tp_name, tracepoint);
+      if (res.ok())
+        return res;
+    }
+  }
+
   int probe_fd;
   TRY2(load_func(probe_func, BPF_PROG_TYPE_TRACEPOINT, probe_fd));
 
@@ -496,6 +1720,7 @@ StatusTuple BPF::detach_kprobe(const std::string& kernel_func,
                                bpf_probe_attach_type attach_type) {
   std::string event = get_kprobe_event(kernel_func, attach_type);
 
+  std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
   auto it = kprobes_.find(event);
   if (it == kprobes_.end())
     return StatusTuple(-1, "No open %skprobe for %s",
@@ -510,13 +1735,34 @@ StatusTuple BPF::detach_kprobe(const std::string& kernel_func,
 StatusTuple BPF::detach_uprobe(const std::string& binary_path,
                                const std::string& symbol, uint64_t symbol_addr,
                                bpf_probe_attach_type attach_type, pid_t pid,
-                               uint64_t symbol_offset) {
+                               uint64_t symbol_offset,
+                               bool pid_filter_in_bpf) {
   std::string module;
   uint64_t offset;
   TRY2(check_binary_symbol(binary_path, symbol, symbol_addr, module, offset,
                            symbol_offset));
 
+  if (pid_filter_in_bpf) {
+    std::string event = get_shared_uprobe_event(module, offset, attach_type);
+    std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
+    auto it = uprobes_.find(event);
+    if (it == uprobes_.end())
+      return StatusTuple(
+          -1, "No open shared %suprobe for binary %s symbol %s addr %lx",
+          attach_type_debug(attach_type).c_str(), binary_path.c_str(),
+          symbol.c_str(), symbol_addr);
+
+    // the kernel probe goes away with the last reference
+    if (--uprobe_ref_counts_[event] > 0)
+      return StatusTuple::OK();
+    uprobe_ref_counts_.erase(event);
+    TRY2(detach_uprobe_event(it->first, it->second));
+    uprobes_.erase(it);
+    return StatusTuple::OK();
+  }
+
   std::string event = get_uprobe_event(module, offset, attach_type, pid);
+  std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
   auto it = uprobes_.find(event);
   if (it == uprobes_.end())
     return StatusTuple(-1, "No open %suprobe for binary %s symbol %s addr %lx",
@@ -595,6 +1841,73 @@ StatusTuple BPF::detach_raw_tracepoint(const std::string& tracepoint) {
   return StatusTuple::OK();
 }
 
+StatusTuple BPF::attach_xdp(const std::string& ifname, const std::string& func,
+                            uint32_t flags, uint32_t* attached_mode) {
+  std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
+
+  int probe_fd;
+  TRY2(load_func(func, BPF_PROG_TYPE_XDP, probe_fd));
+
+  uint32_t base_flags = flags & ~XDP_FLAGS_MODES;
+  std::vector<uint32_t> modes;
+  auto tracked = xdp_probes_.find(ifname);
+  if (flags & XDP_FLAGS_MODES) {
+    // caller demanded a specific mode; no negotiation
+    modes.push_back(flags & XDP_FLAGS_MODES);
+  } else if (tracked != xdp_probes_.end()) {
+    // replacing our own program: stay in the attached mode, where a plain
+    // re-attach (no XDP_FLAGS_UPDATE_IF_NOEXIST) is an atomic swap
+    modes.push_back(tracked->second.mode);
+  } else {
+    // best mode first: hardware offload, native driver mode, generic
+    modes = {XDP_FLAGS_HW_MODE, XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE};
+  }
+
+  int ret = 0;
+  uint32_t mode = 0;
+  for (uint32_t m : modes) {
+    ret = bpf_try_attach_xdp(ifname.c_str(), probe_fd, base_flags | m);
+    if (ret == 0) {
+      mode = m;
+      break;
+    }
+  }
+  if (ret != 0) {
+    TRY2(unload_func(func));
+    return StatusTuple(-1, "Unable to attach XDP program %s to %s: %s",
+                       func.c_str(), ifname.c_str(), std::strerror(-ret));
+  }
+
+  if (tracked != xdp_probes_.end() && tracked->second.func != func)
+    TRY2(unload_func(tracked->second.func));
+  if (attached_mode)
+    *attached_mode = mode;
+  xdp_probes_[ifname] = {func, mode};
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::detach_xdp(const std::string& ifname) {
+  std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
+  auto it = xdp_probes_.find(ifname);
+  if (it == xdp_probes_.end())
+    return StatusTuple(-1, "No open XDP program on %s", ifname.c_str());
+
+  TRY2(detach_xdp_event(it->first, it->second));
+  xdp_probes_.erase(it);
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::detach_xdp_event(const std::string& ifname,
+                                  open_xdp_t& attr) {
+  // detaching is attaching fd -1 in the mode the program went in with
+  int ret = bpf_try_attach_xdp(ifname.c_str(), -1, attr.mode);
+  if (ret != 0)
+    return StatusTuple(-1, "Unable to detach XDP program from %s: %s",
+                       ifname.c_str(), std::strerror(-ret));
+  TRY2(unload_func(attr.func));
+  return StatusTuple::OK();
+}
+
 StatusTuple BPF::detach_perf_event(uint32_t ev_type, uint32_t ev_config) {
   auto it = perf_events_.find(std::make_pair(ev_type, ev_config));
   if (it == perf_events_.end())
@@ -605,6 +1918,31 @@ StatusTuple BPF::detach_perf_event(uint32_t ev_type, uint32_t ev_config) {
   return StatusTuple::OK();
 }
 
+StatusTuple BPF::modulate_perf_event(uint32_t ev_type, uint32_t ev_config,
+                                     uint64_t new_sample_period) {
+  if (new_sample_period == 0)
+    return StatusTuple(-1, "Sample period must be nonzero");
+  auto it = perf_events_.find(std::make_pair(ev_type, ev_config));
+  if (it == perf_events_.end())
+    return StatusTuple(-1, "Perf Event type %d config %d not attached", ev_type,
+                       ev_config);
+  if (!it->second.per_cpu_fd)
+    return StatusTuple(-1, "Perf Event type %d config %d has no open fds",
+                       ev_type, ev_config);
+
+  // apply to every CPU's fd; on partial failure report which CPUs kept the
+  // old period, leaving the rest retuned (sampling continues either way)
+  std::string failed_cpus;
+  for (const auto& fd_pair : *it->second.per_cpu_fd) {
+    if (ioctl(fd_pair.second, PERF_EVENT_IOC_PERIOD, &new_sample_period) != 0)
+      failed_cpus += " " + std::to_string(fd_pair.first);
+  }
+  if (!failed_cpus.empty())
+    return StatusTuple(-1, "Failed to set period on CPU(s)%s: %s",
+                       failed_cpus.c_str(), std::strerror(errno));
+  return StatusTuple::OK();
+}
+
 StatusTuple BPF::detach_perf_event_raw(void* perf_event_attr) {
   auto attr = static_cast<struct perf_event_attr*>(perf_event_attr);
   return detach_perf_event(attr->type, attr->config);
@@ -612,6 +1950,8 @@ StatusTuple BPF::detach_perf_event_raw(void* perf_event_attr) {
 
 StatusTuple BPF::open_perf_event(const std::string& name, uint32_t type,
                                  uint64_t config, int pid) {
+  std::lock_guard<std::mutex> gate(buffers_gate_);
+  std::unique_lock<std::shared_timed_mutex> lock(buffers_mutex_);
   if (perf_event_arrays_.find(name) == perf_event_arrays_.end()) {
     TableStorage::iterator it;
     if (!bpf_module_->table_storage().Find(Path({bpf_module_->id(), name}), it))
@@ -625,6 +1965,8 @@ StatusTuple BPF::open_perf_event(const std::string& name, uint32_t type,
 }
 
 StatusTuple BPF::close_perf_event(const std::string& name) {
+  std::lock_guard<std::mutex> gate(buffers_gate_);
+  std::unique_lock<std::shared_timed_mutex> lock(buffers_mutex_);
   auto it = perf_event_arrays_.find(name);
   if (it == perf_event_arrays_.end())
     return StatusTuple(-1, "Perf Event for %s not open", name.c_str());
@@ -636,6 +1978,8 @@ StatusTuple BPF::open_perf_buffer(const std::string& name,
                                   perf_reader_raw_cb cb,
                                   perf_reader_lost_cb lost_cb, void* cb_cookie,
                                   int page_cnt) {
+  std::lock_guard<std::mutex> gate(buffers_gate_);
+  std::unique_lock<std::shared_timed_mutex> lock(buffers_mutex_);
   if (perf_buffers_.find(name) == perf_buffers_.end()) {
     TableStorage::iterator it;
     if (!bpf_module_->table_storage().Find(Path({bpf_module_->id(), name}), it))
@@ -651,28 +1995,167 @@ StatusTuple BPF::open_perf_buffer(const std::string& name,
   return StatusTuple::OK();
 }
 
+StatusTuple BPF::open_perf_buffer_on_cpus(const std::string& name,
+                                          const std::vector<int>& cpus,
+                                          perf_reader_raw_cb cb,
+                                          perf_reader_lost_cb lost_cb,
+                                          void* cb_cookie, int page_cnt) {
+  std::lock_guard<std::mutex> gate(buffers_gate_);
+  std::unique_lock<std::shared_timed_mutex> lock(buffers_mutex_);
+  if (perf_buffers_.find(name) == perf_buffers_.end()) {
+    TableStorage::iterator it;
+    if (!bpf_module_->table_storage().Find(Path({bpf_module_->id(), name}), it))
+      return StatusTuple(-1,
+                         "open_perf_buffer: unable to find table_storage %s",
+                         name.c_str());
+    perf_buffers_[name] = new BPFPerfBuffer(it->second);
+  }
+  if ((page_cnt & (page_cnt - 1)) != 0)
+    return StatusTuple(-1, "open_perf_buffer page_cnt must be a power of two");
+  auto table = perf_buffers_[name];
+  TRY2(table->open_on_cpus(cpus, cb, lost_cb, cb_cookie, page_cnt));
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::open_perf_buffer_capture(const std::string& name,
+                                          const std::string& capture_dir,
+                                          int page_cnt) {
+  std::lock_guard<std::mutex> gate(buffers_gate_);
+  std::unique_lock<std::shared_timed_mutex> lock(buffers_mutex_);
+  if (perf_buffers_.find(name) == perf_buffers_.end()) {
+    TableStorage::iterator it;
+    if (!bpf_module_->table_storage().Find(Path({bpf_module_->id(), name}), it))
+      return StatusTuple(-1,
+                         "open_perf_buffer: unable to find table_storage %s",
+                         name.c_str());
+    perf_buffers_[name] = new BPFPerfBuffer(it->second);
+  }
+  if ((page_cnt & (page_cnt - 1)) != 0)
+    return StatusTuple(-1, "open_perf_buffer page_cnt must be a power of two");
+  auto table = perf_buffers_[name];
+  TRY2(table->open_all_cpu_capture(capture_dir, page_cnt));
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::open_perf_buffer_adaptive(const std::string& name,
+                                           perf_reader_raw_cb cb,
+                                           perf_reader_lost_cb lost_cb,
+                                           void* cb_cookie, int min_page_cnt,
+                                           int max_page_cnt) {
+  std::lock_guard<std::mutex> gate(buffers_gate_);
+  std::unique_lock<std::shared_timed_mutex> lock(buffers_mutex_);
+  if (perf_buffers_.find(name) == perf_buffers_.end()) {
+    TableStorage::iterator it;
+    if (!bpf_module_->table_storage().Find(Path({bpf_module_->id(), name}), it))
+      return StatusTuple(-1,
+                         "open_perf_buffer: unable to find table_storage %s",
+                         name.c_str());
+    perf_buffers_[name] = new BPFPerfBuffer(it->second);
+  }
+  auto table = perf_buffers_[name];
+  TRY2(table->open_all_cpu_adaptive(cb, lost_cb, cb_cookie, min_page_cnt,
+                                    max_page_cnt));
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::open_perf_buffer_pipelined(const std::string& name,
+                                            perf_reader_raw_cb cb,
+                                            perf_reader_lost_cb lost_cb,
+                                            void* cb_cookie, int page_cnt,
+                                            size_t spool_bytes) {
+  std::lock_guard<std::mutex> gate(buffers_gate_);
+  std::unique_lock<std::shared_timed_mutex> lock(buffers_mutex_);
+  if (perf_buffers_.find(name) == perf_buffers_.end()) {
+    TableStorage::iterator it;
+    if (!bpf_module_->table_storage().Find(Path({bpf_module_->id(), name}), it))
+      return StatusTuple(-1,
+                         "open_perf_buffer: unable to find table_storage %s",
+                         name.c_str());
+    perf_buffers_[name] = new BPFPerfBuffer(it->second);
+  }
+  auto table = perf_buffers_[name];
+  TRY2(table->open_all_cpu_pipelined(cb, lost_cb, cb_cookie, page_cnt,
+                                     spool_bytes));
+  return StatusTuple::OK();
+}
+
 StatusTuple BPF::close_perf_buffer(const std::string& name) {
+  std::lock_guard<std::mutex> gate(buffers_gate_);
+  std::unique_lock<std::shared_timed_mutex> lock(buffers_mutex_);
   auto it = perf_buffers_.find(name);
   if (it == perf_buffers_.end())
     return StatusTuple(-1, "Perf buffer for %s not open", name.c_str());
   TRY2(it->second->close_all_cpu());
+  // readers are gone, so the typed-callback trampoline state (if any) can
+  // no longer be referenced as a cookie
+  typed_perf_cb_states_.erase(name);
   return StatusTuple::OK();
 }
 
 BPFPerfBuffer* BPF::get_perf_buffer(const std::string& name) {
+  { std::lock_guard<std::mutex> gate(buffers_gate_); }  // yield to waiting writers
+  std::shared_lock<std::shared_timed_mutex> lock(buffers_mutex_);
   auto it = perf_buffers_.find(name);
   return (it == perf_buffers_.end()) ? nullptr : it->second;
 }
 
 int BPF::poll_perf_buffer(const std::string& name, int timeout_ms) {
+  // shared: concurrent pollers of different buffers proceed in parallel,
+  // and a close() waits until in-flight polls returned
+  { std::lock_guard<std::mutex> gate(buffers_gate_); }  // yield to waiting writers
+  std::shared_lock<std::shared_timed_mutex> lock(buffers_mutex_);
   auto it = perf_buffers_.find(name);
   if (it == perf_buffers_.end())
     return -1;
   return it->second->poll(timeout_ms);
 }
 
+StatusTuple BPF::open_ring_buffer(const std::string& name,
+                                  ring_buffer_sample_fn cb, void* cb_cookie) {
+  std::lock_guard<std::mutex> gate(buffers_gate_);
+  std::unique_lock<std::shared_timed_mutex> lock(buffers_mutex_);
+  if (ring_buffers_.find(name) == ring_buffers_.end()) {
+    TableStorage::iterator it;
+    if (!bpf_module_->table_storage().Find(Path({bpf_module_->id(), name}), it))
+      return StatusTuple(-1,
+                         "open_ring_buffer: unable to find table_storage %s",
+                         name.c_str());
+    ring_buffers_[name] = new BPFRingBuffer(it->second);
+  }
+  auto table = ring_buffers_[name];
+  TRY2(table->open_ring_buffer(cb, cb_cookie));
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::close_ring_buffer(const std::string& name) {
+  std::lock_guard<std::mutex> gate(buffers_gate_);
+  std::unique_lock<std::shared_timed_mutex> lock(buffers_mutex_);
+  auto it = ring_buffers_.find(name);
+  if (it == ring_buffers_.end())
+    return StatusTuple(-1, "Ring buffer for %s not open", name.c_str());
+  TRY2(it->second->close_ring_buffer());
+  return StatusTuple::OK();
+}
+
+BPFRingBuffer* BPF::get_ring_buffer(const std::string& name) {
+  { std::lock_guard<std::mutex> gate(buffers_gate_); }  // yield to waiting writers
+  std::shared_lock<std::shared_timed_mutex> lock(buffers_mutex_);
+  auto it = ring_buffers_.find(name);
+  return (it == ring_buffers_.end()) ? nullptr : it->second;
+}
+
+int BPF::poll_ring_buffer(const std::string& name, int timeout_ms) {
+  { std::lock_guard<std::mutex> gate(buffers_gate_); }  // yield to waiting writers
+  std::shared_lock<std::shared_timed_mutex> lock(buffers_mutex_);
+  auto it = ring_buffers_.find(name);
+  if (it == ring_buffers_.end())
+    return -1;
+  return it->second->poll(timeout_ms);
+}
+
 StatusTuple BPF::load_func(const std::string& func_name, bpf_prog_type type,
                            int& fd, unsigned flags, bpf_attach_type expected_attach_type) {
+  std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
   if (funcs_.find(func_name) != funcs_.end()) {
     fd = funcs_[func_name];
     return StatusTuple::OK();
@@ -706,7 +2189,167 @@ StatusTuple BPF::load_func(const std::string& func_name, bpf_prog_type type,
   return StatusTuple::OK();
 }
 
+StatusTuple BPF::load_func_pinned(const std::string& func_name,
+                                  bpf_prog_type type,
+                                  const std::string& bpffs_path) {
+  int fd;
+  TRY2(load_func(func_name, type, fd));
+  if (bpf_obj_pin(fd, bpffs_path.c_str()) != 0)
+    return StatusTuple(-1, "Failed to pin %s at %s: %s", func_name.c_str(),
+                       bpffs_path.c_str(), std::strerror(errno));
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::load_func_from_pinned(const std::string& bpffs_path,
+                                       const std::string& func_name) {
+  std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
+  if (funcs_.find(func_name) != funcs_.end())
+    return StatusTuple(-1, "Function %s already loaded", func_name.c_str());
+
+  int fd = bpf_obj_get(bpffs_path.c_str());
+  if (fd < 0)
+    return StatusTuple(-1, "Failed to open pinned program %s: %s",
+                       bpffs_path.c_str(), std::strerror(errno));
+  // registered like a loaded function: attach_* calls find it in funcs_ and
+  // unload_func/detach paths close the fd as usual
+  funcs_[func_name] = fd;
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::pin_all(const std::string& bpffs_dir) {
+  std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
+
+  // Stage everything under a temporary name and rename(2) into place, so
+  // that bpffs_dir either doesn't exist or holds a complete snapshot. bpffs
+  // has no regular files to keep a manifest in; the maps/ and progs/ layout
+  // is the manifest and the final rename is the commit.
+  std::string staging = bpffs_dir + ".tmp." + std::to_string(getpid());
+  std::vector<std::string> dirs = {staging, staging + "/maps",
+                                   staging + "/progs"};
+  std::vector<std::string> pins;
+  auto cleanup = [&]() {
+    for (auto it = pins.rbegin(); it != pins.rend(); ++it)
+      unlink(it->c_str());
+    for (auto it = dirs.rbegin(); it != dirs.rend(); ++it)
+      rmdir(it->c_str());
+  };
+
+  for (const auto& dir : dirs)
+    if (mkdir(dir.c_str(), 0700) != 0) {
+      StatusTuple res(-1, "Failed to create %s: %s", dir.c_str(),
+                      std::strerror(errno));
+      cleanup();
+      return res;
+    }
+
+  for (size_t i = 0; i < bpf_module_->num_tables(); i++) {
+    std::string name = bpf_module_->table_name(i);
+    int fd = bpf_module_->table_fd(i);
+    if (fd < 0)
+      continue;
+    std::string path = staging + "/maps/" + name;
+    if (bpf_obj_pin(fd, path.c_str()) != 0) {
+      StatusTuple res(-1, "Failed to pin map %s at %s: %s", name.c_str(),
+                      path.c_str(), std::strerror(errno));
+      cleanup();
+      return res;
+    }
+    pins.push_back(path);
+  }
+
+  for (const auto& func : funcs_) {
+    std::string path = staging + "/progs/" + func.first;
+    if (bpf_obj_pin(func.second, path.c_str()) != 0) {
+      StatusTuple res(-1, "Failed to pin program %s at %s: %s",
+                      func.first.c_str(), path.c_str(), std::strerror(errno));
+      cleanup();
+      return res;
+    }
+    pins.push_back(path);
+  }
+
+  if (rename(staging.c_str(), bpffs_dir.c_str()) != 0) {
+    StatusTuple res(-1, "Failed to rename %s to %s: %s", staging.c_str(),
+                    bpffs_dir.c_str(), std::strerror(errno));
+    cleanup();
+    return res;
+  }
+  return StatusTuple::OK();
+}
+
+namespace {
+
+StatusTuple for_each_pinned(
+    const std::string& dir,
+    std::function<StatusTuple(const std::string&, const std::string&)> cb) {
+  DIR* d = opendir(dir.c_str());
+  if (!d)
+    return StatusTuple(-1, "Failed to open %s: %s", dir.c_str(),
+                       std::strerror(errno));
+  StatusTuple res = StatusTuple::OK();
+  while (struct dirent* ent = readdir(d)) {
+    std::string name = ent->d_name;
+    if (name == "." || name == "..")
+      continue;
+    res = cb(name, dir + "/" + name);
+    if (!res.ok())
+      break;
+  }
+  closedir(d);
+  return res;
+}
+
+}  // namespace
+
+StatusTuple BPF::load_pinned(const std::string& bpffs_dir) {
+  std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
+
+  TRY2(for_each_pinned(
+      bpffs_dir + "/maps",
+      [&](const std::string& name, const std::string& path) -> StatusTuple {
+        TableStorage::iterator it;
+        if (!bpf_module_->table_storage().Find(
+                Path({bpf_module_->id(), name}), it))
+          return StatusTuple(-1, "Pinned map %s is not a table of this program",
+                             name.c_str());
+        int fd = bpf_obj_get(path.c_str());
+        if (fd < 0)
+          return StatusTuple(-1, "Failed to open pinned map %s: %s",
+                             path.c_str(), std::strerror(errno));
+        struct bpf_map_info info = {};
+        uint32_t info_len = sizeof(info);
+        if (bpf_obj_get_info(fd, &info, &info_len) != 0) {
+          StatusTuple res(-1, "Failed to get info of pinned map %s: %s",
+                          path.c_str(), std::strerror(errno));
+          close(fd);
+          return res;
+        }
+        if (info.type != (uint32_t)it->second.type ||
+            info.key_size != it->second.key_size ||
+            info.value_size != it->second.leaf_size ||
+            info.max_entries != it->second.max_entries) {
+          close(fd);
+          return StatusTuple(
+              -1, "Pinned map %s is incompatible with this program",
+              name.c_str());
+        }
+        // The FileDesc assignment drops the table's freshly created map and
+        // adopts the pinned one; programs loaded from here on are wired to
+        // it, and existing table handles see the new fd through their
+        // TableDesc reference.
+        it->second.fd = fd;
+        return StatusTuple::OK();
+      }));
+
+  return for_each_pinned(
+      bpffs_dir + "/progs",
+      [&](const std::string& name, const std::string& path) -> StatusTuple {
+        return load_func_from_pinned(path, name);
+      });
+}
+
 StatusTuple BPF::unload_func(const std::string& func_name) {
+  std::lock_guard<std::recursive_mutex> lock(probes_mutex_);
   auto it = funcs_.find(func_name);
   if (it == funcs_.end())
     return StatusTuple::OK();
@@ -742,6 +2385,16 @@ StatusTuple BPF::detach_func(int prog_fd, int attachable_fd,
   return StatusTuple::OK();
 }
 
+size_t BPF::total_map_memory() const {
+  size_t total = 0;
+  for (size_t i = 0; i < bpf_module_->num_tables(); i++)
+    total += map_memory_footprint(
+        bpf_module_->table_type(i), bpf_module_->table_key_size(i),
+        bpf_module_->table_leaf_size(i), bpf_module_->table_max_entries(i),
+        bpf_module_->table_flags(i));
+  return total;
+}
+
 std::string BPF::get_syscall_fnname(const std::string& name) {
   if (syscall_prefix_ == nullptr) {
     KSyms ksym;
@@ -784,9 +2437,11 @@ StatusTuple BPF::check_binary_symbol(const std::string& binary_path,
 
 std::string BPF::get_kprobe_event(const std::string& kernel_func,
                                   bpf_probe_attach_type type) {
-  std::string res = attach_type_prefix(type) + "_";
-  res += sanitize_str(kernel_func, &BPF::kprobe_event_validator);
-  return res;
+  EventNameBuilder b;
+  b.append(attach_type_prefix(type).c_str())
+      .append('_')
+      .append_sanitized(kernel_func, &BPF::kprobe_event_validator);
+  return b.finish();
 }
 
 BPFProgTable BPF::get_prog_table(const std::string& name) {
@@ -805,8 +2460,15 @@ BPFCgroupArray BPF::get_cgroup_array(const std::string& name) {
 
 BPFDevmapTable BPF::get_devmap_table(const std::string& name) {
   TableStorage::iterator it;
-  if (bpf_module_->table_storage().Find(Path({bpf_module_->id(), name}), it))
+  if (bpf_module_->table_storage().Find(Path({bpf_module_->id(), name}), it)) {
+    // attach the per-slot stats array when the program declared the map
+    // with BPF_DEVMAP_WITH_STATS
+    TableStorage::iterator stats_it;
+    if (bpf_module_->table_storage().Find(
+            Path({bpf_module_->id(), name + "_xdp_stats"}), stats_it))
+      return BPFDevmapTable(it->second, stats_it->second);
     return BPFDevmapTable(it->second);
+  }
   return BPFDevmapTable({});
 }
 
@@ -817,6 +2479,31 @@ BPFXskmapTable BPF::get_xskmap_table(const std::string& name) {
   return BPFXskmapTable({});
 }
 
+BPFArenaTable BPF::get_arena_table(const std::string& name) {
+  TableStorage::iterator it;
+  if (bpf_module_->table_storage().Find(Path({bpf_module_->id(), name}), it))
+    return BPFArenaTable(it->second);
+  return BPFArenaTable({});
+}
+
+StatusTuple BPF::get_shed_drops(const std::string& name, uint64_t& drops) {
+  TableStorage::iterator it;
+  if (!bpf_module_->table_storage().Find(
+          Path({bpf_module_->id(), name + "_shed_drops"}), it))
+    return StatusTuple(-1, "No load shedding counter for '%s'", name.c_str());
+
+  size_t ncpus = get_possible_cpus().size();
+  std::vector<uint64_t> cpu_drops(ncpus);
+  int key = 0;
+  if (bpf_lookup_elem(it->second.fd, &key, cpu_drops.data()) < 0)
+    return StatusTuple(-1, "Error reading shed drop counter: %s",
+                       std::strerror(errno));
+  drops = 0;
+  for (uint64_t d : cpu_drops)
+    drops += d;
+  return StatusTuple::OK();
+}
+
 BPFStackTable BPF::get_stack_table(const std::string& name, bool use_debug_file,
                                    bool check_debug_file_crc) {
   TableStorage::iterator it;
@@ -854,33 +2541,55 @@ bool BPF::add_module(std::string module)
     false : true;
 }
 
-namespace {
-
-constexpr size_t kEventNameSizeLimit = 224;
-
-std::string shorten_event_name(const std::string& name) {
-  std::string hash = uint_to_hex(std::hash<std::string>{}(name));
-  return name.substr(0, kEventNameSizeLimit - hash.size()) + hash;
-}
-
-} // namespace
-
 std::string BPF::get_uprobe_event(const std::string& binary_path,
                                   uint64_t offset, bpf_probe_attach_type type,
                                   pid_t pid) {
-  std::string res = attach_type_prefix(type) + "_";
-  res += sanitize_str(binary_path, &BPF::uprobe_path_validator);
-  res += "_0x" + uint_to_hex(offset);
+  EventNameBuilder b;
+  b.append(attach_type_prefix(type).c_str())
+      .append('_')
+      .append_sanitized(binary_path, &BPF::uprobe_path_validator)
+      .append("_0x")
+      .append_hex(offset);
   if (pid != -1)
-    res += "_" + std::to_string(pid);
-  if (res.size() > kEventNameSizeLimit) {
-    return shorten_event_name(res);
-  }
-  return res;
+    b.append('_').append_dec(pid);
+  return b.finish();
+}
+
+// Event name for a uprobe shared across pid-filtered attachments: keyed by
+// the module's device and inode so that different paths to the same library
+// deduplicate to one kernel probe.
+std::string BPF::get_shared_uprobe_event(const std::string& module,
+                                         uint64_t offset,
+                                         bpf_probe_attach_type type) {
+  struct stat st;
+  if (::stat(module.c_str(), &st) < 0)
+    return get_uprobe_event(module, offset, type, -1);
+  EventNameBuilder b;
+  b.append(attach_type_prefix(type).c_str())
+      .append("_shared_")
+      .append_hex(st.st_dev)
+      .append('_')
+      .append_hex(st.st_ino)
+      .append("_0x")
+      .append_hex(offset);
+  return b.finish();
 }
 
 StatusTuple BPF::detach_kprobe_event(const std::string& event,
                                      open_probe_t& attr) {
+  if (attr.is_mux)
+    // shared dispatcher: unregister from the pinned chain; there is no
+    // local fd and the program was never entered in funcs_
+    return detach_kprobe_mux(event, attr);
+  if (attr.is_trampoline) {
+    // fentry/fexit upgrade: closing the link detaches; there is no perf
+    // event or kprobe tracefs entry to tear down
+    if (close(attr.perf_event_fd) != 0)
+      return StatusTuple(-1, "Unable to close trampoline link for %s",
+                         event.c_str());
+    TRY2(unload_func(attr.func));
+    return StatusTuple::OK();
+  }
   bpf_close_perf_event_fd(attr.perf_event_fd);
   TRY2(unload_func(attr.func));
   if (bpf_detach_kprobe(event.c_str()) < 0)
@@ -899,6 +2608,15 @@ StatusTuple BPF::detach_uprobe_event(const std::string& event,
 
 StatusTuple BPF::detach_tracepoint_event(const std::string& tracepoint,
                                          open_probe_t& attr) {
+  if (attr.is_trampoline) {
+    // raw-tracepoint upgrade: closing the raw tracepoint fd detaches;
+    // there is no perf event to tear down
+    if (close(attr.perf_event_fd) != 0)
+      return StatusTuple(-1, "Unable to close raw tracepoint fd for %s",
+                         tracepoint.c_str());
+    TRY2(unload_func(attr.func));
+    return StatusTuple::OK();
+  }
   bpf_close_perf_event_fd(attr.perf_event_fd);
   TRY2(unload_func(attr.func));
 
@@ -938,6 +2656,24 @@ int BPF::free_bcc_memory() {
   return bcc_free_memory();
 }
 
+StatusTuple BPF::event_decoder(const std::string& type_name,
+                               EventDecoder& decoder) {
+  BTF* btf = bpf_module_->btf();
+  if (!btf || !btf->get_btf())
+    return StatusTuple(-1, "Module carries no BTF; struct %s is undecodable",
+                       type_name.c_str());
+  std::string error;
+  if (build_event_decoder(btf->get_btf(), type_name, decoder, error) != 0)
+    return StatusTuple(-1, "%s", error.c_str());
+  return StatusTuple::OK();
+}
+
+StatusTuple BPF::seal() {
+  if (bpf_module_->seal() != 0)
+    return StatusTuple(-1, "Unable to seal module: nothing loaded");
+  return StatusTuple::OK();
+}
+
 USDT::USDT(const std::string& binary_path, const std::string& provider,
            const std::string& name, const std::string& probe_func)
     : initialized_(false),
@@ -1005,35 +2741,57 @@ int USDT::set_probe_matching_kludge(uint8_t kludge) {
   return 0;
 }
 
+std::shared_ptr<void> USDT::shared_context(pid_t pid,
+                                           const std::string& binary_path,
+                                           uint8_t mod_match_inode_only) {
+  static std::mutex registry_mutex;
+  static std::map<std::tuple<pid_t, std::string, uint8_t>,
+                  std::shared_ptr<::USDT::Context>>
+      registry;
+
+  auto key = std::make_tuple(pid, binary_path, mod_match_inode_only);
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  auto it = registry.find(key);
+  if (it != registry.end()) {
+    // exec (or pid reuse) invalidates every address the context recorded;
+    // the context's ProcStat notices through the /proc/<pid>/root inode
+    if (!it->second->pid_stat_ || !it->second->pid_stat_->is_stale())
+      return it->second;
+    registry.erase(it);
+  }
+
+  std::shared_ptr<::USDT::Context> ctx;
+  if (!binary_path.empty() && pid > 0)
+    ctx = std::make_shared<::USDT::Context>(pid, binary_path,
+                                            mod_match_inode_only);
+  else if (!binary_path.empty())
+    ctx = std::make_shared<::USDT::Context>(binary_path, mod_match_inode_only);
+  else if (pid > 0)
+    ctx = std::make_shared<::USDT::Context>(pid, mod_match_inode_only);
+  if (!ctx || !ctx->loaded())
+    return nullptr;
+  registry[key] = ctx;
+  return ctx;
+}
+
 StatusTuple USDT::init() {
-  std::unique_ptr<::USDT::Context> ctx;
-  if (!binary_path_.empty() && pid_ > 0)
-    ctx.reset(new ::USDT::Context(pid_, binary_path_, mod_match_inode_only_));
-  else if (!binary_path_.empty())
-    ctx.reset(new ::USDT::Context(binary_path_, mod_match_inode_only_));
-  else if (pid_ > 0)
-    ctx.reset(new ::USDT::Context(pid_, mod_match_inode_only_));
-  else
+  if (binary_path_.empty() && pid_ <= 0)
     return StatusTuple(-1, "No valid Binary Path or PID provided");
 
-  if (!ctx->loaded())
+  auto shared = shared_context(pid_, binary_path_, mod_match_inode_only_);
+  if (!shared)
     return StatusTuple(-1, "Unable to load USDT " + print_name());
+  auto ctx = static_cast<::USDT::Context*>(shared.get());
 
-  auto deleter = [](void* probe) { delete static_cast<::USDT::Probe*>(probe); };
-  for (auto& p : ctx->probes_) {
-    if (p->provider_ == provider_ && p->name_ == name_) {
-      // Take ownership of the probe that we are interested in, and avoid it
-      // being destructed when we destruct the USDT::Context instance
-      probe_ = std::unique_ptr<void, std::function<void(void*)>>(p.release(),
-                                                                 deleter);
-      p.swap(ctx->probes_.back());
-      ctx->probes_.pop_back();
-      break;
-    }
-  }
-  if (!probe_)
+  ::USDT::Probe* found = ctx->get(provider_, name_);
+  if (!found)
     return StatusTuple(-1, "Unable to find USDT " + print_name());
-  ctx.reset(nullptr);
+  // Copy the probe out of the shared context so this object keeps the
+  // exclusive enable/disable semantics it had when it stole the probe from
+  // a private context; only the discovery pass is shared.
+  auto deleter = [](void* probe) { delete static_cast<::USDT::Probe*>(probe); };
+  probe_ = std::unique_ptr<void, std::function<void(void*)>>(
+      new ::USDT::Probe(*found), deleter);
   auto& probe = *static_cast<::USDT::Probe*>(probe_.get());
 
   std::ostringstream stream;
@@ -1046,4 +2804,128 @@ StatusTuple USDT::init() {
   return StatusTuple::OK();
 }
 
+BPFPerfMetrics::~BPFPerfMetrics() { close(); }
+
+size_t BPFPerfMetrics::counter_index(const CounterSpec& spec) {
+  for (size_t i = 0; i < counters_.size(); i++)
+    if (counters_[i].type == spec.type && counters_[i].config == spec.config)
+      return i;
+  counters_.push_back(spec);
+  return counters_.size() - 1;
+}
+
+StatusTuple BPFPerfMetrics::add_metric(const std::string& name,
+                                       const CounterSpec& numerator,
+                                       const CounterSpec& denominator) {
+  if (opened_)
+    return StatusTuple(-1, "BPFPerfMetrics already opened");
+  for (const auto& m : metrics_)
+    if (m.name == name)
+      return StatusTuple(-1, "Metric %s already declared", name.c_str());
+  Metric m;
+  m.name = name;
+  m.num_idx = counter_index(numerator);
+  m.den_idx = counter_index(denominator);
+  metrics_.push_back(std::move(m));
+  return StatusTuple::OK();
+}
+
+StatusTuple BPFPerfMetrics::add_ipc(const std::string& name) {
+  return add_metric(name,
+                    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+                    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES});
+}
+
+StatusTuple BPFPerfMetrics::add_llc_miss_ratio(const std::string& name) {
+  return add_metric(name,
+                    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+                    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES});
+}
+
+StatusTuple BPFPerfMetrics::add_stalls_per_cycle(const std::string& name) {
+  return add_metric(
+      name, {PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND},
+      {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES});
+}
+
+StatusTuple BPFPerfMetrics::open(int pid) {
+  if (opened_)
+    return StatusTuple(-1, "BPFPerfMetrics already opened");
+  if (metrics_.empty())
+    return StatusTuple(-1, "No metrics declared");
+
+  std::vector<int> cpus = get_online_cpus();
+  for (int cpu : cpus) {
+    std::vector<int> fds;
+    for (size_t i = 0; i < counters_.size(); i++) {
+      int group_fd = fds.empty() ? -1 : fds[0];
+      int fd = bpf_open_perf_event_metric(counters_[i].type,
+                                          counters_[i].config, pid, cpu,
+                                          group_fd);
+      if (fd < 0) {
+        for (int ofd : fds)
+          ::close(ofd);
+        close();
+        return StatusTuple(-1,
+                           "Unable to open perf event type %u config %" PRIu64
+                           " on CPU %d",
+                           counters_[i].type, counters_[i].config, cpu);
+      }
+      fds.push_back(fd);
+    }
+    cpu_fds_[cpu] = std::move(fds);
+  }
+  opened_ = true;
+  return StatusTuple::OK();
+}
+
+StatusTuple BPFPerfMetrics::read(
+    std::map<std::string, std::vector<MetricValue>>& values,
+    std::vector<int>& cpus) {
+  if (!opened_)
+    return StatusTuple(-1, "BPFPerfMetrics not opened");
+
+  values.clear();
+  cpus.clear();
+  for (const auto& m : metrics_)
+    values[m.name].reserve(cpu_fds_.size());
+
+  // group read layout with PERF_FORMAT_GROUP | TOTAL_TIME_ENABLED |
+  // TOTAL_TIME_RUNNING: nr, time_enabled, time_running, value[nr]
+  std::vector<uint64_t> buf(3 + counters_.size());
+  for (const auto& it : cpu_fds_) {
+    ssize_t expected = buf.size() * sizeof(uint64_t);
+    ssize_t nread = ::read(it.second[0], buf.data(), expected);
+    if (nread != expected || buf[0] != counters_.size())
+      return StatusTuple(-1, "Unable to read perf event group on CPU %d",
+                         it.first);
+
+    uint64_t enabled = buf[1], running = buf[2];
+    // the whole group schedules on and off the PMU as a unit, so one
+    // enabled/running pair scales every member
+    double scale = running > 0 ? (double)enabled / running : 0.0;
+    double ratio = enabled > 0 ? (double)running / enabled : 0.0;
+
+    cpus.push_back(it.first);
+    for (const auto& m : metrics_) {
+      MetricValue v;
+      v.numerator = buf[3 + m.num_idx] * scale;
+      v.denominator = buf[3 + m.den_idx] * scale;
+      v.value = v.denominator > 0 ? v.numerator / v.denominator : 0.0;
+      v.running_ratio = ratio;
+      values[m.name].push_back(v);
+    }
+  }
+  return StatusTuple::OK();
+}
+
+StatusTuple BPFPerfMetrics::close() {
+  for (const auto& it : cpu_fds_)
+    for (int fd : it.second)
+      ::close(fd);
+  cpu_fds_.clear();
+  opened_ = false;
+  return StatusTuple::OK();
+}
+
 }  // namespace ebpf
@@ -17,13 +17,20 @@
 #pragma once
 
 #include <cctype>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <ostream>
+#include <shared_mutex>
 #include <string>
+#include <thread>
 
 #include "BPFTable.h"
 #include "bcc_exception.h"
+#include "bcc_stats.h"
 #include "bcc_syms.h"
 #include "bpf_module.h"
 #include "linux/bpf.h"
@@ -38,9 +45,19 @@ struct open_probe_t {
   int perf_event_fd;
   std::string func;
   std::vector<std::pair<int, int>>* per_cpu_fd;
+  // set when perf_event_fd is really a BPF link fd from an fentry/fexit
+  // upgrade, or a raw tracepoint fd from a raw-tracepoint upgrade;
+  // teardown then closes that fd instead of a perf event
+  bool is_trampoline;
+  // set when the program was registered with a shared kprobe dispatcher
+  // (BCC_KPROBE_MUX) instead of attached directly; mux_slot is its slot
+  // in the pinned dispatch tables and there is no fd to close here
+  bool is_mux;
+  int mux_slot;
 };
 
 class BPF;
+class EventDecoder;
 
 class USDT {
  public:
@@ -94,6 +111,18 @@ class USDT {
  private:
   bool initialized_;
 
+  // Process-wide registry of parsed USDT contexts, keyed by (pid, binary
+  // path, matching kludge). Building a context rescans the target's maps
+  // and every module's ELF notes, so init() calls for different probes of
+  // the same target share one discovery pass instead of repeating it per
+  // probe. A context whose process has exec'd or exited is detected as
+  // stale through its ProcStat and rebuilt on the next lookup. Returns a
+  // ::USDT::Context, opaque here so this header stays independent of
+  // usdt.h; null when the target cannot be loaded.
+  static std::shared_ptr<void> shared_context(pid_t pid,
+                                              const std::string& binary_path,
+                                              uint8_t mod_match_inode_only);
+
   std::string binary_path_;
   pid_t pid_;
 
@@ -109,6 +138,21 @@ class USDT {
   friend class BPF;
 };
 
+// Thread safety: a BPF object may be used from multiple threads without
+// external locking. Internal state is guarded per subsystem, so the
+// subsystems scale independently instead of serializing on one lock:
+//  - attach/detach and program load/unload serialize on probes_mutex_;
+//  - perf buffer, ring buffer and perf event array registries are guarded
+//    by buffers_mutex_, taken shared on the poll/lookup paths, so
+//    concurrent pollers of different buffers proceed in parallel and only
+//    open/close take it exclusively (close of a buffer waits for its
+//    in-flight poll to return);
+//  - table lookups (get_table and friends) read table storage that is
+//    immutable after init() and need no lock.
+// Polling one buffer from two threads at once is not supported: use one
+// poller per buffer, or BPFPerfBuffer::epoll_fd() for external loops. Do
+// not open or close buffers from inside a buffer callback -- the poll
+// holds the registry lock shared and would deadlock against itself.
 class BPF {
  public:
   static const int BPF_MAX_STACK_DEPTH = 127;
@@ -125,10 +169,79 @@ class BPF {
                    const std::vector<std::string>& cflags = {},
                    const std::vector<USDT>& usdt = {});
 
+  // Ahead-of-time compilation for homogeneous fleets. init_with_artifact()
+  // compiles bpf_program like init() and additionally writes a relocatable
+  // artifact (instructions with unresolved map fds, sections, table
+  // metadata, BTF) to artifact_path. init_from_artifact() initializes from
+  // such an artifact with only map creation and relocation -- no clang or
+  // LLVM needed on the target host. Both require a BPF instance constructed
+  // with rw_engine_enabled = false, and an artifact is only valid for the
+  // kernel release and BTF it was compiled against.
+  StatusTuple init_with_artifact(const std::string& bpf_program,
+                                 const std::string& artifact_path,
+                                 const std::vector<std::string>& cflags = {});
+  StatusTuple init_from_artifact(const std::string& artifact_path);
+
   StatusTuple init_usdt(const USDT& usdt);
 
+  // Per-table map creation tuning: NUMA node placement (BPF_F_NUMA_NODE),
+  // forcing prealloc on or off, and max_entries scaling, without touching
+  // the program source. Maps are created during init(), so this must be
+  // called before it. See BPFModule::MapTuning for field semantics.
+  StatusTuple set_map_tuning(const std::string& name,
+                             const BPFModule::MapTuning& tuning);
+
+  // Set a BPF_CONFIG specialization constant (see export/helpers.h): the
+  // value is substituted into the instruction stream when the function is
+  // loaded, so the verifier sees a plain constant. Call after init() and
+  // before load_func/attach of any function reading the config; functions
+  // already loaded keep their value.
+  StatusTuple set_config(const std::string& name, uint64_t value);
+
+  // Initialize several independent BPF instances concurrently, overlapping
+  // the parse/rewrite/codegen of different programs. Each entry pairs an
+  // instance with its program text; result i corresponds to jobs[i]. The
+  // first job runs alone so process-wide LLVM/Clang setup happens
+  // single-threaded; the rest compile on a small worker team, each within
+  // its own LLVMContext.
+  static std::vector<StatusTuple> init_batch(
+      const std::vector<std::pair<BPF*, std::string>>& jobs,
+      const std::vector<std::string>& cflags = {});
+
+  // Snapshot of the library's internal counters (compilations, perf ring
+  // reads, symbolization hits/misses, map syscalls). See bcc_stats.h.
+  static struct bcc_stats stats() {
+    struct bcc_stats s;
+    bcc_get_stats(&s);
+    return s;
+  }
+
   ~BPF();
   StatusTuple detach_all();
+  // Fast bulk teardown for supervisors: gathers every raw fd this instance
+  // owns (probe perf events, kprobe_multi links, loaded programs) into one
+  // contiguous slab and closes it in sorted runs -- one close_range(2) per
+  // run where the kernel has it -- then removes any legacy debugfs probe
+  // events. Failures are counted instead of concatenated, so the returned
+  // message stays bounded with thousands of probes. Perf/ring buffers still
+  // close through their objects since they own mmaps.
+  StatusTuple detach_all_fast();
+
+  // Future-based async variants of the kprobe/uprobe attach paths and of
+  // detach_all(), backed by a small internal worker pool. The probe
+  // bookkeeping is serialized internally but the attach/detach syscalls of
+  // concurrent calls overlap, so storms of probes complete in roughly the
+  // latency of the slowest single one.
+  std::future<StatusTuple> attach_kprobe_async(
+      const std::string& kernel_func, const std::string& probe_func,
+      uint64_t kernel_func_offset = 0,
+      bpf_probe_attach_type attach_type = BPF_PROBE_ENTRY, int maxactive = 0);
+  std::future<StatusTuple> attach_uprobe_async(
+      const std::string& binary_path, const std::string& symbol,
+      const std::string& probe_func, uint64_t symbol_addr = 0,
+      bpf_probe_attach_type attach_type = BPF_PROBE_ENTRY, pid_t pid = -1,
+      uint64_t symbol_offset = 0, uint32_t ref_ctr_offset = 0);
+  std::future<StatusTuple> detach_all_async();
 
   StatusTuple attach_kprobe(const std::string& kernel_func,
                             const std::string& probe_func,
@@ -139,6 +252,27 @@ class BPF {
       const std::string& kernel_func,
       bpf_probe_attach_type attach_type = BPF_PROBE_ENTRY);
 
+  // Attach a batch of {kernel_func, probe_func} pairs. The whole set is
+  // validated up front, then each program is attached to its functions with
+  // one kprobe_multi link (kernel v5.18+) where possible, falling back to
+  // per-function perf kprobes on older kernels.
+  StatusTuple attach_kprobes_batch(
+      const std::vector<std::pair<std::string, std::string>>& probes,
+      bpf_probe_attach_type attach_type = BPF_PROBE_ENTRY);
+  // Attach one program to many kernel functions with a single kprobe_multi
+  // link. Fails on kernels without kprobe_multi support.
+  StatusTuple attach_kprobe_multi(const std::string& probe_func,
+                                  const std::vector<std::string>& kernel_funcs,
+                                  bpf_probe_attach_type attach_type = BPF_PROBE_ENTRY);
+  StatusTuple detach_kprobe_multi(const std::string& probe_func);
+
+  // With pid_filter_in_bpf set, attachments are deduplicated by the
+  // module's device/inode and offset: N processes sharing a library cost
+  // one kernel probe instead of N, with later attachments only taking a
+  // reference on it. The probe is created without a kernel-side pid
+  // filter, so the BPF program must filter on pid itself (e.g. via
+  // bpf_get_current_pid_tgid()). Pass the same flag to detach_uprobe;
+  // the kernel probe is removed when the last reference goes away.
   StatusTuple attach_uprobe(const std::string& binary_path,
                             const std::string& symbol,
                             const std::string& probe_func,
@@ -146,12 +280,14 @@ class BPF {
                             bpf_probe_attach_type attach_type = BPF_PROBE_ENTRY,
                             pid_t pid = -1,
                             uint64_t symbol_offset = 0,
-                            uint32_t ref_ctr_offset = 0);
+                            uint32_t ref_ctr_offset = 0,
+                            bool pid_filter_in_bpf = false);
   StatusTuple detach_uprobe(const std::string& binary_path,
                             const std::string& symbol, uint64_t symbol_addr = 0,
                             bpf_probe_attach_type attach_type = BPF_PROBE_ENTRY,
                             pid_t pid = -1,
-                            uint64_t symbol_offset = 0);
+                            uint64_t symbol_offset = 0,
+                            bool pid_filter_in_bpf = false);
   StatusTuple attach_usdt(const USDT& usdt, pid_t pid = -1);
   StatusTuple attach_usdt_all();
   StatusTuple detach_usdt(const USDT& usdt, pid_t pid = -1);
@@ -165,6 +301,18 @@ class BPF {
                                     const std::string& probe_func);
   StatusTuple detach_raw_tracepoint(const std::string& tracepoint);
 
+  // Attach func as an XDP program on interface ifname. With no mode bit in
+  // flags the best available mode is negotiated — hardware offload, then
+  // native driver mode, then generic (skb) mode — instead of silently
+  // landing in generic mode; pass an XDP_FLAGS_*_MODE bit to demand one
+  // mode and fail otherwise. The achieved mode bit is reported through
+  // attached_mode when non-null. Re-attaching on an interface this object
+  // already drives replaces the program atomically in the same mode. The
+  // attachment is tracked and torn down by detach_xdp and detach_all.
+  StatusTuple attach_xdp(const std::string& ifname, const std::string& func,
+                         uint32_t flags = 0, uint32_t* attached_mode = nullptr);
+  StatusTuple detach_xdp(const std::string& ifname);
+
   StatusTuple attach_perf_event(uint32_t ev_type, uint32_t ev_config,
                                 const std::string& probe_func,
                                 uint64_t sample_period, uint64_t sample_freq,
@@ -177,6 +325,13 @@ class BPF {
                                     unsigned long extra_flags = 0);
   StatusTuple detach_perf_event(uint32_t ev_type, uint32_t ev_config);
   StatusTuple detach_perf_event_raw(void* perf_event_attr);
+  // Retune an attached sampling event's period in place with
+  // PERF_EVENT_IOC_PERIOD on every per-CPU fd, so overhead-feedback loops
+  // can adjust sampling without the detach/reattach cycle (and its
+  // coverage gap) across all CPUs. Events attached with sample_freq
+  // switch to period-based sampling at the new period.
+  StatusTuple modulate_perf_event(uint32_t ev_type, uint32_t ev_config,
+                                  uint64_t new_sample_period);
   std::string get_syscall_fnname(const std::string& name);
 
   BPFTable get_table(const std::string& name) {
@@ -186,6 +341,11 @@ class BPF {
     return BPFTable({});
   }
 
+  // Estimated kernel-resident bytes pinned by all maps of this program,
+  // for placing collection workloads against real memory budgets; the sum
+  // of map_memory_footprint() over every table. Valid after init().
+  size_t total_map_memory() const;
+
   template <class ValueType>
   BPFArrayTable<ValueType> get_array_table(const std::string& name) {
     TableStorage::iterator it;
@@ -194,6 +354,16 @@ class BPF {
     return BPFArrayTable<ValueType>({});
   }
 
+  // Mapped view of a counter array for zero-syscall reads; see
+  // BPFCounterView for the BPF_F_MMAPABLE requirement and fallback.
+  template <class ValueType>
+  BPFCounterView<ValueType> get_counter_view(const std::string& name) {
+    TableStorage::iterator it;
+    if (bpf_module_->table_storage().Find(Path({bpf_module_->id(), name}), it))
+      return BPFCounterView<ValueType>(it->second);
+    return BPFCounterView<ValueType>({});
+  }
+
   template <class ValueType>
   BPFPercpuArrayTable<ValueType> get_percpu_array_table(
       const std::string& name) {
@@ -203,6 +373,15 @@ class BPF {
     return BPFPercpuArrayTable<ValueType>({});
   }
 
+  // Decoding view of an int-keyed BPF_HISTOGRAM table; see
+  // BPFHistogramTable for bucket decode, percpu merge and percentiles.
+  BPFHistogramTable get_histogram_table(const std::string& name) {
+    TableStorage::iterator it;
+    if (bpf_module_->table_storage().Find(Path({bpf_module_->id(), name}), it))
+      return BPFHistogramTable(it->second);
+    return BPFHistogramTable({});
+  }
+
   template <class KeyType, class ValueType>
   BPFHashTable<KeyType, ValueType> get_hash_table(const std::string& name) {
     TableStorage::iterator it;
@@ -283,6 +462,13 @@ class BPF {
 
   BPFXskmapTable get_xskmap_table(const std::string& name);
 
+  BPFArenaTable get_arena_table(const std::string& name);
+
+  // Total events shed in-kernel by the BPF_SAMPLE_EVERY / BPF_RATE_LIMIT /
+  // BPF_RESERVOIR_SAMPLE(name, ...) instance called name: sums the per-CPU
+  // <name>_shed_drops counter those macros declare (see export/helpers.h).
+  StatusTuple get_shed_drops(const std::string& name, uint64_t& drops);
+
   BPFSockmapTable get_sockmap_table(const std::string& name);
 
   BPFSockhashTable get_sockhash_table(const std::string& name);
@@ -316,6 +502,85 @@ class BPF {
                                perf_reader_lost_cb lost_cb = nullptr,
                                void* cb_cookie = nullptr,
                                int page_cnt = DEFAULT_PERF_BUFFER_PAGE_CNT);
+  // Typed event callback: the event is a view directly over the ring (or
+  // spool) memory, valid only for the duration of the call; copy it out to
+  // keep it. Spares every consumer the memcpy-into-a-struct and cast that
+  // the raw callback otherwise requires.
+  template <typename EventType>
+  using perf_buffer_event_cb = void (*)(void* cb_cookie,
+                                        const EventType& event);
+  // Like open_perf_buffer, but with a typed callback receiving const
+  // EventType& instead of (void*, int). EventType must match the struct the
+  // BPF program submits; records shorter than sizeof(EventType) are dropped
+  // rather than handed out as a truncated view.
+  template <typename EventType>
+  StatusTuple open_perf_buffer(const std::string& name,
+                               perf_buffer_event_cb<EventType> cb,
+                               perf_reader_lost_cb lost_cb = nullptr,
+                               void* cb_cookie = nullptr,
+                               int page_cnt = DEFAULT_PERF_BUFFER_PAGE_CNT) {
+    static_assert(std::is_trivially_copyable<EventType>::value,
+                  "perf buffer event type must be trivially copyable");
+    // ring data follows the 8-byte perf record header, so stricter
+    // alignment cannot be guaranteed for an in-place view
+    static_assert(alignof(EventType) <= 8,
+                  "perf buffer event type must not require alignment above 8");
+    auto state = new TypedPerfCbState{reinterpret_cast<void*>(cb),
+                                      reinterpret_cast<void*>(lost_cb),
+                                      cb_cookie};
+    auto res = open_perf_buffer(
+        name, &typed_perf_buffer_trampoline<EventType>,
+        lost_cb ? &typed_perf_buffer_lost_trampoline : nullptr, state,
+        page_cnt);
+    if (!res.ok()) {
+      delete state;
+      return res;
+    }
+    std::lock_guard<std::mutex> gate(buffers_gate_);
+  std::unique_lock<std::shared_timed_mutex> lock(buffers_mutex_);
+    typed_perf_cb_states_[name].reset(state);
+    return res;
+  }
+  // Like open_perf_buffer, but opens rings only on the given CPUs, for
+  // sharded consumers that each own a subset of the machine (e.g. one
+  // process per NUMA node): pinned ring memory and the polling set cover
+  // only those CPUs. Delivery is per-CPU, so each consumer sees exactly
+  // the events submitted on its CPUs; see BPFPerfBuffer::open_on_cpus for
+  // the kernel-side steering implications.
+  StatusTuple open_perf_buffer_on_cpus(
+      const std::string& name, const std::vector<int>& cpus,
+      perf_reader_raw_cb cb, perf_reader_lost_cb lost_cb = nullptr,
+      void* cb_cookie = nullptr,
+      int page_cnt = DEFAULT_PERF_BUFFER_PAGE_CNT);
+  // Like open_perf_buffer, but instead of a fixed page_cnt each CPU's ring
+  // starts at min_page_cnt and is grown (up to max_page_cnt) when it reports
+  // lost samples, or shrunk back when it stays idle. Sizes the rings for the
+  // actual per-CPU load instead of the worst case across all CPUs; see
+  // BPFPerfBuffer::open_all_cpu_adaptive for the resizing rules.
+  StatusTuple open_perf_buffer_adaptive(
+      const std::string& name, perf_reader_raw_cb cb,
+      perf_reader_lost_cb lost_cb = nullptr, void* cb_cookie = nullptr,
+      int min_page_cnt = DEFAULT_PERF_BUFFER_PAGE_CNT,
+      int max_page_cnt = 256);
+  // Like open_perf_buffer, but in flight-recorder mode: each
+  // poll_perf_buffer() drains every CPU's ring as raw bytes into
+  // capture_dir/cpu<N>.cap with no per-event decode or callbacks. Replay
+  // the files afterwards with BPFPerfBuffer::replay_capture.
+  StatusTuple open_perf_buffer_capture(
+      const std::string& name, const std::string& capture_dir,
+      int page_cnt = DEFAULT_PERF_BUFFER_PAGE_CNT);
+  // Like open_perf_buffer, but decoupled into two stages: an internal drain
+  // thread copies events from the kernel rings into a userspace spool of
+  // spool_bytes, and a decode thread runs cb against the spooled records.
+  // A slow callback then backs up the spool instead of the kernel rings, so
+  // kernel-side drops depend on memcpy speed, not callback speed. cb runs
+  // on the decode thread; no poll_perf_buffer() call is needed (or allowed).
+  // See BPFPerfBuffer::pipeline_stats() for watermarks and backpressure.
+  StatusTuple open_perf_buffer_pipelined(
+      const std::string& name, perf_reader_raw_cb cb,
+      perf_reader_lost_cb lost_cb = nullptr, void* cb_cookie = nullptr,
+      int page_cnt = DEFAULT_PERF_BUFFER_PAGE_CNT,
+      size_t spool_bytes = 1 << 24);
   // Close and free the Perf Buffer of given name.
   StatusTuple close_perf_buffer(const std::string& name);
   // Obtain an pointer to the opened BPFPerfBuffer instance of given name.
@@ -329,10 +594,55 @@ class BPF {
   //   number of CPUs that have new data, otherwise.
   int poll_perf_buffer(const std::string& name, int timeout_ms = -1);
 
+  // Open the BPF_MAP_TYPE_RINGBUF map of given name, providing callback and
+  // callback cookie to use when polling. BPF class owns the opened ring
+  // buffer and will free it on-demand or on destruction.
+  StatusTuple open_ring_buffer(const std::string& name,
+                               ring_buffer_sample_fn cb,
+                               void* cb_cookie = nullptr);
+  // Close and free the ring buffer of given name.
+  StatusTuple close_ring_buffer(const std::string& name);
+  // Obtain a pointer to the opened BPFRingBuffer instance of given name.
+  // Will return nullptr if such open ring buffer doesn't exist.
+  BPFRingBuffer* get_ring_buffer(const std::string& name);
+  // Poll an opened ring buffer of given name with given timeout, using
+  // callback provided when opening. Returns:
+  //   -1 on error or if ring buffer with such name doesn't exist;
+  //   number of records consumed, otherwise.
+  int poll_ring_buffer(const std::string& name, int timeout_ms = -1);
+
   StatusTuple load_func(const std::string& func_name, enum bpf_prog_type type,
                         int& fd, unsigned flags = 0, enum bpf_attach_type = (bpf_attach_type) -1);
   StatusTuple unload_func(const std::string& func_name);
 
+  // Load a compiled function and pin it at bpffs_path (a path under a bpffs
+  // mount, usually /sys/fs/bpf). The pinned program outlives this process,
+  // so a later run can pick it up with load_func_from_pinned() and skip
+  // compilation and kernel verification entirely.
+  StatusTuple load_func_pinned(const std::string& func_name,
+                               enum bpf_prog_type type,
+                               const std::string& bpffs_path);
+  // Register a previously pinned program under func_name, making it usable
+  // with the attach_* calls of this instance exactly like a freshly loaded
+  // function. No BPF program text is needed: restart-heavy deployments
+  // init() with an empty program and reattach in milliseconds.
+  StatusTuple load_func_from_pinned(const std::string& bpffs_path,
+                                    const std::string& func_name);
+
+  // Pin every map of this program and every function loaded so far under
+  // bpffs_dir as maps/<name> and progs/<name>. bpffs cannot hold regular
+  // files, so the directory layout itself is the manifest: everything is
+  // pinned into a temporary sibling directory first and renamed into place,
+  // making the presence of bpffs_dir equivalent to a complete snapshot.
+  // Fails if bpffs_dir already exists.
+  StatusTuple pin_all(const std::string& bpffs_dir);
+  // Adopt a snapshot created by pin_all() of the same program. Call right
+  // after init() and before load_func()/attach_*: each table's fd is
+  // replaced by the pinned map (preserving its state across the restart)
+  // and every pinned program is registered as if loaded by load_func(), so
+  // reattaching skips kernel verification entirely.
+  StatusTuple load_pinned(const std::string& bpffs_dir);
+
   StatusTuple attach_func(int prog_fd, int attachable_fd,
                           enum bpf_attach_type attach_type,
                           uint64_t flags);
@@ -341,14 +651,43 @@ class BPF {
 
   int free_bcc_memory();
 
+  // Build a decoder for events of struct type_name from the module's own
+  // BTF: the field table (flattened names, offsets, sizes) is precomputed
+  // here so decoding each event is a few bounds-checked copies, as fast as
+  // a hand-maintained struct mirror but immune to layout drift between the
+  // BPF program and the consumer. See EventDecoder in bcc_btf.h.
+  StatusTuple event_decoder(const std::string& type_name,
+                            EventDecoder& decoder);
+
+  // Tear down the compiler once everything is loaded: LLVM/Clang state is
+  // destroyed and only the runtime artifacts (instructions, tables, BTF)
+  // remain, cutting steady-state RSS for long-running processes holding
+  // many programs. load_func() and table access keep working; the JITed
+  // key/leaf string converters are dropped, as if rw_engine had been
+  // disabled. Call after init() and any load_func() calls you want cheap.
+  StatusTuple seal();
+
  private:
   std::string get_kprobe_event(const std::string& kernel_func,
                                bpf_probe_attach_type type);
   std::string get_uprobe_event(const std::string& binary_path, uint64_t offset,
                                bpf_probe_attach_type type, pid_t pid);
+  std::string get_shared_uprobe_event(const std::string& module,
+                                      uint64_t offset,
+                                      bpf_probe_attach_type type);
 
   StatusTuple attach_usdt_without_validation(const USDT& usdt, pid_t pid);
   StatusTuple detach_usdt_without_validation(const USDT& usdt, pid_t pid);
+  StatusTuple attach_kprobe_as_trampoline(const std::string& kernel_func,
+                                          const std::string& probe_func,
+                                          bpf_probe_attach_type attach_type);
+  StatusTuple attach_kprobe_as_mux(const std::string& kernel_func,
+                                   const std::string& probe_func,
+                                   bpf_probe_attach_type attach_type,
+                                   const std::string& mux_dir);
+  StatusTuple detach_kprobe_mux(const std::string& event, open_probe_t& attr);
+  StatusTuple attach_tracepoint_as_raw(const std::string& tp_name,
+                                       const std::string& tracepoint);
 
   StatusTuple detach_kprobe_event(const std::string& event, open_probe_t& attr);
   StatusTuple detach_uprobe_event(const std::string& event, open_probe_t& attr);
@@ -386,6 +725,31 @@ class BPF {
     return std::isalpha(c) || std::isdigit(c) || (c == '_');
   }
 
+  // Trampoline state for the typed open_perf_buffer overload; the reader
+  // holds it as its cookie, so it is kept per buffer name and freed when
+  // the buffer is closed.
+  struct TypedPerfCbState {
+    void* fn;
+    void* lost_fn;
+    void* cookie;
+  };
+
+  template <typename EventType>
+  static void typed_perf_buffer_trampoline(void* cb_cookie, void* data,
+                                           int size) {
+    auto state = static_cast<TypedPerfCbState*>(cb_cookie);
+    if (size < static_cast<int>(sizeof(EventType)))
+      return;
+    reinterpret_cast<perf_buffer_event_cb<EventType>>(state->fn)(
+        state->cookie, *static_cast<const EventType*>(data));
+  }
+
+  static void typed_perf_buffer_lost_trampoline(void* cb_cookie,
+                                                uint64_t lost) {
+    auto state = static_cast<TypedPerfCbState*>(cb_cookie);
+    reinterpret_cast<perf_reader_lost_cb>(state->lost_fn)(state->cookie, lost);
+  }
+
   StatusTuple check_binary_symbol(const std::string& binary_path,
                                   const std::string& symbol,
                                   uint64_t symbol_addr, std::string& module_res,
@@ -407,13 +771,115 @@ class BPF {
   std::vector<USDT> usdt_;
   std::string all_bpf_program_;
 
+  // Small lazily-started worker pool backing the *_async methods.
+  class AsyncPool {
+   public:
+    ~AsyncPool();
+    std::future<StatusTuple> submit(std::function<StatusTuple()> task);
+
+   private:
+    static const size_t kWorkers = 4;
+    std::vector<std::thread> workers_;
+    std::deque<std::packaged_task<StatusTuple()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+  };
+  AsyncPool async_pool_;
+  // serializes probe/function bookkeeping between async workers; recursive
+  // because the attach paths call load_func/unload_func while holding it
+  std::recursive_mutex probes_mutex_;
+  // guards perf_buffers_, ring_buffers_, perf_event_arrays_ and
+  // typed_perf_cb_states_ separately from the attach registries, so pollers
+  // do not serialize against attach/detach; shared on lookup/poll,
+  // exclusive on open/close. glibc rwlocks prefer readers, so a tight poll
+  // loop would starve close forever; writers therefore hold buffers_gate_
+  // while acquiring exclusive, and readers touch the gate first, which
+  // drains them when a writer is waiting. Lock order: probes_mutex_, then
+  // buffers_gate_, then buffers_mutex_.
+  mutable std::mutex buffers_gate_;
+  mutable std::shared_timed_mutex buffers_mutex_;
+  StatusTuple detach_all_parallel();
+
   std::map<std::string, open_probe_t> kprobes_;
+  // probe_func -> kprobe_multi link fd
+  std::map<std::string, int> kprobe_multi_links_;
   std::map<std::string, open_probe_t> uprobes_;
+  // reference counts for uprobe events shared across pid-filtered
+  // attachments (attach_uprobe with pid_filter_in_bpf)
+  std::map<std::string, int> uprobe_ref_counts_;
   std::map<std::string, open_probe_t> tracepoints_;
   std::map<std::string, open_probe_t> raw_tracepoints_;
+  struct open_xdp_t {
+    std::string func;
+    uint32_t mode;  // the single XDP_FLAGS_*_MODE bit actually attached
+  };
+  StatusTuple detach_xdp_event(const std::string& ifname, open_xdp_t& attr);
+  // ifname -> attached XDP program; netlink-based, so no fd to track
+  std::map<std::string, open_xdp_t> xdp_probes_;
   std::map<std::string, BPFPerfBuffer*> perf_buffers_;
+  std::map<std::string, std::unique_ptr<TypedPerfCbState>>
+      typed_perf_cb_states_;
+  std::map<std::string, BPFRingBuffer*> ring_buffers_;
   std::map<std::string, BPFPerfEventArray*> perf_event_arrays_;
   std::map<std::pair<uint32_t, uint32_t>, open_probe_t> perf_events_;
 };
 
+// Derived PMU metrics (IPC, LLC miss ratio, stalls per cycle, ...) computed
+// library-side, so tools stop hand-rolling counter groups and time scaling.
+// Declare metrics as ratios of raw counters, then open() creates the minimal
+// de-duplicated counter set as one leader-led perf event group per CPU; each
+// read() fetches a CPU's whole group with a single read() syscall (one
+// consistent snapshot), rescales counts by time_enabled/time_running to
+// correct for PMU multiplexing, and evaluates every declared ratio.
+class BPFPerfMetrics {
+ public:
+  struct CounterSpec {
+    uint32_t type;    // PERF_TYPE_*
+    uint64_t config;  // PERF_COUNT_* for the type
+  };
+  struct MetricValue {
+    double value;        // numerator / denominator, 0 when denominator is 0
+    double numerator;    // multiplex-scaled counts
+    double denominator;
+    double running_ratio;  // time_running / time_enabled; < 1.0 means the
+                           // group was multiplexed and counts were scaled up
+  };
+
+  ~BPFPerfMetrics();
+
+  // Declare name = numerator / denominator. Counters used by several
+  // metrics are opened once. Only valid before open().
+  StatusTuple add_metric(const std::string& name, const CounterSpec& numerator,
+                         const CounterSpec& denominator);
+  // Common ratios over PERF_TYPE_HARDWARE counters.
+  StatusTuple add_ipc(const std::string& name = "ipc");
+  StatusTuple add_llc_miss_ratio(const std::string& name = "llc_miss_ratio");
+  StatusTuple add_stalls_per_cycle(const std::string& name =
+                                       "stalls_per_cycle");
+
+  // Opens the counter group on every online CPU; pid = -1 counts
+  // system-wide, otherwise only the given process.
+  StatusTuple open(int pid = -1);
+  // One group read() per CPU: values[name][i] is the metric on cpus[i].
+  StatusTuple read(std::map<std::string, std::vector<MetricValue>>& values,
+                   std::vector<int>& cpus);
+  StatusTuple close();
+
+ private:
+  struct Metric {
+    std::string name;
+    size_t num_idx;  // indices into counters_
+    size_t den_idx;
+  };
+  // returns the index of spec in counters_, appending it if new
+  size_t counter_index(const CounterSpec& spec);
+
+  std::vector<CounterSpec> counters_;
+  std::vector<Metric> metrics_;
+  // cpu -> fds of the group members in counters_ order; [0] is the leader
+  std::map<int, std::vector<int>> cpu_fds_;
+  bool opened_ = false;
+};
+
 }  // namespace ebpf
@@ -14,17 +14,29 @@
  * limitations under the License.
  */
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <linux/elf.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <sys/stat.h>
 #include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
 #include <cerrno>
 #include <cinttypes>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
 #include <memory>
+#include <queue>
 
 #include "BPFTable.h"
 
@@ -248,6 +260,569 @@ StatusTuple BPFTable::get_table_offline(
 
 size_t BPFTable::get_possible_cpu_count() { return get_possible_cpus().size(); }
 
+size_t map_memory_footprint(int map_type, size_t key_size, size_t leaf_size,
+                            size_t max_entries, int flags) {
+  // constants mirror the kernel's structures: htab_elem header, bucket,
+  // lpm_trie node and stack_map_bucket sizes on 64-bit kernels, and the
+  // base struct bpf_map allocation every map carries
+  const size_t kMapBase = 256;
+  const size_t kHtabElem = 48;
+  const size_t kBucket = 16;
+  const size_t kLpmNode = 40;
+  const size_t kStackBucket = 16;
+  const size_t kPage = 4096;
+
+  auto round8 = [](size_t x) { return (x + 7) & ~size_t(7); };
+  auto pow2 = [](size_t x) {
+    size_t r = 1;
+    while (r < x)
+      r <<= 1;
+    return r;
+  };
+
+  size_t ncpus = get_possible_cpus().size();
+  if (ncpus == 0)
+    ncpus = 1;
+
+  switch (map_type) {
+    case BPF_MAP_TYPE_HASH:
+    case BPF_MAP_TYPE_LRU_HASH:
+    case BPF_MAP_TYPE_PERCPU_HASH:
+    case BPF_MAP_TYPE_LRU_PERCPU_HASH:
+    case BPF_MAP_TYPE_HASH_OF_MAPS: {
+      bool percpu = map_type == BPF_MAP_TYPE_PERCPU_HASH ||
+                    map_type == BPF_MAP_TYPE_LRU_PERCPU_HASH;
+      // a percpu leaf is one pointer in the element plus one rounded copy
+      // per possible CPU; a plain leaf is stored inline, rounded to 8
+      size_t value_bytes =
+          percpu ? 8 + ncpus * round8(leaf_size) : round8(leaf_size);
+      size_t per_elem = kHtabElem + round8(key_size) + value_bytes;
+      // prealloc (the default) allocates the full element pool up front;
+      // BPF_F_NO_PREALLOC reaches the same point at capacity, which is
+      // what a budget has to plan for either way
+      return kMapBase + pow2(max_entries) * kBucket + max_entries * per_elem;
+    }
+    case BPF_MAP_TYPE_ARRAY:
+      return kMapBase + max_entries * round8(leaf_size);
+    case BPF_MAP_TYPE_PERCPU_ARRAY:
+      return kMapBase + max_entries * (8 + ncpus * round8(leaf_size));
+    case BPF_MAP_TYPE_PROG_ARRAY:
+    case BPF_MAP_TYPE_PERF_EVENT_ARRAY:
+    case BPF_MAP_TYPE_CGROUP_ARRAY:
+    case BPF_MAP_TYPE_ARRAY_OF_MAPS:
+      // fd arrays store one pointer per slot; the objects behind the fds
+      // are owned elsewhere
+      return kMapBase + max_entries * 8;
+    case BPF_MAP_TYPE_STACK_TRACE:
+      // bucket pointer array plus the preallocated element pool; leaf_size
+      // here is the full stack blob (depth * 8 or depth * sizeof(bip))
+      return kMapBase + pow2(max_entries) * 8 +
+             max_entries * (kStackBucket + leaf_size);
+    case BPF_MAP_TYPE_LPM_TRIE:
+      return kMapBase + max_entries * (kLpmNode + key_size + round8(leaf_size));
+    case BPF_MAP_TYPE_RINGBUF:
+      // data area (max_entries, power of two, page multiple) plus consumer
+      // and producer bookkeeping pages
+      return kMapBase + pow2(max_entries) + 2 * kPage;
+    case BPF_MAP_TYPE_QUEUE:
+    case BPF_MAP_TYPE_STACK:
+      return kMapBase + max_entries * round8(leaf_size);
+    default:
+      return kMapBase + max_entries * (round8(key_size) + round8(leaf_size) +
+                                       32);
+  }
+  (void)flags;
+}
+
+size_t BPFTable::memory_footprint() const {
+  return map_memory_footprint(desc.type, desc.key_size, desc.leaf_size,
+                              desc.max_entries, desc.flags);
+}
+
+void histogram_merge_slots(uint64_t* dst, const uint64_t* src,
+                           size_t n_slots) {
+  uint64_t* __restrict__ d = dst;
+  const uint64_t* __restrict__ s = src;
+  for (size_t i = 0; i < n_slots; i++)
+    d[i] += s[i];
+}
+
+void histogram_merge_many(uint64_t* dst, const uint64_t* const* srcs,
+                          size_t n_inputs, size_t n_slots) {
+  uint64_t* __restrict__ d = dst;
+  size_t k = 0;
+  // four inputs per pass: the adds are the same as pairwise reduction,
+  // but dst is read and written n_inputs / 4 times instead of n_inputs
+  for (; k + 4 <= n_inputs; k += 4) {
+    const uint64_t* __restrict__ s0 = srcs[k];
+    const uint64_t* __restrict__ s1 = srcs[k + 1];
+    const uint64_t* __restrict__ s2 = srcs[k + 2];
+    const uint64_t* __restrict__ s3 = srcs[k + 3];
+    for (size_t i = 0; i < n_slots; i++)
+      d[i] += s0[i] + s1[i] + s2[i] + s3[i];
+  }
+  for (; k < n_inputs; k++)
+    histogram_merge_slots(dst, srcs[k], n_slots);
+}
+
+void HistogramAggregator::add(const uint64_t* slots, size_t n_slots) {
+  if (n_slots > slots_.size())
+    slots_.resize(n_slots, 0);
+  uint64_t* __restrict__ d = slots_.data();
+  const uint64_t* __restrict__ s = slots;
+  uint64_t added = 0;
+  for (size_t i = 0; i < n_slots; i++) {
+    d[i] += s[i];
+    added += s[i];
+  }
+  total_ += added;
+}
+
+void HistogramAggregator::add_many(const uint64_t* const* srcs,
+                                   size_t n_inputs, size_t n_slots) {
+  if (n_slots > slots_.size())
+    slots_.resize(n_slots, 0);
+  histogram_merge_many(slots_.data(), srcs, n_inputs, n_slots);
+  // one pass over the accumulator beats one extra accumulation per input
+  uint64_t total = 0;
+  for (uint64_t count : slots_)
+    total += count;
+  total_ = total;
+}
+
+namespace {
+
+uint64_t log2_slot_high(size_t slot) {
+  return slot >= 64 ? ~0ULL : (1ULL << slot) - 1;
+}
+
+// 1-based rank of the sample at quantile q, get_summary() rounding
+uint64_t quantile_rank(uint64_t total, double q) {
+  if (q <= 0.0)
+    return 1;
+  if (q >= 1.0)
+    return total;
+  return static_cast<uint64_t>(q * total + 0.999999);
+}
+
+}  // namespace
+
+uint64_t HistogramAggregator::log2_quantile(double q) const {
+  if (total_ == 0)
+    return 0;
+  uint64_t target = quantile_rank(total_, q), seen = 0;
+  for (size_t i = 0; i < slots_.size(); i++) {
+    seen += slots_[i];
+    if (seen >= target)
+      return log2_slot_high(i);
+  }
+  return log2_slot_high(slots_.size() - 1);
+}
+
+uint64_t HistogramAggregator::linear_quantile(double q,
+                                              uint64_t slot_width) const {
+  if (total_ == 0 || slot_width == 0)
+    return 0;
+  uint64_t target = quantile_rank(total_, q), seen = 0;
+  for (size_t i = 0; i < slots_.size(); i++) {
+    seen += slots_[i];
+    if (seen >= target)
+      return (i + 1) * slot_width - 1;
+  }
+  return slots_.size() * slot_width - 1;
+}
+
+void HistogramAggregator::log2_quantiles(const std::vector<double>& qs,
+                                         std::vector<uint64_t>& bounds) const {
+  bounds.assign(qs.size(), 0);
+  if (total_ == 0)
+    return;
+  size_t next = 0;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < slots_.size() && next < qs.size(); i++) {
+    seen += slots_[i];
+    while (next < qs.size() && seen >= quantile_rank(total_, qs[next]))
+      bounds[next++] = log2_slot_high(i);
+  }
+  while (next < qs.size())
+    bounds[next++] = log2_slot_high(slots_.size() - 1);
+}
+
+namespace {
+
+const uint32_t kSnapshotMagic = 0xbcc5a001;
+const uint16_t kSnapshotVersion = 1;
+const uint16_t kSnapshotCompressed = 0x1;
+
+void snap_put_u16(std::string& out, uint16_t v) {
+  out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+void snap_put_u32(std::string& out, uint32_t v) {
+  out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+void snap_put_u64(std::string& out, uint64_t v) {
+  out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+bool snap_get(const std::string& in, size_t& off, void* dst, size_t n) {
+  if (in.size() - off < n)
+    return false;
+  memcpy(dst, in.data() + off, n);
+  off += n;
+  return true;
+}
+
+void snap_put_varint(std::string& out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back(static_cast<char>(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<char>(v));
+}
+
+bool snap_get_varint(const std::string& in, size_t& off, uint64_t* v) {
+  uint64_t res = 0;
+  for (int shift = 0; shift < 64 && off < in.size(); shift += 7) {
+    uint8_t byte = in[off++];
+    res |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *v = res;
+      return true;
+    }
+  }
+  return false;
+}
+
+uint64_t snap_zigzag(int64_t v) {
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+int64_t snap_unzigzag(uint64_t v) {
+  return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+// transpose the packed records into 8-byte lanes (all entries' bytes
+// [lane*8, lane*8+8) back to back) and delta + zigzag + varint encode
+// each lane; the rec_size % 8 tail bytes of every record follow raw
+void snap_encode_columns(const std::string& records, size_t rec_size,
+                         uint64_t count, std::string& out) {
+  size_t lanes = rec_size / 8;
+  for (size_t lane = 0; lane < lanes; lane++) {
+    uint64_t prev = 0;
+    for (uint64_t i = 0; i < count; i++) {
+      uint64_t v;
+      memcpy(&v, records.data() + i * rec_size + lane * 8, 8);
+      snap_put_varint(out, snap_zigzag(static_cast<int64_t>(v - prev)));
+      prev = v;
+    }
+  }
+  size_t tail = rec_size % 8;
+  if (tail)
+    for (uint64_t i = 0; i < count; i++)
+      out.append(records.data() + i * rec_size + lanes * 8, tail);
+}
+
+bool snap_decode_columns(const std::string& in, size_t& off, size_t rec_size,
+                         uint64_t count, std::string& records) {
+  records.assign(rec_size * count, '\0');
+  size_t lanes = rec_size / 8;
+  for (size_t lane = 0; lane < lanes; lane++) {
+    uint64_t prev = 0;
+    for (uint64_t i = 0; i < count; i++) {
+      uint64_t delta;
+      if (!snap_get_varint(in, off, &delta))
+        return false;
+      prev += static_cast<uint64_t>(snap_unzigzag(delta));
+      memcpy(&records[i * rec_size + lane * 8], &prev, 8);
+    }
+  }
+  size_t tail = rec_size % 8;
+  if (tail)
+    for (uint64_t i = 0; i < count; i++)
+      if (!snap_get(in, off, &records[i * rec_size + lanes * 8], tail))
+        return false;
+  return true;
+}
+
+}  // namespace
+
+StatusTuple BPFTable::snapshot_write(std::string& out, bool compress) {
+  if (desc.type == BPF_MAP_TYPE_PERCPU_HASH ||
+      desc.type == BPF_MAP_TYPE_PERCPU_ARRAY ||
+      desc.type == BPF_MAP_TYPE_LRU_PERCPU_HASH)
+    return StatusTuple(-1,
+                       "Table '%s' is per-cpu; snapshot the summed or "
+                       "columnar view instead",
+                       desc.name.c_str());
+
+  std::string keys(desc.max_entries * desc.key_size, '\0');
+  std::string values(desc.max_entries * desc.leaf_size, '\0');
+  uint64_t total = 0;
+
+  uint32_t in_batch = 0, out_batch = 0;
+  bool first_batch = true;
+  bool batch_supported = true;
+  while (total < desc.max_entries) {
+    uint32_t count = desc.max_entries - total;
+    bool ok = this->lookup_batch(first_batch ? nullptr : &in_batch,
+                                 &out_batch, &keys[total * desc.key_size],
+                                 &values[total * desc.leaf_size], &count);
+    if (!ok && errno == EINVAL && first_batch) {
+      batch_supported = false;  // pre-v5.6 kernel: iterate instead
+      break;
+    }
+    total += count;
+    if (!ok && errno != ENOENT)
+      return StatusTuple(-1, "Error batch getting table: %s",
+                         std::strerror(errno));
+    first_batch = false;
+    in_batch = out_batch;
+    if (!ok)
+      break;  // ENOENT: whole map drained
+  }
+
+  if (!batch_supported) {
+    std::string key(desc.key_size, '\0');
+    if (this->first(&key[0])) {
+      while (total < desc.max_entries) {
+        if (!this->lookup(&key[0], &values[total * desc.leaf_size]))
+          break;
+        keys.replace(total * desc.key_size, desc.key_size, key);
+        total++;
+        if (!this->next(&key[0], &key[0]))
+          break;
+      }
+    }
+  }
+
+  std::string body;
+  snap_encode_columns(keys, desc.key_size, total, body);
+  snap_encode_columns(values, desc.leaf_size, total, body);
+
+  uint16_t flags = 0;
+  if (compress && !body.empty()) {
+    uLongf bound = compressBound(body.size());
+    std::string deflated(bound, '\0');
+    if (compress2(reinterpret_cast<Bytef*>(&deflated[0]), &bound,
+                  reinterpret_cast<const Bytef*>(body.data()), body.size(),
+                  Z_DEFAULT_COMPRESSION) == Z_OK &&
+        bound < body.size()) {
+      deflated.resize(bound);
+      body.swap(deflated);
+      flags |= kSnapshotCompressed;
+    }
+    // incompressible or failed: ship the encoded body as is
+  }
+
+  out.clear();
+  snap_put_u32(out, kSnapshotMagic);
+  snap_put_u16(out, kSnapshotVersion);
+  snap_put_u16(out, flags);
+  snap_put_u32(out, desc.key_size);
+  snap_put_u32(out, desc.leaf_size);
+  snap_put_u64(out, total);
+  snap_put_u64(out, body.size());
+  snap_put_varint(out, desc.name.size());
+  out.append(desc.name);
+  snap_put_varint(out, desc.key_desc.size());
+  out.append(desc.key_desc);
+  snap_put_varint(out, desc.leaf_desc.size());
+  out.append(desc.leaf_desc);
+  out.append(body);
+  return StatusTuple::OK();
+}
+
+StatusTuple BPFTable::snapshot_read(const std::string& in, snapshot_t& snap) {
+  size_t off = 0;
+  uint32_t magic = 0;
+  uint16_t version = 0, flags = 0;
+  uint64_t body_size = 0;
+
+  if (!snap_get(in, off, &magic, sizeof(magic)) || magic != kSnapshotMagic)
+    return StatusTuple(-1, "Not a table snapshot");
+  if (!snap_get(in, off, &version, sizeof(version)) ||
+      version != kSnapshotVersion)
+    return StatusTuple(-1, "Unsupported snapshot version %u", version);
+  if (!snap_get(in, off, &flags, sizeof(flags)) ||
+      !snap_get(in, off, &snap.key_size, sizeof(snap.key_size)) ||
+      !snap_get(in, off, &snap.leaf_size, sizeof(snap.leaf_size)) ||
+      !snap_get(in, off, &snap.count, sizeof(snap.count)) ||
+      !snap_get(in, off, &body_size, sizeof(body_size)))
+    return StatusTuple(-1, "Truncated snapshot header");
+
+  uint64_t len;
+  auto get_str = [&](std::string& s) {
+    if (!snap_get_varint(in, off, &len) || in.size() - off < len)
+      return false;
+    s.assign(in, off, len);
+    off += len;
+    return true;
+  };
+  if (!get_str(snap.name) || !get_str(snap.key_desc) ||
+      !get_str(snap.leaf_desc))
+    return StatusTuple(-1, "Truncated snapshot header");
+
+  // size sanity before sizing buffers from untrusted header fields
+  if (snap.key_size == 0 || snap.key_size > (1 << 20) ||
+      snap.leaf_size == 0 || snap.leaf_size > (1 << 20) ||
+      snap.count > (1ULL << 32))
+    return StatusTuple(-1, "Implausible snapshot dimensions");
+
+  if (in.size() - off != body_size)
+    return StatusTuple(-1, "Snapshot body size mismatch");
+  std::string body(in, off, body_size);
+  if (flags & kSnapshotCompressed) {
+    // the encoded columns are at worst 10 varint bytes per 8-byte lane
+    // value plus raw tails; 2x the record bytes covers that with room
+    uLongf inflated_size =
+        (static_cast<uint64_t>(snap.key_size) + snap.leaf_size) * snap.count *
+            2 +
+        64;
+    std::string inflated(inflated_size, '\0');
+    if (uncompress(reinterpret_cast<Bytef*>(&inflated[0]), &inflated_size,
+                   reinterpret_cast<const Bytef*>(body.data()),
+                   body.size()) != Z_OK)
+      return StatusTuple(-1, "Corrupt snapshot body");
+    inflated.resize(inflated_size);
+    body.swap(inflated);
+  }
+
+  size_t body_off = 0;
+  if (!snap_decode_columns(body, body_off, snap.key_size, snap.count,
+                           snap.keys) ||
+      !snap_decode_columns(body, body_off, snap.leaf_size, snap.count,
+                           snap.values) ||
+      body_off != body.size())
+    return StatusTuple(-1, "Corrupt snapshot body");
+  return StatusTuple::OK();
+}
+
+namespace {
+
+struct iter_dump_ctx {
+  size_t key_size;
+  const std::function<bool(const void*, const void*)>* sink;
+  bool stop;
+};
+
+int iter_dump_record(void* cb_cookie, void* data, size_t size) {
+  auto* ctx = static_cast<iter_dump_ctx*>(cb_cookie);
+  if (!ctx->stop) {
+    const char* record = static_cast<const char*>(data);
+    if (!(*ctx->sink)(record, record + ctx->key_size))
+      ctx->stop = true;
+  }
+  return 0;
+}
+
+}  // namespace
+
+StatusTuple dump_map_via_iter(
+    int map_fd, size_t key_size, size_t value_size, uint32_t max_entries,
+    const std::function<bool(const void*, const void*)>& sink) {
+  const size_t record_size = key_size + value_size;
+
+  // Each ring buffer record consumes its payload rounded up to 8 bytes plus
+  // an 8-byte header; size the buffer (power of two, at least one page) so
+  // even a full map cannot drop records.
+  size_t need =
+      (size_t)max_entries * (((record_size + 7) & ~(size_t)7) + 8);
+  size_t rb_size = 4096;
+  while (rb_size < need)
+    rb_size <<= 1;
+
+  FileDesc rb_fd(bcc_create_map(BPF_MAP_TYPE_RINGBUF, "bcc_iter_dump", 0, 0,
+                                rb_size, 0));
+  if (rb_fd < 0)
+    return StatusTuple(-1, "Unable to create dump ring buffer: %s",
+                       std::strerror(errno));
+
+  // bpf_iter__bpf_map_elem gives the program {meta, map, key, value}
+  // pointers at ctx offsets 0/8/16/24; key and value are NULL once the walk
+  // is past the last element. For each element, reserve a record in the
+  // ring buffer, copy key then value into it, and submit.
+  struct bpf_insn prog[] = {
+      BPF_LDX_MEM(BPF_DW, BPF_REG_6, BPF_REG_1, 16),  // r6 = ctx->key
+      BPF_JMP_IMM(BPF_JEQ, BPF_REG_6, 0, 21),
+      BPF_LDX_MEM(BPF_DW, BPF_REG_7, BPF_REG_1, 24),  // r7 = ctx->value
+      BPF_JMP_IMM(BPF_JEQ, BPF_REG_7, 0, 19),
+      // BPF_LD_MAP_FD spelled out: its internal casts trip C++ narrowing
+      // rules inside a braced initializer
+      BPF_RAW_INSN(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0,
+                   (int)rb_fd),
+      BPF_RAW_INSN(0, 0, 0, 0, 0),
+      BPF_MOV64_IMM(BPF_REG_2, (int)record_size),
+      BPF_MOV64_IMM(BPF_REG_3, 0),
+      BPF_RAW_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_ringbuf_reserve),
+      BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 13),  // full: drop the element
+      BPF_MOV64_REG(BPF_REG_8, BPF_REG_0),
+      BPF_MOV64_REG(BPF_REG_1, BPF_REG_8),
+      BPF_MOV64_IMM(BPF_REG_2, (int)key_size),
+      BPF_MOV64_REG(BPF_REG_3, BPF_REG_6),
+      BPF_RAW_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_probe_read_kernel),
+      BPF_MOV64_REG(BPF_REG_1, BPF_REG_8),
+      BPF_ALU64_IMM(BPF_ADD, BPF_REG_1, (int)key_size),
+      BPF_MOV64_IMM(BPF_REG_2, (int)value_size),
+      BPF_MOV64_REG(BPF_REG_3, BPF_REG_7),
+      BPF_RAW_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_probe_read_kernel),
+      BPF_MOV64_REG(BPF_REG_1, BPF_REG_8),
+      BPF_MOV64_IMM(BPF_REG_2, 0),
+      BPF_RAW_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_ringbuf_submit),
+      BPF_MOV64_IMM(BPF_REG_0, 0),
+      BPF_EXIT_INSN(),
+  };
+
+  // The bpf_iter__ prefix makes bcc_prog_load resolve the bpf_map_elem
+  // attach btf id from vmlinux BTF and set BPF_TRACE_ITER.
+  FileDesc prog_fd(bcc_prog_load(BPF_PROG_TYPE_TRACING,
+                                 "bpf_iter__bpf_map_elem", prog, sizeof(prog),
+                                 "GPL", 0, 0, nullptr, 0));
+  if (prog_fd < 0)
+    return StatusTuple(-1, "Unable to load map iterator program: %s",
+                       std::strerror(errno));
+
+  union bpf_iter_link_info link_info = {};
+  link_info.map.map_fd = map_fd;
+  FileDesc link_fd(
+      bcc_iter_attach(prog_fd, &link_info, sizeof(link_info)));
+  if (link_fd < 0)
+    return StatusTuple(-1, "Unable to attach map iterator: %s",
+                       std::strerror(errno));
+
+  FileDesc iter_fd(bcc_iter_create(link_fd));
+  if (iter_fd < 0)
+    return StatusTuple(-1, "Unable to create map iterator: %s",
+                       std::strerror(errno));
+
+  // The program emits nothing through the seq file, so a single read drives
+  // the whole kernel-side walk and returns 0 at the end of the map.
+  char drain[64];
+  ssize_t n;
+  while ((n = read(iter_fd, drain, sizeof(drain))) > 0) {
+  }
+  if (n < 0)
+    return StatusTuple(-1, "Error driving map iterator: %s",
+                       std::strerror(errno));
+
+  iter_dump_ctx ctx = {key_size, &sink, false};
+  struct ring_buffer* rb =
+      static_cast<struct ring_buffer*>(bpf_new_ringbuf(rb_fd,
+                                                       iter_dump_record, &ctx));
+  if (!rb)
+    return StatusTuple(-1, "Unable to open dump ring buffer: %s",
+                       std::strerror(errno));
+  int consumed = bpf_consume_ringbuf(rb);
+  bpf_free_ringbuf(rb);
+  if (consumed < 0)
+    return StatusTuple(-1, "Error reading dump ring buffer: %s",
+                       std::strerror(-consumed));
+
+  bcc_stats_add(BCC_STAT_MAP_LOOKUPS, consumed);
+  return StatusTuple::OK();
+}
+
 BPFStackTable::BPFStackTable(const TableDesc& desc, bool use_debug_file,
                              bool check_debug_file_crc)
     : BPFTableBase<int, stacktrace_t>(desc) {
@@ -265,7 +840,9 @@ BPFStackTable::BPFStackTable(const TableDesc& desc, bool use_debug_file,
 BPFStackTable::BPFStackTable(BPFStackTable&& that)
     : BPFTableBase<int, stacktrace_t>(that.desc),
       symbol_option_(std::move(that.symbol_option_)),
-      pid_sym_(std::move(that.pid_sym_)) {
+      pid_sym_(std::move(that.pid_sym_)),
+      sym_lru_(std::move(that.sym_lru_)),
+      sym_lru_index_(std::move(that.sym_lru_index_)) {
   that.pid_sym_.clear();
 }
 
@@ -280,12 +857,68 @@ void BPFStackTable::free_symcache(int pid) {
     bcc_free_symcache(iter->second, iter->first);
     pid_sym_.erase(iter);
   }
+  // symbolizations for this pid may be stale now
+  for (auto it = sym_lru_index_.begin(); it != sym_lru_index_.end();) {
+    if (it->first.first == pid) {
+      sym_lru_.erase(it->second);
+      it = sym_lru_index_.erase(it);
+    } else {
+      ++it;
+    }
+  }
 }
 
-void BPFStackTable::clear_table_non_atomic() {
-  for (int i = 0; size_t(i) < capacity(); i++) {
-    remove(&i);
+const std::vector<std::string>* BPFStackTable::lru_find(const TraceKey& key) {
+  auto it = sym_lru_index_.find(key);
+  if (it == sym_lru_index_.end())
+    return nullptr;
+  sym_lru_.splice(sym_lru_.begin(), sym_lru_, it->second);
+  return &it->second->second;
+}
+
+void BPFStackTable::lru_insert(TraceKey key,
+                               std::vector<std::string> symbols) {
+  if (sym_lru_.size() >= kSymbolLruCapacity) {
+    sym_lru_index_.erase(sym_lru_.back().first);
+    sym_lru_.pop_back();
+  }
+  sym_lru_.emplace_front(std::move(key), std::move(symbols));
+  sym_lru_index_[sym_lru_.front().first] = sym_lru_.begin();
+}
+
+// Deletes candidate stack ids in chunks of one BPF_MAP_DELETE_BATCH syscall
+// each. A batch stops with ENOENT at the first id not present in the map,
+// with the count updated to how many were processed, so absent ids are
+// skipped and the sweep resumed; any other failure means the kernel has no
+// batch support for this map and the per-id loop finishes the job.
+static void clear_stack_ids_batched(int fd, size_t capacity) {
+  static const uint32_t kChunkSize = 4096;
+  std::vector<int> keys(std::min<size_t>(capacity, kChunkSize));
+  size_t next = 0;
+  while (next < capacity) {
+    uint32_t count = std::min<size_t>(capacity - next, keys.size());
+    for (uint32_t i = 0; i < count; i++)
+      keys[i] = next + i;
+    if (bpf_delete_batch(fd, keys.data(), &count) >= 0)
+      next += count;
+    else if (errno == ENOENT)
+      next += count + 1;  // skip the absent id the batch stopped on
+    else
+      break;
   }
+  for (int i = next; size_t(i) < capacity; i++)
+    bpf_delete_elem(fd, &i);
+}
+
+void BPFStackTable::clear_table_non_atomic() {
+  clear_stack_ids_batched(desc.fd, capacity());
+}
+
+StatusTuple BPFStackTable::clear_and_swap(BPFMapInMapTable<int>& outer,
+                                          const int& slot,
+                                          BPFStackTable& spare) {
+  spare.clear_table_non_atomic();
+  return outer.update_value(slot, spare.desc.fd);
 }
 
 std::vector<uintptr_t> BPFStackTable::get_stack_addr(int stack_id) {
@@ -300,22 +933,27 @@ std::vector<uintptr_t> BPFStackTable::get_stack_addr(int stack_id) {
   return res;
 }
 
-std::vector<std::string> BPFStackTable::get_stack_symbol(int stack_id,
+const std::vector<std::string>* BPFStackTable::symbolize(int stack_id,
                                                          int pid) {
   auto addresses = get_stack_addr(stack_id);
-  std::vector<std::string> res;
   if (addresses.empty())
-    return res;
-  res.reserve(addresses.size());
+    return nullptr;
 
   if (pid < 0)
     pid = -1;
+
+  TraceKey key(pid, std::move(addresses));
+  if (const std::vector<std::string>* cached = lru_find(key))
+    return cached;
+
   if (pid_sym_.find(pid) == pid_sym_.end())
     pid_sym_[pid] = bcc_symcache_new(pid, &symbol_option_);
   void* cache = pid_sym_[pid];
 
+  std::vector<std::string> res;
+  res.reserve(key.second.size());
   bcc_symbol symbol;
-  for (auto addr : addresses)
+  for (auto addr : key.second)
     if (bcc_symcache_resolve(cache, addr, &symbol) != 0)
       res.emplace_back("[UNKNOWN]");
     else {
@@ -323,7 +961,54 @@ std::vector<std::string> BPFStackTable::get_stack_symbol(int stack_id,
       bcc_symbol_free_demangle_name(&symbol);
     }
 
-  return res;
+  lru_insert(std::move(key), std::move(res));
+  return &sym_lru_.front().second;
+}
+
+std::vector<std::string> BPFStackTable::get_stack_symbol(int stack_id,
+                                                         int pid) {
+  const std::vector<std::string>* syms = symbolize(stack_id, pid);
+  return syms ? *syms : std::vector<std::string>();
+}
+
+size_t BPFStackTable::fold_stacks(const std::vector<folded_sample>& samples,
+                                  std::string& out) {
+  // a collapsed line is typically well under this; reserving up front keeps
+  // the append loop from regrowing the buffer mid-pass
+  out.reserve(out.size() + samples.size() * 256);
+
+  size_t lines = 0;
+  for (const auto& sample : samples) {
+    size_t line_start = out.size();
+    if (sample.comm && *sample.comm)
+      out.append(sample.comm);
+
+    // folded format runs root to leaf; traces come back leaf-first
+    auto append_frames = [&](int stack_id, int pid, const char* suffix) {
+      const std::vector<std::string>* syms = symbolize(stack_id, pid);
+      if (!syms)
+        return;
+      for (auto it = syms->rbegin(); it != syms->rend(); ++it) {
+        if (out.size() != line_start)
+          out.push_back(';');
+        out.append(*it);
+        if (suffix)
+          out.append(suffix);
+      }
+    };
+    if (sample.user_stack_id >= 0)
+      append_frames(sample.user_stack_id, sample.pid, nullptr);
+    if (sample.kernel_stack_id >= 0)
+      append_frames(sample.kernel_stack_id, -1, "_[k]");
+
+    if (out.size() == line_start)
+      out.append("[UNKNOWN]");
+    char count[32];
+    int len = ::snprintf(count, sizeof(count), " %" PRIu64 "\n", sample.count);
+    out.append(count, len);
+    lines++;
+  }
+  return lines;
 }
 
 BPFStackBuildIdTable::BPFStackBuildIdTable(const TableDesc& desc, bool use_debug_file,
@@ -342,9 +1027,7 @@ BPFStackBuildIdTable::BPFStackBuildIdTable(const TableDesc& desc, bool use_debug
 }
 
 void BPFStackBuildIdTable::clear_table_non_atomic() {
-  for (int i = 0; size_t(i) < capacity(); i++) {
-    remove(&i);
-  }
+  clear_stack_ids_batched(desc.fd, capacity());
 }
 
 std::vector<bpf_stack_build_id> BPFStackBuildIdTable::get_stack_addr(int stack_id) {
@@ -390,6 +1073,281 @@ std::vector<std::string> BPFStackBuildIdTable::get_stack_symbol(int stack_id)
   return res;
 }
 
+BPFRawStackDecoder::BPFRawStackDecoder(bool use_debug_file,
+                                       bool check_debug_file_crc) {
+  uint32_t use_symbol_type = (1 << STT_FUNC) | (1 << STT_GNU_IFUNC);
+  symbol_option_ = {.use_debug_file = use_debug_file,
+                    .check_debug_file_crc = check_debug_file_crc,
+                    .lazy_symbolize = 1,
+                    .use_symbol_type = use_symbol_type};
+}
+
+BPFRawStackDecoder::~BPFRawStackDecoder() {
+  for (auto it : pid_sym_)
+    bcc_free_symcache(it.second, it.first);
+}
+
+void BPFRawStackDecoder::free_symcache(int pid) {
+  auto iter = pid_sym_.find(pid);
+  if (iter != pid_sym_.end()) {
+    bcc_free_symcache(iter->second, iter->first);
+    pid_sym_.erase(iter);
+  }
+}
+
+int BPFRawStackDecoder::intern(const uint64_t* ips, uint32_t nr) {
+  if (nr == 0)
+    return -1;
+
+  // FNV-1a over the raw frames; collisions fall through to a frame
+  // comparison against every id in the bucket
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(ips);
+  for (size_t i = 0; i < nr * sizeof(uint64_t); i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+
+  auto& bucket = hash_index_[hash];
+  for (int id : bucket) {
+    const stack_span& span = stacks_[id];
+    if (span.len == nr &&
+        memcmp(&arena_[span.off], ips, nr * sizeof(uint64_t)) == 0)
+      return id;
+  }
+
+  int id = stacks_.size();
+  stacks_.push_back({arena_.size(), nr});
+  arena_.insert(arena_.end(), ips, ips + nr);
+  bucket.push_back(id);
+  return id;
+}
+
+BPFRawStackDecoder::raw_stack_sample BPFRawStackDecoder::add_event(
+    const void* data, int size) {
+  raw_stack_sample sample = {0, -1, -1};
+  const size_t hdr_size = offsetof(raw_stack_event_t, ips);
+  if (size < 0 || (size_t)size < hdr_size)
+    return sample;
+
+  auto event = static_cast<const raw_stack_event_t*>(data);
+  sample.pid = event->pid;
+  uint32_t kernel_nr = event->kernel_nr > 0 ? event->kernel_nr : 0;
+  uint32_t user_nr = event->user_nr > 0 ? event->user_nr : 0;
+  if (kernel_nr > BPF_MAX_STACK_DEPTH || user_nr > BPF_MAX_STACK_DEPTH ||
+      hdr_size + (kernel_nr + user_nr) * sizeof(uint64_t) > (size_t)size)
+    return sample;
+
+  sample.kernel_stack_id = intern(event->ips, kernel_nr);
+  sample.user_stack_id = intern(event->ips + kernel_nr, user_nr);
+  return sample;
+}
+
+std::vector<uintptr_t> BPFRawStackDecoder::get_stack_addr(int stack_id) {
+  std::vector<uintptr_t> res;
+  if (stack_id < 0 || (size_t)stack_id >= stacks_.size())
+    return res;
+  const stack_span& span = stacks_[stack_id];
+  res.assign(arena_.begin() + span.off, arena_.begin() + span.off + span.len);
+  return res;
+}
+
+std::vector<std::string> BPFRawStackDecoder::get_stack_symbol(int stack_id,
+                                                              int pid) {
+  auto addresses = get_stack_addr(stack_id);
+  std::vector<std::string> res;
+  if (addresses.empty())
+    return res;
+  res.reserve(addresses.size());
+
+  if (pid < 0)
+    pid = -1;
+  if (pid_sym_.find(pid) == pid_sym_.end())
+    pid_sym_[pid] = bcc_symcache_new(pid, &symbol_option_);
+  void* cache = pid_sym_[pid];
+
+  bcc_symbol symbol;
+  for (auto addr : addresses)
+    if (bcc_symcache_resolve(cache, addr, &symbol) != 0)
+      res.emplace_back("[UNKNOWN]");
+    else {
+      res.push_back(symbol.demangle_name);
+      bcc_symbol_free_demangle_name(&symbol);
+    }
+  return res;
+}
+
+BPFCallchainSampler::BPFCallchainSampler(bool use_debug_file,
+                                         bool check_debug_file_crc)
+    : cb_(nullptr), cb_cookie_(nullptr), epfd_(-1) {
+  uint32_t use_symbol_type = (1 << STT_FUNC) | (1 << STT_GNU_IFUNC);
+  symbol_option_ = {.use_debug_file = use_debug_file,
+                    .check_debug_file_crc = check_debug_file_crc,
+                    .lazy_symbolize = 1,
+                    .use_symbol_type = use_symbol_type};
+}
+
+BPFCallchainSampler::~BPFCallchainSampler() {
+  close_all_cpu();
+  for (auto it : pid_sym_)
+    bcc_free_symcache(it.second, it.first);
+}
+
+// Splits each decoded chain at the PERF_CONTEXT_* markers into kernel and
+// user frame runs and hands the whole batch to the user callback. Frames
+// before the first marker (possible when the chain starts in the kernel
+// without an explicit marker) are treated as kernel frames.
+void BPFCallchainSampler::callchain_trampoline(
+    void* cookie, struct perf_reader_callchain_event* events, int cnt) {
+  auto self = static_cast<BPFCallchainSampler*>(cookie);
+  self->scratch_.clear();
+  self->scratch_.reserve(cnt);
+  for (int i = 0; i < cnt; i++) {
+    callchain_sample s = {};
+    s.pid = events[i].pid;
+    s.tid = events[i].tid;
+    const uint64_t* ips = events[i].ips;
+    uint64_t nr = events[i].nr;
+    bool in_user = false;
+    for (uint64_t j = 0; j < nr; j++) {
+      if (ips[j] >= PERF_CONTEXT_MAX) {
+        in_user = (ips[j] == PERF_CONTEXT_USER);
+        continue;
+      }
+      if (in_user) {
+        if (!s.user_ips)
+          s.user_ips = &ips[j];
+        s.user_nr++;
+      } else {
+        if (!s.kernel_ips)
+          s.kernel_ips = &ips[j];
+        s.kernel_nr++;
+      }
+    }
+    self->scratch_.push_back(s);
+  }
+  if (!self->scratch_.empty())
+    self->cb_(self->cb_cookie_, self->scratch_.data(), self->scratch_.size());
+}
+
+StatusTuple BPFCallchainSampler::open_all_cpu(uint32_t ev_type,
+                                              uint64_t ev_config,
+                                              uint64_t sample_freq, pid_t pid,
+                                              sample_batch_cb cb,
+                                              void* cb_cookie, int page_cnt,
+                                              int max_stack, int max_batch) {
+  if (cpu_readers_.size() != 0 || epfd_ != -1)
+    return StatusTuple(-1, "Previously opened callchain sampler not cleaned");
+  if (page_cnt & (page_cnt - 1))
+    return StatusTuple(-1, "Page count (%d) must be a power of two", page_cnt);
+
+  cb_ = cb;
+  cb_cookie_ = cb_cookie;
+  std::vector<int> cpus = get_online_cpus();
+  ep_events_.reset(new epoll_event[cpus.size()]);
+  epfd_ = epoll_create1(EPOLL_CLOEXEC);
+
+  for (int i : cpus) {
+    auto reader = perf_reader_new(nullptr, nullptr, this, page_cnt);
+    if (!reader) {
+      TRY2(close_all_cpu());
+      return StatusTuple(-1, "Unable to construct perf reader");
+    }
+    if (perf_reader_set_callchain_cb(reader, callchain_trampoline, max_batch,
+                                     0) != 0) {
+      perf_reader_free(static_cast<void*>(reader));
+      TRY2(close_all_cpu());
+      return StatusTuple(-1, "Unable to enable callchain mode");
+    }
+    int fd = bpf_open_perf_sample_callchain(ev_type, ev_config, sample_freq,
+                                            max_stack, pid, i);
+    if (fd < 0) {
+      perf_reader_free(static_cast<void*>(reader));
+      TRY2(close_all_cpu());
+      return StatusTuple(-1, "Unable to open sampling event on CPU %d: %s", i,
+                         std::strerror(errno));
+    }
+    perf_reader_set_fd(reader, fd);
+    if (perf_reader_mmap(reader) != 0) {
+      perf_reader_free(static_cast<void*>(reader));
+      TRY2(close_all_cpu());
+      return StatusTuple(-1, "Unable to mmap sampling ring on CPU %d", i);
+    }
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = static_cast<void*>(reader);
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+      perf_reader_free(static_cast<void*>(reader));
+      TRY2(close_all_cpu());
+      return StatusTuple(-1, "Unable to add perf_reader FD to epoll: %s",
+                         std::strerror(errno));
+    }
+    cpu_readers_[i] = reader;
+  }
+  return StatusTuple::OK();
+}
+
+StatusTuple BPFCallchainSampler::close_all_cpu() {
+  for (auto it : cpu_readers_)
+    perf_reader_free(static_cast<void*>(it.second));
+  cpu_readers_.clear();
+  ep_events_.reset();
+  if (epfd_ >= 0) {
+    int close_res = ::close(epfd_);
+    epfd_ = -1;
+    if (close_res != 0)
+      return StatusTuple(-1, "Unable to close epoll FD: %s",
+                         std::strerror(errno));
+  }
+  return StatusTuple::OK();
+}
+
+int BPFCallchainSampler::poll(int timeout_ms) {
+  if (epfd_ < 0)
+    return -1;
+  int cnt =
+      epoll_wait(epfd_, ep_events_.get(), cpu_readers_.size(), timeout_ms);
+  for (int i = 0; i < cnt; i++)
+    perf_reader_event_read(
+        static_cast<perf_reader*>(ep_events_[i].data.ptr));
+  return cnt;
+}
+
+void* BPFCallchainSampler::get_symcache(int pid) {
+  if (pid < 0)
+    pid = -1;
+  if (pid_sym_.find(pid) == pid_sym_.end())
+    pid_sym_[pid] = bcc_symcache_new(pid, &symbol_option_);
+  return pid_sym_[pid];
+}
+
+void BPFCallchainSampler::symbolize(const uint64_t* ips, size_t nr, int pid,
+                                    std::vector<std::string>& out) {
+  out.clear();
+  if (nr == 0)
+    return;
+  void* cache = get_symcache(pid);
+  std::vector<bcc_symbol> syms(nr);
+  bcc_symcache_resolve_batch(cache, ips, nr, syms.data());
+  out.reserve(nr);
+  for (size_t i = 0; i < nr; i++) {
+    if (syms[i].demangle_name) {
+      out.emplace_back(syms[i].demangle_name);
+      bcc_symbol_free_demangle_name(&syms[i]);
+    } else {
+      out.emplace_back("[UNKNOWN]");
+    }
+  }
+}
+
+void BPFCallchainSampler::free_symcache(int pid) {
+  auto iter = pid_sym_.find(pid);
+  if (iter != pid_sym_.end()) {
+    bcc_free_symcache(iter->second, iter->first);
+    pid_sym_.erase(iter);
+  }
+}
+
 BPFPerfBuffer::BPFPerfBuffer(const TableDesc& desc)
     : BPFTableBase<int, int>(desc), epfd_(-1) {
   if (desc.type != BPF_MAP_TYPE_PERF_EVENT_ARRAY)
@@ -403,8 +1361,12 @@ StatusTuple BPFPerfBuffer::open_on_cpu(perf_reader_raw_cb cb, perf_reader_lost_c
   if (cpu_readers_.find(opts.cpu) != cpu_readers_.end())
     return StatusTuple(-1, "Perf buffer already open on CPU %d", opts.cpu);
 
-  auto reader = static_cast<perf_reader*>(
-      bpf_open_perf_buffer_opts(cb, lost_cb, cb_cookie, page_cnt, &opts));
+  // interpose the batch-unpacking trampoline so coalesced submissions are
+  // split back into single records before any downstream callback
+  std::unique_ptr<UnpackState> state(new UnpackState{cb, lost_cb, cb_cookie});
+  auto reader = static_cast<perf_reader*>(bpf_open_perf_buffer_opts(
+      coalesce_unpack_trampoline, lost_cb ? coalesce_lost_trampoline : nullptr,
+      state.get(), page_cnt, &opts));
   if (reader == nullptr)
     return StatusTuple(-1, "Unable to construct perf reader");
 
@@ -425,9 +1387,33 @@ StatusTuple BPFPerfBuffer::open_on_cpu(perf_reader_raw_cb cb, perf_reader_lost_c
   }
 
   cpu_readers_[opts.cpu] = reader;
+  unpack_states_.push_back(std::move(state));
   return StatusTuple::OK();
 }
 
+void BPFPerfBuffer::coalesce_unpack_trampoline(void* cookie, void* data,
+                                               int size) {
+  auto state = static_cast<UnpackState*>(cookie);
+  auto hdr = static_cast<bpf_perf_coalesce_hdr*>(data);
+  if (size >= (int)sizeof(*hdr) && hdr->magic == BPF_PERF_COALESCE_MAGIC &&
+      hdr->rec_size > 0 && hdr->count > 0 &&
+      (size_t)size >= sizeof(*hdr) + (size_t)hdr->rec_size * hdr->count) {
+    // a flush submits the full staging struct, so trailing slots past
+    // hdr.count are stale; deliver only the valid records
+    char* rec = static_cast<char*>(data) + sizeof(*hdr);
+    for (uint32_t i = 0; i < hdr->count; i++, rec += hdr->rec_size)
+      state->cb(state->cb_cookie, rec, hdr->rec_size);
+    return;
+  }
+  state->cb(state->cb_cookie, data, size);
+}
+
+void BPFPerfBuffer::coalesce_lost_trampoline(void* cookie, uint64_t lost) {
+  auto state = static_cast<UnpackState*>(cookie);
+  if (state->lost_cb)
+    state->lost_cb(state->cb_cookie, lost);
+}
+
 StatusTuple BPFPerfBuffer::open_all_cpu(perf_reader_raw_cb cb,
                                         perf_reader_lost_cb lost_cb,
                                         void* cb_cookie, int page_cnt) {
@@ -438,10 +1424,22 @@ StatusTuple BPFPerfBuffer::open_all_cpu(perf_reader_raw_cb cb,
                                         perf_reader_lost_cb lost_cb,
                                         void* cb_cookie, int page_cnt,
                                         int wakeup_events)
+{
+  return open_all_cpu(cb, lost_cb, cb_cookie, page_cnt, wakeup_events, false,
+                      false);
+}
+
+StatusTuple BPFPerfBuffer::open_all_cpu(perf_reader_raw_cb cb,
+                                        perf_reader_lost_cb lost_cb,
+                                        void* cb_cookie, int page_cnt,
+                                        int wakeup_events, bool use_hugetlb,
+                                        bool numa_bind,
+                                        int wakeup_watermark_bytes)
 {
   if (cpu_readers_.size() != 0 || epfd_ != -1)
     return StatusTuple(-1, "Previously opened perf buffer not cleaned");
 
+  numa_bind_ = numa_bind;
   std::vector<int> cpus = get_online_cpus();
   ep_events_.reset(new epoll_event[cpus.size()]);
   epfd_ = epoll_create1(EPOLL_CLOEXEC);
@@ -451,6 +1449,8 @@ StatusTuple BPFPerfBuffer::open_all_cpu(perf_reader_raw_cb cb,
       .pid = -1,
       .cpu = i,
       .wakeup_events = wakeup_events,
+      .wakeup_watermark_bytes = wakeup_watermark_bytes,
+      .use_hugetlb = use_hugetlb ? 1 : 0,
     };
     auto res = open_on_cpu(cb, lost_cb, cb_cookie, page_cnt, opts);
     if (!res.ok()) {
@@ -458,7 +1458,390 @@ StatusTuple BPFPerfBuffer::open_all_cpu(perf_reader_raw_cb cb,
       return res;
     }
   }
-  return StatusTuple::OK();
+  return StatusTuple::OK();
+}
+
+StatusTuple BPFPerfBuffer::open_all_cpu_capture(const std::string& capture_dir,
+                                                int page_cnt) {
+  if (cpu_readers_.size() != 0 || epfd_ != -1)
+    return StatusTuple(-1, "Previously opened perf buffer not cleaned");
+
+  if (mkdir(capture_dir.c_str(), 0700) != 0 && errno != EEXIST)
+    return StatusTuple(-1, "Unable to create %s: %s", capture_dir.c_str(),
+                       std::strerror(errno));
+
+  std::vector<int> cpus = get_online_cpus();
+  ep_events_.reset(new epoll_event[cpus.size()]);
+  epfd_ = epoll_create1(EPOLL_CLOEXEC);
+
+  for (int i : cpus) {
+    struct bcc_perf_buffer_opts opts = {
+      .pid = -1,
+      .cpu = i,
+      .wakeup_events = 1,
+    };
+    auto res = open_on_cpu(nullptr, nullptr, nullptr, page_cnt, opts);
+    if (!res.ok()) {
+      TRY2(close_all_cpu());
+      return res;
+    }
+    std::string path = capture_dir + "/cpu" + std::to_string(i) + ".cap";
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0600);
+    if (fd < 0 || perf_reader_set_capture_fd(cpu_readers_[i], fd) != 0) {
+      StatusTuple err(-1, "Unable to open capture file %s: %s", path.c_str(),
+                      std::strerror(errno));
+      if (fd >= 0)
+        ::close(fd);
+      TRY2(close_all_cpu());
+      return err;
+    }
+    capture_fds_.push_back(fd);
+  }
+  return StatusTuple::OK();
+}
+
+int64_t BPFPerfBuffer::replay_capture(const std::string& capture_dir,
+                                      perf_reader_raw_cb cb,
+                                      perf_reader_lost_cb lost_cb,
+                                      void* cb_cookie) {
+  if (!cb)
+    return -1;
+  DIR* dir = opendir(capture_dir.c_str());
+  if (!dir)
+    return -1;
+  std::vector<std::pair<int, std::string>> files;
+  while (struct dirent* ent = readdir(dir)) {
+    int cpu;
+    char tail;
+    if (sscanf(ent->d_name, "cpu%d.ca%c", &cpu, &tail) == 2 && tail == 'p')
+      files.emplace_back(cpu, capture_dir + "/" + ent->d_name);
+  }
+  closedir(dir);
+  if (files.empty())
+    return -1;
+  std::sort(files.begin(), files.end());
+
+  // run through the same unpacking trampoline as live delivery, so
+  // coalesced batches captured raw are split back into single records
+  UnpackState state{cb, lost_cb, cb_cookie};
+  int64_t total = 0;
+  for (const auto& file : files) {
+    int fd = ::open(file.second.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return -1;
+    int64_t n = perf_reader_replay(fd, coalesce_unpack_trampoline,
+                                   lost_cb ? coalesce_lost_trampoline : nullptr,
+                                   &state);
+    ::close(fd);
+    if (n < 0)
+      return -1;
+    total += n;
+  }
+  return total;
+}
+
+void BPFPerfBuffer::adaptive_raw_trampoline(void* cookie, void* data,
+                                            int size) {
+  auto state = static_cast<AdaptiveCpuState*>(cookie);
+  state->events_since_check++;
+  if (state->buffer->user_raw_cb_)
+    state->buffer->user_raw_cb_(state->buffer->user_cb_cookie_, data, size);
+}
+
+void BPFPerfBuffer::adaptive_lost_trampoline(void* cookie, uint64_t lost) {
+  auto state = static_cast<AdaptiveCpuState*>(cookie);
+  state->lost_since_check += lost;
+  if (state->buffer->user_lost_cb_)
+    state->buffer->user_lost_cb_(state->buffer->user_cb_cookie_, lost);
+}
+
+StatusTuple BPFPerfBuffer::open_on_cpus(const std::vector<int>& cpus,
+                                        perf_reader_raw_cb cb,
+                                        perf_reader_lost_cb lost_cb,
+                                        void* cb_cookie, int page_cnt,
+                                        int wakeup_events) {
+  if (cpu_readers_.size() != 0 || epfd_ != -1)
+    return StatusTuple(-1, "Previously opened perf buffer not cleaned");
+  if (cpus.empty())
+    return StatusTuple(-1, "open_on_cpus requires at least one CPU");
+
+  ep_events_.reset(new epoll_event[cpus.size()]);
+  epfd_ = epoll_create1(EPOLL_CLOEXEC);
+
+  for (int i : cpus) {
+    struct bcc_perf_buffer_opts opts = {
+      .pid = -1,
+      .cpu = i,
+      .wakeup_events = wakeup_events,
+    };
+    auto res = open_on_cpu(cb, lost_cb, cb_cookie, page_cnt, opts);
+    if (!res.ok()) {
+      TRY2(close_all_cpu());
+      return res;
+    }
+  }
+  return StatusTuple::OK();
+}
+StatusTuple BPFPerfBuffer::open_all_cpu_adaptive(perf_reader_raw_cb cb,
+                                                 perf_reader_lost_cb lost_cb,
+                                                 void* cb_cookie,
+                                                 int min_page_cnt,
+                                                 int max_page_cnt) {
+  if (cpu_readers_.size() != 0 || epfd_ != -1)
+    return StatusTuple(-1, "Previously opened perf buffer not cleaned");
+  if (min_page_cnt < 1 || (min_page_cnt & (min_page_cnt - 1)) != 0 ||
+      (max_page_cnt & (max_page_cnt - 1)) != 0 || max_page_cnt < min_page_cnt)
+    return StatusTuple(
+        -1, "Adaptive perf buffer page counts must be powers of two with "
+            "min <= max");
+
+  adaptive_ = true;
+  min_page_cnt_ = min_page_cnt;
+  max_page_cnt_ = max_page_cnt;
+  user_raw_cb_ = cb;
+  user_lost_cb_ = lost_cb;
+  user_cb_cookie_ = cb_cookie;
+  last_rebalance_ns_ = bcc_stats_now_ns();
+
+  std::vector<int> cpus = get_online_cpus();
+  ep_events_.reset(new epoll_event[cpus.size()]);
+  epfd_ = epoll_create1(EPOLL_CLOEXEC);
+
+  for (int i : cpus) {
+    auto state = std::unique_ptr<AdaptiveCpuState>(new AdaptiveCpuState);
+    state->buffer = this;
+    state->cpu = i;
+    state->page_cnt = min_page_cnt;
+    struct bcc_perf_buffer_opts opts = {
+      .pid = -1,
+      .cpu = i,
+      .wakeup_events = 1,
+    };
+    auto res = open_on_cpu(adaptive_raw_trampoline, adaptive_lost_trampoline,
+                           state.get(), min_page_cnt, opts);
+    if (!res.ok()) {
+      TRY2(close_all_cpu());
+      return res;
+    }
+    adaptive_state_[i] = std::move(state);
+  }
+  return StatusTuple::OK();
+}
+
+static const uint32_t kSpoolWrapMarker = 0xffffffffu;
+
+void BPFPerfBuffer::pipeline_raw_trampoline(void* cookie, void* data,
+                                            int size) {
+  static_cast<BPFPerfBuffer*>(cookie)->spool_push(data, size);
+}
+
+void BPFPerfBuffer::pipeline_lost_trampoline(void* cookie, uint64_t lost) {
+  auto buffer = static_cast<BPFPerfBuffer*>(cookie);
+  {
+    std::lock_guard<std::mutex> lock(buffer->spool_mutex_);
+    buffer->pstats_.lost_events += lost;
+  }
+  if (buffer->user_lost_cb_)
+    buffer->user_lost_cb_(buffer->user_cb_cookie_, lost);
+}
+
+// Stage one, called from the drain thread for every kernel-ring event: one
+// memcpy into the spool, waiting for the decode stage only when the spool
+// is completely full (the kernel ring keeps absorbing events meanwhile).
+void BPFPerfBuffer::spool_push(const void* data, int size) {
+  size_t need = sizeof(uint32_t) + (size_t)size;
+  size_t cap = spool_.size();
+  std::unique_lock<std::mutex> lock(spool_mutex_);
+
+  if (need + sizeof(uint32_t) > cap) {
+    // record larger than the whole spool; deliver inline rather than stall
+    lock.unlock();
+    if (user_raw_cb_)
+      user_raw_cb_(user_cb_cookie_, const_cast<void*>(data), size);
+    return;
+  }
+
+  for (;;) {
+    size_t free_bytes = cap - spool_used_;
+    if (spool_head_ + need <= cap) {
+      if (need <= free_bytes)
+        break;
+    } else {
+      // record would straddle the end; wrap, wasting the tail gap
+      size_t waste = cap - spool_head_;
+      if (need + waste <= free_bytes) {
+        if (waste >= sizeof(uint32_t))
+          std::memcpy(&spool_[spool_head_], &kSpoolWrapMarker,
+                      sizeof(kSpoolWrapMarker));
+        spool_used_ += waste;
+        spool_head_ = 0;
+        break;
+      }
+    }
+    if (!pipeline_running_.load(std::memory_order_acquire))
+      return;
+    pstats_.spool_full_waits++;
+    spool_space_cv_.wait(lock);
+  }
+
+  uint32_t record_size = size;
+  std::memcpy(&spool_[spool_head_], &record_size, sizeof(record_size));
+  std::memcpy(&spool_[spool_head_ + sizeof(record_size)], data, size);
+  spool_head_ += need;
+  if (spool_head_ == cap)
+    spool_head_ = 0;
+  spool_used_ += need;
+  pstats_.spooled_events++;
+  pstats_.spooled_bytes += size;
+  if (spool_used_ > pstats_.spool_high_watermark)
+    pstats_.spool_high_watermark = spool_used_;
+  spool_cv_.notify_one();
+}
+
+// Stage two: deliver spooled records to the user callback in place. Keeps
+// draining whatever is left after shutdown is requested, then exits.
+void BPFPerfBuffer::decode_thread_fn() {
+  std::unique_lock<std::mutex> lock(spool_mutex_);
+  for (;;) {
+    spool_cv_.wait(lock, [this] {
+      return spool_used_ > 0 ||
+             !pipeline_running_.load(std::memory_order_acquire);
+    });
+    if (spool_used_ == 0) {
+      if (!pipeline_running_.load(std::memory_order_acquire))
+        return;
+      continue;
+    }
+
+    size_t cap = spool_.size();
+    if (spool_tail_ + sizeof(uint32_t) > cap ||
+        std::memcmp(&spool_[spool_tail_], &kSpoolWrapMarker,
+                    sizeof(kSpoolWrapMarker)) == 0) {
+      size_t waste = cap - spool_tail_;
+      spool_tail_ = 0;
+      spool_used_ -= waste;
+      spool_space_cv_.notify_one();
+      continue;
+    }
+
+    uint32_t record_size;
+    std::memcpy(&record_size, &spool_[spool_tail_], sizeof(record_size));
+    uint8_t* payload = &spool_[spool_tail_ + sizeof(record_size)];
+    lock.unlock();
+    // safe without the lock: the producer cannot reuse this region until
+    // spool_used_ shrinks below, which only happens right after this
+    if (user_raw_cb_)
+      user_raw_cb_(user_cb_cookie_, payload, (int)record_size);
+    lock.lock();
+
+    size_t total = sizeof(record_size) + record_size;
+    spool_tail_ += total;
+    if (spool_tail_ == cap)
+      spool_tail_ = 0;
+    spool_used_ -= total;
+    pstats_.delivered_events++;
+    spool_space_cv_.notify_one();
+  }
+}
+
+StatusTuple BPFPerfBuffer::open_all_cpu_pipelined(perf_reader_raw_cb cb,
+                                                  perf_reader_lost_cb lost_cb,
+                                                  void* cb_cookie,
+                                                  int page_cnt,
+                                                  size_t spool_bytes) {
+  if (cpu_readers_.size() != 0 || epfd_ != -1)
+    return StatusTuple(-1, "Previously opened perf buffer not cleaned");
+  if (page_cnt < 1 || (page_cnt & (page_cnt - 1)) != 0)
+    return StatusTuple(-1, "open_all_cpu_pipelined page_cnt must be a power of two");
+  if (spool_bytes < 4096)
+    spool_bytes = 4096;
+
+  pipelined_ = true;
+  user_raw_cb_ = cb;
+  user_lost_cb_ = lost_cb;
+  user_cb_cookie_ = cb_cookie;
+  spool_.assign(spool_bytes, 0);
+  spool_head_ = spool_tail_ = spool_used_ = 0;
+  pstats_ = PipelineStats();
+
+  std::vector<int> cpus = get_online_cpus();
+  ep_events_.reset(new epoll_event[cpus.size()]);
+  epfd_ = epoll_create1(EPOLL_CLOEXEC);
+
+  for (int i : cpus) {
+    struct bcc_perf_buffer_opts opts = {
+      .pid = -1,
+      .cpu = i,
+      .wakeup_events = 1,
+    };
+    auto res = open_on_cpu(pipeline_raw_trampoline, pipeline_lost_trampoline,
+                           this, page_cnt, opts);
+    if (!res.ok()) {
+      TRY2(close_all_cpu());
+      return res;
+    }
+  }
+
+  pipeline_running_.store(true, std::memory_order_release);
+  decode_thread_ = std::thread(&BPFPerfBuffer::decode_thread_fn, this);
+
+  std::vector<perf_reader*> readers;
+  for (auto it : cpu_readers_)
+    readers.push_back(it.second);
+  consume_running_.store(true, std::memory_order_release);
+  consume_threads_.emplace_back(&BPFPerfBuffer::consume_thread_fn, this,
+                                std::move(readers), std::vector<int>());
+  return StatusTuple::OK();
+}
+
+BPFPerfBuffer::PipelineStats BPFPerfBuffer::pipeline_stats() {
+  std::lock_guard<std::mutex> lock(spool_mutex_);
+  return pstats_;
+}
+
+StatusTuple BPFPerfBuffer::resize_cpu(AdaptiveCpuState& state,
+                                      int new_page_cnt) {
+  // The ring is torn down and reopened at the new size; events produced in
+  // between land in a missing map slot and are dropped, so callers only
+  // resize rings that are already dropping or completely idle.
+  TRY2(close_on_cpu(state.cpu));
+  struct bcc_perf_buffer_opts opts = {
+    .pid = -1,
+    .cpu = state.cpu,
+    .wakeup_events = 1,
+  };
+  TRY2(open_on_cpu(adaptive_raw_trampoline, adaptive_lost_trampoline, &state,
+                   new_page_cnt, opts));
+  state.page_cnt = new_page_cnt;
+  return StatusTuple::OK();
+}
+
+void BPFPerfBuffer::rebalance() {
+  uint64_t now = bcc_stats_now_ns();
+  if (now - last_rebalance_ns_ < 1000000000ull)
+    return;
+  last_rebalance_ns_ = now;
+
+  for (auto& it : adaptive_state_) {
+    AdaptiveCpuState& state = *it.second;
+    if (state.lost_since_check > 0) {
+      state.idle_intervals = 0;
+      if (state.page_cnt < max_page_cnt_)
+        resize_cpu(state, state.page_cnt * 2);
+    } else if (state.events_since_check == 0) {
+      // only rings with zero traffic shrink, so a busy ring that is keeping
+      // up is never disturbed (resizing it would itself drop events)
+      if (++state.idle_intervals >= 8 && state.page_cnt > min_page_cnt_) {
+        if (resize_cpu(state, state.page_cnt / 2).ok())
+          state.idle_intervals = 0;
+      }
+    } else {
+      state.idle_intervals = 0;
+    }
+    state.events_since_check = 0;
+    state.lost_since_check = 0;
+  }
 }
 
 StatusTuple BPFPerfBuffer::close_on_cpu(int cpu) {
@@ -476,6 +1859,26 @@ StatusTuple BPFPerfBuffer::close_all_cpu() {
   std::string errors;
   bool has_error = false;
 
+  // workers hold raw perf_reader pointers; stop them before freeing readers
+  if (consume_running_.load())
+    stop_consume_threads();
+
+  if (pipelined_) {
+    // the drain stage is already stopped; let the decode stage finish the
+    // spooled backlog and exit
+    {
+      std::lock_guard<std::mutex> lock(spool_mutex_);
+      pipeline_running_.store(false, std::memory_order_release);
+    }
+    spool_cv_.notify_all();
+    spool_space_cv_.notify_all();
+    if (decode_thread_.joinable())
+      decode_thread_.join();
+    pipelined_ = false;
+    spool_.clear();
+    spool_.shrink_to_fit();
+  }
+
   if (epfd_ >= 0) {
     int close_res = close(epfd_);
     epfd_ = -1;
@@ -498,29 +1901,327 @@ StatusTuple BPFPerfBuffer::close_all_cpu() {
     }
   }
 
+  for (int fd : capture_fds_)
+    ::close(fd);
+  capture_fds_.clear();
+  unpack_states_.clear();
+  adaptive_state_.clear();
+  adaptive_ = false;
+  numa_bind_ = false;
+  ordered_ = false;
+
   if (has_error)
     return StatusTuple(-1, errors);
   return StatusTuple::OK();
 }
 
 int BPFPerfBuffer::poll(int timeout_ms) {
-  if (epfd_ < 0)
+  if (epfd_ < 0 || pipelined_)
     return -1;
   int cnt =
       epoll_wait(epfd_, ep_events_.get(), cpu_readers_.size(), timeout_ms);
   for (int i = 0; i < cnt; i++)
     perf_reader_event_read(static_cast<perf_reader*>(ep_events_[i].data.ptr));
+  if (adaptive_)
+    rebalance();
   return cnt;
 }
 
+StatusTuple BPFPerfBuffer::open_all_cpu_ordered(perf_reader_raw_cb cb,
+                                                perf_reader_lost_cb lost_cb,
+                                                void* cb_cookie,
+                                                int page_cnt) {
+  if (cpu_readers_.size() != 0 || epfd_ != -1)
+    return StatusTuple(-1, "Previously opened perf buffer not cleaned");
+
+  std::vector<int> cpus = get_online_cpus();
+  ep_events_.reset(new epoll_event[cpus.size()]);
+  epfd_ = epoll_create1(EPOLL_CLOEXEC);
+
+  for (int i : cpus) {
+    struct bcc_perf_buffer_opts opts = {
+        .pid = -1,
+        .cpu = i,
+        .wakeup_events = 1,
+        .use_hugetlb = 0,
+        .sample_time = 1,
+    };
+    auto res = open_on_cpu(cb, lost_cb, cb_cookie, page_cnt, opts);
+    if (!res.ok()) {
+      TRY2(close_all_cpu());
+      return res;
+    }
+  }
+  ordered_ = true;
+  return StatusTuple::OK();
+}
+
+int BPFPerfBuffer::poll_ordered(int timeout_ms, int window_us) {
+  if (epfd_ < 0 || !ordered_)
+    return -1;
+
+  int cnt =
+      epoll_wait(epfd_, ep_events_.get(), cpu_readers_.size(), timeout_ms);
+  if (cnt < 0)
+    return -1;
+
+  // Min-heap over the ring heads, keyed by the next record's timestamp.
+  // Lost-sample notifications report timestamp 0 and drain first.
+  using Entry = std::pair<uint64_t, perf_reader*>;
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+  for (auto& it : cpu_readers_) {
+    uint64_t ts;
+    if (perf_reader_peek_time(it.second, &ts))
+      heap.emplace(ts, it.second);
+  }
+
+  // Events younger than the watermark stay in their rings: a sample from a
+  // CPU that has not reached the epoll wakeup yet can only be older than
+  // "now", so holding back the last window_us bounds reordering without
+  // stalling on idle CPUs. Perf sample timestamps track CLOCK_MONOTONIC.
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t now_ns =
+      (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+  uint64_t window_ns = (uint64_t)window_us * 1000;
+  uint64_t cutoff = now_ns > window_ns ? now_ns - window_ns : 0;
+
+  int delivered = 0;
+  while (!heap.empty()) {
+    Entry top = heap.top();
+    if (top.first > cutoff)
+      break;
+    heap.pop();
+    if (perf_reader_event_read_one(top.second) > 0)
+      delivered++;
+    uint64_t ts;
+    if (perf_reader_peek_time(top.second, &ts))
+      heap.emplace(ts, top.second);
+  }
+  return delivered;
+}
+
+namespace {
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#else
+  asm volatile("" ::: "memory");
+#endif
+}
+
+}  // namespace
+
+int BPFPerfBuffer::poll_adaptive(int timeout_ms, int max_spin_us) {
+  if (epfd_ < 0 || pipelined_)
+    return -1;
+
+  // Spin phase: sweep the mmap'd ring heads directly (no syscalls), pausing
+  // between sweeps. Every drain restarts the spin window, so the loop stays
+  // hot as long as a burst keeps feeding events.
+  uint64_t spin_window_ns = (uint64_t)max_spin_us * 1000;
+  uint64_t deadline = bcc_stats_now_ns() + spin_window_ns;
+  int drained = 0;
+  while (bcc_stats_now_ns() < deadline) {
+    bool saw_event = false;
+    for (auto it : cpu_readers_) {
+      if (!perf_reader_data_ready(it.second))
+        continue;
+      uint64_t t0 = bcc_stats_now_ns();
+      perf_reader_event_read(it.second);
+      record_dispatch_latency(bcc_stats_now_ns() - t0);
+      apoll_stats_.spin_wakeups++;
+      saw_event = true;
+      drained++;
+    }
+    if (saw_event) {
+      deadline = bcc_stats_now_ns() + spin_window_ns;
+      continue;
+    }
+    for (int i = 0; i < 64; i++)
+      cpu_relax();
+  }
+  if (drained > 0) {
+    if (adaptive_)
+      rebalance();
+    return drained;
+  }
+
+  // Back-off phase: epoll sleeps that double from 1ms per round, clipped to
+  // the remaining budget, until an event arrives or timeout_ms is spent.
+  int sleep_ms = 1;
+  int waited_ms = 0;
+  while (timeout_ms != 0) {
+    int this_wait = sleep_ms;
+    if (timeout_ms > 0 && this_wait > timeout_ms - waited_ms)
+      this_wait = timeout_ms - waited_ms;
+    int cnt =
+        epoll_wait(epfd_, ep_events_.get(), cpu_readers_.size(), this_wait);
+    if (cnt > 0) {
+      uint64_t t0 = bcc_stats_now_ns();
+      for (int i = 0; i < cnt; i++)
+        perf_reader_event_read(
+            static_cast<perf_reader*>(ep_events_[i].data.ptr));
+      record_dispatch_latency(bcc_stats_now_ns() - t0);
+      apoll_stats_.epoll_wakeups += cnt;
+      drained += cnt;
+      break;
+    }
+    waited_ms += this_wait;
+    if (timeout_ms > 0 && waited_ms >= timeout_ms)
+      break;
+    if (sleep_ms < 512)
+      sleep_ms <<= 1;
+  }
+
+  if (adaptive_)
+    rebalance();
+  return drained;
+}
+
+void BPFPerfBuffer::record_dispatch_latency(uint64_t ns) {
+  int bucket = 0;
+  while (bucket < 63 && (1ULL << bucket) < ns)
+    bucket++;
+  latency_hist_[bucket]++;
+}
+
+BPFPerfBuffer::AdaptivePollStats BPFPerfBuffer::adaptive_poll_stats() {
+  AdaptivePollStats res = apoll_stats_;
+  uint64_t total = 0;
+  for (uint64_t c : latency_hist_)
+    total += c;
+  if (total == 0)
+    return res;
+
+  auto percentile = [&](uint64_t pct) -> uint64_t {
+    uint64_t target = (total * pct + 99) / 100;
+    uint64_t cumulative = 0;
+    for (int i = 0; i < 64; i++) {
+      cumulative += latency_hist_[i];
+      if (cumulative >= target)
+        return 1ULL << i;
+    }
+    return 1ULL << 63;
+  };
+  res.p50_latency_ns = percentile(50);
+  res.p99_latency_ns = percentile(99);
+  return res;
+}
+
 int BPFPerfBuffer::consume() {
-  if (epfd_ < 0)
+  if (epfd_ < 0 || pipelined_)
     return -1;
   for (auto it : cpu_readers_)
     perf_reader_event_read(it.second);
+  if (adaptive_)
+    rebalance();
   return 0;
 }
 
+int BPFPerfBuffer::consume_ready() {
+  if (epfd_ < 0 || pipelined_)
+    return -1;
+  int total = 0;
+  for (;;) {
+    int cnt =
+        epoll_wait(epfd_, ep_events_.get(), cpu_readers_.size(), 0);
+    if (cnt <= 0)
+      break;
+    for (int i = 0; i < cnt; i++)
+      perf_reader_event_read(
+          static_cast<perf_reader*>(ep_events_[i].data.ptr));
+    total += cnt;
+  }
+  if (adaptive_)
+    rebalance();
+  return total;
+}
+
+void BPFPerfBuffer::consume_thread_fn(std::vector<perf_reader*> readers,
+                                      std::vector<int> cpus) {
+  if (numa_bind_ && !cpus.empty()) {
+    // restrict this worker to the CPUs whose rings it owns, so the ring
+    // memory it touches stays node-local
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (int cpu : cpus)
+      CPU_SET(cpu, &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+  }
+
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0)
+    return;
+  for (auto reader : readers) {
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = static_cast<void*>(reader);
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, perf_reader_fd(reader), &event) != 0) {
+      close(epfd);
+      return;
+    }
+  }
+
+  auto events = std::unique_ptr<epoll_event[]>(new epoll_event[readers.size()]);
+  while (consume_running_.load(std::memory_order_acquire)) {
+    int cnt = epoll_wait(epfd, events.get(), readers.size(), 100);
+    for (int i = 0; i < cnt; i++)
+      perf_reader_event_read(static_cast<perf_reader*>(events[i].data.ptr));
+  }
+  close(epfd);
+}
+
+StatusTuple BPFPerfBuffer::start_consume_threads(int num_threads) {
+  if (epfd_ < 0)
+    return StatusTuple(-1, "Perf buffer not open");
+  if (adaptive_)
+    return StatusTuple(
+        -1, "Consume threads are not supported on adaptive perf buffers");
+  if (consume_running_.load())
+    return StatusTuple(-1, "Consume threads already running");
+  if (num_threads < 1)
+    return StatusTuple(-1, "At least one consume thread is required");
+  if ((size_t)num_threads > cpu_readers_.size())
+    num_threads = cpu_readers_.size();
+
+  // partition the per-CPU readers so each worker owns a disjoint subset and
+  // never contends with another worker on the same ring. Round-robin spreads
+  // load evenly; with numa_bind a contiguous split keeps each worker's CPUs
+  // on as few nodes as possible
+  std::vector<std::vector<perf_reader*>> partitions(num_threads);
+  std::vector<std::vector<int>> partition_cpus(num_threads);
+  int idx = 0;
+  for (auto it : cpu_readers_) {
+    int slot = numa_bind_
+                   ? idx * num_threads / (int)cpu_readers_.size()
+                   : idx % num_threads;
+    partitions[slot].push_back(it.second);
+    partition_cpus[slot].push_back(it.first);
+    idx++;
+  }
+
+  consume_running_.store(true, std::memory_order_release);
+  for (int i = 0; i < num_threads; i++)
+    consume_threads_.emplace_back(&BPFPerfBuffer::consume_thread_fn, this,
+                                  std::move(partitions[i]),
+                                  std::move(partition_cpus[i]));
+  return StatusTuple::OK();
+}
+
+StatusTuple BPFPerfBuffer::stop_consume_threads() {
+  if (!consume_running_.load())
+    return StatusTuple(-1, "Consume threads not running");
+  consume_running_.store(false, std::memory_order_release);
+  for (auto& thread : consume_threads_)
+    thread.join();
+  consume_threads_.clear();
+  return StatusTuple::OK();
+}
+
 BPFPerfBuffer::~BPFPerfBuffer() {
   auto res = close_all_cpu();
   if (!res.ok())
@@ -528,6 +2229,51 @@ BPFPerfBuffer::~BPFPerfBuffer() {
               << std::endl;
 }
 
+BPFRingBuffer::BPFRingBuffer(const TableDesc& desc)
+    : BPFTableBase<int, int>(desc), rb_(nullptr) {
+  if (desc.type != BPF_MAP_TYPE_RINGBUF)
+    throw std::invalid_argument("Table '" + desc.name +
+                                "' is not a ring buffer");
+}
+
+StatusTuple BPFRingBuffer::open_ring_buffer(ring_buffer_sample_fn cb,
+                                            void* cb_cookie) {
+  if (rb_ != nullptr)
+    return StatusTuple(-1, "Ring buffer already open");
+
+  rb_ = static_cast<struct ring_buffer*>(
+      bpf_new_ringbuf(desc.fd, cb, cb_cookie));
+  if (rb_ == nullptr)
+    return StatusTuple(-1, "Unable to construct ring buffer: %s",
+                       std::strerror(errno));
+  return StatusTuple::OK();
+}
+
+StatusTuple BPFRingBuffer::close_ring_buffer() {
+  if (rb_ == nullptr)
+    return StatusTuple(-1, "Ring buffer not open");
+  bpf_free_ringbuf(rb_);
+  rb_ = nullptr;
+  return StatusTuple::OK();
+}
+
+int BPFRingBuffer::poll(int timeout_ms) {
+  if (rb_ == nullptr)
+    return -1;
+  return bpf_poll_ringbuf(rb_, timeout_ms);
+}
+
+int BPFRingBuffer::consume() {
+  if (rb_ == nullptr)
+    return -1;
+  return bpf_consume_ringbuf(rb_);
+}
+
+BPFRingBuffer::~BPFRingBuffer() {
+  if (rb_ != nullptr)
+    bpf_free_ringbuf(rb_);
+}
+
 BPFPerfEventArray::BPFPerfEventArray(const TableDesc& desc)
     : BPFTableBase<int, int>(desc) {
   if (desc.type != BPF_MAP_TYPE_PERF_EVENT_ARRAY)
@@ -552,6 +2298,58 @@ StatusTuple BPFPerfEventArray::open_all_cpu(uint32_t type, uint64_t config,
   return StatusTuple::OK();
 }
 
+StatusTuple BPFPerfEventArray::open_all_cpu_grouped(uint32_t type,
+                                                    uint64_t config, int pid,
+                                                    BPFPerfEventArray* group_leader) {
+  if (cpu_fds_.size() != 0)
+    return StatusTuple(-1, "Previously opened perf event not cleaned");
+
+  std::vector<int> cpus = get_online_cpus();
+
+  for (int i : cpus) {
+    int group_fd = -1;
+    if (group_leader) {
+      auto it = group_leader->cpu_fds_.find(i);
+      if (it == group_leader->cpu_fds_.end()) {
+        TRY2(close_all_cpu());
+        return StatusTuple(-1, "Group leader has no perf event on CPU %d", i);
+      }
+      group_fd = it->second;
+    }
+    auto res = open_on_cpu(i, type, config, pid, group_fd, true);
+    if (!res.ok()) {
+      TRY2(close_all_cpu());
+      return res;
+    }
+  }
+  group_leader_ = (group_leader == nullptr);
+  return StatusTuple::OK();
+}
+
+StatusTuple BPFPerfEventArray::read_group_all_cpus(
+    std::vector<std::vector<uint64_t>>& values, std::vector<int>& cpus) {
+  if (!group_leader_)
+    return StatusTuple(-1, "Perf events were not opened as a group leader");
+
+  values.clear();
+  cpus.clear();
+  for (auto& it : cpu_fds_) {
+    // PERF_FORMAT_GROUP read layout: u64 nr, then one u64 per member.
+    uint64_t buf[1 + 64];
+    ssize_t n = read(it.second, buf, sizeof(buf));
+    if (n < (ssize_t)sizeof(uint64_t))
+      return StatusTuple(-1, "Unable to read perf event group on CPU %d: %s",
+                         it.first, std::strerror(errno));
+    uint64_t nr = buf[0];
+    if (nr > 64 || (ssize_t)((1 + nr) * sizeof(uint64_t)) > n)
+      return StatusTuple(-1, "Malformed perf event group read on CPU %d",
+                         it.first);
+    values.emplace_back(buf + 1, buf + 1 + nr);
+    cpus.push_back(it.first);
+  }
+  return StatusTuple::OK();
+}
+
 StatusTuple BPFPerfEventArray::close_all_cpu() {
   std::string errors;
   bool has_error = false;
@@ -568,16 +2366,19 @@ StatusTuple BPFPerfEventArray::close_all_cpu() {
     }
   }
 
+  group_leader_ = false;
   if (has_error)
     return StatusTuple(-1, errors);
   return StatusTuple::OK();
 }
 
 StatusTuple BPFPerfEventArray::open_on_cpu(int cpu, uint32_t type,
-                                           uint64_t config, int pid) {
+                                           uint64_t config, int pid,
+                                           int group_fd, bool grouped) {
   if (cpu_fds_.find(cpu) != cpu_fds_.end())
     return StatusTuple(-1, "Perf event already open on CPU %d", cpu);
-  int fd = bpf_open_perf_event(type, config, pid, cpu);
+  int fd = grouped ? bpf_open_perf_event_group(type, config, pid, cpu, group_fd)
+                   : bpf_open_perf_event(type, config, pid, cpu);
   if (fd < 0) {
     return StatusTuple(-1, "Error constructing perf event %" PRIu32 ":%" PRIu64,
                        type, config);
@@ -628,6 +2429,39 @@ StatusTuple BPFProgTable::remove_value(const int& index) {
   return StatusTuple::OK();
 }
 
+StatusTuple BPFProgTable::swap_generation(const std::map<int, int>& programs) {
+  std::vector<int> keys, fds;
+  keys.reserve(programs.size());
+  fds.reserve(programs.size());
+  for (auto& it : programs) {
+    if (it.first < 0 || (size_t)it.first >= this->desc.max_entries)
+      return StatusTuple(-1, "Slot %d out of range for table '%s'", it.first,
+                         this->desc.name.c_str());
+    keys.push_back(it.first);
+    fds.push_back(it.second);
+  }
+
+  uint32_t count = static_cast<uint32_t>(keys.size());
+  if (count && !this->update_batch(keys.data(), fds.data(), &count)) {
+    // batch support is kernel-dependent; retry one slot at a time
+    for (size_t i = 0; i < keys.size(); i++)
+      if (!this->update(&keys[i], &fds[i]))
+        return StatusTuple(-1, "Error updating slot %d: %s", keys[i],
+                           std::strerror(errno));
+  }
+
+  // Clear slots that are not part of the new generation; done after the
+  // updates so a dispatch index valid in both generations never misses.
+  for (int idx = 0; idx < (int)this->desc.max_entries; idx++) {
+    if (programs.find(idx) != programs.end())
+      continue;
+    if (!this->remove(&idx) && errno != ENOENT)
+      return StatusTuple(-1, "Error clearing slot %d: %s", idx,
+                         std::strerror(errno));
+  }
+  return StatusTuple::OK();
+}
+
 BPFCgroupArray::BPFCgroupArray(const TableDesc& desc)
     : BPFTableBase<int, int>(desc) {
   if (desc.type != BPF_MAP_TYPE_CGROUP_ARRAY)
@@ -657,6 +2491,96 @@ StatusTuple BPFCgroupArray::remove_value(const int& index) {
   return StatusTuple::OK();
 }
 
+StatusTuple BPFCgroupArray::register_cgroup(const std::string& path,
+                                            int index) {
+  FileDesc f(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  if ((int)f < 0)
+    return StatusTuple(-1, "Unable to open %s", path.c_str());
+  TRY2(update_value(index, (int)f));
+
+  CachedCgroup cached{f, index, -1};
+  if ((int)inotify_fd_ >= 0) {
+    // IN_DELETE_SELF/IN_MOVE_SELF fire when the cgroup directory itself
+    // goes away; the kernel then drops the watch (IN_IGNORED)
+    cached.wd = ::inotify_add_watch(inotify_fd_, path.c_str(),
+                                    IN_DELETE_SELF | IN_MOVE_SELF);
+    if (cached.wd >= 0)
+      wd_to_path_[cached.wd] = path;
+  }
+  cgroup_cache_[path] = std::move(cached);
+  return StatusTuple::OK();
+}
+
+StatusTuple BPFCgroupArray::update_many(
+    const std::vector<std::string>& cgroup2_paths, int first_index) {
+  if ((int)inotify_fd_ < 0)
+    inotify_fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  std::string errors;
+  for (size_t i = 0; i < cgroup2_paths.size(); i++) {
+    const auto& path = cgroup2_paths[i];
+    int index = first_index + (int)i;
+    auto it = cgroup_cache_.find(path);
+    if (it != cgroup_cache_.end() && it->second.wd >= 0) {
+      // live cached registration; only the index may need to move
+      if (it->second.index != index) {
+        auto res = update_value(index, (int)it->second.fd);
+        if (!res.ok()) {
+          errors += res.msg() + "\n";
+          continue;
+        }
+        it->second.index = index;
+      }
+      continue;
+    }
+    auto res = register_cgroup(path, index);
+    if (!res.ok())
+      errors += res.msg() + "\n";
+  }
+  if (!errors.empty())
+    return StatusTuple(-1, errors);
+  return StatusTuple::OK();
+}
+
+int BPFCgroupArray::refresh() {
+  if ((int)inotify_fd_ < 0)
+    return -1;
+
+  // drain queued events; a deleted or moved-away cgroup drops out of the
+  // array and its entry goes stale (wd -1)
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+  while ((len = ::read(inotify_fd_, buf, sizeof(buf))) > 0) {
+    for (char* p = buf; p < buf + len;) {
+      auto* event = reinterpret_cast<struct inotify_event*>(p);
+      p += sizeof(struct inotify_event) + event->len;
+      auto wd_it = wd_to_path_.find(event->wd);
+      if (wd_it == wd_to_path_.end())
+        continue;
+      auto it = cgroup_cache_.find(wd_it->second);
+      if (event->mask & IN_IGNORED)
+        wd_to_path_.erase(wd_it);
+      if (it == cgroup_cache_.end() || it->second.wd < 0)
+        continue;
+      remove_value(it->second.index);
+      it->second.fd = -1;
+      it->second.wd = -1;
+    }
+  }
+
+  // re-register stale entries whose path exists again (cgroup recreation);
+  // the rest stay stale and are retried on the next call
+  int reregistered = 0;
+  for (auto& entry : cgroup_cache_) {
+    if (entry.second.wd >= 0)
+      continue;
+    auto res = register_cgroup(entry.first, entry.second.index);
+    if (res.ok())
+      reregistered++;
+  }
+  return reregistered;
+}
+
 BPFDevmapTable::BPFDevmapTable(const TableDesc& desc)
     : BPFTableBase<int, int>(desc) {
     if(desc.type != BPF_MAP_TYPE_DEVMAP)
@@ -684,6 +2608,43 @@ StatusTuple BPFDevmapTable::remove_value(const int& index) {
     return StatusTuple::OK();
 }
 
+BPFDevmapTable::BPFDevmapTable(const TableDesc& desc,
+                               const TableDesc& stats_desc)
+    : BPFDevmapTable(desc) {
+  // a companion array of the wrong shape is treated as absent rather than
+  // rejected, so older programs sharing the naming convention keep working
+  if (stats_desc.type == BPF_MAP_TYPE_PERCPU_ARRAY &&
+      stats_desc.leaf_size == sizeof(redirect_stats) &&
+      stats_desc.max_entries >= desc.max_entries) {
+    stats_fd_ = stats_desc.fd;
+    stats_entries_ = desc.max_entries;
+  }
+}
+
+StatusTuple BPFDevmapTable::get_redirect_stats(
+    std::vector<redirect_stats>& res) {
+  if (stats_fd_ < 0)
+    return StatusTuple(-1,
+                       "Table '%s' has no redirect stats; declare it with "
+                       "BPF_DEVMAP_WITH_STATS",
+                       desc.name.c_str());
+
+  size_t ncpus = BPFTable::get_possible_cpu_count();
+  std::vector<redirect_stats> percpu(ncpus);
+  res.assign(stats_entries_, redirect_stats{});
+  for (uint32_t i = 0; i < stats_entries_; i++) {
+    if (bpf_lookup_elem(stats_fd_, &i, percpu.data()) < 0)
+      return StatusTuple(-1, "Error getting stats for slot %u: %s", i,
+                         std::strerror(errno));
+    for (size_t cpu = 0; cpu < ncpus; cpu++) {
+      res[i].redirects += percpu[cpu].redirects;
+      res[i].drops += percpu[cpu].drops;
+    }
+  }
+  bcc_stats_add(BCC_STAT_MAP_LOOKUPS, stats_entries_);
+  return StatusTuple::OK();
+}
+
 BPFXskmapTable::BPFXskmapTable(const TableDesc& desc)
     : BPFTableBase<int, int>(desc) {
     if(desc.type != BPF_MAP_TYPE_XSKMAP)
@@ -711,6 +2672,332 @@ StatusTuple BPFXskmapTable::remove_value(const int& index) {
     return StatusTuple::OK();
 }
 
+BPFXskSocket::BPFXskSocket(uint32_t frame_size, uint32_t num_frames)
+    : frame_size_(frame_size), num_frames_(num_frames) {}
+
+BPFXskSocket::~BPFXskSocket() {
+  for (Ring* r : {&rx_, &fill_, &comp_})
+    if (r->map)
+      munmap(r->map, r->map_len);
+  if (umem_)
+    munmap(umem_, umem_len_);
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+StatusTuple BPFXskSocket::setup_ring(int sockopt, uint64_t pgoff,
+                                     uint32_t entries, size_t desc_size,
+                                     Ring& ring) {
+  if (setsockopt(fd_, SOL_XDP, sockopt, &entries, sizeof(entries)) < 0)
+    return StatusTuple(-1, "Error sizing xsk ring %d: %s", sockopt,
+                       std::strerror(errno));
+
+  struct xdp_mmap_offsets off = {};
+  socklen_t optlen = sizeof(off);
+  if (getsockopt(fd_, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0)
+    return StatusTuple(-1, "Error getting XDP_MMAP_OFFSETS: %s",
+                       std::strerror(errno));
+  const struct xdp_ring_offset& ro =
+      sockopt == XDP_RX_RING
+          ? off.rx
+          : (sockopt == XDP_UMEM_FILL_RING ? off.fr : off.cr);
+
+  ring.map_len = ro.desc + (size_t)entries * desc_size;
+  ring.map = mmap(nullptr, ring.map_len, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd_, pgoff);
+  if (ring.map == MAP_FAILED) {
+    ring.map = nullptr;
+    return StatusTuple(-1, "Error mapping xsk ring %d: %s", sockopt,
+                       std::strerror(errno));
+  }
+  char* base = static_cast<char*>(ring.map);
+  ring.producer = reinterpret_cast<uint32_t*>(base + ro.producer);
+  ring.consumer = reinterpret_cast<uint32_t*>(base + ro.consumer);
+  // the flags word (NEED_WAKEUP) only exists on v5.4+; optlen tells us
+  // whether the kernel filled that far
+  ring.flags = optlen >= sizeof(off)
+                   ? reinterpret_cast<uint32_t*>(base + ro.flags)
+                   : nullptr;
+  ring.desc = base + ro.desc;
+  ring.size = entries;
+  return StatusTuple::OK();
+}
+
+StatusTuple BPFXskSocket::open(const std::string& ifname, uint32_t queue_id,
+                               BPFXskmapTable& xskmap, uint32_t rx_ring_size,
+                               uint32_t fill_ring_size) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  if (frame_size_ < 2048 || frame_size_ > page_size ||
+      (frame_size_ & (frame_size_ - 1)))
+    return StatusTuple(-1, "Invalid xsk frame size %u", frame_size_);
+  if ((rx_ring_size & (rx_ring_size - 1)) ||
+      (fill_ring_size & (fill_ring_size - 1)))
+    return StatusTuple(-1, "xsk ring sizes must be powers of two");
+  if (fd_ >= 0)
+    return StatusTuple(-1, "xsk socket is already open");
+
+  unsigned int ifindex = if_nametoindex(ifname.c_str());
+  if (ifindex == 0)
+    return StatusTuple(-1, "Unknown interface %s", ifname.c_str());
+
+  fd_ = socket(AF_XDP, SOCK_RAW, 0);
+  if (fd_ < 0)
+    return StatusTuple(-1, "Error creating AF_XDP socket: %s",
+                       std::strerror(errno));
+
+  umem_len_ = (size_t)frame_size_ * num_frames_;
+  umem_ = mmap(nullptr, umem_len_, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (umem_ == MAP_FAILED) {
+    umem_ = nullptr;
+    return StatusTuple(-1, "Error allocating %zu byte umem: %s", umem_len_,
+                       std::strerror(errno));
+  }
+
+  struct xdp_umem_reg reg = {};
+  reg.addr = (uintptr_t)umem_;
+  reg.len = umem_len_;
+  reg.chunk_size = frame_size_;
+  reg.headroom = 0;
+  if (setsockopt(fd_, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0)
+    return StatusTuple(-1, "Error registering umem: %s", std::strerror(errno));
+
+  // the kernel insists on a completion ring even for an RX-only socket;
+  // keep it minimal and drain it in fill() so a future TX user of the
+  // same fd gets its frames back through the shared pool
+  TRY2(setup_ring(XDP_UMEM_FILL_RING, XDP_UMEM_PGOFF_FILL_RING,
+                  fill_ring_size, sizeof(uint64_t), fill_));
+  TRY2(setup_ring(XDP_UMEM_COMPLETION_RING, XDP_UMEM_PGOFF_COMPLETION_RING,
+                  fill_ring_size, sizeof(uint64_t), comp_));
+  TRY2(setup_ring(XDP_RX_RING, XDP_PGOFF_RX_RING, rx_ring_size,
+                  sizeof(struct xdp_desc), rx_));
+
+  struct sockaddr_xdp addr = {};
+  addr.sxdp_family = AF_XDP;
+  addr.sxdp_ifindex = ifindex;
+  addr.sxdp_queue_id = queue_id;
+  // prefer the zero-copy datapath, then copy mode; each first with
+  // NEED_WAKEUP so a sleepy driver costs a syscall only when flagged
+  const uint16_t tries[] = {
+      (uint16_t)(XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP), XDP_ZEROCOPY,
+      (uint16_t)(XDP_COPY | XDP_USE_NEED_WAKEUP), XDP_COPY};
+  int bind_err = 0;
+  bool bound = false;
+  for (uint16_t flags : tries) {
+    addr.sxdp_flags = flags;
+    if (bind(fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) ==
+        0) {
+      bound = true;
+      zero_copy_ = flags & XDP_ZEROCOPY;
+      break;
+    }
+    bind_err = errno;
+  }
+  if (!bound)
+    return StatusTuple(-1, "Error binding xsk to %s queue %u: %s",
+                       ifname.c_str(), queue_id, std::strerror(bind_err));
+
+  TRY2(xskmap.update_value(queue_id, fd_));
+
+  free_frames_.reserve(num_frames_);
+  for (uint32_t i = 0; i < num_frames_; i++)
+    free_frames_.push_back((uint64_t)i * frame_size_);
+  fill();
+  return StatusTuple::OK();
+}
+
+size_t BPFXskSocket::rx_burst(Frame* frames, size_t max) {
+  uint32_t prod = __atomic_load_n(rx_.producer, __ATOMIC_ACQUIRE);
+  uint32_t cons = *rx_.consumer;
+  size_t n = std::min<size_t>(prod - cons, max);
+  const struct xdp_desc* descs = static_cast<const struct xdp_desc*>(rx_.desc);
+  for (size_t i = 0; i < n; i++) {
+    const struct xdp_desc& d = descs[(cons + i) & (rx_.size - 1)];
+    frames[i].data = static_cast<char*>(umem_) + d.addr;
+    frames[i].len = d.len;
+    // strip any headroom offset so the recycled address is frame-aligned
+    frames[i].addr = d.addr & ~((uint64_t)frame_size_ - 1);
+  }
+  // releasing the ring slots here is safe: the kernel only reuses a
+  // frame once its address goes back through the fill ring
+  __atomic_store_n(rx_.consumer, cons + (uint32_t)n, __ATOMIC_RELEASE);
+  return n;
+}
+
+void BPFXskSocket::rx_release(const Frame* frames, size_t cnt) {
+  for (size_t i = 0; i < cnt; i++)
+    free_frames_.push_back(frames[i].addr);
+  fill();
+}
+
+size_t BPFXskSocket::fill() {
+  // harvest completions (no-op until the fd is also used for TX)
+  uint32_t cprod = __atomic_load_n(comp_.producer, __ATOMIC_ACQUIRE);
+  uint32_t ccons = *comp_.consumer;
+  if (cprod != ccons) {
+    const uint64_t* caddrs = static_cast<const uint64_t*>(comp_.desc);
+    for (uint32_t i = ccons; i != cprod; i++)
+      free_frames_.push_back(caddrs[i & (comp_.size - 1)]);
+    __atomic_store_n(comp_.consumer, cprod, __ATOMIC_RELEASE);
+  }
+
+  uint32_t prod = *fill_.producer;
+  uint32_t cons = __atomic_load_n(fill_.consumer, __ATOMIC_ACQUIRE);
+  size_t space = fill_.size - (prod - cons);
+  size_t n = std::min(space, free_frames_.size());
+  if (n) {
+    uint64_t* addrs = static_cast<uint64_t*>(fill_.desc);
+    for (size_t i = 0; i < n; i++) {
+      addrs[(prod + i) & (fill_.size - 1)] = free_frames_.back();
+      free_frames_.pop_back();
+    }
+    // one publish for the whole batch
+    __atomic_store_n(fill_.producer, prod + (uint32_t)n, __ATOMIC_RELEASE);
+  }
+  if (need_wakeup())
+    kick_rx();
+  return n;
+}
+
+bool BPFXskSocket::need_wakeup() const {
+  return fill_.flags &&
+         (__atomic_load_n(fill_.flags, __ATOMIC_ACQUIRE) &
+          XDP_RING_NEED_WAKEUP);
+}
+
+void BPFXskSocket::kick_rx() {
+  // an empty recv is the documented RX wakeup for sleepy drivers
+  recvfrom(fd_, nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+}
+
+BPFArenaTable::BPFArenaTable(const TableDesc& desc)
+    : BPFTableBase<int, int>(desc),
+      base_(nullptr),
+      size_(0),
+      alloc_offset_(0) {
+  if (desc.type != BPF_MAP_TYPE_ARENA)
+    throw std::invalid_argument("Table '" + desc.name +
+                                "' is not an arena table");
+  // max_entries of an arena counts backing pages
+  size_ = desc.max_entries * (size_t)sysconf(_SC_PAGESIZE);
+  void* mem =
+      mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, desc.fd, 0);
+  if (mem == MAP_FAILED) {
+    size_ = 0;
+    return;  // base() stays nullptr, callers check
+  }
+  base_ = mem;
+}
+
+BPFArenaTable::BPFArenaTable(BPFArenaTable&& that)
+    : BPFTableBase<int, int>(that.desc),
+      base_(that.base_),
+      size_(that.size_),
+      alloc_offset_(that.alloc_offset_) {
+  that.base_ = nullptr;
+  that.size_ = 0;
+}
+
+BPFArenaTable::~BPFArenaTable() {
+  if (base_)
+    munmap(base_, size_);
+}
+
+StatusTuple BPFArenaTable::alloc(size_t bytes, size_t align, void** out) {
+  if (!base_)
+    return StatusTuple(-1, "Arena is not mapped");
+  if (!align || (align & (align - 1)))
+    return StatusTuple(-1, "Alignment must be a power of two");
+  size_t offset = (alloc_offset_ + align - 1) & ~(align - 1);
+  if (offset + bytes < offset || offset + bytes > size_)
+    return StatusTuple(-1, "Arena exhausted");
+  *out = static_cast<char*>(base_) + offset;
+  alloc_offset_ = offset + bytes;
+  return StatusTuple::OK();
+}
+
+// Core of the sockmap/sockhash bulk insert: one BPF_MAP_UPDATE_BATCH for
+// the whole set, falling back to per-fd updates from wherever the batch
+// stopped (batch support is kernel- and map-type-dependent).
+static StatusTuple sock_update_many(int map_fd, const int* keys,
+                                    const int* sock_fds, size_t count,
+                                    size_t* updated) {
+  *updated = 0;
+  if (count == 0)
+    return StatusTuple::OK();
+
+  uint32_t n = static_cast<uint32_t>(count);
+  int batch_rc = bpf_update_batch(map_fd, const_cast<int*>(keys),
+                                  const_cast<int*>(sock_fds), &n);
+  bcc_stats_add(BCC_STAT_MAP_BATCH_OPS, 1);
+  if (batch_rc >= 0) {
+    *updated = count;
+    return StatusTuple::OK();
+  }
+
+  size_t i = n;  // entries the kernel reports as applied before failing
+  for (; i < count; i++)
+    if (bpf_update_elem(map_fd, const_cast<int*>(&keys[i]),
+                        const_cast<int*>(&sock_fds[i]), 0) < 0)
+      break;
+  bcc_stats_add(BCC_STAT_MAP_UPDATES, i - n);
+  *updated = i;
+  if (i < count)
+    return StatusTuple(-1, "Error updating sock map entry %zu: %s", i,
+                       std::strerror(errno));
+  return StatusTuple::OK();
+}
+
+// Pipelined insert: validate each fd with getsockopt(SO_TYPE) one chunk
+// ahead of the inserter on a prefetch thread, so insertion throughput stays
+// bounded by the kernel batch path and a connection that died since the
+// caller built its list is skipped rather than failing the storm.
+static StatusTuple sock_update_many_pipelined(int map_fd, const int* keys,
+                                              const int* sock_fds,
+                                              size_t count,
+                                              std::vector<size_t>* skipped) {
+  const size_t chunk = 1024;
+  struct Chunk {
+    std::vector<int> keys, fds;
+    std::vector<size_t> skipped;
+  } cur, next;
+
+  auto validate = [&](size_t begin, Chunk& out) {
+    out.keys.clear();
+    out.fds.clear();
+    out.skipped.clear();
+    size_t end = std::min(begin + chunk, count);
+    for (size_t i = begin; i < end; i++) {
+      int type;
+      socklen_t len = sizeof(type);
+      if (::getsockopt(sock_fds[i], SOL_SOCKET, SO_TYPE, &type, &len) == 0) {
+        out.keys.push_back(keys[i]);
+        out.fds.push_back(sock_fds[i]);
+      } else {
+        out.skipped.push_back(i);
+      }
+    }
+  };
+
+  validate(0, cur);
+  for (size_t off = 0; off < count; off += chunk) {
+    std::thread prefetcher;
+    if (off + chunk < count)
+      prefetcher = std::thread(validate, off + chunk, std::ref(next));
+    size_t updated = 0;
+    StatusTuple rc = sock_update_many(map_fd, cur.keys.data(), cur.fds.data(),
+                                      cur.keys.size(), &updated);
+    if (skipped)
+      skipped->insert(skipped->end(), cur.skipped.begin(), cur.skipped.end());
+    if (prefetcher.joinable())
+      prefetcher.join();
+    if (!rc.ok())
+      return rc;
+    std::swap(cur, next);
+  }
+  return StatusTuple::OK();
+}
+
 BPFSockmapTable::BPFSockmapTable(const TableDesc& desc)
     : BPFTableBase<int, int>(desc) {
     if(desc.type != BPF_MAP_TYPE_SOCKMAP)
@@ -718,6 +3005,17 @@ BPFSockmapTable::BPFSockmapTable(const TableDesc& desc)
                                   "' is not a sockmap table");
 }
 
+StatusTuple BPFSockmapTable::update_many(const int* keys, const int* sock_fds,
+                                         size_t count, size_t* updated) {
+  return sock_update_many(desc.fd, keys, sock_fds, count, updated);
+}
+
+StatusTuple BPFSockmapTable::update_many_pipelined(
+    const int* keys, const int* sock_fds, size_t count,
+    std::vector<size_t>* skipped) {
+  return sock_update_many_pipelined(desc.fd, keys, sock_fds, count, skipped);
+}
+
 StatusTuple BPFSockmapTable::update_value(const int& index,
                                          const int& value) {
     if (!this->update(const_cast<int*>(&index), const_cast<int*>(&value)))
@@ -751,4 +3049,64 @@ StatusTuple BPFSockhashTable::remove_value(const int& key) {
     return StatusTuple::OK();
 }
 
+StatusTuple BPFSockhashTable::update_many(const int* keys, const int* sock_fds,
+                                          size_t count, size_t* updated) {
+  return sock_update_many(desc.fd, keys, sock_fds, count, updated);
+}
+
+StatusTuple BPFSockhashTable::update_many_pipelined(
+    const int* keys, const int* sock_fds, size_t count,
+    std::vector<size_t>* skipped) {
+  return sock_update_many_pipelined(desc.fd, keys, sock_fds, count, skipped);
+}
+
+StatusTuple harvest_storage_records(int iter_prog_fd, int map_fd,
+                                    size_t record_size,
+                                    std::vector<uint8_t>& raw) {
+  // Storage-map iterators (bpf_sk_storage_map) are attached to the map;
+  // plain task iterators that read task storage via bpf_task_storage_get()
+  // take no link info. Try the map-scoped attach first and fall back.
+  union bpf_iter_link_info link_info = {};
+  link_info.map.map_fd = map_fd;
+  int link_fd =
+      bcc_iter_attach(iter_prog_fd, &link_info, sizeof(link_info));
+  if (link_fd < 0)
+    link_fd = bcc_iter_attach(iter_prog_fd, nullptr, 0);
+  if (link_fd < 0)
+    return StatusTuple(link_fd, "Unable to attach iterator program: %s",
+                       std::strerror(-link_fd));
+
+  int iter_fd = bcc_iter_create(link_fd);
+  if (iter_fd < 0) {
+    close(link_fd);
+    return StatusTuple(iter_fd, "Unable to create iterator: %s",
+                       std::strerror(-iter_fd));
+  }
+
+  raw.clear();
+  char buf[4096];
+  ssize_t len;
+  while ((len = read(iter_fd, buf, sizeof(buf))) != 0) {
+    if (len < 0) {
+      if (errno == EAGAIN)
+        continue;
+      int err = errno;
+      close(iter_fd);
+      close(link_fd);
+      return StatusTuple(-err, "Error draining iterator: %s",
+                         std::strerror(err));
+    }
+    raw.insert(raw.end(), buf, buf + len);
+  }
+  close(iter_fd);
+  close(link_fd);
+
+  if (raw.size() % record_size != 0)
+    return StatusTuple(-1,
+                       "Iterator stream ends in a partial record "
+                       "(%zu bytes, record size %zu)",
+                       raw.size(), record_size);
+  return StatusTuple::OK();
+}
+
 }  // namespace ebpf
@@ -18,15 +18,29 @@
 
 #include <errno.h>
 #include <sys/epoll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <exception>
+#include <functional>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 #include "bcc_exception.h"
+#include "bcc_stats.h"
 #include "bcc_syms.h"
 #include "bpf_module.h"
 #include "libbpf.h"
@@ -71,35 +85,182 @@ class BPFQueueStackTableBase {
     return bpf_lookup_elem(desc.fd, nullptr, value) >= 0;
   }
 
+  // Batched pop built on BPF_MAP_LOOKUP_AND_DELETE_BATCH. count is in/out:
+  // the capacity of the value buffer on entry, the number of elements
+  // popped on return. Fails with errno == ENOENT (count still valid) once
+  // the map is drained, and with EINVAL on kernels where queue/stack maps
+  // have no batch support.
+  bool pop_batch(void *values, uint32_t *count) {
+    bcc_stats_add(BCC_STAT_MAP_BATCH_OPS, 1);
+    return bpf_lookup_and_delete_batch(desc.fd, nullptr, nullptr, nullptr,
+                                       values, count) >= 0;
+  }
+
   const TableDesc& desc;
 };
 
+// Compile-time string codecs for table keys and leaves, selected by
+// BPFTableBase where KeyType/ValueType are known. Arithmetic types are
+// rendered and parsed as plain numbers; other trivially copyable types as a
+// hex dump of their in-memory representation ("0x00112233..."). Unlike the
+// sscanf/snprintf converters JITed by the rw_engine, these involve no
+// ExecutionEngine and still work when the module was built with
+// rw_engine_enabled=false.
+namespace table_codec {
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value,
+                        StatusTuple>::type
+from_string(const std::string& in, T* out) {
+  char* end;
+  errno = 0;
+  long long v = strtoll(in.c_str(), &end, 0);
+  if (end == in.c_str() || errno != 0)
+    return StatusTuple(-1, "Cannot parse '%s' as an integer", in.c_str());
+  *out = static_cast<T>(v);
+  return StatusTuple::OK();
+}
+
+template <typename T>
+typename std::enable_if<
+    std::is_integral<T>::value && !std::is_signed<T>::value, StatusTuple>::type
+from_string(const std::string& in, T* out) {
+  char* end;
+  errno = 0;
+  unsigned long long v = strtoull(in.c_str(), &end, 0);
+  if (end == in.c_str() || errno != 0)
+    return StatusTuple(-1, "Cannot parse '%s' as an integer", in.c_str());
+  *out = static_cast<T>(v);
+  return StatusTuple::OK();
+}
+
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value, StatusTuple>::type
+from_string(const std::string& in, T* out) {
+  char* end;
+  errno = 0;
+  long double v = strtold(in.c_str(), &end);
+  if (end == in.c_str() || errno != 0)
+    return StatusTuple(-1, "Cannot parse '%s' as a number", in.c_str());
+  *out = static_cast<T>(v);
+  return StatusTuple::OK();
+}
+
+template <typename T>
+typename std::enable_if<!std::is_arithmetic<T>::value &&
+                            std::is_trivially_copyable<T>::value,
+                        StatusTuple>::type
+from_string(const std::string& in, T* out) {
+  if (in.compare(0, 2, "0x") != 0 || in.size() != 2 + 2 * sizeof(T))
+    return StatusTuple(-1, "Expected %zu hex bytes with a 0x prefix",
+                       sizeof(T));
+  unsigned char* p = reinterpret_cast<unsigned char*>(out);
+  for (size_t i = 0; i < sizeof(T); i++) {
+    int byte = 0;
+    if (std::sscanf(in.c_str() + 2 + 2 * i, "%2x", &byte) != 1)
+      return StatusTuple(-1, "Cannot parse '%s' as hex bytes", in.c_str());
+    p[i] = byte;
+  }
+  return StatusTuple::OK();
+}
+
+template <typename T>
+typename std::enable_if<!std::is_trivially_copyable<T>::value,
+                        StatusTuple>::type
+from_string(const std::string&, T*) {
+  return StatusTuple(-1, "No compile-time codec for this type");
+}
+
+template <typename T>
+typename std::enable_if<std::is_arithmetic<T>::value, StatusTuple>::type
+to_string(const T* in, std::string& out) {
+  out = std::to_string(*in);
+  return StatusTuple::OK();
+}
+
+template <typename T>
+typename std::enable_if<!std::is_arithmetic<T>::value &&
+                            std::is_trivially_copyable<T>::value,
+                        StatusTuple>::type
+to_string(const T* in, std::string& out) {
+  static const char digits[] = "0123456789abcdef";
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(in);
+  out.assign("0x");
+  for (size_t i = 0; i < sizeof(T); i++) {
+    out += digits[p[i] >> 4];
+    out += digits[p[i] & 0xf];
+  }
+  return StatusTuple::OK();
+}
+
+template <typename T>
+typename std::enable_if<!std::is_trivially_copyable<T>::value,
+                        StatusTuple>::type
+to_string(const T*, std::string&) {
+  return StatusTuple(-1, "No compile-time codec for this type");
+}
+
+// BPFTableBase<void, void> passes void pointers; only the rw_engine can
+// convert those.
+inline StatusTuple from_string(const std::string&, void*) {
+  return StatusTuple(-1, "No compile-time codec for an untyped table");
+}
+
+inline StatusTuple to_string(const void*, std::string&) {
+  return StatusTuple(-1, "No compile-time codec for an untyped table");
+}
+
+}  // namespace table_codec
+
 template <class KeyType, class ValueType>
 class BPFTableBase {
  public:
   size_t capacity() { return desc.max_entries; }
 
+  // The string converters prefer the compile-time codec for arithmetic
+  // key/leaf types, avoiding the indirect call into rw_engine-JITed code.
+  // Aggregate types still go through the rw_engine, which knows their field
+  // layout; if it is unavailable (rw_engine_enabled=false) the hex codec
+  // keeps the table usable, at the cost of a less readable text form.
   StatusTuple string_to_key(const std::string& key_str, KeyType* key) {
-    return desc.key_sscanf(key_str.c_str(), key);
+    if (std::is_arithmetic<KeyType>::value)
+      return table_codec::from_string(key_str, key);
+    StatusTuple rc = desc.key_sscanf(key_str.c_str(), key);
+    if (!rc.ok() && table_codec::from_string(key_str, key).ok())
+      return StatusTuple::OK();
+    return rc;
   }
 
   StatusTuple string_to_leaf(const std::string& value_str, ValueType* value) {
-    return desc.leaf_sscanf(value_str.c_str(), value);
+    if (std::is_arithmetic<ValueType>::value)
+      return table_codec::from_string(value_str, value);
+    StatusTuple rc = desc.leaf_sscanf(value_str.c_str(), value);
+    if (!rc.ok() && table_codec::from_string(value_str, value).ok())
+      return StatusTuple::OK();
+    return rc;
   }
 
   StatusTuple key_to_string(const KeyType* key, std::string& key_str) {
+    if (std::is_arithmetic<KeyType>::value)
+      return table_codec::to_string(key, key_str);
     char buf[8 * desc.key_size];
     StatusTuple rc = desc.key_snprintf(buf, sizeof(buf), key);
     if (rc.ok())
       key_str.assign(buf);
+    else if (table_codec::to_string(key, key_str).ok())
+      return StatusTuple::OK();
     return rc;
   }
 
   StatusTuple leaf_to_string(const ValueType* value, std::string& value_str) {
+    if (std::is_arithmetic<ValueType>::value)
+      return table_codec::to_string(value, value_str);
     char buf[8 * desc.leaf_size];
     StatusTuple rc = desc.leaf_snprintf(buf, sizeof(buf), value);
     if (rc.ok())
       value_str.assign(buf);
+    else if (table_codec::to_string(value, value_str).ok())
+      return StatusTuple::OK();
     return rc;
   }
 
@@ -107,10 +268,116 @@ class BPFTableBase {
     return desc.fd;
   }
 
+  // Heterogeneous operation queue for mixed per-interval cycles: enqueue
+  // lookups, updates and removes in any order, then submit() executes the
+  // whole set in the fewest syscalls available -- all updates coalesce into
+  // chunked BPF_MAP_UPDATE_BATCH commands and all removes into
+  // BPF_MAP_DELETE_BATCH ones (kernel v5.6+, falling back to per-element
+  // calls where batch commands are unavailable), while lookups run per key,
+  // the kernel offering no keyed batch lookup. A cycle of tens of thousands
+  // of mixed ops thus costs a handful of syscalls for its write half
+  // instead of one each. The queue copies keys and values at enqueue time;
+  // read per-op results back after submit() with op(i).ok (and op(i).value
+  // for lookups).
+  class OpQueue {
+   public:
+    enum OpKind { LOOKUP, UPDATE, REMOVE };
+    struct Op {
+      OpKind kind;
+      KeyType key;
+      ValueType value;
+      bool ok;
+    };
+
+    void enqueue_lookup(const KeyType& key) {
+      ops_.push_back({LOOKUP, key, ValueType(), false});
+    }
+    void enqueue_update(const KeyType& key, const ValueType& value) {
+      ops_.push_back({UPDATE, key, value, false});
+    }
+    void enqueue_remove(const KeyType& key) {
+      ops_.push_back({REMOVE, key, ValueType(), false});
+    }
+    size_t size() const { return ops_.size(); }
+    const Op& op(size_t i) const { return ops_[i]; }
+    void clear() { ops_.clear(); }
+
+    // Execute every queued op; returns the number of failed ones. Results
+    // stay readable until clear().
+    size_t submit() {
+      std::vector<size_t> updates, removes;
+      for (size_t i = 0; i < ops_.size(); i++) {
+        switch (ops_[i].kind) {
+          case UPDATE:
+            updates.push_back(i);
+            break;
+          case REMOVE:
+            removes.push_back(i);
+            break;
+          case LOOKUP:
+            ops_[i].ok = table_.lookup(&ops_[i].key, &ops_[i].value);
+            break;
+        }
+      }
+      submit_writes(updates, true);
+      submit_writes(removes, false);
+      size_t failed = 0;
+      for (const auto& o : ops_)
+        if (!o.ok)
+          failed++;
+      return failed;
+    }
+
+   private:
+    friend class BPFTableBase;
+    explicit OpQueue(BPFTableBase& table) : table_(table) {}
+
+    void submit_writes(const std::vector<size_t>& idx, bool is_update) {
+      const size_t chunk_size = 4096;
+      std::vector<KeyType> keys(std::min(idx.size(), chunk_size));
+      std::vector<ValueType> values(is_update ? keys.size() : 0);
+      for (size_t base = 0; base < idx.size(); base += chunk_size) {
+        uint32_t n = (uint32_t)std::min(idx.size() - base, chunk_size);
+        for (uint32_t i = 0; i < n; i++) {
+          keys[i] = ops_[idx[base + i]].key;
+          if (is_update)
+            values[i] = ops_[idx[base + i]].value;
+        }
+        uint32_t count = n;
+        bool done = is_update
+                        ? table_.update_batch(keys.data(), values.data(),
+                                              &count)
+                        : table_.remove_batch(keys.data(), &count);
+        if (done) {
+          for (uint32_t i = 0; i < n; i++)
+            ops_[idx[base + i]].ok = true;
+          continue;
+        }
+        // EINVAL means the kernel predates batch commands and count was
+        // never written; otherwise count elements went through before the
+        // failure. Redo whatever is not known-processed one at a time.
+        uint32_t processed = (errno == EINVAL) ? 0 : std::min(count, n);
+        for (uint32_t i = 0; i < processed; i++)
+          ops_[idx[base + i]].ok = true;
+        for (uint32_t i = processed; i < n; i++) {
+          Op& o = ops_[idx[base + i]];
+          o.ok = is_update ? table_.update(&o.key, &o.value)
+                           : table_.remove(&o.key);
+        }
+      }
+    }
+
+    BPFTableBase& table_;
+    std::vector<Op> ops_;
+  };
+
+  OpQueue op_queue() { return OpQueue(*this); }
+
  protected:
   explicit BPFTableBase(const TableDesc& desc) : desc(desc) {}
 
   bool lookup(void* key, void* value) {
+    bcc_stats_add(BCC_STAT_MAP_LOOKUPS, 1);
     return bpf_lookup_elem(desc.fd, key, value) >= 0;
   }
 
@@ -123,14 +390,51 @@ class BPFTableBase {
   }
 
   bool update(void* key, void* value) {
+    bcc_stats_add(BCC_STAT_MAP_UPDATES, 1);
     return bpf_update_elem(desc.fd, key, value, 0) >= 0;
   }
 
-  bool remove(void* key) { return bpf_delete_elem(desc.fd, key) >= 0; }
+  bool remove(void* key) {
+    bcc_stats_add(BCC_STAT_MAP_DELETES, 1);
+    return bpf_delete_elem(desc.fd, key) >= 0;
+  }
+
+  // Batched variants built on BPF_MAP_*_BATCH (kernel v5.6+). count is
+  // in/out: the capacity of the key/value buffers on entry, the number of
+  // elements processed on return. lookup_batch returns false with
+  // errno == ENOENT once the whole map has been drained.
+  bool lookup_batch(uint32_t* in_batch, uint32_t* out_batch, void* keys,
+                    void* values, uint32_t* count) {
+    bcc_stats_add(BCC_STAT_MAP_BATCH_OPS, 1);
+    return bpf_lookup_batch(desc.fd, in_batch, out_batch, keys, values,
+                            count) >= 0;
+  }
+
+  bool update_batch(void* keys, void* values, uint32_t* count) {
+    bcc_stats_add(BCC_STAT_MAP_BATCH_OPS, 1);
+    return bpf_update_batch(desc.fd, keys, values, count) >= 0;
+  }
+
+  bool remove_batch(void* keys, uint32_t* count) {
+    bcc_stats_add(BCC_STAT_MAP_BATCH_OPS, 1);
+    return bpf_delete_batch(desc.fd, keys, count) >= 0;
+  }
 
   const TableDesc& desc;
 };
 
+// Estimate of the kernel-resident memory a map of the given shape pins,
+// mirroring the kernel's own sizing: per-element metadata and 8-byte
+// rounding for hash maps, power-of-two bucket arrays, possible-CPU
+// multiplication for percpu types, preallocated element pools for
+// stack-trace maps, and the fixed ring plus bookkeeping pages for ringbufs.
+// Maps created with BPF_F_NO_PREALLOC are still reported at full capacity,
+// since that is what a memory budget has to reserve for them. Validated
+// against /proc/meminfo deltas for the common types; treat the result as a
+// planning figure (within ~15%), not an exact accounting.
+size_t map_memory_footprint(int map_type, size_t key_size, size_t leaf_size,
+                            size_t max_entries, int flags);
+
 class BPFTable : public BPFTableBase<void, void> {
  public:
   BPFTable(const TableDesc& desc);
@@ -149,6 +453,36 @@ class BPFTable : public BPFTableBase<void, void> {
   StatusTuple clear_table_non_atomic();
   StatusTuple get_table_offline(std::vector<std::pair<std::string, std::string>> &res);
 
+  // Decoded form of a binary snapshot: schema from the header plus the
+  // packed key and value blocks (count * key_size / count * leaf_size
+  // bytes, entry i at offset i * size).
+  struct snapshot_t {
+    std::string name;
+    std::string key_desc;   // compiler's type description of the key
+    std::string leaf_desc;  // and of the leaf, for field-level decoding
+    uint32_t key_size;
+    uint32_t leaf_size;
+    uint64_t count;
+    std::string keys;
+    std::string values;
+  };
+  // Compact binary snapshot for cross-host export, an order of magnitude
+  // smaller than JSON on typical counter maps: entries are drained
+  // through the batch read path, stored as columnar key and value blocks
+  // with every 8-byte lane delta + zigzag + varint encoded (counters and
+  // near-sorted keys collapse to a couple of bytes per entry; trailing
+  // non-lane bytes stay raw), and the body deflate-compressed when
+  // compress is set. The header carries the table name and the key/leaf
+  // type descriptions, so an aggregator decodes fields without the
+  // originating program. Readable on any host via snapshot_read(); both
+  // ends must share byte order, as with the map values themselves.
+  StatusTuple snapshot_write(std::string& out, bool compress = true);
+  static StatusTuple snapshot_read(const std::string& in, snapshot_t& snap);
+
+  // Estimated kernel-resident bytes this map pins, from its type, key/leaf
+  // sizes, max_entries and flags. See map_memory_footprint().
+  size_t memory_footprint() const;
+
   static size_t get_possible_cpu_count();
 };
 
@@ -189,6 +523,67 @@ class BPFQueueStackTable : public BPFQueueStackTableBase<void> {
       return StatusTuple(-1, "Error peeking value: %s", std::strerror(errno));
     return StatusTuple::OK();
   }
+
+  // Pop up to max elements into values with a single
+  // BPF_MAP_LOOKUP_AND_DELETE_BATCH syscall, falling back to per-element
+  // pops on kernels where queue/stack maps have no batch support. An
+  // empty map is not an error: values is simply left empty.
+  virtual StatusTuple pop_many(std::vector<ValueType>& values, size_t max) {
+    values.clear();
+    if (max == 0)
+      return StatusTuple::OK();
+
+    if (batch_supported_) {
+      values.resize(max);
+      uint32_t count = static_cast<uint32_t>(max);
+      bool ok = this->pop_batch(values.data(), &count);
+      if (ok || errno == ENOENT) {
+        // ENOENT means the map was drained before max; count still holds
+        // the number of elements returned
+        values.resize(count);
+        return StatusTuple::OK();
+      }
+      values.clear();
+      if (errno != EINVAL)
+        return StatusTuple(-1, "Error popping values: %s",
+                           std::strerror(errno));
+      batch_supported_ = false;
+    }
+
+    ValueType value;
+    while (values.size() < max && this->pop(get_value_addr(value)))
+      values.push_back(value);
+    if (values.empty() && errno != ENOENT)
+      return StatusTuple(-1, "Error popping values: %s", std::strerror(errno));
+    return StatusTuple::OK();
+  }
+
+  // Blocking drain for consumers that would otherwise spin-poll an empty
+  // queue. Queue/stack maps have no kernel-side wakeup to wait on, so this
+  // polls with an exponential backoff capped at 1ms: near-immediate pickup
+  // under load, ~1k probes/sec instead of a hot spin when idle. Returns
+  // with values empty once timeout_ms elapses; a negative timeout waits
+  // until an element arrives.
+  StatusTuple wait_and_pop_many(std::vector<ValueType>& values, size_t max,
+                                int timeout_ms) {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(timeout_ms);
+    std::chrono::microseconds backoff(1);
+    for (;;) {
+      TRY2(pop_many(values, max));
+      if (!values.empty())
+        return StatusTuple::OK();
+      if (timeout_ms >= 0 && std::chrono::steady_clock::now() >= deadline)
+        return StatusTuple::OK();
+      std::this_thread::sleep_for(backoff);
+      if (backoff < std::chrono::milliseconds(1))
+        backoff *= 2;
+    }
+  }
+
+ private:
+  // cleared the first time the kernel rejects a batch pop with EINVAL
+  bool batch_supported_ = true;
 };
 
 template <class ValueType>
@@ -229,8 +624,141 @@ class BPFArrayTable : public BPFTableBase<int, ValueType> {
 
     return res;
   }
+
+  // Map the value region of an array created with BPF_F_MMAPABLE (kernel
+  // v5.5+, plain BPF_MAP_TYPE_ARRAY only) into this process, enabling
+  // zero-syscall reads via get_value_mmap()/mmap_value_ptr(). The mapping
+  // is shared between table copies and unmapped with the last one.
+  StatusTuple enable_mmap() {
+    if (mmap_ptr_)
+      return StatusTuple::OK();
+    if (this->desc.type != BPF_MAP_TYPE_ARRAY)
+      return StatusTuple(-1, "Table '%s' is not a plain array table",
+                         this->desc.name.c_str());
+    // the kernel lays mmapable array values out with each slot rounded up
+    // to 8 bytes, and the whole region rounded up to the page size
+    size_t stride = (this->desc.leaf_size + 7) & ~static_cast<size_t>(7);
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t len = stride * this->desc.max_entries;
+    len = (len + page_size - 1) & ~(page_size - 1);
+    void* ptr = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       this->desc.fd, 0);
+    if (ptr == MAP_FAILED)
+      return StatusTuple(
+          -1, "Unable to mmap table '%s' (missing BPF_F_MMAPABLE?): %s",
+          this->desc.name.c_str(), std::strerror(errno));
+    mmap_ptr_ = std::shared_ptr<void>(ptr, [len](void* p) { ::munmap(p, len); });
+    return StatusTuple::OK();
+  }
+
+  // Direct pointer into the shared value region; nullptr if enable_mmap()
+  // was not called or index is out of range. Reads through the pointer see
+  // concurrent kernel updates without any syscall.
+  ValueType* mmap_value_ptr(const int& index) {
+    if (!mmap_ptr_ || index < 0 || (size_t)index >= this->desc.max_entries)
+      return nullptr;
+    size_t stride = (this->desc.leaf_size + 7) & ~static_cast<size_t>(7);
+    return reinterpret_cast<ValueType*>(static_cast<char*>(mmap_ptr_.get()) +
+                                        stride * index);
+  }
+
+  StatusTuple get_value_mmap(const int& index, ValueType& value) {
+    ValueType* ptr = mmap_value_ptr(index);
+    if (!ptr)
+      return StatusTuple(-1, "mmap not enabled or index out of range");
+    std::memcpy(&value, ptr, sizeof(ValueType));
+    return StatusTuple::OK();
+  }
+
+  std::vector<ValueType> get_table_offline_mmap() {
+    std::vector<ValueType> res;
+    if (!mmap_ptr_)
+      return res;
+    res.resize(this->capacity());
+    for (int i = 0; i < (int)this->capacity(); i++)
+      std::memcpy(&res[i], mmap_value_ptr(i), sizeof(ValueType));
+    return res;
+  }
+
+ private:
+  std::shared_ptr<void> mmap_ptr_;
+};
+
+// Zero-syscall reads for the common tool pattern of a small BPF_ARRAY of
+// global counters. The view maps the array's value pages once at
+// construction (the map must be created with BPF_F_MMAPABLE, kernel v5.5+),
+// after which value() is a plain relaxed load and sum() reduces a
+// contiguous index range with a unit-stride loop the compiler vectorizes.
+// On kernels without mmapable arrays every read falls back to the lookup
+// syscall, so tools can use the view unconditionally. For per-CPU counters
+// the kernel offers no mmap; use BPFPercpuArrayTable::get_value_sum, which
+// reduces the batch-fetched slots the same way.
+template <class ValueType>
+class BPFCounterView {
+  static_assert(std::is_arithmetic<ValueType>::value,
+                "counter views require an arithmetic value type");
+
+ public:
+  explicit BPFCounterView(const TableDesc& desc) : table_(desc) {
+    mapped_ = table_.enable_mmap().ok();
+  }
+
+  // true when reads are plain loads rather than syscalls
+  bool mapped() const { return mapped_; }
+
+  size_t size() { return table_.capacity(); }
+
+  ValueType value(int index) {
+    if (mapped_) {
+      ValueType* ptr = table_.mmap_value_ptr(index);
+      if (ptr) {
+        ValueType v;
+        __atomic_load(ptr, &v, __ATOMIC_RELAXED);
+        return v;
+      }
+    }
+    return table_[index];
+  }
+
+  // Sum of the counters in [first, first + count); with an active mapping
+  // and no slot padding this is a single vectorizable pass over the pages.
+  ValueType sum(int first, int count) {
+    if (mapped_ && sizeof(ValueType) % 8 == 0) {
+      ValueType* base = table_.mmap_value_ptr(first);
+      if (base && first + count <= (int)table_.capacity()) {
+        ValueType total = ValueType();
+        for (int i = 0; i < count; i++)
+          total += base[i];
+        return total;
+      }
+    }
+    ValueType total = ValueType();
+    for (int i = first; i < first + count; i++)
+      total += value(i);
+    return total;
+  }
+
+  ValueType sum_all() { return sum(0, (int)table_.capacity()); }
+
+ private:
+  BPFArrayTable<ValueType> table_;
+  bool mapped_;
 };
 
+// Reduce one key's per-CPU slots straight from the raw syscall buffer. The
+// slots are unit-stride and 8-byte aligned (the percpu table constructors
+// enforce the alignment), so the compiler vectorizes this loop with whatever
+// the target offers (AVX2, NEON, ...) and no per-element objects are built.
+template <class T>
+inline T percpu_reduce_sum(const T* vals, unsigned int ncpus) {
+  static_assert(std::is_arithmetic<T>::value,
+                "per-CPU summation requires an arithmetic value type");
+  T sum = T();
+  for (unsigned int i = 0; i < ncpus; i++)
+    sum += vals[i];
+  return sum;
+}
+
 template <class ValueType>
 class BPFPercpuArrayTable : public BPFArrayTable<std::vector<ValueType>> {
  public:
@@ -258,10 +786,257 @@ class BPFPercpuArrayTable : public BPFArrayTable<std::vector<ValueType>> {
     return BPFArrayTable<std::vector<ValueType>>::update_value(index, value);
   }
 
+  // Percpu arrays cannot be created with BPF_F_MMAPABLE, so the closest the
+  // kernel offers to a bulk snapshot is BPF_MAP_LOOKUP_BATCH (v5.6+): one
+  // syscall copies every slot for every possible CPU into a flat buffer.
+  StatusTuple get_table_offline_batch(
+      std::vector<std::vector<ValueType>>& res) {
+    uint32_t count = this->capacity();
+    std::vector<uint32_t> keys(count);
+    std::vector<ValueType> values(count * ncpus);
+
+    uint32_t out_batch;
+    if (!this->lookup_batch(nullptr, &out_batch, keys.data(), values.data(),
+                            &count) &&
+        errno != ENOENT)
+      return StatusTuple(-1, "Error getting values in batch: %s",
+                         std::strerror(errno));
+
+    res.resize(this->capacity());
+    for (uint32_t i = 0; i < count; i++)
+      res[keys[i]].assign(values.begin() + i * ncpus,
+                          values.begin() + (i + 1) * ncpus);
+    return StatusTuple::OK();
+  }
+
+  // Sum of one slot across all possible CPUs, for arithmetic value types.
+  StatusTuple get_value_sum(const int& index, ValueType& sum) {
+    std::vector<ValueType> vals;
+    TRY2(get_value(index, vals));
+    sum = percpu_reduce_sum(vals.data(), ncpus);
+    return StatusTuple::OK();
+  }
+
+  // Snapshot of the whole table with the per-CPU dimension already summed
+  // away: one lookup_batch syscall, then each key's slots are reduced
+  // directly from the flat buffer without materializing per-CPU vectors.
+  StatusTuple get_table_offline_summed(std::vector<ValueType>& res) {
+    uint32_t count = this->capacity();
+    std::vector<uint32_t> keys(count);
+    std::vector<ValueType> values(count * ncpus);
+
+    uint32_t out_batch;
+    if (!this->lookup_batch(nullptr, &out_batch, keys.data(), values.data(),
+                            &count) &&
+        errno != ENOENT)
+      return StatusTuple(-1, "Error getting values in batch: %s",
+                         std::strerror(errno));
+
+    res.assign(this->capacity(), ValueType());
+    for (uint32_t i = 0; i < count; i++)
+      res[keys[i]] = percpu_reduce_sum(&values[i * ncpus], ncpus);
+    return StatusTuple::OK();
+  }
+
  private:
   unsigned int ncpus;
 };
 
+// First-class view of a BPF_HISTOGRAM table with the default int slot key
+// (a plain or percpu array of u64 slot counters). Decodes the log2/linear
+// slot encoding that bpf_log2l()-style instrumentation writes, so tools
+// stop re-deriving bucket bounds per poll: one snapshot syscall
+// (lookup_batch where the kernel supports it, per-slot lookups otherwise),
+// percpu slots merged straight from the flat buffer with the vectorizable
+// percpu_reduce_sum loop, and percentiles computed in a single cumulative
+// walk over the slot counts without materializing per-bucket vectors.
+// Histograms with struct keys compile to hash maps and are not covered.
+class BPFHistogramTable : public BPFTableBase<int, uint64_t> {
+ public:
+  explicit BPFHistogramTable(const TableDesc& desc)
+      : BPFTableBase<int, uint64_t>(desc),
+        ncpus_(desc.type == BPF_MAP_TYPE_PERCPU_ARRAY
+                   ? BPFTable::get_possible_cpu_count()
+                   : 1) {
+    if (desc.type != BPF_MAP_TYPE_ARRAY &&
+        desc.type != BPF_MAP_TYPE_PERCPU_ARRAY)
+      throw std::invalid_argument("Table '" + desc.name +
+                                  "' is not an int-keyed histogram table");
+    if (desc.leaf_size != sizeof(uint64_t))
+      throw std::invalid_argument("histogram leaf type must be u64");
+  }
+
+  struct Bucket {
+    uint64_t low;
+    uint64_t high;
+    uint64_t count;
+  };
+
+  // Snapshot of all slot counters with the per-CPU dimension (if any)
+  // already summed away.
+  StatusTuple snapshot(std::vector<uint64_t>& slots) {
+    uint32_t count = this->capacity();
+    std::vector<uint32_t> keys(count);
+    std::vector<uint64_t> values((size_t)count * ncpus_);
+
+    slots.assign(this->capacity(), 0);
+    uint32_t out_batch;
+    if (this->lookup_batch(nullptr, &out_batch, keys.data(), values.data(),
+                           &count) ||
+        errno == ENOENT) {
+      for (uint32_t i = 0; i < count; i++)
+        slots[keys[i]] = percpu_reduce_sum(&values[(size_t)i * ncpus_],
+                                           ncpus_);
+      return StatusTuple::OK();
+    }
+
+    // Batched lookup needs kernel v5.6+; fall back to per-slot lookups.
+    for (int i = 0; i < (int)this->capacity(); i++) {
+      if (this->lookup(&i, values.data()))
+        slots[i] = percpu_reduce_sum(values.data(), ncpus_);
+    }
+    return StatusTuple::OK();
+  }
+
+  // Occupied buckets of a bpf_log2l()-indexed histogram: slot i covers
+  // [2^(i-1), 2^i - 1], with slot 0 counting zero-valued samples.
+  StatusTuple get_log2_buckets(std::vector<Bucket>& buckets) {
+    std::vector<uint64_t> slots;
+    TRY2(snapshot(slots));
+    buckets.clear();
+    for (size_t i = 0; i < slots.size(); i++) {
+      if (!slots[i])
+        continue;
+      Bucket b;
+      b.low = i >= 64 ? (1ULL << 63) : (1ULL << i) >> 1;
+      b.high = i >= 64 ? ~0ULL : (1ULL << i) - 1;
+      b.count = slots[i];
+      buckets.push_back(b);
+    }
+    return StatusTuple::OK();
+  }
+
+  // Occupied buckets of a linear histogram indexed with value / slot_width:
+  // slot i covers [i * slot_width, (i + 1) * slot_width - 1].
+  StatusTuple get_linear_buckets(uint64_t slot_width,
+                                 std::vector<Bucket>& buckets) {
+    if (slot_width == 0)
+      return StatusTuple(-1, "slot_width must be non-zero");
+    std::vector<uint64_t> slots;
+    TRY2(snapshot(slots));
+    buckets.clear();
+    for (size_t i = 0; i < slots.size(); i++) {
+      if (!slots[i])
+        continue;
+      Bucket b;
+      b.low = i * slot_width;
+      b.high = (i + 1) * slot_width - 1;
+      b.count = slots[i];
+      buckets.push_back(b);
+    }
+    return StatusTuple::OK();
+  }
+
+  // Sample count and percentiles of a log2 histogram in one cumulative
+  // pass over the slots; percentiles are reported as the upper bound of
+  // the bucket containing them, matching the histogram's resolution.
+  struct Summary {
+    uint64_t total = 0;
+    uint64_t p50 = 0;
+    uint64_t p95 = 0;
+    uint64_t p99 = 0;
+  };
+
+  StatusTuple get_summary(Summary& summary) {
+    std::vector<uint64_t> slots;
+    TRY2(snapshot(slots));
+    summary = Summary();
+    for (uint64_t count : slots)
+      summary.total += count;
+    if (summary.total == 0)
+      return StatusTuple::OK();
+
+    uint64_t t50 = (summary.total * 50 + 99) / 100;
+    uint64_t t95 = (summary.total * 95 + 99) / 100;
+    uint64_t t99 = (summary.total * 99 + 99) / 100;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < slots.size(); i++) {
+      if (!slots[i])
+        continue;
+      seen += slots[i];
+      uint64_t high = i >= 64 ? ~0ULL : (1ULL << i) - 1;
+      if (!summary.p50 && seen >= t50)
+        summary.p50 = high;
+      if (!summary.p95 && seen >= t95)
+        summary.p95 = high;
+      if (!summary.p99 && seen >= t99) {
+        summary.p99 = high;
+        break;
+      }
+    }
+    return StatusTuple::OK();
+  }
+
+ private:
+  unsigned int ncpus_;
+};
+
+// Fleet-scale aggregation companions for BPFHistogramTable: merge kernels
+// and quantile extraction over the same flat u64 slot arrays snapshot()
+// produces, for aggregators that combine histograms from many hosts and
+// tools without a live map behind each input. The merge loops are written
+// so the compiler vectorizes them (plain index loops over __restrict__
+// pointers), and histogram_merge_many folds four inputs per pass over
+// dst -- a flattened tree reduction that moves the bulk of the memory
+// traffic from the accumulator to the streamed inputs.
+
+// dst[i] += src[i] over n_slots slots.
+void histogram_merge_slots(uint64_t* dst, const uint64_t* src,
+                           size_t n_slots);
+
+// Merges n_inputs slot arrays (srcs[0..n_inputs)) into dst.
+void histogram_merge_many(uint64_t* dst, const uint64_t* const* srcs,
+                          size_t n_inputs, size_t n_slots);
+
+// Accumulates merged slot counts as inputs stream in and answers quantile
+// queries at bucket resolution, without retaining the inputs. Inputs may
+// have differing slot counts (tools compile histograms of different
+// widths); the accumulator grows to the widest seen.
+class HistogramAggregator {
+ public:
+  explicit HistogramAggregator(size_t n_slots = 0) : slots_(n_slots, 0) {}
+
+  void add(const uint64_t* slots, size_t n_slots);
+  void add_many(const uint64_t* const* srcs, size_t n_inputs,
+                size_t n_slots);
+
+  const std::vector<uint64_t>& slots() const { return slots_; }
+  uint64_t total() const { return total_; }
+
+  // Upper bound of the bucket holding quantile q (0 < q <= 1), reported
+  // at the histogram's resolution like BPFHistogramTable::get_summary;
+  // 0 when empty. log2_quantile maps slots like bpf_log2l(),
+  // linear_quantile like value / slot_width indexing. log2_quantiles
+  // answers an ascending list of qs in one cumulative walk.
+  uint64_t log2_quantile(double q) const;
+  uint64_t linear_quantile(double q, uint64_t slot_width) const;
+  void log2_quantiles(const std::vector<double>& qs,
+                      std::vector<uint64_t>& bounds) const;
+
+ private:
+  std::vector<uint64_t> slots_;
+  uint64_t total_ = 0;
+};
+
+// Backend of BPFHashTable::get_table_offline_iter(): loads a generic
+// bpf_map_elem iterator program that copies every {key, value} pair of
+// map_fd into a ring buffer from kernel context, then replays the ring
+// buffer through sink (key pointer, value pointer). Lives in BPFTable.cc to
+// keep the instruction assembly out of the template.
+StatusTuple dump_map_via_iter(
+    int map_fd, size_t key_size, size_t value_size, uint32_t max_entries,
+    const std::function<bool(const void*, const void*)>& sink);
+
 template <class KeyType, class ValueType>
 class BPFHashTable : public BPFTableBase<KeyType, ValueType> {
  public:
@@ -322,6 +1097,180 @@ class BPFHashTable : public BPFTableBase<KeyType, ValueType> {
     return res;
   }
 
+  // Drain the whole table into res with BPF_MAP_LOOKUP_BATCH instead of one
+  // get_next_key plus lookup syscall pair per element. res is resized to the
+  // map capacity up front and shrunk to the number of elements read, so the
+  // buffer can be reused across scans. Requires kernel v5.6+; on older
+  // kernels an error is returned and callers can fall back to
+  // get_table_offline().
+  StatusTuple get_table_offline_batch(
+      std::vector<std::pair<KeyType, ValueType>>& res) {
+    uint32_t capacity = this->desc.max_entries;
+    std::vector<KeyType> keys(capacity);
+    std::vector<ValueType> values(capacity);
+    size_t total = 0;
+    uint32_t in_batch = 0, out_batch = 0;
+    bool first_batch = true;
+
+    res.clear();
+    while (total < capacity) {
+      uint32_t count = capacity - total;
+      bool ok = this->lookup_batch(first_batch ? nullptr : &in_batch,
+                                   &out_batch, &keys[total], &values[total],
+                                   &count);
+      total += count;
+      if (!ok && errno != ENOENT)
+        return StatusTuple(-1, "Error batch getting table: %s",
+                           std::strerror(errno));
+      first_batch = false;
+      in_batch = out_batch;
+      if (!ok)
+        break;  // ENOENT: whole map drained
+    }
+
+    res.reserve(total);
+    for (size_t i = 0; i < total; i++)
+      res.emplace_back(keys[i], values[i]);
+    return StatusTuple::OK();
+  }
+
+  // Bulk point lookups for plain fixed-size key/value types (the common
+  // u32/u64-keyed maps): one direct bpf_lookup_elem per key, with no
+  // per-element StatusTuple, virtual dispatch or message formatting.
+  // Keys and values are contiguous caller-owned arrays, so each iteration's
+  // operands sit on already-touched cache lines. found[i] records whether
+  // keys[i] was present; a miss is not an error. Returns the hit count.
+  // (The enable_if takes the place of an if-constexpr/std::span signature:
+  // the tree still builds as C++14.)
+  template <typename K = KeyType, typename V = ValueType>
+  typename std::enable_if<std::is_trivially_copyable<K>::value &&
+                              std::is_trivially_copyable<V>::value,
+                          size_t>::type
+  lookup_many(const K* keys, V* values, bool* found, size_t count) {
+    size_t hits = 0;
+    for (size_t i = 0; i < count; i++) {
+      found[i] = bpf_lookup_elem(this->desc.fd, const_cast<K*>(&keys[i]),
+                                 &values[i]) >= 0;
+      if (found[i])
+        hits++;
+    }
+    bcc_stats_add(BCC_STAT_MAP_LOOKUPS, count);
+    return hits;
+  }
+
+  // Bulk counterpart of update_value under the same constraints; returns
+  // the number of keys updated successfully.
+  template <typename K = KeyType, typename V = ValueType>
+  typename std::enable_if<std::is_trivially_copyable<K>::value &&
+                              std::is_trivially_copyable<V>::value,
+                          size_t>::type
+  update_many(const K* keys, const V* values, size_t count) {
+    size_t updated = 0;
+    for (size_t i = 0; i < count; i++)
+      if (bpf_update_elem(this->desc.fd, const_cast<K*>(&keys[i]),
+                          const_cast<V*>(&values[i]), 0) >= 0)
+        updated++;
+    bcc_stats_add(BCC_STAT_MAP_UPDATES, count);
+    return updated;
+  }
+
+  // Stream the whole table through sink one {key, value} pair at a time,
+  // reading it in fixed-size batches so only one batch is ever held in
+  // memory, unlike get_table_offline_batch() which materializes the full
+  // map. sink returning false stops the scan early. Requires kernel v5.6+.
+  StatusTuple get_table_offline_stream(
+      std::function<bool(const KeyType&, const ValueType&)> sink) {
+    const uint32_t chunk =
+        std::min<uint32_t>(this->desc.max_entries, 4096);
+    std::vector<KeyType> keys(chunk);
+    std::vector<ValueType> values(chunk);
+    uint32_t in_batch = 0, out_batch = 0;
+    bool first_batch = true;
+
+    while (true) {
+      uint32_t count = chunk;
+      bool ok = this->lookup_batch(first_batch ? nullptr : &in_batch,
+                                   &out_batch, keys.data(), values.data(),
+                                   &count);
+      if (!ok && errno != ENOENT)
+        return StatusTuple(-1, "Error batch getting table: %s",
+                           std::strerror(errno));
+      for (uint32_t i = 0; i < count; i++)
+        if (!sink(keys[i], values[i]))
+          return StatusTuple::OK();
+      first_batch = false;
+      in_batch = out_batch;
+      if (!ok)
+        return StatusTuple::OK();  // ENOENT: whole map drained
+    }
+  }
+
+  // Dump the table from kernel context instead of by syscall-driven lookups:
+  // a small generic bpf_map_elem iterator program streams every {key, value}
+  // pair into a ring buffer sized for the whole map, a single read() of the
+  // iterator fd drives the walk, and the ring buffer is then replayed
+  // through sink. The iteration runs under the map's own kernel-side
+  // locking, so a hash being updated concurrently is snapshotted without
+  // get_next_key races or one syscall transition per batch. Requires kernel
+  // v5.8+ (bpf_iter plus BPF ring buffers); per-cpu hashes are not
+  // supported. sink returning false stops the replay early (the kernel walk
+  // itself always completes).
+  StatusTuple get_table_offline_iter(
+      std::function<bool(const KeyType&, const ValueType&)> sink) {
+    if (this->desc.type == BPF_MAP_TYPE_PERCPU_HASH ||
+        this->desc.type == BPF_MAP_TYPE_LRU_PERCPU_HASH)
+      return StatusTuple(-1, "Iterator dump does not support per-cpu hashes");
+    return dump_map_via_iter(
+        this->desc.fd, sizeof(KeyType), sizeof(ValueType),
+        this->desc.max_entries,
+        [&sink](const void* key, const void* value) {
+          return sink(*static_cast<const KeyType*>(key),
+                      *static_cast<const ValueType*>(value));
+        });
+  }
+
+  // Stream the table into a caller-supplied buffer (typically a mmap'd file)
+  // as packed {key, value} records of sizeof(KeyType) + sizeof(ValueType)
+  // bytes each. Stops when the buffer is full; nwritten is set to the number
+  // of records written either way.
+  StatusTuple get_table_offline_raw(void* buf, size_t buf_size,
+                                    size_t& nwritten) {
+    const size_t record_size = sizeof(KeyType) + sizeof(ValueType);
+    char* out = static_cast<char*>(buf);
+    nwritten = 0;
+    return get_table_offline_stream(
+        [&](const KeyType& key, const ValueType& value) {
+          if ((nwritten + 1) * record_size > buf_size)
+            return false;
+          std::memcpy(out, &key, sizeof(KeyType));
+          std::memcpy(out + sizeof(KeyType), &value, sizeof(ValueType));
+          out += record_size;
+          nwritten++;
+          return true;
+        });
+  }
+
+  // Batched counterpart of update_value(): one BPF_MAP_UPDATE_BATCH syscall
+  // for the whole key/value set.
+  StatusTuple update_value_batch(std::vector<KeyType>& keys,
+                                 std::vector<ValueType>& values) {
+    if (keys.size() != values.size())
+      return StatusTuple(-1, "Key and value counts mismatch");
+    uint32_t count = keys.size();
+    if (!this->update_batch(keys.data(), values.data(), &count))
+      return StatusTuple(-1, "Error batch updating table: %s",
+                         std::strerror(errno));
+    return StatusTuple::OK();
+  }
+
+  StatusTuple remove_value_batch(std::vector<KeyType>& keys) {
+    uint32_t count = keys.size();
+    if (!this->remove_batch(keys.data(), &count))
+      return StatusTuple(-1, "Error batch removing from table: %s",
+                         std::strerror(errno));
+    return StatusTuple::OK();
+  }
+
   StatusTuple clear_table_non_atomic() {
     KeyType cur;
     while (this->first(&cur))
@@ -329,6 +1278,380 @@ class BPFHashTable : public BPFTableBase<KeyType, ValueType> {
 
     return StatusTuple::OK();
   }
+
+  // Change watching: watch() replaces caller-side full-map polling with
+  // change callbacks driven by a library thread. Defined below
+  // BPFTableSnapshotter, which provides the change detection.
+  struct WatchState;
+  template <typename Callback>
+  StatusTuple watch(Callback callback, uint64_t poll_interval_ms = 100);
+  void unwatch();
+  BPFHashTable(const BPFHashTable&) = default;
+  ~BPFHashTable();
+
+ private:
+  void stop_watch_state();
+  // shared across copies of the table handle; the last copy stops the
+  // watcher thread on destruction
+  std::shared_ptr<WatchState> watch_state_;
+};
+
+// Diff engine for periodic map export. Keeps the previous scan of a hash
+// table in a flat open-addressing table and streams each new scan through
+// it, invoking the callback only for entries that were created, updated or
+// deleted since the last scan. An exporter polling a large, mostly-stable
+// map then serializes the churn per interval instead of two full copies
+// plus a hash join. Key and value types must be trivially copyable (values
+// are compared with memcmp), which holds for the plain struct types bcc
+// tables use. Scanning uses BPF_MAP_LOOKUP_BATCH, so kernel v5.6+ is
+// required, same as get_table_offline_stream().
+template <class KeyType, class ValueType>
+class BPFTableSnapshotter {
+ public:
+  enum Change { KEY_CREATED, KEY_UPDATED, KEY_DELETED };
+  typedef std::function<void(Change, const KeyType&, const ValueType&)>
+      diff_cb;
+
+  explicit BPFTableSnapshotter(BPFHashTable<KeyType, ValueType>& table)
+      : table_(table), epoch_(0), occupied_(0), tombstones_(0) {
+    static_assert(std::is_trivially_copyable<KeyType>::value &&
+                      std::is_trivially_copyable<ValueType>::value,
+                  "BPFTableSnapshotter requires trivially copyable types");
+    size_t want = 16;
+    while (want < table.capacity() + table.capacity() / 2)
+      want <<= 1;
+    slots_.resize(want);
+  }
+
+  // Read the current table contents and report the delta against the
+  // previous scan: created and updated entries in map iteration order while
+  // streaming, then one deletion per vanished key. The first scan reports
+  // every entry as created. On error the callback may already have received
+  // part of the delta; the next successful scan reports changes relative to
+  // what was delivered, so no transition is lost.
+  StatusTuple scan(diff_cb callback) {
+    epoch_++;
+    TRY2(table_.get_table_offline_stream(
+        [&](const KeyType& key, const ValueType& value) {
+          observe(key, value, callback);
+          return true;
+        }));
+
+    for (auto& slot : slots_) {
+      if (slot.state == OCCUPIED && slot.epoch != epoch_) {
+        callback(KEY_DELETED, slot.key, slot.value);
+        slot.state = TOMBSTONE;
+        occupied_--;
+        tombstones_++;
+      }
+    }
+    return StatusTuple::OK();
+  }
+
+  // Forget the previous scan; the next scan() reports the whole table as
+  // created again (e.g. after an export sink reconnects).
+  void reset() {
+    for (auto& slot : slots_)
+      slot.state = EMPTY;
+    occupied_ = 0;
+    tombstones_ = 0;
+  }
+
+  size_t size() const { return occupied_; }
+
+ private:
+  enum SlotState : uint8_t { EMPTY, OCCUPIED, TOMBSTONE };
+
+  struct Slot {
+    KeyType key;
+    ValueType value;
+    uint32_t epoch;
+    SlotState state = EMPTY;
+  };
+
+  static size_t hash_key(const KeyType& key) {
+    // FNV-1a over the key bytes; keys are kernel copies of the full
+    // key_size bytes, so padding is stable between scans
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(&key);
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < sizeof(KeyType); i++) {
+      h ^= p[i];
+      h *= 0x100000001b3ull;
+    }
+    return static_cast<size_t>(h);
+  }
+
+  void observe(const KeyType& key, const ValueType& value, diff_cb& callback) {
+    if ((occupied_ + tombstones_) * 10 >= slots_.size() * 7)
+      rehash();
+
+    size_t mask = slots_.size() - 1;
+    size_t idx = hash_key(key) & mask;
+    size_t insert_at = slots_.size();
+    while (true) {
+      Slot& slot = slots_[idx];
+      if (slot.state == EMPTY) {
+        if (insert_at == slots_.size())
+          insert_at = idx;
+        break;
+      }
+      if (slot.state == TOMBSTONE) {
+        if (insert_at == slots_.size())
+          insert_at = idx;
+      } else if (std::memcmp(&slot.key, &key, sizeof(KeyType)) == 0) {
+        slot.epoch = epoch_;
+        if (std::memcmp(&slot.value, &value, sizeof(ValueType)) != 0) {
+          slot.value = value;
+          callback(KEY_UPDATED, key, value);
+        }
+        return;
+      }
+      idx = (idx + 1) & mask;
+    }
+
+    Slot& slot = slots_[insert_at];
+    if (slot.state == TOMBSTONE)
+      tombstones_--;
+    slot.key = key;
+    slot.value = value;
+    slot.epoch = epoch_;
+    slot.state = OCCUPIED;
+    occupied_++;
+    callback(KEY_CREATED, key, value);
+  }
+
+  // grow (or just drop tombstones) and reinsert the live entries
+  void rehash() {
+    size_t want = slots_.size();
+    if (occupied_ * 10 >= slots_.size() * 5)
+      want <<= 1;
+    std::vector<Slot> old;
+    old.swap(slots_);
+    slots_.resize(want);
+    tombstones_ = 0;
+    size_t mask = slots_.size() - 1;
+    for (const auto& slot : old) {
+      if (slot.state != OCCUPIED)
+        continue;
+      size_t idx = hash_key(slot.key) & mask;
+      while (slots_[idx].state == OCCUPIED)
+        idx = (idx + 1) & mask;
+      slots_[idx] = slot;
+    }
+  }
+
+  BPFHashTable<KeyType, ValueType>& table_;
+  std::vector<Slot> slots_;
+  uint32_t epoch_;
+  size_t occupied_;
+  size_t tombstones_;
+};
+
+// Watch support for BPFHashTable, built on BPFTableSnapshotter: a library
+// thread scans the map in lookup_batch chunks at the poll interval and
+// invokes the callback only for created, updated and deleted entries, so a
+// control plane consuming another component's map trades its own full-map
+// polls plus diffing for change records. There is no kernel-side map-update
+// tracepoint to attach to, and instrumenting update helper calls in
+// programs this process compiles cannot see writers in other processes, so
+// the scan stays poll-based inside the library — but unchanged entries cost
+// no callback and no copy beyond the batched read.
+template <class KeyType, class ValueType>
+struct BPFHashTable<KeyType, ValueType>::WatchState {
+  BPFHashTable<KeyType, ValueType> table;
+  BPFTableSnapshotter<KeyType, ValueType> snapshotter;
+  typename BPFTableSnapshotter<KeyType, ValueType>::diff_cb cb;
+  uint64_t interval_ms;
+  bool running = false;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::thread thread;
+
+  WatchState(const BPFHashTable<KeyType, ValueType>& t,
+             typename BPFTableSnapshotter<KeyType, ValueType>::diff_cb c,
+             uint64_t ms)
+      : table(t), snapshotter(table), cb(std::move(c)), interval_ms(ms) {}
+};
+
+// Start watching: the callback (a BPFTableSnapshotter::diff_cb) first
+// receives the current contents as KEY_CREATED records, then only deltas.
+// The priming scan runs synchronously so missing kernel batch support
+// (pre-v5.6) fails here rather than silently in the thread. The callback
+// runs on the watcher thread.
+template <class KeyType, class ValueType>
+template <typename Callback>
+StatusTuple BPFHashTable<KeyType, ValueType>::watch(
+    Callback callback, uint64_t poll_interval_ms) {
+  if (watch_state_)
+    return StatusTuple(-1, "Table is already being watched");
+  auto state = std::make_shared<WatchState>(
+      *this,
+      typename BPFTableSnapshotter<KeyType, ValueType>::diff_cb(callback),
+      poll_interval_ms);
+  TRY2(state->snapshotter.scan(state->cb));
+  state->running = true;
+  WatchState* raw = state.get();
+  state->thread = std::thread([raw] {
+    std::unique_lock<std::mutex> guard(raw->mutex);
+    while (raw->running) {
+      if (raw->cv.wait_for(guard, std::chrono::milliseconds(raw->interval_ms),
+                           [raw] { return !raw->running; }))
+        break;
+      guard.unlock();
+      raw->snapshotter.scan(raw->cb);
+      guard.lock();
+    }
+  });
+  watch_state_ = state;
+  return StatusTuple::OK();
+}
+
+template <class KeyType, class ValueType>
+void BPFHashTable<KeyType, ValueType>::stop_watch_state() {
+  WatchState* state = watch_state_.get();
+  {
+    std::lock_guard<std::mutex> guard(state->mutex);
+    if (!state->running)
+      return;
+    state->running = false;
+  }
+  state->cv.notify_all();
+  state->thread.join();
+}
+
+template <class KeyType, class ValueType>
+void BPFHashTable<KeyType, ValueType>::unwatch() {
+  if (!watch_state_)
+    return;
+  stop_watch_state();
+  watch_state_.reset();
+}
+
+template <class KeyType, class ValueType>
+BPFHashTable<KeyType, ValueType>::~BPFHashTable() {
+  // only the last handle sharing this watch state may tear the thread down
+  if (watch_state_ && watch_state_.use_count() == 1)
+    stop_watch_state();
+}
+
+// Idle-entry eviction for plain BPF_HASH tables: a middle ground between a
+// hash that fills until updates fail with E2BIG and an LRU hash that pays
+// list maintenance on every hot-path update. The tool records a
+// bpf_ktime_get_ns() timestamp in each value (last-seen is one store); the
+// evictor is told the byte offset of that u64 field and sweeps the map from
+// a background thread, reading it in lookup_batch chunks and deleting
+// entries idle beyond the TTL with one BPF_MAP_DELETE_BATCH per sweep. The
+// hot path stays a plain hash update; all eviction cost runs in userspace.
+// Requires kernel v5.6+ for the batch syscalls, like
+// get_table_offline_stream().
+template <class KeyType, class ValueType>
+class BPFHashTableEvictor {
+ public:
+  BPFHashTableEvictor(BPFHashTable<KeyType, ValueType>& table,
+                      size_t timestamp_offset, uint64_t ttl_ns,
+                      uint64_t sweep_interval_ms = 1000)
+      : table_(table),
+        timestamp_offset_(timestamp_offset),
+        ttl_ns_(ttl_ns),
+        sweep_interval_ms_(sweep_interval_ms),
+        running_(false) {
+    static_assert(std::is_trivially_copyable<KeyType>::value &&
+                      std::is_trivially_copyable<ValueType>::value,
+                  "BPFHashTableEvictor requires trivially copyable types");
+    if (timestamp_offset + sizeof(uint64_t) > sizeof(ValueType))
+      throw std::invalid_argument(
+          "timestamp offset out of bounds for value type");
+  }
+
+  ~BPFHashTableEvictor() { stop(); }
+
+  StatusTuple start() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (running_)
+      return StatusTuple(-1, "Evictor already running");
+    // probe batch support up front so the failure surfaces to the caller
+    // instead of silently looping in the sweeper thread
+    TRY2(sweep_once_internal(nullptr));
+    running_ = true;
+    thread_ = std::thread([this] { sweeper(); });
+    return StatusTuple::OK();
+  }
+
+  void stop() {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (!running_)
+        return;
+      running_ = false;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  // One synchronous sweep, also usable without the background thread;
+  // n_evicted is set to the number of entries deleted.
+  StatusTuple sweep_once(size_t& n_evicted) {
+    return sweep_once_internal(&n_evicted);
+  }
+
+ private:
+  uint64_t idle_threshold() const {
+    // bpf_ktime_get_ns() is CLOCK_MONOTONIC, which steady_clock maps to
+    uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                       .count();
+    return now > ttl_ns_ ? now - ttl_ns_ : 0;
+  }
+
+  StatusTuple sweep_once_internal(size_t* n_evicted) {
+    uint64_t cutoff = idle_threshold();
+    std::vector<KeyType> idle;
+    TRY2(table_.get_table_offline_stream(
+        [&](const KeyType& key, const ValueType& value) {
+          uint64_t last_seen;
+          std::memcpy(&last_seen,
+                      reinterpret_cast<const char*>(&value) +
+                          timestamp_offset_,
+                      sizeof(last_seen));
+          if (last_seen < cutoff)
+            idle.push_back(key);
+          return true;
+        }));
+    // races between the scan and the batch delete are benign: a key already
+    // gone makes the delete stop with ENOENT (just churn, not a failure),
+    // and an entry refreshed in the window is at worst evicted one TTL
+    // early and re-created on its next use
+    if (!idle.empty()) {
+      StatusTuple rc = table_.remove_value_batch(idle);
+      if (!rc.ok() && errno != ENOENT)
+        return rc;
+    }
+    if (n_evicted)
+      *n_evicted = idle.size();
+    return StatusTuple::OK();
+  }
+
+  void sweeper() {
+    std::unique_lock<std::mutex> guard(mutex_);
+    while (running_) {
+      if (cv_.wait_for(guard, std::chrono::milliseconds(sweep_interval_ms_),
+                       [this] { return !running_; }))
+        break;
+      guard.unlock();
+      size_t evicted;
+      sweep_once_internal(&evicted);
+      guard.lock();
+    }
+  }
+
+  BPFHashTable<KeyType, ValueType>& table_;
+  size_t timestamp_offset_;
+  uint64_t ttl_ns_;
+  uint64_t sweep_interval_ms_;
+  bool running_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::thread thread_;
 };
 
 template <class KeyType, class ValueType>
@@ -361,6 +1684,113 @@ class BPFPercpuHashTable
                                                                        value);
   }
 
+  // Sum of one key's value across all possible CPUs, for arithmetic value
+  // types.
+  StatusTuple get_value_sum(const KeyType& key, ValueType& sum) {
+    std::vector<ValueType> vals;
+    TRY2(get_value(key, vals));
+    sum = percpu_reduce_sum(vals.data(), ncpus);
+    return StatusTuple::OK();
+  }
+
+  // Snapshot of the whole table with the per-CPU dimension already summed
+  // away. Entries are fetched in lookup_batch chunks and each key's slots
+  // are reduced directly from the flat syscall buffer, so no per-CPU
+  // vectors are ever materialized.
+  StatusTuple get_table_offline_summed(
+      std::vector<std::pair<KeyType, ValueType>>& res) {
+    const uint32_t chunk_size = 4096;
+    std::vector<KeyType> keys(chunk_size);
+    std::vector<ValueType> values(chunk_size * ncpus);
+    uint32_t batch = 0;
+    uint32_t* in_batch = nullptr;
+
+    res.clear();
+    while (true) {
+      uint32_t count = chunk_size;
+      bool ok = this->lookup_batch(in_batch, &batch, keys.data(),
+                                   values.data(), &count);
+      if (!ok && errno != ENOENT)
+        return StatusTuple(-1, "Error getting tables in batch: %s",
+                           std::strerror(errno));
+      for (uint32_t i = 0; i < count; i++)
+        res.emplace_back(keys[i], percpu_reduce_sum(&values[i * ncpus], ncpus));
+      if (!ok)  // ENOENT: the whole table has been drained
+        break;
+      in_batch = &batch;
+    }
+    return StatusTuple::OK();
+  }
+
+  // Columnar (structure-of-arrays) snapshot of the whole table: one
+  // contiguous key array plus one [keys x cpus] value matrix. Unlike
+  // get_table_offline(), which materializes one heap vector per key,
+  // dumping a large map this way performs zero per-key allocations.
+  struct columnar_snapshot {
+    std::vector<KeyType> keys;
+    // row-major: the slot of key i on cpu c lives at values[i * ncpus + c]
+    std::vector<ValueType> values;
+    unsigned int ncpus = 0;
+
+    size_t size() const { return keys.size(); }
+    const KeyType& key(size_t i) const { return keys[i]; }
+    const ValueType& at(size_t i, unsigned int cpu) const {
+      return values[i * ncpus + cpu];
+    }
+    // contiguous per-CPU slots of key i, for per-key reduction
+    const ValueType* slots(size_t i) const { return &values[i * ncpus]; }
+    ValueType sum(size_t i) const {
+      return percpu_reduce_sum(slots(i), ncpus);
+    }
+
+    // strided view of one CPU's column across all keys, so per-CPU
+    // aggregation needs no copy either
+    struct cpu_column {
+      const ValueType* base;
+      size_t n;
+      unsigned int stride;
+      size_t size() const { return n; }
+      const ValueType& operator[](size_t i) const { return base[i * stride]; }
+    };
+    cpu_column cpu(unsigned int c) const {
+      return {values.data() + c, keys.size(), ncpus};
+    }
+  };
+
+  // Fills a columnar snapshot straight from the lookup_batch syscall
+  // buffer: entries are drained directly into the destination arrays at
+  // the running offset, so the values never pass through an intermediate
+  // chunk buffer. The arrays are sized to the map's capacity up front and
+  // trimmed to the number of entries actually present.
+  StatusTuple get_table_offline_columnar(columnar_snapshot& snap) {
+    snap.ncpus = ncpus;
+    snap.keys.resize(this->capacity());
+    snap.values.resize(this->capacity() * (size_t)ncpus);
+
+    size_t total = 0;
+    uint32_t batch = 0;
+    uint32_t* in_batch = nullptr;
+    while (total < this->capacity()) {
+      uint32_t count = this->capacity() - total;
+      bool ok = this->lookup_batch(in_batch, &batch, &snap.keys[total],
+                                   &snap.values[total * (size_t)ncpus],
+                                   &count);
+      if (!ok && errno != ENOENT) {
+        snap.keys.clear();
+        snap.values.clear();
+        return StatusTuple(-1, "Error getting tables in batch: %s",
+                           std::strerror(errno));
+      }
+      total += count;
+      if (!ok)  // ENOENT: the whole table has been drained
+        break;
+      in_batch = &batch;
+    }
+    snap.keys.resize(total);
+    snap.values.resize(total * (size_t)ncpus);
+    return StatusTuple::OK();
+  }
+
  private:
   unsigned int ncpus;
 };
@@ -371,6 +1801,9 @@ struct stacktrace_t {
   uintptr_t ip[BPF_MAX_STACK_DEPTH];
 };
 
+template <class KeyType>
+class BPFMapInMapTable;
+
 class BPFStackTable : public BPFTableBase<int, stacktrace_t> {
  public:
   BPFStackTable(const TableDesc& desc, bool use_debug_file,
@@ -379,13 +1812,66 @@ class BPFStackTable : public BPFTableBase<int, stacktrace_t> {
   ~BPFStackTable();
 
   void free_symcache(int pid);
+  // Deletes every possible stack id with BPF_MAP_DELETE_BATCH, one syscall
+  // per chunk instead of one per slot; kernels without batch support fall
+  // back to the per-id loop.
   void clear_table_non_atomic();
+  // Pause-free clearing for a profiler that double-buffers its stack maps:
+  // the BPF program reaches its stack map through slot `slot` of an outer
+  // BPF_ARRAY_OF_MAPS, `this` is the map currently wired into that slot and
+  // `spare` is the idle one holding the window before last. Batch-clears the
+  // spare — the program is not writing to it, so sampling continues into
+  // `this` the whole time — then rotates it into the slot with one atomic
+  // map-in-map update: in-flight get_stackid() calls finish on the old map,
+  // new samples land in the fresh one. Afterwards read the finished window
+  // from `this` (now retired and quiescent) and call again next window with
+  // the two handles' roles swapped.
+  StatusTuple clear_and_swap(BPFMapInMapTable<int>& outer, const int& slot,
+                             BPFStackTable& spare);
   std::vector<uintptr_t> get_stack_addr(int stack_id);
   std::vector<std::string> get_stack_symbol(int stack_id, int pid);
 
+  // One sample for fold_stacks(): typically built from a counts-map entry
+  // whose key carries the comm/pid and the stack ids returned by
+  // get_stackid(). A negative stack id contributes no frames; comm may be
+  // null.
+  struct folded_sample {
+    int pid;
+    int kernel_stack_id;
+    int user_stack_id;
+    uint64_t count;
+    const char* comm;
+  };
+
+  // Append one collapsed line per sample to out, in the folded format
+  // flamegraph.pl and speedscope consume: "comm;user...;kernel_[k] count\n"
+  // with frames ordered root to leaf and kernel frames suffixed "_[k]".
+  // Symbolized traces come from the shared LRU, and frames are appended
+  // straight into out, so a continuous exporter re-emitting a mostly-stable
+  // profile allocates almost nothing per pass. Returns the number of lines
+  // emitted; out is not cleared, so one buffer can collect several tables.
+  size_t fold_stacks(const std::vector<folded_sample>& samples,
+                     std::string& out);
+
  private:
+  // symbolize via the LRU and hand back a pointer into it; valid only until
+  // the next cache mutation, so callers copy out what they need first
+  const std::vector<std::string>* symbolize(int stack_id, int pid);
+
+  // LRU cache of fully symbolized traces, keyed by pid plus the raw
+  // addresses rather than the stack id, which the kernel recycles once the
+  // table is cleared. Entries for a pid are dropped when its symcache is
+  // freed.
+  typedef std::pair<int, std::vector<uintptr_t>> TraceKey;
+  typedef std::list<std::pair<TraceKey, std::vector<std::string>>> TraceLru;
+  static const size_t kSymbolLruCapacity = 1024;
+  const std::vector<std::string>* lru_find(const TraceKey& key);
+  void lru_insert(TraceKey key, std::vector<std::string> symbols);
+
   bcc_symbol_option symbol_option_;
   std::map<int, void*> pid_sym_;
+  TraceLru sym_lru_;
+  std::map<TraceKey, TraceLru::iterator> sym_lru_index_;
 };
 
 // from src/cc/export/helpers.h
@@ -399,6 +1885,8 @@ class BPFStackBuildIdTable : public BPFTableBase<int, stacktrace_buildid_t> {
                        bool check_debug_file_crc, void *bsymcache);
   ~BPFStackBuildIdTable() = default;
 
+  // Batched like BPFStackTable::clear_table_non_atomic(), with the same
+  // per-id fallback.
   void clear_table_non_atomic();
   std::vector<bpf_stack_build_id> get_stack_addr(int stack_id);
   std::vector<std::string> get_stack_symbol(int stack_id);
@@ -408,6 +1896,137 @@ class BPFStackBuildIdTable : public BPFTableBase<int, stacktrace_buildid_t> {
   bcc_symbol_option symbol_option_;
 };
 
+// From src/cc/export/helpers.h
+struct raw_stack_event_t {
+  uint32_t pid;
+  int32_t kernel_nr;
+  int32_t user_nr;
+  uint32_t reserved;
+  uint64_t ips[2 * BPF_MAX_STACK_DEPTH];
+};
+
+// Userspace side of BPF_RAW_STACK_OUTPUT: feed every perf-buffer event to
+// add_event(), which validates the record and hash-conses its kernel and
+// user frame arrays into an arena, so each distinct stack is stored once
+// and identified by a stable id — the lossless equivalent of
+// BPFStackTable's stack ids, without the kernel-side collision drops.
+// Ids are dense, never recycled, and symbolize through the same
+// per-pid symcache path as BPFStackTable::get_stack_symbol.
+class BPFRawStackDecoder {
+ public:
+  BPFRawStackDecoder(bool use_debug_file = true,
+                     bool check_debug_file_crc = true);
+  ~BPFRawStackDecoder();
+
+  struct raw_stack_sample {
+    uint32_t pid;
+    int kernel_stack_id;  // -1 when the event carried no kernel frames
+    int user_stack_id;    // -1 when the event carried no user frames
+  };
+  // Decode one event exactly as delivered to the perf-buffer callback;
+  // malformed or truncated records yield both ids -1.
+  raw_stack_sample add_event(const void* data, int size);
+
+  size_t num_stacks() const { return stacks_.size(); }
+  std::vector<uintptr_t> get_stack_addr(int stack_id);
+  // pid < 0 symbolizes against kernel symbols, as with BPFStackTable.
+  std::vector<std::string> get_stack_symbol(int stack_id, int pid);
+  void free_symcache(int pid);
+
+ private:
+  // id of the interned copy of ips[0..nr), adding it on first sight
+  int intern(const uint64_t* ips, uint32_t nr);
+
+  struct stack_span {
+    size_t off;
+    uint32_t len;
+  };
+  // all interned frames back to back; spans index into it, so a
+  // long-running profiler stores each distinct stack once with no
+  // per-stack allocation
+  std::vector<uintptr_t> arena_;
+  std::vector<stack_span> stacks_;
+  std::map<uint64_t, std::vector<int>> hash_index_;
+
+  bcc_symbol_option symbol_option_;
+  std::map<int, void*> pid_sym_;
+};
+
+// Direct PERF_SAMPLE_CALLCHAIN profiling: one sampling perf event per CPU
+// delivers its callchains through perf_reader's callchain batch path — no
+// BPF program and no BPF_STACK_TRACE map, so there is no hash-collision
+// loss and no per-sample map lookup in the fast path. Frames are split at
+// the kernel's PERF_CONTEXT_* markers before delivery, and symbolization
+// goes through shared per-pid symbol caches with batch resolution.
+class BPFCallchainSampler {
+ public:
+  BPFCallchainSampler(bool use_debug_file = true,
+                      bool check_debug_file_crc = true);
+  ~BPFCallchainSampler();
+
+  // One decoded sample, frames leaf-first as perf records them. The ips
+  // pointers alias the ring buffer and are only valid for the duration of
+  // the callback.
+  struct callchain_sample {
+    uint32_t pid;
+    uint32_t tid;
+    const uint64_t* kernel_ips;
+    size_t kernel_nr;
+    const uint64_t* user_ips;
+    size_t user_nr;
+  };
+  typedef void (*sample_batch_cb)(void* cb_cookie,
+                                  const callchain_sample* samples,
+                                  size_t cnt);
+
+  // Opens one sampling event per online CPU at sample_freq Hz: pid -1
+  // profiles the whole system, >= 0 one process and its children.
+  // Callchains are delivered in batches of up to max_batch samples per
+  // callback; max_stack caps the recorded depth.
+  StatusTuple open_all_cpu(uint32_t ev_type, uint64_t ev_config,
+                           uint64_t sample_freq, pid_t pid,
+                           sample_batch_cb cb, void* cb_cookie,
+                           int page_cnt = 8, int max_stack = 127,
+                           int max_batch = 64);
+  StatusTuple close_all_cpu();
+  // Drains the rings that became ready within timeout_ms (as in
+  // epoll_wait); returns the number of rings drained or -1.
+  int poll(int timeout_ms);
+
+  // Symbolizes one frame array in a single symcache batch pass: pid -1
+  // resolves against the kernel cache, anything else against that
+  // process's cache. Unresolvable frames come back as "[UNKNOWN]".
+  void symbolize(const uint64_t* ips, size_t nr, int pid,
+                 std::vector<std::string>& out);
+  void free_symcache(int pid);
+
+ private:
+  static void callchain_trampoline(void* cookie,
+                                   struct perf_reader_callchain_event* events,
+                                   int cnt);
+  void* get_symcache(int pid);
+
+  sample_batch_cb cb_;
+  void* cb_cookie_;
+  std::map<int, perf_reader*> cpu_readers_;
+  std::unique_ptr<epoll_event[]> ep_events_;
+  int epfd_;
+  std::vector<callchain_sample> scratch_;
+  bcc_symbol_option symbol_option_;
+  std::map<int, void*> pid_sym_;
+};
+
+// From src/cc/export/helpers.h: framing of a packed batch record submitted
+// by a BPF_PERF_OUTPUT_COALESCED table. BPFPerfBuffer recognizes the magic
+// on delivery and hands the user callback one record at a time, so callers
+// never see this header.
+struct bpf_perf_coalesce_hdr {
+  uint64_t magic;
+  uint32_t rec_size;
+  uint32_t count;
+};
+static const uint64_t BPF_PERF_COALESCE_MAGIC = 0xbccc0a1e5ced0001ULL;
+
 class BPFPerfBuffer : public BPFTableBase<int, int> {
  public:
   BPFPerfBuffer(const TableDesc& desc);
@@ -417,19 +2036,263 @@ class BPFPerfBuffer : public BPFTableBase<int, int> {
                            void* cb_cookie, int page_cnt);
   StatusTuple open_all_cpu(perf_reader_raw_cb cb, perf_reader_lost_cb lost_cb,
                            void* cb_cookie, int page_cnt, int wakeup_events);
+  // Placement-aware variant for large machines: use_hugetlb maps each
+  // CPU's ring with MAP_HUGETLB where the kernel accepts it (reducing dTLB
+  // pressure with one mapping per CPU), falling back to normal pages
+  // otherwise; numa_bind pins each thread started by
+  // start_consume_threads() to the CPUs whose rings it drains, so remote
+  // rings are not polled cross-NUMA.
+  // wakeup_watermark_bytes, when nonzero, switches the rings from
+  // counting-based wakeups (wakeup_events) to watermark-based ones: the
+  // consumer is only woken once at least that many bytes are pending in a
+  // ring, cutting wakeups by orders of magnitude on busy hosts at the cost
+  // of delivery latency bounded by the watermark. Pair it with a finite
+  // poll() timeout or periodic consume() so a trickle below the watermark
+  // still drains.
+  StatusTuple open_all_cpu(perf_reader_raw_cb cb, perf_reader_lost_cb lost_cb,
+                           void* cb_cookie, int page_cnt, int wakeup_events,
+                           bool use_hugetlb, bool numa_bind,
+                           int wakeup_watermark_bytes = 0);
+  // Open rings only on the given CPUs, for sharded consumers that each own
+  // a subset of the machine (e.g. one process per NUMA node): pinned ring
+  // memory and the polling set cover only those CPUs. perf event delivery
+  // is per-CPU, so a consumer opening CPUs 0-31 sees exactly the events
+  // submitted on those CPUs; perf_submit on a CPU whose ring slot no
+  // process filled fails with ENOENT in the program, which is the steering
+  // signal — shard work to CPUs (sched affinity, IRQ steering, or a
+  // cpu-keyed program filter) rather than expecting cross-CPU delivery.
+  StatusTuple open_on_cpus(const std::vector<int>& cpus,
+                           perf_reader_raw_cb cb, perf_reader_lost_cb lost_cb,
+                           void* cb_cookie, int page_cnt,
+                           int wakeup_events = 1);
+  // Adaptive variant: every ring starts at min_page_cnt and is resized per
+  // CPU based on observed traffic. A ring that reported lost samples since
+  // the last rebalance is reopened at double its page_cnt (up to
+  // max_page_cnt); a ring that stayed completely idle for several rebalance
+  // intervals shrinks back toward min_page_cnt. Rebalancing happens inside
+  // poll()/consume() at most once per second; the brief close/reopen of a
+  // resized ring can itself drop events, which is why only rings already
+  // dropping (or fully idle) are touched. Not compatible with
+  // start_consume_threads().
+  StatusTuple open_all_cpu_adaptive(perf_reader_raw_cb cb,
+                                    perf_reader_lost_cb lost_cb,
+                                    void* cb_cookie, int min_page_cnt,
+                                    int max_page_cnt);
+
+  // Counters of the pipelined mode, all monotonic since open:
+  // spool_full_waits is the number of times the drain stage had to wait for
+  // the decode stage (the kernel ring absorbs the burst meanwhile), and
+  // spool_high_watermark the peak spool fill in bytes.
+  struct PipelineStats {
+    uint64_t spooled_events = 0;
+    uint64_t spooled_bytes = 0;
+    uint64_t delivered_events = 0;
+    uint64_t lost_events = 0;
+    uint64_t spool_full_waits = 0;
+    size_t spool_high_watermark = 0;
+  };
+  // Two-stage pipelined variant: a drain thread copies events out of the
+  // kernel rings into a large userspace spool as fast as memcpy allows, and
+  // a decode thread runs the user callback against the spooled records in
+  // place (no second copy). A slow callback therefore backs up the spool,
+  // not the kernel rings, and kernel-side drops only start once the spool
+  // has been full long enough to fill the rings too. Callbacks run on the
+  // decode thread; do not mix with poll()/consume()/start_consume_threads().
+  StatusTuple open_all_cpu_pipelined(perf_reader_raw_cb cb,
+                                     perf_reader_lost_cb lost_cb,
+                                     void* cb_cookie, int page_cnt,
+                                     size_t spool_bytes = 1 << 24);
+  PipelineStats pipeline_stats();
+
+  // Ordered-delivery variant: every ring is opened with PERF_SAMPLE_TIME so
+  // samples carry the kernel perf-clock timestamp, and poll_ordered() merges
+  // the per-CPU rings into one globally ordered callback stream. Use with
+  // poll_ordered() only.
+  StatusTuple open_all_cpu_ordered(perf_reader_raw_cb cb,
+                                   perf_reader_lost_cb lost_cb,
+                                   void* cb_cookie, int page_cnt);
+  // K-way merge across the per-CPU rings on the kernel-provided sample
+  // timestamps: the oldest pending event is consumed first via a min-heap
+  // over the ring heads, so callbacks fire in global timestamp order with
+  // no user-side sort. Events younger than window_us stay in their rings
+  // until a later poll, bounding how far a CPU whose event is still in
+  // flight can reorder the stream (perf timestamps track CLOCK_MONOTONIC,
+  // which supplies the watermark). Returns the number of events delivered,
+  // or -1 when the buffer was not opened with open_all_cpu_ordered().
+  int poll_ordered(int timeout_ms, int window_us = 1000);
+
+  // Flight-recorder mode for incident capture: each poll()/consume() drains
+  // every CPU's ring as raw bytes straight into capture_dir/cpu<N>.cap --
+  // no per-event decode, no callbacks -- so sustained capture runs at
+  // near-disk bandwidth. Replay the files afterwards through the normal
+  // callback path with replay_capture(). Do not mix with the
+  // callback-driven open variants.
+  StatusTuple open_all_cpu_capture(const std::string& capture_dir,
+                                   int page_cnt);
+  // Offline reader for flight-recorder captures: replays every cpu<N>.cap
+  // under capture_dir (in CPU order) through the given callbacks, including
+  // splitting coalesced batches exactly like live delivery. Returns the
+  // number of samples replayed, or -1 on a missing or corrupt capture.
+  static int64_t replay_capture(const std::string& capture_dir,
+                                perf_reader_raw_cb cb,
+                                perf_reader_lost_cb lost_cb, void* cb_cookie);
+
   StatusTuple close_all_cpu();
   int poll(int timeout_ms);
+  // Self-tuning poll: busy-spins over the mmap'd ring heads with pause
+  // instructions while events keep arriving, so pickup latency during a
+  // burst is bounded by the spin sweep instead of an epoll wakeup, then
+  // exponentially backs off through ever longer epoll sleeps once the
+  // rings stay quiet, so an idle caller does not burn a core.
+  // max_spin_us bounds how long the spin phase lingers after the last
+  // event before backing off; timeout_ms bounds the whole call as in
+  // poll() (negative waits forever). Returns the number of ring drains
+  // performed, or -1 when the buffer is not pollable.
+  int poll_adaptive(int timeout_ms, int max_spin_us = 100);
+  // Counters for poll_adaptive(), monotonic since open: how many drains
+  // were picked up while spinning vs. after falling back to epoll, and
+  // p50/p99 of the latency from readiness detection to callback
+  // completion, from a log2 histogram (reported as the bucket upper
+  // bound). Read them from the polling thread.
+  struct AdaptivePollStats {
+    uint64_t spin_wakeups = 0;
+    uint64_t epoll_wakeups = 0;
+    uint64_t p50_latency_ns = 0;
+    uint64_t p99_latency_ns = 0;
+  };
+  AdaptivePollStats adaptive_poll_stats();
   int consume();
 
+  // Integration point for external event loops: the epoll fd the buffer
+  // polls internally, readable whenever any per-CPU ring has pending
+  // events. Register it (EPOLLIN, or an io_uring poll op) in your own
+  // reactor instead of dedicating a thread to poll(), and call
+  // consume_ready() when it fires. The fd is owned by the buffer — do not
+  // close it — and is -1 before open or after close. Not meaningful in
+  // pipelined mode or while start_consume_threads() workers are running,
+  // which drain on their own.
+  int epoll_fd() const { return epfd_; }
+  // Drain exactly the rings that have pending events, without blocking,
+  // repeating until none are ready so edge-triggered registrations of
+  // epoll_fd() cannot strand data. Returns the number of ring drains
+  // performed, or -1 when the buffer is not pollable.
+  int consume_ready();
+
+  // Opt-in threaded consumption: spawn num_threads workers, each owning a
+  // disjoint subset of the per-CPU readers and draining them from its own
+  // epoll loop. Callbacks fire on worker threads, so they must be
+  // thread-safe; do not mix with poll()/consume() while workers are running.
+  StatusTuple start_consume_threads(int num_threads);
+  StatusTuple stop_consume_threads();
+
  private:
   StatusTuple open_on_cpu(perf_reader_raw_cb cb, perf_reader_lost_cb lost_cb,
                           void* cb_cookie, int page_cnt, struct bcc_perf_buffer_opts& opts);
   StatusTuple close_on_cpu(int cpu);
 
+  void consume_thread_fn(std::vector<perf_reader*> readers,
+                         std::vector<int> cpus);
+
+  // Per-CPU accounting for the adaptive mode. The state object is the
+  // cb_cookie handed to the kernel-facing trampolines, so counters are
+  // updated on the consumption path without any extra lookup.
+  struct AdaptiveCpuState {
+    BPFPerfBuffer* buffer;
+    int cpu;
+    int page_cnt;
+    uint64_t events_since_check = 0;
+    uint64_t lost_since_check = 0;
+    int idle_intervals = 0;
+  };
+  static void adaptive_raw_trampoline(void* cookie, void* data, int size);
+  static void adaptive_lost_trampoline(void* cookie, uint64_t lost);
+  void rebalance();
+  StatusTuple resize_cpu(AdaptiveCpuState& state, int new_page_cnt);
+
+  // Every reader delivers through this trampoline, which splits records
+  // out of BPF_PERF_OUTPUT_COALESCED batches (detected by header magic plus
+  // a size consistency check) and passes everything else through untouched.
+  // The state object carries the next callback in the chain, which for the
+  // adaptive/pipelined modes is their own trampoline.
+  struct UnpackState {
+    perf_reader_raw_cb cb;
+    perf_reader_lost_cb lost_cb;
+    void* cb_cookie;
+  };
+  static void coalesce_unpack_trampoline(void* cookie, void* data, int size);
+  static void coalesce_lost_trampoline(void* cookie, uint64_t lost);
+  std::vector<std::unique_ptr<UnpackState>> unpack_states_;
+
+  // flight-recorder mode: per-CPU capture file fds, closed by
+  // close_all_cpu()
+  std::vector<int> capture_fds_;
+
   std::map<int, perf_reader*> cpu_readers_;
 
   int epfd_;
   std::unique_ptr<epoll_event[]> ep_events_;
+
+  std::vector<std::thread> consume_threads_;
+  std::atomic<bool> consume_running_{false};
+  bool numa_bind_ = false;
+
+  bool ordered_ = false;
+
+  bool adaptive_ = false;
+  int min_page_cnt_ = 0;
+  int max_page_cnt_ = 0;
+  perf_reader_raw_cb user_raw_cb_ = nullptr;
+  perf_reader_lost_cb user_lost_cb_ = nullptr;
+  void* user_cb_cookie_ = nullptr;
+  uint64_t last_rebalance_ns_ = 0;
+  std::map<int, std::unique_ptr<AdaptiveCpuState>> adaptive_state_;
+
+  // pipelined mode: byte ring between the drain and decode stages. Records
+  // are [u32 size][payload]; a wrap marker (or a tail too close to the end
+  // for a header) sends the reader back to offset zero. Only the drain
+  // thread moves head_ and only the decode thread moves tail_, both under
+  // spool_mutex_; a record is delivered in place with the mutex dropped,
+  // which is safe because space accounting keeps the producer out of the
+  // unconsumed region.
+  static void pipeline_raw_trampoline(void* cookie, void* data, int size);
+  static void pipeline_lost_trampoline(void* cookie, uint64_t lost);
+  void spool_push(const void* data, int size);
+  void decode_thread_fn();
+
+  // poll_adaptive accounting: log2-bucketed readiness-to-callback latency
+  // plus the wakeup counters; only touched from the polling thread.
+  void record_dispatch_latency(uint64_t ns);
+  uint64_t latency_hist_[64] = {};
+  AdaptivePollStats apoll_stats_;
+
+  bool pipelined_ = false;
+  std::vector<uint8_t> spool_;
+  size_t spool_head_ = 0;
+  size_t spool_tail_ = 0;
+  size_t spool_used_ = 0;
+  std::mutex spool_mutex_;
+  std::condition_variable spool_cv_;       // signaled when data arrives
+  std::condition_variable spool_space_cv_; // signaled when space frees up
+  std::thread decode_thread_;
+  std::atomic<bool> pipeline_running_{false};
+  PipelineStats pstats_;
+};
+
+// Wraps a BPF_MAP_TYPE_RINGBUF map (kernel v5.8+): a single MPSC ring shared
+// by all CPUs with in-kernel reserve/commit semantics, as a lower-overhead
+// alternative to the per-CPU rings of BPFPerfBuffer.
+class BPFRingBuffer : public BPFTableBase<int, int> {
+ public:
+  BPFRingBuffer(const TableDesc& desc);
+  ~BPFRingBuffer();
+
+  StatusTuple open_ring_buffer(ring_buffer_sample_fn cb, void* cb_cookie);
+  StatusTuple close_ring_buffer();
+  int poll(int timeout_ms);
+  int consume();
+
+ private:
+  struct ring_buffer* rb_;
 };
 
 class BPFPerfEventArray : public BPFTableBase<int, int> {
@@ -438,13 +2301,30 @@ class BPFPerfEventArray : public BPFTableBase<int, int> {
   ~BPFPerfEventArray();
 
   StatusTuple open_all_cpu(uint32_t type, uint64_t config, int pid = -1);
+  // Grouped variant of open_all_cpu: events are created with
+  // PERF_FORMAT_GROUP and, when group_leader is given, joined to the
+  // leader's event on the same CPU. Open the leader array first with
+  // group_leader = nullptr, then each member array with the leader. A
+  // read_group_all_cpus() on the leader then fetches every counter of a
+  // CPU's group with a single read() and a consistent snapshot.
+  StatusTuple open_all_cpu_grouped(uint32_t type, uint64_t config,
+                                   int pid = -1,
+                                   BPFPerfEventArray* group_leader = nullptr);
+  // Read all grouped counters, one read() per CPU on the leader fds.
+  // values[i][j] is the j-th group member's count (in open order, leader
+  // first) on CPU cpus[i]. Only valid on an array opened as a group
+  // leader via open_all_cpu_grouped.
+  StatusTuple read_group_all_cpus(std::vector<std::vector<uint64_t>>& values,
+                                  std::vector<int>& cpus);
   StatusTuple close_all_cpu();
 
  private:
-  StatusTuple open_on_cpu(int cpu, uint32_t type, uint64_t config, int pid = -1);
+  StatusTuple open_on_cpu(int cpu, uint32_t type, uint64_t config, int pid = -1,
+                          int group_fd = -1, bool grouped = false);
   StatusTuple close_on_cpu(int cpu);
 
   std::map<int, int> cpu_fds_;
+  bool group_leader_ = false;
 };
 
 class BPFProgTable : public BPFTableBase<int, int> {
@@ -453,6 +2333,16 @@ class BPFProgTable : public BPFTableBase<int, int> {
 
   StatusTuple update_value(const int& index, const int& prog_fd);
   StatusTuple remove_value(const int& index);
+
+  // Replace the whole tail-call dispatch set (index -> prog fd) in one
+  // kernel pass: occupied slots are rewritten with a single
+  // BPF_MAP_UPDATE_BATCH (per-slot updates on pre-v5.6 kernels), then
+  // slots absent from the new generation are cleared. Each slot swap is
+  // atomic, but a tail call racing the batch can still observe a mix of
+  // the two generations for its duration; for a fully atomic generation
+  // swap route the dispatch through an outer BPF_ARRAY_OF_MAPS and use
+  // BPFMapInMapTable::swap_prog_generation.
+  StatusTuple swap_generation(const std::map<int, int>& programs);
 };
 
 class BPFCgroupArray : public BPFTableBase<int, int> {
@@ -462,15 +2352,63 @@ class BPFCgroupArray : public BPFTableBase<int, int> {
   StatusTuple update_value(const int& index, const int& cgroup2_fd);
   StatusTuple update_value(const int& index, const std::string& cgroup2_path);
   StatusTuple remove_value(const int& index);
+  // Bulk registration: registers cgroup2_paths[i] at index first_index + i.
+  // Opened fds are cached per path and each cgroup directory is watched via
+  // inotify, so a repeated call with unchanged paths does no open() or map
+  // update at all. Errors are accumulated; paths after a failing one are
+  // still processed.
+  StatusTuple update_many(const std::vector<std::string>& cgroup2_paths,
+                          int first_index = 0);
+  // Process cgroup churn since the last call: entries whose directory was
+  // deleted are removed from the array, and re-registered once the path
+  // exists again. O(changed), driven by the queued inotify events. Returns
+  // the number of entries re-registered, or -1 if inotify is unavailable.
+  int refresh();
+
+ private:
+  // one cached registration per path; fd shares the entry's lifetime, wd is
+  // the inotify watch (-1 once the directory went away, making the entry
+  // stale until the path reappears)
+  struct CachedCgroup {
+    FileDesc fd;
+    int index;
+    int wd;
+  };
+  FileDesc inotify_fd_;
+  std::map<std::string, CachedCgroup> cgroup_cache_;
+  std::map<int, std::string> wd_to_path_;
+
+  StatusTuple register_cgroup(const std::string& path, int index);
 };
 
 class BPFDevmapTable : public BPFTableBase<int, int> {
 public:
+  // mirror of struct bpf_redirect_stats in export/helpers.h
+  struct redirect_stats {
+    uint64_t redirects;
+    uint64_t drops;
+  };
+
   BPFDevmapTable(const TableDesc& desc);
+  // with the companion percpu stats array declared by
+  // BPF_DEVMAP_WITH_STATS; BPF::get_devmap_table wires it up when a
+  // <name>_xdp_stats table exists
+  BPFDevmapTable(const TableDesc& desc, const TableDesc& stats_desc);
 
   StatusTuple update_value(const int& index, const int& value);
   StatusTuple get_value(const int& index, int& value);
   StatusTuple remove_value(const int& index);
+
+  // Per-slot redirect/drop counts summed across CPUs, read from the
+  // companion percpu array. res is resized to the devmap capacity; one
+  // lookup per slot, so a scan of a typical devmap is a few hundred
+  // syscalls at most. Fails if the table was declared without
+  // BPF_DEVMAP_WITH_STATS.
+  StatusTuple get_redirect_stats(std::vector<redirect_stats>& res);
+
+private:
+  int stats_fd_ = -1;
+  uint32_t stats_entries_ = 0;
 };
 
 class BPFXskmapTable : public BPFTableBase<int, int> {
@@ -482,6 +2420,127 @@ public:
   StatusTuple remove_value(const int& index);
 };
 
+// One AF_XDP socket bound to a single (interface, queue) pair, with its
+// umem, fill/completion rings and frame pool managed here so an XDP
+// program redirecting into a BPFXskmapTable gives zero-copy RX without
+// bespoke ring code. The umem is carved into fixed-size frames; frames
+// handed out by rx_burst() stay owned by the caller until rx_release()
+// recycles them into the fill ring. open() tries XDP_ZEROCOPY first and
+// falls back to copy mode (zero_copy() reports which one stuck), and
+// binds with XDP_USE_NEED_WAKEUP when available so a sleepy driver is
+// kicked only when the fill ring asks for it.
+class BPFXskSocket {
+ public:
+  // One received frame. data points into the umem and stays valid until
+  // the frame is passed back through rx_release().
+  struct Frame {
+    void* data;
+    uint32_t len;
+    uint64_t addr;  // umem offset, used to recycle the frame
+  };
+
+  // frame_size must be a power of two in [2048, page size]
+  explicit BPFXskSocket(uint32_t frame_size = 2048,
+                        uint32_t num_frames = 4096);
+  BPFXskSocket(const BPFXskSocket&) = delete;
+  BPFXskSocket& operator=(const BPFXskSocket&) = delete;
+  ~BPFXskSocket();
+
+  // Create the socket, register the umem, map the rings, bind to the
+  // given interface queue, insert the socket into xskmap[queue_id] and
+  // pre-populate the fill ring. Ring sizes must be powers of two.
+  StatusTuple open(const std::string& ifname, uint32_t queue_id,
+                   BPFXskmapTable& xskmap, uint32_t rx_ring_size = 2048,
+                   uint32_t fill_ring_size = 2048);
+
+  // Dequeue up to max received frames. The RX ring slots are released
+  // immediately (the kernel cannot reuse a frame until it reappears in
+  // the fill ring), so the returned packet data stays valid until
+  // rx_release(). Returns the number of frames filled in.
+  size_t rx_burst(Frame* frames, size_t max);
+  // Return frames from rx_burst to the pool and top up the fill ring.
+  void rx_release(const Frame* frames, size_t cnt);
+  // Push free frames into the fill ring (batched: one producer publish
+  // per call) after harvesting any completion ring entries back into the
+  // pool. Called from rx_release; exposed for initial priming and for
+  // callers that hold frames long-term. Returns frames enqueued.
+  size_t fill();
+  // True when the driver went to sleep and the fill ring is flagged
+  // NEED_WAKEUP; fill() already checks this and kicks the socket.
+  bool need_wakeup() const;
+
+  int fd() const { return fd_; }
+  bool zero_copy() const { return zero_copy_; }
+  uint32_t frame_size() const { return frame_size_; }
+
+ private:
+  struct Ring {
+    uint32_t* producer = nullptr;
+    uint32_t* consumer = nullptr;
+    uint32_t* flags = nullptr;
+    void* desc = nullptr;
+    uint32_t size = 0;  // entries, power of two
+    void* map = nullptr;
+    size_t map_len = 0;
+  };
+
+  StatusTuple setup_ring(int sockopt, uint64_t pgoff, uint32_t entries,
+                         size_t desc_size, Ring& ring);
+  void kick_rx();
+
+  int fd_ = -1;
+  void* umem_ = nullptr;
+  size_t umem_len_ = 0;
+  uint32_t frame_size_;
+  uint32_t num_frames_;
+  bool zero_copy_ = false;
+  Ring fill_;
+  Ring comp_;
+  Ring rx_;
+  // slab of umem frames not owned by the kernel or the caller
+  std::vector<uint64_t> free_frames_;
+};
+
+// Userspace view of a BPF_ARENA map (see BPF_ARENA in export/helpers.h):
+// the whole arena is mapped shared read-write at construction, so
+// producer/consumer structures laid out in it (counters, freelists, small
+// queues) are plain shared memory with no syscall on either side.
+// Requires kernel v6.9+.
+class BPFArenaTable : public BPFTableBase<int, int> {
+ public:
+  explicit BPFArenaTable(const TableDesc& desc);
+  BPFArenaTable(BPFArenaTable&& that);
+  ~BPFArenaTable();
+
+  // Base address of the mapping; nullptr when mapping the arena failed.
+  void* base() const { return base_; }
+  // Mapped size in bytes (the arena's page count times the page size).
+  size_t size() const { return size_; }
+
+  // Typed pointer at a byte offset into the arena, or nullptr when the
+  // object would not fit. Offsets are stable across processes mapping the
+  // same arena, so they can be exchanged where raw pointers cannot.
+  template <typename T>
+  T* at(size_t byte_offset) const {
+    if (!base_ || byte_offset + sizeof(T) > size_)
+      return nullptr;
+    return reinterpret_cast<T*>(static_cast<char*>(base_) + byte_offset);
+  }
+
+  // Carve bytes out of the arena with a bump allocator (align must be a
+  // power of two; there is no free, see reset_allocator()). The allocator
+  // state lives in this object, not in the arena: use it when userspace
+  // owns the layout, and leave regions allocated kernel-side with
+  // bpf_arena_alloc_pages() alone.
+  StatusTuple alloc(size_t bytes, size_t align, void** out);
+  void reset_allocator() { alloc_offset_ = 0; }
+
+ private:
+  void* base_;
+  size_t size_;
+  size_t alloc_offset_;
+};
+
 template <class KeyType>
 class BPFMapInMapTable : public BPFTableBase<KeyType, int> {
  public:
@@ -502,6 +2561,286 @@ class BPFMapInMapTable : public BPFTableBase<KeyType, int> {
       return StatusTuple(-1, "Error removing value: %s", std::strerror(errno));
     return StatusTuple::OK();
   }
+
+  // Bulk inner-map provisioning: creates one inner map per entry of `keys`
+  // from `spec` across a small worker team (map creation is syscall-bound,
+  // so a handful of threads hide most of the serialized latency), then
+  // inserts the fds with a single BPF_MAP_UPDATE_BATCH when the kernel
+  // supports it, falling back to per-key updates. On success the created
+  // fds are returned through `created_fds` if non-null, otherwise closed —
+  // the outer map keeps the inner maps alive either way. On failure every
+  // map created by this call is closed and no keys are left inserted.
+  StatusTuple create_inner_maps(const std::vector<KeyType>& keys,
+                                const bcc_create_map_attr& spec,
+                                std::vector<int>* created_fds = nullptr) {
+    size_t n = keys.size();
+    std::vector<int> fds(n, -1);
+    size_t nthreads =
+        std::min<size_t>({n, std::thread::hardware_concurrency(), 8});
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < nthreads; t++)
+      workers.emplace_back([&] { create_worker(spec, fds, next, failed); });
+    create_worker(spec, fds, next, failed);
+    for (auto& w : workers)
+      w.join();
+
+    StatusTuple res = StatusTuple::OK();
+    if (failed)
+      res = StatusTuple(-1, "Error creating inner map: %s",
+                        std::strerror(errno));
+    uint32_t count = static_cast<uint32_t>(n);
+    if (res.ok() && n > 0 &&
+        !this->update_batch(const_cast<KeyType*>(keys.data()), fds.data(),
+                            &count)) {
+      // batch support is kernel-dependent; retry one at a time before
+      // giving up
+      size_t i = 0;
+      for (; i < n; i++)
+        if (!this->update(const_cast<KeyType*>(&keys[i]), &fds[i]))
+          break;
+      if (i < n) {
+        res = StatusTuple(-1, "Error inserting inner map fd: %s",
+                          std::strerror(errno));
+        for (size_t j = 0; j < i; j++)
+          this->remove(const_cast<KeyType*>(&keys[j]));
+      }
+    }
+    if (res.ok() && created_fds) {
+      *created_fds = std::move(fds);
+      return res;
+    }
+    for (int fd : fds)
+      if (fd >= 0)
+        ::close(fd);
+    return res;
+  }
+
+  // Transactional tail-call generation swap: builds a shadow
+  // BPF_MAP_TYPE_PROG_ARRAY with `max_entries` slots, populates it from
+  // `programs` (index -> prog fd) while no program can see it, then swaps
+  // it into the outer slot `key` with one atomic map-in-map update. A
+  // dispatch program that tail-calls through the inner map it looks up at
+  // `key` therefore only ever runs a complete generation: in-flight
+  // executions finish on the old set, new ones see only the new set. The
+  // replaced inner map is released by the kernel once the last in-flight
+  // user drops it.
+  StatusTuple swap_prog_generation(const KeyType& key,
+                                   const std::map<int, int>& programs,
+                                   int max_entries) {
+    struct bcc_create_map_attr attr = {};
+    attr.map_type = BPF_MAP_TYPE_PROG_ARRAY;
+    attr.name = "swap_gen";
+    attr.key_size = sizeof(int);
+    attr.value_size = sizeof(int);
+    attr.max_entries = max_entries;
+    int shadow_fd = bcc_create_map_xattr(&attr, true);
+    if (shadow_fd < 0)
+      return StatusTuple(-1, "Error creating shadow prog array: %s",
+                         std::strerror(errno));
+
+    for (auto& it : programs) {
+      if (it.first < 0 || it.first >= max_entries) {
+        ::close(shadow_fd);
+        return StatusTuple(-1, "Slot %d out of range", it.first);
+      }
+      if (bpf_update_elem(shadow_fd, const_cast<int*>(&it.first),
+                          const_cast<int*>(&it.second), 0) < 0) {
+        int err = errno;
+        ::close(shadow_fd);
+        return StatusTuple(-1, "Error populating shadow slot %d: %s",
+                           it.first, std::strerror(err));
+      }
+    }
+
+    StatusTuple res = update_value(key, shadow_fd);
+    // the outer map holds its own reference once inserted
+    ::close(shadow_fd);
+    return res;
+  }
+
+  // Online resize of the inner map wired into outer slot `key`: creates a
+  // map with the same type, key/value size and flags but `new_max_entries`
+  // slots, migrates the contents with batched lookup/update while the old
+  // map stays live, then repoints the slot with one atomic map-in-map
+  // update — so a table can be created small (saving prealloc memory) and
+  // grown under load without restarting the tool or losing state.
+  //
+  // Two full copy passes run before the swap (the second re-reads values
+  // mutated during the first, shrinking the inconsistency window) and one
+  // reconcile pass runs after it, inserting with BPF_NOEXIST so keys that
+  // raced into the old map are preserved without clobbering anything
+  // written to the new map since the swap. In-place value updates landing
+  // in the old map between its last read and the swap can still be lost;
+  // callers needing exactness must quiesce writers around the call.
+  //
+  // Supports hash, LRU hash and array inner maps. Inner maps with a
+  // max_entries differing from the outer map's template need kernel 5.10+,
+  // and array inner maps additionally need BPF_F_INNER_MAP set at creation
+  // (inherited here via the old map's flags). On success the old inner map
+  // is released once its last in-flight user drops it; the new map's fd is
+  // returned through `new_fd_out` if non-null, otherwise closed — the
+  // outer map keeps it alive either way.
+  StatusTuple resize_inner_map(const KeyType& key, uint32_t new_max_entries,
+                               int* new_fd_out = nullptr) {
+    int id = 0;
+    if (!this->lookup(const_cast<KeyType*>(&key), &id))
+      return StatusTuple(-1, "Error looking up inner map: %s",
+                         std::strerror(errno));
+    int old_fd = bpf_map_get_fd_by_id(id);
+    if (old_fd < 0)
+      return StatusTuple(-1, "Error opening inner map id %d: %s", id,
+                         std::strerror(errno));
+
+    struct bpf_map_info info = {};
+    uint32_t info_len = sizeof(info);
+    if (bpf_obj_get_info(old_fd, &info, &info_len) != 0) {
+      int err = errno;
+      ::close(old_fd);
+      return StatusTuple(-1, "Error querying inner map: %s",
+                         std::strerror(err));
+    }
+    if (info.type != BPF_MAP_TYPE_HASH &&
+        info.type != BPF_MAP_TYPE_LRU_HASH &&
+        info.type != BPF_MAP_TYPE_ARRAY) {
+      ::close(old_fd);
+      return StatusTuple(-1, "Map type %u not supported for resize",
+                         info.type);
+    }
+
+    struct bcc_create_map_attr attr = {};
+    attr.map_type = (enum bpf_map_type)info.type;
+    attr.name = info.name;
+    attr.key_size = info.key_size;
+    attr.value_size = info.value_size;
+    attr.max_entries = new_max_entries;
+    attr.map_flags = info.map_flags;
+    int new_fd = bcc_create_map_xattr(&attr, true);
+    if (new_fd < 0) {
+      int err = errno;
+      ::close(old_fd);
+      return StatusTuple(-1, "Error creating resized map: %s",
+                         std::strerror(err));
+    }
+
+    auto fail = [&](StatusTuple res) {
+      ::close(old_fd);
+      ::close(new_fd);
+      return res;
+    };
+
+    // pre-swap passes: writers still land in the old map
+    for (int pass = 0; pass < 2; pass++) {
+      StatusTuple res =
+          copy_all_entries(old_fd, new_fd, info.key_size, info.value_size, 0);
+      if (!res.ok())
+        return fail(res);
+    }
+
+    // atomic repoint: in-flight lookups finish on the old map, new ones
+    // see only the new one
+    if (!this->update(const_cast<KeyType*>(&key), &new_fd))
+      return fail(StatusTuple(-1, "Error swapping inner map: %s",
+                              std::strerror(errno)));
+
+    // reconcile keys that raced into the old map before the swap; never
+    // overwrites post-swap writes to the new map
+    StatusTuple res = copy_all_entries(old_fd, new_fd, info.key_size,
+                                       info.value_size, BPF_NOEXIST);
+    ::close(old_fd);
+    if (res.ok() && new_fd_out) {
+      *new_fd_out = new_fd;
+      return res;
+    }
+    ::close(new_fd);
+    return res;
+  }
+
+  // Lazy provisioning for first use: if `key` already holds an inner map
+  // its stored value (the kernel reports the inner map id here, not an fd)
+  // is returned; otherwise a new inner map is created from `spec`,
+  // inserted, and its fd returned. The caller owns the returned fd only in
+  // the newly-created case.
+  StatusTuple ensure_inner_map(const KeyType& key,
+                               const bcc_create_map_attr& spec, int& value,
+                               bool* created = nullptr) {
+    if (this->lookup(const_cast<KeyType*>(&key), &value)) {
+      if (created)
+        *created = false;
+      return StatusTuple::OK();
+    }
+    int fd = bcc_create_map_xattr(
+        const_cast<struct bcc_create_map_attr*>(&spec), true);
+    if (fd < 0)
+      return StatusTuple(-1, "Error creating inner map: %s",
+                         std::strerror(errno));
+    if (!this->update(const_cast<KeyType*>(&key), &fd)) {
+      int err = errno;
+      ::close(fd);
+      return StatusTuple(-1, "Error inserting inner map fd: %s",
+                         std::strerror(err));
+    }
+    value = fd;
+    if (created)
+      *created = true;
+    return StatusTuple::OK();
+  }
+
+ private:
+  // One migration pass for resize_inner_map(): streams src in lookup_batch
+  // chunks into dst. elem_flags 0 copies via BPF_MAP_UPDATE_BATCH (with a
+  // per-element fallback for kernels without batch update); BPF_NOEXIST
+  // copies per element, skipping keys dst already holds.
+  StatusTuple copy_all_entries(int src_fd, int dst_fd, uint32_t key_size,
+                               uint32_t value_size, uint64_t elem_flags) {
+    const uint32_t chunk = 4096;
+    std::vector<char> keys((size_t)chunk * key_size);
+    std::vector<char> values((size_t)chunk * value_size);
+    uint32_t batch = 0;
+    uint32_t* in_batch = nullptr;
+    while (true) {
+      uint32_t count = chunk;
+      int rc = bpf_lookup_batch(src_fd, in_batch, &batch, keys.data(),
+                                values.data(), &count);
+      if (rc < 0 && errno != ENOENT)
+        return StatusTuple(-1, "Error reading entries in batch: %s",
+                           std::strerror(errno));
+      uint32_t ucount = count;
+      if (count > 0 &&
+          (elem_flags != 0 ||
+           bpf_update_batch(dst_fd, keys.data(), values.data(), &ucount) <
+               0)) {
+        for (uint32_t i = 0; i < count; i++) {
+          if (bpf_update_elem(dst_fd, &keys[(size_t)i * key_size],
+                              &values[(size_t)i * value_size],
+                              elem_flags) < 0 &&
+              !(elem_flags == BPF_NOEXIST && errno == EEXIST))
+            return StatusTuple(-1, "Error writing migrated entry: %s",
+                               std::strerror(errno));
+        }
+      }
+      if (rc < 0)  // ENOENT: the whole map has been drained
+        break;
+      in_batch = &batch;
+    }
+    return StatusTuple::OK();
+  }
+
+  void create_worker(const bcc_create_map_attr& spec, std::vector<int>& fds,
+                     std::atomic<size_t>& next, std::atomic<bool>& failed) {
+    for (size_t idx = next++; idx < fds.size(); idx = next++) {
+      if (failed)
+        return;
+      int fd = bcc_create_map_xattr(
+          const_cast<struct bcc_create_map_attr*>(&spec), true);
+      if (fd < 0) {
+        failed = true;
+        return;
+      }
+      fds[idx] = fd;
+    }
+  }
 };
 
 class BPFSockmapTable : public BPFTableBase<int, int> {
@@ -510,6 +2849,21 @@ public:
 
   StatusTuple update_value(const int& index, const int& value);
   StatusTuple remove_value(const int& index);
+
+  // Register count sockets with one BPF_MAP_UPDATE_BATCH syscall (per-fd
+  // updates on kernels without batch support), instead of one syscall per
+  // connection. updated reports how many entries went in; on error it names
+  // the first index that failed.
+  StatusTuple update_many(const int* keys, const int* sock_fds, size_t count,
+                          size_t* updated);
+  // Pipelined variant for failover-time registration storms: fds are
+  // checked to still be live sockets one chunk ahead of the inserter, so a
+  // connection that died since the list was built costs a skip instead of
+  // failing the batch. Indices of skipped fds are appended to skipped when
+  // non-null.
+  StatusTuple update_many_pipelined(const int* keys, const int* sock_fds,
+                                    size_t count,
+                                    std::vector<size_t>* skipped = nullptr);
 };
 
 class BPFSockhashTable : public BPFTableBase<int, int> {
@@ -518,8 +2872,24 @@ public:
 
   StatusTuple update_value(const int& key, const int& value);
   StatusTuple remove_value(const int& key);
+
+  // batched insertion; see BPFSockmapTable::update_many
+  StatusTuple update_many(const int* keys, const int* sock_fds, size_t count,
+                          size_t* updated);
+  StatusTuple update_many_pipelined(const int* keys, const int* sock_fds,
+                                    size_t count,
+                                    std::vector<size_t>* skipped = nullptr);
 };
 
+// Attaches a user-loaded BPF iterator program to the given storage map,
+// creates the iterator and drains it, collecting the fixed-size records the
+// program emitted through bpf_seq_write() into raw. Returns an error if the
+// stream ends in a partial record. Used by the storage tables' bulk
+// get_all_values() below.
+StatusTuple harvest_storage_records(int iter_prog_fd, int map_fd,
+                                    size_t record_size,
+                                    std::vector<uint8_t>& raw);
+
 template <class ValueType>
 class BPFSkStorageTable : public BPFTableBase<int, ValueType> {
  public:
@@ -547,6 +2917,29 @@ class BPFSkStorageTable : public BPFTableBase<int, ValueType> {
       return StatusTuple(-1, "Error removing value: %s", std::strerror(errno));
     return StatusTuple::OK();
   }
+
+  // Harvests the storage of every socket in one iterator pass instead of a
+  // lookup syscall per socket. iter_prog_fd is a loaded bpf_sk_storage_map
+  // iterator program (see examples/cpp/SkLocalStorageIterator.cc) that
+  // bpf_seq_write()s records laid out as { int key; ValueType value; },
+  // where key is a caller-chosen socket identifier.
+  virtual StatusTuple get_all_values(
+      int iter_prog_fd, std::vector<std::pair<int, ValueType>>& values) {
+    struct Record {
+      int key;
+      ValueType value;
+    };
+    std::vector<uint8_t> raw;
+    TRY2(harvest_storage_records(iter_prog_fd, this->desc.fd, sizeof(Record),
+                                 raw));
+    const Record* records = reinterpret_cast<const Record*>(raw.data());
+    size_t count = raw.size() / sizeof(Record);
+    values.clear();
+    values.reserve(count);
+    for (size_t i = 0; i < count; i++)
+      values.emplace_back(records[i].key, records[i].value);
+    return StatusTuple::OK();
+  }
 };
 
 template <class ValueType>
@@ -605,6 +2998,29 @@ class BPFTaskStorageTable : public BPFTableBase<int, ValueType> {
       return StatusTuple(-1, "Error removing value: %s", std::strerror(errno));
     return StatusTuple::OK();
   }
+
+  // Harvests the storage of every task in one iterator pass instead of a
+  // pidfd_open/lookup/close triple per task. iter_prog_fd is a loaded task
+  // iterator program (see examples/cpp/TaskIterator.cc) that calls
+  // bpf_task_storage_get() on this map and bpf_seq_write()s records laid
+  // out as { int pid; ValueType value; }, skipping tasks with no storage.
+  virtual StatusTuple get_all_values(
+      int iter_prog_fd, std::vector<std::pair<int, ValueType>>& values) {
+    struct Record {
+      int pid;
+      ValueType value;
+    };
+    std::vector<uint8_t> raw;
+    TRY2(harvest_storage_records(iter_prog_fd, this->desc.fd, sizeof(Record),
+                                 raw));
+    const Record* records = reinterpret_cast<const Record*>(raw.data());
+    size_t count = raw.size() / sizeof(Record);
+    values.clear();
+    values.reserve(count);
+    for (size_t i = 0; i < count; i++)
+      values.emplace_back(records[i].pid, records[i].value);
+    return StatusTuple::OK();
+  }
 };
 
 template <class ValueType>
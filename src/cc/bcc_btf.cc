@@ -15,11 +15,14 @@
  */
 
 #include "bcc_btf.h"
+#include <fcntl.h>
 #include <stdarg.h>
 #include <string.h>
 #include "linux/btf.h"
 #include "libbpf.h"
 #include "bcc_libbpf_inc.h"
+#include <mutex>
+#include <utility>
 #include <vector>
 #include <byteswap.h>
 
@@ -575,6 +578,24 @@ void BTF::adjust(uint8_t *btf_sec, uintptr_t btf_sec_size,
   }
 }
 
+// Process-wide cache of uploaded BTF blobs, keyed by content hash and size:
+// modules compiled from near-identical sources produce byte-identical
+// blobs, and re-uploading several MB of kernel types per module costs both
+// syscalls and kernel memory. On a hit the cached fd is duped, so every
+// module shares one kernel BTF object; the cache keeps its own dup alive
+// for the process lifetime.
+static std::mutex btf_fd_cache_mutex;
+static std::map<std::pair<uint64_t, uintptr_t>, int> btf_fd_cache;
+
+static uint64_t btf_blob_hash(const uint8_t *data, uintptr_t size) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (uintptr_t i = 0; i < size; i++) {
+    h ^= data[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
 int BTF::load(uint8_t *btf_sec, uintptr_t btf_sec_size,
               uint8_t *btf_ext_sec, uintptr_t btf_ext_sec_size,
               std::map<std::string, std::string> &remapped_sources) {
@@ -586,21 +607,43 @@ int BTF::load(uint8_t *btf_sec, uintptr_t btf_sec_size,
   adjust(btf_sec, btf_sec_size, btf_ext_sec, btf_ext_sec_size,
          remapped_sources, &new_btf_sec, &new_btf_sec_size);
 
-  if (new_btf_sec) {
-    btf = btf__new(new_btf_sec, new_btf_sec_size);
+  const uint8_t *blob = new_btf_sec ? new_btf_sec : btf_sec;
+  uintptr_t blob_size = new_btf_sec ? new_btf_sec_size : btf_sec_size;
+  auto cache_key = std::make_pair(btf_blob_hash(blob, blob_size), blob_size);
+
+  btf = btf__new(blob, blob_size);
+  if (new_btf_sec)
     delete[] new_btf_sec;
-  } else {
-    btf = btf__new(btf_sec, btf_sec_size);
-  }
   if (BCC_IS_ERR(btf)) {
     warning("Processing .BTF section failed\n");
     return -1;
   }
 
-  if (btf__load_into_kernel(btf)) {
-    btf__free(btf);
-    warning("Loading .BTF section failed\n");
-    return -1;
+  bool uploaded = false;
+  {
+    std::lock_guard<std::mutex> lock(btf_fd_cache_mutex);
+    auto it = btf_fd_cache.find(cache_key);
+    if (it != btf_fd_cache.end()) {
+      int fd = fcntl(it->second, F_DUPFD_CLOEXEC, 3);
+      if (fd >= 0) {
+        btf__set_fd(btf, fd);
+        uploaded = true;
+      }
+    }
+  }
+
+  if (!uploaded) {
+    if (btf__load_into_kernel(btf)) {
+      btf__free(btf);
+      warning("Loading .BTF section failed\n");
+      return -1;
+    }
+    std::lock_guard<std::mutex> lock(btf_fd_cache_mutex);
+    if (btf_fd_cache.find(cache_key) == btf_fd_cache.end()) {
+      int fd = fcntl(btf__fd(btf), F_DUPFD_CLOEXEC, 3);
+      if (fd >= 0)
+        btf_fd_cache[cache_key] = fd;
+    }
   }
 
   btf_ext = btf_ext_vendored::btf_ext__new(btf_ext_sec, btf_ext_sec_size);
@@ -695,4 +738,200 @@ int BTF::get_map_tids(std::string map_name,
   return 0;
 }
 
+int EventDecoder::field_index(const std::string &name) const {
+  for (size_t i = 0; i < fields_.size(); i++)
+    if (fields_[i].name == name)
+      return (int)i;
+  return -1;
+}
+
+bool EventDecoder::get_unsigned(const void *data, size_t size, size_t id,
+                                uint64_t *value) const {
+  if (id >= fields_.size())
+    return false;
+  const Field &f = fields_[id];
+  if (f.kind != UNSIGNED || f.size > sizeof(*value) ||
+      (size_t)f.offset + f.size > size)
+    return false;
+  *value = 0;
+  memcpy(value, (const uint8_t *)data + f.offset, f.size);
+  return true;
+}
+
+bool EventDecoder::get_signed(const void *data, size_t size, size_t id,
+                              int64_t *value) const {
+  if (id >= fields_.size())
+    return false;
+  const Field &f = fields_[id];
+  if (f.kind != SIGNED || f.size > sizeof(*value) ||
+      (size_t)f.offset + f.size > size)
+    return false;
+  uint64_t raw = 0;
+  memcpy(&raw, (const uint8_t *)data + f.offset, f.size);
+  // sign-extend from the field's width
+  if (f.size < sizeof(raw) && (raw & (1ULL << (f.size * 8 - 1))))
+    raw |= ~0ULL << (f.size * 8);
+  *value = (int64_t)raw;
+  return true;
+}
+
+bool EventDecoder::get_string(const void *data, size_t size, size_t id,
+                              std::string &value) const {
+  if (id >= fields_.size())
+    return false;
+  const Field &f = fields_[id];
+  if (f.kind != CHAR_ARRAY || (size_t)f.offset + f.size > size)
+    return false;
+  const char *p = (const char *)data + f.offset;
+  value.assign(p, strnlen(p, f.size));
+  return true;
+}
+
+bool EventDecoder::get_bytes(const void *data, size_t size, size_t id,
+                             const void **bytes, size_t *len) const {
+  if (id >= fields_.size())
+    return false;
+  const Field &f = fields_[id];
+  if ((size_t)f.offset + f.size > size)
+    return false;
+  *bytes = (const uint8_t *)data + f.offset;
+  *len = f.size;
+  return true;
+}
+
+// Append the members of struct type t to the decoder's field table, nested
+// structs flattened depth-first with dotted names so the table is a single
+// linear array at decode time.
+static int flatten_struct_members(struct btf *btf, const struct btf_type *t,
+                                  const std::string &prefix,
+                                  uint32_t base_offset, EventDecoder &decoder,
+                                  std::string &error) {
+  const struct btf_member *m = btf_members(t);
+  for (uint16_t i = 0; i < btf_vlen(t); i++, m++) {
+    if (btf_member_bitfield_size(t, i))
+      continue;  // documented: bitfields are not decodable by plain copy
+
+    const char *mname = btf__name_by_offset(btf, m->name_off);
+    std::string name =
+        prefix.empty() ? (mname ? mname : "") : prefix + "." + (mname ? mname : "");
+    uint32_t offset = base_offset + btf_member_bit_offset(t, i) / 8;
+
+    int mtid = btf__resolve_type(btf, m->type);
+    if (mtid < 0) {
+      error = "cannot resolve type of field " + name;
+      return -1;
+    }
+    const struct btf_type *mt = btf__type_by_id(btf, mtid);
+    int64_t msize = btf__resolve_size(btf, mtid);
+    if (!mt || msize < 0) {
+      error = "cannot resolve size of field " + name;
+      return -1;
+    }
+
+    if (btf_is_struct(mt)) {
+      // anonymous struct members keep the parent's prefix
+      if (flatten_struct_members(btf, mt, (mname && *mname) ? name : prefix,
+                                 offset, decoder, error))
+        return -1;
+      continue;
+    }
+
+    EventDecoder::FieldKind kind = EventDecoder::BYTES;
+    if (btf_is_int(mt)) {
+      uint8_t enc = btf_int_encoding(mt);
+      if (enc & BTF_INT_SIGNED)
+        kind = EventDecoder::SIGNED;
+      else
+        kind = EventDecoder::UNSIGNED;
+    } else if (btf_is_enum(mt)) {
+      kind = EventDecoder::SIGNED;
+    } else if (btf_is_ptr(mt)) {
+      kind = EventDecoder::UNSIGNED;
+    } else if (btf_is_array(mt)) {
+      const struct btf_array *a = btf_array(mt);
+      int etid = btf__resolve_type(btf, a->type);
+      const struct btf_type *et = etid >= 0 ? btf__type_by_id(btf, etid) : nullptr;
+      // any 1-byte integer element counts as char: compilers disagree on
+      // whether plain char carries the CHAR or SIGNED encoding
+      if (et && btf_is_int(et) && btf__resolve_size(btf, etid) == 1)
+        kind = EventDecoder::CHAR_ARRAY;
+    }
+
+    decoder.fields_.push_back(
+        {std::move(name), offset, (uint32_t)msize, kind});
+  }
+  return 0;
+}
+
+int build_event_decoder(struct btf *btf, const std::string &type_name,
+                        EventDecoder &decoder, std::string &error) {
+  int type_id = btf__find_by_name_kind(btf, type_name.c_str(), BTF_KIND_STRUCT);
+  if (type_id < 0) {
+    error = "struct " + type_name + " not found in module BTF";
+    return -1;
+  }
+  const struct btf_type *t = btf__type_by_id(btf, type_id);
+  int64_t size = btf__resolve_size(btf, type_id);
+  if (!t || size < 0) {
+    error = "cannot resolve size of struct " + type_name;
+    return -1;
+  }
+
+  decoder.fields_.clear();
+  decoder.struct_size_ = (size_t)size;
+  return flatten_struct_members(btf, t, "", 0, decoder, error);
+}
+
+int verify_kernel_field_offsets(const field_accesses_def &accesses,
+                                std::string &error) {
+  if (accesses.empty())
+    return 0;
+
+  struct btf *vmlinux = bcc_vmlinux_btf_get();
+  if (!vmlinux)
+    return 0;  // no kernel BTF: nothing to check against
+
+  int rc = 0;
+  for (const auto &access : accesses) {
+    // the recorded parent is always the named struct (or union) the field
+    // was declared in, so a flat walk of its direct members is sufficient
+    int type_id = btf__find_by_name_kind(vmlinux, access.struct_name.c_str(),
+                                         BTF_KIND_STRUCT);
+    if (type_id < 0)
+      type_id = btf__find_by_name_kind(vmlinux, access.struct_name.c_str(),
+                                       BTF_KIND_UNION);
+    if (type_id < 0)
+      continue;  // program-local type, invisible to kernel BTF
+
+    const struct btf_type *t = btf__type_by_id(vmlinux, type_id);
+    const struct btf_member *m = btf_members(t);
+    bool found = false;
+    for (uint16_t i = 0; i < btf_vlen(t); i++, m++) {
+      const char *name = btf__name_by_offset(vmlinux, m->name_off);
+      if (!name || access.field_name != name)
+        continue;
+      found = true;
+      uint32_t bit_offset = btf_member_bit_offset(t, i);
+      if (bit_offset != access.bit_offset) {
+        error = "field " + access.struct_name + "." + access.field_name +
+                " compiled at bit offset " + std::to_string(access.bit_offset) +
+                " but the running kernel has it at " +
+                std::to_string(bit_offset);
+        rc = -1;
+      }
+      break;
+    }
+    if (!found) {
+      error = "field " + access.struct_name + "." + access.field_name +
+              " does not exist in the running kernel";
+      rc = -1;
+    }
+    if (rc)
+      break;
+  }
+
+  bcc_vmlinux_btf_put(vmlinux);
+  return rc;
+}
+
 } // namespace ebpf
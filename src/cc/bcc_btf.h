@@ -133,6 +133,8 @@ class BTF {
            uint8_t *btf_ext_sec, uintptr_t btf_ext_sec_size,
            std::map<std::string, std::string> &remapped_sources);
   int get_fd();
+  // underlying in-memory BTF, for callers resolving type layout directly
+  struct btf *get_btf() const { return btf_; }
   int get_btf_info(const char *fname,
                    void **func_info, unsigned *func_info_cnt,
                    unsigned *finfo_rec_size,
@@ -157,6 +159,66 @@ class BTF {
   sec_map_def &sections_;
 };
 
+// Flattened field table of one event struct, precomputed from the module's
+// BTF when the decoder is built so that per-event decoding is a handful of
+// bounds-checked memcpys with no BTF walking or per-field type dispatch.
+// Obtain through BPF::event_decoder(); resolve field indices once with
+// field_index() and decode events by index.
+class EventDecoder {
+ public:
+  enum FieldKind {
+    SIGNED,      // signed integer or enum, widened to int64_t
+    UNSIGNED,    // unsigned integer, bool or pointer, widened to uint64_t
+    CHAR_ARRAY,  // fixed-size char array, extracted up to the first NUL
+    BYTES,       // anything else (unions, non-char arrays), raw bytes
+  };
+  struct Field {
+    std::string name;  // members of nested structs flattened as "outer.inner"
+    uint32_t offset;
+    uint32_t size;
+    FieldKind kind;
+  };
+
+  size_t struct_size() const { return struct_size_; }
+  size_t num_fields() const { return fields_.size(); }
+  const Field &field(size_t id) const { return fields_[id]; }
+  // id of the named field, or -1 if the struct has no such member
+  int field_index(const std::string &name) const;
+  // Extractors return false when id is out of range, the field is not of
+  // the requested kind, or the event is shorter than the field's extent
+  // (events may legitimately be truncated by perf_submit with a short size).
+  bool get_unsigned(const void *data, size_t size, size_t id,
+                    uint64_t *value) const;
+  bool get_signed(const void *data, size_t size, size_t id,
+                  int64_t *value) const;
+  bool get_string(const void *data, size_t size, size_t id,
+                  std::string &value) const;
+  bool get_bytes(const void *data, size_t size, size_t id, const void **bytes,
+                 size_t *len) const;
+
+ private:
+  friend int build_event_decoder(struct btf *btf, const std::string &type_name,
+                                 EventDecoder &decoder, std::string &error);
+  std::vector<Field> fields_;
+  size_t struct_size_ = 0;
+};
+
+// Fill decoder with the flattened member table of struct type_name, looked
+// up in btf. Bitfield members are omitted (their extraction cannot be a
+// plain copy); everything else gets an entry. Returns 0 on success, -1 with
+// a description in error otherwise.
+int build_event_decoder(struct btf *btf, const std::string &type_name,
+                        EventDecoder &decoder, std::string &error);
+
+// Check the struct field offsets recorded at compile time against the
+// running kernel's BTF. Returns 0 when every named field still sits at its
+// recorded offset — or when kernel BTF is unavailable, in which case nothing
+// can be checked — and -1 on the first mismatch, with a description in
+// error. Used to validate AOT artifacts loaded on a kernel other than the
+// one they were compiled against.
+int verify_kernel_field_offsets(const field_accesses_def &accesses,
+                                std::string &error);
+
 } // namespace ebpf
 
 #endif
@@ -13,8 +13,11 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <errno.h>
+
 #include "bcc_common.h"
 #include "bpf_module.h"
+#include "libbpf.h"
 
 extern "C" {
 void * bpf_module_create_c(const char *filename, unsigned flags, const char *cflags[],
@@ -232,6 +235,117 @@ int bpf_table_leaf_sscanf(void *program, size_t id, const char *buf, void *leaf)
   return mod->table_leaf_scanf(id, buf, leaf);
 }
 
+int bpf_table_key_snprintf_batch(void *program, size_t id, char *buf,
+                                 size_t buf_stride, const void *keys,
+                                 size_t n) {
+  auto mod = static_cast<ebpf::BPFModule *>(program);
+  if (!mod) return -1;
+  return mod->table_key_printf_batch(id, buf, buf_stride, keys, n);
+}
+
+int bpf_table_leaf_snprintf_batch(void *program, size_t id, char *buf,
+                                  size_t buf_stride, const void *leaves,
+                                  size_t n) {
+  auto mod = static_cast<ebpf::BPFModule *>(program);
+  if (!mod) return -1;
+  return mod->table_leaf_printf_batch(id, buf, buf_stride, leaves, n);
+}
+
+int bpf_table_key_sscanf_batch(void *program, size_t id,
+                               const char *const *bufs, void *keys,
+                               size_t n) {
+  auto mod = static_cast<ebpf::BPFModule *>(program);
+  if (!mod) return -1;
+  return mod->table_key_scanf_batch(id, bufs, keys, n);
+}
+
+int bpf_table_leaf_sscanf_batch(void *program, size_t id,
+                                const char *const *bufs, void *leaves,
+                                size_t n) {
+  auto mod = static_cast<ebpf::BPFModule *>(program);
+  if (!mod) return -1;
+  return mod->table_leaf_scanf_batch(id, bufs, leaves, n);
+}
+
+int bpf_table_lookup_batch(void *program, size_t id, void *keys, void *leaves,
+                           unsigned int *count) {
+  auto mod = static_cast<ebpf::BPFModule *>(program);
+  if (!mod || !count) return -1;
+  int fd = mod->table_fd(id);
+  size_t key_size = mod->table_key_size(id);
+  size_t leaf_size = mod->table_leaf_size(id);
+  if (fd < 0 || key_size == 0 || leaf_size == 0) return -1;
+
+  unsigned int want = *count, got = 0;
+  __u32 batch = 0, out_batch = 0;
+  bool first = true;
+  while (got < want) {
+    __u32 n = want - got;
+    int err = bpf_lookup_batch(fd, first ? nullptr : &batch, &out_batch,
+                               static_cast<char *>(keys) + (size_t)got * key_size,
+                               static_cast<char *>(leaves) + (size_t)got * leaf_size,
+                               &n);
+    if (err == 0 || errno == ENOENT) {
+      // ENOENT still copies out the final partial chunk
+      got += n;
+      if (err != 0)
+        break;
+      batch = out_batch;
+      first = false;
+      continue;
+    }
+    if (!first || errno != EINVAL)
+      return -1;
+    // pre-batch kernel: walk the map one get_next_key/lookup pair at a time
+    char *kcur = static_cast<char *>(keys);
+    char *vcur = static_cast<char *>(leaves);
+    if (bpf_get_first_key(fd, kcur, key_size) < 0)
+      break;
+    while (got < want) {
+      if (bpf_lookup_elem(fd, kcur, vcur) < 0)
+        break;
+      got++;
+      vcur += leaf_size;
+      if (got >= want ||
+          bpf_get_next_key(fd, kcur, kcur + key_size) < 0)
+        break;
+      kcur += key_size;
+    }
+    break;
+  }
+  *count = got;
+  return 0;
+}
+
+int bpf_table_update_batch(void *program, size_t id, void *keys, void *leaves,
+                           unsigned int *count) {
+  auto mod = static_cast<ebpf::BPFModule *>(program);
+  if (!mod || !count) return -1;
+  int fd = mod->table_fd(id);
+  size_t key_size = mod->table_key_size(id);
+  size_t leaf_size = mod->table_leaf_size(id);
+  if (fd < 0 || key_size == 0 || leaf_size == 0) return -1;
+
+  __u32 n = *count;
+  if (bpf_update_batch(fd, keys, leaves, &n) == 0) {
+    *count = n;
+    return 0;
+  }
+  if (errno != EINVAL)
+    return -1;
+  // pre-batch kernel fallback
+  unsigned int done = 0;
+  for (; done < *count; done++) {
+    if (bpf_update_elem(fd, static_cast<char *>(keys) + (size_t)done * key_size,
+                        static_cast<char *>(leaves) + (size_t)done * leaf_size,
+                        0) < 0)
+      break;
+  }
+  unsigned int want = *count;
+  *count = done;
+  return done == want ? 0 : -1;
+}
+
 int bcc_func_load(void *program, int prog_type, const char *name,
                   const struct bpf_insn *insns, int prog_len,
                   const char *license, unsigned kern_version,
@@ -63,9 +63,46 @@ int bpf_table_key_snprintf(void *program, size_t id, char *buf, size_t buflen, c
 int bpf_table_leaf_snprintf(void *program, size_t id, char *buf, size_t buflen, const void *leaf);
 int bpf_table_key_sscanf(void *program, size_t id, const char *buf, void *key);
 int bpf_table_leaf_sscanf(void *program, size_t id, const char *buf, void *leaf);
+/* Batch variants of the four string converters above: one call converts n
+ * entries, looping natively over the JITed converter, so bindings dumping
+ * a large map cross the FFI boundary once instead of once per entry.
+ * Binary keys/leaves are packed at key_size/leaf_size stride; string i
+ * lives at buf + i * buf_stride (NUL-terminated within its stride), and
+ * the sscanf variants take an array of n string pointers. Returns the
+ * number of entries converted — n on success; conversion stops at the
+ * first failing entry. */
+int bpf_table_key_snprintf_batch(void *program, size_t id, char *buf,
+                                 size_t buf_stride, const void *keys,
+                                 size_t n);
+int bpf_table_leaf_snprintf_batch(void *program, size_t id, char *buf,
+                                  size_t buf_stride, const void *leaves,
+                                  size_t n);
+int bpf_table_key_sscanf_batch(void *program, size_t id,
+                               const char *const *bufs, void *keys, size_t n);
+int bpf_table_leaf_sscanf_batch(void *program, size_t id,
+                                const char *const *bufs, void *leaves,
+                                size_t n);
+/* Bulk table access over caller-preallocated buffers, for FFI bindings
+ * where each C call is expensive. keys/leaves are packed arrays with
+ * key_size/leaf_size stride and room for *count entries. lookup_batch
+ * dumps entries from the start of the map and update_batch writes *count
+ * entries, both in as few BPF_MAP_*_BATCH syscalls as possible (one
+ * element at a time on pre-v5.6 kernels). On success *count holds the
+ * number of entries copied in/out and 0 is returned. */
+int bpf_table_lookup_batch(void *program, size_t id, void *keys, void *leaves,
+                           unsigned int *count);
+int bpf_table_update_batch(void *program, size_t id, void *keys, void *leaves,
+                           unsigned int *count);
 size_t bpf_perf_event_fields(void *program, const char *event);
 const char * bpf_perf_event_field(void *program, const char *event, size_t i);
 
+// Build the per-build-id DWARF inline index consumed by
+// bcc_symcache_resolve_inline (see bcc_syms.h): walks .debug_info of
+// binary_path (the binary or its separate debuginfo file) once and writes
+// <index_dir>/<buildid>.inline for mmap'd lookups thereafter. Returns 0 on
+// success, -1 when the file has no build-id or no inline information.
+int bcc_build_inline_index(const char *binary_path, const char *index_dir);
+
 struct bpf_insn;
 int bcc_func_load(void *program, int prog_type, const char *name,
                   const struct bpf_insn *insns, int prog_len,
@@ -14,18 +14,27 @@
  * limitations under the License.
  */
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <map>
 #include <string>
 #include <tuple>
 #include <vector>
 
 #include "bcc_debug.h"
+#include "bcc_elf.h"
+#include "syms.h"
 
 #if LLVM_VERSION_MAJOR >= 15
 #include <llvm/DebugInfo/DWARF/DWARFCompileUnit.h>
 #endif
 #include <llvm/DebugInfo/DWARF/DWARFContext.h>
 #include <llvm/DebugInfo/DWARF/DWARFDebugLine.h>
+#include <llvm/DebugInfo/DWARF/DWARFDie.h>
+#include <llvm/Object/ObjectFile.h>
 #include <llvm/IR/Module.h>
 #include <llvm/MC/MCAsmInfo.h>
 #include <llvm/MC/MCContext.h>
@@ -58,10 +67,54 @@ using std::vector;
 using namespace llvm;
 using DWARFLineTable = DWARFDebugLine::LineTable;
 
+// Everything the per-function disassembler needs, built once by init() and
+// reused for every subsequent dump()/disassemble() call.
+struct SourceDebugger::MCState {
+  const Target *T;
+  std::unique_ptr<MCRegisterInfo> MRI;
+  std::unique_ptr<MCAsmInfo> MAI;
+  std::unique_ptr<MCSubtargetInfo> STI;
+  MCObjectFileInfo MOFI;
+  std::unique_ptr<MCContext> Ctx;
+  std::unique_ptr<MCInstrInfo> MCII;
+  std::unique_ptr<MCInstPrinter> IP;
+  std::unique_ptr<const MCDisassembler> DisAsm;
+  std::unique_ptr<DWARFContext> DwarfCtx;
+  DWARFCompileUnit *CU;
+  const DWARFLineTable *LineTable;
+  vector<string> LineCache;
+};
+
+SourceDebugger::SourceDebugger(llvm::Module *mod, sec_map_def &sections,
+                               ProgFuncInfo &prog_func_info,
+                               const std::string &mod_src,
+                               std::map<std::string, std::string> &src_dbg_fmap)
+    : prog_func_info_(prog_func_info),
+      mod_src_(mod_src),
+      src_dbg_fmap_(src_dbg_fmap),
+      triple_(mod->getTargetTriple()),
+      src_file_name_(mod->getSourceFileName()),
+      little_endian_(mod->getDataLayout().isLittleEndian()),
+      init_failed_(false) {
+  // Copy out the debug sections and section ids up front: the section map
+  // and the module may be gone by the time disassembly is first requested.
+  for (auto section : sections) {
+    section_ids_[section.first] = get<2>(section.second);
+    if (strncmp(section.first.c_str(), ".debug", 6) == 0) {
+      StringRef SecData(reinterpret_cast<const char *>(get<0>(section.second)),
+                        get<1>(section.second));
+      debug_sections_[section.first.substr(1)] =
+          MemoryBuffer::getMemBufferCopy(SecData);
+    }
+  }
+}
+
+SourceDebugger::~SourceDebugger() = default;
+
 void SourceDebugger::adjustInstSize(uint64_t &Size, uint8_t byte0,
                                     uint8_t byte1) {
 #ifdef WORKAROUND_FOR_LD_PSEUDO
-  bool isLittleEndian = mod_->getDataLayout().isLittleEndian();
+  bool isLittleEndian = little_endian_;
   if (byte0 == 0x18 && ((isLittleEndian && (byte1 & 0xf) == 0x1) ||
                         (!isLittleEndian && (byte1 & 0xf0) == 0x10)))
     Size = 16;
@@ -90,7 +143,7 @@ void SourceDebugger::dumpSrcLine(const vector<string> &LineCache,
                                  uint32_t &CurrentSrcLine,
                                  llvm::raw_ostream &os) {
   if (Line != 0 && Line != CurrentSrcLine && Line < LineCache.size() &&
-      FileName == mod_->getSourceFileName()) {
+      FileName == src_file_name_) {
     os << "; " << StringRef(LineCache[Line - 1]).ltrim()
        << format(
               " // Line"
@@ -100,144 +153,429 @@ void SourceDebugger::dumpSrcLine(const vector<string> &LineCache,
   }
 }
 
-void SourceDebugger::getDebugSections(
-    StringMap<std::unique_ptr<MemoryBuffer>> &DebugSections) {
-  for (auto section : sections_) {
-    if (strncmp(section.first.c_str(), ".debug", 6) == 0) {
-      StringRef SecData(reinterpret_cast<const char *>(get<0>(section.second)),
-                        get<1>(section.second));
-      DebugSections[section.first.substr(1)] =
-          MemoryBuffer::getMemBufferCopy(SecData);
-    }
-  }
-}
+bool SourceDebugger::init() {
+  if (mc_)
+    return true;
+  if (init_failed_)
+    return false;
+  init_failed_ = true;
 
-void SourceDebugger::dump() {
   string Error;
-  string TripleStr(mod_->getTargetTriple());
-  Triple TheTriple(TripleStr);
-  const Target *T = TargetRegistry::lookupTarget(TripleStr, Error);
-  if (!T) {
+  Triple TheTriple(triple_);
+  auto mc = std::unique_ptr<MCState>(new MCState());
+  mc->T = TargetRegistry::lookupTarget(triple_, Error);
+  if (!mc->T) {
     errs() << "Debug Error: cannot get target\n";
-    return;
+    return false;
   }
 
-  std::unique_ptr<MCRegisterInfo> MRI(T->createMCRegInfo(TripleStr));
-  if (!MRI) {
+  mc->MRI.reset(mc->T->createMCRegInfo(triple_));
+  if (!mc->MRI) {
     errs() << "Debug Error: cannot get register info\n";
-    return;
+    return false;
   }
 
   MCTargetOptions MCOptions;
-  std::unique_ptr<MCAsmInfo> MAI(T->createMCAsmInfo(*MRI, TripleStr, MCOptions));
-  if (!MAI) {
+  mc->MAI.reset(mc->T->createMCAsmInfo(*mc->MRI, triple_, MCOptions));
+  if (!mc->MAI) {
     errs() << "Debug Error: cannot get assembly info\n";
-    return;
+    return false;
   }
 
-  std::unique_ptr<MCSubtargetInfo> STI(
-      T->createMCSubtargetInfo(TripleStr, "", ""));
-  MCObjectFileInfo MOFI;
+  mc->STI.reset(mc->T->createMCSubtargetInfo(triple_, "", ""));
 #if LLVM_VERSION_MAJOR >= 13
-  MCContext Ctx(TheTriple, MAI.get(), MRI.get(), STI.get(), nullptr);
-  Ctx.setObjectFileInfo(&MOFI);
-  MOFI.initMCObjectFileInfo(Ctx, false, false);
+  mc->Ctx.reset(new MCContext(TheTriple, mc->MAI.get(), mc->MRI.get(),
+                              mc->STI.get(), nullptr));
+  mc->Ctx->setObjectFileInfo(&mc->MOFI);
+  mc->MOFI.initMCObjectFileInfo(*mc->Ctx, false, false);
 #else
-  MCContext Ctx(MAI.get(), MRI.get(), &MOFI, nullptr);
-  MOFI.InitMCObjectFileInfo(TheTriple, false, Ctx, false);
+  mc->Ctx.reset(new MCContext(mc->MAI.get(), mc->MRI.get(), &mc->MOFI,
+                              nullptr));
+  mc->MOFI.InitMCObjectFileInfo(TheTriple, false, *mc->Ctx, false);
 #endif
 
-  std::unique_ptr<MCInstrInfo> MCII(T->createMCInstrInfo());
-  MCInstPrinter *IP = T->createMCInstPrinter(TheTriple, 0, *MAI, *MCII, *MRI);
-  if (!IP) {
+  mc->MCII.reset(mc->T->createMCInstrInfo());
+  mc->IP.reset(
+      mc->T->createMCInstPrinter(TheTriple, 0, *mc->MAI, *mc->MCII, *mc->MRI));
+  if (!mc->IP) {
     errs() << "Debug Error: unable to create instruction printer\n";
-    return;
+    return false;
   }
 
-  std::unique_ptr<const MCDisassembler> DisAsm(
-      T->createMCDisassembler(*STI, Ctx));
-  if (!DisAsm) {
+  mc->DisAsm.reset(mc->T->createMCDisassembler(*mc->STI, *mc->Ctx));
+  if (!mc->DisAsm) {
     errs() << "Debug Error: no disassembler\n";
-    return;
+    return false;
   }
 
   // Set up the dwarf debug context
-  StringMap<std::unique_ptr<MemoryBuffer>> DebugSections;
-  getDebugSections(DebugSections);
-  std::unique_ptr<DWARFContext> DwarfCtx =
-      DWARFContext::create(DebugSections, 8);
-  if (!DwarfCtx) {
+  mc->DwarfCtx = DWARFContext::create(debug_sections_, 8);
+  if (!mc->DwarfCtx) {
     errs() << "Debug Error: dwarf context creation failed\n";
-    return;
+    return false;
   }
 
-  DWARFCompileUnit *CU = cast<DWARFCompileUnit>(DwarfCtx->getUnitAtIndex(0));
-  if (!CU) {
+  mc->CU = cast<DWARFCompileUnit>(mc->DwarfCtx->getUnitAtIndex(0));
+  if (!mc->CU) {
     errs() << "Debug Error: dwarf context failed to get compile unit\n";
-    return;
+    return false;
   }
 
-  const DWARFLineTable *LineTable = DwarfCtx->getLineTableForUnit(CU);
-  if (!LineTable) {
+  mc->LineTable = mc->DwarfCtx->getLineTableForUnit(mc->CU);
+  if (!mc->LineTable) {
     errs() << "Debug Error: dwarf context failed to get line table\n";
-    return;
+    return false;
   }
 
   // Build LineCache for later source code printing
-  vector<string> LineCache = buildLineCache();
+  mc->LineCache = buildLineCache();
 
-  // Start to disassemble with source code annotation section by section
-  prog_func_info_.for_each_func([&](std::string func_name, FuncInfo &info) {
-    MCDisassembler::DecodeStatus S;
-    MCInst Inst;
-    uint64_t Size;
-    uint8_t *FuncStart = info.start_;
-    uint64_t FuncSize = info.size_;
-
-    auto section = sections_.find(info.section_);
-    if (section == sections_.end()) {
-      errs() << "Debug Error: no section entry for section " << info.section_
-             << '\n';
-      return;
+  mc_ = std::move(mc);
+  init_failed_ = false;
+  return true;
+}
+
+bool SourceDebugger::disassembleFunc(const string &func_name, FuncInfo &info,
+                                     string &out) {
+  MCDisassembler::DecodeStatus S;
+  MCInst Inst;
+  uint64_t Size;
+  uint8_t *FuncStart = info.start_;
+  uint64_t FuncSize = info.size_;
+
+  auto section_id = section_ids_.find(info.section_);
+  if (section_id == section_ids_.end()) {
+    errs() << "Debug Error: no section entry for section " << info.section_
+           << '\n';
+    return false;
+  }
+  unsigned SectionID = section_id->second;
+
+  ArrayRef<uint8_t> Data(FuncStart, FuncSize);
+  uint32_t CurrentSrcLine = 0;
+
+  llvm::raw_string_ostream os(out);
+  for (uint64_t Index = 0; Index < FuncSize; Index += Size) {
+    S = mc_->DisAsm->getInstruction(Inst, Size, Data.slice(Index), Index,
+                                    nulls());
+    if (S != MCDisassembler::Success) {
+      os << "Debug Error: disassembler failed: " << std::to_string(S) << '\n';
+      break;
+    } else {
+      DILineInfo LineInfo;
+
+      mc_->LineTable->getFileLineInfoForAddress(
+          {(uint64_t)FuncStart + Index, SectionID},
+#if LLVM_VERSION_MAJOR >= 20
+          false,
+#endif
+          mc_->CU->getCompilationDir(),
+          DILineInfoSpecifier::FileLineInfoKind::AbsoluteFilePath, LineInfo);
+
+      adjustInstSize(Size, Data[Index], Data[Index + 1]);
+      dumpSrcLine(mc_->LineCache, LineInfo.FileName, LineInfo.Line,
+                  CurrentSrcLine, os);
+      os << format("%4" PRIu64 ":", Index >> 3) << '\t';
+      dumpBytes(Data.slice(Index, Size), os);
+      mc_->IP->printInst(&Inst, 0, "", *mc_->STI, os);
+      os << '\n';
     }
-    unsigned SectionID = get<2>(section->second);
+  }
+  os.flush();
+  return true;
+}
 
-    ArrayRef<uint8_t> Data(FuncStart, FuncSize);
-    uint32_t CurrentSrcLine = 0;
+void SourceDebugger::dump() {
+  if (!init())
+    return;
 
+  // Disassemble with source code annotation function by function
+  prog_func_info_.for_each_func([&](std::string func_name, FuncInfo &info) {
     errs() << "Disassembly of function " << func_name << "\n";
 
     string src_dbg_str;
-    llvm::raw_string_ostream os(src_dbg_str);
-    for (uint64_t Index = 0; Index < FuncSize; Index += Size) {
-      S = DisAsm->getInstruction(Inst, Size, Data.slice(Index), Index, nulls());
-      if (S != MCDisassembler::Success) {
-        os << "Debug Error: disassembler failed: " << std::to_string(S) << '\n';
-        break;
-      } else {
-        DILineInfo LineInfo;
+    if (!disassembleFunc(func_name, info, src_dbg_str))
+      return;
+    errs() << src_dbg_str << '\n';
+    src_dbg_fmap_[func_name] = src_dbg_str;
+  });
+}
 
-        LineTable->getFileLineInfoForAddress(
-            {(uint64_t)FuncStart + Index, SectionID},
+const std::string &SourceDebugger::disassemble(const std::string &func_name) {
+  static const std::string empty;
+
+  auto cached = src_dbg_fmap_.find(func_name);
+  if (cached != src_dbg_fmap_.end() && !cached->second.empty())
+    return cached->second;
+
+  if (!init())
+    return empty;
+
+  auto fn = prog_func_info_.get_func(func_name);
+  if (!fn || !fn->start_)
+    return empty;
+
+  string src_dbg_str;
+  if (!disassembleFunc(func_name, *fn, src_dbg_str))
+    return empty;
+  auto &slot = src_dbg_fmap_[func_name];
+  slot = std::move(src_dbg_str);
+  return slot;
+}
+
+std::map<string, vector<uint32_t>> build_func_line_tables(
+    llvm::Module *mod, sec_map_def &sections, ProgFuncInfo &prog_func_info) {
+  std::map<string, vector<uint32_t>> tables;
+  StringMap<std::unique_ptr<MemoryBuffer>> debug_sections;
+  std::map<string, unsigned> section_ids;
+
+  for (auto section : sections) {
+    section_ids[section.first] = get<2>(section.second);
+    if (strncmp(section.first.c_str(), ".debug", 6) == 0) {
+      StringRef SecData(reinterpret_cast<const char *>(get<0>(section.second)),
+                        get<1>(section.second));
+      debug_sections[section.first.substr(1)] =
+          MemoryBuffer::getMemBufferCopy(SecData);
+    }
+  }
+  if (debug_sections.empty())
+    return tables;
+
+  auto DwarfCtx = DWARFContext::create(debug_sections, 8);
+  if (!DwarfCtx)
+    return tables;
+  auto *CU = cast_or_null<DWARFCompileUnit>(DwarfCtx->getUnitAtIndex(0));
+  if (!CU)
+    return tables;
+  const DWARFLineTable *LineTable = DwarfCtx->getLineTableForUnit(CU);
+  if (!LineTable)
+    return tables;
+
+  string src_file_name = mod->getSourceFileName();
+  prog_func_info.for_each_func([&](std::string func_name, FuncInfo &info) {
+    if (!info.start_ || !info.size_)
+      return;
+    auto section_id = section_ids.find(info.section_);
+    if (section_id == section_ids.end())
+      return;
+    // One entry per 8-byte slot matches the verifier's instruction
+    // numbering: the second half of a 16-byte ld_imm64 inherits the line
+    // row covering its address, which is the same source line.
+    vector<uint32_t> lines(info.size_ / 8, 0);
+    for (uint64_t Index = 0; Index < info.size_; Index += 8) {
+      DILineInfo LineInfo;
+      LineTable->getFileLineInfoForAddress(
+          {(uint64_t)info.start_ + Index, section_id->second},
 #if LLVM_VERSION_MAJOR >= 20
-            false,
+          false,
 #endif
-            CU->getCompilationDir(),
-            DILineInfoSpecifier::FileLineInfoKind::AbsoluteFilePath, LineInfo);
-
-        adjustInstSize(Size, Data[Index], Data[Index + 1]);
-        dumpSrcLine(LineCache, LineInfo.FileName, LineInfo.Line, CurrentSrcLine,
-                    os);
-        os << format("%4" PRIu64 ":", Index >> 3) << '\t';
-        dumpBytes(Data.slice(Index, Size), os);
-        IP->printInst(&Inst, 0, "", *STI, os);
-        os << '\n';
+          CU->getCompilationDir(),
+          DILineInfoSpecifier::FileLineInfoKind::AbsoluteFilePath, LineInfo);
+      if (LineInfo.FileName == src_file_name)
+        lines[Index >> 3] = LineInfo.Line;
+    }
+    tables[func_name] = std::move(lines);
+  });
+  return tables;
+}
+
+// Builder side of the DWARF inline index consumed by InlineIndex in
+// bcc_syms.cc (see syms.h for the on-disk layout). The DIE tree of every
+// compile unit is walked once, collecting an address range per
+// DW_TAG_inlined_subroutine together with its enclosing-inline name chain;
+// overlapping (nested) ranges are then flattened into disjoint sorted
+// segments where the deepest chain wins, so lookups are a single binary
+// search. This lives here rather than in bcc_syms.cc because it needs
+// LLVM's DWARF parser, which the loader-only symbol library does not link.
+
+namespace {
+struct RawInlineRange {
+  uint64_t start;
+  uint64_t end;
+  std::vector<uint32_t> chain;  // strtab offsets, innermost-first
+};
+}  // namespace
+
+static void collect_inline_ranges(const DWARFDie &die,
+                                  std::vector<uint32_t> &stack,
+                                  std::map<std::string, uint32_t> &interned,
+                                  std::string &strtab,
+                                  std::vector<RawInlineRange> &out) {
+  bool pushed = false;
+  if (die.getTag() == dwarf::DW_TAG_inlined_subroutine) {
+    // getSubroutineName chases DW_AT_abstract_origin to the source-level
+    // name of the inlined callee
+    const char *name = die.getSubroutineName(DINameKind::ShortName);
+    if (name) {
+      auto it = interned.find(name);
+      if (it == interned.end()) {
+        it = interned.emplace(name, (uint32_t)strtab.size()).first;
+        strtab.append(name);
+        strtab.push_back('\0');
+      }
+      stack.push_back(it->second);
+      pushed = true;
+
+      auto emit_range = [&](uint64_t low, uint64_t high) {
+        if (low >= high)
+          return;
+        RawInlineRange raw;
+        raw.start = low;
+        raw.end = high;
+        raw.chain.assign(stack.rbegin(), stack.rend());
+        out.push_back(std::move(raw));
+      };
+#if LLVM_VERSION_MAJOR >= 8
+      auto ranges = die.getAddressRanges();
+      if (ranges) {
+        for (const auto &r : *ranges)
+          emit_range(r.LowPC, r.HighPC);
+      } else {
+        consumeError(ranges.takeError());
       }
+#else
+      for (const auto &r : die.getAddressRanges())
+        emit_range(r.LowPC, r.HighPC);
+#endif
     }
-    os.flush();
-    errs() << src_dbg_str << '\n';
-    src_dbg_fmap_[func_name] = src_dbg_str;
+  }
+  for (DWARFDie child = die.getFirstChild(); child;
+       child = child.getSibling())
+    collect_inline_ranges(child, stack, interned, strtab, out);
+  if (pushed)
+    stack.pop_back();
+}
+
+int build_inline_index(const std::string &binary_path,
+                       const std::string &index_dir) {
+  char buildid[128];
+  if (bcc_elf_get_buildid(binary_path.c_str(), buildid) != 0)
+    return -1;
+
+  auto buf_or_err = MemoryBuffer::getFile(binary_path);
+  if (!buf_or_err)
+    return -1;
+  auto obj_or_err = object::ObjectFile::createObjectFile(
+      (*buf_or_err)->getMemBufferRef());
+  if (!obj_or_err) {
+    consumeError(obj_or_err.takeError());
+    return -1;
+  }
+  auto ctx = DWARFContext::create(**obj_or_err);
+
+  std::vector<RawInlineRange> raw;
+  std::map<std::string, uint32_t> interned;
+  std::string strtab;
+  std::vector<uint32_t> stack;
+  for (const auto &cu : ctx->compile_units()) {
+    DWARFDie cu_die = cu->getUnitDIE(false);
+    if (cu_die)
+      collect_inline_ranges(cu_die, stack, interned, strtab, raw);
+  }
+  if (raw.empty())
+    return -1;
+
+  // flatten nested/overlapping inline ranges into disjoint sorted segments:
+  // sweep the range boundaries, and between consecutive boundaries the
+  // active range with the deepest chain describes the innermost inline
+  struct Event {
+    uint64_t addr;
+    bool open;
+    size_t idx;
+  };
+  std::vector<Event> events;
+  events.reserve(raw.size() * 2);
+  for (size_t i = 0; i < raw.size(); i++) {
+    events.push_back({raw[i].start, true, i});
+    events.push_back({raw[i].end, false, i});
+  }
+  std::sort(events.begin(), events.end(), [](const Event &a, const Event &b) {
+    if (a.addr != b.addr)
+      return a.addr < b.addr;
+    return a.open < b.open;  // close before open at the same address
   });
+
+  std::vector<struct bcc_inline_index_range> segments;
+  std::vector<uint32_t> chain_words;
+  std::map<std::vector<uint32_t>, std::pair<uint32_t, uint32_t>> chain_pool;
+  std::vector<size_t> active;
+  uint64_t prev_addr = 0;
+
+  auto emit = [&](uint64_t start, uint64_t end) {
+    if (active.empty() || start >= end)
+      return;
+    size_t deepest = active[0];
+    for (size_t idx : active)
+      if (raw[idx].chain.size() > raw[deepest].chain.size())
+        deepest = idx;
+    auto pooled = chain_pool.find(raw[deepest].chain);
+    if (pooled == chain_pool.end()) {
+      std::pair<uint32_t, uint32_t> loc((uint32_t)chain_words.size(),
+                                        (uint32_t)raw[deepest].chain.size());
+      chain_words.insert(chain_words.end(), raw[deepest].chain.begin(),
+                         raw[deepest].chain.end());
+      pooled = chain_pool.emplace(raw[deepest].chain, loc).first;
+    }
+    // extend the previous segment instead of emitting an adjacent twin
+    if (!segments.empty() && segments.back().end == start &&
+        segments.back().chain_off == pooled->second.first &&
+        segments.back().chain_len == pooled->second.second) {
+      segments.back().end = end;
+      return;
+    }
+    struct bcc_inline_index_range seg;
+    seg.start = start;
+    seg.end = end;
+    seg.chain_off = pooled->second.first;
+    seg.chain_len = pooled->second.second;
+    segments.push_back(seg);
+  };
+
+  for (const Event &ev : events) {
+    emit(prev_addr, ev.addr);
+    if (ev.open) {
+      active.push_back(ev.idx);
+    } else {
+      for (size_t i = 0; i < active.size(); i++)
+        if (active[i] == ev.idx) {
+          active.erase(active.begin() + i);
+          break;
+        }
+    }
+    prev_addr = ev.addr;
+  }
+
+  struct bcc_inline_index_header hdr;
+  hdr.magic = BCC_INLINE_INDEX_MAGIC;
+  hdr.version = BCC_INLINE_INDEX_VERSION;
+  hdr.n_ranges = segments.size();
+  hdr.n_chain_words = chain_words.size();
+  hdr.strtab_size = strtab.size();
+
+  std::string path = index_dir + "/" + buildid + ".inline";
+  std::string tmp_path = path + ".tmp." + std::to_string(::getpid());
+  std::ofstream os(tmp_path, std::ios::binary | std::ios::trunc);
+  if (!os.is_open())
+    return -1;
+  os.write(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+  os.write(reinterpret_cast<const char *>(segments.data()),
+           segments.size() * sizeof(segments[0]));
+  os.write(reinterpret_cast<const char *>(chain_words.data()),
+           chain_words.size() * sizeof(uint32_t));
+  os.write(strtab.data(), strtab.size());
+  os.close();
+  if (os.fail() || ::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    ::unlink(tmp_path.c_str());
+    return -1;
+  }
+  return 0;
 }
 
 }  // namespace ebpf
+
+extern "C" int bcc_build_inline_index(const char *binary_path,
+                                      const char *index_dir) {
+  if (!binary_path || !index_dir)
+    return -1;
+  return ebpf::build_inline_index(binary_path, index_dir);
+}
@@ -14,6 +14,14 @@
  * limitations under the License.
  */
 
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/MemoryBuffer.h>
+
 #include "bpf_module.h"
 #include "frontends/clang/loader.h"
 
@@ -21,31 +29,68 @@ namespace ebpf {
 
 class SourceDebugger {
  public:
+  // The constructor only snapshots what later disassembly needs from the
+  // module and the section map (both may be torn down once finalize
+  // returns): the target triple, source file name, byte order, section ids
+  // and copies of the .debug_* sections. The LLVM disassembler pipeline is
+  // built lazily on the first dump() or disassemble() call and reused.
   SourceDebugger(llvm::Module *mod, sec_map_def &sections,
                  ProgFuncInfo &prog_func_info, const std::string &mod_src,
-                 std::map<std::string, std::string> &src_dbg_fmap)
-      : mod_(mod),
-        sections_(sections),
-        prog_func_info_(prog_func_info),
-        mod_src_(mod_src),
-        src_dbg_fmap_(src_dbg_fmap) {}
+                 std::map<std::string, std::string> &src_dbg_fmap);
+  ~SourceDebugger();
+
+  // Disassemble every program function, print the result to stderr and
+  // cache it in src_dbg_fmap.
   void dump();
+  // Disassemble a single function on demand, caching the result in
+  // src_dbg_fmap so repeated requests are free. Returns the empty string
+  // for unknown functions or when the disassembler cannot be set up.
+  const std::string &disassemble(const std::string &func_name);
 
  private:
+  struct MCState;
+
+  bool init();
+  bool disassembleFunc(const std::string &func_name, FuncInfo &info,
+                       std::string &out);
   void adjustInstSize(uint64_t &Size, uint8_t byte0, uint8_t byte1);
   std::vector<std::string> buildLineCache();
   void dumpSrcLine(const std::vector<std::string> &LineCache,
                    const std::string &FileName, uint32_t Line,
                    uint32_t &CurrentSrcLine, llvm::raw_ostream &os);
-  void getDebugSections(
-      llvm::StringMap<std::unique_ptr<llvm::MemoryBuffer>> &DebugSections);
 
  private:
-  llvm::Module *mod_;
-  const sec_map_def &sections_;
   ProgFuncInfo &prog_func_info_;
   const std::string &mod_src_;
   std::map<std::string, std::string> &src_dbg_fmap_;
+  // captured from the module/section map at construction time
+  std::string triple_;
+  std::string src_file_name_;
+  bool little_endian_;
+  llvm::StringMap<std::unique_ptr<llvm::MemoryBuffer>> debug_sections_;
+  std::map<std::string, unsigned> section_ids_;
+  // lazily built disassembler/dwarf pipeline, shared across calls
+  std::unique_ptr<MCState> mc_;
+  bool init_failed_;
 };
 
+// Compact source attribution index for verifier errors. The clang
+// frontend always compiles with -g, so every finalized module carries a
+// DWARF line table; this walks it once and returns, per program function,
+// one source line number per 8-byte instruction slot (0 where nothing
+// maps, or where the line belongs to an included header rather than the
+// program text). The few KB BPFModule retains let a verifier rejection
+// point at the offending source line immediately, without re-running the
+// compile under DEBUG_SOURCE.
+std::map<std::string, std::vector<uint32_t>> build_func_line_tables(
+    llvm::Module *mod, sec_map_def &sections, ProgFuncInfo &prog_func_info);
+
+// Build the per-build-id DWARF inline index consumed by
+// bcc_symcache_resolve_inline: binary_path is the file holding .debug_info
+// (the binary itself or its separate debuginfo file), and the index is
+// written to <index_dir>/<buildid>.inline. Returns 0 on success, -1 when
+// the file has no build-id or no inline information.
+int build_inline_index(const std::string &binary_path,
+                       const std::string &index_dir);
+
 }  // namespace ebpf
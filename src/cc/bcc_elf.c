@@ -18,12 +18,14 @@
 #include <sys/mman.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <unistd.h>
 #include <string.h>
 #include <libgen.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <pthread.h>
 #ifdef HAVE_LIBLZMA
 #include <lzma.h>
 #endif
@@ -44,7 +46,9 @@ static int openelf_fd(int fd, Elf **elf_out) {
   if (elf_version(EV_CURRENT) == EV_NONE)
     return -1;
 
-  *elf_out = elf_begin(fd, ELF_C_READ, 0);
+  // ELF_C_READ_MMAP maps the file instead of reading it up front, so only
+  // the pages actually inspected are faulted in
+  *elf_out = elf_begin(fd, ELF_C_READ_MMAP, 0);
   if (*elf_out == NULL)
     return -1;
 
@@ -370,12 +374,100 @@ static Elf_Scn * get_section(Elf *e, const char *section_name,
   return NULL;
 }
 
+// Fast path for ELFs whose class and byte order match the host: walk the raw
+// on-disk symbol records from elf_rawdata() without the per-symbol gelf
+// conversion, and resolve a symbol's name only after it passed the cheap
+// st_value/st_type filters, so string table pages are faulted in just for
+// the symbols actually delivered. Returns -2 when the section needs the
+// portable gelf walk instead (foreign class/endianness, or powerpc64 where
+// function descriptor and local-entry-point fixups apply).
+static int list_in_scn_raw(Elf *e, Elf_Scn *section, size_t stridx,
+                           size_t symsize, struct bcc_symbol_option *option,
+                           bcc_elf_symcb callback,
+                           bcc_elf_symcb_lazy callback_lazy, void *payload,
+                           bool debugfile) {
+#if defined(__powerpc64__)
+  return -2;
+#else
+  GElf_Ehdr ehdr;
+  if (!gelf_getehdr(e, &ehdr))
+    return -2;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  const unsigned char host_data = ELFDATA2LSB;
+#else
+  const unsigned char host_data = ELFDATA2MSB;
+#endif
+  if (ehdr.e_ident[EI_DATA] != host_data)
+    return -2;
+  int elfclass = gelf_getclass(e);
+  if ((elfclass == ELFCLASS64 && symsize != sizeof(Elf64_Sym)) ||
+      (elfclass == ELFCLASS32 && symsize != sizeof(Elf32_Sym)))
+    return -2;
+
+  Elf_Data *data = NULL;
+  while ((data = elf_rawdata(section, data)) != 0) {
+    size_t i, symcount = data->d_size / symsize;
+    const uint8_t *recs = data->d_buf;
+
+    if (data->d_size % symsize)
+      return -1;
+
+    for (i = 0; i < symcount; ++i) {
+      uint64_t st_value, st_size;
+      uint32_t st_name;
+      unsigned char st_info;
+      const char *name;
+
+      if (elfclass == ELFCLASS64) {
+        const Elf64_Sym *sym = (const Elf64_Sym *)(recs + i * symsize);
+        st_value = sym->st_value;
+        st_size = sym->st_size;
+        st_name = sym->st_name;
+        st_info = sym->st_info;
+      } else {
+        const Elf32_Sym *sym = (const Elf32_Sym *)(recs + i * symsize);
+        st_value = sym->st_value;
+        st_size = sym->st_size;
+        st_name = sym->st_name;
+        st_info = sym->st_info;
+      }
+
+      if (st_value == 0)
+        continue;
+      if (!(option->use_symbol_type & (1 << ELF_ST_TYPE(st_info))))
+        continue;
+
+      if ((name = elf_strptr(e, stridx, st_name)) == NULL)
+        continue;
+      if (name[0] == 0)
+        continue;
+
+      int ret;
+      if (option->lazy_symbolize)
+        ret = callback_lazy(stridx, st_name, strlen(name), st_value, st_size,
+                            debugfile, payload);
+      else
+        ret = callback(name, st_value, st_size, payload);
+      if (ret < 0)
+        return 1;      // signal termination to caller
+    }
+  }
+
+  return 0;
+#endif
+}
+
 static int list_in_scn(Elf *e, Elf_Scn *section, size_t stridx, size_t symsize,
                        struct bcc_symbol_option *option,
                        bcc_elf_symcb callback, bcc_elf_symcb_lazy callback_lazy,
                        void *payload, bool debugfile) {
   Elf_Data *data = NULL;
 
+  int rc = list_in_scn_raw(e, section, stridx, symsize, option, callback,
+                           callback_lazy, payload, debugfile);
+  if (rc != -2)
+    return rc;
+
 #if defined(__powerpc64__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
   size_t opdidx = 0;
   Elf_Scn *opdsec = NULL;
@@ -636,6 +728,152 @@ static bool same_file(char *a, const char *b)
 		return false;
 }
 
+/* Cache of build-id -> resolved debug file path. Debug-file discovery probes
+ * several /usr/lib/debug locations and CRC-validates candidates for every
+ * module; with hundreds of modules, or debug repositories on network
+ * filesystems, that probing dominates first symbolization. Entries are
+ * validated by the debug file's mtime, so a replaced debug file is
+ * re-discovered (and re-CRC-checked) rather than trusted. The in-memory
+ * cache is shared across concurrent symbolization threads; setting
+ * BCC_DEBUG_FILE_CACHE_DIR additionally persists entries to disk, one file
+ * per build-id, so later processes skip the probing entirely. */
+struct debug_path_entry {
+  char *buildid;
+  char *path;
+  struct timespec mtime;
+};
+static struct debug_path_entry *debug_path_cache;
+static int debug_path_cache_count;
+static int debug_path_cache_cap;
+static pthread_mutex_t debug_path_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int debug_path_mtime(const char *path, struct timespec *mtime) {
+  struct stat st;
+
+  if (stat(path, &st) < 0)
+    return -1;
+  *mtime = st.st_mtim;
+  return 0;
+}
+
+static void debug_path_disk_name(const char *cache_dir, const char *buildid,
+                                 char *file, size_t len) {
+  snprintf(file, len, "%s/%s.debugpath", cache_dir, buildid);
+}
+
+/* Returns 1 and fills path (PATH_MAX) when a still-valid entry exists. */
+static int debug_path_cache_lookup(const char *buildid, char *path) {
+  const char *cache_dir;
+  char file[PATH_MAX];
+  struct timespec mtime, now_mtime;
+  long long sec;
+  long nsec;
+  FILE *fp;
+  int i, found = 0;
+
+  pthread_mutex_lock(&debug_path_cache_mutex);
+  for (i = 0; i < debug_path_cache_count; ++i) {
+    if (debug_path_cache[i].path &&
+        !strcmp(debug_path_cache[i].buildid, buildid)) {
+      snprintf(path, PATH_MAX, "%s", debug_path_cache[i].path);
+      mtime = debug_path_cache[i].mtime;
+      found = 1;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&debug_path_cache_mutex);
+
+  if (found) {
+    if (debug_path_mtime(path, &now_mtime) == 0 &&
+        now_mtime.tv_sec == mtime.tv_sec && now_mtime.tv_nsec == mtime.tv_nsec)
+      return 1;
+    return 0;
+  }
+
+  cache_dir = getenv("BCC_DEBUG_FILE_CACHE_DIR");
+  if (!cache_dir || !*cache_dir)
+    return 0;
+
+  debug_path_disk_name(cache_dir, buildid, file, sizeof(file));
+  fp = fopen(file, "r");
+  if (!fp)
+    return 0;
+
+  if (fscanf(fp, "%lld %ld ", &sec, &nsec) != 2 || !fgets(path, PATH_MAX, fp)) {
+    fclose(fp);
+    return 0;
+  }
+  fclose(fp);
+  path[strcspn(path, "\n")] = 0;
+
+  if (debug_path_mtime(path, &now_mtime) != 0 || now_mtime.tv_sec != sec ||
+      now_mtime.tv_nsec != nsec) {
+    unlink(file);
+    return 0;
+  }
+  return 1;
+}
+
+static void debug_path_cache_store(const char *buildid, const char *path) {
+  const char *cache_dir;
+  char file[PATH_MAX], tmp_file[PATH_MAX + 16];
+  struct timespec mtime;
+  struct debug_path_entry *entry = NULL;
+  FILE *fp;
+  int i;
+
+  if (debug_path_mtime(path, &mtime) != 0)
+    return;
+
+  pthread_mutex_lock(&debug_path_cache_mutex);
+  for (i = 0; i < debug_path_cache_count; ++i) {
+    if (!strcmp(debug_path_cache[i].buildid, buildid)) {
+      entry = &debug_path_cache[i];
+      free(entry->path);
+      entry->path = NULL;
+      break;
+    }
+  }
+  if (!entry) {
+    if (debug_path_cache_count == debug_path_cache_cap) {
+      int new_cap = debug_path_cache_cap ? debug_path_cache_cap * 2 : 32;
+      struct debug_path_entry *tmp =
+          realloc(debug_path_cache, new_cap * sizeof(*debug_path_cache));
+      if (!tmp)
+        goto disk;
+      debug_path_cache = tmp;
+      debug_path_cache_cap = new_cap;
+    }
+    entry = &debug_path_cache[debug_path_cache_count];
+    entry->buildid = strdup(buildid);
+    if (!entry->buildid)
+      goto disk;
+    debug_path_cache_count++;
+  }
+  entry->path = strdup(path);
+  entry->mtime = mtime;
+
+disk:
+  pthread_mutex_unlock(&debug_path_cache_mutex);
+
+  cache_dir = getenv("BCC_DEBUG_FILE_CACHE_DIR");
+  if (!cache_dir || !*cache_dir)
+    return;
+
+  /* written to a temporary name and renamed so concurrent discoverers of
+   * the same build-id never observe a half-written entry */
+  debug_path_disk_name(cache_dir, buildid, file, sizeof(file));
+  snprintf(tmp_file, sizeof(tmp_file), "%s.%d", file, getpid());
+  fp = fopen(tmp_file, "w");
+  if (!fp)
+    return;
+  fprintf(fp, "%lld %ld %s\n", (long long)mtime.tv_sec, mtime.tv_nsec, path);
+  if (fclose(fp) == 0)
+    rename(tmp_file, file);
+  else
+    unlink(tmp_file);
+}
+
 static int try_open_debuglink_candidate(const char *path, int check_crc,
                                         int crc, struct bcc_elf_file *out) {
   if (access(path, F_OK)) {
@@ -654,7 +892,8 @@ static int try_open_debuglink_candidate(const char *path, int check_crc,
 // Caller is responsible for calling bcc_elf_file_close when done using it.
 // See https://sourceware.org/gdb/onlinedocs/gdb/Separate-Debug-Files.html
 static int find_debug_via_debuglink(Elf *e, const char *binpath, int check_crc,
-                                    struct bcc_elf_file *out) {
+                                    struct bcc_elf_file *out,
+                                    char *resolved) {
   char fullpath[PATH_MAX];
   char tmppath[PATH_MAX];
   char *bindir = NULL;
@@ -675,26 +914,32 @@ static int find_debug_via_debuglink(Elf *e, const char *binpath, int check_crc,
   snprintf(fullpath, sizeof(fullpath),"%s/%s", bindir, name);
   if (same_file(fullpath, binpath) != true &&
       try_open_debuglink_candidate(fullpath, check_crc, crc, out) == 0)
-    return 0;
+    goto found;
 
   // Search for the file in 'binpath'/.debug
   snprintf(fullpath, sizeof(fullpath), "%s/.debug/%s", bindir, name);
   if (try_open_debuglink_candidate(fullpath, check_crc, crc, out) == 0)
-    return 0;
+    goto found;
 
   // Search for the file in the global debug directory /usr/lib/debug/'binpath'
   snprintf(fullpath, sizeof(fullpath), "/usr/lib/debug%s/%s", bindir, name);
   if (try_open_debuglink_candidate(fullpath, check_crc, crc, out) == 0)
-    return 0;
+    goto found;
 
   return -1;
+
+found:
+  if (resolved)
+    snprintf(resolved, PATH_MAX, "%s", fullpath);
+  return 0;
 }
 
 // Returns 0 on success, otherwise nonzero.
 // If successfull, 'out' param is a valid bcc_elf_file.
 // Caller is responsible for calling bcc_elf_file_close when done using it.
 // See https://sourceware.org/gdb/onlinedocs/gdb/Separate-Debug-Files.html
-static int find_debug_via_buildid(Elf *e, struct bcc_elf_file *out) {
+static int find_debug_via_buildid(Elf *e, struct bcc_elf_file *out,
+                                  char *resolved) {
   char fullpath[PATH_MAX];
   char buildid[128];  // currently 40 seems to be default, let's be safe
 
@@ -710,7 +955,11 @@ static int find_debug_via_buildid(Elf *e, struct bcc_elf_file *out) {
     bcc_debuginfo_root = "/usr/lib/debug";
   snprintf(fullpath, sizeof(fullpath), "%s/.build-id/%c%c/%s.debug",
            bcc_debuginfo_root, buildid[0], buildid[1], buildid + 2);
-  return bcc_elf_file_open(fullpath, out);
+  if (bcc_elf_file_open(fullpath, out))
+    return -1;
+  if (resolved)
+    snprintf(resolved, PATH_MAX, "%s", fullpath);
+  return 0;
 }
 
 // Returns 0 on success, otherwise nonzero.
@@ -864,16 +1113,30 @@ static int find_debug_via_debuginfod(Elf *e, struct bcc_elf_file *out) {
 // Caller is responsible for calling bcc_elf_file_close when done using it.
 static int find_debug_file(Elf *e, const char *path, int check_crc,
                            struct bcc_elf_file *out) {
-  if (find_debug_via_symfs(e, path, out) == 0)
+  char buildid[128];
+  char cached[PATH_MAX];
+  char resolved[PATH_MAX];
+  int have_buildid = find_buildid(e, buildid);
+
+  // A cached entry was CRC-checked when first discovered and is pinned to
+  // the debug file's mtime, so a hit needs no probing or re-checksumming.
+  if (have_buildid && debug_path_cache_lookup(buildid, cached) &&
+      bcc_elf_file_open(cached, out) == 0)
     return 0;
 
-  if (find_debug_via_buildid(e, out) == 0)
+  // symfs is an operator-supplied override tree; not cached.
+  if (find_debug_via_symfs(e, path, out) == 0)
     return 0;
 
-  if (find_debug_via_debuglink(e, path, check_crc, out) == 0)
-    return 0;
+  resolved[0] = 0;
+  if (find_debug_via_buildid(e, out, resolved) == 0)
+    goto found;
+
+  if (find_debug_via_debuglink(e, path, check_crc, out, resolved) == 0)
+    goto found;
 
 #ifdef HAVE_LIBLZMA
+  // Embedded in the binary itself; nothing to cache.
   if (find_debug_via_mini_debug_info(e, out) == 0)
     return 0;
 #endif
@@ -884,6 +1147,11 @@ static int find_debug_file(Elf *e, const char *path, int check_crc,
 #endif
 
   return -1;
+
+found:
+  if (have_buildid && resolved[0])
+    debug_path_cache_store(buildid, resolved);
+  return 0;
 }
 
 static int foreach_sym_core(const char *path, bcc_elf_symcb callback,
@@ -929,6 +1197,52 @@ int bcc_elf_foreach_sym_lazy(const char *path, bcc_elf_symcb_lazy callback,
   return foreach_sym_core(path, NULL, callback, o, payload);
 }
 
+struct sym_match_filter {
+  bcc_elf_symcb cb;
+  void *payload;
+  const char *pattern;
+  size_t prefix_len;    // literal prefix before the first metacharacter
+  int fnmatch_needed;   // pattern has more than <prefix> or <prefix>*
+};
+
+static int sym_match_filter_cb(const char *name, uint64_t start,
+                               uint64_t size, void *payload) {
+  struct sym_match_filter *f = payload;
+
+  // the prefix compare rejects non-matches on the first differing byte;
+  // fnmatch only runs for patterns more complex than <prefix> / <prefix>*
+  if (strncmp(name, f->pattern, f->prefix_len))
+    return 0;
+  if (f->fnmatch_needed) {
+    if (fnmatch(f->pattern, name, 0))
+      return 0;
+  } else if (f->pattern[f->prefix_len] == 0 && name[f->prefix_len] != 0) {
+    return 0;  // exact pattern, longer name
+  }
+  return f->cb(name, start, size, f->payload);
+}
+
+int bcc_elf_foreach_sym_matching(const char *path, bcc_elf_symcb callback,
+                                 void *option, const char *pattern,
+                                 void *payload) {
+  struct bcc_symbol_option *o = option;
+  struct sym_match_filter filter;
+
+  if (!pattern || !*pattern)
+    return bcc_elf_foreach_sym(path, callback, option, payload);
+
+  filter.cb = callback;
+  filter.payload = payload;
+  filter.pattern = pattern;
+  filter.prefix_len = strcspn(pattern, "*?[");
+  filter.fnmatch_needed =
+      pattern[filter.prefix_len] &&
+      !(pattern[filter.prefix_len] == '*' &&
+        pattern[filter.prefix_len + 1] == 0);
+  o->lazy_symbolize = 0;
+  return foreach_sym_core(path, sym_match_filter_cb, NULL, o, &filter);
+}
+
 int bcc_elf_get_text_scn_info(const char *path, uint64_t *addr,
                               uint64_t *offset) {
   int err;
@@ -962,6 +1276,66 @@ exit:
   return err;
 }
 
+static int copy_section(Elf *e, const char *name, void **out, size_t *out_sz) {
+  Elf_Data *data = get_section_elf_data(e, name);
+
+  if (!data || !data->d_buf || data->d_size == 0)
+    return -1;
+
+  *out = malloc(data->d_size);
+  if (!*out)
+    return -1;
+  memcpy(*out, data->d_buf, data->d_size);
+  *out_sz = data->d_size;
+  return 0;
+}
+
+int bcc_elf_get_dwarf_sections(const char *path,
+                               struct bcc_elf_dwarf_sections *out) {
+  struct bcc_elf_file elf_file;
+  struct bcc_elf_file debug_elf_file;
+  Elf *e;
+  int err = -1;
+
+  bcc_elf_file_init(&elf_file);
+  bcc_elf_file_init(&debug_elf_file);
+  memset(out, 0, sizeof(*out));
+
+  if (bcc_elf_file_open(path, &elf_file) < 0)
+    return -1;
+
+  e = elf_file.elf;
+  if (!get_section(e, ".debug_info", NULL, NULL) &&
+      find_debug_file(elf_file.elf, path, 1, &debug_elf_file) == 0)
+    e = debug_elf_file.elf;
+
+  if (copy_section(e, ".debug_info", &out->info, &out->info_sz) < 0 ||
+      copy_section(e, ".debug_abbrev", &out->abbrev, &out->abbrev_sz) < 0)
+    goto exit;
+
+  // Optional: small units can carry every string inline, and only DWARF5
+  // producers emit .debug_str_offsets.
+  copy_section(e, ".debug_str", &out->str, &out->str_sz);
+  copy_section(e, ".debug_str_offsets", &out->str_offsets,
+               &out->str_offsets_sz);
+  err = 0;
+
+exit:
+  if (err)
+    bcc_elf_free_dwarf_sections(out);
+  bcc_elf_file_close(&debug_elf_file);
+  bcc_elf_file_close(&elf_file);
+  return err;
+}
+
+void bcc_elf_free_dwarf_sections(struct bcc_elf_dwarf_sections *sections) {
+  free(sections->info);
+  free(sections->abbrev);
+  free(sections->str);
+  free(sections->str_offsets);
+  memset(sections, 0, sizeof(*sections));
+}
+
 int bcc_elf_foreach_load_section(const char *path,
                                  bcc_elf_load_sectioncb callback,
                                  void *payload) {
@@ -69,6 +69,15 @@ int bcc_elf_foreach_sym(const char *path, bcc_elf_symcb callback, void *option,
 // with symbolized string length
 int bcc_elf_foreach_sym_lazy(const char *path, bcc_elf_symcb_lazy callback,
                              void *option, void *payload);
+// Similar to bcc_elf_foreach_sym, but only invokes the callback for symbol
+// names matching pattern (fnmatch glob: * ? [], or a plain name). The
+// filter runs inside the scan: non-matching names are rejected on a
+// prefix compare before any callback crossing, and fnmatch only runs for
+// patterns more complex than <prefix> or <prefix>*. A NULL or empty
+// pattern matches everything.
+int bcc_elf_foreach_sym_matching(const char *path, bcc_elf_symcb callback,
+                                 void *option, const char *pattern,
+                                 void *payload);
 // Iterate over all symbols from current system's vDSO
 // Returns -1 on error, and 0 on success or stopped by callback
 int bcc_elf_foreach_vdso_sym(bcc_elf_symcb callback, void *payload);
@@ -76,6 +85,29 @@ int bcc_elf_foreach_vdso_sym(bcc_elf_symcb callback, void *payload);
 int bcc_elf_get_text_scn_info(const char *path, uint64_t *addr,
                               uint64_t *offset);
 
+// Raw DWARF debug sections of a binary, each a malloc'd copy. Sections
+// missing from the binary are left NULL with a zero size; str/str_offsets
+// are optional and may legitimately be absent.
+struct bcc_elf_dwarf_sections {
+  void *info;
+  size_t info_sz;
+  void *abbrev;
+  size_t abbrev_sz;
+  void *str;
+  size_t str_sz;
+  void *str_offsets;
+  size_t str_offsets_sz;
+};
+
+// Load the DWARF sections of a binary module. When the binary itself is
+// stripped, the separate debug file is located through the same lookup
+// chain the symbolizer uses (symfs, build-id, debuglink, debuginfod).
+// Returns -1 on error (no .debug_info/.debug_abbrev anywhere), 0 on
+// success; the caller frees with bcc_elf_free_dwarf_sections.
+int bcc_elf_get_dwarf_sections(const char *path,
+                               struct bcc_elf_dwarf_sections *out);
+void bcc_elf_free_dwarf_sections(struct bcc_elf_dwarf_sections *sections);
+
 int bcc_elf_get_type(const char *path);
 int bcc_elf_is_pie(const char *path);
 int bcc_elf_is_shared_obj(const char *path);
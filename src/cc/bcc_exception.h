@@ -17,10 +17,15 @@
 #pragma once
 
 #include <cstdio>
+#include <memory>
 #include <string>
 
 namespace ebpf {
 
+// Success carries no message: msg_ stays null and constructing, copying or
+// returning an OK status never touches the allocator, which matters on API
+// paths doing millions of table operations per second. The message string
+// is only materialized on error (or by append_msg).
 class StatusTuple {
 public:
   enum class Code {
@@ -36,26 +41,60 @@ public:
   };
 
   static StatusTuple OK() {
-    return StatusTuple(Code::OK, "");
+    return StatusTuple(0);
   }
 
   StatusTuple(int ret) : ret_(ret) {}
 
-  StatusTuple(int ret, const char *msg) : ret_(ret), msg_(msg) {}
+  StatusTuple(int ret, const char *msg) : ret_(ret) {
+    if (msg && msg[0])
+      msg_.reset(new std::string(msg));
+  }
 
-  StatusTuple(int ret, const std::string &msg) : ret_(ret), msg_(msg) {}
+  StatusTuple(int ret, const std::string &msg) : ret_(ret) {
+    if (!msg.empty())
+      msg_.reset(new std::string(msg));
+  }
 
   template <typename... Args>
   StatusTuple(int ret, const char *fmt, Args... args) : ret_(ret) {
     char buf[2048];
     snprintf(buf, sizeof(buf), fmt, args...);
-    msg_ = std::string(buf);
+    msg_.reset(new std::string(buf));
+  }
+
+  StatusTuple(Code code, const std::string &msg)
+      : use_enum_code_(true), code_(code) {
+    if (!msg.empty())
+      msg_.reset(new std::string(msg));
+  }
+
+  StatusTuple(const StatusTuple &other)
+      : ret_(other.ret_),
+        use_enum_code_(other.use_enum_code_),
+        code_(other.code_) {
+    if (other.msg_)
+      msg_.reset(new std::string(*other.msg_));
   }
 
-  StatusTuple(Code code, const std::string &msg) : use_enum_code_(true), code_(code), msg_(msg) {}
+  StatusTuple &operator=(const StatusTuple &other) {
+    if (this != &other) {
+      ret_ = other.ret_;
+      use_enum_code_ = other.use_enum_code_;
+      code_ = other.code_;
+      msg_.reset(other.msg_ ? new std::string(*other.msg_) : nullptr);
+    }
+    return *this;
+  }
+
+  StatusTuple(StatusTuple &&) = default;
+  StatusTuple &operator=(StatusTuple &&) = default;
 
   void append_msg(const std::string& msg) {
-    msg_ += msg;
+    if (msg_)
+      *msg_ += msg;
+    else if (!msg.empty())
+      msg_.reset(new std::string(msg));
   }
 
   bool ok() const {
@@ -72,7 +111,10 @@ public:
     return ret_;
   }
 
-  const std::string& msg() const { return msg_; }
+  const std::string& msg() const {
+    static const std::string empty;
+    return msg_ ? *msg_ : empty;
+  }
 
 private:
   int ret_;
@@ -80,7 +122,8 @@ private:
   bool use_enum_code_ = false;
   Code code_ = Code::UNKNOWN;
 
-  std::string msg_;
+  // null on the success path; only errors pay for a heap string
+  std::unique_ptr<std::string> msg_;
 };
 
 #define TRY2(CMD)                    \
@@ -15,10 +15,13 @@
  */
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "bcc_perf_map.h"
 
@@ -80,42 +83,156 @@ bool bcc_perf_map_path(char *map_path, size_t map_len, int pid) {
   return true;
 }
 
-int bcc_perf_map_foreach_sym(const char *path, bcc_perf_map_symcb callback,
-                             void* payload) {
-  FILE* file = fopen(path, "r");
-  if (!file)
-    return -1;
+// In-place hex parser over a non-NUL-terminated buffer. Returns a pointer
+// past the last digit consumed (an optional 0x prefix is accepted), or NULL
+// if no digits were found.
+static const char *parse_hex(const char *p, const char *end, uint64_t *out) {
+  const char *start = p;
+  uint64_t v = 0;
+
+  if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+    p += 2;
+  while (p < end) {
+    char c = *p;
+    int d;
+    if (c >= '0' && c <= '9')
+      d = c - '0';
+    else if (c >= 'a' && c <= 'f')
+      d = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F')
+      d = c - 'A' + 10;
+    else
+      break;
+    v = (v << 4) | d;
+    p++;
+  }
+  if (p == start)
+    return NULL;
+  *out = v;
+  return p;
+}
 
-  char *line = NULL;
-  size_t size = 0;
-  long long begin, len;
-  while (getline(&line, &size, file) != -1) {
-    char *cursor = line;
-    char *newline, *sep;
-
-    begin = strtoull(cursor, &sep, 16);
-    if (begin == 0 || *sep != ' ' || (begin == ULLONG_MAX && errno == ERANGE))
-      continue;
+// Parse every complete line in buf[0..len), invoking the callback per
+// symbol. Newlines are located with memchr (vectorized in libc) and the
+// address/length fields are decoded in place; only the symbol name is
+// copied, into a reusable buffer, to hand the callback a NUL-terminated
+// string. Returns the number of bytes consumed, always at a line boundary,
+// so an incomplete trailing line is left for the next call.
+static size_t perf_map_parse(const char *buf, size_t len,
+                             bcc_perf_map_symcb callback, void *payload) {
+  const char *p = buf, *end = buf + len;
+  char *name = NULL;
+  size_t name_cap = 0;
+
+  while (p < end) {
+    const char *nl = memchr(p, '\n', end - p);
+    const char *cursor = p, *sep;
+    uint64_t begin, sym_len;
+    size_t name_len;
+
+    if (!nl)
+      break;
+
+    sep = parse_hex(cursor, nl, &begin);
+    if (!sep || begin == 0 || sep >= nl || *sep != ' ')
+      goto next;
     cursor = sep;
-    while (*cursor && isspace(*cursor)) cursor++;
+    while (cursor < nl && isspace((unsigned char)*cursor)) cursor++;
 
-    len = strtoull(cursor, &sep, 16);
-    if (*sep != ' ' ||
-        (sep == cursor && len == 0) ||
-        (len == ULLONG_MAX && errno == ERANGE))
-      continue;
+    sep = parse_hex(cursor, nl, &sym_len);
+    if (!sep || sep >= nl || *sep != ' ')
+      goto next;
     cursor = sep;
-    while (*cursor && isspace(*cursor)) cursor++;
+    while (cursor < nl && isspace((unsigned char)*cursor)) cursor++;
+
+    name_len = nl - cursor;
+    if (name_len + 1 > name_cap) {
+      size_t cap = name_cap ? name_cap : 256;
+      char *tmp;
+      while (cap < name_len + 1)
+        cap *= 2;
+      tmp = realloc(name, cap);
+      if (!tmp)
+        break;
+      name = tmp;
+      name_cap = cap;
+    }
+    memcpy(name, cursor, name_len);
+    name[name_len] = '\0';
+
+    callback(name, begin, sym_len, payload);
+next:
+    p = nl + 1;
+  }
+
+  free(name);
+  return p - buf;
+}
 
-    newline = strchr(cursor, '\n');
-    if (newline)
-        newline[0] = '\0';
+int bcc_perf_map_foreach_sym_tail(const char *path,
+                                  bcc_perf_map_symcb callback, void *payload,
+                                  uint64_t *offset) {
+  uint64_t start = offset ? *offset : 0;
+  size_t map_len, consumed;
+  struct stat st;
+  char *buf;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
 
-    callback(cursor, begin, len, payload);
+  if ((uint64_t)st.st_size < start) {
+    // the file shrank, so the append-only assumption broke (truncated or
+    // replaced map): tell the caller to drop its symbols and start over
+    close(fd);
+    if (offset)
+      *offset = 0;
+    return 1;
+  }
+  if ((uint64_t)st.st_size == start) {
+    close(fd);
+    return 0;
   }
 
-  free(line);
-  fclose(file);
+  map_len = st.st_size;
+  buf = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (buf != MAP_FAILED) {
+    consumed =
+        start + perf_map_parse(buf + start, map_len - start, callback, payload);
+    munmap(buf, map_len);
+  } else {
+    // filesystems without mmap support: read the tail into a heap buffer
+    size_t tail_len = map_len - start;
+    ssize_t n;
+    char *heap = malloc(tail_len);
+    if (!heap) {
+      close(fd);
+      return -1;
+    }
+    n = pread(fd, heap, tail_len, (off_t)start);
+    if (n < 0) {
+      free(heap);
+      close(fd);
+      return -1;
+    }
+    consumed = start + perf_map_parse(heap, (size_t)n, callback, payload);
+    free(heap);
+  }
+  close(fd);
 
+  if (offset)
+    *offset = consumed;
   return 0;
 }
+
+int bcc_perf_map_foreach_sym(const char *path, bcc_perf_map_symcb callback,
+                             void* payload) {
+  uint64_t off = 0;
+  return bcc_perf_map_foreach_sym_tail(path, callback, payload, &off) < 0 ? -1
+                                                                          : 0;
+}
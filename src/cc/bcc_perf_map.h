@@ -34,6 +34,16 @@ int bcc_perf_map_nstgid(int pid);
 bool bcc_perf_map_path(char *map_path, size_t map_len, int pid);
 int bcc_perf_map_foreach_sym(const char *path, bcc_perf_map_symcb callback,
                              void* payload);
+// Incremental variant for append-only perf maps. Parsing starts at *offset
+// (0, or the value stored by a previous call) and consumes only complete
+// lines; *offset is advanced past the last full line so the next call picks
+// up appended entries only. If the file shrank below *offset (truncated or
+// replaced), nothing is parsed, *offset is reset to 0 and 1 is returned so
+// the caller can drop its symbols before reparsing. Returns 0 on success,
+// -1 on error.
+int bcc_perf_map_foreach_sym_tail(const char *path,
+                                  bcc_perf_map_symcb callback, void *payload,
+                                  uint64_t *offset);
 
 #ifdef __cplusplus
 }
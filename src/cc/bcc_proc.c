@@ -22,6 +22,7 @@
 #include <inttypes.h>
 #include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -218,17 +219,236 @@ int _procfs_maps_each_module(FILE *procmap, int pid,
   return -1;
 }
 
+// Parsed-module snapshot cache, keyed by pid. /proc/<pid>/maps exposes no
+// generation counter, so the raw text itself (length plus FNV-1a hash) is
+// the change detector: one sequential read replaces the per-line parsing
+// and the memfd/zip path resolution that dominate each_module on processes
+// with large address spaces. Identical text means an identical parse, so
+// replaying a snapshot is exact, not heuristic.
+struct maps_snapshot_mod {
+  mod_info info; // info.name owned by the snapshot
+  uint8_t enter_ns;
+};
+
+struct maps_snapshot {
+  int valid;
+  int pid;
+  uint64_t hash;
+  size_t len;
+  struct maps_snapshot_mod *mods;
+  size_t nmods;
+  size_t cap;
+};
+
+#define MAPS_CACHE_SLOTS 16
+static struct maps_snapshot maps_cache[MAPS_CACHE_SLOTS];
+static size_t maps_cache_next;
+static pthread_mutex_t maps_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t _maps_text_hash(const char *buf, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  size_t i;
+  for (i = 0; i < len; i++) {
+    h ^= (unsigned char)buf[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static void _maps_snapshot_free_contents(struct maps_snapshot *snap) {
+  size_t i;
+  for (i = 0; i < snap->nmods; i++)
+    free(snap->mods[i].info.name);
+  free(snap->mods);
+  memset(snap, 0, sizeof(*snap));
+}
+
+static char *_maps_read_all(FILE *f, size_t *len_out) {
+  size_t cap = 65536, len = 0, n;
+  char *buf = malloc(cap), *nbuf;
+  if (!buf)
+    return NULL;
+  for (;;) {
+    if (len == cap) {
+      cap *= 2;
+      nbuf = realloc(buf, cap);
+      if (!nbuf) {
+        free(buf);
+        return NULL;
+      }
+      buf = nbuf;
+    }
+    n = fread(buf + len, 1, cap - len, f);
+    len += n;
+    if (n == 0)
+      break;
+  }
+  *len_out = len;
+  return buf;
+}
+
+// Replays a matching snapshot through the callback. The entries are
+// duplicated under the lock so callbacks run without it (they may re-enter
+// this file for another pid). Returns 1 on a cache hit.
+static int _maps_snapshot_replay(int pid, uint64_t hash, size_t len,
+                                 bcc_procutils_modulecb callback,
+                                 void *payload) {
+  struct maps_snapshot_mod *copy = NULL;
+  size_t n = 0, i, j;
+  int found = 0;
+
+  pthread_mutex_lock(&maps_cache_mutex);
+  for (i = 0; i < MAPS_CACHE_SLOTS; i++) {
+    struct maps_snapshot *s = &maps_cache[i];
+    if (s->valid && s->pid == pid && s->hash == hash && s->len == len) {
+      found = 1;
+      n = s->nmods;
+      copy = malloc(n * sizeof(*copy) + 1);
+      if (!copy) {
+        found = 0;
+        break;
+      }
+      for (j = 0; j < n; j++) {
+        copy[j] = s->mods[j];
+        copy[j].info.name = strdup(s->mods[j].info.name);
+        if (!copy[j].info.name) {
+          while (j > 0)
+            free(copy[--j].info.name);
+          free(copy);
+          copy = NULL;
+          found = 0;
+          break;
+        }
+      }
+      break;
+    }
+  }
+  pthread_mutex_unlock(&maps_cache_mutex);
+  if (!found)
+    return 0;
+
+  for (i = 0; i < n; i++)
+    if (callback(&copy[i].info, copy[i].enter_ns, payload) < 0)
+      break;
+  for (i = 0; i < n; i++)
+    free(copy[i].info.name);
+  free(copy);
+  return 1;
+}
+
+static void _maps_snapshot_store(struct maps_snapshot *snap) {
+  struct maps_snapshot victim;
+  struct maps_snapshot *slot = NULL;
+  size_t i;
+
+  pthread_mutex_lock(&maps_cache_mutex);
+  for (i = 0; i < MAPS_CACHE_SLOTS; i++)
+    if (maps_cache[i].valid && maps_cache[i].pid == snap->pid) {
+      slot = &maps_cache[i];
+      break;
+    }
+  if (!slot)
+    slot = &maps_cache[maps_cache_next++ % MAPS_CACHE_SLOTS];
+  victim = *slot;
+  *slot = *snap;
+  slot->valid = 1;
+  pthread_mutex_unlock(&maps_cache_mutex);
+
+  memset(snap, 0, sizeof(*snap));
+  if (victim.valid)
+    _maps_snapshot_free_contents(&victim);
+}
+
+struct maps_record_ctx {
+  bcc_procutils_modulecb callback;
+  void *payload;
+  struct maps_snapshot snap;
+  int aborted;
+  int oom;
+};
+
+static int _maps_record_cb(mod_info *mod, int enter_ns, void *payload) {
+  struct maps_record_ctx *ctx = payload;
+  int rc;
+
+  if (!ctx->oom) {
+    if (ctx->snap.nmods == ctx->snap.cap) {
+      size_t ncap = ctx->snap.cap ? ctx->snap.cap * 2 : 64;
+      struct maps_snapshot_mod *nmods =
+          realloc(ctx->snap.mods, ncap * sizeof(*nmods));
+      if (nmods) {
+        ctx->snap.mods = nmods;
+        ctx->snap.cap = ncap;
+      } else {
+        ctx->oom = 1;
+      }
+    }
+    if (!ctx->oom) {
+      struct maps_snapshot_mod *rec = &ctx->snap.mods[ctx->snap.nmods];
+      rec->info = *mod;
+      rec->enter_ns = (uint8_t)enter_ns;
+      rec->info.name = strdup(mod->name);
+      if (rec->info.name)
+        ctx->snap.nmods++;
+      else
+        ctx->oom = 1;
+    }
+  }
+
+  rc = ctx->callback(mod, enter_ns, ctx->payload);
+  if (rc < 0)
+    ctx->aborted = 1;
+  return rc;
+}
+
 int bcc_procutils_each_module(int pid, bcc_procutils_modulecb callback,
                               void *payload) {
   char procmap_filename[128];
   FILE *procmap;
+  char *text;
+  size_t text_len = 0;
   snprintf(procmap_filename, sizeof(procmap_filename), "/proc/%ld/maps",
            (long)pid);
   procmap = fopen(procmap_filename, "r");
   if (!procmap)
     return -1;
 
-  _procfs_maps_each_module(procmap, pid, callback, payload);
+  text = _maps_read_all(procmap, &text_len);
+  fclose(procmap);
+  if (text) {
+    uint64_t hash = _maps_text_hash(text, text_len);
+    if (!_maps_snapshot_replay(pid, hash, text_len, callback, payload)) {
+      FILE *mem = fmemopen(text, text_len, "r");
+      if (mem) {
+        struct maps_record_ctx ctx = {callback, payload, {0}, 0, 0};
+        _procfs_maps_each_module(mem, pid, _maps_record_cb, &ctx);
+        fclose(mem);
+        if (!ctx.aborted && !ctx.oom) {
+          ctx.snap.pid = pid;
+          ctx.snap.hash = hash;
+          ctx.snap.len = text_len;
+          _maps_snapshot_store(&ctx.snap);
+        } else {
+          _maps_snapshot_free_contents(&ctx.snap);
+        }
+      } else {
+        free(text);
+        text = NULL;
+        procmap = fopen(procmap_filename, "r");
+        if (!procmap)
+          return -1;
+        _procfs_maps_each_module(procmap, pid, callback, payload);
+        fclose(procmap);
+      }
+    }
+    free(text);
+  } else {
+    procmap = fopen(procmap_filename, "r");
+    if (!procmap)
+      return -1;
+    _procfs_maps_each_module(procmap, pid, callback, payload);
+    fclose(procmap);
+  }
 
   // Address mapping for the entire address space maybe in /tmp/perf-<PID>.map
   // This will be used if symbols aren't resolved in an earlier mapping.
@@ -255,7 +475,6 @@ int bcc_procutils_each_module(int pid, bcc_procutils_modulecb callback,
   }
 
 done:
-  fclose(procmap);
   return 0;
 }
 
@@ -543,19 +762,119 @@ static bool which_so_in_ldconfig_cache(const char* libname, char* libpath) {
   return false;
 }
 
+/* Process-wide cache of short-name library resolutions, keyed by (libname,
+ * mount namespace of the target pid). Tools resolve the same handful of
+ * libraries ("c", "ssl", "pthread") over and over, each time rescanning
+ * /proc/<pid>/maps and the parsed ld.so.cache; with the cache a repeat
+ * resolution is one linear scan of a few dozen entries under a mutex.
+ * Negative results are cached too. Processes sharing a mount namespace are
+ * assumed to see the same library set; set BCC_NO_WHICH_SO_CACHE to bypass
+ * the cache if that assumption does not hold for a workload. */
+struct which_so_entry {
+  char *libname;
+  uint64_t mntns;
+  char *path; /* NULL: negative result */
+};
+static struct which_so_entry *which_so_cache;
+static int which_so_cache_count;
+static int which_so_cache_cap;
+static pthread_mutex_t which_so_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Mount namespace id (inode of /proc/<pid>/ns/mnt; self when pid is 0).
+ * Returns 0 when it cannot be determined, which disables caching for the
+ * call rather than conflating unknown namespaces. */
+static uint64_t procutils_mntns_of(int pid) {
+  char nspath[64];
+  struct stat st;
+
+  if (pid)
+    snprintf(nspath, sizeof(nspath), "/proc/%d/ns/mnt", pid);
+  else
+    snprintf(nspath, sizeof(nspath), "/proc/self/ns/mnt");
+  if (stat(nspath, &st) < 0)
+    return 0;
+  return st.st_ino;
+}
+
+static struct which_so_entry *which_so_cache_find(const char *libname,
+                                                  uint64_t mntns) {
+  int i;
+
+  for (i = 0; i < which_so_cache_count; ++i) {
+    if (which_so_cache[i].mntns == mntns &&
+        !strcmp(which_so_cache[i].libname, libname))
+      return &which_so_cache[i];
+  }
+  return NULL;
+}
+
+static void which_so_cache_store(const char *libname, uint64_t mntns,
+                                 const char *path) {
+  struct which_so_entry *entry;
+
+  if (which_so_cache_count == which_so_cache_cap) {
+    int new_cap = which_so_cache_cap ? which_so_cache_cap * 2 : 16;
+    struct which_so_entry *tmp =
+        realloc(which_so_cache, new_cap * sizeof(*which_so_cache));
+    if (!tmp)
+      return;
+    which_so_cache = tmp;
+    which_so_cache_cap = new_cap;
+  }
+
+  entry = &which_so_cache[which_so_cache_count];
+  entry->libname = strdup(libname);
+  if (!entry->libname)
+    return;
+  entry->mntns = mntns;
+  entry->path = path ? strdup(path) : NULL;
+  if (path && !entry->path) {
+    free(entry->libname);
+    return;
+  }
+  which_so_cache_count++;
+}
+
 char *bcc_procutils_which_so(const char *libname, int pid) {
   char libpath[PATH_MAX];
+  struct which_so_entry *entry;
+  uint64_t mntns = 0;
+  bool found;
 
   if (strchr(libname, '/'))
     return strdup(libname);
 
-  if (pid && which_so_in_process(libname, pid, libpath))
-    return strdup(libpath);
+  if (!getenv("BCC_NO_WHICH_SO_CACHE"))
+    mntns = procutils_mntns_of(pid);
 
-  if (which_so_in_ldconfig_cache(libname, libpath))
-    return strdup(libpath);
+  if (mntns) {
+    char *res = NULL;
+    bool hit = false;
 
-  return NULL;
+    pthread_mutex_lock(&which_so_cache_mutex);
+    entry = which_so_cache_find(libname, mntns);
+    if (entry) {
+      hit = true;
+      if (entry->path)
+        res = strdup(entry->path);
+    }
+    pthread_mutex_unlock(&which_so_cache_mutex);
+    if (hit)
+      return res;
+  }
+
+  found = (pid && which_so_in_process(libname, pid, libpath)) ||
+          which_so_in_ldconfig_cache(libname, libpath);
+
+  if (mntns) {
+    pthread_mutex_lock(&which_so_cache_mutex);
+    /* a racing resolver may have filled the slot; first entry wins */
+    if (!which_so_cache_find(libname, mntns))
+      which_so_cache_store(libname, mntns, found ? libpath : NULL);
+    pthread_mutex_unlock(&which_so_cache_mutex);
+  }
+
+  return found ? strdup(libpath) : NULL;
 }
 
 char *bcc_procutils_which_so_in_process(const char *libname, int pid) {
@@ -574,7 +893,7 @@ const char *languages[] = {"java", "node", "perl", "php", "python", "ruby"};
 const char *language_c = "c";
 const int nb_languages = 6;
 
-const char *bcc_procutils_language(int pid) {
+static const char *procutils_language_scan(int pid) {
   char procfilename[24], line[4096], pathname[32], *str;
   FILE *procfile;
   int i, ret;
@@ -625,3 +944,113 @@ const char *bcc_procutils_language(int pid) {
   /* Return C as the language if libc was found and nothing else. */
   return libc ? language_c : NULL;
 }
+
+/* A process's language never changes, so cache scan results keyed on
+ * pid + starttime (/proc/<pid>/stat field 22, in clock ticks since boot),
+ * which together identify one process lifetime: fleet scanners sweeping
+ * the same pids every interval pay the exe/maps scan once per process
+ * instead of once per sweep. Entries for exited pids linger until the pid
+ * is recycled, bounded by the pid space. Results point into languages[]
+ * (or language_c), so no ownership moves. BCC_NO_LANGUAGE_CACHE in the
+ * environment disables the cache. */
+struct lang_cache_entry {
+  int pid;
+  uint64_t starttime;
+  const char *lang; /* static string, or NULL when nothing was detected */
+  struct lang_cache_entry *next;
+};
+
+#define LANG_CACHE_BUCKETS 1024
+static struct lang_cache_entry *lang_cache[LANG_CACHE_BUCKETS];
+static pthread_mutex_t lang_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* starttime of pid, or 0 when the process cannot be inspected (which
+ * disables caching for the call rather than conflating lifetimes) */
+static uint64_t procutils_starttime_of(int pid) {
+  char statpath[40], buf[512], *p;
+  unsigned long long starttime;
+  int i, fd, n;
+
+  snprintf(statpath, sizeof(statpath), "/proc/%d/stat", pid);
+  fd = open(statpath, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return 0;
+  buf[n] = '\0';
+
+  /* comm may contain spaces and parens; fields resume after the last ')' */
+  p = strrchr(buf, ')');
+  if (!p)
+    return 0;
+  p++;
+  for (i = 0; i < 19; i++) { /* skip state (field 3) .. itrealvalue (21) */
+    p = strchr(p + 1, ' ');
+    if (!p)
+      return 0;
+  }
+  if (sscanf(p, "%llu", &starttime) != 1)
+    return 0;
+  return starttime;
+}
+
+const char *bcc_procutils_language(int pid) {
+  struct lang_cache_entry *entry;
+  uint64_t starttime;
+  const char *lang;
+  unsigned bucket;
+
+  if (getenv("BCC_NO_LANGUAGE_CACHE"))
+    return procutils_language_scan(pid);
+  starttime = procutils_starttime_of(pid);
+  if (!starttime)
+    return procutils_language_scan(pid);
+
+  bucket = (unsigned)pid & (LANG_CACHE_BUCKETS - 1);
+  pthread_mutex_lock(&lang_cache_mutex);
+  for (entry = lang_cache[bucket]; entry; entry = entry->next)
+    if (entry->pid == pid)
+      break;
+  if (entry && entry->starttime == starttime) {
+    lang = entry->lang;
+    pthread_mutex_unlock(&lang_cache_mutex);
+    return lang;
+  }
+  pthread_mutex_unlock(&lang_cache_mutex);
+
+  lang = procutils_language_scan(pid);
+
+  pthread_mutex_lock(&lang_cache_mutex);
+  for (entry = lang_cache[bucket]; entry; entry = entry->next)
+    if (entry->pid == pid)
+      break;
+  if (entry) {
+    /* recycled pid (or a racing scan got here first): latest result wins */
+    entry->starttime = starttime;
+    entry->lang = lang;
+  } else {
+    entry = malloc(sizeof(*entry));
+    if (entry) {
+      entry->pid = pid;
+      entry->starttime = starttime;
+      entry->lang = lang;
+      entry->next = lang_cache[bucket];
+      lang_cache[bucket] = entry;
+    }
+  }
+  pthread_mutex_unlock(&lang_cache_mutex);
+  return lang;
+}
+
+int bcc_procutils_language_batch(const int *pids, const char **langs, int n) {
+  int i, detected = 0;
+
+  for (i = 0; i < n; i++) {
+    langs[i] = bcc_procutils_language(pids[i]);
+    if (langs[i])
+      detected++;
+  }
+  return detected;
+}
@@ -67,7 +67,16 @@ int _procfs_maps_each_module(FILE *procmaps, int pid,
 // Returns -1 on error, and 0 on success
 int bcc_procutils_each_ksym(bcc_procutils_ksymcb callback, void *payload);
 void bcc_procutils_free(const char *ptr);
+// Detect the process's runtime ("java", "node", "perl", "php", "python",
+// "ruby", or "c"); NULL when nothing is recognized. Results are cached
+// per process lifetime (pid + starttime), so repeated queries for a live
+// process cost a hash lookup instead of re-scanning its maps; set
+// BCC_NO_LANGUAGE_CACHE to disable. The returned string is static — do
+// not free it.
 const char *bcc_procutils_language(int pid);
+// Detect n pids in one call, filling langs[i] for pids[i]; returns the
+// number of pids with a detected language.
+int bcc_procutils_language_batch(const int *pids, const char **langs, int n);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2022 The BCC Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bcc_stats.h"
+
+static struct bcc_stats g_stats;
+
+static struct bcc_trace_span g_trace[BCC_TRACE_MAX_SPANS];
+static uint64_t g_trace_cnt;
+
+void bcc_stats_add(enum bcc_stat_id id, uint64_t delta) {
+  if ((int)id < 0 || id >= BCC_STAT_MAX)
+    return;
+  __atomic_fetch_add(&g_stats.counters[id], delta, __ATOMIC_RELAXED);
+}
+
+uint64_t bcc_stats_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void bcc_stats_record_compile_ns(uint64_t ns) {
+  int bucket = 0;
+  uint64_t v = ns;
+
+  bcc_stats_add(BCC_STAT_COMPILE_COUNT, 1);
+  bcc_stats_add(BCC_STAT_COMPILE_NS, ns);
+
+  while (v >>= 1)
+    bucket++;
+  if (bucket >= BCC_STATS_NS_HIST_SIZE)
+    bucket = BCC_STATS_NS_HIST_SIZE - 1;
+  __atomic_fetch_add(&g_stats.compile_ns_hist[bucket], 1, __ATOMIC_RELAXED);
+}
+
+void bcc_get_stats(struct bcc_stats *stats) {
+  int i;
+
+  for (i = 0; i < BCC_STAT_MAX; i++)
+    stats->counters[i] =
+        __atomic_load_n(&g_stats.counters[i], __ATOMIC_RELAXED);
+  for (i = 0; i < BCC_STATS_NS_HIST_SIZE; i++)
+    stats->compile_ns_hist[i] =
+        __atomic_load_n(&g_stats.compile_ns_hist[i], __ATOMIC_RELAXED);
+}
+
+uint64_t bcc_trace_begin(void) {
+  return bcc_stats_now_ns();
+}
+
+void bcc_trace_end(const char *name, uint64_t begin_ns) {
+  uint64_t end_ns = bcc_stats_now_ns();
+  uint64_t idx = __atomic_fetch_add(&g_trace_cnt, 1, __ATOMIC_RELAXED);
+
+  if (idx >= BCC_TRACE_MAX_SPANS)
+    return;
+  g_trace[idx].name = name;
+  g_trace[idx].begin_ns = begin_ns;
+  g_trace[idx].end_ns = end_ns;
+  g_trace[idx].tid = syscall(__NR_gettid);
+}
+
+size_t bcc_get_trace(struct bcc_trace_span *spans, size_t max_spans) {
+  uint64_t cnt = __atomic_load_n(&g_trace_cnt, __ATOMIC_RELAXED);
+  size_t i, n;
+
+  if (cnt > BCC_TRACE_MAX_SPANS)
+    cnt = BCC_TRACE_MAX_SPANS;
+  n = cnt < max_spans ? cnt : max_spans;
+  for (i = 0; i < n; i++)
+    spans[i] = g_trace[i];
+  return n;
+}
+
+void bcc_trace_reset(void) {
+  __atomic_store_n(&g_trace_cnt, 0, __ATOMIC_RELAXED);
+}
+
+int bcc_trace_dump_json(const char *path) {
+  uint64_t cnt = __atomic_load_n(&g_trace_cnt, __ATOMIC_RELAXED);
+  FILE *f;
+  uint64_t i;
+
+  if (cnt > BCC_TRACE_MAX_SPANS)
+    cnt = BCC_TRACE_MAX_SPANS;
+  f = fopen(path, "w");
+  if (!f)
+    return -1;
+  /* chrome trace "complete" events; timestamps in microseconds */
+  fprintf(f, "{\"traceEvents\":[");
+  for (i = 0; i < cnt; i++) {
+    struct bcc_trace_span *s = &g_trace[i];
+    uint64_t dur = s->end_ns - s->begin_ns;
+    fprintf(f,
+            "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,"
+            "\"tid\":%" PRIu64 ",\"ts\":%" PRIu64 ".%03" PRIu64
+            ",\"dur\":%" PRIu64 ".%03" PRIu64 "}",
+            i ? "," : "", s->name, getpid(), s->tid, s->begin_ns / 1000,
+            s->begin_ns % 1000, dur / 1000, dur % 1000);
+  }
+  fprintf(f, "]}\n");
+  if (fclose(f) != 0)
+    return -1;
+  return 0;
+}
+
+void bcc_stats_reset(void) {
+  int i;
+
+  for (i = 0; i < BCC_STAT_MAX; i++)
+    __atomic_store_n(&g_stats.counters[i], 0, __ATOMIC_RELAXED);
+  for (i = 0; i < BCC_STATS_NS_HIST_SIZE; i++)
+    __atomic_store_n(&g_stats.compile_ns_hist[i], 0, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2022 The BCC Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef BCC_STATS_H
+#define BCC_STATS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Always-on internal counters for the library's own hot paths: compile,
+ * perf ring consumption, symbolization and map syscalls. Updates are
+ * single relaxed atomic adds, cheap enough to stay enabled in production.
+ */
+
+enum bcc_stat_id {
+  BCC_STAT_COMPILE_COUNT = 0, /* frontend compilations */
+  BCC_STAT_COMPILE_NS,        /* total time spent in ClangLoader::parse */
+  BCC_STAT_PERF_READS,        /* perf_reader_event_read invocations */
+  BCC_STAT_PERF_EVENTS,       /* samples delivered to callbacks */
+  BCC_STAT_PERF_LOST,         /* samples the kernel reported lost */
+  BCC_STAT_SYM_HITS,          /* symcache resolutions that found a symbol */
+  BCC_STAT_SYM_MISSES,
+  BCC_STAT_MAP_LOOKUPS,       /* per-element map syscalls (C++ table API) */
+  BCC_STAT_MAP_UPDATES,
+  BCC_STAT_MAP_DELETES,
+  BCC_STAT_MAP_BATCH_OPS,     /* batch map syscalls */
+  BCC_STAT_MAX
+};
+
+#define BCC_STATS_NS_HIST_SIZE 32
+
+struct bcc_stats {
+  uint64_t counters[BCC_STAT_MAX];
+  /* log2(duration in ns) histogram of frontend compilations */
+  uint64_t compile_ns_hist[BCC_STATS_NS_HIST_SIZE];
+};
+
+/* snapshot / reset the process-wide stats */
+void bcc_get_stats(struct bcc_stats *stats);
+void bcc_stats_reset(void);
+
+/* instrumentation hooks used inside the library */
+void bcc_stats_add(enum bcc_stat_id id, uint64_t delta);
+uint64_t bcc_stats_now_ns(void);
+void bcc_stats_record_compile_ns(uint64_t ns);
+
+/* Structured startup trace: a bounded ring of span records (phase name,
+ * begin/end ns, thread) covering the internal phases of program
+ * initialization -- frontend compile, codegen, map creation, BTF upload.
+ * Recording is always on and costs two clock reads per span; once the
+ * ring is full further spans are dropped. Span names must be string
+ * literals (the pointers are stored, not copied).
+ */
+#define BCC_TRACE_MAX_SPANS 256
+
+struct bcc_trace_span {
+  const char *name;
+  uint64_t begin_ns;
+  uint64_t end_ns;
+  uint64_t tid;
+};
+
+/* take a begin timestamp / record the span ending now */
+uint64_t bcc_trace_begin(void);
+void bcc_trace_end(const char *name, uint64_t begin_ns);
+
+/* copy up to max_spans recorded spans into spans, returning the count */
+size_t bcc_get_trace(struct bcc_trace_span *spans, size_t max_spans);
+void bcc_trace_reset(void);
+
+/* write the recorded spans as a chrome://tracing (Perfetto-loadable) JSON
+ * file; returns 0 on success, -1 on I/O error */
+int bcc_trace_dump_json(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
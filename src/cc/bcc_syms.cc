@@ -22,18 +22,31 @@
 #include <linux/elf.h>
 #include <signal.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <atomic>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "bcc_elf.h"
 #include "bcc_perf_map.h"
 #include "bcc_proc.h"
+#include "bcc_stats.h"
 #include "common.h"
+#include "libbpf.h"
+#include "perf_reader.h"
 #include "syms.h"
 #include "vendor/tinyformat.hpp"
 
@@ -115,57 +128,395 @@ ProcStat::ProcStat(int pid)
 
 void KSyms::_add_symbol(const char *symname, const char *modname, uint64_t addr, void *p) {
   KSyms *ks = static_cast<KSyms *>(p);
-  ks->syms_.emplace_back(symname, modname, addr);
+  if (ks->mod_filter_ &&
+      ks->mod_filter_->find(modname) == ks->mod_filter_->end())
+    return;
+  ks->segments_[modname].syms.emplace_back(symname, modname, addr);
+}
+
+// Sort the given segments; each is small, so with BCC_SYMBOLIZE_THREADS > 1
+// the sorts run on a worker team, one segment per task.
+void KSyms::finalize_segments(std::vector<ModSegment *> dirty) {
+  int threads_requested = 0;
+  const char *env = ::getenv("BCC_SYMBOLIZE_THREADS");
+  if (env)
+    threads_requested = ::atoi(env);
+
+  if (threads_requested > 1 && dirty.size() > 1) {
+    size_t nthreads = std::min((size_t)threads_requested, dirty.size());
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < nthreads; i++)
+      workers.emplace_back([&] {
+        for (size_t idx = next++; idx < dirty.size(); idx = next++)
+          std::sort(dirty[idx]->syms.begin(), dirty[idx]->syms.end());
+      });
+    for (auto &w : workers)
+      w.join();
+    return;
+  }
+
+  for (auto seg : dirty)
+    std::sort(seg->syms.begin(), seg->syms.end());
 }
 
+// Rebuild the top-level range index: one entry per segment, sorted by the
+// segment's first address. Module ranges are disjoint, so the segment with
+// the greatest start not above an address holds its preceding symbol.
+void KSyms::build_ranges() {
+  ranges_.clear();
+  ranges_.reserve(segments_.size());
+  for (const auto &it : segments_)
+    if (!it.second.syms.empty())
+      ranges_.emplace_back(it.second.syms.front().addr, &it.second);
+  std::sort(ranges_.begin(), ranges_.end());
+}
+
+// Read the names of the currently loaded modules from /proc/modules; an
+// empty set on failure.
+static std::unordered_set<std::string> read_module_set() {
+  std::unordered_set<std::string> mods;
+  std::ifstream f("/proc/modules");
+  std::string line;
+  while (std::getline(f, line))
+    mods.insert(line.substr(0, line.find(' ')));
+  return mods;
+}
+
+// Layout of the host-wide shared kernel symbol cache, published as a packed
+// file under /dev/shm when BCC_KSYMS_SHM is set. The file is written to a
+// temporary name and renamed into place, so readers only ever see complete
+// snapshots; a snapshot is identified by the hash of the module set it was
+// built from, and readers whose module set differs fall back to a private
+// table. All offsets are relative so the mapping is position-independent.
+struct ksym_shm_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t nsyms;
+  uint32_t reserved;
+  uint64_t mods_hash;
+  uint64_t strtab_off; // from the start of the mapping
+};
+
+struct ksym_shm_entry {
+  uint64_t addr;
+  uint32_t name_off; // into the string table
+  uint32_t mod_off;
+};
+
+static const uint32_t KSYM_SHM_MAGIC = 0x4d534b42; // "BKSM"
+static const uint32_t KSYM_SHM_VERSION = 1;
+static const char KSYM_SHM_PATH[] = "/dev/shm/bcc_ksyms";
+
+// order-independent hash of the loaded module set
+static uint64_t hash_module_set(const std::unordered_set<std::string> &mods) {
+  uint64_t h = 0;
+  for (const auto &mod : mods)
+    h ^= std::hash<std::string>()(mod);
+  return h;
+}
+
+static bool write_all(int fd, const void *buf, size_t len) {
+  const char *p = static_cast<const char *>(buf);
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool KSyms::shm_load(uint64_t mods_hash) {
+  int fd = ::open(KSYM_SHM_PATH, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ksym_shm_header)) {
+    ::close(fd);
+    return false;
+  }
+  void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (base == MAP_FAILED)
+    return false;
+  const ksym_shm_header *hdr = static_cast<const ksym_shm_header *>(base);
+  if (hdr->magic != KSYM_SHM_MAGIC || hdr->version != KSYM_SHM_VERSION ||
+      hdr->mods_hash != mods_hash ||
+      sizeof(*hdr) + (uint64_t)hdr->nsyms * sizeof(ksym_shm_entry) >
+          (uint64_t)st.st_size ||
+      hdr->strtab_off > (uint64_t)st.st_size) {
+    munmap(base, st.st_size);
+    return false;
+  }
+  shm_base_ = base;
+  shm_size_ = st.st_size;
+  return true;
+}
+
+void KSyms::shm_publish(uint64_t mods_hash) const {
+  // serialize the sorted array with a deduplicated string table
+  std::unordered_map<std::string, uint32_t> interned;
+  std::string strtab;
+  auto intern = [&](const std::string &s) -> uint32_t {
+    auto it = interned.find(s);
+    if (it != interned.end())
+      return it->second;
+    uint32_t off = strtab.size();
+    interned[s] = off;
+    strtab.append(s.c_str(), s.size() + 1);
+    return off;
+  };
+
+  // walk the range index so the packed array comes out globally sorted
+  std::vector<ksym_shm_entry> entries;
+  for (const auto &range : ranges_)
+    for (const auto &sym : range.second->syms)
+      entries.push_back({sym.addr, intern(sym.name), intern(sym.mod)});
+
+  ksym_shm_header hdr = {
+      KSYM_SHM_MAGIC, KSYM_SHM_VERSION, (uint32_t)entries.size(), 0,
+      mods_hash,
+      sizeof(hdr) + entries.size() * sizeof(ksym_shm_entry)};
+
+  char tmp[sizeof(KSYM_SHM_PATH) + 32];
+  snprintf(tmp, sizeof(tmp), "%s.tmp.%d", KSYM_SHM_PATH, (int)getpid());
+  int fd = ::open(tmp, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return;
+  bool ok = write_all(fd, &hdr, sizeof(hdr)) &&
+            write_all(fd, entries.data(),
+                      entries.size() * sizeof(ksym_shm_entry)) &&
+            write_all(fd, strtab.data(), strtab.size());
+  ::close(fd);
+  if (!ok || ::rename(tmp, KSYM_SHM_PATH) < 0)
+    ::unlink(tmp);
+}
+
+void KSyms::shm_detach() {
+  if (shm_base_) {
+    munmap(shm_base_, shm_size_);
+    shm_base_ = nullptr;
+    shm_size_ = 0;
+  }
+}
+
+KSyms::~KSyms() { shm_detach(); }
+
 void KSyms::refresh() {
-  if (syms_.empty()) {
+  std::unique_lock<std::shared_timed_mutex> guard(mutex_);
+  refresh_locked();
+}
+
+void KSyms::refresh_locked() {
+  if (!segments_.empty() || shm_base_)
+    return;
+  mods_ = read_module_set();
+  uint64_t h = 0;
+  bool use_shm = ::getenv("BCC_KSYMS_SHM") != nullptr;
+  if (use_shm) {
+    h = hash_module_set(mods_);
+    if (shm_load(h))
+      return;
+  }
+
+  bcc_procutils_each_ksym(_add_symbol, this);
+  std::vector<ModSegment *> dirty;
+  dirty.reserve(segments_.size());
+  for (auto &it : segments_)
+    dirty.push_back(&it.second);
+  finalize_segments(std::move(dirty));
+  build_ranges();
+  symnames_stale_ = true;
+
+  if (use_shm && !segments_.empty())
+    shm_publish(h);
+}
+
+// Reconcile the per-module segments with the current module set: unloaded
+// modules just drop their segment, newly loaded ones get a fresh segment
+// from a filtered kallsyms scan; the other ~150 segments are untouched and
+// only the small range index is rebuilt. Returns whether the module set
+// changed at all.
+bool KSyms::refresh_incremental() {
+  std::unordered_set<std::string> mods = read_module_set();
+  if (mods == mods_)
+    return false;
+
+  if (shm_base_) {
+    // the shared snapshot was built from a different module set; fall back
+    // to a private table (refresh() also republishes it for other readers)
+    shm_detach();
+    symnames_.clear();
+    refresh_locked();
+    return true;
+  }
+
+  for (auto it = segments_.begin(); it != segments_.end();) {
+    if (it->first != "kernel" && mods.find(it->first) == mods.end())
+      it = segments_.erase(it);
+    else
+      ++it;
+  }
+
+  std::unordered_set<std::string> added;
+  for (const auto &mod : mods)
+    if (mods_.find(mod) == mods_.end())
+      added.insert(mod);
+  mods_ = std::move(mods);
+
+  if (!added.empty()) {
+    mod_filter_ = &added;
     bcc_procutils_each_ksym(_add_symbol, this);
-    std::sort(syms_.begin(), syms_.end());
+    mod_filter_ = nullptr;
+    std::vector<ModSegment *> dirty;
+    for (const auto &mod : added) {
+      auto it = segments_.find(mod);
+      if (it != segments_.end())
+        dirty.push_back(&it->second);
+    }
+    finalize_segments(std::move(dirty));
+  }
+
+  build_ranges();
+  symnames_stale_ = true;
+  return true;
+}
+
+// Search the already-built tables only; a pure read, safe under the shared
+// side of mutex_ so any number of threads can resolve concurrently.
+bool KSyms::lookup_addr(uint64_t addr, struct bcc_symbol *sym,
+                        bool demangle) const {
+  if (shm_base_) {
+    // search the shared packed array; the returned strings point into the
+    // read-only mapping and stay valid for the lifetime of this KSyms
+    const ksym_shm_header *hdr =
+        static_cast<const ksym_shm_header *>(shm_base_);
+    const ksym_shm_entry *ents = reinterpret_cast<const ksym_shm_entry *>(
+        static_cast<const uint8_t *>(shm_base_) + sizeof(*hdr));
+    const char *strtab =
+        static_cast<const char *>(shm_base_) + hdr->strtab_off;
+    const ksym_shm_entry *it = std::upper_bound(
+        ents, ents + hdr->nsyms, addr,
+        [](uint64_t a, const ksym_shm_entry &e) { return a < e.addr; });
+    if (it != ents) {
+      it--;
+      sym->name = strtab + it->name_off;
+      if (demangle)
+        sym->demangle_name = sym->name;
+      sym->module = strtab + it->mod_off;
+      sym->offset = addr - it->addr;
+      return true;
+    }
+    return false;
+  }
+
+  if (ranges_.empty())
+    return false;
+
+  // pick the segment whose range covers addr, then search only its
+  // sorted symbols; two binary searches over ~150 ranges plus one
+  // module's symbols instead of one over every kernel symbol
+  auto rit = std::upper_bound(
+      ranges_.begin(), ranges_.end(), addr,
+      [](uint64_t a, const std::pair<uint64_t, const ModSegment *> &r) {
+        return a < r.first;
+      });
+  if (rit != ranges_.begin()) {
+    const ModSegment *seg = std::prev(rit)->second;
+    auto it = std::upper_bound(seg->syms.begin(), seg->syms.end(),
+                               Symbol("", "", addr));
+    if (it != seg->syms.begin()) {
+      it--;
+      sym->name = (*it).name.c_str();
+      if (demangle)
+        sym->demangle_name = sym->name;
+      sym->module = (*it).mod.c_str();
+      sym->offset = addr - (*it).addr;
+      return true;
+    }
   }
+  return false;
 }
 
 bool KSyms::resolve_addr(uint64_t addr, struct bcc_symbol *sym, bool demangle) {
-  refresh();
+  {
+    // warm path: the tables are already built and cover the address, so the
+    // lookup runs under the shared lock, concurrently with other readers
+    std::shared_lock<std::shared_timed_mutex> guard(mutex_);
+    if ((shm_base_ || !ranges_.empty()) && lookup_addr(addr, sym, demangle))
+      return true;
+  }
 
-  std::vector<Symbol>::iterator it;
+  // cold cache or miss: take the exclusive side for the initial kallsyms
+  // scan or an incremental module merge, then retry the lookup
+  std::unique_lock<std::shared_timed_mutex> guard(mutex_);
+  refresh_locked();
 
-  if (syms_.empty())
-    goto unknown_symbol;
+  for (int pass = 0; pass < 2; pass++) {
+    if (lookup_addr(addr, sym, demangle))
+      return true;
 
-  it = std::upper_bound(syms_.begin(), syms_.end(), Symbol("", "", addr));
-  if (it != syms_.begin()) {
-    it--;
-    sym->name = (*it).name.c_str();
-    if (demangle)
-      sym->demangle_name = sym->name;
-    sym->module = (*it).mod.c_str();
-    sym->offset = addr - (*it).addr;
-    return true;
+    // a module load since the last scan may explain the miss; merge any new
+    // modules' symbols and retry once
+    if (pass == 0 && !refresh_incremental())
+      break;
   }
 
-unknown_symbol:
   memset(sym, 0, sizeof(struct bcc_symbol));
   return false;
 }
 
 bool KSyms::resolve_name(const char *_unused, const char *name,
                          uint64_t *addr) {
-  refresh();
-
-  if (syms_.size() != symnames_.size()) {
-    symnames_.clear();
-    for (Symbol &sym : syms_) {
-      symnames_[sym.name] = sym.addr;
+  {
+    // warm path: a hit in the already-built name index is a pure read
+    std::shared_lock<std::shared_timed_mutex> guard(mutex_);
+    auto it = symnames_.find(name);
+    if (it != symnames_.end()) {
+      *addr = it->second;
+      return true;
     }
   }
 
-  auto it = symnames_.find(name);
-  if (it == symnames_.end())
-    return false;
+  // cold index or miss: build or merge under the exclusive lock and retry
+  std::unique_lock<std::shared_timed_mutex> guard(mutex_);
+  refresh_locked();
+
+  for (int pass = 0; pass < 2; pass++) {
+    if (shm_base_) {
+      // name lookups still need a private index; build it once from the
+      // shared array on the first resolve_name call
+      const ksym_shm_header *hdr =
+          static_cast<const ksym_shm_header *>(shm_base_);
+      if (symnames_.empty() && hdr->nsyms > 0) {
+        const ksym_shm_entry *ents = reinterpret_cast<const ksym_shm_entry *>(
+            static_cast<const uint8_t *>(shm_base_) + sizeof(*hdr));
+        const char *strtab =
+            static_cast<const char *>(shm_base_) + hdr->strtab_off;
+        for (uint32_t i = 0; i < hdr->nsyms; i++)
+          symnames_[strtab + ents[i].name_off] = ents[i].addr;
+      }
+    } else if (symnames_stale_) {
+      symnames_.clear();
+      for (const auto &seg : segments_)
+        for (const Symbol &sym : seg.second.syms)
+          symnames_[sym.name] = sym.addr;
+      symnames_stale_ = false;
+    }
 
-  *addr = it->second;
-  return true;
+    auto it = symnames_.find(name);
+    if (it != symnames_.end()) {
+      *addr = it->second;
+      return true;
+    }
+
+    if (pass == 0 && !refresh_incremental())
+      break;
+  }
+
+  return false;
 }
 
 ProcSyms::ProcSyms(int pid, struct bcc_symbol_option *option)
@@ -182,13 +533,105 @@ ProcSyms::ProcSyms(int pid, struct bcc_symbol_option *option)
   load_modules();
 }
 
+ProcSyms::~ProcSyms() {
+  disable_mmap_tracking();
+}
+
+int ProcSyms::enable_mmap_tracking() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (mmap_reader_)
+    return 0;
+  if (pid_ < 0)
+    return -1;
+  mmap_reader_ = static_cast<struct perf_reader *>(
+      bpf_open_perf_mmap_tracker(_mmap_record_cb, this, pid_, 8));
+  return mmap_reader_ ? 0 : -1;
+}
+
+void ProcSyms::disable_mmap_tracking() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (mmap_reader_) {
+    perf_reader_free(mmap_reader_);
+    mmap_reader_ = nullptr;
+  }
+}
+
+void ProcSyms::_mmap_record_cb(void *cookie, int pid, uint64_t addr,
+                               uint64_t len, uint64_t pgoff,
+                               const char *filename) {
+  ProcSyms *ps = static_cast<ProcSyms *>(cookie);
+  // anonymous, special and JIT mappings carry no ELF to parse; perf maps
+  // keep going through the refresh path
+  if (pid != ps->pid_ || !filename || filename[0] != '/')
+    return;
+  mod_info mod = {};
+  mod.name = const_cast<char *>(filename);
+  mod.start_addr = addr;
+  mod.end_addr = addr + len;
+  mod.file_offset = pgoff;
+  // the lock is already held: this only runs under drain_mmap_events_locked
+  _add_module(&mod, 1, ps);
+}
+
+void ProcSyms::drain_mmap_events_locked() {
+  // head/tail probe first, so the common no-news case costs two loads
+  if (mmap_reader_ && perf_reader_data_ready(mmap_reader_))
+    perf_reader_event_read(mmap_reader_);
+}
+
 void ProcSyms::load_modules() {
   bcc_procutils_each_module(pid_, _add_module, this);
+
+  // Symbol tables are normally parsed lazily, one module at a time, on the
+  // first lookup that hits each module. For processes mapping hundreds of
+  // DSOs that serializes a lot of independent ELF parsing behind the first
+  // resolutions; BCC_SYMBOLIZE_THREADS=<n> opts into preloading all modules'
+  // tables here with n worker threads instead. Each worker only touches the
+  // Module it claimed, and each module's SharedTable takes its own lock, so
+  // this is safe even for tables shared with other ProcSyms instances;
+  // load_sym_table() becomes a no-op for later lookups.
+  const char *threads_env = ::getenv("BCC_SYMBOLIZE_THREADS");
+  if (!threads_env)
+    return;
+  int threads_requested = ::atoi(threads_env);
+  if (threads_requested <= 1 || modules_.empty())
+    return;
+  size_t nthreads = threads_requested;
+  if (nthreads > modules_.size())
+    nthreads = modules_.size();
+
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  workers.reserve(nthreads);
+  for (size_t i = 0; i < nthreads; i++)
+    workers.emplace_back([this, &next] {
+      for (size_t idx = next++; idx < modules_.size(); idx = next++)
+        modules_[idx].load_sym_table();
+    });
+  for (auto &w : workers)
+    w.join();
 }
 
 void ProcSyms::refresh() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  refresh_locked();
+}
+
+void ProcSyms::refresh_locked() {
+  // perf maps are append-only, so keep those modules aside for _add_module
+  // to reuse: their symbol tables stay valid and the next load_sym_table()
+  // only parses the tail appended since the last parse
+  saved_perf_maps_.clear();
+  for (auto &mod : modules_)
+    if (mod.type_ == ModuleType::PERF_MAP) {
+      mod.ranges_.clear();
+      mod.table_->loaded = false;
+      saved_perf_maps_.push_back(std::move(mod));
+    }
   modules_.clear();
+  demangle_cache_.clear();
   load_modules();
+  saved_perf_maps_.clear();
   procstat_.reset();
 }
 
@@ -201,6 +644,21 @@ int ProcSyms::_add_module(mod_info *mod, int enter_ns, void *payload) {
       ps->modules_.begin(), ps->modules_.end(),
       [=](const ProcSyms::Module &m) { return m.name_ == mod->name; });
   if (it == ps->modules_.end()) {
+    // reuse a perf-map module preserved across refresh(); its symbols stay
+    // valid since the map only grows
+    auto saved = std::find_if(
+        ps->saved_perf_maps_.begin(), ps->saved_perf_maps_.end(),
+        [=](const ProcSyms::Module &m) { return m.name_ == mod->name; });
+    if (saved != ps->saved_perf_maps_.end()) {
+      it = ps->modules_.insert(ps->modules_.end(), std::move(*saved));
+      ps->saved_perf_maps_.erase(saved);
+      it->path_ = modpath;
+      it->ranges_.emplace_back(mod->start_addr, mod->end_addr,
+                               mod->file_offset);
+      // see below: only ever add one perf-PID map
+      return -1;
+    }
+
     auto module = Module(
         mod->name, modpath, &ps->symbol_option_);
 
@@ -237,9 +695,15 @@ int ProcSyms::_add_module(mod_info *mod, int enter_ns, void *payload) {
 
 bool ProcSyms::resolve_addr(uint64_t addr, struct bcc_symbol *sym,
                             bool demangle) {
+  std::lock_guard<std::mutex> guard(mutex_);
   if (procstat_.is_stale())
-    refresh();
+    refresh_locked();
+  drain_mmap_events_locked();
+  return resolve_addr_locked(addr, sym, demangle);
+}
 
+bool ProcSyms::resolve_addr_locked(uint64_t addr, struct bcc_symbol *sym,
+                                   bool demangle) {
   memset(sym, 0, sizeof(struct bcc_symbol));
 
   const char *original_module = nullptr;
@@ -251,9 +715,20 @@ bool ProcSyms::resolve_addr(uint64_t addr, struct bcc_symbol *sym,
     if (mod.contains(addr, offset)) {
       if (mod.find_addr(offset, sym)) {
         if (demangle) {
-          if (sym->name && (!strncmp(sym->name, "_Z", 2) || !strncmp(sym->name, "___Z", 4)))
-            sym->demangle_name =
-                abi::__cxa_demangle(sym->name, nullptr, nullptr, nullptr);
+          if (sym->name && (!strncmp(sym->name, "_Z", 2) || !strncmp(sym->name, "___Z", 4))) {
+            // demangling long template names costs microseconds; the same
+            // few symbols resolve over and over, so keep the result around
+            auto it = demangle_cache_.find(sym->name);
+            if (it == demangle_cache_.end()) {
+              char *dn =
+                  abi::__cxa_demangle(sym->name, nullptr, nullptr, nullptr);
+              it = demangle_cache_
+                       .emplace(sym->name, dn ? dn : sym->name)
+                       .first;
+              free(dn);
+            }
+            sym->demangle_name = it->second.c_str();
+          }
           if (!sym->demangle_name)
             sym->demangle_name = sym->name;
         }
@@ -279,8 +754,10 @@ bool ProcSyms::resolve_addr(uint64_t addr, struct bcc_symbol *sym,
 
 bool ProcSyms::resolve_name(const char *module, const char *name,
                             uint64_t *addr) {
+  std::lock_guard<std::mutex> guard(mutex_);
   if (procstat_.is_stale())
-    refresh();
+    refresh_locked();
+  drain_mmap_events_locked();
 
   for (Module &mod : modules_) {
     if (mod.name_ == module)
@@ -289,13 +766,337 @@ bool ProcSyms::resolve_name(const char *module, const char *name,
   return false;
 }
 
+size_t ProcSyms::resolve_names(const char *module, const char **names,
+                               size_t count, uint64_t *addrs) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (procstat_.is_stale())
+    refresh_locked();
+  drain_mmap_events_locked();
+
+  for (size_t i = 0; i < count; i++)
+    addrs[i] = 0;
+
+  // find the module once for the whole batch; every lookup after the first
+  // hits the module's name index
+  for (Module &mod : modules_) {
+    if (mod.name_ != module)
+      continue;
+    size_t resolved = 0;
+    for (size_t i = 0; i < count; i++)
+      if (mod.find_name(names[i], &addrs[i]))
+        resolved++;
+    return resolved;
+  }
+  return 0;
+}
+
+size_t ProcSyms::resolve_addrs(const uint64_t *addrs, size_t count,
+                               struct bcc_symbol *syms, bool demangle) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (procstat_.is_stale())
+    refresh_locked();
+  drain_mmap_events_locked();
+
+  // sweep the batch in ascending address order so the per-module range and
+  // symbol binary searches touch neighbouring cache lines instead of
+  // bouncing across the arrays; results land at the callers' indices
+  std::vector<size_t> order(count);
+  for (size_t i = 0; i < count; i++)
+    order[i] = i;
+  std::sort(order.begin(), order.end(),
+            [&](size_t a, size_t b) { return addrs[a] < addrs[b]; });
+
+  size_t resolved = 0;
+  for (size_t i : order)
+    if (resolve_addr_locked(addrs[i], &syms[i], demangle))
+      resolved++;
+  return resolved;
+}
+
+// <BCC_INLINE_INDEX_DIR>/<buildid>.inline, mirroring the other build-id
+// keyed on-disk caches
+static std::string inline_index_path(const char *module_path) {
+  const char *dir = ::getenv("BCC_INLINE_INDEX_DIR");
+  if (!dir || !*dir)
+    return "";
+  char buildid[128];
+  if (bcc_elf_get_buildid(module_path, buildid) != 0)
+    return "";
+  return std::string(dir) + "/" + buildid + ".inline";
+}
+
+std::unique_ptr<InlineIndex> InlineIndex::load(const char *module_path) {
+  std::string path = inline_index_path(module_path);
+  if (path.empty())
+    return nullptr;
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return nullptr;
+  struct stat st;
+  if (::fstat(fd, &st) != 0 ||
+      (size_t)st.st_size < sizeof(struct bcc_inline_index_header)) {
+    ::close(fd);
+    return nullptr;
+  }
+  void *base = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (base == MAP_FAILED)
+    return nullptr;
+
+  // validate the section sizes against the file size up front so lookups
+  // can index without bounds checks
+  auto *hdr = static_cast<const struct bcc_inline_index_header *>(base);
+  size_t want = sizeof(*hdr) +
+                hdr->n_ranges * sizeof(struct bcc_inline_index_range) +
+                hdr->n_chain_words * sizeof(uint32_t) + hdr->strtab_size;
+  if (hdr->magic != BCC_INLINE_INDEX_MAGIC ||
+      hdr->version != BCC_INLINE_INDEX_VERSION || want > (size_t)st.st_size ||
+      hdr->strtab_size == 0 ||
+      static_cast<const char *>(base)[want - 1] != '\0') {
+    ::munmap(base, st.st_size);
+    return nullptr;
+  }
+
+  std::unique_ptr<InlineIndex> index(new InlineIndex());
+  index->base_ = base;
+  index->size_ = st.st_size;
+  return index;
+}
+
+InlineIndex::~InlineIndex() {
+  if (base_)
+    ::munmap(base_, size_);
+}
+
+size_t InlineIndex::lookup(uint64_t offset, const char **names,
+                           size_t max_names) const {
+  auto *hdr = static_cast<const struct bcc_inline_index_header *>(base_);
+  auto *ranges = reinterpret_cast<const struct bcc_inline_index_range *>(
+      hdr + 1);
+  auto *chain_words =
+      reinterpret_cast<const uint32_t *>(ranges + hdr->n_ranges);
+  const char *strtab =
+      reinterpret_cast<const char *>(chain_words + hdr->n_chain_words);
+
+  // the ranges are disjoint and sorted: find the last range starting at or
+  // below the offset and check containment
+  auto *bound = std::upper_bound(
+      ranges, ranges + hdr->n_ranges, offset,
+      [](uint64_t off, const struct bcc_inline_index_range &r) {
+        return off < r.start;
+      });
+  if (bound == ranges)
+    return 0;
+  const struct bcc_inline_index_range &r = bound[-1];
+  if (offset >= r.end)
+    return 0;
+
+  size_t n = std::min((size_t)r.chain_len, max_names);
+  for (size_t i = 0; i < n; i++) {
+    uint32_t str_off = chain_words[r.chain_off + i];
+    if (str_off >= hdr->strtab_size)
+      return i;
+    names[i] = strtab + str_off;
+  }
+  return n;
+}
+
+size_t ProcSyms::resolve_addr_inline(uint64_t addr, struct bcc_symbol *frames,
+                                     size_t max_frames, bool demangle) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (procstat_.is_stale())
+    refresh_locked();
+  drain_mmap_events_locked();
+  if (max_frames == 0)
+    return 0;
+
+  size_t n = 0;
+  uint64_t offset;
+  for (Module &mod : modules_) {
+    if (mod.type_ == ModuleType::PERF_MAP || !mod.contains(addr, offset))
+      continue;
+    if (!mod.inline_index_checked_) {
+      mod.inline_index_checked_ = true;
+      mod.inline_index_ = InlineIndex::load(mod.path_->path());
+    }
+    if (mod.inline_index_) {
+      std::vector<const char *> names(max_frames);
+      size_t chain = mod.inline_index_->lookup(offset, names.data(),
+                                               max_frames);
+      for (size_t i = 0; i < chain; i++, n++) {
+        memset(&frames[n], 0, sizeof(frames[n]));
+        // DWARF DW_AT_name is already the source-level name; nothing to
+        // demangle, and the pointer stays valid for the index's lifetime
+        frames[n].name = names[i];
+        frames[n].demangle_name = names[i];
+        frames[n].module = mod.name_.c_str();
+        frames[n].offset = offset;
+      }
+    }
+    break;
+  }
+
+  // the outermost frame is the plain symbol-table resolution (which also
+  // handles the perf-map fallback)
+  if (n < max_frames && resolve_addr_locked(addr, &frames[n], demangle))
+    n++;
+  return n;
+}
+
+static void append_varint(std::string &out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back((char)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((char)v);
+}
+
+static uint64_t read_varint(const uint8_t *&p) {
+  uint64_t v = 0;
+  int shift = 0;
+  while (*p & 0x80) {
+    v |= (uint64_t)(*p++ & 0x7f) << shift;
+    shift += 7;
+  }
+  v |= (uint64_t)(*p++) << shift;
+  return v;
+}
+
+uint32_t ProcSyms::FrontCodedNames::add(const char *name, uint64_t addr) {
+  staging_.push_back({name, addr});
+  return count_++;
+}
+
+void ProcSyms::FrontCodedNames::freeze() {
+  if (frozen_)
+    return;
+  frozen_ = true;
+  if (staging_.empty())
+    return;
+
+  // sort ranks lexicographically, stable on staged id so duplicate names
+  // keep their first-definition order
+  id_of_rank_.resize(count_);
+  for (uint32_t i = 0; i < count_; i++)
+    id_of_rank_[i] = i;
+  std::sort(id_of_rank_.begin(), id_of_rank_.end(),
+            [this](uint32_t a, uint32_t b) {
+              int c = staging_[a].name.compare(staging_[b].name);
+              return c != 0 ? c < 0 : a < b;
+            });
+  rank_of_id_.resize(count_);
+  addr_of_id_.resize(count_);
+  for (uint32_t r = 0; r < count_; r++)
+    rank_of_id_[id_of_rank_[r]] = r;
+  for (uint32_t id = 0; id < count_; id++)
+    addr_of_id_[id] = staging_[id].addr;
+
+  // encode each name as (prefix len, suffix len, suffix) against its
+  // predecessor; every kBucket-th entry is a whole name to decode from
+  const std::string *prev = nullptr;
+  for (uint32_t r = 0; r < count_; r++) {
+    const std::string &s = staging_[id_of_rank_[r]].name;
+    size_t plen = 0;
+    if (r % kBucket == 0)
+      bucket_off_.push_back(blob_.size());
+    else
+      while (plen < prev->size() && plen < s.size() &&
+             (*prev)[plen] == s[plen])
+        plen++;
+    append_varint(blob_, plen);
+    append_varint(blob_, s.size() - plen);
+    blob_.append(s, plen, s.size() - plen);
+    prev = &s;
+  }
+  blob_.shrink_to_fit();
+  staging_.clear();
+  staging_.shrink_to_fit();
+}
+
+void ProcSyms::FrontCodedNames::materialize(uint32_t id,
+                                            std::string &out) const {
+  out.clear();
+  if (!frozen_ || id >= count_)
+    return;
+  uint32_t rank = rank_of_id_[id];
+  uint32_t bucket = rank / kBucket;
+  const uint8_t *p =
+      reinterpret_cast<const uint8_t *>(blob_.data()) + bucket_off_[bucket];
+  for (uint32_t r = bucket * kBucket;; r++) {
+    size_t plen = read_varint(p);
+    size_t slen = read_varint(p);
+    out.resize(plen);
+    out.append(reinterpret_cast<const char *>(p), slen);
+    p += slen;
+    if (r == rank)
+      return;
+  }
+}
+
+// decode the whole name anchoring the given bucket
+const char *ProcSyms::FrontCodedNames::anchor(uint32_t bucket,
+                                              std::string &scratch) const {
+  const uint8_t *p =
+      reinterpret_cast<const uint8_t *>(blob_.data()) + bucket_off_[bucket];
+  read_varint(p); // prefix length, always 0 for an anchor
+  size_t slen = read_varint(p);
+  scratch.assign(reinterpret_cast<const char *>(p), slen);
+  return scratch.c_str();
+}
+
+bool ProcSyms::FrontCodedNames::find(const char *name, uint64_t *addr) const {
+  if (!frozen_ || count_ == 0)
+    return false;
+
+  // binary search the anchors for the last bucket starting at or before
+  // name, then decode forward; entries are contiguous across buckets, so
+  // a run of duplicates spilling into the next bucket still gets walked
+  std::string scratch;
+  if (strcmp(anchor(0, scratch), name) > 0)
+    return false;
+  uint32_t lo = 0, hi = bucket_off_.size();
+  while (lo + 1 < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (strcmp(anchor(mid, scratch), name) <= 0)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  // a run of duplicates may begin before a bucket whose anchor equals the
+  // name; back up so the earliest definition is in the walk
+  while (lo > 0 && strcmp(anchor(lo, scratch), name) == 0)
+    lo--;
+
+  const uint8_t *p =
+      reinterpret_cast<const uint8_t *>(blob_.data()) + bucket_off_[lo];
+  std::string cur;
+  uint32_t best = count_;
+  for (uint32_t r = lo * kBucket; r < count_; r++) {
+    size_t plen = read_varint(p);
+    size_t slen = read_varint(p);
+    cur.resize(plen);
+    cur.append(reinterpret_cast<const char *>(p), slen);
+    p += slen;
+    int c = strcmp(cur.c_str(), name);
+    if (c > 0)
+      break;
+    if (c == 0 && id_of_rank_[r] < best)
+      best = id_of_rank_[r];
+  }
+  if (best == count_)
+    return false;
+  *addr = addr_of_id_[best];
+  return true;
+}
+
 ProcSyms::Module::Module(const char *name, std::shared_ptr<ModulePath> path,
                          struct bcc_symbol_option *option)
     : name_(name),
       path_(path),
-      loaded_(false),
       symbol_option_(option),
-      type_(ModuleType::UNKNOWN) {
+      type_(ModuleType::UNKNOWN),
+      perf_map_offset_(0) {
   int elf_type = bcc_elf_get_type(path_->path());
   // The Module is an ELF file
   if (elf_type >= 0) {
@@ -303,24 +1104,72 @@ ProcSyms::Module::Module(const char *name, std::shared_ptr<ModulePath> path,
       type_ = ModuleType::EXEC;
     else if (elf_type == ET_DYN)
       type_ = ModuleType::SO;
-    return;
+  } else {
+    // Other symbol files
+    if (bcc_is_valid_perf_map(path_->path()) == 1)
+      type_ = ModuleType::PERF_MAP;
+    else if (bcc_elf_is_vdso(path_->path()) == 1)
+      type_ = ModuleType::VDSO;
+
+    // Will be stored later
+    elf_so_offset_ = 0;
+    elf_so_addr_ = 0;
   }
-  // Other symbol files
-  if (bcc_is_valid_perf_map(path_->path()) == 1)
-    type_ = ModuleType::PERF_MAP;
-  else if (bcc_elf_is_vdso(path_->path()) == 1)
-    type_ = ModuleType::VDSO;
 
-  // Will be stored later
-  elf_so_offset_ = 0;
-  elf_so_addr_ = 0;
+  table_ = shared_table_for(path_->path(), type_, option);
+}
+
+std::shared_ptr<ProcSyms::Module::SharedTable>
+ProcSyms::Module::shared_table_for(const char *path, ModuleType type,
+                                   struct bcc_symbol_option *option) {
+  static std::mutex registry_mutex;
+  static std::unordered_map<std::string, std::weak_ptr<SharedTable>> registry;
+
+  // perf maps grow per process and the vdso has no stat-able file; only
+  // on-disk ELF objects are shared
+  if ((type != ModuleType::EXEC && type != ModuleType::SO) ||
+      ::getenv("BCC_NO_SHARED_SYMS"))
+    return std::make_shared<SharedTable>();
+
+  struct stat st;
+  if (stat(path, &st) < 0)
+    return std::make_shared<SharedTable>();
+
+  char buildid[128] = {};
+  // best effort: dev/inode already identify the file, the build-id guards
+  // against inode recycling between container images
+  bcc_elf_get_buildid(path, buildid);
+
+  // options change what a parse produces, so they are part of the identity
+  char key[256];
+  ::snprintf(key, sizeof(key), "%llx:%llx:%s:%x:%x:%x:%x",
+             (unsigned long long)st.st_dev, (unsigned long long)st.st_ino,
+             buildid, option->use_debug_file, option->check_debug_file_crc,
+             option->lazy_symbolize, option->use_symbol_type);
+
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  auto &slot = registry[key];
+  auto table = slot.lock();
+  if (!table) {
+    table = std::make_shared<SharedTable>();
+    slot = table;
+  }
+  return table;
 }
 
 int ProcSyms::Module::_add_symbol(const char *symname, uint64_t start,
                                   uint64_t size, void *p) {
   Module *m = static_cast<Module *>(p);
-  auto res = m->symnames_.emplace(symname);
-  m->syms_.emplace_back(&*(res.first), start, size);
+  // perf maps keep appending across reloads, so their names go straight to
+  // the intern table; one-shot ELF/vdso tables stage into the front-coded
+  // arena instead and only decode the names that actually get resolved
+  if (m->type_ == ModuleType::PERF_MAP) {
+    auto res = m->table_->symnames.emplace(symname);
+    m->table_->syms.emplace_back(&*(res.first), start, size);
+  } else {
+    m->table_->syms.emplace_back(m->table_->names.add(symname, start), start,
+                                 size);
+  }
   return 0;
 }
 
@@ -328,21 +1177,35 @@ int ProcSyms::Module::_add_symbol_lazy(size_t section_idx, size_t str_table_idx,
                                        size_t str_len, uint64_t start,
                                        uint64_t size, int debugfile, void *p) {
   Module *m = static_cast<Module *>(p);
-  m->syms_.emplace_back(
+  m->table_->syms.emplace_back(
       section_idx, str_table_idx, str_len, start, size, debugfile);
   return 0;
 }
 
 void ProcSyms::Module::load_sym_table() {
-  if (loaded_)
+  SharedTable &tbl = *table_;
+  std::lock_guard<std::mutex> lock(tbl.mutex);
+
+  if (tbl.loaded)
     return;
-  loaded_ = true;
+  tbl.loaded = true;
 
   if (type_ == ModuleType::UNKNOWN)
     return;
 
-  if (type_ == ModuleType::PERF_MAP)
-    bcc_perf_map_foreach_sym(path_->path(), _add_symbol, this);
+  if (type_ == ModuleType::PERF_MAP) {
+    int res = bcc_perf_map_foreach_sym_tail(path_->path(), _add_symbol, this,
+                                            &perf_map_offset_);
+    if (res > 0) {
+      // the map shrank, so it was truncated or replaced: drop everything
+      // and parse it from scratch
+      tbl.syms.clear();
+      tbl.symnames.clear();
+      tbl.sym_addrs.clear();
+      bcc_perf_map_foreach_sym_tail(path_->path(), _add_symbol, this,
+                                    &perf_map_offset_);
+    }
+  }
   if (type_ == ModuleType::EXEC || type_ == ModuleType::SO) {
     if (symbol_option_->lazy_symbolize)
       bcc_elf_foreach_sym_lazy(path_->path(), _add_symbol_lazy, symbol_option_,
@@ -353,7 +1216,14 @@ void ProcSyms::Module::load_sym_table() {
   if (type_ == ModuleType::VDSO)
     bcc_elf_foreach_vdso_sym(_add_symbol, this);
 
-  std::sort(syms_.begin(), syms_.end());
+  std::sort(tbl.syms.begin(), tbl.syms.end());
+  tbl.names.freeze();
+
+  // packed start-address index for cache-friendly binary search in find_addr
+  tbl.sym_addrs.clear();
+  tbl.sym_addrs.reserve(tbl.syms.size());
+  for (const auto &sym : tbl.syms)
+    tbl.sym_addrs.push_back(sym.start);
 }
 
 bool ProcSyms::Module::contains(uint64_t addr, uint64_t &offset) const {
@@ -373,46 +1243,74 @@ bool ProcSyms::Module::contains(uint64_t addr, uint64_t &offset) const {
   return false;
 }
 
+int ProcSyms::Module::_add_name_index(const char *symname, uint64_t start,
+                                      uint64_t size, void *p) {
+  Module *m = static_cast<Module *>(p);
+  // find() resolves duplicates to the earliest add, matching the
+  // first-match semantics of the linear scan this dictionary replaces
+  m->table_->name_dict.add(symname, start);
+  return 0;
+}
+
+void ProcSyms::Module::build_name_index() {
+  if (table_->name_index_built)
+    return;
+  table_->name_index_built = true;
+
+  if (type_ == ModuleType::EXEC || type_ == ModuleType::SO) {
+    bcc_elf_foreach_sym(path_->path(), _add_name_index, symbol_option_, this);
+    if (path_->path() != path_->alt_path())
+      // some features (e.g. some kinds of debug info) don't work with
+      // /proc/self/fd/... path
+      bcc_elf_foreach_sym(path_->alt_path(), _add_name_index, symbol_option_,
+                          this);
+  }
+  if (type_ == ModuleType::VDSO)
+    bcc_elf_foreach_vdso_sym(_add_name_index, this);
+
+  table_->name_dict.freeze();
+}
+
 bool ProcSyms::Module::find_name(const char *symname, uint64_t *addr) {
-  struct Payload {
-    const char *symname;
-    uint64_t *out;
-    bool found;
-  };
+  // perf maps grow while we run, so an index over them would go stale;
+  // keep the streaming scan for those
+  if (type_ == ModuleType::PERF_MAP) {
+    struct Payload {
+      const char *symname;
+      uint64_t *out;
+      bool found;
+    };
 
-  Payload payload;
-  payload.symname = symname;
-  payload.out = addr;
-  payload.found = false;
+    Payload payload;
+    payload.symname = symname;
+    payload.out = addr;
+    payload.found = false;
 
-  auto cb = [](const char *name, uint64_t start, uint64_t size, void *p) {
-    Payload *payload = static_cast<Payload*>(p);
+    auto cb = [](const char *name, uint64_t start, uint64_t size, void *p) {
+      Payload *payload = static_cast<Payload*>(p);
 
-    if (!strcmp(payload->symname, name)) {
-      payload->found = true;
-      *(payload->out) = start;
-      return -1;  // Stop iteration
-    }
+      if (!strcmp(payload->symname, name)) {
+        payload->found = true;
+        *(payload->out) = start;
+        return -1;  // Stop iteration
+      }
 
-    return 0;
-  };
+      return 0;
+    };
 
-  if (type_ == ModuleType::PERF_MAP)
     bcc_perf_map_foreach_sym(path_->path(), cb, &payload);
-  if (type_ == ModuleType::EXEC || type_ == ModuleType::SO) {
-    bcc_elf_foreach_sym(path_->path(), cb, symbol_option_, &payload);
-    if (path_->path() != path_->alt_path())
-      // some features (e.g. some kinds of debug info) don't work with /proc/self/fd/... path
-      bcc_elf_foreach_sym(path_->alt_path(), cb, symbol_option_, &payload);
+    return payload.found;
   }
-  if (type_ == ModuleType::VDSO)
-    bcc_elf_foreach_vdso_sym(cb, &payload);
 
-  if (!payload.found)
-    return false;
+  {
+    std::lock_guard<std::mutex> lock(table_->mutex);
+    build_name_index();
+    if (!table_->name_dict.find(symname, addr))
+      return false;
+  }
 
   if (type_ == ModuleType::SO)
-    *(payload.out) += start();
+    *addr += start();
 
   return true;
 }
@@ -423,9 +1321,21 @@ bool ProcSyms::Module::find_addr(uint64_t offset, struct bcc_symbol *sym) {
   sym->module = name_.c_str();
   sym->offset = offset;
 
-  auto it = std::upper_bound(syms_.begin(), syms_.end(), Symbol(nullptr, offset, 0));
-  if (it == syms_.begin())
+  // The table may be shared with other ProcSyms instances (each holding only
+  // its own mutex_), so the search and the lazy name decode below both need
+  // the table's own lock.
+  SharedTable &tbl = *table_;
+  std::lock_guard<std::mutex> lock(tbl.mutex);
+
+  // Binary search over the packed start-address index keeps the hot part of
+  // the lookup within a flat array of u64s; the full Symbol records (and any
+  // cold name storage) are only touched for the handful of candidates
+  // examined below.
+  auto bound =
+      std::upper_bound(tbl.sym_addrs.begin(), tbl.sym_addrs.end(), offset);
+  if (bound == tbl.sym_addrs.begin())
     return false;
+  auto it = tbl.syms.begin() + (bound - tbl.sym_addrs.begin());
 
   // 'it' points to the symbol whose start address is strictly greater than
   // the address we're looking for. Start stepping backwards as long as the
@@ -453,13 +1363,22 @@ bool ProcSyms::Module::find_addr(uint64_t offset, struct bcc_symbol *sym) {
     if (offset < it->start + it->size) {
       // Resolve and cache the symbol name if necessary
       if (!it->is_name_resolved) {
-        std::string sym_name(it->data.name_idx.str_len + 1, '\0');
-        if (bcc_elf_symbol_str(path_->path(), it->data.name_idx.section_idx,
-                               it->data.name_idx.str_table_idx, &sym_name[0],
-                               sym_name.size(), it->data.name_idx.debugfile))
-          break;
+        std::string sym_name;
+        if (it->is_arena_name) {
+          // decode from the front-coded arena and intern the copy so the
+          // handed-out pointer stays stable
+          tbl.names.materialize(it->data.arena_id, sym_name);
+          if (sym_name.empty())
+            break;
+        } else {
+          sym_name.assign(it->data.name_idx.str_len + 1, '\0');
+          if (bcc_elf_symbol_str(path_->path(), it->data.name_idx.section_idx,
+                                 it->data.name_idx.str_table_idx, &sym_name[0],
+                                 sym_name.size(), it->data.name_idx.debugfile))
+            break;
+        }
 
-        it->data.name = &*(symnames_.emplace(std::move(sym_name)).first);
+        it->data.name = &*(tbl.symnames.emplace(std::move(sym_name)).first);
         it->is_name_resolved = true;
       }
 
@@ -470,7 +1389,7 @@ bool ProcSyms::Module::find_addr(uint64_t offset, struct bcc_symbol *sym) {
     if (limit > it->start + it->size)
       break;
     // But don't step beyond begin()!
-    if (it == syms_.begin())
+    if (it == tbl.syms.begin())
       break;
   }
 
@@ -491,10 +1410,6 @@ bool BuildSyms::Module::load_sym_table()
 
   bcc_elf_foreach_sym(module_name_.c_str(), _add_symbol, &symbol_option_, this);
   std::sort(syms_.begin(), syms_.end());
-
-  for(std::vector<Symbol>::iterator it = syms_.begin();
-      it != syms_.end(); ++it++) {
-  }
   loaded_ = true;
   return true;
 }
@@ -534,10 +1449,22 @@ unknown_symbol:
   return false;
 }
 
+static int hex_nibble(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
 bool BuildSyms::add_module(const std::string module_name)
 {
   struct stat s;
   char buildid[BPF_BUILD_ID_SIZE*2+1];
+  std::string raw_buildid(BPF_BUILD_ID_SIZE, '\0');
 
   if (stat(module_name.c_str(), &s) < 0)
      return false;
@@ -545,13 +1472,21 @@ bool BuildSyms::add_module(const std::string module_name)
   if (bcc_elf_get_buildid(module_name.c_str(), buildid) < 0)
       return false;
 
-  std::string elf_buildid(buildid);
+  /*store under the raw bytes so resolve avoids a per-frame hex conversion*/
+  for (int i = 0; i < BPF_BUILD_ID_SIZE; i++) {
+    int hi = hex_nibble(buildid[i*2]);
+    int lo = hex_nibble(buildid[i*2+1]);
+    if (hi < 0 || lo < 0)
+      return false;
+    raw_buildid[i] = (char)((hi << 4) | lo);
+  }
+
   std::unique_ptr<BuildSyms::Module> ptr(new BuildSyms::Module(module_name.c_str()));
-  buildmap_[elf_buildid] = std::move(ptr);
+  buildmap_[raw_buildid] = std::move(ptr);
   return true;
 }
 
-bool BuildSyms::resolve_addr(std::string build_id, uint64_t offset,
+bool BuildSyms::resolve_addr(const std::string &build_id, uint64_t offset,
                              struct bcc_symbol *sym, bool demangle)
 {
   std::unordered_map<std::string,std::unique_ptr<BuildSyms::Module> >::iterator it;
@@ -581,20 +1516,43 @@ void bcc_free_symcache(void *symcache, int pid) {
 }
 
 void bcc_symbol_free_demangle_name(struct bcc_symbol *sym) {
-  if (sym->demangle_name && (sym->demangle_name != sym->name))
-    free(const_cast<char*>(sym->demangle_name));
+  // demangled names are now owned by the per-symcache demangle cache and
+  // stay valid for the cache's lifetime; nothing to free. Kept for API
+  // compatibility with callers that still pair resolve with free.
+  (void)sym;
 }
 
 int bcc_symcache_resolve(void *resolver, uint64_t addr,
                          struct bcc_symbol *sym) {
   SymbolCache *cache = static_cast<SymbolCache *>(resolver);
-  return cache->resolve_addr(addr, sym) ? 0 : -1;
+  bool ok = cache->resolve_addr(addr, sym);
+  bcc_stats_add(ok ? BCC_STAT_SYM_HITS : BCC_STAT_SYM_MISSES, 1);
+  return ok ? 0 : -1;
 }
 
 int bcc_symcache_resolve_no_demangle(void *resolver, uint64_t addr,
                                      struct bcc_symbol *sym) {
   SymbolCache *cache = static_cast<SymbolCache *>(resolver);
-  return cache->resolve_addr(addr, sym, false) ? 0 : -1;
+  bool ok = cache->resolve_addr(addr, sym, false);
+  bcc_stats_add(ok ? BCC_STAT_SYM_HITS : BCC_STAT_SYM_MISSES, 1);
+  return ok ? 0 : -1;
+}
+
+int bcc_symcache_resolve_inline(void *resolver, uint64_t addr,
+                                struct bcc_symbol *frames, int max_frames) {
+  if (max_frames <= 0)
+    return 0;
+  SymbolCache *cache = static_cast<SymbolCache *>(resolver);
+  return (int)cache->resolve_addr_inline(addr, frames, (size_t)max_frames);
+}
+
+int bcc_symcache_resolve_batch(void *resolver, const uint64_t *addrs,
+                               size_t count, struct bcc_symbol *syms) {
+  SymbolCache *cache = static_cast<SymbolCache *>(resolver);
+  size_t resolved = cache->resolve_addrs(addrs, count, syms);
+  bcc_stats_add(BCC_STAT_SYM_HITS, resolved);
+  bcc_stats_add(BCC_STAT_SYM_MISSES, count - resolved);
+  return (int)resolved;
 }
 
 int bcc_symcache_resolve_name(void *resolver, const char *module,
@@ -603,11 +1561,28 @@ int bcc_symcache_resolve_name(void *resolver, const char *module,
   return cache->resolve_name(module, name, addr) ? 0 : -1;
 }
 
+int bcc_symcache_resolve_names(void *resolver, const char *module,
+                               const char **names, size_t count,
+                               uint64_t *addrs) {
+  SymbolCache *cache = static_cast<SymbolCache *>(resolver);
+  return (int)cache->resolve_names(module, names, count, addrs);
+}
+
 void bcc_symcache_refresh(void *resolver) {
   SymbolCache *cache = static_cast<SymbolCache *>(resolver);
   cache->refresh();
 }
 
+int bcc_symcache_enable_mmap_tracking(void *resolver) {
+  SymbolCache *cache = static_cast<SymbolCache *>(resolver);
+  return cache->enable_mmap_tracking();
+}
+
+void bcc_symcache_disable_mmap_tracking(void *resolver) {
+  SymbolCache *cache = static_cast<SymbolCache *>(resolver);
+  cache->disable_mmap_tracking();
+}
+
 void *bcc_buildsymcache_new(void) {
   return static_cast<void *>(new BuildSyms());
 }
@@ -626,22 +1601,14 @@ int bcc_buildsymcache_resolve(void *resolver,
                               struct bpf_stack_build_id *trace,
                               struct bcc_symbol *sym)
 {
-  std::string build_id;
-  unsigned char *c = &trace->build_id[0];
-  int idx = 0;
-
   /*cannot resolve in case of fallback*/
   if (trace->status == BPF_STACK_BUILD_ID_EMPTY ||
       trace->status == BPF_STACK_BUILD_ID_IP)
     return 0;
 
-  while( idx < 20) {
-    int nib1 = (c[idx]&0xf0)>>4;
-    int nib2 = (c[idx]&0x0f);
-    build_id += "0123456789abcdef"[nib1];
-    build_id += "0123456789abcdef"[nib2];
-    idx++;
-  }
+  /*the map is keyed by the raw id bytes, use them as-is*/
+  std::string build_id(reinterpret_cast<const char *>(trace->build_id),
+                       sizeof(trace->build_id));
 
   BuildSyms *bsym = static_cast<BuildSyms *>(resolver);
   return bsym->resolve_addr(build_id, trace->offset, sym) ? 0 : -1;
@@ -750,6 +1717,63 @@ int bcc_foreach_function_symbol(const char *module, SYM_CB cb) {
       module, _sym_cb_wrapper, &default_option, (void *)cb);
 }
 
+struct _sym_match_builder {
+  std::vector<std::pair<size_t, uint64_t>> entries;  // {pool offset, addr}
+  std::string pool;                                  // NUL-joined names
+};
+
+static int _collect_match_cb(const char *symname, uint64_t addr, uint64_t,
+                             void *payload) {
+  struct _sym_match_builder *b = (struct _sym_match_builder *)payload;
+  b->entries.emplace_back(b->pool.size(), addr);
+  b->pool.append(symname);
+  b->pool.push_back('\0');
+  return 0;
+}
+
+int bcc_function_symbols_matching(const char *module, const char *pattern,
+                                  struct bcc_symbol_match **matches,
+                                  size_t *n_matches) {
+  if (module == 0 || matches == 0 || n_matches == 0)
+    return -1;
+  *matches = nullptr;
+  *n_matches = 0;
+
+  static struct bcc_symbol_option default_option = {
+    .use_debug_file = 1,
+    .check_debug_file_crc = 1,
+    .lazy_symbolize = 1,
+    .use_symbol_type = (1 << STT_FUNC) | (1 << STT_GNU_IFUNC)
+  };
+
+  struct _sym_match_builder b;
+  if (bcc_elf_foreach_sym_matching(module, _collect_match_cb, &default_option,
+                                   pattern, &b) < 0)
+    return -1;
+  if (b.entries.empty())
+    return 0;
+
+  // one arena: the match array, then the name pool it points into
+  size_t array_bytes = b.entries.size() * sizeof(struct bcc_symbol_match);
+  char *arena = (char *)malloc(array_bytes + b.pool.size());
+  if (!arena)
+    return -1;
+  struct bcc_symbol_match *out = (struct bcc_symbol_match *)arena;
+  char *names = arena + array_bytes;
+  memcpy(names, b.pool.data(), b.pool.size());
+  for (size_t i = 0; i < b.entries.size(); i++) {
+    out[i].name = names + b.entries[i].first;
+    out[i].addr = b.entries[i].second;
+  }
+  *matches = out;
+  *n_matches = b.entries.size();
+  return 0;
+}
+
+void bcc_free_symbol_matches(struct bcc_symbol_match *matches) {
+  free(matches);
+}
+
 static int _find_sym(const char *symname, uint64_t addr, uint64_t,
                      void *payload) {
   struct bcc_symbol *sym = (struct bcc_symbol *)payload;
@@ -774,6 +1798,103 @@ int _find_load(uint64_t v_addr, uint64_t mem_sz, uint64_t file_offset,
   return 0;
 }
 
+// Cache of symbol-name -> final file offset for uprobe attachment, so
+// re-attaching a probe to an already-seen binary skips the ELF symbol walk
+// and load-section translation. Entries are keyed by build-id plus the
+// option bits that influence matching, which also makes them immune to a
+// binary being replaced in place: a changed build-id simply misses. An
+// in-process LRU answers repeat lookups; pointing BCC_UPROBE_CACHE_DIR at a
+// writable directory additionally persists results as one append-only
+// "<key> <offset>" text file per build-id, shared across processes. A hit
+// still reads the build-id note from the target (a bounded read of the
+// first ELF pages) — that is the staleness check.
+class UprobeOffsetCache {
+ public:
+  static UprobeOffsetCache &instance() {
+    static UprobeOffsetCache cache;
+    return cache;
+  }
+
+  bool lookup(const std::string &buildid, const std::string &key,
+              uint64_t *offset) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    load_disk(buildid);
+    auto it = map_.find(buildid + "/" + key);
+    if (it == map_.end())
+      return false;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    *offset = it->second->second;
+    return true;
+  }
+
+  void store(const std::string &buildid, const std::string &key,
+             uint64_t offset) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (insert(buildid + "/" + key, offset)) {
+      std::string path = disk_path(buildid);
+      if (!path.empty()) {
+        // single-line O_APPEND writes are atomic between processes; a
+        // duplicate line after a racing append is harmless on reload
+        std::string line = tfm::format("%s %llx\n", key, offset);
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd >= 0) {
+          if (::write(fd, line.data(), line.size()) < 0) {}
+          ::close(fd);
+        }
+      }
+    }
+  }
+
+ private:
+  UprobeOffsetCache() {}
+
+  static std::string disk_path(const std::string &buildid) {
+    const char *dir = ::getenv("BCC_UPROBE_CACHE_DIR");
+    if (!dir || !*dir)
+      return "";
+    return std::string(dir) + "/" + buildid + ".syms";
+  }
+
+  // returns whether the entry is new (and should be appended to disk)
+  bool insert(const std::string &full_key, uint64_t offset) {
+    auto it = map_.find(full_key);
+    if (it != map_.end()) {
+      lru_.splice(lru_.begin(), lru_, it->second);
+      it->second->second = offset;
+      return false;
+    }
+    lru_.emplace_front(full_key, offset);
+    map_[full_key] = lru_.begin();
+    if (map_.size() > kCapacity) {
+      map_.erase(lru_.back().first);
+      lru_.pop_back();
+    }
+    return true;
+  }
+
+  void load_disk(const std::string &buildid) {
+    if (!disk_loaded_.insert(buildid).second)
+      return;
+    std::string path = disk_path(buildid);
+    if (path.empty())
+      return;
+    std::ifstream is(path);
+    std::string key;
+    uint64_t offset;
+    while (is >> key >> std::hex >> offset >> std::dec)
+      insert(buildid + "/" + key, offset);
+  }
+
+  static const size_t kCapacity = 4096;
+  std::mutex mutex_;
+  // front = most recently used
+  std::list<std::pair<std::string, uint64_t>> lru_;
+  std::unordered_map<std::string,
+                     std::list<std::pair<std::string, uint64_t>>::iterator>
+      map_;
+  std::unordered_set<std::string> disk_loaded_;
+};
+
 int bcc_resolve_symname(const char *module, const char *symname,
                         const uint64_t addr, int pid,
                         struct bcc_symbol_option *option,
@@ -813,25 +1934,50 @@ int bcc_resolve_symname(const char *module, const char *symname,
   if (option == NULL)
     option = &default_option;
 
-  if (sym->name && sym->offset == 0x0)
-    if (bcc_elf_foreach_sym(sym->module, _find_sym, option, sym) < 0)
-      goto invalid_module;
-  if (sym->offset == 0x0)
-    goto invalid_module;
-
-  // For executable (ET_EXEC) binaries and shared objects (ET_DYN), translate
-  // the virtual address to physical address in the binary file.
-  module_type = bcc_elf_get_type(sym->module);
-  if (module_type == ET_EXEC || module_type == ET_DYN) {
-    struct load_addr_t addr = {
-      .target_addr = sym->offset,
-      .binary_addr = 0x0,
-    };
-    if (bcc_elf_foreach_load_section(sym->module, &_find_load, &addr) < 0)
-      goto invalid_module;
-    if (!addr.binary_addr)
+  {
+    // name-based lookups are cacheable: the cached value is the final file
+    // offset, so a hit skips both the symbol walk and the load-section
+    // translation below
+    char buildid[128] = {0};
+    std::string cache_key;
+    bool cacheable = sym->name && sym->offset == 0x0 &&
+                     bcc_elf_get_buildid(sym->module, buildid) == 0;
+    if (cacheable) {
+      cache_key = tfm::format(
+          "%x:%x:%s", option->use_symbol_type,
+          (option->use_debug_file ? 1 : 0) |
+              (option->check_debug_file_crc ? 2 : 0),
+          sym->name);
+      uint64_t cached;
+      if (UprobeOffsetCache::instance().lookup(buildid, cache_key, &cached)) {
+        sym->offset = cached;
+        return 0;
+      }
+    }
+
+    if (sym->name && sym->offset == 0x0)
+      if (bcc_elf_foreach_sym(sym->module, _find_sym, option, sym) < 0)
+        goto invalid_module;
+    if (sym->offset == 0x0)
       goto invalid_module;
-    sym->offset = addr.binary_addr;
+
+    // For executable (ET_EXEC) binaries and shared objects (ET_DYN),
+    // translate the virtual address to physical address in the binary file.
+    module_type = bcc_elf_get_type(sym->module);
+    if (module_type == ET_EXEC || module_type == ET_DYN) {
+      struct load_addr_t load_addr = {
+        .target_addr = sym->offset,
+        .binary_addr = 0x0,
+      };
+      if (bcc_elf_foreach_load_section(sym->module, &_find_load, &load_addr) < 0)
+        goto invalid_module;
+      if (!load_addr.binary_addr)
+        goto invalid_module;
+      sym->offset = load_addr.binary_addr;
+    }
+
+    if (cacheable)
+      UprobeOffsetCache::instance().store(buildid, cache_key, sym->offset);
   }
   return 0;
 
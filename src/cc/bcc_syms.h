@@ -20,6 +20,7 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 #include "linux/bpf.h"
 #include "bcc_proc.h"
@@ -57,17 +58,49 @@ struct bcc_symbol_option {
 void *bcc_symcache_new(int pid, struct bcc_symbol_option *option);
 void bcc_free_symcache(void *symcache, int pid);
 
-// The demangle_name pointer in bcc_symbol struct is returned from the
-// __cxa_demangle function call, which is supposed to be freed by caller. Call
-// this function after done using returned result of bcc_symcache_resolve.
+// The demangle_name pointer in bcc_symbol struct points into a per-symcache
+// cache and stays valid for the symcache's lifetime; this is now a no-op.
+// Call it anyway after using the result of bcc_symcache_resolve so callers
+// stay compatible with versions that returned heap-allocated names.
 void bcc_symbol_free_demangle_name(struct bcc_symbol *sym);
 int bcc_symcache_resolve(void *symcache, uint64_t addr, struct bcc_symbol *sym);
 int bcc_symcache_resolve_no_demangle(void *symcache, uint64_t addr,
                                      struct bcc_symbol *sym);
+// Inline-aware variant of bcc_symcache_resolve: fills frames[] with the
+// chain of inlined functions covering addr, innermost first, ending with
+// the enclosing symbol-table frame, and returns the frame count (0 when
+// the address does not resolve). Inline chains come from a per-build-id
+// index under BCC_INLINE_INDEX_DIR built once from DWARF by
+// bcc_build_inline_index(); without an index only the symtab frame is
+// returned, so this degrades to bcc_symcache_resolve. Inline frame name
+// pointers stay valid for the symcache's lifetime.
+int bcc_symcache_resolve_inline(void *symcache, uint64_t addr,
+                                struct bcc_symbol *frames, int max_frames);
+// Batch variant of bcc_symcache_resolve: resolves count addresses in one
+// call. The batch is resolved in ascending address order for cache
+// locality and the lock and staleness check are taken once, but syms[i]
+// always corresponds to addrs[i]. syms[i] is zeroed when addrs[i] does not
+// resolve. Returns the number of addresses resolved.
+int bcc_symcache_resolve_batch(void *symcache, const uint64_t *addrs,
+                               size_t count, struct bcc_symbol *syms);
 
 int bcc_symcache_resolve_name(void *resolver, const char *module,
                               const char *name, uint64_t *addr);
+// Batch variant of bcc_symcache_resolve_name: resolves count names from
+// one module in a single call; addrs[i] is set to 0 when names[i] is
+// unknown. Returns the number of names resolved. Amortizes the module
+// lookup and staleness check across the batch, and name lookups after the
+// first hit a per-module name index instead of rescanning the ELF.
+int bcc_symcache_resolve_names(void *resolver, const char *module,
+                               const char **names, size_t count,
+                               uint64_t *addrs);
 void bcc_symcache_refresh(void *resolver);
+// Subscribe a process symcache to the kernel's PERF_RECORD_MMAP2 stream so
+// new executable mappings (dlopen etc.) are applied incrementally instead
+// of triggering full /proc/<pid>/maps re-parses. Returns 0, or -1 when the
+// cache is a kernel one or the perf event cannot be opened.
+int bcc_symcache_enable_mmap_tracking(void *resolver);
+void bcc_symcache_disable_mmap_tracking(void *resolver);
 
 int _bcc_syms_find_module(struct mod_info *info, int enter_ns, void *p);
 int bcc_resolve_global_addr(int pid, const char *module, const uint64_t address,
@@ -85,6 +118,24 @@ int bcc_buildsymcache_resolve(void *resolver,
 // Will prefer use debug file and check debug file CRC when reading the module.
 int bcc_foreach_function_symbol(const char *module, SYM_CB cb);
 
+struct bcc_symbol_match {
+  const char *name;
+  uint64_t addr;
+};
+
+// Batch variant of bcc_foreach_function_symbol for wildcard attach: the
+// pattern (fnmatch glob, or a plain name) is pushed down into the ELF
+// scan, so selecting a handful of functions out of a large symtab costs
+// one prefix compare per symbol instead of one callback crossing each.
+// On success *matches points at the matched {name, addr} pairs -- array
+// and names live in one arena, released with bcc_free_symbol_matches --
+// and *n_matches holds the count (0 with a NULL array when nothing
+// matched). Returns -1 when the module cannot be read.
+int bcc_function_symbols_matching(const char *module, const char *pattern,
+                                  struct bcc_symbol_match **matches,
+                                  size_t *n_matches);
+void bcc_free_symbol_matches(struct bcc_symbol_match *matches);
+
 // Find the offset of a symbol in a module binary. If addr is not zero, will
 // calculate the offset using the provided addr and the module's load address.
 //
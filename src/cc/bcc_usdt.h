@@ -79,6 +79,14 @@ int bcc_usdt_enable_fully_specified_probe(void *, const char *, const char *,
                                           const char *);
 int bcc_usdt_addsem_fully_specified_probe(void *, const char *, const char *,
                                           const char *, int16_t);
+#define BCC_USDT_HAS_ENABLE_PROBES
+/* Enable count probes in one call; NULL provider entries match any provider.
+ * Semaphore updates for the batch are grouped into a single remote write per
+ * target process. All-or-nothing: returns 0 only if every probe was enabled.
+ */
+int bcc_usdt_enable_probes(void *usdt, const char **provider_names,
+                           const char **probe_names, const char **fn_names,
+                           int count);
 const char *bcc_usdt_genargs(void **ctx_array, int len);
 const char *bcc_usdt_get_probe_argctype(
   void *ctx, const char* probe_name, const int arg_index
@@ -87,7 +95,11 @@ const char *bcc_usdt_get_fully_specified_probe_argctype(
   void *ctx, const char* provider_name, const char* probe_name, const int arg_index
 );
 
-typedef void (*bcc_usdt_uprobe_cb)(const char *, const char *, uint64_t, int);
+/* binpath, fn_name, address, pid, ref_ctr_offset; pass ref_ctr_offset to the
+ * uprobe attach so the kernel manages the USDT semaphore (0 when the
+ * semaphore was already raised in userspace or the probe has none) */
+typedef void (*bcc_usdt_uprobe_cb)(const char *, const char *, uint64_t, int,
+                                   uint64_t);
 void bcc_usdt_foreach_uprobe(void *usdt, bcc_usdt_uprobe_cb callback);
 
 #ifdef __cplusplus
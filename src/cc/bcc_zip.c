@@ -18,10 +18,12 @@
 
 #include <fcntl.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 // Specification of ZIP file format can be found here:
@@ -141,13 +143,58 @@ struct local_file_header {
   unaligned_uint16_t extra_field_length;
 };
 
+// one slot of the lazily built central-directory name index; cdfh_offset is
+// the record's offset within the archive plus one, so zero marks a free slot
+struct cd_index_slot {
+  uint32_t hash;
+  uint32_t cdfh_offset;
+};
+
 struct bcc_zip_archive {
   void* data;
   uint32_t size;
   uint32_t cd_offset;
   uint32_t cd_records;
+
+  // name -> central-directory record hash index, built on the first
+  // find_entry; index_built < 0 means the build failed and lookups fall
+  // back to the linear directory scan
+  struct cd_index_slot* index;
+  uint32_t index_mask;
+  int index_built;
+
+  // process-wide handle cache bookkeeping: archives are keyed by path and
+  // identity (device, inode, mtime, size) and stay mapped after the last
+  // close so repeated symbolization sessions do not re-parse them
+  char* path;
+  dev_t dev;
+  ino_t ino;
+  time_t mtime;
+  off_t fsize;
+  int refcount;
+  int in_cache;
+  struct bcc_zip_archive* next;
 };
 
+static pthread_mutex_t zip_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct bcc_zip_archive* zip_cache_head;
+
+static void archive_destroy(struct bcc_zip_archive* archive) {
+  munmap(archive->data, archive->size);
+  free(archive->index);
+  free(archive->path);
+  free(archive);
+}
+
+static uint32_t zip_name_hash(const char* name, size_t len) {
+  uint32_t h = 0x811c9dc5u;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)name[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
 static void* check_access(struct bcc_zip_archive* archive, uint32_t offset,
                           uint32_t size) {
   if (offset + size > archive->size || offset > offset + size) {
@@ -212,7 +259,7 @@ static int find_central_directory(struct bcc_zip_archive* archive) {
   return rc;
 }
 
-struct bcc_zip_archive* bcc_zip_archive_open(const char* path) {
+static struct bcc_zip_archive* archive_open_uncached(const char* path) {
   int fd = open(path, O_RDONLY);
   if (fd < 0) {
     return NULL;
@@ -231,7 +278,8 @@ struct bcc_zip_archive* bcc_zip_archive_open(const char* path) {
     return NULL;
   }
 
-  struct bcc_zip_archive* archive = malloc(sizeof(struct bcc_zip_archive));
+  struct bcc_zip_archive* archive =
+      calloc(1, sizeof(struct bcc_zip_archive));
   if (archive == NULL) {
     munmap(data, size);
     return NULL;
@@ -248,9 +296,78 @@ struct bcc_zip_archive* bcc_zip_archive_open(const char* path) {
   return archive;
 }
 
+struct bcc_zip_archive* bcc_zip_archive_open(const char* path) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    return NULL;
+  }
+
+  // serve repeat opens from the process-wide cache when the file identity
+  // still matches; a replaced or rewritten archive evicts the stale handle
+  pthread_mutex_lock(&zip_cache_mutex);
+  struct bcc_zip_archive** prev = &zip_cache_head;
+  for (struct bcc_zip_archive* a = zip_cache_head; a; a = a->next) {
+    if (strcmp(a->path, path) != 0) {
+      prev = &a->next;
+      continue;
+    }
+    if (a->dev == st.st_dev && a->ino == st.st_ino &&
+        a->mtime == st.st_mtime && a->fsize == st.st_size) {
+      a->refcount++;
+      pthread_mutex_unlock(&zip_cache_mutex);
+      return a;
+    }
+    // stale: detach; destroy now unless a caller still holds it
+    *prev = a->next;
+    a->in_cache = 0;
+    if (a->refcount == 0) {
+      pthread_mutex_unlock(&zip_cache_mutex);
+      archive_destroy(a);
+      pthread_mutex_lock(&zip_cache_mutex);
+    }
+    break;
+  }
+  pthread_mutex_unlock(&zip_cache_mutex);
+
+  struct bcc_zip_archive* archive = archive_open_uncached(path);
+  if (archive == NULL) {
+    return NULL;
+  }
+
+  archive->path = strdup(path);
+  if (archive->path == NULL) {
+    archive_destroy(archive);
+    return NULL;
+  }
+  archive->dev = st.st_dev;
+  archive->ino = st.st_ino;
+  archive->mtime = st.st_mtime;
+  archive->fsize = st.st_size;
+  archive->refcount = 1;
+  archive->in_cache = 1;
+
+  pthread_mutex_lock(&zip_cache_mutex);
+  archive->next = zip_cache_head;
+  zip_cache_head = archive;
+  pthread_mutex_unlock(&zip_cache_mutex);
+  return archive;
+}
+
 void bcc_zip_archive_close(struct bcc_zip_archive* archive) {
-  munmap(archive->data, archive->size);
-  free(archive);
+  if (archive == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&zip_cache_mutex);
+  if (archive->refcount > 0) {
+    archive->refcount--;
+  }
+  // cached archives stay mapped for the next session; only handles already
+  // evicted from the cache are torn down with the last reference
+  int destroy = (archive->refcount == 0 && !archive->in_cache);
+  pthread_mutex_unlock(&zip_cache_mutex);
+  if (destroy) {
+    archive_destroy(archive);
+  }
 }
 
 static struct local_file_header* local_file_header_at_offset(
@@ -317,11 +434,104 @@ static struct central_directory_file_header* cd_file_header_at_offset(
   return cdfh;
 }
 
+// walk the central directory once and index every usable entry by name
+// hash, so find_entry probes a table instead of rescanning the directory
+static void build_cd_index(struct bcc_zip_archive* archive) {
+  archive->index_built = -1;
+
+  uint32_t cap = 8;
+  while (cap < archive->cd_records * 2) {
+    cap <<= 1;
+  }
+  struct cd_index_slot* index = calloc(cap, sizeof(*index));
+  if (index == NULL) {
+    return;
+  }
+  uint32_t mask = cap - 1;
+
+  uint32_t offset = archive->cd_offset;
+  for (uint32_t i = 0; i < archive->cd_records; ++i) {
+    uint32_t record_offset = offset;
+    struct central_directory_file_header* cdfh =
+        cd_file_header_at_offset(archive, offset);
+    offset += sizeof(struct central_directory_file_header);
+    if (cdfh == NULL) {
+      free(index);
+      return;
+    }
+
+    uint16_t name_length = unaligned_uint16_read(cdfh->file_name_length);
+    const char* name = check_access(archive, offset, name_length);
+    if (name == NULL) {
+      free(index);
+      return;
+    }
+
+    uint16_t flags = unaligned_uint16_read(cdfh->flags);
+    if ((flags & FLAG_ENCRYPTED) == 0 &&
+        (flags & FLAG_HAS_DATA_DESCRIPTOR) == 0) {
+      uint32_t hash = zip_name_hash(name, name_length);
+      uint32_t probe = hash & mask;
+      while (index[probe].cdfh_offset != 0) {
+        probe = (probe + 1) & mask;
+      }
+      index[probe].hash = hash;
+      index[probe].cdfh_offset = record_offset + 1;
+    }
+
+    offset += name_length;
+    offset += unaligned_uint16_read(cdfh->extra_field_length);
+    offset += unaligned_uint16_read(cdfh->file_comment_length);
+  }
+
+  archive->index = index;
+  archive->index_mask = mask;
+  archive->index_built = 1;
+}
+
 int bcc_zip_archive_find_entry(struct bcc_zip_archive* archive,
                                const char* file_name,
                                struct bcc_zip_entry* out) {
   size_t file_name_length = strlen(file_name);
 
+  if (archive->index_built == 0) {
+    // cached archives can be shared between threads; build the index once
+    pthread_mutex_lock(&zip_cache_mutex);
+    if (archive->index_built == 0) {
+      build_cd_index(archive);
+    }
+    pthread_mutex_unlock(&zip_cache_mutex);
+  }
+
+  if (archive->index_built > 0) {
+    uint32_t hash = zip_name_hash(file_name, file_name_length);
+    for (uint32_t probe = hash & archive->index_mask;;
+         probe = (probe + 1) & archive->index_mask) {
+      struct cd_index_slot* slot = &archive->index[probe];
+      if (slot->cdfh_offset == 0) {
+        return -1;
+      }
+      if (slot->hash != hash) {
+        continue;
+      }
+      uint32_t record_offset = slot->cdfh_offset - 1;
+      struct central_directory_file_header* cdfh =
+          cd_file_header_at_offset(archive, record_offset);
+      if (cdfh == NULL) {
+        return -1;
+      }
+      uint16_t name_length = unaligned_uint16_read(cdfh->file_name_length);
+      const char* name = check_access(
+          archive, record_offset + sizeof(struct central_directory_file_header),
+          name_length);
+      if (name != NULL && name_length == file_name_length &&
+          memcmp(file_name, name, file_name_length) == 0) {
+        return get_entry_at_offset(archive, unaligned_uint32_read(cdfh->offset),
+                                   out);
+      }
+    }
+  }
+
   uint32_t offset = archive->cd_offset;
   for (uint32_t i = 0; i < archive->cd_records; ++i) {
     struct central_directory_file_header* cdfh =
@@ -52,12 +52,19 @@ struct bcc_zip_entry {
 };
 
 // Opens a zip archive. Returns NULL in case of an error.
+// Handles are served from a process-wide cache keyed by path and file
+// identity (device, inode, mtime, size), so repeated opens of the same
+// archive reuse one mapping and parsed central directory; a replaced
+// archive is re-opened fresh.
 struct bcc_zip_archive* bcc_zip_archive_open(const char* path);
 
-// Closes a zip archive and releases resources.
+// Releases a reference obtained from bcc_zip_archive_open. The mapping may
+// stay cached for later sessions; resources are freed once the archive has
+// been evicted from the cache and the last reference dropped.
 void bcc_zip_archive_close(struct bcc_zip_archive* archive);
 
-// Looks up data corresponding to a file in given zip archive.
+// Looks up data corresponding to a file in given zip archive via a name
+// hash index built over the central directory on first use.
 int bcc_zip_archive_find_entry(struct bcc_zip_archive* archive,
                                const char* name, struct bcc_zip_entry* out);
 
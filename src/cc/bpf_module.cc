@@ -36,6 +36,11 @@
 #include <llvm/IR/PassManager.h>
 #include <llvm/Passes/PassBuilder.h>
 #include <llvm/Transforms/IPO/AlwaysInliner.h>
+#include <llvm/Transforms/Scalar/IndVarSimplify.h>
+#include <llvm/Transforms/Scalar/LoopPassManager.h>
+#include <llvm/Transforms/Scalar/SimplifyCFG.h>
+#include <llvm/Transforms/Utils/LoopSimplify.h>
+#include <llvm/Transforms/Utils/SimplifyCFGOptions.h>
 #else
 #include <llvm/IR/LegacyPassManager.h>
 #endif
@@ -46,13 +51,27 @@
 #include <llvm/Object/SymbolSize.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Transforms/IPO.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 #if LLVM_VERSION_MAJOR <= 16
 #include <llvm/Transforms/IPO/PassManagerBuilder.h>
 #endif
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/MemoryBuffer.h>
 #include <net/if.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/utsname.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <fstream>
+#include <thread>
+
 #include <map>
 #include <set>
 #include <string>
@@ -61,6 +80,7 @@
 
 #include "bcc_btf.h"
 #include "bcc_debug.h"
+#include "bcc_stats.h"
 #include "bcc_elf.h"
 #include "bcc_libbpf_inc.h"
 #include "common.h"
@@ -206,12 +226,82 @@ int BPFModule::free_bcc_memory() {
   return bcc_free_memory();
 }
 
+// Reclaim the compiler's memory once loading is done. Function bodies and
+// sections still living in the JIT's heap are copied into buffers this
+// module owns, then both execution engines, the IR module and the
+// LLVMContext are destroyed. Program loading, table metadata, BTF and
+// (with DEBUG_SOURCE) disassembly keep working off the detached copies;
+// the JITed key/leaf string converters do not survive, so a sealed module
+// behaves like one built with rw_engine disabled. Idempotent once sealed;
+// fails if nothing has been loaded yet.
+int BPFModule::seal() {
+  if (lazy_finalize_ && mod_) {
+    // materialize everything still pending first: a sealed module has no
+    // compiler left for materialize_func() to run later
+    std::vector<std::string> pending;
+    prog_func_info_->for_each_func([&](std::string name, FuncInfo &info) {
+      if (!info.start_)
+        pending.push_back(name);
+    });
+    for (const auto &name : pending)
+      if (materialize_func(name))
+        return -1;
+    lazy_finalize_ = false;
+    mod_.reset();
+    ctx_.reset();
+    return 0;
+  }
+
+  if (!rw_engine_enabled_) {
+    if (num_functions() == 0)
+      return -1;
+    // finalize() / load_object() already detached the artifacts and dropped
+    // the engine; only the (unused) context may remain
+    ctx_.reset();
+    return 0;
+  }
+
+  if (!engine_)
+    return -1;
+
+  // detach the artifacts from the JIT's memory, mirroring the
+  // !rw_engine_enabled_ handling in finalize()
+  for (auto &section : sections_) {
+    uintptr_t size = get<1>(section.second);
+    uint8_t *addr = get<0>(section.second);
+    uint8_t *tmp_p = NULL;
+    if (addr && strncmp("maps/", section.first.c_str(), 5)) {
+      tmp_p = new uint8_t[size];
+      memcpy(tmp_p, addr, size);
+    }
+    section.second = make_tuple(tmp_p, size, get<2>(section.second));
+  }
+  prog_func_info_->for_each_func([](std::string name, FuncInfo &info) {
+    if (!info.start_)
+      return;
+    uint8_t *tmp_p = new uint8_t[info.size_];
+    memcpy(tmp_p, info.start_, info.size_);
+    info.start_ = tmp_p;
+  });
+
+  engine_.reset();
+  cleanup_rw_engine();
+  // the reader/writer maps key on Types owned by the dying context
+  readers_.clear();
+  writers_.clear();
+  ctx_.reset();
+  // table_key_scanf and friends check this at call time, and the destructor
+  // keys the ownership of the detached buffers off it
+  rw_engine_enabled_ = false;
+  return 0;
+}
+
 // load an entire c file as a module
 int BPFModule::load_cfile(const string &file, bool in_memory, const char *cflags[], int ncflags) {
   ClangLoader clang_loader(&*ctx_, flags_);
   if (clang_loader.parse(&mod_, *ts_, file, in_memory, cflags, ncflags, id_,
                          *prog_func_info_, mod_src_, maps_ns_, fake_fd_map_,
-                         perf_events_))
+                         perf_events_, field_accesses_))
     return -1;
   return 0;
 }
@@ -226,7 +316,7 @@ int BPFModule::load_includes(const string &text) {
   const char *cflags[] = {"-DB_WORKAROUND"};
   if (clang_loader.parse(&mod_, *ts_, text, true, cflags, 1, "",
                          *prog_func_info_, mod_src_, "", fake_fd_map_,
-                         perf_events_))
+                         perf_events_, field_accesses_))
     return -1;
   return 0;
 }
@@ -273,7 +363,12 @@ void BPFModule::dump_ir(Module &mod) {
 }
 
 int BPFModule::run_pass_manager(Module &mod) {
-  if (verifyModule(mod, &errs())) {
+  // machine-generated IR (the rewriter output) can opt out of the IR
+  // verifier and the O3 pipeline; the kernel verifier still rejects any
+  // bad bytecode, so the failure mode is a later error, not a crash
+  bool trusted = flags_ & SKIP_IR_VERIFY;
+  bool verifier_friendly = flags_ & VERIFIER_FRIENDLY;
+  if (!trusted && verifyModule(mod, &errs())) {
     if (flags_ & DEBUG_LLVM_IR)
       dump_ir(mod);
     return -1;
@@ -287,23 +382,56 @@ int BPFModule::run_pass_manager(Module &mod) {
   ModuleAnalysisManager MAM;
 
   // Create the pass manager
-  PassBuilder PB;
+  PipelineTuningOptions PTO;
+  if (verifier_friendly) {
+    // a rolled bounded loop is verified once per distinct entry state;
+    // unrolling it makes the verifier walk every copy. Vector IR only
+    // gets scalarized back by the BPF backend anyway.
+    PTO.LoopUnrolling = false;
+    PTO.LoopVectorization = false;
+    PTO.SLPVectorization = false;
+  }
+  PassBuilder PB(nullptr, PTO);
   PB.registerModuleAnalyses(MAM);
   PB.registerCGSCCAnalyses(CGAM);
   PB.registerFunctionAnalyses(FAM);
   PB.registerLoopAnalyses(LAM);
   PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
-  auto MPM = PB.buildPerModuleDefaultPipeline(OptimizationLevel::O3);
+  // the BPF backend only needs inlining plus basic simplification; O1
+  // keeps always_inline honored and loops unrollable while dropping the
+  // expensive interprocedural passes
+  auto MPM = PB.buildPerModuleDefaultPipeline(
+      trusted ? OptimizationLevel::O1 : OptimizationLevel::O3);
 
   // Add passes and run
   MPM.addPass(AlwaysInlinerPass());
+  if (verifier_friendly) {
+    FunctionPassManager FPM;
+    // single-latch loops with one canonical induction variable give the
+    // verifier a tight trip-count bound to prune on
+    FPM.addPass(LoopSimplifyPass());
+    FPM.addPass(createFunctionToLoopPassAdaptor(IndVarSimplifyPass()));
+    // hoisting/sinking instructions common to both arms of a branch
+    // shrinks the per-path register-state delta, so divergent paths
+    // converge to states the verifier can recognize as equivalent
+    FPM.addPass(SimplifyCFGPass(
+        SimplifyCFGOptions().hoistCommonInsts(true).sinkCommonInsts(true)));
+    MPM.addPass(createModuleToFunctionPassAdaptor(std::move(FPM)));
+  }
   if (flags_ & DEBUG_LLVM_IR)
     MPM.addPass(PrintModulePass(outs()));
   MPM.run(mod, MAM);
 #else
   legacy::PassManager PM;
   PassManagerBuilder PMB;
-  PMB.OptLevel = 3;
+  PMB.OptLevel = trusted ? 1 : 3;
+  if (verifier_friendly) {
+    // older pass-manager equivalent: keep bounded loops rolled and skip
+    // vector IR the BPF backend would scalarize anyway
+    PMB.DisableUnrollLoops = true;
+    PMB.LoopVectorize = false;
+    PMB.SLPVectorize = false;
+  }
   PM.add(createFunctionInliningPass());
   /*
    * llvm < 4.0 needs
@@ -367,6 +495,26 @@ void BPFModule::load_btf(sec_map_def &sections) {
   btf_ = btf;
 }
 
+int BPFModule::set_map_tuning(const std::string &name,
+                              const MapTuning &tuning) {
+  if (maps_loaded_)
+    return -1;
+  map_tuning_[name] = tuning;
+  return 0;
+}
+
+// Fold a table's MapTuning into the creation attributes (and, with the same
+// arithmetic, into its TableDesc so userspace iteration sees the real size).
+static void apply_map_tuning(const BPFModule::MapTuning &tuning,
+                             uint32_t *max_entries, uint32_t *map_flags) {
+  if (tuning.max_entries_scale > 0)
+    *max_entries = (uint32_t)(*max_entries * tuning.max_entries_scale);
+  if (tuning.prealloc == 0)
+    *map_flags |= BPF_F_NO_PREALLOC;
+  else if (tuning.prealloc == 1)
+    *map_flags &= ~(uint32_t)BPF_F_NO_PREALLOC;
+}
+
 int BPFModule::create_maps(std::map<std::string, std::pair<int, int>> &map_tids,
                            std::map<int, int> &map_fds,
                            std::map<std::string, int> &inner_map_fds,
@@ -424,6 +572,15 @@ int BPFModule::create_maps(std::map<std::string, std::pair<int, int>> &map_tids,
       attr.map_ifindex = ifindex_;
       attr.inner_map_fd = inner_map_fd;
 
+      auto tuning = map_tuning_.find(map_name);
+      if (tuning != map_tuning_.end()) {
+        apply_map_tuning(tuning->second, &attr.max_entries, &attr.map_flags);
+        if (tuning->second.numa_node >= 0) {
+          attr.numa_node = tuning->second.numa_node;
+          attr.map_flags |= BPF_F_NUMA_NODE;
+        }
+      }
+
       if (map_tids.find(map_name) != map_tids.end()) {
         attr.btf_fd = btf_->get_fd();
         attr.btf_key_type_id = map_tids[map_name].first;
@@ -505,39 +662,77 @@ int BPFModule::load_maps(sec_map_def &sections) {
 
   // create maps
   std::map<std::string, int> inner_map_fds;
-  std::map<int, int> map_fds;
-  if (create_maps(map_tids, map_fds, inner_map_fds, true) < 0)
+  if (create_maps(map_tids, map_fds_, inner_map_fds, true) < 0)
     return -1;
-  if (create_maps(map_tids, map_fds, inner_map_fds, false) < 0)
+  if (create_maps(map_tids, map_fds_, inner_map_fds, false) < 0)
     return -1;
 
   // update map table fd's
   for (auto it = ts_->begin(), up = ts_->end(); it != up; ++it) {
     TableDesc &table = it->second;
-    if (map_fds.find(table.fake_fd) != map_fds.end()) {
-      table.fd = map_fds[table.fake_fd];
+    if (map_fds_.find(table.fake_fd) != map_fds_.end()) {
+      table.fd = map_fds_[table.fake_fd];
       table.fake_fd = 0;
+      // shared-namespace entries (/ns/...) get an ownership lease so a
+      // supervisor can reclaim them if this process dies; see
+      // TableStorage::Gc()
+      const std::string ns_prefix = Path::DELIM + "ns" + Path::DELIM;
+      if (it->first.compare(0, ns_prefix.size(), ns_prefix) == 0)
+        ts_->Heartbeat(Path::from_string(it->first));
+    }
+    auto tuning = map_tuning_.find(table.name);
+    if (tuning != map_tuning_.end()) {
+      uint32_t max_entries = table.max_entries, flags = table.flags;
+      apply_map_tuning(tuning->second, &max_entries, &flags);
+      table.max_entries = max_entries;
+      table.flags = (int)flags;
+    }
+    auto tids = map_tids.find(table.name);
+    if (tids != map_tids.end()) {
+      table.btf_key_tid = tids->second.first;
+      table.btf_value_tid = tids->second.second;
     }
   }
 
   // update instructions
   prog_func_info_->for_each_func([&](std::string name, FuncInfo &info) {
-    struct bpf_insn *insns = (struct bpf_insn *)info.start_;
-    uint32_t i, num_insns = info.size_ / sizeof(struct bpf_insn);
-    for (i = 0; i < num_insns; i++) {
-      if (insns[i].code == (BPF_LD | BPF_DW | BPF_IMM)) {
-        // change map_fd is it is a ld_pseudo
-        if (insns[i].src_reg == BPF_PSEUDO_MAP_FD &&
-            map_fds.find(insns[i].imm) != map_fds.end())
-          insns[i].imm = map_fds[insns[i].imm];
-        i++;
-      }
-    }
+    patch_map_fds(info);
   });
 
   return 0;
 }
 
+// tagged hash a BPF_CONFIG accessor embeds as its ld_imm64 immediate; must
+// match __BPF_CONFIG_HASH in export/helpers.h (FNV-1a over at most the first
+// 16 characters, truncated to 48 bits, 0xbcc0 tag in the top 16)
+static uint64_t config_magic(const std::string &name) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < name.size() && i < 16; i++)
+    h = (h ^ (unsigned char)name[i]) * 0x100000001b3ull;
+  return 0xbcc0000000000000ull | (h & 0xffffffffffffull);
+}
+
+int BPFModule::set_config(const std::string &name, uint64_t value) {
+  config_values_[config_magic(name)] = value;
+  return 0;
+}
+
+// rewrite ld_pseudo map loads from the fake fds assigned at rewrite time to
+// the fds of the created maps
+void BPFModule::patch_map_fds(FuncInfo &info) {
+  struct bpf_insn *insns = (struct bpf_insn *)info.start_;
+  uint32_t i, num_insns = info.size_ / sizeof(struct bpf_insn);
+  for (i = 0; i < num_insns; i++) {
+    if (insns[i].code == (BPF_LD | BPF_DW | BPF_IMM)) {
+      // change map_fd is it is a ld_pseudo
+      if (insns[i].src_reg == BPF_PSEUDO_MAP_FD &&
+          map_fds_.find(insns[i].imm) != map_fds_.end())
+        insns[i].imm = map_fds_[insns[i].imm];
+      i++;
+    }
+  }
+}
+
 int BPFModule::finalize() {
   Module *mod = &*mod_;
   sec_map_def tmp_sections,
@@ -550,8 +745,29 @@ int BPFModule::finalize() {
   mod->setDataLayout("E-m:e-p:64:64-i64:64-i128:128-n32:64-S128");
 #endif
 
+  // Lazy finalization: keep the annotated module and defer all codegen
+  // (and map creation) to materialize_func(), so startup cost scales with
+  // the functions actually requested rather than everything in the program.
+  if (!rw_engine_enabled_ && ::getenv("BCC_LAZY_COMPILE")) {
+    lazy_finalize_ = true;
+    return 0;
+  }
+
+  // Parallel codegen (BCC_PARALLEL_COMPILE): large generated programs with
+  // many functions optimize per function across threads. Needs the same
+  // conditions as the detached-section path -- no rw_engine holding the
+  // context, no source debugger wanting the full module.
+  if (!rw_engine_enabled_ && !(flags_ & DEBUG_SOURCE) &&
+      ::getenv("BCC_PARALLEL_COMPILE")) {
+    size_t nfuncs = 0;
+    prog_func_info_->for_each_func([&](std::string, FuncInfo &) { nfuncs++; });
+    if (nfuncs > 1)
+      return parallel_finalize();
+  }
+
   sections_p = rw_engine_enabled_ ? &sections_ : &tmp_sections;
 
+  uint64_t span = bcc_trace_begin();
   string err;
   EngineBuilder builder(move(mod_));
   builder.setErrorStr(&err);
@@ -574,20 +790,41 @@ int BPFModule::finalize() {
     return rc;
 
   engine_->finalizeObject();
+  bcc_trace_end("llvm_codegen", span);
   prog_func_info_->for_each_func([&](std::string name, FuncInfo &info) {
     info.start_ = (uint8_t *)engine_->getFunctionAddress(name);
   });
   finalize_prog_func_info();
 
-  if (flags_ & DEBUG_SOURCE) {
-    SourceDebugger src_debugger(mod, *sections_p, *prog_func_info_, mod_src_,
-                                src_dbg_fmap_);
-    src_debugger.dump();
-  }
+  if (flags_ & DEBUG_SOURCE)
+    // constructing the debugger only snapshots the debug sections;
+    // disassembly itself is deferred until disassemble() asks for a
+    // function, so debug-enabled hosts do not pay for it at load time
+    src_debugger_.reset(new SourceDebugger(mod, *sections_p, *prog_func_info_,
+                                           mod_src_, src_dbg_fmap_));
+
+  // retain the compact insn->source-line index for verifier-error
+  // attribution; a cheap line-table walk, no disassembler involved
+  func_line_tables_ = build_func_line_tables(mod, *sections_p,
+                                             *prog_func_info_);
 
+  span = bcc_trace_begin();
   load_btf(*sections_p);
+  bcc_trace_end("btf_load", span);
+
+  if (!cache_file_.empty()) {
+    // snapshot instructions before map fds are patched in, for the object cache
+    prog_func_info_->for_each_func([&](std::string name, FuncInfo &info) {
+      if (info.start_)
+        cache_insns_[name] = string((const char *)info.start_, info.size_);
+    });
+  }
+
+  span = bcc_trace_begin();
   if (load_maps(*sections_p))
     return -1;
+  bcc_trace_end("map_create", span);
+  maps_loaded_ = true;
 
   if (!rw_engine_enabled_) {
     // Setup sections_ correctly and then free llvm internal memory
@@ -616,6 +853,252 @@ int BPFModule::finalize() {
   return 0;
 }
 
+// Compile a single function on demand when lazy finalization is active.
+// Codegen runs on a clone of the annotated module with every other program
+// function's body dropped, so its cost tracks the one function being
+// requested. Shared state -- BTF and map creation -- is taken from the first
+// materialized object; later objects only patch their own instructions.
+int BPFModule::materialize_func(const string &name) {
+  if (!lazy_finalize_ || !mod_)
+    return 0;
+  auto fn = prog_func_info_->get_func(name);
+  if (!fn)
+    return -1;
+  if (fn->start_)
+    return 0;
+
+  auto clone = CloneModule(*mod_);
+  Module *mod = &*clone;
+
+  vector<Function *> unused;
+  prog_func_info_->for_each_func([&](std::string other, FuncInfo &info) {
+    if (other == name)
+      return;
+    if (Function *f = mod->getFunction(other)) {
+      f->deleteBody();
+      if (f->use_empty())
+        unused.push_back(f);
+    }
+  });
+  for (Function *f : unused)
+    f->eraseFromParent();
+
+  sec_map_def tmp_sections;
+  string err;
+  EngineBuilder builder(move(clone));
+  builder.setErrorStr(&err);
+  builder.setMCJITMemoryManager(
+      ebpf::make_unique<MyMemoryManager>(&tmp_sections, &*prog_func_info_));
+  builder.setMArch("bpf");
+  builder.setMCPU("v1");
+#if LLVM_VERSION_MAJOR <= 11
+  builder.setUseOrcMCJITReplacement(false);
+#endif
+  auto engine = unique_ptr<ExecutionEngine>(builder.create());
+  if (!engine) {
+    fprintf(stderr, "Could not create ExecutionEngine: %s\n", err.c_str());
+    return -1;
+  }
+  engine->setProcessAllSections(true);
+
+  if (int rc = run_pass_manager(*mod))
+    return rc;
+
+  engine->finalizeObject();
+  fn->start_ = (uint8_t *)engine->getFunctionAddress(name);
+  if (!fn->start_)
+    return -1;
+
+  // the object carries BTF for this function; reload so bcc_func_load picks
+  // up its func_info/line_info
+  if (btf_) {
+    delete btf_;
+    btf_ = nullptr;
+  }
+  load_btf(tmp_sections);
+
+  if (!maps_loaded_) {
+    if (load_maps(tmp_sections)) {
+      fn->start_ = nullptr;
+      return -1;
+    }
+    maps_loaded_ = true;
+  } else {
+    patch_map_fds(*fn);
+  }
+
+  // the engine dies with this scope, so detach the function body and any
+  // sections we have not seen yet (mirrors the !rw_engine_enabled_ handling
+  // in finalize())
+  uint8_t *tmp_p = new uint8_t[fn->size_];
+  memcpy(tmp_p, fn->start_, fn->size_);
+  fn->start_ = tmp_p;
+  for (auto section : tmp_sections) {
+    if (sections_.find(section.first) != sections_.end())
+      continue;
+    uintptr_t size = get<1>(section.second);
+    uint8_t *p = NULL;
+    if (strncmp("maps/", section.first.c_str(), 5)) {
+      p = new uint8_t[size];
+      memcpy(p, get<0>(section.second), size);
+    }
+    sections_[section.first] = make_tuple(p, size, get<2>(section.second));
+  }
+
+  return 0;
+}
+
+// Split codegen into per-function jobs (BCC_PARALLEL_COMPILE). Each BPF
+// program function is isolated by construction, so every worker round-trips
+// the annotated module through bitcode into its own LLVMContext (CloneModule
+// would share ctx_, and contexts are not thread-safe), drops the other
+// program function bodies exactly like materialize_func(), and runs the pass
+// pipeline and MCJIT independently. Function sections are distinct
+// (.bpf.fn.<name>), so the merge takes the first copy of every shared
+// section; that includes .BTF, whose func_info/line_info then cover only the
+// first job's function -- the rest load without them, as in the lazy path.
+int BPFModule::parallel_finalize() {
+  uint64_t span = bcc_trace_begin();
+  SmallString<0> bitcode;
+  {
+    raw_svector_ostream os(bitcode);
+    WriteBitcodeToFile(*mod_, os);
+  }
+
+  vector<string> names;
+  prog_func_info_->for_each_func(
+      [&](std::string name, FuncInfo &) { names.push_back(name); });
+
+  struct JobResult {
+    int rc = -1;
+    map<string, tuple<std::unique_ptr<uint8_t[]>, uintptr_t, unsigned>>
+        sections;
+    std::unique_ptr<uint8_t[]> func_body;
+  };
+  vector<JobResult> results(names.size());
+
+  auto run_job = [&](size_t idx) {
+    JobResult &res = results[idx];
+    const string &name = names[idx];
+
+    LLVMContext ctx;
+    auto parsed = parseBitcodeFile(
+        MemoryBufferRef(StringRef(bitcode.data(), bitcode.size()), "program"),
+        ctx);
+    if (!parsed) {
+      logAllUnhandledErrors(parsed.takeError(), errs(), "bitcode parse: ");
+      return;
+    }
+    unique_ptr<Module> mod = move(*parsed);
+    Module *raw = &*mod;
+
+    for (const string &other : names) {
+      if (other == name)
+        continue;
+      if (Function *f = raw->getFunction(other)) {
+        f->deleteBody();
+        if (f->use_empty())
+          f->eraseFromParent();
+      }
+    }
+
+    sec_map_def tmp_sections;
+    string err;
+    EngineBuilder builder(move(mod));
+    builder.setErrorStr(&err);
+    builder.setMCJITMemoryManager(
+        ebpf::make_unique<MyMemoryManager>(&tmp_sections, &*prog_func_info_));
+    builder.setMArch("bpf");
+    builder.setMCPU("v1");
+#if LLVM_VERSION_MAJOR <= 11
+    builder.setUseOrcMCJITReplacement(false);
+#endif
+    auto engine = unique_ptr<ExecutionEngine>(builder.create());
+    if (!engine) {
+      fprintf(stderr, "Could not create ExecutionEngine: %s\n", err.c_str());
+      return;
+    }
+    engine->setProcessAllSections(true);
+
+    if (run_pass_manager(*raw))
+      return;
+
+    engine->finalizeObject();
+    uint8_t *start = (uint8_t *)engine->getFunctionAddress(name);
+    auto fn = prog_func_info_->get_func(name);
+    if (!start || !fn)
+      return;
+
+    // the engine dies with this job; detach the function body and sections
+    res.func_body.reset(new uint8_t[fn->size_]);
+    memcpy(res.func_body.get(), start, fn->size_);
+    for (auto &section : tmp_sections) {
+      uintptr_t size = get<1>(section.second);
+      std::unique_ptr<uint8_t[]> p;
+      if (strncmp("maps/", section.first.c_str(), 5)) {
+        p.reset(new uint8_t[size]);
+        memcpy(p.get(), get<0>(section.second), size);
+      }
+      res.sections[section.first] =
+          make_tuple(move(p), size, get<2>(section.second));
+    }
+    res.rc = 0;
+  };
+
+  std::atomic<size_t> next(0);
+  size_t nworkers = std::min(names.size(), (size_t)4);
+  vector<std::thread> workers;
+  workers.reserve(nworkers);
+  for (size_t i = 0; i < nworkers; i++)
+    workers.emplace_back([&] {
+      for (size_t idx = next++; idx < names.size(); idx = next++)
+        run_job(idx);
+    });
+  for (auto &w : workers)
+    w.join();
+
+  for (auto &res : results)
+    if (res.rc)
+      return -1;
+
+  for (size_t i = 0; i < names.size(); i++) {
+    auto fn = prog_func_info_->get_func(names[i]);
+    fn->start_ = results[i].func_body.release();
+    for (auto &section : results[i].sections) {
+      if (sections_.find(section.first) != sections_.end())
+        continue;
+      sections_[section.first] =
+          make_tuple(get<0>(section.second).release(), get<1>(section.second),
+                     get<2>(section.second));
+    }
+  }
+  bcc_trace_end("llvm_codegen", span);
+
+  finalize_prog_func_info();
+
+  span = bcc_trace_begin();
+  load_btf(sections_);
+  bcc_trace_end("btf_load", span);
+
+  if (!cache_file_.empty()) {
+    // snapshot instructions before map fds are patched in, for the object cache
+    prog_func_info_->for_each_func([&](std::string name, FuncInfo &info) {
+      if (info.start_)
+        cache_insns_[name] = string((const char *)info.start_, info.size_);
+    });
+  }
+
+  span = bcc_trace_begin();
+  if (load_maps(sections_))
+    return -1;
+  bcc_trace_end("map_create", span);
+  maps_loaded_ = true;
+
+  mod_.reset();
+  ctx_.reset();
+  return 0;
+}
+
 void BPFModule::finalize_prog_func_info() {
   // prog_func_info_'s FuncInfo data is gradually populated (first in frontend
   // action, then bpf_module). It's possible for a FuncInfo to have been
@@ -646,13 +1129,16 @@ const char * BPFModule::function_name(size_t id) const {
 }
 
 uint8_t * BPFModule::function_start(size_t id) const {
-  auto fn = prog_func_info_->get_func(id);
-  if (fn)
-    return fn->start_;
+  auto name = prog_func_info_->func_name(id);
+  if (name)
+    return function_start(*name);
   return nullptr;
 }
 
 uint8_t * BPFModule::function_start(const string &name) const {
+  if (lazy_finalize_ &&
+      const_cast<BPFModule *>(this)->materialize_func(name) != 0)
+    return nullptr;
   auto fn = prog_func_info_->get_func(name);
   if (fn)
     return fn->start_;
@@ -673,6 +1159,12 @@ const char * BPFModule::function_source_rewritten(const string &name) const {
   return "";
 }
 
+const char * BPFModule::disassemble(const string &name) {
+  if (!src_debugger_)
+    return "";
+  return src_debugger_->disassemble(name).c_str();
+}
+
 int BPFModule::annotate_prog_tag(const string &name, int prog_fd,
                                  struct bpf_insn *insns, int prog_len) {
   unsigned long long tag1, tag2;
@@ -725,6 +1217,8 @@ int BPFModule::annotate_prog_tag(const string &name, int prog_fd,
   src = function_source_rewritten(name);
   write(fd, src, strlen(src));
 
+  if (src_debugger_)
+    src_debugger_->disassemble(name);
   if (!src_dbg_fmap_[name].empty()) {
     ::snprintf(buf, sizeof(buf), BCC_PROG_TAG_DIR "/bpf_prog_%llx/%s.dis.txt",
                tag1, name.data());
@@ -742,13 +1236,16 @@ int BPFModule::annotate_prog_tag(const string &name, int prog_fd,
 }
 
 size_t BPFModule::function_size(size_t id) const {
-  auto fn = prog_func_info_->get_func(id);
-  if (fn)
-    return fn->size_;
+  auto name = prog_func_info_->func_name(id);
+  if (name)
+    return function_size(*name);
   return 0;
 }
 
 size_t BPFModule::function_size(const string &name) const {
+  if (lazy_finalize_ &&
+      const_cast<BPFModule *>(this)->materialize_func(name) != 0)
+    return 0;
   auto fn = prog_func_info_->get_func(name);
   if (fn)
     return fn->size_;
@@ -860,6 +1357,26 @@ const char * BPFModule::table_leaf_desc(size_t id) const {
 const char * BPFModule::table_leaf_desc(const string &name) const {
   return table_leaf_desc(table_id(name));
 }
+
+unsigned BPFModule::table_btf_key_tid(size_t id) const {
+  if (id >= tables_.size())
+    return 0;
+  return tables_[id]->btf_key_tid;
+}
+
+unsigned BPFModule::table_btf_key_tid(const string &name) const {
+  return table_btf_key_tid(table_id(name));
+}
+
+unsigned BPFModule::table_btf_value_tid(size_t id) const {
+  if (id >= tables_.size())
+    return 0;
+  return tables_[id]->btf_value_tid;
+}
+
+unsigned BPFModule::table_btf_value_tid(const string &name) const {
+  return table_btf_value_tid(table_id(name));
+}
 size_t BPFModule::table_key_size(size_t id) const {
   if (id >= tables_.size())
     return 0;
@@ -935,6 +1452,526 @@ int BPFModule::table_leaf_scanf(size_t id, const char *leaf_str, void *leaf) {
   return 0;
 }
 
+// Batch variants of the four converters above: the loop runs here, on the
+// already-JITed per-table converter, so language bindings dumping a large
+// map cross the FFI boundary once per map instead of once per entry.
+int BPFModule::table_key_printf_batch(size_t id, char *buf, size_t buf_stride,
+                                      const void *keys, size_t n) {
+  if (id >= tables_.size())
+    return -1;
+  const TableDesc &desc = *tables_[id];
+  const uint8_t *key = static_cast<const uint8_t *>(keys);
+  for (size_t i = 0; i < n; i++, key += desc.key_size) {
+    StatusTuple rc = desc.key_snprintf(buf + i * buf_stride, buf_stride, key);
+    if (rc.code() < 0) {
+      fprintf(stderr, "%s\n", rc.msg().c_str());
+      return i;
+    }
+  }
+  return n;
+}
+
+int BPFModule::table_leaf_printf_batch(size_t id, char *buf,
+                                       size_t buf_stride, const void *leaves,
+                                       size_t n) {
+  if (id >= tables_.size())
+    return -1;
+  const TableDesc &desc = *tables_[id];
+  const uint8_t *leaf = static_cast<const uint8_t *>(leaves);
+  for (size_t i = 0; i < n; i++, leaf += desc.leaf_size) {
+    StatusTuple rc =
+        desc.leaf_snprintf(buf + i * buf_stride, buf_stride, leaf);
+    if (rc.code() < 0) {
+      fprintf(stderr, "%s\n", rc.msg().c_str());
+      return i;
+    }
+  }
+  return n;
+}
+
+int BPFModule::table_key_scanf_batch(size_t id, const char *const *key_strs,
+                                     void *keys, size_t n) {
+  if (id >= tables_.size())
+    return -1;
+  const TableDesc &desc = *tables_[id];
+  uint8_t *key = static_cast<uint8_t *>(keys);
+  for (size_t i = 0; i < n; i++, key += desc.key_size) {
+    StatusTuple rc = desc.key_sscanf(key_strs[i], key);
+    if (rc.code() < 0) {
+      fprintf(stderr, "%s\n", rc.msg().c_str());
+      return i;
+    }
+  }
+  return n;
+}
+
+int BPFModule::table_leaf_scanf_batch(size_t id, const char *const *leaf_strs,
+                                      void *leaves, size_t n) {
+  if (id >= tables_.size())
+    return -1;
+  const TableDesc &desc = *tables_[id];
+  uint8_t *leaf = static_cast<uint8_t *>(leaves);
+  for (size_t i = 0; i < n; i++, leaf += desc.leaf_size) {
+    StatusTuple rc = desc.leaf_sscanf(leaf_strs[i], leaf);
+    if (rc.code() < 0) {
+      fprintf(stderr, "%s\n", rc.msg().c_str());
+      return i;
+    }
+  }
+  return n;
+}
+
+// On-disk cache of finalized BPF objects, keyed on the program text, cflags,
+// kernel release and kernel BTF identity. A cache hit skips ClangLoader::parse
+// and LLVM codegen entirely. Enabled by pointing BCC_OBJECT_CACHE_DIR at a
+// writable directory; only available when the rw_engine is disabled, since the
+// JITed key/leaf converters cannot be restored from disk.
+static const uint32_t OBJ_CACHE_MAGIC = 0xb9cca9e1;
+static const uint32_t OBJ_CACHE_VERSION = 2;
+
+static void cache_write_u64(std::ofstream &os, uint64_t v) {
+  os.write(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+static void cache_write_str(std::ofstream &os, const string &s) {
+  cache_write_u64(os, s.size());
+  os.write(s.data(), s.size());
+}
+
+static bool cache_read_u64(std::ifstream &is, uint64_t *v) {
+  is.read(reinterpret_cast<char *>(v), sizeof(*v));
+  return !is.fail();
+}
+
+static bool cache_read_str(std::ifstream &is, string *s) {
+  uint64_t len;
+  if (!cache_read_u64(is, &len) || len > (64 << 20))
+    return false;
+  s->resize(len);
+  is.read(&(*s)[0], len);
+  return !is.fail();
+}
+
+// Compile-offload transport hooks for the object cache. On a local cache
+// miss, BCC_OBJECT_CACHE_FETCH_CMD is run as `cmd <key> <dest>`; if it exits
+// 0 and leaves a valid artifact at <dest>, the local compile is skipped.
+// After a local compile populates the cache, BCC_OBJECT_CACHE_STORE_CMD is
+// run as `cmd <key> <src>` so a fleet artifact service can publish the
+// object — a new kernel rollout then compiles each program once per fleet
+// rather than once per host. The key is the cache file basename and already
+// covers the program text, cflags, kernel release and kernel BTF identity;
+// the transport is any executable (curl wrapper, rsync script, ...).
+static int run_cache_transport(const char *cmd, const string &key,
+                               const string &path) {
+  string full = string(cmd) + " '" + key + "' '" + path + "'";
+  return ::system(full.c_str()) == 0 ? 0 : -1;
+}
+
+static string obj_cache_key(const string &path) {
+  size_t slash = path.rfind('/');
+  return (slash == string::npos) ? path : path.substr(slash + 1);
+}
+
+static int fetch_remote_object(const string &path) {
+  const char *cmd = ::getenv("BCC_OBJECT_CACHE_FETCH_CMD");
+  if (!cmd || !*cmd)
+    return -1;
+  // fetch into a private file first so a failed or partial transfer never
+  // poisons the cache entry other processes may be racing on
+  string tmp_path = path + ".fetch." + std::to_string(::getpid());
+  if (run_cache_transport(cmd, obj_cache_key(path), tmp_path) != 0 ||
+      ::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    ::unlink(tmp_path.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+// Host-local compile daemon transport. With BCC_COMPILE_DAEMON pointing at
+// the unix socket of a running bccd (introspection/bccd.cc), a cache miss
+// ships {flags, text, cflags} to the daemon, which keeps a warm Clang/LLVM
+// across requests and replies with an artifact in the object cache format.
+// The client then only creates maps and loads instructions, so short-lived
+// tools skip compiler startup entirely while only the daemon pays compiler
+// memory. Only the artifact travels — maps and programs are still created
+// by this process, so map sharing and namespacing semantics are unchanged.
+static const uint32_t COMPILE_DAEMON_MAGIC = 0xb0ccdae1;
+static const uint32_t COMPILE_DAEMON_VERSION = 1;
+
+static bool daemon_io_full(int fd, void *buf, size_t len, bool do_write) {
+  char *p = static_cast<char *>(buf);
+  while (len > 0) {
+    ssize_t n = do_write ? ::write(fd, p, len) : ::read(fd, p, len);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR)
+        continue;
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static int daemon_compile_object(unsigned flags, const string &text,
+                                 const char *cflags[], int ncflags,
+                                 string *blob) {
+  const char *sock_path = ::getenv("BCC_COMPILE_DAEMON");
+  if (!sock_path || !*sock_path)
+    return -1;
+
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (strlen(sock_path) >= sizeof(addr.sun_path))
+    return -1;
+  strcpy(addr.sun_path, sock_path);
+
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+  // a wedged daemon must not hang every tool on the host indefinitely; the
+  // budget still covers a full cold compile on the daemon side
+  struct timeval tv = {120, 0};
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  if (::connect(fd, reinterpret_cast<struct sockaddr *>(&addr),
+                sizeof(addr)) < 0) {
+    ::close(fd);
+    return -1;
+  }
+
+  string req;
+  auto put_u32 = [&req](uint32_t v) {
+    req.append(reinterpret_cast<const char *>(&v), sizeof(v));
+  };
+  auto put_str = [&req](const char *s, size_t n) {
+    uint64_t len = n;
+    req.append(reinterpret_cast<const char *>(&len), sizeof(len));
+    req.append(s, n);
+  };
+  put_u32(COMPILE_DAEMON_MAGIC);
+  put_u32(COMPILE_DAEMON_VERSION);
+  put_u32(flags);
+  put_u32(ncflags);
+  put_str(text.data(), text.size());
+  for (int i = 0; i < ncflags; i++)
+    put_str(cflags[i], strlen(cflags[i]));
+
+  uint32_t status;
+  uint64_t len;
+  if (!daemon_io_full(fd, &req[0], req.size(), true) ||
+      !daemon_io_full(fd, &status, sizeof(status), false) ||
+      !daemon_io_full(fd, &len, sizeof(len), false) || len > (64 << 20)) {
+    ::close(fd);
+    return -1;
+  }
+  blob->resize(len);
+  bool ok = len == 0 || daemon_io_full(fd, &(*blob)[0], len, false);
+  ::close(fd);
+  if (!ok)
+    return -1;
+  if (status != 0) {
+    // the payload of an error reply is the daemon's diagnostic text
+    fprintf(stderr, "bccd: %.*s\n", (int)(len > 4096 ? 4096 : len),
+            blob->data());
+    return -1;
+  }
+  return 0;
+}
+
+string BPFModule::obj_cache_file(const string &text, const char *cflags[],
+                                 int ncflags) {
+  const char *dir = ::getenv("BCC_OBJECT_CACHE_DIR");
+  if (!dir || !*dir || rw_engine_enabled_)
+    return "";
+
+  MD5 md5;
+  md5.update(text);
+  for (int i = 0; i < ncflags; i++) {
+    md5.update(StringRef(cflags[i]));
+    md5.update(StringRef("\0", 1));
+  }
+
+  struct utsname un;
+  if (uname(&un) == 0)
+    md5.update(StringRef(un.release));
+
+  // cheap proxy for the vmlinux BTF blob identity
+  struct stat st;
+  if (::stat("/sys/kernel/btf/vmlinux", &st) == 0) {
+    md5.update(ArrayRef<uint8_t>((uint8_t *)&st.st_size, sizeof(st.st_size)));
+    md5.update(ArrayRef<uint8_t>((uint8_t *)&st.st_mtime, sizeof(st.st_mtime)));
+  }
+
+  MD5::MD5Result result;
+  md5.final(result);
+  SmallString<32> hex = result.digest();
+  return string(dir) + "/bcc_obj_" + hex.c_str() + ".cache";
+}
+
+int BPFModule::load_cached_object(const string &path) {
+  std::ifstream is(path, std::ios::binary);
+  if (!is.is_open())
+    return -1;
+
+  // a corrupt or truncated cache entry must leave no partial state behind, so
+  // that the caller can fall back to a full compile
+  auto fail = [&]() {
+    prog_func_info_->for_each_func([](std::string name, FuncInfo &info) {
+      delete[] info.start_;
+      info.start_ = nullptr;
+    });
+    prog_func_info_->clear();
+    for (auto &section : sections_)
+      delete[] get<0>(section.second);
+    sections_.clear();
+    tables_.clear();
+    table_names_.clear();
+    fake_fd_map_.clear();
+    field_accesses_.clear();
+    ts_->DeletePrefix(Path({id_}));
+    return -1;
+  };
+
+  uint64_t magic, version, nfuncs, nsections, ntables, nmaps;
+  if (!cache_read_u64(is, &magic) || magic != OBJ_CACHE_MAGIC)
+    return fail();
+  if (!cache_read_u64(is, &version) || version != OBJ_CACHE_VERSION)
+    return fail();
+
+  if (!cache_read_u64(is, &nfuncs))
+    return fail();
+  for (uint64_t i = 0; i < nfuncs; i++) {
+    string name, section, insns;
+    if (!cache_read_str(is, &name) || !cache_read_str(is, &section) ||
+        !cache_read_str(is, &insns))
+      return fail();
+    auto info = prog_func_info_->add_func(name);
+    if (!info)
+      return fail();
+    uint8_t *start = new uint8_t[insns.size()];
+    memcpy(start, insns.data(), insns.size());
+    info->start_ = start;
+    info->size_ = insns.size();
+    info->section_ = section;
+  }
+
+  if (!cache_read_u64(is, &nsections))
+    return fail();
+  for (uint64_t i = 0; i < nsections; i++) {
+    string name, data;
+    uint64_t sec_id;
+    if (!cache_read_str(is, &name) || !cache_read_str(is, &data) ||
+        !cache_read_u64(is, &sec_id))
+      return fail();
+    uint8_t *addr = new uint8_t[data.size()];
+    memcpy(addr, data.data(), data.size());
+    sections_[name] = make_tuple(addr, data.size(), (unsigned)sec_id);
+  }
+
+  if (!cache_read_u64(is, &ntables))
+    return fail();
+  for (uint64_t i = 0; i < ntables; i++) {
+    TableDesc table;
+    uint64_t type, key_size, leaf_size, max_entries, flags, fake_fd;
+    if (!cache_read_str(is, &table.name) || !cache_read_u64(is, &type) ||
+        !cache_read_u64(is, &key_size) || !cache_read_u64(is, &leaf_size) ||
+        !cache_read_u64(is, &max_entries) || !cache_read_u64(is, &flags) ||
+        !cache_read_u64(is, &fake_fd) || !cache_read_str(is, &table.key_desc) ||
+        !cache_read_str(is, &table.leaf_desc))
+      return fail();
+    table.type = type;
+    table.key_size = key_size;
+    table.leaf_size = leaf_size;
+    table.max_entries = max_entries;
+    table.flags = flags;
+    table.fake_fd = fake_fd;
+    table.key_sscanf = unimplemented_sscanf;
+    table.leaf_sscanf = unimplemented_sscanf;
+    table.key_snprintf = unimplemented_snprintf;
+    table.leaf_snprintf = unimplemented_snprintf;
+    ts_->Insert(Path({id_, table.name}), move(table));
+  }
+
+  if (!cache_read_u64(is, &nmaps))
+    return fail();
+  for (uint64_t i = 0; i < nmaps; i++) {
+    uint64_t fake_fd, type, key_size, value_size, max_entries, flags, pinned_id;
+    string name, inner_map_name, pinned;
+    if (!cache_read_u64(is, &fake_fd) || !cache_read_u64(is, &type) ||
+        !cache_read_str(is, &name) || !cache_read_u64(is, &key_size) ||
+        !cache_read_u64(is, &value_size) || !cache_read_u64(is, &max_entries) ||
+        !cache_read_u64(is, &flags) || !cache_read_u64(is, &pinned_id) ||
+        !cache_read_str(is, &inner_map_name) || !cache_read_str(is, &pinned))
+      return fail();
+    fake_fd_map_[fake_fd] =
+        make_tuple((int)type, name, (int)key_size, (int)value_size,
+                   (int)max_entries, (int)flags, (int)pinned_id,
+                   inner_map_name, pinned);
+  }
+
+  if (!cache_read_str(is, &mod_src_))
+    return fail();
+
+  uint64_t naccesses;
+  if (!cache_read_u64(is, &naccesses))
+    return fail();
+  for (uint64_t i = 0; i < naccesses; i++) {
+    field_access_def access;
+    if (!cache_read_str(is, &access.struct_name) ||
+        !cache_read_str(is, &access.field_name) ||
+        !cache_read_u64(is, &access.bit_offset))
+      return fail();
+    field_accesses_.push_back(move(access));
+  }
+
+  // the artifact may have been compiled on another kernel; refuse to load it
+  // if any struct layout it baked in no longer holds, so the caller falls
+  // back to a fresh compile instead of reading garbage offsets
+  std::string layout_error;
+  if (verify_kernel_field_offsets(field_accesses_, layout_error) != 0) {
+    fprintf(stderr, "Rejecting BPF artifact %s: %s\n", path.c_str(),
+            layout_error.c_str());
+    return fail();
+  }
+
+  annotate_light();
+  if (load_maps(sections_))
+    return fail();
+  return 0;
+}
+
+void BPFModule::save_cached_object(const string &path) {
+  // Shared and extern tables reference maps outside of this module's
+  // namespace; replaying them from a cache would skip that linkage.
+  for (auto &table : tables_)
+    if (table->is_shared || table->is_extern)
+      return;
+
+  string tmp_path = path + ".tmp." + std::to_string(::getpid());
+  std::ofstream os(tmp_path, std::ios::binary | std::ios::trunc);
+  if (!os.is_open())
+    return;
+
+  cache_write_u64(os, OBJ_CACHE_MAGIC);
+  cache_write_u64(os, OBJ_CACHE_VERSION);
+
+  // cache_insns_ was snapshotted before load_maps patched real map fds into
+  // the instruction stream; the cached copy must keep the fake fds so that a
+  // later load can relocate against freshly created maps.
+  cache_write_u64(os, cache_insns_.size());
+  prog_func_info_->for_each_func([&](std::string name, FuncInfo &info) {
+    auto insns = cache_insns_.find(name);
+    if (insns == cache_insns_.end())
+      return;
+    cache_write_str(os, name);
+    cache_write_str(os, info.section_);
+    cache_write_str(os, insns->second);
+  });
+
+  cache_write_u64(os, sections_.size());
+  for (auto &section : sections_) {
+    cache_write_str(os, section.first);
+    uint8_t *addr = get<0>(section.second);
+    uintptr_t size = get<1>(section.second);
+    cache_write_str(os, addr ? string((const char *)addr, size) : string());
+    cache_write_u64(os, get<2>(section.second));
+  }
+
+  cache_write_u64(os, tables_.size());
+  for (auto &table : tables_) {
+    // load_maps() zeroed the table's fake_fd once the real map was created;
+    // recover it from fake_fd_map_ so a restore can relocate against it
+    uint64_t fake_fd = table->fake_fd;
+    for (auto &map : fake_fd_map_) {
+      if (get<1>(map.second) == table->name) {
+        fake_fd = map.first;
+        break;
+      }
+    }
+    cache_write_str(os, table->name);
+    cache_write_u64(os, table->type);
+    cache_write_u64(os, table->key_size);
+    cache_write_u64(os, table->leaf_size);
+    cache_write_u64(os, table->max_entries);
+    cache_write_u64(os, table->flags);
+    cache_write_u64(os, fake_fd);
+    cache_write_str(os, table->key_desc);
+    cache_write_str(os, table->leaf_desc);
+  }
+
+  cache_write_u64(os, fake_fd_map_.size());
+  for (auto &map : fake_fd_map_) {
+    cache_write_u64(os, map.first);
+    cache_write_u64(os, get<0>(map.second));
+    cache_write_str(os, get<1>(map.second));
+    cache_write_u64(os, get<2>(map.second));
+    cache_write_u64(os, get<3>(map.second));
+    cache_write_u64(os, get<4>(map.second));
+    cache_write_u64(os, get<5>(map.second));
+    cache_write_u64(os, get<6>(map.second));
+    cache_write_str(os, get<7>(map.second));
+    cache_write_str(os, get<8>(map.second));
+  }
+
+  cache_write_str(os, mod_src_);
+
+  cache_write_u64(os, field_accesses_.size());
+  for (auto &access : field_accesses_) {
+    cache_write_str(os, access.struct_name);
+    cache_write_str(os, access.field_name);
+    cache_write_u64(os, access.bit_offset);
+  }
+
+  os.close();
+  if (os.fail() || ::rename(tmp_path.c_str(), path.c_str())) {
+    ::unlink(tmp_path.c_str());
+    return;
+  }
+
+  // publish cache entries only; AOT artifacts have caller-chosen names that
+  // are not keyed on the program text
+  const char *store_cmd = ::getenv("BCC_OBJECT_CACHE_STORE_CMD");
+  if (store_cmd && *store_cmd && artifact_file_.empty())
+    run_cache_transport(store_cmd, obj_cache_key(path), path);
+}
+
+int BPFModule::set_object_output(const std::string &path) {
+  if (rw_engine_enabled_) {
+    fprintf(stderr, "AOT artifacts require the rw_engine to be disabled\n");
+    return -1;
+  }
+  if (lazy_finalize_) {
+    fprintf(stderr,
+            "AOT artifacts are incompatible with lazy finalization\n");
+    return -1;
+  }
+  if (!sections_.empty()) {
+    fprintf(stderr, "Program already initialized\n");
+    return -1;
+  }
+  if (path.empty())
+    return -1;
+  artifact_file_ = path;
+  return 0;
+}
+
+int BPFModule::load_object(const std::string &path) {
+  if (!sections_.empty()) {
+    fprintf(stderr, "Program already initialized\n");
+    return -1;
+  }
+  if (rw_engine_enabled_) {
+    fprintf(stderr, "AOT artifacts require the rw_engine to be disabled\n");
+    return -1;
+  }
+  if (load_cached_object(path) != 0) {
+    fprintf(stderr, "Unable to load BPF artifact %s\n", path.c_str());
+    return -1;
+  }
+  return 0;
+}
+
 // load a C file
 int BPFModule::load_c(const string &filename, const char *cflags[], int ncflags) {
   if (!sections_.empty()) {
@@ -964,8 +2001,58 @@ int BPFModule::load_string(const string &text, const char *cflags[], int ncflags
     fprintf(stderr, "Program already initialized\n");
     return -1;
   }
+
+  cache_file_ = obj_cache_file(text, cflags, ncflags);
+  if (artifact_file_.empty()) {
+    if (!cache_file_.empty()) {
+      if (load_cached_object(cache_file_) == 0)
+        return 0;
+      // local miss: ask the remote artifact service before compiling
+      if (fetch_remote_object(cache_file_) == 0 &&
+          load_cached_object(cache_file_) == 0)
+        return 0;
+    }
+    // still a miss: ask the host-local compile daemon before paying for a
+    // clang/LLVM pass of our own
+    if (!rw_engine_enabled_) {
+      string blob;
+      if (daemon_compile_object(flags_, text, cflags, ncflags, &blob) == 0) {
+        // materialize into the cache entry when one is configured, so later
+        // runs hit locally without a daemon round trip; otherwise use a
+        // scratch file just long enough to load from it
+        string path = cache_file_;
+        bool scratch = path.empty();
+        if (scratch)
+          path = "/tmp/bcc_daemon_obj_" + std::to_string(::getpid()) + "_" +
+                 id_ + ".cache";
+        string tmp_path = path + ".daemon." + std::to_string(::getpid());
+        std::ofstream os(tmp_path, std::ios::binary | std::ios::trunc);
+        if (os.is_open()) {
+          os.write(blob.data(), blob.size());
+          os.close();
+          if (!os.fail() &&
+              ::rename(tmp_path.c_str(), path.c_str()) == 0) {
+            int rc = load_cached_object(path);
+            if (scratch)
+              ::unlink(path.c_str());
+            if (rc == 0)
+              return 0;
+          } else {
+            ::unlink(tmp_path.c_str());
+          }
+        }
+      }
+    }
+  } else {
+    // AOT build mode: the artifact path is caller-chosen and not keyed on
+    // the program text, so never pre-load from it; compile and overwrite
+    cache_file_ = artifact_file_;
+  }
+
+  uint64_t span = bcc_trace_begin();
   if (int rc = load_cfile(text, true, cflags, ncflags))
     return rc;
+  bcc_trace_end("clang_frontend", span);
   if (rw_engine_enabled_) {
     if (int rc = annotate())
       return rc;
@@ -973,11 +2060,52 @@ int BPFModule::load_string(const string &text, const char *cflags[], int ncflags
     annotate_light();
   }
 
+  span = bcc_trace_begin();
   if (int rc = finalize())
     return rc;
+  bcc_trace_end("finalize", span);
+
+  // with lazy finalization there are no compiled functions to cache yet
+  if (!cache_file_.empty() && !lazy_finalize_)
+    save_cached_object(cache_file_);
   return 0;
 }
 
+// The verifier log echoes every instruction it walks as "N: (opcode) ...";
+// the last such line is where verification stopped. Returns -1 when the
+// log carries no instruction lines.
+static int parse_verifier_insn(const char *log) {
+  int insn = -1;
+  const char *p = log;
+  while (p && *p) {
+    if (*p >= '0' && *p <= '9') {
+      char *end;
+      long v = strtol(p, &end, 10);
+      if (*end == ':' && end[1] == ' ' && v >= 0 && v < BPF_MAXINSNS)
+        insn = (int)v;
+    }
+    p = strchr(p, '\n');
+    if (p)
+      p++;
+  }
+  return insn;
+}
+
+static std::string nth_source_line(const std::string &src, uint32_t line) {
+  size_t start = 0;
+  for (uint32_t i = 1; i < line; i++) {
+    start = src.find('\n', start);
+    if (start == std::string::npos)
+      return "";
+    start++;
+  }
+  size_t end = src.find('\n', start);
+  start = src.find_first_not_of(" \t", start);
+  if (start == std::string::npos || (end != std::string::npos && start >= end))
+    return "";
+  return src.substr(start, end == std::string::npos ? end : end - start);
+}
+
 int BPFModule::bcc_func_load(int prog_type, const char *name,
                 const struct bpf_insn *insns, int prog_len,
                 const char *license, unsigned kern_version,
@@ -1019,12 +2147,62 @@ int BPFModule::bcc_func_load(int prog_type, const char *name,
     }
   }
 
+  // substitute BPF_CONFIG constants before the verifier sees the program;
+  // the shared instruction buffer stays untouched (a config set later must
+  // not retroactively look applied to an already-loaded fd)
+  std::vector<struct bpf_insn> cfg_patched;
+  int num_insns = prog_len / (int)sizeof(struct bpf_insn);
+  for (int i = 0; i + 1 < num_insns; i++) {
+    if (insns[i].code == (BPF_LD | BPF_DW | BPF_IMM)) {
+      if (insns[i].src_reg == 0 &&
+          ((uint32_t)insns[i + 1].imm >> 16) == 0xbcc0) {
+        if (cfg_patched.empty())
+          cfg_patched.assign(insns, insns + num_insns);
+        uint64_t magic = ((uint64_t)(uint32_t)insns[i + 1].imm << 32) |
+                         (uint32_t)insns[i].imm;
+        auto cfg = config_values_.find(magic);
+        uint64_t v = (cfg == config_values_.end()) ? 0 : cfg->second;
+        cfg_patched[i].imm = (int)(uint32_t)v;
+        cfg_patched[i + 1].imm = (int)(uint32_t)(v >> 32);
+      }
+      i++;
+    }
+  }
+  if (!cfg_patched.empty())
+    insns = cfg_patched.data();
+
+  // When the caller brings no log buffer, capture the verifier log
+  // ourselves (on failure bcc_prog_load_xattr re-runs with logging either
+  // way) so the rejected instruction can be mapped back to source via the
+  // line index retained at finalize. Skipped when the caller asked for
+  // verbose logs, since then the arena path prints them even on success.
+  auto line_table = func_line_tables_.find(name);
+  std::vector<char> attrib_log;
+  bool want_attrib = log_buf == NULL && log_level == 0 &&
+                     line_table != func_line_tables_.end();
+  if (want_attrib) {
+    attrib_log.resize(LOG_BUF_SIZE);
+    attrib_log[0] = 0;
+    log_buf = attrib_log.data();
+    log_buf_size = attrib_log.size();
+  }
+
   ret = bcc_prog_load_xattr((enum bpf_prog_type)prog_type, name, license, insns, &opts, prog_len, log_buf, log_buf_size, allow_rlimit_);
   if (btf_) {
     free(func_info);
     free(line_info);
   }
 
+  if (want_attrib && ret < 0 && attrib_log[0]) {
+    int insn = parse_verifier_insn(attrib_log.data());
+    const std::vector<uint32_t> &lines = line_table->second;
+    if (insn >= 0 && (size_t)insn < lines.size() && lines[insn]) {
+      std::string src = nth_source_line(mod_src_, lines[insn]);
+      fprintf(stderr, "bpf: %s: insn %d rejected at line %u%s%s\n", name, insn,
+              lines[insn], src.empty() ? "" : ": ", src.c_str());
+    }
+  }
+
   return ret;
 }
 
@@ -53,6 +53,16 @@ enum {
   DEBUG_BPF_REGISTER_STATE = 0x10,
   // Debug BTF.
   DEBUG_BTF = 0x20,
+  // Skip LLVM IR verification and run a reduced optimization pipeline.
+  // For trusted machine-generated programs on hot load paths; the kernel
+  // verifier still checks the final bytecode.
+  SKIP_IR_VERIFY = 0x40,
+  // Shape the IR for kernel-verifier state pruning instead of minimum
+  // instruction count: bounded loops stay rolled with canonical induction
+  // variables, and common code is hoisted/sunk across branches so more
+  // paths reach state-equivalence checkpoints. Cuts verification time on
+  // large generated programs at some runtime cost.
+  VERIFIER_FRIENDLY = 0x80,
 };
 
 class TableDesc;
@@ -60,6 +70,8 @@ class TableStorage;
 class BLoader;
 class ClangLoader;
 class ProgFuncInfo;
+class SourceDebugger;
+struct FuncInfo;
 class BTF;
 
 bool bpf_module_rw_engine_enabled(void);
@@ -71,6 +83,7 @@ class BPFModule {
   void cleanup_rw_engine();
   int parse(llvm::Module *mod);
   int finalize();
+  int parallel_finalize();
   int annotate();
   void annotate_light();
   void finalize_prog_func_info();
@@ -83,6 +96,11 @@ class BPFModule {
   int load_cfile(const std::string &file, bool in_memory, const char *cflags[], int ncflags);
   int kbuild_flags(const char *uname_release, std::vector<std::string> *cflags);
   int run_pass_manager(llvm::Module &mod);
+  int generate_rw_converters(const std::string &table_name);
+  StatusTuple rw_sscanf(std::string table_name, bool is_key, const char *str,
+                        void *val);
+  StatusTuple rw_snprintf(std::string table_name, bool is_key, char *str,
+                          size_t sz, const void *val);
   StatusTuple sscanf(std::string fn_name, const char *str, void *val);
   StatusTuple snprintf(std::string fn_name, char *str, size_t sz,
                        const void *val);
@@ -92,6 +110,12 @@ class BPFModule {
                   std::map<int, int> &map_fds,
                   std::map<std::string, int> &inner_map_fds,
                   bool for_inner_map);
+  std::string obj_cache_file(const std::string &text, const char *cflags[],
+                             int ncflags);
+  int load_cached_object(const std::string &path);
+  void save_cached_object(const std::string &path);
+  int materialize_func(const std::string &name);
+  void patch_map_fds(FuncInfo &info);
 
  public:
   BPFModule(unsigned flags, TableStorage *ts = nullptr, bool rw_engine_enabled = true,
@@ -99,8 +123,44 @@ class BPFModule {
             const char *dev_name = nullptr);
   ~BPFModule();
   int free_bcc_memory();
+  // Destroy all LLVM/Clang state after loading, keeping only the detached
+  // runtime artifacts (instructions, sections, table metadata, BTF); cuts
+  // steady-state RSS for long-running processes holding many programs.
+  // JITed key/leaf string converters are dropped, as if rw_engine had been
+  // disabled. Returns 0 on success (idempotent), -1 before any load.
+  int seal();
   int load_c(const std::string &filename, const char *cflags[], int ncflags);
   int load_string(const std::string &text, const char *cflags[], int ncflags);
+  // Ahead-of-time compilation. set_object_output() makes the next
+  // load_string() additionally write a relocatable artifact to path:
+  // instructions with unresolved map fds, sections, table metadata and BTF,
+  // in the object-cache format. load_object() recreates a module from such
+  // an artifact, performing only map creation and fd relocation -- no
+  // clang/LLVM at runtime. The artifact is only valid against the kernel
+  // release and BTF it was compiled for, which the caller guarantees on
+  // homogeneous fleets; both calls require rw_engine to be disabled, since
+  // JITed key/leaf converters cannot be restored from disk.
+  int set_object_output(const std::string &path);
+  int load_object(const std::string &path);
+  // Per-table map creation tuning, applied when the map is created. All
+  // fields are optional; unset ones keep the declared behavior. numa_node
+  // >= 0 allocates the map's memory on that node (BPF_F_NUMA_NODE);
+  // prealloc 0/1 forces BPF_F_NO_PREALLOC on or off (hash-type maps only);
+  // max_entries_scale > 0 multiplies the declared max_entries, so one
+  // program source can be sized per host at load time.
+  struct MapTuning {
+    int numa_node = -1;
+    int prealloc = -1;
+    double max_entries_scale = 0.0;
+  };
+  // Returns -1 once maps have been created (call before load_string/load_c,
+  // or before the first function request under lazy compilation).
+  int set_map_tuning(const std::string &name, const MapTuning &tuning);
+  // Load-time specialization constants (see BPF_CONFIG in export/helpers.h):
+  // registers the value substituted into the instruction stream when a
+  // function is loaded. Must precede the function's first load;
+  // already-loaded programs keep the value they were verified with.
+  int set_config(const std::string &name, uint64_t value);
   std::string id() const { return id_; }
   std::string maps_ns() const { return maps_ns_; }
   size_t num_functions() const;
@@ -108,6 +168,9 @@ class BPFModule {
   uint8_t * function_start(const std::string &name) const;
   const char * function_source(const std::string &name) const;
   const char * function_source_rewritten(const std::string &name) const;
+  // source-annotated disassembly of one compiled function, produced on
+  // first request and cached; "" unless built with DEBUG_SOURCE
+  const char * disassemble(const std::string &name);
   int annotate_prog_tag(const std::string &name, int fd,
 			struct bpf_insn *insn, int prog_len);
   const char * function_name(size_t id) const;
@@ -132,10 +195,32 @@ class BPFModule {
   int table_key_scanf(size_t id, const char *buf, void *key);
   const char * table_leaf_desc(size_t id) const;
   const char * table_leaf_desc(const std::string &name) const;
+  // BTF type ids of a table's key/value types (0 without BTF); together with
+  // btf() these let consumers resolve layout without the JSON descriptions
+  unsigned table_btf_key_tid(size_t id) const;
+  unsigned table_btf_key_tid(const std::string &name) const;
+  unsigned table_btf_value_tid(size_t id) const;
+  unsigned table_btf_value_tid(const std::string &name) const;
+  BTF * btf() const { return btf_; }
   size_t table_leaf_size(size_t id) const;
   size_t table_leaf_size(const std::string &name) const;
   int table_leaf_printf(size_t id, char *buf, size_t buflen, const void *leaf);
   int table_leaf_scanf(size_t id, const char *buf, void *leaf);
+  // Batched string conversion: converts n entries with one library call,
+  // looping natively over the JITed converter, so dumping a large map
+  // pays one binding/FFI crossing instead of one per entry. Binary keys
+  // and leaves are packed contiguously at the table's key/leaf size;
+  // strings live at buf + i * buf_stride (each NUL-terminated within its
+  // stride). Returns the number of entries converted — n on success;
+  // conversion stops at the first failing entry.
+  int table_key_printf_batch(size_t id, char *buf, size_t buf_stride,
+                             const void *keys, size_t n);
+  int table_leaf_printf_batch(size_t id, char *buf, size_t buf_stride,
+                              const void *leaves, size_t n);
+  int table_key_scanf_batch(size_t id, const char *const *key_strs,
+                            void *keys, size_t n);
+  int table_leaf_scanf_batch(size_t id, const char *const *leaf_strs,
+                             void *leaves, size_t n);
   char * license() const;
   unsigned kern_version() const;
   TableStorage &table_storage() { return *ts_; }
@@ -160,7 +245,12 @@ class BPFModule {
   std::string proto_filename_;
   std::unique_ptr<llvm::LLVMContext> ctx_;
   std::unique_ptr<llvm::ExecutionEngine> engine_;
-  std::unique_ptr<llvm::ExecutionEngine> rw_engine_;
+  // key/leaf string converters are generated per table on first use; each
+  // generation round gets its own engine, and rw_fn_engines_ maps every
+  // converter function to the engine owning it (converters are shared
+  // between tables with identical key/leaf types)
+  std::vector<std::unique_ptr<llvm::ExecutionEngine>> rw_engines_;
+  std::map<std::string, llvm::ExecutionEngine *> rw_fn_engines_;
   std::unique_ptr<llvm::Module> mod_;
   std::unique_ptr<ProgFuncInfo> prog_func_info_;
   sec_map_def sections_;
@@ -168,15 +258,58 @@ class BPFModule {
   std::map<std::string, size_t> table_names_;
   std::map<llvm::Type *, std::string> readers_;
   std::map<llvm::Type *, std::string> writers_;
+  // lazy rw_engine bookkeeping: key/leaf types recorded at annotate() time
+  // (owned by ctx_), and the generated converter names once a table has
+  // been materialized
+  struct TableRWTypes {
+    llvm::Type *key_type;
+    llvm::Type *leaf_type;
+  };
+  struct TableRWNames {
+    std::string key_reader;
+    std::string leaf_reader;
+    std::string key_writer;
+    std::string leaf_writer;
+  };
+  std::map<std::string, TableRWTypes> rw_types_;
+  std::map<std::string, TableRWNames> rw_names_;
   std::string id_;
   std::string maps_ns_;
   std::string mod_src_;
   std::map<std::string, std::string> src_dbg_fmap_;
+  std::unique_ptr<SourceDebugger> src_debugger_;
+  // per-function instruction-index -> source line, built from the DWARF
+  // line table at finalize (every compile carries one); lets bcc_func_load
+  // attribute a verifier rejection to source without DEBUG_SOURCE
+  std::map<std::string, std::vector<uint32_t>> func_line_tables_;
   TableStorage *ts_;
   std::unique_ptr<TableStorage> local_ts_;
+  std::string cache_file_;
+  // explicit artifact destination set by set_object_output(); unlike the
+  // object cache, the path is caller-chosen and not keyed on the program
+  // text, so it is only ever written, never pre-loaded
+  std::string artifact_file_;
+  // per-function instruction snapshot taken before map fd fixup, so that the
+  // object cache stores relocatable (fake fd) instructions
+  std::map<std::string, std::string> cache_insns_;
   BTF *btf_;
   fake_fd_map_def fake_fd_map_;
+  // struct field offsets the rewriter baked into this program, serialized
+  // with AOT artifacts and verified against kernel BTF when one is loaded
+  field_accesses_def field_accesses_;
   unsigned int ifindex_;
+  // lazy finalization (BCC_LAZY_COMPILE): codegen is deferred until a
+  // function is first requested, and maps are created with the first one
+  bool lazy_finalize_ = false;
+  bool maps_loaded_ = false;
+  // fake fd -> real fd, kept so lazily materialized functions can patch
+  // their ld_pseudo instructions after the maps have been created
+  std::map<int, int> map_fds_;
+  // per-table creation overrides (see MapTuning), keyed by table name
+  std::map<std::string, MapTuning> map_tuning_;
+  // BPF_CONFIG values, keyed by the tagged name hash embedded in the
+  // instruction stream
+  std::map<uint64_t, uint64_t> config_values_;
 
   // map of events -- key: event name, value: event fields
   std::map<std::string, std::vector<std::string>> perf_events_;
@@ -44,7 +44,10 @@ void BPFModule::initialize_rw_engine() {
 }
 
 void BPFModule::cleanup_rw_engine() {
-  rw_engine_.reset();
+  rw_fn_engines_.clear();
+  rw_engines_.clear();
+  rw_names_.clear();
+  rw_types_.clear();
 }
 
 static LoadInst *createLoad(IRBuilder<> &B, Value *addr, bool isVolatile = false)
@@ -432,9 +435,6 @@ int BPFModule::annotate() {
     if (!fn->hasFnAttribute(Attribute::NoInline))
       fn->addFnAttr(Attribute::AlwaysInline);
 
-  // separate module to hold the reader functions
-  auto m = ebpf::make_unique<Module>("sscanf", *ctx_);
-
   size_t id = 0;
   Path path({id_});
   for (auto it = ts_->lower_bound(path), up = ts_->upper_bound(path); it != up; ++it) {
@@ -453,36 +453,97 @@ int BPFModule::annotate() {
 #endif
       if (st) {
         if (st->getNumElements() < 2) continue;
-        Type *key_type = st->elements()[0];
-        Type *leaf_type = st->elements()[1];
+        // record the key/leaf types (owned by ctx_, valid until seal) and
+        // bind the converters to the lazy entry points; no IR is generated
+        // here -- a typical tool only string-accesses one or two tables, so
+        // codegen and JIT finalization wait until a table is first used
+        rw_types_[table.name] = {st->elements()[0], st->elements()[1]};
 
         using std::placeholders::_1;
         using std::placeholders::_2;
         using std::placeholders::_3;
-        table.key_sscanf = std::bind(&BPFModule::sscanf, this,
-                                     make_reader(&*m, key_type), _1, _2);
-        table.leaf_sscanf = std::bind(&BPFModule::sscanf, this,
-                                      make_reader(&*m, leaf_type), _1, _2);
-        table.key_snprintf = std::bind(&BPFModule::snprintf, this,
-                                       make_writer(&*m, key_type), _1, _2, _3);
-        table.leaf_snprintf =
-            std::bind(&BPFModule::snprintf, this, make_writer(&*m, leaf_type),
-                      _1, _2, _3);
+        table.key_sscanf = std::bind(&BPFModule::rw_sscanf, this, table.name,
+                                     true, _1, _2);
+        table.leaf_sscanf = std::bind(&BPFModule::rw_sscanf, this, table.name,
+                                      false, _1, _2);
+        table.key_snprintf = std::bind(&BPFModule::rw_snprintf, this,
+                                       table.name, true, _1, _2, _3);
+        table.leaf_snprintf = std::bind(&BPFModule::rw_snprintf, this,
+                                        table.name, false, _1, _2, _3);
       }
     }
   }
 
-  rw_engine_ = finalize_rw(move(m));
-  if (!rw_engine_)
+  return 0;
+}
+
+// Generate and JIT the key/leaf converters for one table on first use.
+// Converters are deduplicated across tables by llvm::Type (readers_/writers_),
+// so a table may resolve entirely to functions already owned by an earlier
+// engine; a new engine is only built when this table introduces new ones.
+int BPFModule::generate_rw_converters(const string &table_name) {
+  if (rw_names_.find(table_name) != rw_names_.end())
+    return 0;
+  auto types_it = rw_types_.find(table_name);
+  if (types_it == rw_types_.end() || !ctx_)
     return -1;
+
+  // separate module to hold this table's reader functions
+  auto m = ebpf::make_unique<Module>("sscanf." + table_name, *ctx_);
+
+  TableRWNames names;
+  names.key_reader = make_reader(&*m, types_it->second.key_type);
+  names.leaf_reader = make_reader(&*m, types_it->second.leaf_type);
+  names.key_writer = make_writer(&*m, types_it->second.key_type);
+  names.leaf_writer = make_writer(&*m, types_it->second.leaf_type);
+
+  vector<string> new_fns;
+  for (auto &fn_name : {names.key_reader, names.leaf_reader, names.key_writer,
+                        names.leaf_writer})
+    if (rw_fn_engines_.find(fn_name) == rw_fn_engines_.end())
+      new_fns.push_back(fn_name);
+
+  if (!new_fns.empty()) {
+    auto engine = finalize_rw(move(m));
+    if (!engine)
+      return -1;
+    for (auto &fn_name : new_fns)
+      rw_fn_engines_[fn_name] = &*engine;
+    rw_engines_.push_back(move(engine));
+  }
+
+  rw_names_[table_name] = names;
   return 0;
 }
 
+StatusTuple BPFModule::rw_sscanf(string table_name, bool is_key,
+                                 const char *str, void *val) {
+  if (!rw_engine_enabled_)
+    return StatusTuple(-1, "rw_engine not enabled");
+  if (generate_rw_converters(table_name) < 0)
+    return StatusTuple(-1, "sscanf not available");
+  const TableRWNames &names = rw_names_[table_name];
+  return sscanf(is_key ? names.key_reader : names.leaf_reader, str, val);
+}
+
+StatusTuple BPFModule::rw_snprintf(string table_name, bool is_key, char *str,
+                                   size_t sz, const void *val) {
+  if (!rw_engine_enabled_)
+    return StatusTuple(-1, "rw_engine not enabled");
+  if (generate_rw_converters(table_name) < 0)
+    return StatusTuple(-1, "snprintf not available");
+  const TableRWNames &names = rw_names_[table_name];
+  return snprintf(is_key ? names.key_writer : names.leaf_writer, str, sz, val);
+}
+
 StatusTuple BPFModule::sscanf(string fn_name, const char *str, void *val) {
   if (!rw_engine_enabled_)
     return StatusTuple(-1, "rw_engine not enabled");
-  auto fn =
-      (int (*)(const char *, void *))rw_engine_->getFunctionAddress(fn_name);
+  auto engine_it = rw_fn_engines_.find(fn_name);
+  auto fn = engine_it == rw_fn_engines_.end()
+                ? nullptr
+                : (int (*)(const char *, void *))
+                      engine_it->second->getFunctionAddress(fn_name);
   if (!fn)
     return StatusTuple(-1, "sscanf not available");
   int rc = fn(str, val);
@@ -495,8 +556,11 @@ StatusTuple BPFModule::snprintf(string fn_name, char *str, size_t sz,
                                 const void *val) {
   if (!rw_engine_enabled_)
     return StatusTuple(-1, "rw_engine not enabled");
-  auto fn = (int (*)(char *, size_t,
-                     const void *))rw_engine_->getFunctionAddress(fn_name);
+  auto engine_it = rw_fn_engines_.find(fn_name);
+  auto fn = engine_it == rw_fn_engines_.end()
+                ? nullptr
+                : (int (*)(char *, size_t, const void *))
+                      engine_it->second->getFunctionAddress(fn_name);
   if (!fn)
     return StatusTuple(-1, "snprintf not available");
   int rc = fn(str, sz, val);
@@ -34,9 +34,11 @@ class BpfFsTableStorage : public TableStorageImpl {
     virtual pointer operator->() const override;
   };
   virtual ~BpfFsTableStorage() {}
-  virtual bool Find(const string &name, TableStorage::iterator &result) const override;
-  virtual bool Insert(const string &name, TableDesc &&desc) override;
-  virtual bool Delete(const string &name) override;
+  virtual bool Find(const string &name, uint32_t hash,
+                    TableStorage::iterator &result) const override;
+  virtual bool Insert(const string &name, uint32_t hash,
+                      TableDesc &&desc) override;
+  virtual bool Delete(const string &name, uint32_t hash) override;
   virtual unique_ptr<TableStorageIteratorImpl> begin() override;
   virtual unique_ptr<TableStorageIteratorImpl> end() override;
   virtual unique_ptr<TableStorageIteratorImpl> lower_bound(const string &k) override;
@@ -46,13 +48,14 @@ class BpfFsTableStorage : public TableStorageImpl {
  private:
 };
 
-bool BpfFsTableStorage::Find(const string &name, TableStorage::iterator &result) const {
+bool BpfFsTableStorage::Find(const string &name, uint32_t hash,
+                             TableStorage::iterator &result) const {
   return false;
 }
 
-bool BpfFsTableStorage::Insert(const string &name, TableDesc &&desc) { return false; }
+bool BpfFsTableStorage::Insert(const string &name, uint32_t hash, TableDesc &&desc) { return false; }
 
-bool BpfFsTableStorage::Delete(const string &name) { return false; }
+bool BpfFsTableStorage::Delete(const string &name, uint32_t hash) { return false; }
 
 unique_ptr<TableStorageIteratorImpl> BpfFsTableStorage::begin() { return unique_ptr<iterator>(); }
 unique_ptr<TableStorageIteratorImpl> BpfFsTableStorage::end() { return unique_ptr<iterator>(); }
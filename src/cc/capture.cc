@@ -0,0 +1,910 @@
+/*
+ * Copyright (c) 2016 PLUMgrid, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+
+#include "bcc_elf.h"
+#include "capture.h"
+#include "vendor/tinyformat.hpp"
+
+namespace ebpf {
+
+namespace {
+
+// Minimal DWARF reader behind ArgumentCaptureSpec. It only answers the
+// questions the capture path asks -- find a subprogram by name, walk a
+// parameter's type chain, look up member offsets and sizes -- so it reads
+// just .debug_info/.debug_abbrev plus the string sections, DWARF32
+// versions 2-5. Location lists are deliberately ignored: capture happens
+// at function entry where the SysV ABI pins arguments to registers, which
+// sidesteps location expression evaluation entirely.
+
+// tags
+const uint64_t DW_TAG_array_type = 0x01;
+const uint64_t DW_TAG_class_type = 0x02;
+const uint64_t DW_TAG_enumeration_type = 0x04;
+const uint64_t DW_TAG_formal_parameter = 0x05;
+const uint64_t DW_TAG_member = 0x0d;
+const uint64_t DW_TAG_pointer_type = 0x0f;
+const uint64_t DW_TAG_structure_type = 0x13;
+const uint64_t DW_TAG_subrange_type = 0x21;
+const uint64_t DW_TAG_typedef = 0x16;
+const uint64_t DW_TAG_union_type = 0x17;
+const uint64_t DW_TAG_base_type = 0x24;
+const uint64_t DW_TAG_const_type = 0x26;
+const uint64_t DW_TAG_subprogram = 0x2e;
+const uint64_t DW_TAG_volatile_type = 0x35;
+const uint64_t DW_TAG_restrict_type = 0x37;
+
+// attributes
+const uint64_t DW_AT_sibling = 0x01;
+const uint64_t DW_AT_name = 0x03;
+const uint64_t DW_AT_byte_size = 0x0b;
+const uint64_t DW_AT_upper_bound = 0x2f;
+const uint64_t DW_AT_count = 0x37;
+const uint64_t DW_AT_data_member_location = 0x38;
+const uint64_t DW_AT_declaration = 0x3c;
+const uint64_t DW_AT_encoding = 0x3e;
+const uint64_t DW_AT_type = 0x49;
+const uint64_t DW_AT_str_offsets_base = 0x72;
+
+// forms
+const uint64_t DW_FORM_addr = 0x01;
+const uint64_t DW_FORM_block2 = 0x03;
+const uint64_t DW_FORM_block4 = 0x04;
+const uint64_t DW_FORM_data2 = 0x05;
+const uint64_t DW_FORM_data4 = 0x06;
+const uint64_t DW_FORM_data8 = 0x07;
+const uint64_t DW_FORM_string = 0x08;
+const uint64_t DW_FORM_block = 0x09;
+const uint64_t DW_FORM_block1 = 0x0a;
+const uint64_t DW_FORM_data1 = 0x0b;
+const uint64_t DW_FORM_flag = 0x0c;
+const uint64_t DW_FORM_sdata = 0x0d;
+const uint64_t DW_FORM_strp = 0x0e;
+const uint64_t DW_FORM_udata = 0x0f;
+const uint64_t DW_FORM_ref_addr = 0x10;
+const uint64_t DW_FORM_ref1 = 0x11;
+const uint64_t DW_FORM_ref2 = 0x12;
+const uint64_t DW_FORM_ref4 = 0x13;
+const uint64_t DW_FORM_ref8 = 0x14;
+const uint64_t DW_FORM_ref_udata = 0x15;
+const uint64_t DW_FORM_indirect = 0x16;
+const uint64_t DW_FORM_sec_offset = 0x17;
+const uint64_t DW_FORM_exprloc = 0x18;
+const uint64_t DW_FORM_flag_present = 0x19;
+const uint64_t DW_FORM_strx = 0x1a;
+const uint64_t DW_FORM_addrx = 0x1b;
+const uint64_t DW_FORM_ref_sup4 = 0x1c;
+const uint64_t DW_FORM_strp_sup = 0x1d;
+const uint64_t DW_FORM_data16 = 0x1e;
+const uint64_t DW_FORM_line_strp = 0x1f;
+const uint64_t DW_FORM_ref_sig8 = 0x20;
+const uint64_t DW_FORM_implicit_const = 0x21;
+const uint64_t DW_FORM_loclistx = 0x22;
+const uint64_t DW_FORM_rnglistx = 0x23;
+const uint64_t DW_FORM_ref_sup8 = 0x24;
+const uint64_t DW_FORM_strx1 = 0x25;
+const uint64_t DW_FORM_strx2 = 0x26;
+const uint64_t DW_FORM_strx3 = 0x27;
+const uint64_t DW_FORM_strx4 = 0x28;
+const uint64_t DW_FORM_addrx1 = 0x29;
+const uint64_t DW_FORM_addrx2 = 0x2a;
+const uint64_t DW_FORM_addrx3 = 0x2b;
+const uint64_t DW_FORM_addrx4 = 0x2c;
+
+const uint64_t DW_OP_plus_uconst = 0x23;
+const uint64_t DW_ATE_signed = 0x05;
+const uint64_t DW_ATE_signed_char = 0x06;
+
+struct Section {
+  const uint8_t *data;
+  size_t size;
+};
+
+// bounds-checked little-endian reader; any overrun poisons ok
+struct Cursor {
+  const uint8_t *p;
+  const uint8_t *end;
+  bool ok = true;
+
+  bool fits(size_t n) {
+    if (static_cast<size_t>(end - p) < n) {
+      ok = false;
+      return false;
+    }
+    return true;
+  }
+  uint64_t fixed(size_t n) {
+    if (!fits(n))
+      return 0;
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; i++)
+      v |= static_cast<uint64_t>(p[i]) << (8 * i);
+    p += n;
+    return v;
+  }
+  uint64_t uleb() {
+    uint64_t v = 0;
+    int shift = 0;
+    while (p < end && shift < 64) {
+      uint8_t b = *p++;
+      v |= static_cast<uint64_t>(b & 0x7f) << shift;
+      if (!(b & 0x80))
+        return v;
+      shift += 7;
+    }
+    ok = false;
+    return 0;
+  }
+  int64_t sleb() {
+    int64_t v = 0;
+    int shift = 0;
+    while (p < end && shift < 64) {
+      uint8_t b = *p++;
+      v |= static_cast<int64_t>(b & 0x7f) << shift;
+      shift += 7;
+      if (!(b & 0x80)) {
+        if (shift < 64 && (b & 0x40))
+          v |= -(static_cast<int64_t>(1) << shift);
+        return v;
+      }
+    }
+    ok = false;
+    return 0;
+  }
+  const char *cstr() {
+    const uint8_t *s = p;
+    while (p < end && *p)
+      p++;
+    if (p >= end) {
+      ok = false;
+      return nullptr;
+    }
+    p++;
+    return reinterpret_cast<const char *>(s);
+  }
+  void skip(size_t n) {
+    if (fits(n))
+      p += n;
+  }
+};
+
+const char *str_at(const Section &s, uint64_t off) {
+  if (off >= s.size)
+    return nullptr;
+  if (!memchr(s.data + off, 0, s.size - off))
+    return nullptr;
+  return reinterpret_cast<const char *>(s.data + off);
+}
+
+struct AbbrevAttr {
+  uint64_t attr;
+  uint64_t form;
+  int64_t implicit_const;
+};
+
+struct Abbrev {
+  uint64_t tag;
+  bool children;
+  std::vector<AbbrevAttr> attrs;
+};
+
+struct Unit {
+  Section info{nullptr, 0};
+  Section str{nullptr, 0};
+  Section str_offsets{nullptr, 0};
+  size_t base = 0;       // offset of the unit header in .debug_info
+  size_t die_begin = 0;  // offset of the root DIE
+  size_t end = 0;        // offset just past the unit
+  uint16_t version = 0;
+  uint8_t addr_size = 8;
+  bool is_compile = false;
+  // default matches the common layout (header only precedes the first
+  // contribution); the root DIE's DW_AT_str_offsets_base overrides it
+  // before any child is parsed
+  uint64_t str_offsets_base = 8;
+  std::unordered_map<uint64_t, Abbrev> abbrevs;
+};
+
+bool parse_abbrevs(const Section &abbrev, uint64_t off,
+                   std::unordered_map<uint64_t, Abbrev> *out) {
+  if (off >= abbrev.size)
+    return false;
+  Cursor c{abbrev.data + off, abbrev.data + abbrev.size};
+  for (;;) {
+    uint64_t code = c.uleb();
+    if (!c.ok)
+      return false;
+    if (code == 0)
+      return true;
+    Abbrev &a = (*out)[code];
+    a.tag = c.uleb();
+    a.children = c.fixed(1) != 0;
+    for (;;) {
+      uint64_t at = c.uleb();
+      uint64_t form = c.uleb();
+      if (!c.ok)
+        return false;
+      if (at == 0 && form == 0)
+        break;
+      int64_t iconst = form == DW_FORM_implicit_const ? c.sleb() : 0;
+      a.attrs.push_back({at, form, iconst});
+    }
+  }
+}
+
+// Reads one attribute value. Numeric values land in *val (reference forms
+// converted to absolute .debug_info offsets), strings in *str, and
+// block/exprloc payloads in *blk/*blk_len for the data_member_location
+// case; values a caller never asks about are just skipped.
+bool read_form(Unit &u, Cursor &c, uint64_t form, int64_t implicit_const,
+               uint64_t *val, const char **str, const uint8_t **blk,
+               size_t *blk_len) {
+  switch (form) {
+  case DW_FORM_addr:
+    *val = c.fixed(u.addr_size);
+    break;
+  case DW_FORM_data1:
+  case DW_FORM_ref1:
+  case DW_FORM_flag:
+  case DW_FORM_strx1:
+  case DW_FORM_addrx1:
+    *val = c.fixed(1);
+    break;
+  case DW_FORM_data2:
+  case DW_FORM_ref2:
+  case DW_FORM_strx2:
+  case DW_FORM_addrx2:
+    *val = c.fixed(2);
+    break;
+  case DW_FORM_strx3:
+  case DW_FORM_addrx3:
+    *val = c.fixed(3);
+    break;
+  case DW_FORM_data4:
+  case DW_FORM_ref4:
+  case DW_FORM_sec_offset:
+  case DW_FORM_ref_addr:
+  case DW_FORM_strp:
+  case DW_FORM_line_strp:
+  case DW_FORM_strp_sup:
+  case DW_FORM_ref_sup4:
+  case DW_FORM_strx4:
+  case DW_FORM_addrx4:
+    *val = c.fixed(4);
+    break;
+  case DW_FORM_data8:
+  case DW_FORM_ref8:
+  case DW_FORM_ref_sig8:
+  case DW_FORM_ref_sup8:
+    *val = c.fixed(8);
+    break;
+  case DW_FORM_data16:
+    c.skip(16);
+    break;
+  case DW_FORM_sdata:
+    *val = static_cast<uint64_t>(c.sleb());
+    break;
+  case DW_FORM_udata:
+  case DW_FORM_ref_udata:
+  case DW_FORM_strx:
+  case DW_FORM_addrx:
+  case DW_FORM_loclistx:
+  case DW_FORM_rnglistx:
+    *val = c.uleb();
+    break;
+  case DW_FORM_string:
+    *str = c.cstr();
+    break;
+  case DW_FORM_flag_present:
+    *val = 1;
+    break;
+  case DW_FORM_implicit_const:
+    *val = static_cast<uint64_t>(implicit_const);
+    break;
+  case DW_FORM_exprloc:
+  case DW_FORM_block: {
+    uint64_t len = c.uleb();
+    if (!c.fits(len))
+      return false;
+    *blk = c.p;
+    *blk_len = len;
+    c.skip(len);
+    break;
+  }
+  case DW_FORM_block1:
+  case DW_FORM_block2:
+  case DW_FORM_block4: {
+    uint64_t len = c.fixed(form == DW_FORM_block1
+                               ? 1
+                               : (form == DW_FORM_block2 ? 2 : 4));
+    if (!c.fits(len))
+      return false;
+    *blk = c.p;
+    *blk_len = len;
+    c.skip(len);
+    break;
+  }
+  case DW_FORM_indirect:
+    return read_form(u, c, c.uleb(), 0, val, str, blk, blk_len);
+  default:
+    return false;  // unknown form: cannot know its size, bail out
+  }
+  if (!c.ok)
+    return false;
+
+  switch (form) {
+  case DW_FORM_ref1:
+  case DW_FORM_ref2:
+  case DW_FORM_ref4:
+  case DW_FORM_ref8:
+  case DW_FORM_ref_udata:
+    *val += u.base;  // unit-relative to section offset
+    break;
+  case DW_FORM_strp:
+    *str = str_at(u.str, *val);
+    break;
+  case DW_FORM_strx:
+  case DW_FORM_strx1:
+  case DW_FORM_strx2:
+  case DW_FORM_strx3:
+  case DW_FORM_strx4: {
+    uint64_t off = u.str_offsets_base + 4 * *val;
+    if (off + 4 > u.str_offsets.size)
+      return false;
+    uint32_t so;
+    memcpy(&so, u.str_offsets.data + off, 4);
+    *str = str_at(u.str, so);
+    break;
+  }
+  default:
+    break;
+  }
+  return true;
+}
+
+struct Die {
+  uint64_t tag = 0;  // 0 is the null entry closing a sibling chain
+  bool has_children = false;
+  size_t offset = 0;   // own offset in .debug_info
+  size_t next = 0;     // just past the attributes: first child or sibling
+  uint64_t sibling = 0;
+  const char *name = nullptr;
+  uint64_t type = 0;
+  uint64_t byte_size = 0;
+  bool has_byte_size = false;
+  int64_t member_location = 0;
+  bool has_member_location = false;
+  uint64_t encoding = 0;
+  uint64_t upper_bound = 0;
+  bool has_upper_bound = false;
+  uint64_t count = 0;
+  bool has_count = false;
+  bool declaration = false;
+};
+
+bool parse_die(Unit &u, size_t off, Die *d) {
+  if (off < u.die_begin || off >= u.end)
+    return false;
+  Cursor c{u.info.data + off, u.info.data + u.end};
+  *d = Die();
+  d->offset = off;
+  uint64_t code = c.uleb();
+  if (!c.ok)
+    return false;
+  if (code == 0) {
+    d->next = c.p - u.info.data;
+    return true;
+  }
+  auto it = u.abbrevs.find(code);
+  if (it == u.abbrevs.end())
+    return false;
+  d->tag = it->second.tag;
+  d->has_children = it->second.children;
+  for (const auto &a : it->second.attrs) {
+    uint64_t val = 0;
+    const char *str = nullptr;
+    const uint8_t *blk = nullptr;
+    size_t blk_len = 0;
+    if (!read_form(u, c, a.form, a.implicit_const, &val, &str, &blk,
+                   &blk_len))
+      return false;
+    switch (a.attr) {
+    case DW_AT_sibling:
+      d->sibling = val;
+      break;
+    case DW_AT_name:
+      d->name = str;
+      break;
+    case DW_AT_type:
+      d->type = val;
+      break;
+    case DW_AT_byte_size:
+      d->byte_size = val;
+      d->has_byte_size = true;
+      break;
+    case DW_AT_data_member_location:
+      if (blk) {
+        // gcc < 4.8 encodes the offset as DW_OP_plus_uconst <uleb>
+        Cursor bc{blk, blk + blk_len};
+        if (blk_len < 2 || bc.fixed(1) != DW_OP_plus_uconst)
+          break;
+        d->member_location = static_cast<int64_t>(bc.uleb());
+        d->has_member_location = bc.ok;
+      } else {
+        d->member_location = static_cast<int64_t>(val);
+        d->has_member_location = true;
+      }
+      break;
+    case DW_AT_encoding:
+      d->encoding = val;
+      break;
+    case DW_AT_upper_bound:
+      d->upper_bound = val;
+      d->has_upper_bound = true;
+      break;
+    case DW_AT_count:
+      d->count = val;
+      d->has_count = true;
+      break;
+    case DW_AT_declaration:
+      d->declaration = val != 0;
+      break;
+    case DW_AT_str_offsets_base:
+      // only ever on the root DIE, so it is in place before any child
+      // resolves a strx form
+      u.str_offsets_base = val;
+      break;
+    default:
+      break;
+    }
+  }
+  if (!c.ok)
+    return false;
+  d->next = c.p - u.info.data;
+  return true;
+}
+
+// advances past d's subtree: to its next sibling entry
+bool skip_children(Unit &u, const Die &d, size_t *out) {
+  if (!d.has_children) {
+    *out = d.next;
+    return true;
+  }
+  if (d.sibling) {
+    *out = d.sibling;
+    return true;
+  }
+  size_t off = d.next;
+  int depth = 1;
+  Die child;
+  while (depth > 0) {
+    if (!parse_die(u, off, &child))
+      return false;
+    if (child.tag == 0) {
+      depth--;
+      off = child.next;
+    } else if (child.has_children) {
+      if (child.sibling) {
+        off = child.sibling;
+      } else {
+        depth++;
+        off = child.next;
+      }
+    } else {
+      off = child.next;
+    }
+  }
+  *out = off;
+  return true;
+}
+
+bool parse_unit(const struct bcc_elf_dwarf_sections &sec, size_t base,
+                Unit *u) {
+  u->info = {static_cast<const uint8_t *>(sec.info), sec.info_sz};
+  u->str = {static_cast<const uint8_t *>(sec.str), sec.str_sz};
+  u->str_offsets = {static_cast<const uint8_t *>(sec.str_offsets),
+                    sec.str_offsets_sz};
+  u->base = base;
+
+  Cursor c{u->info.data + base, u->info.data + u->info.size};
+  uint64_t len = c.fixed(4);
+  if (!c.ok || len == 0xffffffffu)  // DWARF64 is not produced for ELF64
+    return false;
+  size_t end = base + 4 + len;
+  if (len == 0 || end > u->info.size)
+    return false;
+  u->end = end;
+  u->version = c.fixed(2);
+
+  uint64_t abbrev_off;
+  if (u->version == 5) {
+    uint8_t unit_type = c.fixed(1);
+    u->addr_size = c.fixed(1);
+    abbrev_off = c.fixed(4);
+    u->is_compile = unit_type == 0x01;  // DW_UT_compile
+  } else if (u->version >= 2 && u->version <= 4) {
+    abbrev_off = c.fixed(4);
+    u->addr_size = c.fixed(1);
+    u->is_compile = true;
+  } else {
+    return false;
+  }
+  if (!c.ok)
+    return false;
+  u->die_begin = c.p - u->info.data;
+
+  Section abbrev{static_cast<const uint8_t *>(sec.abbrev), sec.abbrev_sz};
+  return !u->is_compile || parse_abbrevs(abbrev, abbrev_off, &u->abbrevs);
+}
+
+// follows typedef/const/volatile/restrict wrappers to the underlying type
+bool strip_type(Unit &u, uint64_t off, Die *d) {
+  for (int i = 0; i < 64; i++) {
+    // cross-unit references (DW_FORM_ref_addr) would need the other
+    // unit's abbrevs; C debug info keeps types unit-local
+    if (off < u.base || off >= u.end)
+      return false;
+    if (!parse_die(u, off, d))
+      return false;
+    if (d->tag == DW_TAG_typedef || d->tag == DW_TAG_const_type ||
+        d->tag == DW_TAG_volatile_type || d->tag == DW_TAG_restrict_type) {
+      if (!d->type)
+        return false;
+      off = d->type;
+      continue;
+    }
+    return true;
+  }
+  return false;
+}
+
+bool is_aggregate(uint64_t tag) {
+  return tag == DW_TAG_structure_type || tag == DW_TAG_class_type ||
+         tag == DW_TAG_union_type;
+}
+
+bool type_size(Unit &u, const Die &d, uint64_t *size) {
+  if (d.tag == DW_TAG_pointer_type) {
+    *size = d.has_byte_size ? d.byte_size : 8;
+    return true;
+  }
+  if (d.has_byte_size) {
+    *size = d.byte_size;
+    return true;
+  }
+  if (d.tag == DW_TAG_array_type && d.type && d.has_children) {
+    Die elem;
+    uint64_t esz;
+    if (!strip_type(u, d.type, &elem) || !type_size(u, elem, &esz))
+      return false;
+    size_t pos = d.next;
+    Die sr;
+    while (parse_die(u, pos, &sr) && sr.tag != 0) {
+      if (sr.tag == DW_TAG_subrange_type) {
+        uint64_t n =
+            sr.has_count ? sr.count
+                         : (sr.has_upper_bound ? sr.upper_bound + 1 : 0);
+        if (n == 0)
+          return false;  // flexible array member
+        *size = esz * n;
+        return true;
+      }
+      if (!skip_children(u, sr, &pos))
+        return false;
+    }
+  }
+  return false;
+}
+
+// member lookup by name, descending into anonymous struct/union members
+// with their offsets accumulated into *off
+bool find_member(Unit &u, const Die &agg, const std::string &name,
+                 int64_t *off, uint64_t *type_off) {
+  size_t pos = agg.next;
+  Die m;
+  while (agg.has_children && parse_die(u, pos, &m) && m.tag != 0) {
+    if (m.tag == DW_TAG_member) {
+      int64_t mloc = m.has_member_location ? m.member_location : 0;
+      if (m.name && name == m.name) {
+        *off += mloc;
+        *type_off = m.type;
+        return true;
+      }
+      if (!m.name && m.type) {
+        Die sub;
+        if (strip_type(u, m.type, &sub) && is_aggregate(sub.tag)) {
+          int64_t inner = *off + mloc;
+          if (find_member(u, sub, name, &inner, type_off)) {
+            *off = inner;
+            return true;
+          }
+        }
+      }
+    }
+    if (!skip_children(u, m, &pos))
+      return false;
+  }
+  return false;
+}
+
+// defining DW_TAG_subprogram with a matching DW_AT_name, at any nesting
+bool find_subprogram(Unit &u, const std::string &name, Die *out) {
+  size_t pos = u.die_begin;
+  Die d;
+  while (pos < u.end && parse_die(u, pos, &d)) {
+    if (d.tag == DW_TAG_subprogram) {
+      if (d.has_children && !d.declaration && d.name && name == d.name) {
+        *out = d;
+        return true;
+      }
+      // do not descend: parameters of other functions are not ours
+      if (!skip_children(u, d, &pos))
+        return false;
+      continue;
+    }
+    pos = d.next;
+  }
+  return false;
+}
+
+struct ExprStep {
+  bool deref;  // true for ->, false for .
+  std::string member;
+};
+
+bool parse_expression(const std::string &expr, int *arg_index,
+                      std::vector<ExprStep> *steps, std::string *err) {
+  size_t pos = 0;
+  if (expr.compare(0, 3, "arg") != 0) {
+    *err = "capture expressions start with argN";
+    return false;
+  }
+  pos = 3;
+  size_t digits = pos;
+  while (digits < expr.size() && isdigit((unsigned char)expr[digits]))
+    digits++;
+  if (digits == pos) {
+    *err = "capture expressions start with argN";
+    return false;
+  }
+  *arg_index = atoi(expr.substr(pos, digits - pos).c_str());
+  pos = digits;
+
+  while (pos < expr.size()) {
+    bool deref;
+    if (expr.compare(pos, 2, "->") == 0) {
+      deref = true;
+      pos += 2;
+    } else if (expr[pos] == '.') {
+      deref = false;
+      pos += 1;
+    } else {
+      *err = tfm::format("unexpected '%c' in capture expression", expr[pos]);
+      return false;
+    }
+    size_t start = pos;
+    while (pos < expr.size() &&
+           (isalnum((unsigned char)expr[pos]) || expr[pos] == '_'))
+      pos++;
+    if (pos == start || isdigit((unsigned char)expr[start])) {
+      *err = "expected a member name after '->' or '.'";
+      return false;
+    }
+    steps->push_back({deref, expr.substr(start, pos - start)});
+  }
+  return true;
+}
+
+// walks the parameter's type chain, producing one deref offset per
+// pointer chase and the final capture size/signedness
+bool resolve_chain(Unit &u, uint64_t param_type,
+                   const std::vector<ExprStep> &steps,
+                   std::vector<int64_t> *derefs, size_t *size,
+                   bool *is_signed, std::string *err) {
+  uint64_t cur = param_type;
+  for (const auto &step : steps) {
+    Die d;
+    if (!cur || !strip_type(u, cur, &d)) {
+      *err = "unsupported type in debug info";
+      return false;
+    }
+    if (step.deref) {
+      if (d.tag != DW_TAG_pointer_type || !d.type) {
+        *err = tfm::format("'->%s' applied to a non-pointer", step.member);
+        return false;
+      }
+      Die pointee;
+      if (!strip_type(u, d.type, &pointee) || !is_aggregate(pointee.tag)) {
+        *err = tfm::format("'->%s' applied to a pointer to a non-struct",
+                           step.member);
+        return false;
+      }
+      int64_t off = 0;
+      uint64_t mtype = 0;
+      if (!find_member(u, pointee, step.member, &off, &mtype)) {
+        *err = tfm::format("no member '%s' in %s", step.member,
+                           pointee.name ? pointee.name : "anonymous struct");
+        return false;
+      }
+      derefs->push_back(off);
+      cur = mtype;
+    } else {
+      if (derefs->empty()) {
+        *err = "structs passed by value are not supported; capture through "
+               "a pointer argument";
+        return false;
+      }
+      if (!is_aggregate(d.tag)) {
+        *err = tfm::format("'.%s' applied to a non-struct", step.member);
+        return false;
+      }
+      int64_t off = 0;
+      uint64_t mtype = 0;
+      if (!find_member(u, d, step.member, &off, &mtype)) {
+        *err = tfm::format("no member '%s' in %s", step.member,
+                           d.name ? d.name : "anonymous struct");
+        return false;
+      }
+      derefs->back() += off;
+      cur = mtype;
+    }
+  }
+
+  Die fin;
+  if (!cur || !strip_type(u, cur, &fin)) {
+    *err = "unsupported type in debug info";
+    return false;
+  }
+  if (derefs->empty() && (is_aggregate(fin.tag) ||
+                          fin.tag == DW_TAG_array_type)) {
+    *err = "structs passed by value are not supported; capture through "
+           "a pointer argument";
+    return false;
+  }
+  uint64_t sz = 0;
+  if (!type_size(u, fin, &sz) || sz == 0) {
+    *err = "cannot size the captured type from debug info";
+    return false;
+  }
+  if (derefs->empty() && sz > 8) {
+    *err = "argument is wider than a register";
+    return false;
+  }
+  *size = sz;
+  *is_signed = fin.tag == DW_TAG_base_type &&
+               (fin.encoding == DW_ATE_signed ||
+                fin.encoding == DW_ATE_signed_char);
+  return true;
+}
+
+// Same barrier the USDT argument accessors emit: keeps llvm from sinking
+// the ctx-> read past the bpf_probe_read calls.
+const char kCompilerBarrier[] = "__asm__ __volatile__(\"\": : :\"memory\");";
+
+#ifdef __x86_64__
+// SysV integer argument registers, by pt_regs field name
+const char *arg_registers[] = {"di", "si", "dx", "cx", "r8", "r9"};
+#endif
+
+}  // namespace
+
+bool ArgumentCaptureSpec::resolve() {
+  resolved_ = false;
+  deref_offsets_.clear();
+  error_msg_.clear();
+
+#ifndef __x86_64__
+  error_msg_ = "in-kernel argument capture currently supports x86-64 only";
+  return false;
+#else
+  int arg_index = 0;
+  std::vector<ExprStep> steps;
+  if (!parse_expression(expression_, &arg_index, &steps, &error_msg_))
+    return false;
+  if (arg_index < 1 ||
+      arg_index > (int)(sizeof(arg_registers) / sizeof(*arg_registers))) {
+    error_msg_ = tfm::format(
+        "arg%d is passed on the stack; only register arguments 1-%d can be "
+        "captured", arg_index, sizeof(arg_registers) / sizeof(*arg_registers));
+    return false;
+  }
+
+  struct bcc_elf_dwarf_sections sec;
+  if (bcc_elf_get_dwarf_sections(binary_path_.c_str(), &sec) != 0) {
+    error_msg_ = tfm::format("no DWARF debug info found for %s",
+                             binary_path_);
+    return false;
+  }
+
+  bool found = false;
+  for (size_t off = 0; off + 4 <= sec.info_sz;) {
+    Unit u;
+    if (!parse_unit(sec, off, &u))
+      break;
+    if (u.is_compile) {
+      Die sub;
+      if (find_subprogram(u, function_, &sub)) {
+        found = true;
+        // parameters appear in signature order
+        std::vector<uint64_t> params;
+        size_t pos = sub.next;
+        Die child;
+        while (parse_die(u, pos, &child) && child.tag != 0) {
+          if (child.tag == DW_TAG_formal_parameter && child.type)
+            params.push_back(child.type);
+          if (!skip_children(u, child, &pos))
+            break;
+        }
+        if ((size_t)arg_index > params.size()) {
+          error_msg_ = tfm::format("%s has %d parameters in debug info",
+                                   function_, params.size());
+        } else if (resolve_chain(u, params[arg_index - 1], steps,
+                                 &deref_offsets_, &capture_size_, &signed_,
+                                 &error_msg_)) {
+          base_register_ = arg_registers[arg_index - 1];
+          resolved_ = true;
+        }
+        break;
+      }
+    }
+    off = u.end;
+  }
+  if (!found)
+    error_msg_ = tfm::format("function %s not found in debug info of %s",
+                             function_, binary_path_);
+
+  bcc_elf_free_dwarf_sections(&sec);
+  return resolved_;
+#endif
+}
+
+bool ArgumentCaptureSpec::generate(std::ostream &stream,
+                                   const std::string &local_name) const {
+  if (!resolved_)
+    return false;
+
+  bool aggregate = capture_size_ > 8 ||
+                   (capture_size_ & (capture_size_ - 1)) != 0;
+  std::string ctype =
+      tfm::format("%sint%d_t", signed_ ? "" : "u", capture_size_ * 8);
+
+  if (deref_offsets_.empty()) {
+    tfm::format(stream, "%s %s = (%s)ctx->%s; %s", ctype, local_name, ctype,
+                base_register_, kCompilerBarrier);
+    return true;
+  }
+
+  if (aggregate)
+    tfm::format(stream, "char %s[%d] = {}; ", local_name, capture_size_);
+  else
+    tfm::format(stream, "%s %s = 0; ", ctype, local_name);
+  tfm::format(stream, "{ u64 __addr = ctx->%s + %d; %s ", base_register_,
+              deref_offsets_[0], kCompilerBarrier);
+  for (size_t i = 1; i < deref_offsets_.size(); i++)
+    tfm::format(stream,
+                "u64 __p%d = 0x0; "
+                "bpf_probe_read_user(&__p%d, sizeof(__p%d), (void *)__addr); "
+                "__addr = __p%d + %d; ",
+                i, i, i, i, deref_offsets_[i]);
+  tfm::format(stream, "bpf_probe_read_user(&%s, %d, (void *)__addr); }",
+              local_name, capture_size_);
+  return true;
+}
+
+}  // namespace ebpf
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2016 PLUMgrid, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace ebpf {
+
+// DWARF-driven argument capture for uprobes.
+//
+// Given a binary, a function and an argument expression like
+// "arg1->net.read_pos" or "arg2", resolve() consults the binary's DWARF
+// (through the bcc_elf machinery, including separate debug files for
+// stripped binaries) to compute the register/offset access chain, and
+// generate() emits the minimal bpf_probe_read_user() sequence that ships
+// only the requested bytes to the program -- instead of copying whole
+// structs to userspace and decoding there. The emitted text is spliced
+// into the program source ahead of init(), the same way USDT argument
+// accessors are.
+//
+// The expression grammar is argN (1-based, matching the function
+// signature) followed by any number of ->member or .member steps.
+// Capture happens at function entry, so arguments are taken from their
+// SysV integer registers; x86-64 targets only, arguments 1-6, and
+// structs passed by value are not supported.
+class ArgumentCaptureSpec {
+public:
+  ArgumentCaptureSpec(const std::string &binary_path,
+                      const std::string &function,
+                      const std::string &expression)
+      : binary_path_(binary_path),
+        function_(function),
+        expression_(expression) {}
+
+  // Computes the access chain from DWARF. Returns false and sets
+  // error_msg() when the function, an argument or a member cannot be
+  // resolved; generate() may only be called after success.
+  bool resolve();
+
+  // Emits a declaration of `local_name` followed by the reads that fill
+  // it: a zero-initialized intN_t/uintN_t for scalar captures, a char
+  // array for aggregates. The fragment is a full statement sequence
+  // valid at block scope inside the probe function.
+  bool generate(std::ostream &stream, const std::string &local_name) const;
+
+  bool resolved() const { return resolved_; }
+  // Number of bytes generate() captures into the local.
+  size_t capture_size() const { return capture_size_; }
+  const std::string &error_msg() const { return error_msg_; }
+
+private:
+  std::string binary_path_;
+  std::string function_;
+  std::string expression_;
+
+  // access chain: the argument's entry register, then one pointer chase
+  // per entry of deref_offsets_ -- every entry but the last reads a
+  // pointer at (addr + offset), the last reads capture_size_ bytes.
+  std::string base_register_;
+  std::vector<int64_t> deref_offsets_;
+  size_t capture_size_ = 0;
+  bool signed_ = false;
+
+  bool resolved_ = false;
+  std::string error_msg_;
+};
+
+}  // namespace ebpf
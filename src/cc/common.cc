@@ -13,11 +13,15 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include <atomic>
+#include <cstdlib>
 #include <fstream>
+#include <mutex>
 #include <sstream>
 
 #include "common.h"
 #include "bcc_libbpf_inc.h"
+#include "libbpf.h"
 #include "vendor/optional.hpp"
 #include "vendor/tinyformat.hpp"
 
@@ -34,8 +38,8 @@ using std::experimental::optional;
 static optional<int32_t> get_enum_val_from_btf(const char *name) {
   optional<int32_t> val;
 
-  auto btf = btf__load_vmlinux_btf();
-  if (libbpf_get_error(btf))
+  auto btf = bcc_vmlinux_btf_get();
+  if (!btf)
     return {};
 
   for (size_t i = 1; i < btf__type_cnt(btf); i++) {
@@ -55,7 +59,7 @@ static optional<int32_t> get_enum_val_from_btf(const char *name) {
       break;
   }
 
-  btf__free(btf);
+  bcc_vmlinux_btf_put(btf);
   return val;
 }
 
@@ -79,12 +83,77 @@ std::vector<int> read_cpu_range(std::string path) {
   return cpus;
 }
 
+// Cached CPU topology. The sysfs range files are parsed once and served
+// from memory afterwards: the possible mask is fixed for the lifetime of
+// the boot, and the online mask only changes on CPU hotplug, which callers
+// that care about can handle via invalidate_cpu_topology_cache() (e.g.
+// from a udev monitor). Set BCC_NO_CPU_TOPOLOGY_CACHE to restore the old
+// read-sysfs-on-every-call behavior.
+namespace {
+
+struct CpuTopologyCache {
+  std::mutex mutex;
+  std::vector<int> online;
+  std::vector<int> possible;
+  bool online_valid = false;
+  bool possible_valid = false;
+  std::atomic<size_t> count_hint{0};
+  bool disabled = ::getenv("BCC_NO_CPU_TOPOLOGY_CACHE") != nullptr;
+
+  static CpuTopologyCache &instance() {
+    static CpuTopologyCache cache;
+    return cache;
+  }
+};
+
+} // namespace
+
 std::vector<int> get_online_cpus() {
-  return read_cpu_range("/sys/devices/system/cpu/online");
+  auto &cache = CpuTopologyCache::instance();
+  if (cache.disabled)
+    return read_cpu_range("/sys/devices/system/cpu/online");
+
+  std::lock_guard<std::mutex> guard(cache.mutex);
+  if (!cache.online_valid) {
+    cache.online = read_cpu_range("/sys/devices/system/cpu/online");
+    cache.online_valid = true;
+  }
+  return cache.online;
 }
 
 std::vector<int> get_possible_cpus() {
-  return read_cpu_range("/sys/devices/system/cpu/possible");
+  auto &cache = CpuTopologyCache::instance();
+  if (cache.disabled)
+    return read_cpu_range("/sys/devices/system/cpu/possible");
+
+  std::lock_guard<std::mutex> guard(cache.mutex);
+  if (!cache.possible_valid) {
+    cache.possible = read_cpu_range("/sys/devices/system/cpu/possible");
+    cache.possible_valid = true;
+    cache.count_hint.store(cache.possible.size(),
+                           std::memory_order_relaxed);
+  }
+  return cache.possible;
+}
+
+size_t cpu_count_hint() {
+  auto &cache = CpuTopologyCache::instance();
+  size_t hint = cache.count_hint.load(std::memory_order_relaxed);
+  if (hint == 0) {
+    hint = get_possible_cpus().size();
+    if (cache.disabled)
+      cache.count_hint.store(hint, std::memory_order_relaxed);
+  }
+  return hint;
+}
+
+void invalidate_cpu_topology_cache() {
+  auto &cache = CpuTopologyCache::instance();
+  std::lock_guard<std::mutex> guard(cache.mutex);
+  // Keep the possible mask: it cannot change after boot. Only the online
+  // mask is affected by hotplug.
+  cache.online_valid = false;
+  cache.online.clear();
 }
 
 std::string get_pid_exe(pid_t pid) {
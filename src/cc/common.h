@@ -37,6 +37,15 @@ std::vector<int> get_online_cpus();
 
 std::vector<int> get_possible_cpus();
 
+// Number of possible CPUs, served from the cached topology without touching
+// sysfs on the hot path. Suitable for sizing per-cpu buffers.
+size_t cpu_count_hint();
+
+// Drops the cached online-CPU mask so the next get_online_cpus() re-reads
+// sysfs. Call from a CPU hotplug notification (e.g. a udev monitor) when
+// long-lived sessions must observe newly onlined CPUs.
+void invalidate_cpu_topology_cache();
+
 std::string get_pid_exe(pid_t pid);
 
 std::string tracefs_path();
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2016 PLUMgrid, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Build-time generator for ENABLE_COMPRESSED_HEADERS: embeds the same raw
+// string literals as exported_files.cc, deflates each with zlib and writes
+// the exported_files_compressed.inc fragment that exported_files.cc picks
+// up when BCC_COMPRESSED_HEADERS is defined. Runs on the build host only;
+// it is never installed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+struct input_file {
+  const char *path;
+  const char *contents;
+};
+
+static const struct input_file headers[] = {
+  {
+    "/virtual/include/bcc/bpf.h",
+    #include "compat/linux/virtual_bpf.h"
+  },
+  {
+    "/virtual/include/bcc/bpf_workaround.h",
+    #include "export/bpf_workaround.h"
+  },
+  {
+    "/virtual/include/bcc/proto.h",
+    #include "export/proto.h"
+  },
+  {
+    "/virtual/include/bcc/helpers.h",
+    #include "export/helpers.h"
+  },
+  {
+    "/virtual/lib/clang/include/stdarg.h",
+    #include "clang/include/stdarg.h"
+  },
+};
+
+static const struct input_file footers[] = {
+  {
+    "/virtual/include/bcc/footer.h",
+    #include "export/footer.h"
+  },
+};
+
+static int emit_table(FILE *out, const char *name,
+                      const struct input_file *files, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    uLong raw_len = strlen(files[i].contents);
+    uLong z_len = compressBound(raw_len);
+    unsigned char *z_buf = (unsigned char *)malloc(z_len);
+    if (!z_buf ||
+        compress2(z_buf, &z_len, (const Bytef *)files[i].contents, raw_len,
+                  Z_BEST_COMPRESSION) != Z_OK) {
+      fprintf(stderr, "compress_headers: deflate of %s failed\n",
+              files[i].path);
+      return -1;
+    }
+    fprintf(out, "static const unsigned char %s_%zu_z[] = {", name, i);
+    for (uLong j = 0; j < z_len; j++)
+      fprintf(out, "%s0x%02x,", j % 12 ? " " : "\n  ", z_buf[j]);
+    fprintf(out, "\n};\n");
+    free(z_buf);
+  }
+  fprintf(out, "static const struct compressed_file %s[] = {\n", name);
+  for (size_t i = 0; i < n; i++) {
+    uLong raw_len = strlen(files[i].contents);
+    fprintf(out, "  { \"%s\", %s_%zu_z, sizeof(%s_%zu_z), %luUL },\n",
+            files[i].path, name, i, name, i, (unsigned long)raw_len);
+  }
+  fprintf(out, "};\n\n");
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <output.inc>\n", argv[0]);
+    return 1;
+  }
+  FILE *out = fopen(argv[1], "w");
+  if (!out) {
+    perror(argv[1]);
+    return 1;
+  }
+  fprintf(out, "// generated by compress_headers; do not edit\n\n");
+  if (emit_table(out, "compressed_headers",
+                 headers, sizeof(headers) / sizeof(headers[0])) ||
+      emit_table(out, "compressed_footers",
+                 footers, sizeof(footers) / sizeof(footers[0]))) {
+    fclose(out);
+    remove(argv[1]);
+    return 1;
+  }
+  if (fclose(out) != 0) {
+    perror(argv[1]);
+    return 1;
+  }
+  return 0;
+}
@@ -204,6 +204,39 @@ struct _name##_table_t __##_name
 #define BPF_TABLE_SHARED(...) \
   BPF_TABLE_SHAREDX(__VA_ARGS__, BPF_TABLE_SHARED6, BPF_TABLE_SHARED5)(__VA_ARGS__)
 
+// Load-time specialization constants. BPF_CONFIG(u32, target_pid) defines an
+// inline accessor target_pid() whose value userspace sets through
+// BPF::set_config("target_pid", v) after compilation but before the program
+// is loaded, so parameter changes reuse the compiled program (and the object
+// cache) instead of forcing a recompile with different -D flags. The
+// accessor compiles to a 64-bit immediate load carrying a tagged hash of the
+// config name; the loader rewrites it in place, so the verifier still sees a
+// plain constant and dead-code-eliminates accordingly. Configs never set
+// read as 0. Names must differ within their first 16 characters (the hash
+// covers no more).
+#define __BPF_CONFIG_FNV(h, s, i) \
+  ((unsigned)(i) < sizeof(s) - 1 \
+       ? ((h) ^ (unsigned long long)(unsigned char)(s)[i]) * 0x100000001b3ull \
+       : (h))
+#define __BPF_CONFIG_HASH(s) \
+  (0xbcc0000000000000ull | \
+   (__BPF_CONFIG_FNV(__BPF_CONFIG_FNV(__BPF_CONFIG_FNV(__BPF_CONFIG_FNV( \
+    __BPF_CONFIG_FNV(__BPF_CONFIG_FNV(__BPF_CONFIG_FNV(__BPF_CONFIG_FNV( \
+    __BPF_CONFIG_FNV(__BPF_CONFIG_FNV(__BPF_CONFIG_FNV(__BPF_CONFIG_FNV( \
+    __BPF_CONFIG_FNV(__BPF_CONFIG_FNV(__BPF_CONFIG_FNV(__BPF_CONFIG_FNV( \
+    0xcbf29ce484222325ull, \
+    s, 0), s, 1), s, 2), s, 3), s, 4), s, 5), s, 6), s, 7), \
+    s, 8), s, 9), s, 10), s, 11), s, 12), s, 13), s, 14), s, 15) & \
+    0xffffffffffffull))
+#define BPF_CONFIG(_type, _name) \
+static __always_inline _type _name() { \
+  unsigned long long __cfg = __BPF_CONFIG_HASH(#_name); \
+  /* opaque to the optimizer so the tagged immediate survives to the */ \
+  /* final instruction stream as one ld_imm64 */ \
+  asm volatile("" : "+r"(__cfg)); \
+  return (_type)__cfg; \
+}
+
 // Identifier for current CPU used in perf_submit and perf_read
 // Prefer BPF_F_CURRENT_CPU flag, falls back to call helper for older kernel
 // Can be overridden from BCC
@@ -228,6 +261,46 @@ struct _name##_table_t { \
 __attribute__((section("maps/perf_output"))) \
 struct _name##_table_t _name = { .max_entries = 0 }
 
+// Header of a packed batch record emitted by BPF_PERF_OUTPUT_COALESCED;
+// BPFPerfBuffer recognizes the magic and unpacks the records before the
+// user callback, which therefore never sees this framing.
+struct bpf_perf_coalesce_hdr {
+  u64 magic;
+  u32 rec_size;
+  u32 count;
+};
+#define BPF_PERF_COALESCE_MAGIC 0xbccc0a1e5ced0001ULL
+
+// Coalescing variant of BPF_PERF_OUTPUT for high-rate streams of small
+// fixed-size records: map.perf_submit_coalesced(ctx, &record) appends the
+// record to a percpu staging buffer and only pays the
+// bpf_perf_event_output() call once _batch records have accumulated, when
+// one packed batch is submitted. Records parked in a partial batch are
+// pushed out with map.perf_flush_coalesced(ctx) — call it from a periodic
+// program (e.g. a perf timer) to bound delivery latency. Userspace
+// BPFPerfBuffer unpacks batches transparently, so the callback still
+// receives one record per invocation.
+#define BPF_PERF_OUTPUT_COALESCED(_name, _type, _batch) \
+struct _name##_table_t { \
+  int key; \
+  u32 leaf; \
+  /* map.perf_submit(ctx, data, data_size) */ \
+  int (*perf_submit) (void *, void *, u32); \
+  int (*perf_submit_skb) (void *, u32, void *, u32); \
+  /* map.perf_submit_coalesced(ctx, &record) */ \
+  int (*perf_submit_coalesced) (void *, _type *); \
+  /* map.perf_flush_coalesced(ctx) */ \
+  int (*perf_flush_coalesced) (void *); \
+  u32 max_entries; \
+}; \
+__attribute__((section("maps/perf_output"))) \
+struct _name##_table_t _name = { .max_entries = 0 }; \
+struct _name##_coalesce_leaf_t { \
+  struct bpf_perf_coalesce_hdr hdr; \
+  _type records[_batch]; \
+}; \
+BPF_PERCPU_ARRAY(_name##_coalesce, struct _name##_coalesce_leaf_t, 1)
+
 // Table for pushing custom events to userspace via ring buffer
 #define BPF_RINGBUF_OUTPUT(_name, _num_pages) \
 struct _name##_table_t { \
@@ -248,6 +321,23 @@ struct _name##_table_t { \
 __attribute__((section("maps/ringbuf"))) \
 struct _name##_table_t _name = { .max_entries = ((_num_pages) * PAGE_SIZE) }
 
+// Arena of _num_pages pages shared read-write between BPF programs and
+// userspace with no syscall on either side; userspace maps the whole region
+// through BPFArenaTable. Programs built with a toolchain that has BPF arena
+// support address it via the bpf_arena_alloc_pages()/bpf_arena_free_pages()
+// kfuncs and arena address-space casts. Requires kernel v6.9+.
+#define BPF_ARENA(_name, _num_pages) \
+struct _name##_table_t { \
+  int key; \
+  u32 leaf; \
+  u32 max_entries; \
+  int flags; \
+}; \
+__attribute__((section("maps/arena"))) \
+struct _name##_table_t _name = { \
+  .flags = (1U << 10) /* BPF_F_MMAPABLE, absent from older uapi headers */, \
+  .max_entries = (_num_pages) }
+
 // Table for reading hw perf cpu counters
 #define BPF_PERF_ARRAY(_name, _max_entries) \
 struct _name##_table_t { \
@@ -382,6 +472,59 @@ struct bpf_stacktrace_buildid {
 #define BPF_STACK_TRACE_BUILDID(_name, _max_entries) \
   BPF_F_TABLE("stacktrace", int, struct bpf_stacktrace_buildid, _name, roundup_pow_of_two(_max_entries), BPF_F_STACK_BUILD_ID)
 
+// Raw stack record streamed by BPF_RAW_STACK_OUTPUT: kernel frames first,
+// user frames following at ips[kernel_nr]; only the used portion of ips
+// is submitted.
+struct bpf_raw_stack_event {
+  u32 pid;
+  s32 kernel_nr;
+  s32 user_nr;
+  u32 reserved;
+  u64 ips[2 * BPF_MAX_STACK_DEPTH];
+};
+
+// Collision-free alternative to BPF_STACK_TRACE for high stack
+// cardinality: stack-trace maps hash frames into a fixed id space and
+// silently drop distinct stacks that collide on an id, skewing profiles.
+// BPF_RAW_STACK_OUTPUT(_name) declares a perf output table plus a percpu
+// scratch slot and a helper _name##_stack_submit(ctx) that captures the
+// kernel and user stacks with bpf_get_stack() and streams the raw frames
+// inline through the ring — no id, no collision. Userspace feeds the
+// events to BPFRawStackDecoder (api/BPFTable.h), which dedups them into
+// stable ids and symbolizes like BPFStackTable. Costs ring bandwidth
+// proportional to stack depth per event instead of kernel map memory;
+// needs kernel v4.18+ for bpf_get_stack().
+#define BPF_RAW_STACK_OUTPUT(_name) \
+BPF_PERF_OUTPUT(_name); \
+BPF_PERCPU_ARRAY(_name##_stack_scratch, struct bpf_raw_stack_event, 1); \
+static inline __attribute__((always_inline)) \
+int _name##_stack_submit(void *ctx) { \
+  int _zero = 0; \
+  struct bpf_raw_stack_event *_ev = _name##_stack_scratch.lookup(&_zero); \
+  if (!_ev) \
+    return -1; \
+  _ev->pid = bpf_get_current_pid_tgid() >> 32; \
+  _ev->reserved = 0; \
+  int _kb = bpf_get_stack(ctx, _ev->ips, \
+                          BPF_MAX_STACK_DEPTH * sizeof(u64), 0); \
+  u32 _kn = _kb > 0 ? (u32)_kb / sizeof(u64) : 0; \
+  if (_kn > BPF_MAX_STACK_DEPTH) \
+    _kn = BPF_MAX_STACK_DEPTH; \
+  int _ub = bpf_get_stack(ctx, &_ev->ips[_kn], \
+                          BPF_MAX_STACK_DEPTH * sizeof(u64), \
+                          BPF_F_USER_STACK); \
+  u32 _un = _ub > 0 ? (u32)_ub / sizeof(u64) : 0; \
+  if (_un > BPF_MAX_STACK_DEPTH) \
+    _un = BPF_MAX_STACK_DEPTH; \
+  _ev->kernel_nr = _kn; \
+  _ev->user_nr = _un; \
+  u32 _sz = __builtin_offsetof(struct bpf_raw_stack_event, ips) + \
+            (_kn + _un) * sizeof(u64); \
+  if (_sz > sizeof(*_ev)) \
+    _sz = sizeof(*_ev); \
+  return _name.perf_submit(ctx, _ev, _sz); \
+}
+
 #define BPF_PROG_ARRAY(_name, _max_entries) \
   BPF_TABLE("prog", u32, u32, _name, _max_entries)
 
@@ -418,6 +561,120 @@ struct _name##_table_t _name = { .max_entries = (_max_entries) }
 #define BPF_XSKMAPX(_1, _2, _3, NAME, ...) NAME
 #define BPF_XSKMAP(...) BPF_XSKMAPX(__VA_ARGS__, BPF_XSKMAP3, BPF_XSKMAP2)(__VA_ARGS__)
 
+// mirrored by BPFDevmapTable::redirect_stats in the C++ API
+struct bpf_redirect_stats {
+  u64 redirects;
+  u64 drops;
+};
+
+// Redirect map with per-slot visibility: declares the map plus a companion
+// percpu array <name>_xdp_stats with one bpf_redirect_stats slot per map
+// slot. Count with <name>_record_redirect(index) before redirect_map() and
+// <name>_record_drop(index) on the drop path; a percpu increment costs one
+// array lookup, so the probe overhead is near zero. Userspace reads the
+// summed per-slot rates with BPFDevmapTable::get_redirect_stats().
+#define _BPF_XDP_REDIRECT_STATS(_name, _max_entries) \
+BPF_PERCPU_ARRAY(_name##_xdp_stats, struct bpf_redirect_stats, _max_entries); \
+static inline __attribute__((always_inline)) \
+void _name##_record_redirect(int index) { \
+  struct bpf_redirect_stats *__stats = _name##_xdp_stats.lookup(&index); \
+  if (__stats) __stats->redirects++; \
+} \
+static inline __attribute__((always_inline)) \
+void _name##_record_drop(int index) { \
+  struct bpf_redirect_stats *__stats = _name##_xdp_stats.lookup(&index); \
+  if (__stats) __stats->drops++; \
+}
+
+#define BPF_DEVMAP_WITH_STATS(_name, _max_entries) \
+  BPF_DEVMAP(_name, _max_entries); \
+  _BPF_XDP_REDIRECT_STATS(_name, _max_entries)
+
+#define BPF_CPUMAP_WITH_STATS(_name, _max_entries) \
+  BPF_CPUMAP(_name, _max_entries); \
+  _BPF_XDP_REDIRECT_STATS(_name, _max_entries)
+
+// Kernel-side load shedding for event-producing programs. Each of the
+// macros below declares per-CPU state plus a single-entry per-CPU drop
+// counter named <name>_shed_drops, summed in userspace by
+// BPF::get_shed_drops("<name>"), so dropping happens in the program while
+// the damage stays measurable. All decisions are per CPU: no shared
+// cachelines on the hot path, at the cost of per-CPU rather than global
+// budgets.
+#define _BPF_SHED_DROPS(_name) \
+BPF_PERCPU_ARRAY(_name##_shed_drops, u64, 1); \
+static inline __attribute__((always_inline)) \
+void _name##_shed_drop(void) { \
+  int __zero = 0; \
+  u64 *__drops = _name##_shed_drops.lookup(&__zero); \
+  if (__drops) (*__drops)++; \
+}
+
+// Keep one event in every _n per CPU. <name>_should_sample() returns 1
+// when the current event should be emitted.
+#define BPF_SAMPLE_EVERY(_name, _n) \
+_BPF_SHED_DROPS(_name) \
+BPF_PERCPU_ARRAY(_name##_shed_state, u64, 1); \
+static inline __attribute__((always_inline)) \
+int _name##_should_sample(void) { \
+  int __zero = 0; \
+  u64 *__count = _name##_shed_state.lookup(&__zero); \
+  if (!__count) return 1; \
+  if ((*__count)++ % (_n) == 0) return 1; \
+  _name##_shed_drop(); \
+  return 0; \
+}
+
+// Token bucket of _tokens_per_sec events per CPU with one second of burst.
+// <name>_allow() returns 1 while the budget lasts.
+#define BPF_RATE_LIMIT(_name, _tokens_per_sec) \
+_BPF_SHED_DROPS(_name) \
+struct _name##_bucket_t { u64 tokens; u64 last_ns; }; \
+BPF_PERCPU_ARRAY(_name##_shed_state, struct _name##_bucket_t, 1); \
+static inline __attribute__((always_inline)) \
+int _name##_allow(void) { \
+  int __zero = 0; \
+  struct _name##_bucket_t *__b = _name##_shed_state.lookup(&__zero); \
+  u64 __now, __refill; \
+  if (!__b) return 1; \
+  __now = bpf_ktime_get_ns(); \
+  __refill = (__now - __b->last_ns) * (_tokens_per_sec) / 1000000000ull; \
+  if (__refill > 0) { \
+    __b->tokens += __refill; \
+    if (__b->tokens > (_tokens_per_sec)) __b->tokens = (_tokens_per_sec); \
+    __b->last_ns = __now; \
+  } \
+  if (__b->tokens > 0) { \
+    __b->tokens--; \
+    return 1; \
+  } \
+  _name##_shed_drop(); \
+  return 0; \
+}
+
+// Classic per-CPU reservoir sampling over a stream of unknown length:
+// <name>_reservoir_slot() returns the slot in [0, _k) the current event
+// should overwrite, or -1 when it should be dropped, such that every event
+// seen so far is resident with equal probability. Pair it with a per-CPU
+// array of _k event slots owned by the program.
+#define BPF_RESERVOIR_SAMPLE(_name, _k) \
+_BPF_SHED_DROPS(_name) \
+BPF_PERCPU_ARRAY(_name##_shed_state, u64, 1); \
+static inline __attribute__((always_inline)) \
+int _name##_reservoir_slot(void) { \
+  int __zero = 0; \
+  u64 __seen; \
+  u32 __j; \
+  u64 *__count = _name##_shed_state.lookup(&__zero); \
+  if (!__count) return -1; \
+  __seen = ++(*__count); \
+  if (__seen <= (_k)) return (int)(__seen - 1); \
+  __j = bpf_get_prandom_u32() % __seen; \
+  if (__j < (_k)) return (int)__j; \
+  _name##_shed_drop(); \
+  return -1; \
+}
+
 #define BPF_ARRAY_OF_MAPS(_name, _inner_map_name, _max_entries) \
   BPF_TABLE("array_of_maps$" _inner_map_name, int, int, _name, _max_entries)
 
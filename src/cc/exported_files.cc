@@ -16,15 +16,25 @@
 
 #include "exported_files.h"
 
+#ifdef BCC_COMPRESSED_HEADERS
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+
+#include <zlib.h>
+#endif
+
 using std::map;
 using std::string;
 
 namespace ebpf {
 
+#ifndef BCC_COMPRESSED_HEADERS
+
 // c++11 feature for including raw string literals
 // see http://www.stroustrup.com/C++11FAQ.html#raw-strings
 
-map<string, const char *> ExportedFiles::headers_ = {
+static map<string, const char *> headers_files = {
   {
     "/virtual/include/bcc/bpf.h",
     #include "compat/linux/virtual_bpf.h"
@@ -47,11 +57,89 @@ map<string, const char *> ExportedFiles::headers_ = {
   },
 };
 
-map<string, const char *> ExportedFiles::footers_ = {
+static map<string, const char *> footers_files = {
   {
     "/virtual/include/bcc/footer.h",
     #include "export/footer.h"
   },
 };
 
+const map<string, const char *> & ExportedFiles::headers() {
+  return headers_files;
+}
+
+const map<string, const char *> & ExportedFiles::footers() {
+  return footers_files;
+}
+
+#else  // BCC_COMPRESSED_HEADERS
+
+// The corpus is embedded deflate-compressed (generated at build time by
+// compress_headers from the same raw string literals) and inflated on the
+// first headers()/footers() call. Every consumer needs the whole corpus at
+// once -- the remap buffers of add_remapped_includes and the PCH digest
+// both walk all files -- so inflation is lazy per corpus, not per file.
+// The inflated strings live for the process, exactly like the static
+// literals they replace, so the const char * map interface is unchanged.
+
+struct compressed_file {
+  const char *path;
+  const unsigned char *data;
+  unsigned long z_size;
+  unsigned long raw_size;
+};
+
+#include "exported_files_compressed.inc"
+
+template <size_t N>
+static const map<string, const char *> &
+inflate_files(const struct compressed_file (&files)[N],
+              map<string, const char *> &out) {
+  for (const auto &f : files) {
+    char *buf = new char[f.raw_size + 1];
+    uLongf raw_len = f.raw_size;
+    if (uncompress(reinterpret_cast<Bytef *>(buf), &raw_len, f.data,
+                   f.z_size) != Z_OK ||
+        raw_len != f.raw_size) {
+      // embedded data is generated, so this only fires on build breakage
+      fprintf(stderr, "bcc: inflating embedded header %s failed\n", f.path);
+      abort();
+    }
+    buf[f.raw_size] = '\0';
+    out[f.path] = buf;
+  }
+  return out;
+}
+
+const map<string, const char *> & ExportedFiles::headers() {
+  static map<string, const char *> files;
+  static std::once_flag once;
+  std::call_once(once, [] { inflate_files(compressed_headers, files); });
+  return files;
+}
+
+const map<string, const char *> & ExportedFiles::footers() {
+  static map<string, const char *> files;
+  static std::once_flag once;
+  std::call_once(once, [] { inflate_files(compressed_footers, files); });
+  return files;
+}
+
+#endif  // BCC_COMPRESSED_HEADERS
+
+// Builds that target one known kernel/flags configuration (fleet images)
+// can bake the preamble PCH into the library by defining BCC_EMBED_PCH_BLOB
+// to a generated fragment defining these three symbols. The key must be the
+// same digest ClangLoader::ensure_pch derives at runtime (kernel release,
+// cc1 argument vector, exported header contents, NUL-separated, MD5, lower
+// hex); a mismatch simply falls back to generating the PCH on first use, so
+// a stale blob costs nothing but its size.
+#ifdef BCC_EMBED_PCH_BLOB
+#include BCC_EMBED_PCH_BLOB
+#else
+const unsigned char *ExportedFiles::preamble_pch_ = nullptr;
+size_t ExportedFiles::preamble_pch_size_ = 0;
+const char *ExportedFiles::preamble_pch_key_ = "";
+#endif
+
 }
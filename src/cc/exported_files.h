@@ -22,11 +22,22 @@
 namespace ebpf {
 
 class ExportedFiles {
-  static std::map<std::string, const char *> headers_;
-  static std::map<std::string, const char *> footers_;
+  static const unsigned char *preamble_pch_;
+  static size_t preamble_pch_size_;
+  static const char *preamble_pch_key_;
  public:
-  static const std::map<std::string, const char *> & headers() { return headers_; }
-  static const std::map<std::string, const char *> & footers() { return footers_; }
+  // Virtual header corpus fed to the embedded clang. With
+  // ENABLE_COMPRESSED_HEADERS the blobs are stored deflate-compressed and
+  // inflated on the first call (i.e. the first BPF compile), so tools that
+  // never compile pay neither the resident memory nor the page-in I/O.
+  static const std::map<std::string, const char *> & headers();
+  static const std::map<std::string, const char *> & footers();
+  // Optional precompiled preamble baked into the library at build time
+  // (empty in a stock build); used by ClangLoader::ensure_pch when the key
+  // matches the running kernel and flags. See exported_files.cc.
+  static const unsigned char *preamble_pch() { return preamble_pch_; }
+  static size_t preamble_pch_size() { return preamble_pch_size_; }
+  static const char *preamble_pch_key() { return preamble_pch_key_; }
 };
 
 }
@@ -18,50 +18,46 @@
 
 #include <unistd.h>
 
+#include <memory>
+
 namespace ebpf {
 
-/// FileDesc is a helper class for managing open file descriptors. Copy is
-/// disallowed (call dup instead), and cleanup happens automatically.
+/// FileDesc is a helper class for managing open file descriptors. Copies
+/// share the same underlying fd, which is closed when the last sharer
+/// releases it; call dup() for an independent descriptor with its own
+/// kernel-level lifetime.
 class FileDesc {
  public:
-  explicit FileDesc(int fd = -1) : fd_(fd) {}
-  FileDesc(FileDesc &&that) : fd_(-1) { *this = std::move(that); }
-  FileDesc(const FileDesc &that) = delete;
+  explicit FileDesc(int fd = -1) { *this = fd; }
+  FileDesc(const FileDesc &that) = default;
+  FileDesc(FileDesc &&that) = default;
 
-  ~FileDesc() {
-    if (fd_ >= 0)
-      ::close(fd_);
-  }
+  FileDesc &operator=(const FileDesc &that) = default;
+  FileDesc &operator=(FileDesc &&that) = default;
 
   FileDesc &operator=(int fd) {
-    if (fd_ >= 0)
-      ::close(fd_);
-    fd_ = fd;
-    return *this;
-  }
-  FileDesc &operator=(FileDesc &&that) {
-    if (fd_ >= 0)
-      ::close(fd_);
-    fd_ = that.fd_;
-    that.fd_ = -1;
+    if (fd >= 0)
+      fd_ = std::shared_ptr<int>(new int(fd), [](int *p) {
+        ::close(*p);
+        delete p;
+      });
+    else
+      fd_.reset();
     return *this;
   }
-  FileDesc &operator=(const FileDesc &that) = delete;
 
+  /// An independent descriptor via dup(2), for the rare caller that needs
+  /// its own fd lifetime (e.g. to hand off to another owner).
   FileDesc dup() const {
-    if (fd_ >= 0) {
-      int dup_fd = ::dup(fd_);
-      return FileDesc(dup_fd);
-    } else {
-      return FileDesc(-1);
-    }
+    if (fd_)
+      return FileDesc(::dup(*fd_));
+    return FileDesc(-1);
   }
 
-  operator int() { return fd_; }
-  operator int() const { return fd_; }
+  operator int() const { return fd_ ? *fd_ : -1; }
 
  private:
-  int fd_;
+  std::shared_ptr<int> fd_;
 };
 
 }  // namespace ebpf
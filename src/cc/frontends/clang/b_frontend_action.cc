@@ -358,8 +358,10 @@ bool MapVisitor::VisitCallExpr(CallExpr *Call) {
 }
 
 ProbeVisitor::ProbeVisitor(ASTContext &C, Rewriter &rewriter,
-                           set<Decl *> &m, bool track_helpers) :
-  C(C), rewriter_(rewriter), m_(m), ctx_(nullptr), track_helpers_(track_helpers),
+                           set<Decl *> &m, bool track_helpers,
+                           field_accesses_def &field_accesses) :
+  C(C), rewriter_(rewriter), m_(m), field_accesses_(field_accesses),
+  ctx_(nullptr), track_helpers_(track_helpers),
   addrof_stmt_(nullptr), is_addrof_(false) {
   const char **calling_conv_regs = get_call_conv();
   cannot_fall_back_safely = (calling_conv_regs == calling_conv_regs_s390x || calling_conv_regs == calling_conv_regs_riscv64);
@@ -624,6 +626,23 @@ bool ProbeVisitor::VisitMemberExpr(MemberExpr *E) {
   if (E->getType()->isArrayType())
     return true;
 
+  // this rewrite bakes the field offsets into the emitted probe read;
+  // record each named-struct member in the chain so that an AOT artifact
+  // can verify the layouts against the running kernel's BTF at load time
+  for (MemberExpr *M = E; M; M = dyn_cast<MemberExpr>(M->getBase())) {
+    if (FieldDecl *field = dyn_cast<FieldDecl>(M->getMemberDecl())) {
+      const RecordDecl *record = field->getParent()->getDefinition();
+      if (record && !record->getNameAsString().empty()) {
+        const ASTRecordLayout &layout = C.getASTRecordLayout(record);
+        field_accesses_.push_back(
+            {record->getNameAsString(), field->getNameAsString(),
+             layout.getFieldOffset(field->getFieldIndex())});
+      }
+    }
+    if (M->isArrow())
+      break;
+  }
+
   string rhs = rewriter_.getRewrittenText(expansionRange(SourceRange(rhs_start, GET_ENDLOC(E))));
   string base_type = base->getType()->getPointeeType().getAsString();
   string pre, post;
@@ -1035,6 +1054,67 @@ bool BTypeVisitor::VisitCallExpr(CallExpr *Call) {
             }
             fe_.perf_events_[name] = perf_event;
           }
+        } else if (memb_name == "perf_submit_coalesced" ||
+                   memb_name == "perf_flush_coalesced") {
+          // BPF_PERF_OUTPUT_COALESCED: stage records in the companion percpu
+          // array and emit one packed batch per bpf_perf_event_output call.
+          // The batch capacity comes from the staging leaf's array size, so
+          // the generated text needs only the two map fds.
+          string name = string(Ref->getDecl()->getName());
+          string staging = name + "_coalesce";
+          TableStorage::iterator staging_desc;
+          Path staging_local({fe_.id(), staging});
+          Path staging_global({staging});
+          if (!fe_.table_storage().Find(staging_local, staging_desc) &&
+              !fe_.table_storage().Find(staging_global, staging_desc)) {
+            error(GET_ENDLOC(Ref),
+                  "%0 is not declared with BPF_PERF_OUTPUT_COALESCED")
+                << name;
+            return false;
+          }
+          string sfd = to_string(staging_desc->second.fd >= 0
+                                     ? staging_desc->second.fd
+                                     : staging_desc->second.fake_fd);
+          string arg0 = rewriter_.getRewrittenText(expansionRange(Call->getArg(0)->getSourceRange()));
+          string capacity = "(sizeof(_buf->records) / sizeof(_buf->records[0]))";
+          string emit;
+          emit  = "_buf->hdr.magic = BPF_PERF_COALESCE_MAGIC; ";
+          emit += "_buf->hdr.rec_size = sizeof(_buf->records[0]); ";
+          emit += "_rc = bpf_perf_event_output(" + arg0 +
+                  ", (void *)bpf_pseudo_fd(1, " + fd +
+                  "), CUR_CPU_IDENTIFIER, _buf, sizeof(*_buf)); ";
+          emit += "_buf->hdr.count = 0; ";
+          txt  = "({ int _rc = 0; int _zero = 0; ";
+          txt += "typeof(" + staging + ".leaf) *_buf = "
+                 "bpf_map_lookup_elem_(bpf_pseudo_fd(1, " + sfd +
+                 "), &_zero); ";
+          if (memb_name == "perf_submit_coalesced") {
+            string arg1 = rewriter_.getRewrittenText(expansionRange(Call->getArg(1)->getSourceRange()));
+            txt += "if (_buf) { ";
+            txt += "u32 _i = _buf->hdr.count; ";
+            txt += "if (_i >= " + capacity + ") _i = 0; ";
+            txt += "__builtin_memcpy(&_buf->records[_i], " + arg1 +
+                   ", sizeof(_buf->records[0])); ";
+            txt += "_buf->hdr.count = _i + 1; ";
+            txt += "if (_buf->hdr.count == " + capacity + ") { " + emit + "} ";
+            txt += "} ";
+
+            auto type_arg1 = Call->getArg(1)->IgnoreCasts()->getType().getTypePtr()->getPointeeType().getTypePtrOrNull();
+            if (type_arg1 && type_arg1->isStructureType()) {
+              auto event_type = type_arg1->getAsTagDecl();
+              const auto *r = dyn_cast<RecordDecl>(event_type);
+              std::vector<std::string> perf_event;
+              for (auto it = r->field_begin(); it != r->field_end(); ++it)
+                perf_event.push_back(it->getNameAsString() + "#" + it->getType().getAsString());
+              fe_.perf_events_[name] = perf_event;
+            }
+          } else {
+            // flush submits the full staging struct even when partially
+            // filled -- hdr.count tells userspace how many records are
+            // valid, and a constant size keeps the verifier happy
+            txt += "if (_buf && _buf->hdr.count > 0) { " + emit + "} ";
+          }
+          txt += "_rc; })";
         } else if (memb_name == "perf_submit_skb") {
           string skb = rewriter_.getRewrittenText(expansionRange(Call->getArg(0)->getSourceRange()));
           string skb_len = rewriter_.getRewrittenText(expansionRange(Call->getArg(1)->getSourceRange()));
@@ -1589,6 +1669,11 @@ bool BTypeVisitor::VisitVarDecl(VarDecl *Decl) {
       // values from libbpf/src/libbpf_probes.c
       table.key_size = 0;
       table.leaf_size = 0;
+    } else if (section_attr == "maps/arena") {
+      map_type = BPF_MAP_TYPE_ARENA;
+      // like ringbuf: no per-element key/value, max_entries counts pages
+      table.key_size = 0;
+      table.leaf_size = 0;
     } else if (section_attr == "maps/perf_array") {
       map_type = BPF_MAP_TYPE_PERF_EVENT_ARRAY;
     } else if (section_attr == "maps/queue") {
@@ -1695,10 +1780,32 @@ bool BTypeVisitor::VisitVarDecl(VarDecl *Decl) {
 BTypeConsumer::BTypeConsumer(ASTContext &C, BFrontendAction &fe,
                              Rewriter &rewriter, set<Decl *> &m)
     : fe_(fe),
+      rewriter_(rewriter),
       map_visitor_(m),
       btype_visitor_(C, fe),
-      probe_visitor1_(C, rewriter, m, true),
-      probe_visitor2_(C, rewriter, m, false) {}
+      probe_visitor1_(C, rewriter, m, true, fe.field_accesses()),
+      probe_visitor2_(C, rewriter, m, false, fe.field_accesses()) {}
+
+// Key covering everything the ProbeVisitor passes can observe about a
+// function: its signature (pointer tracking starts from the parameter types)
+// and the body's source text. Returns an empty key, disabling memoization,
+// for functions without a usable body and for USDT argument readers, whose
+// rewrite embeds the enclosing function's name.
+string BTypeConsumer::probeMemoKey(FunctionDecl *F) {
+  if (!F->hasBody())
+    return "";
+  SourceManager &SM = rewriter_.getSourceMgr();
+  CharSourceRange body = CharSourceRange::getTokenRange(
+      SM.getExpansionRange(F->getBody()->getSourceRange()).getAsRange());
+  string text = Lexer::getSourceText(body, SM, rewriter_.getLangOpts()).str();
+  if (text.empty() || text.find("bpf_usdt_readarg") != string::npos)
+    return "";
+  string key = F->getReturnType().getAsString();
+  for (auto arg : F->parameters())
+    key += "|" + arg->getType().getAsString();
+  key += "|" + text;
+  return key;
+}
 
 void BTypeConsumer::HandleTranslationUnit(ASTContext &Context) {
   DeclContext::decl_iterator it;
@@ -1714,6 +1821,23 @@ void BTypeConsumer::HandleTranslationUnit(ASTContext &Context) {
     Decl *D = *it;
     if (FunctionDecl *F = dyn_cast<FunctionDecl>(D)) {
       if (fe_.is_rewritable_ext_func(F)) {
+        string memo_key = probeMemoKey(F);
+        if (!memo_key.empty()) {
+          auto res = probe_rewrite_memo_.emplace(memo_key, F);
+          if (!res.second) {
+            /**
+             * Same signature and body text as an earlier probe: generated
+             * programs often contain hundreds of identical bodies differing
+             * only in attach name. The pointer-tracking passes would make
+             * the same decisions and produce the same rewrites, so skip
+             * them here (and below) and splice in the memoized function's
+             * rewritten body at the end.
+             */
+            probe_rewrite_dups_.emplace_back(F, res.first->second);
+            probe_rewrite_skip_.insert(F);
+            continue;
+          }
+        }
         for (auto arg : F->parameters()) {
           if (arg == F->getParamDecl(0)) {
             /**
@@ -1753,7 +1877,8 @@ void BTypeConsumer::HandleTranslationUnit(ASTContext &Context) {
   for (it = DC->decls_begin(); it != DC->decls_end(); it++) {
     Decl *D = *it;
     if (FunctionDecl *F = dyn_cast<FunctionDecl>(D)) {
-      if (fe_.is_rewritable_ext_func(F)) {
+      if (fe_.is_rewritable_ext_func(F) &&
+          probe_rewrite_skip_.find(F) == probe_rewrite_skip_.end()) {
         map_visitor_.TraverseDecl(D);
       }
     }
@@ -1770,7 +1895,8 @@ void BTypeConsumer::HandleTranslationUnit(ASTContext &Context) {
   for (it = DC->decls_begin(); it != DC->decls_end(); it++) {
     Decl *D = *it;
     if (FunctionDecl *F = dyn_cast<FunctionDecl>(D)) {
-      if (fe_.is_rewritable_ext_func(F)) {
+      if (fe_.is_rewritable_ext_func(F) &&
+          probe_rewrite_skip_.find(F) == probe_rewrite_skip_.end()) {
         probe_visitor2_.TraverseDecl(D);
       }
     }
@@ -1778,6 +1904,24 @@ void BTypeConsumer::HandleTranslationUnit(ASTContext &Context) {
     btype_visitor_.TraverseDecl(D);
   }
 
+  /**
+   * Functions skipped above because an earlier probe had the same signature
+   * and body text now receive that probe's rewritten body. BTypeVisitor
+   * still traversed them, so per-function bookkeeping (ProgFuncInfo, perf
+   * events, map fds) is complete; its body rewrites are text-identical for
+   * identical bodies, so the splice carries them along with the
+   * bpf_probe_read rewrites.
+   */
+  SourceManager &SM = Context.getSourceManager();
+  for (auto &dup : probe_rewrite_dups_) {
+    SourceRange dst =
+        SM.getExpansionRange(dup.first->getBody()->getSourceRange())
+            .getAsRange();
+    SourceRange src =
+        SM.getExpansionRange(dup.second->getBody()->getSourceRange())
+            .getAsRange();
+    rewriter_.ReplaceText(dst, rewriter_.getRewrittenText(src));
+  }
 }
 
 BFrontendAction::BFrontendAction(
@@ -1785,7 +1929,8 @@ BFrontendAction::BFrontendAction(
     const std::string &id, const std::string &main_path,
     ProgFuncInfo &prog_func_info, std::string &mod_src,
     const std::string &maps_ns, fake_fd_map_def &fake_fd_map,
-    std::map<std::string, std::vector<std::string>> &perf_events)
+    std::map<std::string, std::vector<std::string>> &perf_events,
+    field_accesses_def &field_accesses)
     : os_(os),
       flags_(flags),
       ts_(ts),
@@ -1797,7 +1942,8 @@ BFrontendAction::BFrontendAction(
       mod_src_(mod_src),
       next_fake_fd_(-1),
       fake_fd_map_(fake_fd_map),
-      perf_events_(perf_events) {}
+      perf_events_(perf_events),
+      field_accesses_(field_accesses) {}
 
 bool BFrontendAction::is_rewritable_ext_func(FunctionDecl *D) {
   StringRef file_name = rewriter_->getSourceMgr().getFilename(GET_BEGINLOC(D));
@@ -1854,21 +2000,44 @@ void BFrontendAction::EndSourceFileAction() {
   // Additional misc rewrites
   DoMiscWorkAround();
 
-  if (flags_ & DEBUG_PREPROCESSOR)
-    rewriter_->getEditBuffer(rewriter_->getSourceMgr().getMainFileID()).write(llvm::errs());
+  // Materialize the rewrite rope exactly once and serve every consumer from
+  // the flat string. The buffer used to be re-walked for the debug dump,
+  // mod_src_, each function's rewritten source and the final output, and on
+  // a large generated program those repeated traversals of an edit-heavy
+  // rope dominated the rewrite stage. Per-function slices come from mapping
+  // the original range endpoints through the rope's delta tree — the same
+  // mapping getRewrittenText() performs — then substr()ing the
+  // already-materialized text instead of walking the rope per function.
+  SourceManager &SM = rewriter_->getSourceMgr();
+  FileID main_id = SM.getMainFileID();
+  const RewriteBuffer &buf = rewriter_->getEditBuffer(main_id);
 
   llvm::raw_string_ostream tmp_os(mod_src_);
-  rewriter_->getEditBuffer(rewriter_->getSourceMgr().getMainFileID())
-      .write(tmp_os);
-
-  for (auto func : func_range_) {
-    auto f = func.first;
-    string bd = rewriter_->getRewrittenText(func_range_[f]);
-    auto fn = prog_func_info_.get_func(f);
-    if (fn)
-      fn->src_rewritten_ = bd;
+  buf.write(tmp_os);
+  tmp_os.flush();
+
+  if (flags_ & DEBUG_PREPROCESSOR)
+    llvm::errs() << mod_src_;
+
+  for (const auto &func : func_range_) {
+    auto fn = prog_func_info_.get_func(func.first);
+    if (!fn)
+      continue;
+    SourceLocation start = func.second.getBegin(), end = func.second.getEnd();
+    std::pair<FileID, unsigned> start_info = SM.getDecomposedLoc(start);
+    std::pair<FileID, unsigned> end_info = SM.getDecomposedLoc(end);
+    if (start_info.first != main_id || end_info.first != main_id)
+      continue;
+    unsigned start_off = buf.getMappedOffset(start_info.second);
+    unsigned end_off = buf.getMappedOffset(
+        end_info.second +
+            Lexer::MeasureTokenLength(end, SM, rewriter_->getLangOpts()),
+        true);
+    if (start_off <= end_off && end_off <= mod_src_.size())
+      fn->src_rewritten_ = mod_src_.substr(start_off, end_off - start_off);
   }
-  rewriter_->getEditBuffer(rewriter_->getSourceMgr().getMainFileID()).write(os_);
+
+  os_ << mod_src_;
   os_.flush();
 }
 
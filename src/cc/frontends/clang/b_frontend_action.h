@@ -97,7 +97,8 @@ class BTypeVisitor : public clang::RecursiveASTVisitor<BTypeVisitor> {
 class ProbeVisitor : public clang::RecursiveASTVisitor<ProbeVisitor> {
  public:
   explicit ProbeVisitor(clang::ASTContext &C, clang::Rewriter &rewriter,
-                        std::set<clang::Decl *> &m, bool track_helpers);
+                        std::set<clang::Decl *> &m, bool track_helpers,
+                        field_accesses_def &field_accesses);
   bool VisitVarDecl(clang::VarDecl *Decl);
   bool TraverseStmt(clang::Stmt *S);
   bool VisitCallExpr(clang::CallExpr *Call);
@@ -125,6 +126,7 @@ class ProbeVisitor : public clang::RecursiveASTVisitor<ProbeVisitor> {
   std::set<const clang::Stmt *> whitelist_;
   std::set<std::tuple<clang::Decl *, int>> ptregs_;
   std::set<clang::Decl *> &m_;
+  field_accesses_def &field_accesses_;
   clang::Decl *ctx_;
   bool track_helpers_;
   std::list<int> ptregs_returned_;
@@ -140,11 +142,21 @@ class BTypeConsumer : public clang::ASTConsumer {
                          clang::Rewriter &rewriter, std::set<clang::Decl *> &m);
   void HandleTranslationUnit(clang::ASTContext &Context) override;
  private:
+  std::string probeMemoKey(clang::FunctionDecl *F);
   BFrontendAction &fe_;
+  clang::Rewriter &rewriter_;
   MapVisitor map_visitor_;
   BTypeVisitor btype_visitor_;
   ProbeVisitor probe_visitor1_;
   ProbeVisitor probe_visitor2_;
+  // probe-rewrite memoization: first function seen for each distinct
+  // (signature, body text) pair. Later identical functions skip the
+  // pointer-tracking passes and get the memoized function's rewritten body
+  // spliced in instead, so the rewriting passes run once per unique body.
+  std::map<std::string, clang::FunctionDecl *> probe_rewrite_memo_;
+  std::set<clang::FunctionDecl *> probe_rewrite_skip_;
+  std::vector<std::pair<clang::FunctionDecl *, clang::FunctionDecl *>>
+      probe_rewrite_dups_;
 };
 
 // Create a B program in 2 phases (everything else is normal C frontend):
@@ -158,7 +170,8 @@ class BFrontendAction : public clang::ASTFrontendAction {
                   const std::string &id, const std::string &main_path,
                   ProgFuncInfo &prog_func_info, std::string &mod_src,
                   const std::string &maps_ns, fake_fd_map_def &fake_fd_map,
-                  std::map<std::string, std::vector<std::string>> &perf_events);
+                  std::map<std::string, std::vector<std::string>> &perf_events,
+                  field_accesses_def &field_accesses);
 
   // Called by clang when the AST has been completed, here the output stream
   // will be flushed.
@@ -180,6 +193,7 @@ class BFrontendAction : public clang::ASTFrontendAction {
                std::string> map_def) {
     fake_fd_map_[fd] = move(map_def);
   }
+  field_accesses_def &field_accesses() { return field_accesses_; }
 
  private:
   llvm::raw_ostream &os_;
@@ -197,6 +211,7 @@ class BFrontendAction : public clang::ASTFrontendAction {
   int next_fake_fd_;
   fake_fd_map_def &fake_fd_map_;
   std::map<std::string, std::vector<std::string>> &perf_events_;
+  field_accesses_def &field_accesses_;
 };
 
 }  // namespace visitor
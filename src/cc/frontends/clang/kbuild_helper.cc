@@ -14,11 +14,17 @@
  * limitations under the License.
  */
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <mutex>
 
 #include <dirent.h>
 #include <fcntl.h>
+#include <stdio.h>
+#include <sys/file.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <sys/utsname.h>
 #include <unistd.h>
 
@@ -225,18 +231,62 @@ cleanup:
   return ret;
 }
 
+// Kernel build id from the NT_GNU_BUILD_ID note in /sys/kernel/notes, as a
+// hex string. Falls back to a hash of the uname version string (which embeds
+// the build count and timestamp), so a rebuilt kernel whose release string
+// did not change still gets a fresh extracted tree.
+static std::string kernel_build_id(const struct utsname &uname_data)
+{
+  std::ifstream notes("/sys/kernel/notes", std::ios::binary);
+  if (notes) {
+    std::string data((std::istreambuf_iterator<char>(notes)),
+                     std::istreambuf_iterator<char>());
+    size_t off = 0;
+    while (off + 12 <= data.size()) {
+      uint32_t namesz, descsz, type;
+      memcpy(&namesz, &data[off], 4);
+      memcpy(&descsz, &data[off + 4], 4);
+      memcpy(&type, &data[off + 8], 4);
+      size_t name_off = off + 12;
+      size_t desc_off = name_off + ((namesz + 3) & ~3u);
+      if (desc_off + descsz > data.size())
+        break;
+      if (type == 3 /* NT_GNU_BUILD_ID */ && namesz == 4 &&
+          !memcmp(&data[name_off], "GNU", 4)) {
+        std::string out;
+        char hex[3];
+        for (size_t i = 0; i < descsz; i++) {
+          snprintf(hex, sizeof(hex), "%02x", (unsigned char)data[desc_off + i]);
+          out += hex;
+        }
+        return out;
+      }
+      off = desc_off + ((descsz + 3) & ~3u);
+    }
+  }
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%zx",
+           std::hash<std::string>{}(uname_data.version));
+  return std::string(buf);
+}
+
 int get_proc_kheaders(std::string &dirpath)
 {
   struct utsname uname_data;
-  char dirpath_tmp[256];
+  char dirpath_tmp[256], lockpath[sizeof(dirpath_tmp) + 8];
+  int lock_fd, ret;
 
   if (uname(&uname_data))
     return -errno;
 
-  snprintf(dirpath_tmp, 256, "%s/kheaders-%s", get_tmp_dir(),
-           uname_data.release);
+  // keyed by build id so every process on the host shares one extracted
+  // tree per booted kernel, and a kernel rebuild invalidates it
+  std::string build_id = kernel_build_id(uname_data);
+  snprintf(dirpath_tmp, sizeof(dirpath_tmp), "%s/kheaders-%s-%s",
+           get_tmp_dir(), uname_data.release, build_id.c_str());
   dirpath = std::string(dirpath_tmp);
 
+  // warm path: no lock needed once the tree is in place
   if (file_exists(dirpath_tmp)) {
     if (file_exists_and_ownedby(dirpath_tmp, 0))
       return 0;
@@ -246,8 +296,117 @@ int get_proc_kheaders(std::string &dirpath)
       return -EEXIST;
   }
 
-  // First time so extract it
-  return extract_kheaders(dirpath, uname_data);
+  // Serialize extraction across processes so only the first one pays the
+  // decompression; the rest block on the lock and find the tree ready.
+  // extract_kheaders stays race-tolerant (tempdir + rename) as a backstop
+  // for the lockless case.
+  snprintf(lockpath, sizeof(lockpath), "%s.lock", dirpath_tmp);
+  lock_fd = open(lockpath, O_CREAT | O_RDWR | O_CLOEXEC, 0600);
+  if (lock_fd >= 0)
+    flock(lock_fd, LOCK_EX);
+
+  if (file_exists(dirpath_tmp))
+    ret = file_exists_and_ownedby(dirpath_tmp, 0) ? 0 : -EEXIST;
+  else
+    ret = extract_kheaders(dirpath, uname_data);
+
+  if (lock_fd >= 0) {
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+  }
+  return ret;
+}
+
+static std::mutex kbuild_cache_mutex;
+static std::map<string, KBuildResolution> kbuild_cache;
+
+static const char kKbuildCacheMagic[] = "bcc-kbuild-cache-v1";
+
+static string kbuild_cache_file(const string &key) {
+  const char *dir = ::getenv("BCC_KBUILD_CACHE_DIR");
+  if (!dir || !*dir)
+    return "";
+  // keys embed env override paths; hash them into a flat file name
+  return string(dir) + "/kbuild-" +
+         std::to_string(std::hash<string>{}(key)) + ".flags";
+}
+
+static uint64_t path_mtime(const string &path) {
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0)
+    return 0;
+  return (uint64_t)st.st_mtime;
+}
+
+bool kbuild_resolution_lookup(const string &key, KBuildResolution *res) {
+  {
+    std::lock_guard<std::mutex> lock(kbuild_cache_mutex);
+    auto it = kbuild_cache.find(key);
+    if (it != kbuild_cache.end()) {
+      *res = it->second;
+      return true;
+    }
+  }
+
+  string path = kbuild_cache_file(key);
+  if (path.empty())
+    return false;
+  std::ifstream ifs(path);
+  if (!ifs)
+    return false;
+  string magic;
+  uint64_t mtime;
+  int has_source;
+  ifs >> magic >> mtime >> has_source;
+  if (!ifs || magic != kKbuildCacheMagic)
+    return false;
+  ifs.ignore();
+  KBuildResolution r;
+  r.has_kpath_source = has_source != 0;
+  if (!std::getline(ifs, r.kdir) || !std::getline(ifs, r.kpath))
+    return false;
+  string line;
+  while (std::getline(ifs, line))
+    r.kflags.push_back(line);
+  if (r.kflags.empty())
+    return false;
+  // a kernel update shows up as a new modules-dir mtime; leftover build
+  // directories without headers are caught by the kconfig.h check, same as
+  // the non-cached path
+  if (path_mtime(r.kdir.empty() ? r.kpath : r.kdir) != mtime)
+    return false;
+  if (!file_exists((r.kpath + "/include/linux/kconfig.h").c_str()))
+    return false;
+
+  std::lock_guard<std::mutex> lock(kbuild_cache_mutex);
+  kbuild_cache[key] = r;
+  *res = std::move(r);
+  return true;
+}
+
+void kbuild_resolution_store(const string &key, const KBuildResolution &res) {
+  {
+    std::lock_guard<std::mutex> lock(kbuild_cache_mutex);
+    kbuild_cache[key] = res;
+  }
+
+  string path = kbuild_cache_file(key);
+  if (path.empty())
+    return;
+  string tmp_path = path + ".tmp." + std::to_string(::getpid());
+  std::ofstream ofs(tmp_path);
+  if (!ofs)
+    return;
+  ofs << kKbuildCacheMagic << " "
+      << path_mtime(res.kdir.empty() ? res.kpath : res.kdir) << " "
+      << (res.has_kpath_source ? 1 : 0) << "\n"
+      << res.kdir << "\n"
+      << res.kpath << "\n";
+  for (const auto &flag : res.kflags)
+    ofs << flag << "\n";
+  ofs.close();
+  if (!ofs.good() || ::rename(tmp_path.c_str(), path.c_str()) != 0)
+    ::unlink(tmp_path.c_str());
 }
 
 }  // namespace ebpf
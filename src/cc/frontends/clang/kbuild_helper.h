@@ -104,4 +104,24 @@ class KBuildHelper {
 };
 
 int get_proc_kheaders(std::string &dir);
+
+// Resolved kernel header location plus the kbuild flag set derived from it.
+struct KBuildResolution {
+  std::string kdir;
+  std::string kpath;
+  bool has_kpath_source;
+  std::vector<std::string> kflags;
+};
+
+// Cache of kernel header resolution so repeated compiles skip the candidate
+// path probing: an in-process map shared by all BPF::init() calls, plus an
+// opt-in on-disk copy (set BCC_KBUILD_CACHE_DIR to a writable directory)
+// that survives across tool launches. The key should include the uname
+// release and any environment overrides that influence resolution; disk
+// entries are validated against the modules directory mtime and the
+// presence of kconfig.h so a kernel update or removed headers invalidate
+// them.
+bool kbuild_resolution_lookup(const std::string &key, KBuildResolution *res);
+void kbuild_resolution_store(const std::string &key,
+                             const KBuildResolution &res);
 }  // namespace ebpf
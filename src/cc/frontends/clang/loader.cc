@@ -15,11 +15,14 @@
  */
 
 #include <map>
+#include <mutex>
 #include <string>
 #include <algorithm>
 #include <fcntl.h>
+#include <fstream>
 #include <ftw.h>
 #include <map>
+#include <set>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string>
@@ -48,9 +51,15 @@
 #include <clang/FrontendTool/Utils.h>
 #include <clang/Lex/PreprocessorOptions.h>
 
+#include <llvm/ADT/SmallString.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MD5.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/VirtualFileSystem.h>
 
 #include "bcc_exception.h"
+#include "bcc_stats.h"
 #include "bpf_module.h"
 #include "exported_files.h"
 #include "kbuild_helper.h"
@@ -66,53 +75,257 @@ using std::vector;
 
 namespace ebpf {
 
-optional<FuncInfo &> ProgFuncInfo::get_func(std::string name) {
-  auto it = funcs_.find(name);
-  if (it != funcs_.end())
-    return it->second;
-  return nullopt;
+// Linear probing over a power-of-two table; the returned slot either holds
+// the entry for name or is the free slot where it belongs. Callers must
+// ensure slots_ is non-empty.
+size_t ProgFuncInfo::find_slot(const std::string &name, uint32_t hash) const {
+  size_t mask = slots_.size() - 1;
+  size_t i = hash & mask;
+  while (slots_[i].idx != kEmptySlot &&
+         (slots_[i].hash != hash || funcs_[slots_[i].idx]->name_ != name))
+    i = (i + 1) & mask;
+  return i;
+}
+
+void ProgFuncInfo::grow_slots() {
+  size_t cap = slots_.empty() ? 16 : slots_.size() * 2;
+  slots_.assign(cap, {0, kEmptySlot});
+  for (uint32_t idx = 0; idx < funcs_.size(); idx++) {
+    uint32_t hash = Path::fnv1a(funcs_[idx]->name_);
+    slots_[find_slot(funcs_[idx]->name_, hash)] = {hash, idx};
+  }
+}
+
+optional<FuncInfo &> ProgFuncInfo::get_func(const std::string &name) {
+  if (slots_.empty())
+    return nullopt;
+  size_t i = find_slot(name, Path::fnv1a(name));
+  if (slots_[i].idx == kEmptySlot)
+    return nullopt;
+  return *funcs_[slots_[i].idx];
 }
 
 optional<FuncInfo &> ProgFuncInfo::get_func(size_t id) {
-  auto it = func_idx_.find(id);
-  if (it != func_idx_.end())
-    return get_func(it->second);
+  if (id < funcs_.size())
+    return *funcs_[id];
   return nullopt;
 }
 
 optional<std::string &> ProgFuncInfo::func_name(size_t id) {
-  auto it = func_idx_.find(id);
-  if (it != func_idx_.end())
-    return it->second;
+  if (id < funcs_.size())
+    return funcs_[id]->name_;
   return nullopt;
 }
 
+optional<size_t> ProgFuncInfo::func_id(const std::string &name) {
+  if (slots_.empty())
+    return nullopt;
+  size_t i = find_slot(name, Path::fnv1a(name));
+  if (slots_[i].idx == kEmptySlot)
+    return nullopt;
+  return slots_[i].idx;
+}
+
 void ProgFuncInfo::for_each_func(
     std::function<void(std::string, FuncInfo &)> cb) {
-  for (auto it = funcs_.begin(); it != funcs_.end(); ++it) {
-    cb(it->first, it->second);
-  }
+  for (auto &fn : funcs_)
+    cb(fn->name_, *fn);
 }
 
 optional<FuncInfo &> ProgFuncInfo::add_func(std::string name) {
   auto fn = get_func(name);
   if (fn)
     return nullopt;
-  size_t current = funcs_.size();
-  funcs_.emplace(name, 0);
-  func_idx_.emplace(current, name);
-  return get_func(name);
+  // keep load factor below 70%
+  if (slots_.empty() || (funcs_.size() + 1) * 10 >= slots_.size() * 7)
+    grow_slots();
+  uint32_t hash = Path::fnv1a(name);
+  size_t i = find_slot(name, hash);
+  slots_[i] = {hash, static_cast<uint32_t>(funcs_.size())};
+  funcs_.emplace_back(new FuncInfo(0));
+  funcs_.back()->name_ = std::move(name);
+  return *funcs_.back();
+}
+
+// The remapped header/footer buffers are immutable views over the static
+// strings in exported_files.cc. Materialize them once per process and share
+// them across all ClangLoader instances, so that a multi-tool process does
+// not rebuild the include file mappings for every BPF::init() call. This is
+// safe to share between concurrent compiles since clang is instructed to
+// retain (not free) the remapped buffers and only ever reads them.
+static const std::map<string, unique_ptr<llvm::MemoryBuffer>> &
+shared_remapped_files(const std::map<std::string, const char *> &(*files)()) {
+  static std::once_flag once[2];
+  static std::map<string, unique_ptr<llvm::MemoryBuffer>> pools[2];
+  int idx = (files == &ExportedFiles::footers);
+  std::call_once(once[idx], [&]() {
+    for (auto f : files())
+      pools[idx][f.first] = llvm::MemoryBuffer::getMemBuffer(f.second);
+  });
+  return pools[idx];
 }
 
 ClangLoader::ClangLoader(llvm::LLVMContext *ctx, unsigned flags)
-    : ctx_(ctx), flags_(flags)
+    : remapped_headers_(shared_remapped_files(&ExportedFiles::headers)),
+      remapped_footers_(shared_remapped_files(&ExportedFiles::footers)),
+      ctx_(ctx), flags_(flags)
 {
-  for (auto f : ExportedFiles::headers())
-    remapped_headers_[f.first] = llvm::MemoryBuffer::getMemBuffer(f.second);
-  for (auto f : ExportedFiles::footers())
-    remapped_footers_[f.first] = llvm::MemoryBuffer::getMemBuffer(f.second);
 }
 
+// Header include resolution probes every -I directory in order for each
+// #include, so the bulk of the stat/open traffic of a compile is misses on
+// paths that do not exist — and the same misses repeat for every pass and
+// every compile against the same kernel. Cache the negative outcomes
+// process-wide and layer them under clang's FileManager through a proxy
+// VFS; with BCC_KBUILD_CACHE_DIR set they are also persisted per
+// (cc1 argument) key and pre-seeded on later launches. A persisted miss is
+// only trusted while its parent directory's mtime is unchanged, so
+// installing a new header invalidates exactly the entries it could
+// satisfy.
+namespace {
+
+struct HeaderStatCache {
+  std::mutex mutex;
+  std::set<string> missing;     // absolute paths known not to exist
+  std::set<string> loaded_keys; // disk keys already merged this process
+  size_t persisted = 0;         // |missing| at the last disk write
+};
+
+HeaderStatCache &header_stat_cache() {
+  static HeaderStatCache cache;
+  return cache;
+}
+
+class StatCachingFileSystem : public llvm::vfs::ProxyFileSystem {
+ public:
+  StatCachingFileSystem()
+      : llvm::vfs::ProxyFileSystem(llvm::vfs::getRealFileSystem()) {}
+
+  llvm::ErrorOr<llvm::vfs::Status> status(const llvm::Twine &path) override {
+    string abs = absolute(path);
+    auto &cache = header_stat_cache();
+    {
+      std::lock_guard<std::mutex> lock(cache.mutex);
+      if (cache.missing.find(abs) != cache.missing.end())
+        return std::errc::no_such_file_or_directory;
+    }
+    auto ret = llvm::vfs::ProxyFileSystem::status(path);
+    if (!ret &&
+        ret.getError() == std::errc::no_such_file_or_directory) {
+      std::lock_guard<std::mutex> lock(cache.mutex);
+      cache.missing.insert(std::move(abs));
+    }
+    return ret;
+  }
+
+  llvm::ErrorOr<std::unique_ptr<llvm::vfs::File>>
+  openFileForRead(const llvm::Twine &path) override {
+    auto &cache = header_stat_cache();
+    {
+      std::lock_guard<std::mutex> lock(cache.mutex);
+      if (cache.missing.find(absolute(path)) != cache.missing.end())
+        return std::errc::no_such_file_or_directory;
+    }
+    return llvm::vfs::ProxyFileSystem::openFileForRead(path);
+  }
+
+ private:
+  static string absolute(const llvm::Twine &path) {
+    llvm::SmallString<256> abs;
+    path.toVector(abs);
+    llvm::sys::fs::make_absolute(abs);
+    llvm::sys::path::remove_dots(abs, /*remove_dot_dot=*/true);
+    return string(abs.str());
+  }
+};
+
+const char kHdrStatCacheMagic[] = "bcc-hdrstat-cache-v1";
+
+string header_stat_cache_file(const string &key) {
+  const char *dir = ::getenv("BCC_KBUILD_CACHE_DIR");
+  if (!dir || !*dir)
+    return "";
+  return string(dir) + "/hdrstat-" +
+         std::to_string(std::hash<string>{}(key)) + ".paths";
+}
+
+uint64_t parent_dir_mtime(const string &path) {
+  struct stat st;
+  string dir = string(llvm::sys::path::parent_path(path));
+  if (dir.empty() || ::stat(dir.c_str(), &st) != 0)
+    return 0;
+  return (uint64_t)st.st_mtime;
+}
+
+void header_stat_cache_load(const string &key) {
+  auto &cache = header_stat_cache();
+  {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if (!cache.loaded_keys.insert(key).second)
+      return;
+  }
+  string path = header_stat_cache_file(key);
+  if (path.empty())
+    return;
+  std::ifstream ifs(path);
+  if (!ifs)
+    return;
+  string magic;
+  ifs >> magic;
+  if (magic != kHdrStatCacheMagic)
+    return;
+  ifs.ignore();
+  // each line is "<parent dir mtime> <missing path>"; stat each distinct
+  // parent once, so seeding costs a handful of stats instead of the
+  // thousands it saves
+  std::map<string, uint64_t> dir_mtimes;
+  string line;
+  std::set<string> seed;
+  while (std::getline(ifs, line)) {
+    size_t sp = line.find(' ');
+    if (sp == string::npos)
+      return; // truncated write; distrust the rest
+    uint64_t mtime = strtoull(line.substr(0, sp).c_str(), nullptr, 10);
+    string miss = line.substr(sp + 1);
+    string dir = string(llvm::sys::path::parent_path(miss));
+    auto it = dir_mtimes.find(dir);
+    if (it == dir_mtimes.end())
+      it = dir_mtimes.emplace(dir, parent_dir_mtime(miss)).first;
+    if (it->second == mtime)
+      seed.insert(std::move(miss));
+  }
+  std::lock_guard<std::mutex> lock(cache.mutex);
+  cache.missing.insert(seed.begin(), seed.end());
+  cache.persisted = cache.missing.size();
+}
+
+void header_stat_cache_save(const string &key) {
+  auto &cache = header_stat_cache();
+  std::set<string> missing;
+  {
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    if (cache.missing.size() == cache.persisted)
+      return;
+    missing = cache.missing;
+    cache.persisted = missing.size();
+  }
+  string path = header_stat_cache_file(key);
+  if (path.empty())
+    return;
+  string tmp_path = path + ".tmp." + std::to_string(::getpid());
+  std::ofstream ofs(tmp_path);
+  if (!ofs)
+    return;
+  ofs << kHdrStatCacheMagic << "\n";
+  for (const auto &miss : missing)
+    ofs << parent_dir_mtime(miss) << " " << miss << "\n";
+  ofs.close();
+  if (!ofs.good() || ::rename(tmp_path.c_str(), path.c_str()) != 0)
+    ::unlink(tmp_path.c_str());
+}
+
+}  // namespace
+
 ClangLoader::~ClangLoader() {}
 
 void ClangLoader::add_remapped_includes(clang::CompilerInvocation& invocation)
@@ -184,12 +397,148 @@ static int CreateFromArgs(clang::CompilerInvocation &invocation,
 
 }
 
+// Build (or reuse) a precompiled header capturing the forced-include
+// preamble (bcc bpf.h/helpers.h and everything they pull in from the kernel
+// tree). Opt-in via BCC_PCH_DIR since the PCH takes disk space and the very
+// first compile pays for its generation. Returns 0 iff pch_path names a
+// usable PCH for the given cc1 argument vector.
+int ClangLoader::ensure_pch(const llvm::opt::ArgStringList &ccargs,
+                            clang::DiagnosticsEngine &diags,
+                            std::string &pch_path) {
+  using namespace clang;
+
+  const char *pch_dir = ::getenv("BCC_PCH_DIR");
+  if (!pch_dir && ExportedFiles::preamble_pch_size() == 0)
+    return -1;
+
+  struct utsname un;
+  uname(&un);
+
+  // key on kernel release plus the full cc1 argument vector; any flag that
+  // can change the preamble contents (user cflags, arch defines, kernel
+  // config macros) shows up in ccargs
+  llvm::MD5 md5;
+  md5.update(llvm::StringRef(un.release));
+  for (auto arg : ccargs) {
+    md5.update(llvm::StringRef(arg));
+    md5.update(llvm::StringRef("\0", 1));
+  }
+  // the helper layer (bcc's exported bpf.h/helpers.h) is remapped from
+  // buffers baked into this binary, so its content never shows up in
+  // ccargs; key on it too, otherwise a PCH built by an older bcc against
+  // the same kernel and flags would keep serving stale helper macros
+  for (const auto &hdr : ExportedFiles::headers()) {
+    md5.update(llvm::StringRef(hdr.first));
+    md5.update(llvm::StringRef(hdr.second));
+    md5.update(llvm::StringRef("\0", 1));
+  }
+  llvm::MD5::MD5Result result;
+  md5.final(result);
+  llvm::SmallString<32> hex = result.digest();
+
+  // a PCH baked into the library at build time (see exported_files.cc) acts
+  // as a pre-seeded cache entry; when it matches this configuration it also
+  // supplies a default cache directory, so fleets shipping the blob get the
+  // fast path without any environment rollout
+  bool embedded_match = ExportedFiles::preamble_pch_size() > 0 &&
+                        hex.str() == ExportedFiles::preamble_pch_key();
+  if (!pch_dir) {
+    if (!embedded_match)
+      return -1;
+    pch_dir = P_tmpdir;
+  }
+
+  pch_path = string(pch_dir) + "/bcc-preamble-" + hex.c_str() + ".pch";
+
+  // compiles of many programs from one process hit the same PCH over and
+  // over; remember the paths already validated so only the first compile
+  // pays the stat, and concurrent first compiles do not race to generate
+  // the same file
+  static std::mutex pch_cache_mutex;
+  static std::set<std::string> pch_validated;
+  std::lock_guard<std::mutex> cache_guard(pch_cache_mutex);
+  if (pch_validated.find(pch_path) != pch_validated.end())
+    return 0;
+  if (::access(pch_path.c_str(), R_OK) == 0) {
+    pch_validated.insert(pch_path);
+    return 0;
+  }
+
+  string tmp_path = pch_path + ".tmp." + std::to_string(::getpid());
+  if (embedded_match) {
+    // the library ships this exact preamble: materialize the baked blob
+    // instead of re-parsing the headers
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+      ssize_t len = static_cast<ssize_t>(ExportedFiles::preamble_pch_size());
+      ssize_t n = ::write(fd, ExportedFiles::preamble_pch(), len);
+      ::close(fd);
+      if (n == len && ::rename(tmp_path.c_str(), pch_path.c_str()) == 0) {
+        pch_validated.insert(pch_path);
+        return 0;
+      }
+    }
+    ::unlink(tmp_path.c_str());
+    // fall through and generate from source like any other first compile
+  }
+
+  // generate the PCH from an empty main header: the -include preamble flags
+  // are processed before it, so the PCH ends up holding exactly the preamble
+  CompilerInstance compiler;
+  CompilerInvocation &invocation = compiler.getInvocation();
+  if (!CreateFromArgs(invocation, ccargs, diags))
+    return -1;
+
+  add_remapped_includes(invocation);
+
+  string pch_main = "/virtual/pch_main.h";
+  auto empty_buf = llvm::MemoryBuffer::getMemBuffer("");
+  invocation.getPreprocessorOpts().addRemappedFile(pch_main, &*empty_buf);
+  invocation.getFrontendOpts().Inputs.clear();
+  invocation.getFrontendOpts().Inputs.push_back(
+      FrontendInputFile(pch_main,
+                        FrontendOptions::getInputKindForExtension("h")));
+  // write to a private temp file and rename, so concurrent processes never
+  // observe a half-written PCH
+  invocation.getFrontendOpts().OutputFile = tmp_path;
+  invocation.getFrontendOpts().DisableFree = false;
+
+#if LLVM_VERSION_MAJOR >= 20
+  compiler.createDiagnostics(*llvm::vfs::getRealFileSystem(),
+                             new IgnoringDiagConsumer());
+#else
+  compiler.createDiagnostics(new IgnoringDiagConsumer());
+#endif
+
+  GeneratePCHAction pch_act;
+  if (!compiler.ExecuteAction(pch_act) ||
+      ::rename(tmp_path.c_str(), pch_path.c_str()) != 0) {
+    ::unlink(tmp_path.c_str());
+    return -1;
+  }
+  pch_validated.insert(pch_path);
+  return 0;
+}
+
+void ClangLoader::use_pch(clang::CompilerInvocation &invocation,
+                          const std::string &pch_path) {
+  // the preamble headers live in the PCH; drop the -include flags so the
+  // frontend does not parse them a second time
+  invocation.getPreprocessorOpts().Includes.clear();
+  invocation.getPreprocessorOpts().ImplicitPCHInclude = pch_path;
+}
+
 int ClangLoader::parse(
     unique_ptr<llvm::Module> *mod, TableStorage &ts, const string &file,
     bool in_memory, const char *cflags[], int ncflags, const std::string &id,
     ProgFuncInfo &prog_func_info, std::string &mod_src,
     const std::string &maps_ns, fake_fd_map_def &fake_fd_map,
-    std::map<std::string, std::vector<std::string>> &perf_events) {
+    std::map<std::string, std::vector<std::string>> &perf_events,
+    field_accesses_def &field_accesses) {
+  struct CompileTimer {
+    uint64_t t0 = bcc_stats_now_ns();
+    ~CompileTimer() { bcc_stats_record_compile_ns(bcc_stats_now_ns() - t0); }
+  } timer;
   string main_path = "/virtual/main.c";
   unique_ptr<llvm::MemoryBuffer> main_buf;
   struct utsname un;
@@ -201,28 +550,55 @@ int ClangLoader::parse(
   string vmacro;
   std::string tmpdir;
 
-  if (kpath_env) {
-    kpath = string(kpath_env);
+  // Header resolution and the kbuild flag set are cached (in-process for
+  // repeated BPF::init() calls, on disk across launches when
+  // BCC_KBUILD_CACHE_DIR is set) keyed by the release and the environment
+  // overrides that influence them.
+  const char *arch_env = ::getenv("ARCH");
+  const char *suffix_env = ::getenv("BCC_KERNEL_MODULES_SUFFIX");
+  string kbuild_key = string(un.release) + "|" +
+                      (kpath_env ? kpath_env : "") + "|" +
+                      (arch_env ? arch_env : "") + "|" +
+                      (suffix_env ? suffix_env : "");
+  KBuildResolution resolution;
+  if (kbuild_resolution_lookup(kbuild_key, &resolution)) {
+    kdir = resolution.kdir;
+    kpath = resolution.kpath;
+    has_kpath_source = resolution.has_kpath_source;
   } else {
-    kdir = string(KERNEL_MODULES_DIR) + "/" + un.release;
-    auto kernel_path_info = get_kernel_path_info(kdir);
-    has_kpath_source = kernel_path_info.first;
-    kpath = kdir + "/" + kernel_path_info.second;
-  }
-
-  // If all attempts to obtain kheaders fail, check for kheaders.tar.xz in sysfs
-  // Checking just for kpath existence is unsufficient, since it can refer to
-  // leftover build directory without headers present anymore.
-  // See https://github.com/iovisor/bcc/pull/3588 for more details.
-  if (!is_file(kpath + "/include/linux/kconfig.h")) {
-    int ret = get_proc_kheaders(tmpdir);
-    if (!ret) {
-      kpath = tmpdir;
+    if (kpath_env) {
+      kpath = string(kpath_env);
     } else {
-      std::cout << "Unable to find kernel headers. ";
-      std::cout << "Try rebuilding kernel with CONFIG_IKHEADERS=m (module) ";
-      std::cout <<  "or installing the kernel development package for your running kernel version.\n";
+      kdir = string(KERNEL_MODULES_DIR) + "/" + un.release;
+      auto kernel_path_info = get_kernel_path_info(kdir);
+      has_kpath_source = kernel_path_info.first;
+      kpath = kdir + "/" + kernel_path_info.second;
+    }
+
+    // If all attempts to obtain kheaders fail, check for kheaders.tar.xz in sysfs
+    // Checking just for kpath existence is unsufficient, since it can refer to
+    // leftover build directory without headers present anymore.
+    // See https://github.com/iovisor/bcc/pull/3588 for more details.
+    if (!is_file(kpath + "/include/linux/kconfig.h")) {
+      int ret = get_proc_kheaders(tmpdir);
+      if (!ret) {
+        kpath = tmpdir;
+      } else {
+        std::cout << "Unable to find kernel headers. ";
+        std::cout << "Try rebuilding kernel with CONFIG_IKHEADERS=m (module) ";
+        std::cout <<  "or installing the kernel development package for your running kernel version.\n";
+      }
     }
+
+    resolution.kdir = kdir;
+    resolution.kpath = kpath;
+    resolution.has_kpath_source = has_kpath_source;
+    KBuildHelper kbuild_helper(kpath_env ? kpath : kdir, has_kpath_source);
+    if (kbuild_helper.get_flags(un.machine, &resolution.kflags))
+      return -1;
+    // only a resolution that actually found headers is worth reusing
+    if (is_file(kpath + "/include/linux/kconfig.h"))
+      kbuild_resolution_store(kbuild_key, resolution);
   }
 
   if (flags_ & DEBUG_PREPROCESSOR)
@@ -277,11 +653,7 @@ int ClangLoader::parse(
     flags_cstr.push_back("-D_MIPS_SZLONG=64");
   }
 
-  KBuildHelper kbuild_helper(kpath_env ? kpath : kdir, has_kpath_source);
-
-  vector<string> kflags;
-  if (kbuild_helper.get_flags(un.machine, &kflags))
-    return -1;
+  vector<string> &kflags = resolution.kflags;
 
   flags_cstr.push_back("-g");
   flags_cstr.push_back("-gdwarf-4");
@@ -314,7 +686,7 @@ int ClangLoader::parse(
 
   if (do_compile(mod, ts, in_memory, flags_cstr, flags_cstr_rem, main_path,
                  main_buf, id, prog_func_info, mod_src, true, maps_ns,
-                 fake_fd_map, perf_events)) {
+                 fake_fd_map, perf_events, field_accesses)) {
 #if BCC_BACKUP_COMPILE != 1
     return -1;
 #else
@@ -325,9 +697,10 @@ int ClangLoader::parse(
     prog_func_info.clear();
     mod_src.clear();
     fake_fd_map.clear();
+    field_accesses.clear();
     if (do_compile(mod, ts, in_memory, flags_cstr, flags_cstr_rem, main_path,
                    main_buf, id, prog_func_info, mod_src, false, maps_ns,
-                   fake_fd_map, perf_events))
+                   fake_fd_map, perf_events, field_accesses))
       return -1;
 #endif
   }
@@ -382,7 +755,8 @@ int ClangLoader::do_compile(
     const unique_ptr<llvm::MemoryBuffer> &main_buf, const std::string &id,
     ProgFuncInfo &prog_func_info, std::string &mod_src, bool use_internal_bpfh,
     const std::string &maps_ns, fake_fd_map_def &fake_fd_map,
-    std::map<std::string, std::vector<std::string>> &perf_events) {
+    std::map<std::string, std::vector<std::string>> &perf_events,
+    field_accesses_def &field_accesses) {
   using namespace clang;
 
   vector<const char *> flags_cstr = flags_cstr_in;
@@ -443,13 +817,33 @@ int ClangLoader::do_compile(
     llvm::errs() << "\n";
   }
 
+  // With BCC_PCH_DIR set, all three frontend passes below reuse a
+  // precompiled preamble and only parse the program text itself.
+  string pch_path;
+  bool have_pch = ensure_pch(ccargs, diags, pch_path) == 0;
+
+  // all three passes resolve includes through the shared negative-stat
+  // cache; the cc1 arguments embed the kernel dirs and user cflags, so
+  // they are the key for the persisted copy
+  string hdrstat_key;
+  for (auto arg : ccargs) {
+    hdrstat_key += arg;
+    hdrstat_key += '\1';
+  }
+  header_stat_cache_load(hdrstat_key);
+  IntrusiveRefCntPtr<llvm::vfs::FileSystem> stat_fs(
+      new StatCachingFileSystem());
+
   // pre-compilation pass for generating tracepoint structures
   CompilerInstance compiler0;
   CompilerInvocation &invocation0 = compiler0.getInvocation();
   if (!CreateFromArgs(invocation0, ccargs, diags))
     return -1;
 
+  compiler0.createFileManager(stat_fs);
   add_remapped_includes(invocation0);
+  if (have_pch)
+    use_pch(invocation0, pch_path);
 
   if (in_memory) {
     add_main_input(invocation0, main_path, &*main_buf);
@@ -475,7 +869,10 @@ int ClangLoader::do_compile(
   if (!CreateFromArgs( invocation1, ccargs, diags))
     return -1;
 
+  compiler1.createFileManager(stat_fs);
   add_remapped_includes(invocation1);
+  if (have_pch)
+    use_pch(invocation1, pch_path);
   add_main_input(invocation1, main_path, &*out_buf);
   invocation1.getFrontendOpts().DisableFree = false;
 
@@ -489,7 +886,7 @@ int ClangLoader::do_compile(
   string out_str1;
   llvm::raw_string_ostream os1(out_str1);
   BFrontendAction bact(os1, flags_, ts, id, main_path, prog_func_info, mod_src,
-                       maps_ns, fake_fd_map, perf_events);
+                       maps_ns, fake_fd_map, perf_events, field_accesses);
   if (!compiler1.ExecuteAction(bact))
     return -1;
   unique_ptr<llvm::MemoryBuffer> out_buf1 = llvm::MemoryBuffer::getMemBuffer(out_str1);
@@ -500,7 +897,10 @@ int ClangLoader::do_compile(
   if (!CreateFromArgs(invocation2, ccargs, diags))
     return -1;
 
+  compiler2.createFileManager(stat_fs);
   add_remapped_includes(invocation2);
+  if (have_pch)
+    use_pch(invocation2, pch_path);
   add_main_input(invocation2, main_path, &*out_buf1);
   invocation2.getFrontendOpts().DisableFree = false;
   invocation2.getCodeGenOpts().DisableFree = false;
@@ -520,6 +920,9 @@ int ClangLoader::do_compile(
     return -1;
   *mod = ir_act.takeModule();
 
+  // persist any fresh misses for the next launch
+  header_stat_cache_save(hdrstat_key);
+
   return 0;
 }
 }  // namespace ebpf
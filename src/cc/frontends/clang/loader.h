@@ -17,11 +17,13 @@
 #pragma once
 
 #include <clang/Frontend/CompilerInvocation.h>
+#include <llvm/Option/Option.h>
 
 #include <functional>
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "table_storage.h"
 #include "vendor/optional.hpp"
@@ -40,6 +42,7 @@ namespace ebpf {
 struct FuncInfo {
   uint8_t *start_ = nullptr;
   size_t size_ = 0;
+  std::string name_;
   std::string section_;
   std::string src_;
   std::string src_rewritten_;
@@ -47,23 +50,40 @@ struct FuncInfo {
   FuncInfo(int i) {}
 };
 
+// Per-module function registry. Function-dense modules look these entries up
+// once per attach, so the name index is a flat open-addressing table storing
+// precomputed hashes: lookups probe linearly, compare integers and fall back
+// to one string compare only on a hash match. Ids are assigned in add_func()
+// order and resolve with a plain vector index, making the id-based accessors
+// O(1) and allocation-free.
 class ProgFuncInfo {
  public:
   ProgFuncInfo() {}
   void clear() {
     funcs_.clear();
-    func_idx_.clear();
+    slots_.clear();
   }
-  optional<FuncInfo &> get_func(std::string name);
+  optional<FuncInfo &> get_func(const std::string &name);
   optional<FuncInfo &> get_func(size_t id);
   optional<std::string &> func_name(size_t id);
+  // id of a registered function, stable for the module's lifetime
+  optional<size_t> func_id(const std::string &name);
   optional<FuncInfo &> add_func(std::string name);
   size_t num_funcs() { return funcs_.size(); }
   void for_each_func(std::function<void(std::string, FuncInfo &)> cb);
 
  private:
-  std::map<std::string, FuncInfo> funcs_;
-  std::map<uint32_t, std::string> func_idx_;
+  struct Slot {
+    uint32_t hash;
+    uint32_t idx;  // kEmptySlot when free
+  };
+  static const uint32_t kEmptySlot = 0xffffffffu;
+  size_t find_slot(const std::string &name, uint32_t hash) const;
+  void grow_slots();
+  // entries are heap-allocated so references handed out by add_func() and
+  // get_func() stay valid while later functions are registered
+  std::vector<std::unique_ptr<FuncInfo>> funcs_;
+  std::vector<Slot> slots_;
 };
 
 class ClangLoader {
@@ -75,7 +95,8 @@ class ClangLoader {
             int ncflags, const std::string &id, ProgFuncInfo &prog_func_info,
             std::string &mod_src, const std::string &maps_ns,
             fake_fd_map_def &fake_fd_map,
-            std::map<std::string, std::vector<std::string>> &perf_events);
+            std::map<std::string, std::vector<std::string>> &perf_events,
+            field_accesses_def &field_accesses);
 
  private:
   int do_compile(std::unique_ptr<llvm::Module> *mod, TableStorage &ts,
@@ -86,15 +107,21 @@ class ClangLoader {
                  const std::string &id, ProgFuncInfo &prog_func_info,
                  std::string &mod_src, bool use_internal_bpfh,
                  const std::string &maps_ns, fake_fd_map_def &fake_fd_map,
-                 std::map<std::string, std::vector<std::string>> &perf_events);
+                 std::map<std::string, std::vector<std::string>> &perf_events,
+                 field_accesses_def &field_accesses);
   void add_remapped_includes(clang::CompilerInvocation& invocation);
   void add_main_input(clang::CompilerInvocation& invocation,
                       const std::string& main_path,
                       llvm::MemoryBuffer *main_buf);
+  int ensure_pch(const llvm::opt::ArgStringList &ccargs,
+                 clang::DiagnosticsEngine &diags, std::string &pch_path);
+  void use_pch(clang::CompilerInvocation &invocation,
+               const std::string &pch_path);
 
  private:
-  std::map<std::string, std::unique_ptr<llvm::MemoryBuffer>> remapped_headers_;
-  std::map<std::string, std::unique_ptr<llvm::MemoryBuffer>> remapped_footers_;
+  // process-wide pool of remapped file buffers, shared by all loaders
+  const std::map<std::string, std::unique_ptr<llvm::MemoryBuffer>> &remapped_headers_;
+  const std::map<std::string, std::unique_ptr<llvm::MemoryBuffer>> &remapped_footers_;
   llvm::LLVMContext *ctx_;
   unsigned flags_;
 };
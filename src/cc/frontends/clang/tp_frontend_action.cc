@@ -15,10 +15,13 @@
  */
 #include <linux/bpf.h>
 #include <linux/version.h>
+#include <sys/stat.h>
 #include <sys/utsname.h>
 #include <unistd.h>
 
+#include <cstdio>
 #include <fstream>
+#include <mutex>
 #include <regex>
 
 #include <clang/AST/ASTConsumer.h>
@@ -51,14 +54,120 @@ TracepointTypeVisitor::TracepointTypeVisitor(ASTContext &C, Rewriter &rewriter)
     : diag_(C.getDiagnostics()), rewriter_(rewriter), out_(llvm::errs()) {
 }
 
+// Generated tracepoint structs are cached so that programs referencing many
+// tracepoints do not re-read and re-parse the same tracefs format files:
+// in-process across compilations, and optionally on disk across restarts
+// when BCC_TRACEPOINT_CACHE_DIR names a writable directory. Disk entries
+// are validated against the kernel release and the format file's mtime.
+static const char kTpCacheMagic[] = "bcc-tracepoint-cache-v1";
+
+static std::mutex tp_struct_cache_mutex;
+static map<string, string> tp_struct_cache;
+
+static string tp_kernel_release() {
+  struct utsname un;
+  if (uname(&un) < 0)
+    return "";
+  return un.release;
+}
+
+static string tp_cache_file(string const& category, string const& event) {
+  const char *dir = ::getenv("BCC_TRACEPOINT_CACHE_DIR");
+  if (!dir || !*dir)
+    return "";
+  return string(dir) + "/tp-" + category + "__" + event + ".txt";
+}
+
+static bool tp_format_mtime(string const& path, long long &mtime) {
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0)
+    return false;
+  mtime = (long long)st.st_mtime;
+  return true;
+}
+
+static bool tp_disk_cache_lookup(string const& format_file,
+                                 string const& category, string const& event,
+                                 string &tp_struct) {
+  string path = tp_cache_file(category, event);
+  if (path.empty())
+    return false;
+
+  long long mtime;
+  if (!tp_format_mtime(format_file, mtime))
+    return false;
+
+  ifstream input(path.c_str());
+  if (!input)
+    return false;
+
+  string magic, release, mtime_line;
+  if (!getline(input, magic) || magic != kTpCacheMagic)
+    return false;
+  if (!getline(input, release) || release != tp_kernel_release())
+    return false;
+  if (!getline(input, mtime_line) || mtime_line != to_string(mtime))
+    return false;
+
+  string body, line;
+  while (getline(input, line))
+    body += line + "\n";
+  if (body.empty())
+    return false;
+
+  tp_struct = body;
+  return true;
+}
+
+static void tp_disk_cache_store(string const& format_file,
+                                string const& category, string const& event,
+                                string const& tp_struct) {
+  string path = tp_cache_file(category, event);
+  if (path.empty())
+    return;
+
+  long long mtime;
+  if (!tp_format_mtime(format_file, mtime))
+    return;
+
+  // write to a temporary and rename into place so concurrent readers only
+  // ever see complete entries
+  string tmp_path = path + ".tmp." + to_string(getpid());
+  std::ofstream output(tmp_path.c_str(), std::ios::trunc);
+  if (!output)
+    return;
+  output << kTpCacheMagic << "\n"
+         << tp_kernel_release() << "\n"
+         << mtime << "\n"
+         << tp_struct;
+  output.close();
+  if (!output || ::rename(tmp_path.c_str(), path.c_str()) < 0)
+    ::unlink(tmp_path.c_str());
+}
+
 string TracepointTypeVisitor::GenerateTracepointStruct(
     SourceLocation loc, string const& category, string const& event) {
+  string key = category + ":" + event;
+  {
+    std::lock_guard<std::mutex> lock(tp_struct_cache_mutex);
+    auto it = tp_struct_cache.find(key);
+    if (it != tp_struct_cache.end())
+      return it->second;
+  }
+
   string format_file = tracepoint_format_file(category, event);
-  ifstream input(format_file.c_str());
-  if (!input)
-    return "";
+  string tp_struct;
+  if (!tp_disk_cache_lookup(format_file, category, event, tp_struct)) {
+    ifstream input(format_file.c_str());
+    if (!input)
+      return "";
+    tp_struct = ebpf::parse_tracepoint(input, category, event);
+    tp_disk_cache_store(format_file, category, event, tp_struct);
+  }
 
-  return ebpf::parse_tracepoint(input, category, event);
+  std::lock_guard<std::mutex> lock(tp_struct_cache_mutex);
+  tp_struct_cache[key] = tp_struct;
+  return tp_struct;
 }
 
 static inline bool _is_tracepoint_struct_type(string const& type_name,
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <cstdlib>
 #include <memory>
 #include <string>
 
@@ -186,6 +187,12 @@ class JsonMapTypesVisitor : public virtual MapTypesVisitor {
  public:
   virtual void Visit(TableDesc &desc, clang::ASTContext &C, clang::QualType key_type,
                      clang::QualType leaf_type) {
+    // Walking every map's key/leaf types into JSON is pure compile-time
+    // overhead for consumers that resolve layout from the module's BTF
+    // (TableDesc::btf_key_tid/btf_value_tid); BCC_NO_JSON_TYPES lets them
+    // opt out, leaving key_desc/leaf_desc empty.
+    if (::getenv("BCC_NO_JSON_TYPES"))
+      return;
     BMapDeclVisitor v1(C, desc.key_desc), v2(C, desc.leaf_desc);
     v1.TraverseType(key_type);
     v2.TraverseType(leaf_type);
@@ -38,7 +38,9 @@
 #include <linux/version.h>
 #include <net/ethernet.h>
 #include <net/if.h>
+#include <pthread.h>
 #include <sched.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -48,6 +50,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/vfs.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "bcc_zip.h"
@@ -650,6 +653,44 @@ int bpf_prog_get_tag(int fd, unsigned long long *ptag)
   return -2;
 }
 
+// Per-process verifier log arena. Loads that need a verifier log and have
+// no caller-provided buffer borrow this one; it grows exponentially on
+// ENOSPC and is kept for the next load, so a startup sequence loading many
+// programs does not cycle multi-megabyte buffers through malloc/free.
+static pthread_mutex_t log_arena_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *log_arena = NULL;
+static unsigned log_arena_size = 0;
+
+// Returns the arena grown to at least min_size with log_arena_mutex held;
+// release with log_arena_release(). Returns NULL (mutex released) on OOM.
+// Grows the arena to at least min_size; log_arena_mutex must be held.
+static char *log_arena_reserve(unsigned min_size)
+{
+  if (log_arena_size < min_size) {
+    // Contents never survive across loads, so no need to realloc-copy.
+    free(log_arena);
+    log_arena = malloc(min_size);
+    log_arena_size = log_arena ? min_size : 0;
+  }
+  return log_arena;
+}
+
+static char *log_arena_acquire(unsigned min_size)
+{
+  char *buf;
+
+  pthread_mutex_lock(&log_arena_mutex);
+  buf = log_arena_reserve(min_size);
+  if (!buf)
+    pthread_mutex_unlock(&log_arena_mutex);
+  return buf;
+}
+
+static void log_arena_release(void)
+{
+  pthread_mutex_unlock(&log_arena_mutex);
+}
+
 static int libbpf_bpf_prog_load(enum bpf_prog_type prog_type,
                                 const char *prog_name, const char *license,
                                 const struct bpf_insn *insns, size_t insn_cnt,
@@ -696,10 +737,199 @@ static int libbpf_bpf_prog_load(enum bpf_prog_type prog_type,
                        insns, insn_cnt, &p);
 }
 
+// Process-wide cache of parsed kernel BTF. Parsing /sys/kernel/btf/vmlinux
+// costs a multi-MB read plus a type graph of comparable size, and every
+// consumer used to do it independently, so a process loading many BPF
+// objects paid both repeatedly. The cache loads each BTF lazily once and
+// hands out refcounted pointers to the shared immutable graph; it keeps one
+// reference of its own so the graph survives between users, and
+// bcc_kernel_btf_flush() drops that reference when a memory-sensitive
+// caller wants it reclaimed once the last user puts theirs. Module BTFs are
+// split BTFs on top of vmlinux, so each cached module entry pins the
+// vmlinux graph for its own lifetime.
+static pthread_mutex_t kernel_btf_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct btf *vmlinux_btf_cache;
+static int vmlinux_btf_refcnt;     // includes the cache's own reference
+static bool vmlinux_btf_pinned;    // cache's reference not yet flushed
+
+struct module_btf_entry {
+  struct module_btf_entry *next;
+  struct btf *btf;
+  int refcnt;
+  bool pinned;
+  char name[64];
+};
+static struct module_btf_entry *module_btf_cache;
+
+// kernel_btf_mutex must be held; returns with an extra reference taken.
+static struct btf *vmlinux_btf_get_locked(void)
+{
+  struct btf *btf;
+
+  if (!vmlinux_btf_cache) {
+    btf = btf__load_vmlinux_btf();
+    if (libbpf_get_error(btf))
+      return NULL;
+    vmlinux_btf_cache = btf;
+    vmlinux_btf_refcnt = 1;
+    vmlinux_btf_pinned = true;
+  }
+  vmlinux_btf_refcnt++;
+  return vmlinux_btf_cache;
+}
+
+// kernel_btf_mutex must be held; returns a graph to free outside the lock,
+// or NULL if the shared graph stays alive.
+static struct btf *vmlinux_btf_put_locked(void)
+{
+  if (--vmlinux_btf_refcnt > 0)
+    return NULL;
+  struct btf *dead = vmlinux_btf_cache;
+  vmlinux_btf_cache = NULL;
+  return dead;
+}
+
+struct btf *bcc_vmlinux_btf_get(void)
+{
+  struct btf *btf;
+
+  pthread_mutex_lock(&kernel_btf_mutex);
+  btf = vmlinux_btf_get_locked();
+  pthread_mutex_unlock(&kernel_btf_mutex);
+  return btf;
+}
+
+void bcc_vmlinux_btf_put(struct btf *btf)
+{
+  struct btf *dead = NULL;
+
+  if (!btf)
+    return;
+  pthread_mutex_lock(&kernel_btf_mutex);
+  if (btf == vmlinux_btf_cache)
+    dead = vmlinux_btf_put_locked();
+  else
+    dead = btf;  // not ours: a pre-cache graph the caller parsed itself
+  pthread_mutex_unlock(&kernel_btf_mutex);
+  if (dead)
+    btf__free(dead);
+}
+
+struct btf *bcc_module_btf_get(const char *module_name)
+{
+  struct module_btf_entry *e;
+  struct btf *vmlinux, *btf = NULL, *dead_vmlinux = NULL;
+
+  if (strlen(module_name) >= sizeof(e->name))
+    return NULL;
+
+  pthread_mutex_lock(&kernel_btf_mutex);
+  for (e = module_btf_cache; e; e = e->next) {
+    if (!strcmp(e->name, module_name)) {
+      e->refcnt++;
+      btf = e->btf;
+      goto out;
+    }
+  }
+
+  vmlinux = vmlinux_btf_get_locked();
+  if (!vmlinux)
+    goto out;
+  btf = btf__load_module_btf(module_name, vmlinux);
+  if (libbpf_get_error(btf))
+    btf = NULL;
+  else
+    e = calloc(1, sizeof(*e));
+  if (btf && !e) {
+    btf__free(btf);
+    btf = NULL;
+  }
+  if (!btf) {
+    dead_vmlinux = vmlinux_btf_put_locked();
+    goto out;
+  }
+  strcpy(e->name, module_name);
+  e->btf = btf;
+  e->refcnt = 2;  // the cache's reference plus the caller's
+  e->pinned = true;
+  e->next = module_btf_cache;
+  module_btf_cache = e;
+
+out:
+  pthread_mutex_unlock(&kernel_btf_mutex);
+  if (dead_vmlinux)
+    btf__free(dead_vmlinux);
+  return btf;
+}
+
+void bcc_module_btf_put(struct btf *btf)
+{
+  struct module_btf_entry **ep, *e = NULL;
+  struct btf *dead_vmlinux = NULL;
+
+  if (!btf)
+    return;
+  pthread_mutex_lock(&kernel_btf_mutex);
+  for (ep = &module_btf_cache; *ep; ep = &(*ep)->next) {
+    if ((*ep)->btf == btf) {
+      e = *ep;
+      break;
+    }
+  }
+  if (e && --e->refcnt == 0) {
+    *ep = e->next;
+    dead_vmlinux = vmlinux_btf_put_locked();  // drop the entry's vmlinux pin
+  } else {
+    e = NULL;
+  }
+  pthread_mutex_unlock(&kernel_btf_mutex);
+  if (e) {
+    btf__free(e->btf);
+    free(e);
+  }
+  if (dead_vmlinux)
+    btf__free(dead_vmlinux);
+}
+
+void bcc_kernel_btf_flush(void)
+{
+  struct module_btf_entry **ep = &module_btf_cache, *e;
+  struct module_btf_entry *dead_modules = NULL;
+  struct btf *dead_vmlinux = NULL;
+
+  pthread_mutex_lock(&kernel_btf_mutex);
+  while ((e = *ep) != NULL) {
+    if (e->pinned && --e->refcnt == 0) {
+      *ep = e->next;
+      e->next = dead_modules;
+      dead_modules = e;
+      struct btf *d = vmlinux_btf_put_locked();  // drop the entry's pin
+      if (d)
+        dead_vmlinux = d;
+    } else {
+      e->pinned = false;
+      ep = &e->next;
+    }
+  }
+  if (vmlinux_btf_cache && vmlinux_btf_pinned) {
+    vmlinux_btf_pinned = false;
+    dead_vmlinux = vmlinux_btf_put_locked();
+  }
+  pthread_mutex_unlock(&kernel_btf_mutex);
+  while (dead_modules) {
+    e = dead_modules;
+    dead_modules = e->next;
+    btf__free(e->btf);
+    free(e);
+  }
+  if (dead_vmlinux)
+    btf__free(dead_vmlinux);
+}
+
 static int find_btf_id(const char *module_name, const char *func_name,
                        enum bpf_attach_type expected_attach_type, int *btf_fd)
 {
-  struct btf *vmlinux_btf = NULL, *module_btf = NULL;
+  struct btf *module_btf = NULL;
   struct bpf_btf_info info;
   int err, fd, btf_id;
   __u32 id = 0, len;
@@ -738,17 +968,10 @@ static int find_btf_id(const char *module_name, const char *func_name,
       continue;
     }
 
-    vmlinux_btf = btf__load_vmlinux_btf();
-    err = libbpf_get_error(vmlinux_btf);
-    if (err) {
-      fprintf(stderr, "btf__load_vmlinux_btf failed: %d\n", err);
-      goto err_out;
-    }
-
-    module_btf = btf__load_module_btf(module_name, vmlinux_btf);
-    err = libbpf_get_error(vmlinux_btf);
-    if (err) {
-      fprintf(stderr, "btf__load_module_btf failed: %d\n", err);
+    module_btf = bcc_module_btf_get(module_name);
+    if (!module_btf) {
+      err = -ENOENT;
+      fprintf(stderr, "bcc_module_btf_get failed for %s\n", module_name);
       goto err_out;
     }
 
@@ -759,15 +982,13 @@ static int find_btf_id(const char *module_name, const char *func_name,
       goto err_out;
     }
 
-    btf__free(module_btf);
-    btf__free(vmlinux_btf);
+    bcc_module_btf_put(module_btf);
 
     *btf_fd = fd;
     return btf_id;
 
 err_out:
-    btf__free(module_btf);
-    btf__free(vmlinux_btf);
+    bcc_module_btf_put(module_btf);
     close(fd);
     *btf_fd = -1;
     return err;
@@ -784,6 +1005,7 @@ int bcc_prog_load_xattr(enum bpf_prog_type prog_type, const char *prog_name,
   unsigned name_len = prog_name ? strlen(prog_name) : 0;
   char *tmp_log_buf = NULL, *opts_log_buf = NULL;
   unsigned tmp_log_buf_size = 0, opts_log_buf_size = 0;
+  bool arena_held = false;
   int ret = 0, name_offset = 0, expected_attach_type = 0;
   char new_prog_name[BPF_OBJ_NAME_LEN] = {};
   char mod_name[64] = {};
@@ -800,14 +1022,15 @@ int bcc_prog_load_xattr(enum bpf_prog_type prog_type, const char *prog_name,
       opts_log_buf = log_buf;
       opts_log_buf_size = log_buf_size;
     } else {
-      // Create and use temporary log buffer if user didn't provide one.
-      tmp_log_buf_size = LOG_BUF_SIZE;
-      tmp_log_buf = malloc(tmp_log_buf_size);
+      // Borrow the persistent log arena if user didn't provide a buffer.
+      tmp_log_buf = log_arena_acquire(LOG_BUF_SIZE);
       if (!tmp_log_buf) {
         fprintf(stderr, "bpf: Failed to allocate temporary log buffer: %s\n\n",
                 strerror(errno));
         opts->log_level = 0;
       } else {
+        arena_held = true;
+        tmp_log_buf_size = log_arena_size;
         tmp_log_buf[0] = 0;
         opts_log_buf = tmp_log_buf;
         opts_log_buf_size = tmp_log_buf_size;
@@ -855,11 +1078,11 @@ int bcc_prog_load_xattr(enum bpf_prog_type prog_type, const char *prog_name,
                         expected_attach_type, &fd);
       if (ret == -EINVAL) {
         fprintf(stderr, "bpf: %s BTF is not found\n", mod_name);
-        return ret;
+        goto return_result;
       } else if (ret < 0) {
         fprintf(stderr, "bpf: %s is not found in %s BTF\n",
                 prog_name + name_offset, mod_name);
-        return ret;
+        goto return_result;
       }
 
       opts->attach_btf_obj_fd = fd == -1 ? 0 : fd;
@@ -894,7 +1117,7 @@ int bcc_prog_load_xattr(enum bpf_prog_type prog_type, const char *prog_name,
 
   if (ret < 0 && errno == EPERM) {
     if (!allow_rlimit)
-      return ret;
+      goto return_result;
 
     // When EPERM is returned, two reasons are possible:
     //  1. user has no permissions for bpf()
@@ -916,7 +1139,8 @@ int bcc_prog_load_xattr(enum bpf_prog_type prog_type, const char *prog_name,
     fprintf(stderr,
             "bpf: %s. Program %s too large (%u insns), at most %d insns\n\n",
             strerror(errno), new_prog_name, insns_cnt, BPF_MAXINSNS);
-    return -1;
+    ret = -1;
+    goto return_result;
   }
 
   // The load has failed. Handle log message.
@@ -935,26 +1159,35 @@ int bcc_prog_load_xattr(enum bpf_prog_type prog_type, const char *prog_name,
       goto return_result;
     }
 
-    // User did not provide log buffer. We will try to increase size of
-    // our temporary log buffer to get full error message.
-    if (tmp_log_buf)
-      free(tmp_log_buf);
+    // User did not provide log buffer. Retry with the persistent arena,
+    // doubling it until the full error message fits; the arena keeps its
+    // largest size for later loads.
     tmp_log_buf_size = LOG_BUF_SIZE;
     if (opts->log_level == 0)
       opts->log_level = 1;
     for (;;) {
-      tmp_log_buf = malloc(tmp_log_buf_size);
+      if (arena_held)
+        tmp_log_buf = log_arena_reserve(tmp_log_buf_size);
+      else {
+        tmp_log_buf = log_arena_acquire(tmp_log_buf_size);
+        arena_held = tmp_log_buf != NULL;
+      }
       if (!tmp_log_buf) {
+        // log_arena_reserve() keeps the mutex held on failure.
+        if (arena_held) {
+          log_arena_release();
+          arena_held = false;
+        }
         fprintf(stderr, "bpf: Failed to allocate temporary log buffer: %s\n\n",
                 strerror(errno));
         goto return_result;
       }
+      if (tmp_log_buf_size < log_arena_size)
+        tmp_log_buf_size = log_arena_size;
       tmp_log_buf[0] = 0;
       ret = libbpf_bpf_prog_load(prog_type, new_prog_name, license, insns, insns_cnt, opts, tmp_log_buf, tmp_log_buf_size);
       if (ret < 0 && errno == ENOSPC) {
-        // Temporary buffer size is not enough. Double it and try again.
-        free(tmp_log_buf);
-        tmp_log_buf = NULL;
+        // Arena size is not enough. Double it and try again.
         tmp_log_buf_size <<= 1;
       } else {
         break;
@@ -976,8 +1209,8 @@ int bcc_prog_load_xattr(enum bpf_prog_type prog_type, const char *prog_name,
 return_result:
   if (fd >= 0)
     close(fd);
-  if (tmp_log_buf)
-    free(tmp_log_buf);
+  if (arena_held)
+    log_arena_release();
   return ret;
 }
 
@@ -1080,6 +1313,52 @@ static int bpf_get_retprobe_bit(const char *event_type)
   return errno ? -1 : ret;
 }
 
+/* The perf_kprobe/perf_uprobe PMU type ids and their retprobe format bit are
+ * fixed for a boot, but were re-read from sysfs (two open/read/close round
+ * trips) on every attach. Cache them per event_type for the process
+ * lifetime, so the hot attach path is a single perf_event_open. */
+struct probe_pmu_info {
+  char event_type[16];
+  int type;
+  int retprobe_bit;
+};
+
+static int bpf_probe_pmu_info(const char *event_type,
+                              struct probe_pmu_info *out)
+{
+  static struct probe_pmu_info cache[4];
+  static int cache_used;
+  static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+  int i, ret = -1;
+
+  pthread_mutex_lock(&cache_mutex);
+  for (i = 0; i < cache_used; i++)
+    if (strcmp(cache[i].event_type, event_type) == 0)
+      goto found;
+
+  if (cache_used >= sizeof(cache) / sizeof(cache[0]) ||
+      strlen(event_type) >= sizeof(cache[0].event_type)) {
+    /* no slot; fall back to an uncached read */
+    pthread_mutex_unlock(&cache_mutex);
+    out->type = bpf_find_probe_type(event_type);
+    out->retprobe_bit = bpf_get_retprobe_bit(event_type);
+    return (out->type < 0 || out->retprobe_bit < 0) ? -1 : 0;
+  }
+
+  /* negative results are cached too: the PMU will not appear mid-boot */
+  i = cache_used++;
+  strcpy(cache[i].event_type, event_type);
+  cache[i].type = bpf_find_probe_type(event_type);
+  cache[i].retprobe_bit = bpf_get_retprobe_bit(event_type);
+
+found:
+  *out = cache[i];
+  pthread_mutex_unlock(&cache_mutex);
+  if (out->type >= 0 && out->retprobe_bit >= 0)
+    ret = 0;
+  return ret;
+}
+
 /*
  * Kernel API with e12f03d ("perf/core: Implement the 'perf_kprobe' PMU") allows
  * creating [k,u]probe with perf_event_open, which makes it easier to clean up
@@ -1090,12 +1369,14 @@ static int bpf_try_perf_event_open_with_probe(const char *name, uint64_t offs,
              uint64_t ref_ctr_offset)
 {
   struct perf_event_attr attr = {};
-  int type = bpf_find_probe_type(event_type);
-  int is_return_bit = bpf_get_retprobe_bit(event_type);
+  struct probe_pmu_info pmu;
+  int type, is_return_bit;
   int cpu = 0;
 
-  if (type < 0 || is_return_bit < 0)
+  if (bpf_probe_pmu_info(event_type, &pmu) < 0)
     return -1;
+  type = pmu.type;
+  is_return_bit = pmu.retprobe_bit;
   attr.sample_period = 1;
   attr.wakeup_events = 1;
   if (is_return)
@@ -1149,6 +1430,136 @@ static const char *get_tracefs_path()
   return TRACEFS;
 }
 
+/* In-process index of tracefs available_filter_functions for cheap kprobe
+ * pre-validation: the file is read once into one name blob plus a sorted
+ * pointer array, so a wildcard attach over thousands of candidates can
+ * reject the unprobeable ones with a binary search each instead of a full
+ * failed attach round trip. Modules loading later grow the file, so a
+ * lookup miss triggers a reload, rate-limited to once a second so a batch
+ * of misses pays for one re-read. */
+static pthread_mutex_t filter_funcs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char **filter_funcs;
+static unsigned filter_funcs_cnt;
+static char *filter_funcs_blob;
+static int filter_funcs_state; /* 0 not loaded, 1 loaded, -1 unavailable */
+static time_t filter_funcs_loaded_at;
+
+static int filter_funcs_cmp(const void *a, const void *b)
+{
+  return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+/* (re)read available_filter_functions; filter_funcs_mutex held */
+static void filter_funcs_load(void)
+{
+  char path[PATH_MAX], line[512];
+  size_t blob_used = 0, blob_cap = 0, *offs = NULL;
+  size_t offs_cap = 0, cnt = 0, len, i;
+  struct timespec ts;
+  FILE *f;
+
+  free(filter_funcs);
+  free(filter_funcs_blob);
+  filter_funcs = NULL;
+  filter_funcs_blob = NULL;
+  filter_funcs_cnt = 0;
+  filter_funcs_state = -1;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  filter_funcs_loaded_at = ts.tv_sec;
+
+  snprintf(path, sizeof(path), "%s/available_filter_functions",
+           get_tracefs_path());
+  f = fopen(path, "r");
+  if (!f)
+    return;
+
+  while (fgets(line, sizeof(line), f)) {
+    /* each line is "name" or "name [module]"; keep the first token */
+    len = strcspn(line, " \t\n");
+    if (len == 0)
+      continue;
+    if (blob_used + len + 1 > blob_cap) {
+      blob_cap = blob_cap ? blob_cap * 2 : 1 << 20;
+      char *nb = realloc(filter_funcs_blob, blob_cap);
+      if (!nb)
+        goto oom;
+      filter_funcs_blob = nb;
+    }
+    if (cnt == offs_cap) {
+      offs_cap = offs_cap ? offs_cap * 2 : 1 << 16;
+      size_t *no = realloc(offs, offs_cap * sizeof(*offs));
+      if (!no)
+        goto oom;
+      offs = no;
+    }
+    memcpy(filter_funcs_blob + blob_used, line, len);
+    filter_funcs_blob[blob_used + len] = '\0';
+    offs[cnt++] = blob_used;
+    blob_used += len + 1;
+  }
+  fclose(f);
+
+  filter_funcs = malloc(cnt * sizeof(*filter_funcs));
+  if (!filter_funcs) {
+    free(offs);
+    free(filter_funcs_blob);
+    filter_funcs_blob = NULL;
+    return;
+  }
+  for (i = 0; i < cnt; i++)
+    filter_funcs[i] = filter_funcs_blob + offs[i];
+  free(offs);
+  qsort(filter_funcs, cnt, sizeof(*filter_funcs), filter_funcs_cmp);
+  filter_funcs_cnt = cnt;
+  filter_funcs_state = 1;
+  return;
+
+oom:
+  fclose(f);
+  free(offs);
+  free(filter_funcs_blob);
+  filter_funcs_blob = NULL;
+}
+
+static int filter_funcs_contains(const char *fn_name)
+{
+  const char *key = fn_name;
+
+  return bsearch(&key, filter_funcs, filter_funcs_cnt,
+                 sizeof(*filter_funcs), filter_funcs_cmp) != NULL;
+}
+
+int bcc_kprobe_exists(const char *fn_name)
+{
+  struct timespec ts;
+  int found;
+
+  if (!fn_name)
+    return -1;
+
+  pthread_mutex_lock(&filter_funcs_mutex);
+  if (filter_funcs_state == 0)
+    filter_funcs_load();
+  if (filter_funcs_state < 0) {
+    pthread_mutex_unlock(&filter_funcs_mutex);
+    return -1;
+  }
+  found = filter_funcs_contains(fn_name);
+  if (!found) {
+    /* the list grows when modules load; re-read before trusting a miss,
+     * at most once a second */
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    if (ts.tv_sec != filter_funcs_loaded_at) {
+      filter_funcs_load();
+      if (filter_funcs_state > 0)
+        found = filter_funcs_contains(fn_name);
+    }
+  }
+  found = filter_funcs_state > 0 ? found : -1;
+  pthread_mutex_unlock(&filter_funcs_mutex);
+  return found;
+}
+
 
 // When a valid Perf Event FD provided through pfd, it will be used to enable
 // and attach BPF program to the event, and event_path will be ignored.
@@ -1277,6 +1688,72 @@ error:
   return -1;
 }
 
+/* tracefs probe events created by create_probe_event carry a _bcc_<pid>
+ * suffix; when a tool crashes before detaching, the events stay behind and
+ * accumulate across crashes. Sweep both event files once per process on the
+ * first probe attach, deleting events whose owning pid is gone. Events of
+ * live processes (including our own) are left alone, and deletion failures
+ * (e.g. EBUSY for an event something still holds open) are ignored.
+ * BCC_NO_PROBE_GC=1 disables the sweep. */
+static void probe_event_gc_type(const char *event_type)
+{
+  char path[PATH_MAX], line[PATH_MAX], dead[256][64];
+  int n_dead = 0, i;
+  FILE *f;
+  int kfd;
+
+  snprintf(path, sizeof(path), "%s/%s_events", get_tracefs_path(), event_type);
+  f = fopen(path, "r");
+  if (!f)
+    return;
+
+  while (n_dead < 256 && fgets(line, sizeof(line), f)) {
+    /* p:kprobes/NAME_bcc_1234 func+0x0 ... */
+    char *ev = strchr(line, '/');
+    char *end, *suffix, *p;
+    long pid;
+
+    if (!ev++)
+      continue;
+    end = strpbrk(ev, " \t\n");
+    if (end)
+      *end = '\0';
+    suffix = NULL;
+    for (p = ev; (p = strstr(p, "_bcc_")); p += 5)
+      suffix = p;
+    if (!suffix)
+      continue;
+    pid = strtol(suffix + 5, &end, 10);
+    if (pid <= 0 || *end != '\0')
+      continue;
+    if (pid == getpid() || kill(pid, 0) == 0 || errno != ESRCH)
+      continue;
+    if (strlen(ev) < sizeof(dead[0]))
+      strcpy(dead[n_dead++], ev);
+  }
+  fclose(f);
+
+  if (n_dead == 0)
+    return;
+  kfd = open(path, O_WRONLY | O_APPEND, 0);
+  if (kfd < 0)
+    return;
+  for (i = 0; i < n_dead; i++) {
+    snprintf(line, sizeof(line), "-:%ss/%s", event_type, dead[i]);
+    if (write(kfd, line, strlen(line)) < 0)
+      continue;  /* busy or already gone; leave it */
+  }
+  close(kfd);
+}
+
+static void probe_event_gc(void)
+{
+  if (getenv("BCC_NO_PROBE_GC"))
+    return;
+  probe_event_gc_type("kprobe");
+  probe_event_gc_type("uprobe");
+}
+
 // config1 could be either kprobe_func or uprobe_path,
 // see bpf_try_perf_event_open_with_probe().
 static int bpf_attach_probe(int progfd, enum bpf_probe_attach_type attach_type,
@@ -1284,9 +1761,13 @@ static int bpf_attach_probe(int progfd, enum bpf_probe_attach_type attach_type,
                             uint64_t offset, pid_t pid, int maxactive,
                             uint32_t ref_ctr_offset)
 {
+  static pthread_once_t gc_once = PTHREAD_ONCE_INIT;
   int kfd, pfd = -1;
   char buf[PATH_MAX], fname[256], kprobe_events[PATH_MAX];
   bool is_kprobe = strncmp("kprobe", event_type, 6) == 0;
+  struct probe_pmu_info pmu;
+
+  pthread_once(&gc_once, probe_event_gc);
 
   if (maxactive <= 0)
     // Try create the [k,u]probe Perf Event with perf_event_open API.
@@ -1298,6 +1779,18 @@ static int bpf_attach_probe(int progfd, enum bpf_probe_attach_type attach_type,
   // (e12f03d "perf/core: Implement the 'perf_kprobe' PMU") yet.
   // Try create the event using tracefs.
   if (pfd < 0) {
+    // When the PMU does exist, a perf_event_open failure (bad symbol, bad
+    // offset, permissions) is authoritative: the tracefs path would fail
+    // for the same reason, after taking the global tracefs event lock that
+    // parallel attach storms contend on. Only fall back when the kernel
+    // lacks the PMU or the request needs tracefs features (maxactive).
+    // BCC_ALLOW_TRACEFS_PROBES=1 restores the unconditional fallback.
+    if (maxactive <= 0 && bpf_probe_pmu_info(event_type, &pmu) == 0 &&
+        !getenv("BCC_ALLOW_TRACEFS_PROBES")) {
+      fprintf(stderr, "%s(%s): %s\n", event_type, config1, strerror(errno));
+      goto error;
+    }
+
     if (create_probe_event(buf, ev_name, attach_type, config1, offset,
                            event_type, pid, maxactive) < 0)
       goto error;
@@ -1358,6 +1851,49 @@ int bpf_attach_kprobe(int progfd, enum bpf_probe_attach_type attach_type,
                           fn_offset, -1, maxactive, 0);
 }
 
+int bpf_attach_kprobe_link(int progfd, enum bpf_probe_attach_type attach_type,
+                           const char *fn_name)
+{
+  union bpf_attr attr;
+  int pfd, link_fd;
+
+  /* kernels without the perf_kprobe PMU predate BPF links anyway, so no
+   * tracefs fallback here */
+  pfd = bpf_try_perf_event_open_with_probe(fn_name, 0, -1, "kprobe",
+                                           attach_type != BPF_PROBE_ENTRY, 0);
+  if (pfd < 0)
+    return -1;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.link_create.prog_fd = progfd;
+  attr.link_create.target_fd = pfd;
+  attr.link_create.attach_type = BPF_PERF_EVENT;
+  link_fd = syscall(__NR_bpf, BPF_LINK_CREATE, &attr, sizeof(attr));
+  /* the link holds its own reference on the perf event */
+  close(pfd);
+  return link_fd;
+}
+
+/* Attach progfd to many kernel functions with a single kprobe_multi link
+ * (kernel v5.18+). The program must have been loaded with expected attach
+ * type BPF_TRACE_KPROBE_MULTI. Returns a link fd, or a negative value on
+ * failure. */
+int bpf_attach_kprobe_multi(int progfd, enum bpf_probe_attach_type attach_type,
+                            const char **syms, unsigned int cnt)
+{
+  union bpf_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.link_create.prog_fd = progfd;
+  attr.link_create.attach_type = BPF_TRACE_KPROBE_MULTI;
+  attr.link_create.kprobe_multi.syms = ptr_to_u64((void *)syms);
+  attr.link_create.kprobe_multi.cnt = cnt;
+  if (attach_type == BPF_PROBE_RETURN)
+    attr.link_create.kprobe_multi.flags = BPF_F_KPROBE_MULTI_RETURN;
+
+  return syscall(__NR_bpf, BPF_LINK_CREATE, &attr, sizeof(attr));
+}
+
 static int _find_archive_path_and_offset(const char *entry_path,
                                          char out_path[PATH_MAX],
                                          uint64_t *offset) {
@@ -1546,9 +2082,8 @@ int kernel_struct_has_field(const char *struct_name, const char *field_name)
   struct btf *btf;
   int ret, btf_id;
 
-  btf = btf__load_vmlinux_btf();
-  ret = libbpf_get_error(btf);
-  if (ret)
+  btf = bcc_vmlinux_btf_get();
+  if (!btf)
     return -1;
 
   btf_id = btf__find_by_name_kind(btf, struct_name, BTF_KIND_STRUCT);
@@ -1561,7 +2096,7 @@ int kernel_struct_has_field(const char *struct_name, const char *field_name)
   ret = find_member_by_name(btf, btf_type, field_name);
 
 cleanup:
-  btf__free(btf);
+  bcc_vmlinux_btf_put(btf);
   return ret;
 }
 
@@ -1610,11 +2145,23 @@ void * bpf_open_perf_buffer_opts(perf_reader_raw_cb raw_cb,
   if (!reader)
     goto error;
 
+  if (opts->use_hugetlb)
+    perf_reader_set_hugetlb(reader, 1);
+
   attr.config = 10;//PERF_COUNT_SW_BPF_OUTPUT;
   attr.type = PERF_TYPE_SOFTWARE;
   attr.sample_type = PERF_SAMPLE_RAW;
+  if (opts->sample_time) {
+    attr.sample_type |= PERF_SAMPLE_TIME;
+    perf_reader_set_sample_time(reader, 1);
+  }
   attr.sample_period = 1;
-  attr.wakeup_events = opts->wakeup_events;
+  if (opts->wakeup_watermark_bytes > 0) {
+    attr.watermark = 1;
+    attr.wakeup_watermark = opts->wakeup_watermark_bytes;
+  } else {
+    attr.wakeup_events = opts->wakeup_events;
+  }
   pfd = syscall(__NR_perf_event_open, &attr, pid, cpu, -1, PERF_FLAG_FD_CLOEXEC);
   if (pfd < 0) {
     fprintf(stderr, "perf_event_open: %s\n", strerror(errno));
@@ -1640,6 +2187,53 @@ error:
   return NULL;
 }
 
+void * bpf_open_perf_mmap_tracker(perf_reader_mmap_cb mmap_cb, void *cb_cookie,
+                                  int pid, int page_cnt)
+{
+  struct perf_event_attr attr = {};
+  struct perf_reader *reader = NULL;
+  int pfd;
+
+  reader = perf_reader_new(NULL, NULL, NULL, page_cnt);
+  if (!reader)
+    goto error;
+  perf_reader_set_mmap_cb(reader, mmap_cb, cb_cookie);
+
+  // a dummy counter never fires; the event exists purely for its side-band
+  // mmap2 records, one per new PROT_EXEC mapping in the traced task
+  attr.config = 9;//PERF_COUNT_SW_DUMMY;
+  attr.type = PERF_TYPE_SOFTWARE;
+  // mmap gates side-band generation on some kernels; mmap2 upgrades the
+  // record format to carry the file offset and inode
+  attr.mmap = 1;
+  attr.mmap2 = 1;
+  attr.exclude_kernel = 1;
+  attr.wakeup_events = 1;
+  pfd = syscall(__NR_perf_event_open, &attr, pid, -1, -1,
+                PERF_FLAG_FD_CLOEXEC);
+  if (pfd < 0) {
+    fprintf(stderr, "perf_event_open(mmap tracker): %s\n", strerror(errno));
+    goto error;
+  }
+  perf_reader_set_fd(reader, pfd);
+
+  if (perf_reader_mmap(reader) < 0)
+    goto error;
+
+  if (ioctl(pfd, PERF_EVENT_IOC_ENABLE, 0) < 0) {
+    perror("ioctl(PERF_EVENT_IOC_ENABLE)");
+    goto error;
+  }
+
+  return reader;
+
+error:
+  if (reader)
+    perf_reader_free(reader);
+
+  return NULL;
+}
+
 static int invalid_perf_config(uint32_t type, uint64_t config) {
   switch (type) {
   case PERF_TYPE_HARDWARE:
@@ -1706,17 +2300,119 @@ int bpf_open_perf_event(uint32_t type, uint64_t config, int pid, int cpu) {
   return fd;
 }
 
-int bpf_attach_xdp(const char *dev_name, int progfd, uint32_t flags) {
-  int ifindex = if_nametoindex(dev_name);
-  char err_buf[256];
-  int ret = -1;
+int bpf_open_perf_sample_callchain(uint32_t type, uint64_t config,
+                                   uint64_t sample_freq, int max_stack,
+                                   int pid, int cpu) {
+  int fd;
+  struct perf_event_attr attr = {};
 
-  if (ifindex == 0) {
-    fprintf(stderr, "bpf: Resolving device name to index: %s\n", strerror(errno));
+  if (invalid_perf_config(type, config)) {
+    return -1;
+  }
+
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.sample_freq = sample_freq;
+  attr.freq = 1;
+  attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN;
+  if (max_stack > 0)
+    attr.sample_max_stack = max_stack;
+  attr.wakeup_events = 1;
+  attr.inherit = pid >= 0; // follow children when profiling one process
+
+  fd = syscall(__NR_perf_event_open, &attr, pid, cpu, -1,
+               PERF_FLAG_FD_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "perf_event_open: %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (ioctl(fd, PERF_EVENT_IOC_ENABLE, 0) < 0) {
+    perror("ioctl(PERF_EVENT_IOC_ENABLE)");
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+int bpf_open_perf_event_group(uint32_t type, uint64_t config, int pid,
+                              int cpu, int group_fd) {
+  int fd;
+  struct perf_event_attr attr = {};
+
+  if (invalid_perf_config(type, config)) {
+    return -1;
+  }
+
+  attr.sample_period = LONG_MAX;
+  attr.type = type;
+  attr.config = config;
+  attr.read_format = PERF_FORMAT_GROUP;
+
+  fd = syscall(__NR_perf_event_open, &attr, pid, cpu, group_fd,
+               PERF_FLAG_FD_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "perf_event_open: %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (ioctl(fd, PERF_EVENT_IOC_ENABLE, 0) < 0) {
+    perror("ioctl(PERF_EVENT_IOC_ENABLE)");
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+int bpf_open_perf_event_metric(uint32_t type, uint64_t config, int pid,
+                               int cpu, int group_fd) {
+  int fd;
+  struct perf_event_attr attr = {};
+
+  if (invalid_perf_config(type, config)) {
+    return -1;
+  }
+
+  // pure counting mode: no sample period, but carry the scheduling times so
+  // readers can rescale counts when the group was multiplexed off the PMU
+  attr.type = type;
+  attr.config = config;
+  attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                     PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  fd = syscall(__NR_perf_event_open, &attr, pid, cpu, group_fd,
+               PERF_FLAG_FD_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "perf_event_open: %s\n", strerror(errno));
     return -1;
   }
 
-  ret = bpf_xdp_attach(ifindex, progfd, flags, NULL);
+  if (ioctl(fd, PERF_EVENT_IOC_ENABLE, 0) < 0) {
+    perror("ioctl(PERF_EVENT_IOC_ENABLE)");
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+int bpf_try_attach_xdp(const char *dev_name, int progfd, uint32_t flags) {
+  int ifindex = if_nametoindex(dev_name);
+
+  if (ifindex == 0)
+    return -errno;
+
+  return bpf_xdp_attach(ifindex, progfd, flags, NULL);
+}
+
+int bpf_attach_xdp(const char *dev_name, int progfd, uint32_t flags) {
+  char err_buf[256];
+  int ret;
+
+  ret = bpf_try_attach_xdp(dev_name, progfd, flags);
   if (ret) {
     libbpf_strerror(ret, err_buf, sizeof(err_buf));
     fprintf(stderr, "bpf: Attaching prog to %s: %s\n", dev_name, err_buf);
@@ -1885,3 +2581,161 @@ int bcc_check_bpffs_path(const char *path) {
 
   return err;
 }
+
+/* One kind's worth of scan results, sorted by id (the kernel id iterators
+ * walk in ascending order, so a scan appends in sorted order for free). */
+struct bcc_object_vec {
+  struct bcc_object_info *entries;
+  size_t count;
+  size_t cap;
+};
+
+struct bcc_object_cache {
+  struct bcc_object_vec progs;
+  struct bcc_object_vec maps;
+};
+
+struct bcc_object_cache *bcc_object_cache_new(void)
+{
+  return calloc(1, sizeof(struct bcc_object_cache));
+}
+
+void bcc_object_cache_free(struct bcc_object_cache *cache)
+{
+  if (!cache)
+    return;
+  free(cache->progs.entries);
+  free(cache->maps.entries);
+  free(cache);
+}
+
+static int bcc_object_vec_push(struct bcc_object_vec *v,
+                               const struct bcc_object_info *info)
+{
+  if (v->count == v->cap) {
+    size_t new_cap = v->cap ? v->cap * 2 : 64;
+    struct bcc_object_info *entries =
+        realloc(v->entries, new_cap * sizeof(*entries));
+    if (!entries)
+      return -1;
+    v->entries = entries;
+    v->cap = new_cap;
+  }
+  v->entries[v->count++] = *info;
+  return 0;
+}
+
+static int bcc_fetch_prog_info(uint32_t id, struct bcc_object_info *out)
+{
+  struct bpf_prog_info info = {};
+  uint32_t info_len = sizeof(info);
+  int fd, ret;
+
+  fd = bpf_prog_get_fd_by_id(id);
+  if (fd < 0)
+    return -1;
+  ret = bpf_obj_get_info_by_fd(fd, &info, &info_len);
+  close(fd);
+  if (ret)
+    return -1;
+
+  memset(out, 0, sizeof(*out));
+  out->kind = BCC_OBJ_PROG;
+  out->id = id;
+  out->type = info.type;
+  memcpy(out->name, info.name, sizeof(out->name));
+  out->btf_id = info.btf_id;
+  out->load_time = info.load_time;
+  out->created_by_uid = info.created_by_uid;
+  out->nr_map_ids = info.nr_map_ids;
+  out->jited_prog_len = info.jited_prog_len;
+  return 0;
+}
+
+static int bcc_fetch_map_info(uint32_t id, struct bcc_object_info *out)
+{
+  struct bpf_map_info info = {};
+  uint32_t info_len = sizeof(info);
+  int fd, ret;
+
+  fd = bpf_map_get_fd_by_id(id);
+  if (fd < 0)
+    return -1;
+  ret = bpf_obj_get_info_by_fd(fd, &info, &info_len);
+  close(fd);
+  if (ret)
+    return -1;
+
+  memset(out, 0, sizeof(*out));
+  out->kind = BCC_OBJ_MAP;
+  out->id = id;
+  out->type = info.type;
+  memcpy(out->name, info.name, sizeof(out->name));
+  out->btf_id = info.btf_id;
+  out->key_size = info.key_size;
+  out->value_size = info.value_size;
+  out->max_entries = info.max_entries;
+  out->map_flags = info.map_flags;
+  return 0;
+}
+
+static int bcc_enumerate_kind(enum bcc_object_kind kind,
+                              struct bcc_object_vec *old,
+                              struct bcc_object_vec *fresh,
+                              bcc_object_info_cb cb, void *ctx)
+{
+  struct bcc_object_info info;
+  uint32_t id = 0;
+  size_t oi = 0;
+  int ret;
+
+  while (!(kind == BCC_OBJ_PROG ? bpf_prog_get_next_id(id, &id)
+                                : bpf_map_get_next_id(id, &id))) {
+    /* both the id walk and the cache are ascending, so a single merge
+     * cursor finds the previous scan's entry without searching */
+    while (old && oi < old->count && old->entries[oi].id < id)
+      oi++;
+    if (old && oi < old->count && old->entries[oi].id == id) {
+      info = old->entries[oi];
+    } else if (kind == BCC_OBJ_PROG ? bcc_fetch_prog_info(id, &info)
+                                    : bcc_fetch_map_info(id, &info)) {
+      if (errno == ENOENT)
+        continue;  /* raced with unload; keep going */
+      return -1;
+    }
+    if (fresh && bcc_object_vec_push(fresh, &info))
+      return -1;
+    ret = cb(&info, ctx);
+    if (ret)
+      return ret;
+  }
+  return errno == ENOENT ? 0 : -1;
+}
+
+int bcc_enumerate_objects(struct bcc_object_cache *cache,
+                          bcc_object_info_cb cb, void *ctx)
+{
+  struct bcc_object_vec progs = {}, maps = {};
+  int ret;
+
+  ret = bcc_enumerate_kind(BCC_OBJ_PROG, cache ? &cache->progs : NULL,
+                           cache ? &progs : NULL, cb, ctx);
+  if (!ret)
+    ret = bcc_enumerate_kind(BCC_OBJ_MAP, cache ? &cache->maps : NULL,
+                             cache ? &maps : NULL, cb, ctx);
+
+  if (!cache)
+    return ret;
+  if (ret) {
+    /* interrupted scan; keep the previous cache, deltas refetch next time */
+    free(progs.entries);
+    free(maps.entries);
+    return ret;
+  }
+  /* swap in this scan's view so entries for unloaded ids age out */
+  free(cache->progs.entries);
+  free(cache->maps.entries);
+  cache->progs = progs;
+  cache->maps = maps;
+  return 0;
+}
@@ -27,6 +27,8 @@
 extern "C" {
 #endif
 
+struct btf;
+
 struct bcc_create_map_attr {
 	const char *name;
 	enum bpf_map_type map_type;
@@ -56,6 +58,16 @@ struct bcc_perf_buffer_opts {
   int pid;
   int cpu;
   int wakeup_events;
+  // when > 0, wake the consumer by pending bytes instead of by event
+  // count: attr.watermark is set and wakeup_events is ignored. Large
+  // watermarks trade bounded delivery latency for far fewer wakeups.
+  int wakeup_watermark_bytes;
+  // try MAP_HUGETLB for the ring mmap, falling back to normal pages on
+  // kernels that reject it for perf events
+  int use_hugetlb;
+  // request PERF_SAMPLE_TIME so every sample carries the kernel perf-clock
+  // timestamp, enabling timestamp-ordered merging across per-CPU rings
+  int sample_time;
 };
 
 int bcc_create_map(enum bpf_map_type map_type, const char *name,
@@ -102,12 +114,42 @@ int bpf_open_raw_sock(const char *name);
 
 typedef void (*perf_reader_raw_cb)(void *cb_cookie, void *raw, int raw_size);
 typedef void (*perf_reader_lost_cb)(void *cb_cookie, uint64_t lost);
+/* one PERF_RECORD_MMAP2 record: a new executable mapping in the traced
+ * process (see bpf_open_perf_mmap_tracker) */
+typedef void (*perf_reader_mmap_cb)(void *cb_cookie, int pid, uint64_t addr,
+                                    uint64_t len, uint64_t pgoff,
+                                    const char *filename);
 
 int bpf_attach_kprobe(int progfd, enum bpf_probe_attach_type attach_type,
                       const char *ev_name, const char *fn_name, uint64_t fn_offset,
                       int maxactive);
 int bpf_detach_kprobe(const char *ev_name);
 
+/* Attach progfd to fn_name as a kprobe owned by a BPF link instead of by
+ * the calling process's perf event fd. Returns the link fd: the
+ * attachment lives exactly as long as the link does, so pinning the link
+ * in bpffs keeps the probe armed after the creating process exits (used
+ * by the shared kprobe dispatcher in the C++ API). Needs the perf_kprobe
+ * PMU plus BPF_PERF_EVENT links (kernel v5.15+); returns a negative value
+ * on older kernels or failure. */
+int bpf_attach_kprobe_link(int progfd, enum bpf_probe_attach_type attach_type,
+                           const char *fn_name);
+
+/* Whether fn_name appears in tracefs available_filter_functions, checked
+ * against an in-process sorted index loaded once (and re-read, rate
+ * limited, on a miss since module loads grow the file). Returns 1 if
+ * present, 0 if absent, -1 if the list cannot be read. Intended for
+ * pre-filtering wildcard/batch kprobe candidates without a failed attach
+ * syscall per bad name; note functions absent from the list (e.g. notrace)
+ * may still accept a breakpoint-based kprobe, so a plain attach should
+ * treat 0 as advisory. */
+int bcc_kprobe_exists(const char *fn_name);
+
+// attach a prog to many kernel functions at once with a kprobe_multi link
+// (kernel v5.18+); returns a link fd owning all the attachments
+int bpf_attach_kprobe_multi(int progfd, enum bpf_probe_attach_type attach_type,
+                            const char **syms, unsigned int cnt);
+
 int bpf_attach_uprobe(int progfd, enum bpf_probe_attach_type attach_type,
                       const char *ev_name, const char *binary_path,
                       uint64_t offset, pid_t pid, uint32_t ref_ctr_offset);
@@ -125,6 +167,19 @@ int bpf_attach_lsm(int prog_fd);
 
 bool bpf_has_kernel_btf(void);
 
+/* Shared, lazily loaded parse of the running kernel's BTF (and per-module
+ * split BTFs). Every get returns the same immutable graph and must be
+ * balanced with the matching put; do not btf__free() it directly. The cache
+ * keeps the graphs alive across users so repeated consumers skip the
+ * multi-MB reparse; bcc_kernel_btf_flush() releases the cached references
+ * so memory is reclaimed once the last outstanding get is put back.
+ */
+struct btf *bcc_vmlinux_btf_get(void);
+void bcc_vmlinux_btf_put(struct btf *btf);
+struct btf *bcc_module_btf_get(const char *module_name);
+void bcc_module_btf_put(struct btf *btf);
+void bcc_kernel_btf_flush(void);
+
 int kernel_struct_has_field(const char *struct_name, const char *field_name);
 
 void * bpf_open_perf_buffer(perf_reader_raw_cb raw_cb,
@@ -135,8 +190,18 @@ void * bpf_open_perf_buffer_opts(perf_reader_raw_cb raw_cb,
                             perf_reader_lost_cb lost_cb, void *cb_cookie,
                             int page_cnt, struct bcc_perf_buffer_opts *opts);
 
+/* Follow pid's executable mmaps: a dummy software perf event with mmap2
+ * recording delivers one PERF_RECORD_MMAP2 per new PROT_EXEC mapping to
+ * mmap_cb when the returned perf_reader is drained. Returns a perf_reader
+ * (free with perf_reader_free) or NULL. */
+void * bpf_open_perf_mmap_tracker(perf_reader_mmap_cb mmap_cb, void *cb_cookie,
+                                  int pid, int page_cnt);
+
 /* attached a prog expressed by progfd to the device specified in dev_name */
 int bpf_attach_xdp(const char *dev_name, int progfd, uint32_t flags);
+/* like bpf_attach_xdp, but silent: returns a negative errno instead of
+ * printing, so callers can probe for the best supported XDP mode */
+int bpf_try_attach_xdp(const char *dev_name, int progfd, uint32_t flags);
 
 // attach a prog expressed by progfd to run on a specific perf event. The perf
 // event will be created using the perf_event_attr pointer provided.
@@ -149,6 +214,26 @@ int bpf_attach_perf_event(int progfd, uint32_t ev_type, uint32_t ev_config,
                           pid_t pid, int cpu, int group_fd);
 
 int bpf_open_perf_event(uint32_t type, uint64_t config, int pid, int cpu);
+// Like bpf_open_perf_event, but the event is created with PERF_FORMAT_GROUP
+// and attached to group_fd (-1 creates a group leader), so reading a leader
+// fd returns every counter of its group in one syscall, as one consistent
+// snapshot.
+int bpf_open_perf_event_group(uint32_t type, uint64_t config, int pid,
+                              int cpu, int group_fd);
+// Like bpf_open_perf_event_group, but in pure counting mode (no sample
+// period) and with PERF_FORMAT_TOTAL_TIME_ENABLED/RUNNING in the read
+// format, so a group read also reports how long the group was actually
+// scheduled and counts can be rescaled under PMU multiplexing.
+int bpf_open_perf_event_metric(uint32_t type, uint64_t config, int pid,
+                               int cpu, int group_fd);
+// Opens a sampling event at sample_freq Hz carrying PERF_SAMPLE_TID |
+// PERF_SAMPLE_CALLCHAIN, for direct callchain profiling through a
+// perf_reader in callchain mode (perf_reader_set_callchain_cb) -- no BPF
+// program or stack map involved. max_stack > 0 caps the recorded chain
+// depth; pid >= 0 also follows children. The fd is enabled on return.
+int bpf_open_perf_sample_callchain(uint32_t type, uint64_t config,
+                                   uint64_t sample_freq, int max_stack,
+                                   int pid, int cpu);
 
 int bpf_close_perf_event_fd(int fd);
 
@@ -179,6 +264,46 @@ int bcc_iter_attach(int prog_fd, union bpf_iter_link_info *link_info,
 int bcc_iter_create(int link_fd);
 int bcc_make_parent_dir(const char *path);
 int bcc_check_bpffs_path(const char *path);
+/* Full-system BPF object inventory. bcc_enumerate_objects() walks all loaded
+ * programs and maps via the id iterators and invokes cb once per object; a
+ * non-zero return from cb stops the walk and is passed through. With a cache
+ * (from bcc_object_cache_new, reused across scans) the per-object info fetch
+ * is skipped for ids already seen -- the reported fields are fixed at
+ * load/creation time -- so a steady-state rescan costs only the id walk plus
+ * fetches for objects that appeared since the previous scan.
+ */
+enum bcc_object_kind {
+  BCC_OBJ_PROG,
+  BCC_OBJ_MAP,
+};
+
+struct bcc_object_info {
+  enum bcc_object_kind kind;
+  uint32_t id;
+  uint32_t type;          /* enum bpf_prog_type or enum bpf_map_type */
+  char name[16];          /* BPF_OBJ_NAME_LEN */
+  uint32_t btf_id;        /* 0 when the object carries no BTF */
+  /* programs only */
+  uint64_t load_time;     /* ns since boot */
+  uint32_t created_by_uid;
+  uint32_t nr_map_ids;
+  uint32_t jited_prog_len;
+  /* maps only */
+  uint32_t key_size;
+  uint32_t value_size;
+  uint32_t max_entries;
+  uint32_t map_flags;
+};
+
+struct bcc_object_cache;
+
+typedef int (*bcc_object_info_cb)(const struct bcc_object_info *info,
+                                  void *ctx);
+struct bcc_object_cache *bcc_object_cache_new(void);
+void bcc_object_cache_free(struct bcc_object_cache *cache);
+int bcc_enumerate_objects(struct bcc_object_cache *cache,
+                          bcc_object_info_cb cb, void *ctx);
+
 int bpf_lookup_batch(int fd, __u32 *in_batch, __u32 *out_batch, void *keys,
                      void *values, __u32 *count);
 int bpf_delete_batch(int fd,  void *keys, __u32 *count);
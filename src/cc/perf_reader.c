@@ -14,13 +14,16 @@
  * limitations under the License.
  */
 
+#include <errno.h>
 #include <inttypes.h>
 #include <poll.h>
+#include <sys/epoll.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syscall.h>
+#include <time.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -28,6 +31,7 @@
 #include <linux/types.h>
 #include <linux/perf_event.h>
 
+#include "bcc_stats.h"
 #include "libbpf.h"
 #include "perf_reader.h"
 
@@ -49,8 +53,64 @@ struct perf_reader {
   int page_size;
   int page_cnt;
   int fd;
+  int use_hugetlb;
+  // batched delivery (see perf_reader_set_batch_cb); while a batch is
+  // pending, data_tail is withheld from the kernel so the queued ring
+  // pointers stay valid, and batch_tail holds the value to publish at flush
+  perf_reader_batch_cb batch_cb;
+  struct perf_reader_raw_event *batch; // capacity batch_max
+  int batch_max;
+  int batch_cnt;
+  int batch_latency_us;
+  uint64_t batch_start_ns; // when the oldest pending event was queued
+  uint64_t batch_tail;
+  int batch_scratch_used; // a queued event lives in the scratch buffer
+  // callchain sampling mode (see perf_reader_set_callchain_cb); shares the
+  // batch scheduling fields above
+  perf_reader_callchain_cb callchain_cb;
+  struct perf_reader_callchain_event *cc_batch; // capacity batch_max
+  int sample_time; // samples carry a leading u64 PERF_SAMPLE_TIME field
+  // decode plan: byte offsets of the sample fields, derived once from the
+  // sample format (fixed at open time) so per-record parsing does no
+  // format branching
+  int sample_time_offset; // offset of the u64 timestamp, -1 when absent
+  int sample_raw_offset;  // offset of the PERF_SAMPLE_RAW {u32 size; data}
+  // flight-recorder capture (see perf_reader_set_capture_fd)
+  int capture_fd;
+  int capture_hdr_written;
+  // mmap tracking (see bpf_open_perf_mmap_tracker)
+  perf_reader_mmap_cb mmap_cb;
+  void *mmap_cb_cookie;
 };
 
+// PERF_RECORD_MMAP2 body with sample_id_all off; filename is padded with
+// NULs to the 8-byte record boundary
+struct perf_record_mmap2 {
+  struct perf_event_header header;
+  uint32_t pid, tid;
+  uint64_t addr;
+  uint64_t len;
+  uint64_t pgoff;
+  uint32_t maj;
+  uint32_t min;
+  uint64_t ino;
+  uint64_t ino_generation;
+  uint32_t prot;
+  uint32_t flags;
+  char filename[];
+};
+
+static void compute_sample_offsets(struct perf_reader *reader) {
+  // in callchain mode the PERF_SAMPLE_TID pair precedes the timestamp
+  int prefix = reader->callchain_cb ? (int)(2 * sizeof(uint32_t)) : 0;
+  reader->sample_time_offset =
+      reader->sample_time ? (int)sizeof(struct perf_event_header) + prefix
+                          : -1;
+  reader->sample_raw_offset =
+      (int)sizeof(struct perf_event_header) +
+      (reader->sample_time ? (int)sizeof(uint64_t) : 0);
+}
+
 struct perf_reader * perf_reader_new(perf_reader_raw_cb raw_cb,
                                      perf_reader_lost_cb lost_cb,
                                      void *cb_cookie, int page_cnt) {
@@ -63,6 +123,8 @@ struct perf_reader * perf_reader_new(perf_reader_raw_cb raw_cb,
   reader->fd = -1;
   reader->page_size = getpagesize();
   reader->page_cnt = page_cnt;
+  reader->capture_fd = -1;
+  compute_sample_offsets(reader);
   return reader;
 }
 
@@ -80,6 +142,8 @@ void perf_reader_free(void *ptr) {
       ioctl(reader->fd, PERF_EVENT_IOC_DISABLE, 0);
       close(reader->fd);
     }
+    free(reader->batch);
+    free(reader->cc_batch);
     free(reader->buf);
     free(ptr);
   }
@@ -93,6 +157,16 @@ int perf_reader_mmap(struct perf_reader *reader) {
     return -1;
   }
 
+#ifdef MAP_HUGETLB
+  if (reader->use_hugetlb) {
+    reader->base = mmap(NULL, mmap_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_HUGETLB, reader->fd, 0);
+    if (reader->base != MAP_FAILED)
+      return 0;
+    // not every kernel accepts MAP_HUGETLB for a perf event mmap; fall
+    // back to normal pages
+  }
+#endif
   reader->base = mmap(NULL, mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED, reader->fd, 0);
   if (reader->base == MAP_FAILED) {
     perror("mmap");
@@ -114,16 +188,57 @@ struct perf_sample_trace_kprobe {
   uint64_t ip;
 };
 
+// callchain sampling mode: samples were opened with sample_type =
+// PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN (optionally | PERF_SAMPLE_TIME),
+// so the body is u32 pid, u32 tid, [u64 time,] u64 nr, u64 ips[nr]. The
+// chain is queued by reference -- the batch machinery withholds data_tail,
+// so the ring bytes stay valid until the flush.
+static void parse_callchain(struct perf_reader *reader, void *data, int size) {
+  uint8_t *ptr = data;
+  uint8_t *end = ptr + size;
+  struct perf_reader_callchain_event *ev;
+  uint64_t nr;
+
+  ptr += sizeof(struct perf_event_header);
+  if (ptr + 2 * sizeof(uint32_t) + (reader->sample_time ? 8 : 0) + 8 > end) {
+    fprintf(stderr, "%s: corrupt callchain sample\n", __FUNCTION__);
+    return;
+  }
+  ev = &reader->cc_batch[reader->batch_cnt];
+  ev->pid = *(uint32_t *)ptr;
+  ev->tid = *(uint32_t *)(ptr + sizeof(uint32_t));
+  ptr += 2 * sizeof(uint32_t);
+  if (reader->sample_time)
+    ptr += sizeof(uint64_t);
+  nr = *(uint64_t *)ptr;
+  ptr += sizeof(uint64_t);
+  if (nr > (uint64_t)(end - ptr) / sizeof(uint64_t)) {
+    fprintf(stderr, "%s: corrupt callchain length\n", __FUNCTION__);
+    return;
+  }
+  ev->nr = nr;
+  ev->ips = (const uint64_t *)ptr;
+  reader->batch_cnt++;
+  if (data == reader->buf)
+    reader->batch_scratch_used = 1;
+}
+
 static void parse_sw(struct perf_reader *reader, void *data, int size) {
   uint8_t *ptr = data;
-  struct perf_event_header *header = (void *)data;
+
+  if (reader->callchain_cb) {
+    parse_callchain(reader, data, size);
+    return;
+  }
 
   struct {
       uint32_t size;
       char data[0];
   } *raw = NULL;
 
-  ptr += sizeof(*header);
+  // precomputed decode plan: skips the header and, when the format carries
+  // PERF_SAMPLE_TIME, the u64 timestamp ahead of the raw data
+  ptr += reader->sample_raw_offset;
   if (ptr > (uint8_t *)data + size) {
     fprintf(stderr, "%s: corrupt sample header\n", __FUNCTION__);
     return;
@@ -142,8 +257,15 @@ static void parse_sw(struct perf_reader *reader, void *data, int size) {
     return;
   }
 
-  if (reader->raw_cb)
+  if (reader->batch_cb) {
+    struct perf_reader_raw_event *ev = &reader->batch[reader->batch_cnt++];
+    ev->data = raw->data;
+    ev->size = raw->size;
+    if (data == reader->buf)
+      reader->batch_scratch_used = 1;
+  } else if (reader->raw_cb) {
     reader->raw_cb(reader->cb_cookie, raw->data, raw->size);
+  }
 }
 
 static uint64_t read_data_head(volatile struct perf_event_mmap_page *perf_header) {
@@ -157,6 +279,89 @@ static void write_data_tail(volatile struct perf_event_mmap_page *perf_header, u
   perf_header->data_tail = data_tail;
 }
 
+static uint64_t monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Either batched-delivery flavor is active: raw events or decoded
+// callchains; both share the withheld-tail scheduling.
+static int batch_active(struct perf_reader *reader) {
+  return reader->batch_cb != NULL || reader->callchain_cb != NULL;
+}
+
+// Deliver the pending batch and publish the withheld data_tail, releasing
+// the queued events' ring space back to the kernel.
+static void flush_batch(struct perf_reader *reader,
+                        volatile struct perf_event_mmap_page *perf_header) {
+  if (reader->batch_cnt) {
+    if (reader->callchain_cb)
+      reader->callchain_cb(reader->cb_cookie, reader->cc_batch,
+                           reader->batch_cnt);
+    else
+      reader->batch_cb(reader->cb_cookie, reader->batch, reader->batch_cnt);
+    reader->batch_cnt = 0;
+    reader->batch_scratch_used = 0;
+  }
+  write_data_tail(perf_header, reader->batch_tail);
+}
+
+static int write_full(int fd, const void *buf, size_t len) {
+  const uint8_t *p = buf;
+  while (len) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("capture write");
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+// Flight-recorder drain: ship the raw ring bytes [tail, head) straight to
+// the capture file with no per-event decode and no callbacks, at most two
+// writes per sweep for the ring wraparound. The file is a linear stream of
+// perf_event_header records behind a perf_capture_hdr carrying the decode
+// plan, so perf_reader_replay can parse it offline.
+static void capture_drain(struct perf_reader *reader,
+                          volatile struct perf_event_mmap_page *perf_header) {
+  uint64_t buffer_size = (uint64_t)reader->page_size * reader->page_cnt;
+  uint8_t *base = (uint8_t *)reader->base + reader->page_size;
+  uint64_t data_tail = perf_header->data_tail;
+  uint64_t data_head = read_data_head(perf_header);
+
+  if (!reader->capture_hdr_written) {
+    struct perf_capture_hdr hdr = {
+      .magic = PERF_CAPTURE_MAGIC,
+      .version = 1,
+      .sample_raw_offset = (uint32_t)reader->sample_raw_offset,
+    };
+    if (write_full(reader->capture_fd, &hdr, sizeof(hdr)) < 0)
+      return;
+    reader->capture_hdr_written = 1;
+  }
+
+  while (data_tail != data_head) {
+    uint64_t off = data_tail % buffer_size;
+    uint64_t avail = data_head - data_tail;
+    uint64_t chunk = buffer_size - off;  // contiguous run up to the wrap
+    if (chunk > avail)
+      chunk = avail;
+    if (write_full(reader->capture_fd, base + off, chunk) < 0)
+      break;
+    data_tail += chunk;
+    // release the shipped bytes back to the kernel before the next write,
+    // so the producer regains space while the disk keeps up
+    write_data_tail(perf_header, data_tail);
+    data_head = read_data_head(perf_header);
+  }
+}
+
 void perf_reader_event_read(struct perf_reader *reader) {
   volatile struct perf_event_mmap_page *perf_header = reader->base;
   uint64_t buffer_size = (uint64_t)reader->page_size * reader->page_cnt;
@@ -168,13 +373,23 @@ void perf_reader_event_read(struct perf_reader *reader) {
   reader->rb_read_tid = syscall(__NR_gettid);
   if (!__sync_bool_compare_and_swap(&reader->rb_use_state, RB_NOT_USED, RB_USED_IN_READ))
     return;
+  bcc_stats_add(BCC_STAT_PERF_READS, 1);
+
+  if (reader->capture_fd >= 0) {
+    capture_drain(reader, perf_header);
+    reader->rb_use_state = RB_NOT_USED;
+    __sync_synchronize();
+    reader->rb_read_tid = 0;
+    return;
+  }
 
   // Consume all the events on this ring, calling the cb function for each one.
   // The message may fall on the ring boundary, in which case copy the message
   // into a malloced buffer.
-  for (data_head = read_data_head(perf_header); perf_header->data_tail != data_head;
+  uint64_t data_tail = perf_header->data_tail;
+  reader->batch_tail = data_tail;
+  for (data_head = read_data_head(perf_header); data_tail != data_head;
       data_head = read_data_head(perf_header)) {
-    uint64_t data_tail = perf_header->data_tail;
     uint8_t *ptr;
 
     begin = base + data_tail % buffer_size;
@@ -183,8 +398,23 @@ void perf_reader_event_read(struct perf_reader *reader) {
     ptr = begin;
     end = base + (data_tail + e->size) % buffer_size;
     if (end < begin) {
-      // perf event wraps around the ring, make a contiguous copy
-      reader->buf = realloc(reader->buf, e->size);
+      // Perf event wraps around the ring, make a contiguous copy into the
+      // scratch buffer. The buffer only ever grows and is reused across
+      // events, so the allocator stays off the hot path; contiguous records
+      // are delivered as direct pointers into the ring without any copy.
+      if (batch_active(reader) && reader->batch_scratch_used)
+        // the scratch buffer still backs a queued event; drain the batch
+        // before overwriting it
+        flush_batch(reader, perf_header);
+      if (e->size > reader->buf_size) {
+        void *buf = realloc(reader->buf, e->size);
+        if (!buf) {
+          fprintf(stderr, "%s: cannot allocate scratch buffer\n", __FUNCTION__);
+          break;
+        }
+        reader->buf = buf;
+        reader->buf_size = e->size;
+      }
       size_t len = sentinel - begin;
       memcpy(reader->buf, begin, len);
       memcpy((void *)((unsigned long)reader->buf + len), base, e->size - len);
@@ -201,22 +431,232 @@ void perf_reader_event_read(struct perf_reader *reader) {
        * };
        */
       uint64_t lost = *(uint64_t *)(ptr + sizeof(*e) + sizeof(uint64_t));
+      bcc_stats_add(BCC_STAT_PERF_LOST, lost);
+      if (batch_active(reader))
+        // keep lost notifications ordered relative to queued samples
+        flush_batch(reader, perf_header);
       if (reader->lost_cb) {
         reader->lost_cb(reader->cb_cookie, lost);
       } else {
         fprintf(stderr, "Possibly lost %" PRIu64 " samples\n", lost);
       }
     } else if (e->type == PERF_RECORD_SAMPLE) {
+      int prev_cnt = reader->batch_cnt;
+      bcc_stats_add(BCC_STAT_PERF_EVENTS, 1);
+      parse_sw(reader, ptr, e->size);
+      if (batch_active(reader) && reader->batch_cnt && !prev_cnt)
+        reader->batch_start_ns = monotonic_ns();
+    } else if (e->type == PERF_RECORD_MMAP2) {
+      // only readers opened as mmap trackers receive these
+      if (reader->mmap_cb && e->size >= sizeof(struct perf_record_mmap2)) {
+        struct perf_record_mmap2 *m = (void *)ptr;
+        reader->mmap_cb(reader->mmap_cb_cookie, (int)m->pid, m->addr, m->len,
+                        m->pgoff, m->filename);
+      }
+    } else {
+      fprintf(stderr, "%s: unknown sample type %d\n", __FUNCTION__, e->type);
+    }
+
+    data_tail += e->size;
+    if (batch_active(reader)) {
+      reader->batch_tail = data_tail;
+      if (reader->batch_cnt >= reader->batch_max ||
+          (reader->batch_cnt && reader->batch_latency_us > 0 &&
+           monotonic_ns() - reader->batch_start_ns >=
+               (uint64_t)reader->batch_latency_us * 1000))
+        flush_batch(reader, perf_header);
+    } else {
+      write_data_tail(perf_header, data_tail);
+    }
+  }
+  if (batch_active(reader))
+    flush_batch(reader, perf_header);
+  reader->rb_use_state = RB_NOT_USED;
+  __sync_synchronize();
+  reader->rb_read_tid = 0;
+}
+
+int perf_reader_data_ready(struct perf_reader *reader) {
+  volatile struct perf_event_mmap_page *perf_header = reader->base;
+
+  if (!perf_header)
+    return 0;
+  return read_data_head(perf_header) != perf_header->data_tail;
+}
+
+int perf_reader_peek_time(struct perf_reader *reader, uint64_t *time) {
+  volatile struct perf_event_mmap_page *perf_header = reader->base;
+  uint64_t buffer_size, data_tail;
+  uint8_t *base;
+  struct perf_event_header *e;
+  uint64_t ts = 0;
+  int i;
+
+  if (!perf_header || !reader->sample_time)
+    return 0;
+  data_tail = perf_header->data_tail;
+  if (data_tail == read_data_head(perf_header))
+    return 0;
+
+  buffer_size = (uint64_t)reader->page_size * reader->page_cnt;
+  base = (uint8_t *)reader->base + reader->page_size;
+  // event header is u64-sized and u64-aligned, so it never wraps; the
+  // timestamp right after it may, hence the byte-wise copy
+  e = (void *)(base + data_tail % buffer_size);
+  if (e->type == PERF_RECORD_SAMPLE) {
+    for (i = 0; i < (int)sizeof(ts); i++)
+      ((uint8_t *)&ts)[i] =
+          base[(data_tail + reader->sample_time_offset + i) % buffer_size];
+  }
+  *time = ts;
+  return 1;
+}
+
+int perf_reader_event_read_one(struct perf_reader *reader) {
+  volatile struct perf_event_mmap_page *perf_header = reader->base;
+  uint64_t buffer_size = (uint64_t)reader->page_size * reader->page_cnt;
+  uint8_t *base = (uint8_t *)reader->base + reader->page_size;
+  uint8_t *sentinel = (uint8_t *)reader->base + buffer_size + reader->page_size;
+  uint8_t *begin, *end, *ptr;
+  uint64_t data_tail;
+  int ret = 0;
+
+  if (batch_active(reader))
+    // batch mode withholds data_tail across records; single-record stepping
+    // would defeat it
+    return -1;
+
+  reader->rb_read_tid = syscall(__NR_gettid);
+  if (!__sync_bool_compare_and_swap(&reader->rb_use_state, RB_NOT_USED, RB_USED_IN_READ))
+    return 0;
+
+  data_tail = perf_header->data_tail;
+  if (data_tail != read_data_head(perf_header)) {
+    begin = base + data_tail % buffer_size;
+    struct perf_event_header *e = (void *)begin;
+    ptr = begin;
+    end = base + (data_tail + e->size) % buffer_size;
+    if (end < begin) {
+      // record wraps the ring edge; reassemble it in the scratch buffer
+      if (e->size > reader->buf_size) {
+        void *buf = realloc(reader->buf, e->size);
+        if (!buf) {
+          fprintf(stderr, "%s: cannot allocate scratch buffer\n", __FUNCTION__);
+          goto out;
+        }
+        reader->buf = buf;
+        reader->buf_size = e->size;
+      }
+      size_t len = sentinel - begin;
+      memcpy(reader->buf, begin, len);
+      memcpy((void *)((unsigned long)reader->buf + len), base, e->size - len);
+      ptr = reader->buf;
+    }
+
+    if (e->type == PERF_RECORD_LOST) {
+      uint64_t lost = *(uint64_t *)(ptr + sizeof(*e) + sizeof(uint64_t));
+      bcc_stats_add(BCC_STAT_PERF_LOST, lost);
+      if (reader->lost_cb)
+        reader->lost_cb(reader->cb_cookie, lost);
+      else
+        fprintf(stderr, "Possibly lost %" PRIu64 " samples\n", lost);
+    } else if (e->type == PERF_RECORD_SAMPLE) {
+      bcc_stats_add(BCC_STAT_PERF_EVENTS, 1);
       parse_sw(reader, ptr, e->size);
+    } else if (e->type == PERF_RECORD_MMAP2) {
+      if (reader->mmap_cb && e->size >= sizeof(struct perf_record_mmap2)) {
+        struct perf_record_mmap2 *m = (void *)ptr;
+        reader->mmap_cb(reader->mmap_cb_cookie, (int)m->pid, m->addr, m->len,
+                        m->pgoff, m->filename);
+      }
     } else {
       fprintf(stderr, "%s: unknown sample type %d\n", __FUNCTION__, e->type);
     }
 
-    write_data_tail(perf_header, perf_header->data_tail + e->size);
+    write_data_tail(perf_header, data_tail + e->size);
+    ret = 1;
   }
+
+out:
   reader->rb_use_state = RB_NOT_USED;
   __sync_synchronize();
   reader->rb_read_tid = 0;
+  return ret;
+}
+
+// Persistent reader set built on epoll. Unlike perf_reader_poll(), which
+// re-registers every reader fd on each call, each reader fd is registered
+// with the kernel once at add time and a wait wakes up with only the ready
+// readers, keeping the per-wake cost constant on many-CPU systems.
+struct perf_reader_epoll {
+  int epfd;
+  int num_readers;
+  struct epoll_event *events; // capacity num_readers
+};
+
+struct perf_reader_epoll * perf_reader_epoll_new(void) {
+  struct perf_reader_epoll *ep = calloc(1, sizeof(struct perf_reader_epoll));
+  if (!ep)
+    return NULL;
+  ep->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (ep->epfd < 0) {
+    free(ep);
+    return NULL;
+  }
+  return ep;
+}
+
+void perf_reader_epoll_free(struct perf_reader_epoll *ep) {
+  if (ep) {
+    close(ep->epfd);
+    free(ep->events);
+    free(ep);
+  }
+}
+
+int perf_reader_epoll_add(struct perf_reader_epoll *ep,
+                          struct perf_reader *reader) {
+  struct epoll_event event = {};
+  struct epoll_event *events;
+
+  if (reader->fd < 0) {
+    fprintf(stderr, "%s: reader fd is not set\n", __FUNCTION__);
+    return -1;
+  }
+
+  events = realloc(ep->events,
+                   (ep->num_readers + 1) * sizeof(struct epoll_event));
+  if (!events)
+    return -1;
+  ep->events = events;
+
+  event.events = EPOLLIN;
+  event.data.ptr = reader;
+  if (epoll_ctl(ep->epfd, EPOLL_CTL_ADD, reader->fd, &event) < 0) {
+    perror("epoll_ctl");
+    return -1;
+  }
+  ep->num_readers++;
+  return 0;
+}
+
+int perf_reader_epoll_remove(struct perf_reader_epoll *ep,
+                             struct perf_reader *reader) {
+  if (epoll_ctl(ep->epfd, EPOLL_CTL_DEL, reader->fd, NULL) < 0) {
+    perror("epoll_ctl");
+    return -1;
+  }
+  ep->num_readers--;
+  return 0;
+}
+
+int perf_reader_epoll_wait(struct perf_reader_epoll *ep, int timeout) {
+  int i, cnt;
+
+  cnt = epoll_wait(ep->epfd, ep->events, ep->num_readers, timeout);
+  for (i = 0; i < cnt; i++)
+    perf_reader_event_read(ep->events[i].data.ptr);
+  return cnt;
 }
 
 int perf_reader_poll(int num_readers, struct perf_reader **readers, int timeout) {
@@ -245,10 +685,178 @@ int perf_reader_consume(int num_readers, struct perf_reader **readers) {
   return 0;
 }
 
+int perf_reader_set_batch_cb(struct perf_reader *reader,
+                             perf_reader_batch_cb cb, int max_batch,
+                             int max_latency_us) {
+  if (!cb) {
+    free(reader->batch);
+    reader->batch = NULL;
+    reader->batch_cb = NULL;
+    reader->batch_max = 0;
+    reader->batch_cnt = 0;
+    reader->batch_scratch_used = 0;
+    return 0;
+  }
+  if (max_batch <= 0 || reader->callchain_cb)
+    return -1;
+  struct perf_reader_raw_event *batch =
+      realloc(reader->batch, max_batch * sizeof(*batch));
+  if (!batch)
+    return -1;
+  reader->batch = batch;
+  reader->batch_cb = cb;
+  reader->batch_max = max_batch;
+  reader->batch_cnt = 0;
+  reader->batch_latency_us = max_latency_us;
+  reader->batch_scratch_used = 0;
+  return 0;
+}
+
+int perf_reader_set_callchain_cb(struct perf_reader *reader,
+                                 perf_reader_callchain_cb cb, int max_batch,
+                                 int max_latency_us) {
+  if (!cb) {
+    free(reader->cc_batch);
+    reader->cc_batch = NULL;
+    reader->callchain_cb = NULL;
+    reader->batch_max = 0;
+    reader->batch_cnt = 0;
+    reader->batch_scratch_used = 0;
+    compute_sample_offsets(reader);
+    return 0;
+  }
+  if (max_batch <= 0 || reader->batch_cb || reader->capture_fd >= 0)
+    return -1;
+  struct perf_reader_callchain_event *batch =
+      realloc(reader->cc_batch, max_batch * sizeof(*batch));
+  if (!batch)
+    return -1;
+  reader->cc_batch = batch;
+  reader->callchain_cb = cb;
+  reader->batch_max = max_batch;
+  reader->batch_cnt = 0;
+  reader->batch_latency_us = max_latency_us;
+  reader->batch_scratch_used = 0;
+  compute_sample_offsets(reader);
+  return 0;
+}
+
 void perf_reader_set_fd(struct perf_reader *reader, int fd) {
   reader->fd = fd;
 }
 
+void perf_reader_set_mmap_cb(struct perf_reader *reader,
+                             perf_reader_mmap_cb mmap_cb, void *cb_cookie) {
+  reader->mmap_cb = mmap_cb;
+  reader->mmap_cb_cookie = cb_cookie;
+}
+
+void perf_reader_set_hugetlb(struct perf_reader *reader, int use_hugetlb) {
+  reader->use_hugetlb = use_hugetlb;
+}
+
+void perf_reader_set_sample_time(struct perf_reader *reader, int sample_time) {
+  reader->sample_time = sample_time;
+  compute_sample_offsets(reader);
+}
+
 int perf_reader_fd(struct perf_reader *reader) {
   return reader->fd;
 }
+
+int perf_reader_set_capture_fd(struct perf_reader *reader, int fd) {
+  if (batch_active(reader))
+    return -1;
+  reader->capture_fd = fd;
+  reader->capture_hdr_written = 0;
+  return 0;
+}
+
+static int read_full(int fd, void *buf, size_t len) {
+  uint8_t *p = buf;
+  size_t got = 0;
+  while (got < len) {
+    ssize_t n = read(fd, p + got, len - got);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0)
+      break;
+    got += n;
+  }
+  return (int)got;
+}
+
+int64_t perf_reader_replay(int fd, perf_reader_raw_cb raw_cb,
+                           perf_reader_lost_cb lost_cb, void *cb_cookie) {
+  struct perf_capture_hdr hdr;
+  void *buf = NULL;
+  size_t buf_size = 0;
+  int64_t samples = 0;
+
+  if (read_full(fd, &hdr, sizeof(hdr)) != (int)sizeof(hdr) ||
+      hdr.magic != PERF_CAPTURE_MAGIC || hdr.version != 1) {
+    fprintf(stderr, "%s: not a perf capture stream\n", __FUNCTION__);
+    return -1;
+  }
+
+  for (;;) {
+    struct perf_event_header e;
+    int n = read_full(fd, &e, sizeof(e));
+    if (n == 0)
+      break;  // clean end of stream
+    if (n != (int)sizeof(e) || e.size < sizeof(e)) {
+      fprintf(stderr, "%s: truncated record header\n", __FUNCTION__);
+      samples = -1;
+      break;
+    }
+    if (e.size > buf_size) {
+      void *p = realloc(buf, e.size);
+      if (!p) {
+        samples = -1;
+        break;
+      }
+      buf = p;
+      buf_size = e.size;
+    }
+    memcpy(buf, &e, sizeof(e));
+    if (read_full(fd, (uint8_t *)buf + sizeof(e), e.size - sizeof(e)) !=
+        (int)(e.size - sizeof(e))) {
+      fprintf(stderr, "%s: truncated record body\n", __FUNCTION__);
+      samples = -1;
+      break;
+    }
+
+    if (e.type == PERF_RECORD_LOST) {
+      uint64_t lost =
+          *(uint64_t *)((uint8_t *)buf + sizeof(e) + sizeof(uint64_t));
+      if (lost_cb)
+        lost_cb(cb_cookie, lost);
+      else
+        fprintf(stderr, "Possibly lost %" PRIu64 " samples\n", lost);
+    } else if (e.type == PERF_RECORD_SAMPLE) {
+      // same layout parse_sw performs live, with the decode plan taken
+      // from the capture header instead of the reader
+      uint8_t *ptr = (uint8_t *)buf + hdr.sample_raw_offset;
+      struct {
+          uint32_t size;
+          char data[0];
+      } *raw = (void *)ptr;
+      if (ptr + sizeof(raw->size) > (uint8_t *)buf + e.size ||
+          ptr + sizeof(raw->size) + raw->size > (uint8_t *)buf + e.size) {
+        fprintf(stderr, "%s: corrupt raw sample\n", __FUNCTION__);
+        samples = -1;
+        break;
+      }
+      if (raw_cb)
+        raw_cb(cb_cookie, raw->data, raw->size);
+      samples++;
+    }
+    // other record types (e.g. throttle notifications) are skipped
+  }
+
+  free(buf);
+  return samples;
+}
@@ -31,11 +31,104 @@ struct perf_reader * perf_reader_new(perf_reader_raw_cb raw_cb,
 void perf_reader_free(void *ptr);
 int perf_reader_mmap(struct perf_reader *reader);
 void perf_reader_event_read(struct perf_reader *reader);
+/* non-blocking readiness probe: returns nonzero when the ring holds unread
+ * data, by comparing the mmap'd head and tail without any syscall. Cheap
+ * enough for a busy-spin loop. */
+int perf_reader_data_ready(struct perf_reader *reader);
+/* timestamp-ordered consumption, for merging several per-CPU rings into one
+ * globally ordered stream. The ring must have been opened with
+ * bcc_perf_buffer_opts.sample_time so samples carry PERF_SAMPLE_TIME.
+ * peek_time reports the perf-clock timestamp of the next record without
+ * consuming it: returns 1 with *time set (0 for records that carry no
+ * timestamp, e.g. lost-sample notifications, so they drain ahead of any
+ * sample), or 0 when the ring is empty or timestamps were not requested.
+ * event_read_one consumes exactly the record at the tail, invoking the
+ * usual callbacks; returns 1 when a record was consumed, 0 on an empty
+ * ring, -1 in batch mode (use perf_reader_event_read there). */
+int perf_reader_peek_time(struct perf_reader *reader, uint64_t *time);
+int perf_reader_event_read_one(struct perf_reader *reader);
 int perf_reader_poll(int num_readers, struct perf_reader **readers, int timeout);
+/* persistent epoll-based reader set: fds are registered once at add time and
+ * a wait only touches the ready readers */
+struct perf_reader_epoll;
+struct perf_reader_epoll * perf_reader_epoll_new(void);
+void perf_reader_epoll_free(struct perf_reader_epoll *ep);
+int perf_reader_epoll_add(struct perf_reader_epoll *ep,
+                          struct perf_reader *reader);
+int perf_reader_epoll_remove(struct perf_reader_epoll *ep,
+                             struct perf_reader *reader);
+int perf_reader_epoll_wait(struct perf_reader_epoll *ep, int timeout);
 int perf_reader_consume(int num_readers, struct perf_reader **readers);
+/* batched delivery: decoded samples are collected into an array and handed
+ * to the callback in groups of up to max_batch, so per-call bridge overhead
+ * (locking, FFI) is paid once per batch instead of once per event. A batch
+ * is also flushed once max_latency_us has elapsed since its first event, or
+ * when the ring has been drained, whichever comes first. The event data
+ * pointers are only valid for the duration of the callback. Replaces the
+ * raw_cb for sample records; lost records still go to the lost_cb. */
+struct perf_reader_raw_event {
+  void *data;
+  int size;
+};
+typedef void (*perf_reader_batch_cb)(void *cb_cookie,
+                                     struct perf_reader_raw_event *events,
+                                     int cnt);
+int perf_reader_set_batch_cb(struct perf_reader *reader,
+                             perf_reader_batch_cb cb, int max_batch,
+                             int max_latency_us);
+/* callchain sampling mode: for rings opened with sample_type =
+ * PERF_SAMPLE_TID | PERF_SAMPLE_CALLCHAIN (see
+ * bpf_open_perf_sample_callchain), samples are decoded in place and
+ * delivered in batches of up to max_batch like the batch_cb path -- no BPF
+ * program and no stack map involved, so there is no hash-collision loss.
+ * The ips array points into the ring (or the scratch buffer) and is only
+ * valid for the duration of the callback; it still contains the
+ * PERF_CONTEXT_* boundary markers. Mutually exclusive with the raw batch
+ * callback; lost records still go to the lost_cb. */
+struct perf_reader_callchain_event {
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t nr;
+  const uint64_t *ips;
+};
+typedef void (*perf_reader_callchain_cb)(
+    void *cb_cookie, struct perf_reader_callchain_event *events, int cnt);
+int perf_reader_set_callchain_cb(struct perf_reader *reader,
+                                 perf_reader_callchain_cb cb, int max_batch,
+                                 int max_latency_us);
 int perf_reader_fd(struct perf_reader *reader);
 void perf_reader_set_fd(struct perf_reader *reader, int fd);
 
+/* flight-recorder capture: with a capture fd set (>= 0), every
+ * perf_reader_event_read drains the raw ring bytes straight to that fd --
+ * no per-event decode, no callbacks, at most two large writes per sweep --
+ * so capture throughput is bounded by the disk, not the consumer. The file
+ * starts with a perf_capture_hdr and then holds the verbatim record stream;
+ * perf_reader_replay feeds a captured file back through the normal
+ * callback path, returning the number of samples replayed or -1 on a
+ * corrupt stream. Capture is mutually exclusive with batch mode; pass
+ * fd = -1 to return to callback delivery. */
+struct perf_capture_hdr {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t sample_raw_offset; /* decode plan of the capturing reader */
+};
+#define PERF_CAPTURE_MAGIC 0xbccf11e5ca9704f1ULL
+int perf_reader_set_capture_fd(struct perf_reader *reader, int fd);
+int64_t perf_reader_replay(int fd, perf_reader_raw_cb raw_cb,
+                           perf_reader_lost_cb lost_cb, void *cb_cookie);
+// when set before perf_reader_mmap, the ring is mapped with MAP_HUGETLB if
+// the kernel accepts it, reducing dTLB pressure with many rings; silently
+// falls back to normal pages otherwise
+void perf_reader_set_hugetlb(struct perf_reader *reader, int use_hugetlb);
+// must match the perf_event_attr the ring was opened with: when set, samples
+// are parsed with a leading u64 PERF_SAMPLE_TIME field before the raw data
+void perf_reader_set_sample_time(struct perf_reader *reader, int sample_time);
+/* deliver PERF_RECORD_MMAP2 records to mmap_cb during reads; rings without
+ * the callback skip them silently */
+void perf_reader_set_mmap_cb(struct perf_reader *reader,
+                             perf_reader_mmap_cb mmap_cb, void *cb_cookie);
+
 #ifdef __cplusplus
 }
 #endif
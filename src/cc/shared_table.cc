@@ -14,8 +14,14 @@
  * limitations under the License.
  */
 
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
 #include <unistd.h>
+#include <cstring>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
 
 #include "common.h"
 #include "linux/bpf.h"
@@ -45,9 +51,11 @@ class SharedTableStorage : public TableStorageImpl {
     virtual pointer operator->() const override { return &*it_; }
   };
   virtual ~SharedTableStorage() {}
-  virtual bool Find(const string &name, TableStorage::iterator &result) const override;
-  virtual bool Insert(const string &name, TableDesc &&desc) override;
-  virtual bool Delete(const string &name) override;
+  virtual bool Find(const string &name, uint32_t hash,
+                    TableStorage::iterator &result) const override;
+  virtual bool Insert(const string &name, uint32_t hash,
+                      TableDesc &&desc) override;
+  virtual bool Delete(const string &name, uint32_t hash) override;
   virtual unique_ptr<TableStorageIteratorImpl> begin() override;
   virtual unique_ptr<TableStorageIteratorImpl> end() override;
   virtual unique_ptr<TableStorageIteratorImpl> lower_bound(const string &k) override;
@@ -55,10 +63,25 @@ class SharedTableStorage : public TableStorageImpl {
   virtual unique_ptr<TableStorageIteratorImpl> erase(const TableStorageIteratorImpl &it) override;
 
  private:
+  static void index_remove(uint32_t hash,
+                           const std::map<string, TableDesc>::iterator &it);
+
   static std::map<string, TableDesc> tables_;
+  // interned-id index over tables_: Path::hash() -> entry, maintained on
+  // every insert/erase. std::map iterators are stable, so entries stay
+  // valid until the entry itself is removed. A colliding id simply stays
+  // un-indexed and falls back to the ordered map.
+  static std::unordered_map<uint32_t, std::map<string, TableDesc>::iterator>
+      index_;
 };
 
-bool SharedTableStorage::Find(const string &name, TableStorage::iterator &result) const {
+bool SharedTableStorage::Find(const string &name, uint32_t hash,
+                              TableStorage::iterator &result) const {
+  auto idx = index_.find(hash);
+  if (idx != index_.end() && idx->second->first == name) {
+    result = TableStorage::iterator(make_unique<iterator>(idx->second));
+    return true;
+  }
   auto it = tables_.find(name);
   if (it == tables_.end())
     return false;
@@ -66,18 +89,28 @@ bool SharedTableStorage::Find(const string &name, TableStorage::iterator &result
   return true;
 }
 
-bool SharedTableStorage::Insert(const string &name, TableDesc &&desc) {
+bool SharedTableStorage::Insert(const string &name, uint32_t hash,
+                                TableDesc &&desc) {
   auto it = tables_.find(name);
   if (it != tables_.end())
     return false;
-  tables_[name] = std::move(desc);
+  auto res = tables_.emplace(name, std::move(desc));
+  index_.emplace(hash, res.first);
   return true;
 }
 
-bool SharedTableStorage::Delete(const string &name) {
+void SharedTableStorage::index_remove(
+    uint32_t hash, const std::map<string, TableDesc>::iterator &it) {
+  auto idx = index_.find(hash);
+  if (idx != index_.end() && idx->second == it)
+    index_.erase(idx);
+}
+
+bool SharedTableStorage::Delete(const string &name, uint32_t hash) {
   auto it = tables_.find(name);
   if (it == tables_.end())
     return false;
+  index_remove(hash, it);
   tables_.erase(it);
   return true;
 }
@@ -99,11 +132,14 @@ unique_ptr<TableStorageIteratorImpl> SharedTableStorage::erase(const TableStorag
   auto i = tables_.find((*it).first);
   if (i == tables_.end())
     return unique_ptr<iterator>();
+  index_remove(Path::fnv1a(i->first), i);
   return make_unique<iterator>(tables_.erase(i));
 }
 
 // All maps for this process are kept in global static storage.
 std::map<string, TableDesc> SharedTableStorage::tables_;
+std::unordered_map<uint32_t, std::map<string, TableDesc>::iterator>
+    SharedTableStorage::index_;
 
 unique_ptr<TableStorage> createSharedTableStorage() {
   auto t = make_unique<TableStorage>();
@@ -111,4 +147,276 @@ unique_ptr<TableStorage> createSharedTableStorage() {
   t->AddMapTypesVisitor(createJsonMapTypesVisitor());
   return t;
 }
+
+// Cross-process export/import of table metadata and fds. The metadata is
+// laid out as fixed-size records plus a string pool in a memfd that readers
+// map read-only, so N reader processes share one physical copy and attach
+// with plain memcpys instead of parsing; the map fds travel separately via
+// SCM_RIGHTS.
+namespace {
+
+const char kTableExportMagic[] = "bcc-table-export-v2";
+const size_t kFdChunk = 60;
+
+struct ExportHeader {
+  char magic[20];
+  uint32_t count;
+  uint32_t strings_off;
+  uint32_t strings_len;
+};
+
+struct ExportRecord {
+  uint32_t key_off, key_len;
+  uint32_t name_off, name_len;
+  uint32_t key_desc_off, key_desc_len;
+  uint32_t leaf_desc_off, leaf_desc_len;
+  uint32_t type;
+  uint32_t flags;
+  uint64_t key_size;
+  uint64_t leaf_size;
+  uint64_t max_entries;
+  uint32_t btf_key_tid;
+  uint32_t btf_value_tid;
+  uint8_t has_fd;
+  uint8_t is_shared;
+  uint8_t is_extern;
+  uint8_t pad;
+  // ownership lease travels with the desc so an importing supervisor can
+  // tell which (possibly remote) pid holds the map; see TableStorage::Gc()
+  int32_t lease_pid;
+  uint64_t lease_heartbeat_ns;
+};
+
+int send_with_fds(int sock, const void *buf, size_t len, const int *fds,
+                  size_t nfds) {
+  struct msghdr msg = {};
+  struct iovec iov;
+  std::vector<char> cbuf;
+
+  iov.iov_base = const_cast<void *>(buf);
+  iov.iov_len = len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (nfds) {
+    cbuf.resize(CMSG_SPACE(nfds * sizeof(int)));
+    msg.msg_control = cbuf.data();
+    msg.msg_controllen = cbuf.size();
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+  }
+  return sendmsg(sock, &msg, 0) == (ssize_t)len ? 0 : -1;
+}
+
+int recv_with_fds(int sock, void *buf, size_t len, int *fds, size_t max_fds,
+                  size_t *nfds) {
+  struct msghdr msg = {};
+  struct iovec iov;
+  std::vector<char> cbuf(CMSG_SPACE(max_fds * sizeof(int)));
+
+  *nfds = 0;
+  iov.iov_base = buf;
+  iov.iov_len = len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf.data();
+  msg.msg_controllen = cbuf.size();
+  if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != (ssize_t)len)
+    return -1;
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+      continue;
+    size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < n && *nfds < max_fds; i++)
+      fds[(*nfds)++] = ((int *)CMSG_DATA(cmsg))[i];
+  }
+  return 0;
+}
+
+int export_shm_fd() {
+#ifdef __NR_memfd_create
+  int fd = syscall(__NR_memfd_create, "bcc-tables", 1 /* MFD_CLOEXEC */);
+  if (fd >= 0)
+    return fd;
+#endif
+  // kernels without memfd: an unlinked tmpfs file works the same way
+  char tmpl[] = "/dev/shm/bcc-tables.XXXXXX";
+  int fd2 = mkstemp(tmpl);
+  if (fd2 >= 0)
+    unlink(tmpl);
+  return fd2;
+}
+
+int write_all(int fd, const void *buf, size_t len) {
+  const char *p = static_cast<const char *>(buf);
+  while (len) {
+    ssize_t n = write(fd, p, len);
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+}  // namespace
+
+int ExportTables(TableStorage &ts, int sock_fd) {
+  std::vector<ExportRecord> recs;
+  std::vector<int> fds;
+  string pool;
+
+  auto add_str = [&pool](const string &s, uint32_t &off, uint32_t &len) {
+    off = pool.size();
+    len = s.size();
+    pool += s;
+  };
+
+  for (auto it = ts.begin(); it != ts.end(); ++it) {
+    const TableDesc &desc = (*it).second;
+    ExportRecord r = {};
+    add_str((*it).first, r.key_off, r.key_len);
+    add_str(desc.name, r.name_off, r.name_len);
+    add_str(desc.key_desc, r.key_desc_off, r.key_desc_len);
+    add_str(desc.leaf_desc, r.leaf_desc_off, r.leaf_desc_len);
+    r.type = desc.type;
+    r.flags = desc.flags;
+    r.key_size = desc.key_size;
+    r.leaf_size = desc.leaf_size;
+    r.max_entries = desc.max_entries;
+    r.btf_key_tid = desc.btf_key_tid;
+    r.btf_value_tid = desc.btf_value_tid;
+    r.is_shared = desc.is_shared;
+    r.is_extern = desc.is_extern;
+    r.lease_pid = desc.lease_pid;
+    r.lease_heartbeat_ns = desc.lease_heartbeat_ns;
+    if (desc.fd >= 0) {
+      r.has_fd = 1;
+      fds.push_back(desc.fd);
+    }
+    recs.push_back(r);
+  }
+
+  ExportHeader hdr = {};
+  strncpy(hdr.magic, kTableExportMagic, sizeof(hdr.magic) - 1);
+  hdr.count = recs.size();
+  hdr.strings_off = sizeof(hdr) + recs.size() * sizeof(ExportRecord);
+  hdr.strings_len = pool.size();
+  uint32_t blob_size = hdr.strings_off + pool.size();
+
+  int shm = export_shm_fd();
+  if (shm < 0)
+    return -1;
+  if (write_all(shm, &hdr, sizeof(hdr)) ||
+      (recs.size() &&
+       write_all(shm, recs.data(), recs.size() * sizeof(ExportRecord))) ||
+      (pool.size() && write_all(shm, pool.data(), pool.size()))) {
+    close(shm);
+    return -1;
+  }
+
+  int res = send_with_fds(sock_fd, &blob_size, sizeof(blob_size), &shm, 1);
+  close(shm);
+  if (res)
+    return -1;
+
+  for (size_t i = 0; i < fds.size(); i += kFdChunk) {
+    uint32_t n = std::min(kFdChunk, fds.size() - i);
+    if (send_with_fds(sock_fd, &n, sizeof(n), fds.data() + i, n))
+      return -1;
+  }
+  return 0;
+}
+
+int ImportTables(TableStorage &ts, int sock_fd) {
+  uint32_t blob_size = 0;
+  int shm_buf[1];
+  size_t nfds;
+
+  if (recv_with_fds(sock_fd, &blob_size, sizeof(blob_size), shm_buf, 1,
+                    &nfds) ||
+      nfds != 1 || blob_size < sizeof(ExportHeader))
+    return -1;
+  int shm = shm_buf[0];
+
+  char *base =
+      (char *)mmap(nullptr, blob_size, PROT_READ, MAP_SHARED, shm, 0);
+  close(shm);
+  if (base == MAP_FAILED)
+    return -1;
+
+  const ExportHeader *hdr = (const ExportHeader *)base;
+  const ExportRecord *recs = (const ExportRecord *)(base + sizeof(*hdr));
+  if (strncmp(hdr->magic, kTableExportMagic, sizeof(hdr->magic)) != 0 ||
+      hdr->strings_off != sizeof(*hdr) + hdr->count * sizeof(ExportRecord) ||
+      (uint64_t)hdr->strings_off + hdr->strings_len != blob_size) {
+    munmap(base, blob_size);
+    return -1;
+  }
+  const char *pool = base + hdr->strings_off;
+
+  size_t fds_needed = 0;
+  for (uint32_t i = 0; i < hdr->count; i++)
+    if (recs[i].has_fd)
+      fds_needed++;
+
+  std::vector<int> fds;
+  while (fds.size() < fds_needed) {
+    uint32_t n = 0;
+    int chunk[kFdChunk];
+    if (recv_with_fds(sock_fd, &n, sizeof(n), chunk, kFdChunk, &nfds) ||
+        nfds != n || fds.size() + n > fds_needed) {
+      for (int fd : fds)
+        close(fd);
+      munmap(base, blob_size);
+      return -1;
+    }
+    fds.insert(fds.end(), chunk, chunk + n);
+  }
+
+  auto get_str = [&](uint32_t off, uint32_t len, string &out) {
+    if ((uint64_t)off + len > hdr->strings_len)
+      return false;
+    out.assign(pool + off, len);
+    return true;
+  };
+
+  size_t next_fd = 0;
+  int res = 0;
+  for (uint32_t i = 0; i < hdr->count; i++) {
+    const ExportRecord &r = recs[i];
+    string key, name, key_desc, leaf_desc;
+    if (!get_str(r.key_off, r.key_len, key) ||
+        !get_str(r.name_off, r.name_len, name) ||
+        !get_str(r.key_desc_off, r.key_desc_len, key_desc) ||
+        !get_str(r.leaf_desc_off, r.leaf_desc_len, leaf_desc)) {
+      res = -1;
+      break;
+    }
+
+    int fd = r.has_fd ? fds[next_fd++] : -1;
+    TableDesc desc(name, FileDesc(fd), r.type, r.key_size, r.leaf_size,
+                   r.max_entries, r.flags);
+    desc.key_desc = std::move(key_desc);
+    desc.leaf_desc = std::move(leaf_desc);
+    desc.btf_key_tid = r.btf_key_tid;
+    desc.btf_value_tid = r.btf_value_tid;
+    desc.is_shared = r.is_shared;
+    desc.is_extern = r.is_extern;
+    desc.lease_pid = r.lease_pid;
+    desc.lease_heartbeat_ns = r.lease_heartbeat_ns;
+    // a duplicate key means the reader already has this table; the desc
+    // (and its fd) are simply dropped
+    ts.Insert(Path::from_string(key), std::move(desc));
+  }
+
+  // close fds of any records not consumed due to a malformed entry
+  for (; next_fd < fds.size(); next_fd++)
+    close(fds[next_fd]);
+  munmap(base, blob_size);
+  return res;
+}
 }
@@ -16,7 +16,10 @@
 #pragma once
 
 #include <algorithm>
+#include <cstring>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <sys/types.h>
 #include <unordered_map>
@@ -27,6 +30,8 @@
 #include "bcc_syms.h"
 #include "file_desc.h"
 
+struct perf_reader;
+
 class ProcStat {
   std::string procfs_;
   std::string root_symlink_;
@@ -60,6 +65,104 @@ public:
   virtual bool resolve_addr(uint64_t addr, struct bcc_symbol *sym, bool demangle = true) = 0;
   virtual bool resolve_name(const char *module, const char *name,
                             uint64_t *addr) = 0;
+  // Batch variant: resolve count names from one module in a single call;
+  // addrs[i] is 0 when names[i] is unknown. Returns the number resolved.
+  // Derived caches override this when they can amortize per-call work
+  // (module lookup, staleness checks) across the whole batch.
+  virtual size_t resolve_names(const char *module, const char **names,
+                               size_t count, uint64_t *addrs) {
+    size_t resolved = 0;
+    for (size_t i = 0; i < count; i++) {
+      addrs[i] = 0;
+      if (resolve_name(module, names[i], &addrs[i]))
+        resolved++;
+    }
+    return resolved;
+  }
+
+  // Batch variant of resolve_addr: resolves count addresses in one call.
+  // The batch is resolved in ascending address order, so consecutive
+  // lookups walk the module and symbol arrays forward instead of jumping
+  // across them at random; results come back in the callers' order.
+  // Returns the number resolved; syms[i] is zeroed when addrs[i] does not
+  // resolve.
+  virtual size_t resolve_addrs(const uint64_t *addrs, size_t count,
+                               struct bcc_symbol *syms,
+                               bool demangle = true) {
+    std::vector<size_t> order(count);
+    for (size_t i = 0; i < count; i++)
+      order[i] = i;
+    std::sort(order.begin(), order.end(),
+              [&](size_t a, size_t b) { return addrs[a] < addrs[b]; });
+    size_t resolved = 0;
+    for (size_t i : order)
+      if (resolve_addr(addrs[i], &syms[i], demangle))
+        resolved++;
+    return resolved;
+  }
+
+  // Inline-aware variant of resolve_addr: fills frames[] innermost-first
+  // with the chain of inlined functions covering addr, ending with the
+  // enclosing symbol-table frame, and returns the frame count (0 when the
+  // address does not resolve). Caches without inline information resolve
+  // at most the single symtab frame.
+  virtual size_t resolve_addr_inline(uint64_t addr, struct bcc_symbol *frames,
+                                     size_t max_frames,
+                                     bool demangle = true) {
+    if (max_frames == 0 || !resolve_addr(addr, &frames[0], demangle))
+      return 0;
+    return 1;
+  }
+
+  // Event-driven mapping discovery; only process caches implement it (see
+  // ProcSyms::enable_mmap_tracking). The default says "not supported".
+  virtual int enable_mmap_tracking() { return -1; }
+  virtual void disable_mmap_tracking() {}
+};
+
+// On-disk layout of a DWARF inline index: header, then n_ranges sorted
+// disjoint ranges, then n_chain_words uint32_t string-table offsets (the
+// ranges' name chains, innermost-first), then the string table. All offsets
+// and range addresses are module file-relative, the same address space as
+// the symbol table.
+struct bcc_inline_index_header {
+  uint32_t magic;  // BCC_INLINE_INDEX_MAGIC
+  uint32_t version;
+  uint64_t n_ranges;
+  uint64_t n_chain_words;
+  uint64_t strtab_size;
+};
+
+struct bcc_inline_index_range {
+  uint64_t start;
+  uint64_t end;  // [start, end)
+  uint32_t chain_off;
+  uint32_t chain_len;
+};
+
+static const uint32_t BCC_INLINE_INDEX_MAGIC = 0xbcc11de1;
+static const uint32_t BCC_INLINE_INDEX_VERSION = 1;
+
+// mmap'd per-build-id index of DWARF inline ranges, built once from
+// .debug_info by ebpf::build_inline_index() (bcc_debug.h) and consumed here
+// without any DWARF machinery: disjoint module-offset ranges sorted for
+// binary search, each mapping to an innermost-first chain of function names.
+// Discovery is by build-id under BCC_INLINE_INDEX_DIR, like the other
+// on-disk caches. Name pointers handed out point into the mapping and stay
+// valid for the index's lifetime.
+class InlineIndex {
+public:
+  static std::unique_ptr<InlineIndex> load(const char *module_path);
+  ~InlineIndex();
+
+  // fills names[] innermost-first, returns the chain length (0 on no
+  // inline coverage; chains longer than max_names are truncated)
+  size_t lookup(uint64_t offset, const char **names, size_t max_names) const;
+
+private:
+  InlineIndex() = default;
+  void *base_ = nullptr;
+  size_t size_ = 0;
 };
 
 class KSyms : SymbolCache {
@@ -72,11 +175,48 @@ class KSyms : SymbolCache {
     bool operator<(const Symbol &rhs) const { return addr < rhs.addr; }
   };
 
-  std::vector<Symbol> syms_;
+  // one sorted segment per module (plus one for the core kernel), with a
+  // top-level address-range index over the ~150 segment start addresses;
+  // resolving binary-searches the ranges first, and a module load/unload
+  // only rebuilds that module's segment instead of one flat array
+  struct ModSegment {
+    std::vector<Symbol> syms; // sorted by addr
+  };
+  std::unordered_map<std::string, ModSegment> segments_;
+  std::vector<std::pair<uint64_t, const ModSegment *>> ranges_;
   std::unordered_map<std::string, uint64_t> symnames_;
+  bool symnames_stale_ = true;
+  // module set at the time of the last kallsyms scan, and the module filter
+  // consulted by _add_symbol during an incremental merge
+  std::unordered_set<std::string> mods_;
+  const std::unordered_set<std::string> *mod_filter_ = nullptr;
   static void _add_symbol(const char *, const char *, uint64_t, void *);
+  bool refresh_incremental();
+  void finalize_segments(std::vector<ModSegment *> dirty);
+  void build_ranges();
+
+  // Concurrency: once the tables are built, address and name lookups are
+  // pure reads and run concurrently under the shared side of this lock;
+  // the initial kallsyms scan, incremental module merges and name-index
+  // rebuilds take it exclusively. refresh_locked() is the body of
+  // refresh() for callers already holding the exclusive side, and
+  // lookup_addr() is the read-only search usable under the shared side.
+  std::shared_timed_mutex mutex_;
+  void refresh_locked();
+  bool lookup_addr(uint64_t addr, struct bcc_symbol *sym,
+                   bool demangle) const;
+
+  // host-wide shared symbol cache (opt-in via BCC_KSYMS_SHM, see
+  // bcc_syms.cc): when a valid segment is mapped, lookups read the packed
+  // read-only data directly and segments_ stays empty
+  void *shm_base_ = nullptr;
+  size_t shm_size_ = 0;
+  bool shm_load(uint64_t mods_hash);
+  void shm_publish(uint64_t mods_hash) const;
+  void shm_detach();
 
 public:
+  virtual ~KSyms();
   virtual bool resolve_addr(uint64_t addr, struct bcc_symbol *sym, bool demangle = true) override;
   virtual bool resolve_name(const char *unused, const char *name,
                             uint64_t *addr) override;
@@ -91,22 +231,71 @@ class ProcSyms : SymbolCache {
     bool debugfile;
   };
 
+  // Front-coded symbol-name dictionary. Names are staged with add(), then
+  // freeze() sorts them and stores each as (shared-prefix length, suffix)
+  // against its lexicographic predecessor, with every kBucket-th name kept
+  // whole as a decode anchor. Mangled C++ names share long prefixes, so
+  // the blob comes out a fraction of the size of individually allocated
+  // strings (and carries none of their per-node heap overhead). Decoding
+  // is on demand: materialize() walks at most one bucket, and find() does
+  // a binary search over the anchors plus one bucket walk, so address
+  // binary search (which never touches names) is unaffected.
+  class FrontCodedNames {
+   public:
+    // stage one name; returns its id, stable across freeze()
+    uint32_t add(const char *name, uint64_t addr);
+    void freeze();
+    size_t size() const { return count_; }
+    // decode the name staged as id into out
+    void materialize(uint32_t id, std::string &out) const;
+    // lexicographic lookup; duplicate names resolve to the earliest add(),
+    // matching the first-definition-wins semantics of a linear scan
+    bool find(const char *name, uint64_t *addr) const;
+
+   private:
+    static const uint32_t kBucket = 16;
+    struct Staged {
+      std::string name;
+      uint64_t addr;
+    };
+    const char *anchor(uint32_t bucket, std::string &scratch) const;
+    std::vector<Staged> staging_;   // emptied by freeze()
+    std::string blob_;              // front-coded entries, bucket anchors whole
+    std::vector<uint32_t> bucket_off_; // byte offset of each bucket's anchor
+    std::vector<uint32_t> rank_of_id_; // staged id -> lexicographic rank
+    std::vector<uint32_t> id_of_rank_; // inverse, for first-definition wins
+    std::vector<uint64_t> addr_of_id_;
+    uint32_t count_ = 0;
+    bool frozen_ = false;
+  };
+
   struct Symbol {
     Symbol(const std::string *name, uint64_t start, uint64_t size)
-        : is_name_resolved(true), start(start), size(size) {
+        : is_name_resolved(true), is_arena_name(false), start(start),
+          size(size) {
       data.name = name;
     }
     Symbol(size_t section_idx, size_t str_table_idx, size_t str_len, uint64_t start,
            uint64_t size, bool debugfile)
-        : is_name_resolved(false), start(start), size(size) {
+        : is_name_resolved(false), is_arena_name(false), start(start),
+          size(size) {
       data.name_idx.section_idx = section_idx;
       data.name_idx.str_table_idx = str_table_idx;
       data.name_idx.str_len = str_len;
       data.name_idx.debugfile = debugfile;
     }
+    Symbol(uint32_t arena_id, uint64_t start, uint64_t size)
+        : is_name_resolved(false), is_arena_name(true), start(start),
+          size(size) {
+      data.arena_id = arena_id;
+    }
     bool is_name_resolved;
+    // the name lives front-coded in the module's names_ arena and is
+    // decoded (and interned in symnames_) on first access
+    bool is_arena_name;
     union {
       struct NameIdx name_idx;
+      uint32_t arena_id;
       const std::string *name{nullptr};
     } data;
     uint64_t start;
@@ -164,16 +353,62 @@ class ProcSyms : SymbolCache {
     std::string name_;
     std::shared_ptr<ModulePath> path_;
     std::vector<Range> ranges_;
-    bool loaded_;
     bcc_symbol_option *symbol_option_;
     ModuleType type_;
+    // bytes of the perf map already parsed; perf maps are append-only, so
+    // a module preserved across refresh() only reparses the tail
+    uint64_t perf_map_offset_;
 
     // The file offset within the ELF of the SO's first text section.
     uint64_t elf_so_offset_;
     uint64_t elf_so_addr_;
 
-    std::unordered_set<std::string> symnames_;
-    std::vector<Symbol> syms_;
+    // Everything load_sym_table() produces, shareable across ProcSyms
+    // instances: N containers from one base image map the identical
+    // on-disk libc, so EXEC/SO modules resolving to the same
+    // (device, inode, build-id) — under the same symbol options — point
+    // at one SharedTable, parsed once. Per-process state (ranges_, the
+    // SO load bias) stays in the Module. The table's own mutex
+    // serializes loading, lazy name decode and interning, because
+    // sharers each hold only their ProcSyms instance lock.
+    struct SharedTable {
+      std::mutex mutex;
+      bool loaded = false;
+      // interned storage for the names actually handed out to callers:
+      // perf-map symbols, plus arena names decoded on first access.
+      // Interning keeps the c_str pointers (and the demangle-cache keys)
+      // stable.
+      std::unordered_set<std::string> symnames;
+      // front-coded storage for ELF/vdso symbol-table names, frozen at
+      // the end of load_sym_table(); perf maps stay out of it since they
+      // grow while we run
+      FrontCodedNames names;
+      std::vector<Symbol> syms;
+      // start addresses parallel to syms, packed for binary search
+      // without touching the wider Symbol records
+      std::vector<uint64_t> sym_addrs;
+      // front-coded name -> start dictionary, built lazily on the first
+      // find_name so repeated name lookups stay cheap without a full ELF
+      // walk per query. Perf maps are excluded: they grow while we run,
+      // so find_name keeps the streaming scan for them.
+      FrontCodedNames name_dict;
+      bool name_index_built = false;
+    };
+    std::shared_ptr<SharedTable> table_;
+    // registry lookup keyed on (device, inode, build-id) plus the symbol
+    // options; EXEC/SO files share, everything else (perf maps, vdso)
+    // gets a private table. BCC_NO_SHARED_SYMS disables sharing.
+    static std::shared_ptr<SharedTable> shared_table_for(
+        const char *path, ModuleType type, struct bcc_symbol_option *option);
+    // call with table_->mutex held
+    void build_name_index();
+
+    // per-build-id DWARF inline index, probed once on first use; stays
+    // null when no index exists for this module
+    std::unique_ptr<InlineIndex> inline_index_;
+    bool inline_index_checked_ = false;
+    static int _add_name_index(const char *symname, uint64_t start,
+                               uint64_t size, void *p);
 
     void load_sym_table();
 
@@ -192,18 +427,62 @@ class ProcSyms : SymbolCache {
 
   int pid_;
   std::vector<Module> modules_;
+  // perf-map modules carried over from before the last refresh(), reused by
+  // _add_module so their symbol tables survive and only the tail is parsed
+  std::vector<Module> saved_perf_maps_;
   ProcStat procstat_;
   bcc_symbol_option symbol_option_;
+  // each mangled name is demangled at most once per cache lifetime; keyed
+  // by the interned name pointer (stable until refresh() drops modules_)
+  std::unordered_map<const char *, std::string> demangle_cache_;
 
   static int _add_module(mod_info *, int, void *);
   void load_modules();
 
+  // ProcSyms cannot offer a shared read path: with the default options even
+  // a warm lookup may mutate (lazy symbol-name resolution, the demangle
+  // cache, first-touch module loads). A plain mutex around the public entry
+  // points still makes concurrent resolve and refresh safe; refresh_locked()
+  // is the body of refresh() for callers already holding it.
+  std::mutex mutex_;
+  void refresh_locked();
+  bool resolve_addr_locked(uint64_t addr, struct bcc_symbol *sym,
+                           bool demangle);
+
+  // event-driven mapping updates (see enable_mmap_tracking)
+  static void _mmap_record_cb(void *cookie, int pid, uint64_t addr,
+                              uint64_t len, uint64_t pgoff,
+                              const char *filename);
+  void drain_mmap_events_locked();
+  struct perf_reader *mmap_reader_ = nullptr;
+
 public:
   ProcSyms(int pid, struct bcc_symbol_option *option = nullptr);
+  virtual ~ProcSyms();
   virtual void refresh() override;
   virtual bool resolve_addr(uint64_t addr, struct bcc_symbol *sym, bool demangle = true) override;
   virtual bool resolve_name(const char *module, const char *name,
                             uint64_t *addr) override;
+  virtual size_t resolve_names(const char *module, const char **names,
+                               size_t count, uint64_t *addrs) override;
+  // one lock acquisition and staleness check for the whole sorted sweep
+  virtual size_t resolve_addrs(const uint64_t *addrs, size_t count,
+                               struct bcc_symbol *syms,
+                               bool demangle = true) override;
+  virtual size_t resolve_addr_inline(uint64_t addr, struct bcc_symbol *frames,
+                                     size_t max_frames,
+                                     bool demangle = true) override;
+
+  // Event-driven mapping discovery for dlopen-heavy processes: subscribe to
+  // the kernel's PERF_RECORD_MMAP2 side-band stream for pid, and apply new
+  // executable mappings to the cache incrementally. Pending records are
+  // drained at the start of every resolve under the cache lock, so a
+  // dlopen between resolutions costs one ring sweep and one module insert
+  // instead of a full /proc/<pid>/maps re-parse. Returns 0, or -1 when the
+  // perf event cannot be opened (insufficient privilege, or a kernel
+  // symcache with pid -1).
+  virtual int enable_mmap_tracking() override;
+  virtual void disable_mmap_tracking() override;
 };
 
 class BuildSyms {
@@ -236,11 +515,15 @@ class BuildSyms {
     bool resolve_addr(uint64_t offset, struct bcc_symbol*, bool demangle=true);
   };
 
+  // Keyed by the raw build-id bytes as they appear in the trace, so a
+  // per-frame lookup is a single hash probe with no hex conversion.
   std::unordered_map<std::string, std::unique_ptr<Module> > buildmap_;
 
 public:
   BuildSyms() {}
   virtual ~BuildSyms() = default;
   virtual bool add_module(const std::string module_name);
-  virtual bool resolve_addr(std::string build_id, uint64_t offset, struct bcc_symbol *sym, bool demangle = true);
+  /* build_id holds the raw build-id bytes, not their hex representation */
+  virtual bool resolve_addr(const std::string &build_id, uint64_t offset,
+                            struct bcc_symbol *sym, bool demangle = true);
 };
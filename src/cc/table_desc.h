@@ -35,16 +35,17 @@ namespace ebpf {
 typedef std::function<StatusTuple(const char *, void *)> sscanf_fn;
 typedef std::function<StatusTuple(char *, size_t, const void *)> snprintf_fn;
 
-/// TableDesc uniquely stores all of the runtime state for an active bpf table.
-/// The copy constructor/assign operator are disabled since the file handles
-/// owned by this table are not implicitly copyable. One should call the dup()
-/// method if an explicit new handle is required. We define the move operators
-/// so that objects of this class can reside in stl containers.
+/// TableDesc stores all of the runtime state for an active bpf table. Copies
+/// (via the dup() method; the copy constructor stays private so they remain
+/// deliberate) share the underlying map fd, which is closed when the last
+/// descriptor referencing it goes away -- duplicating a descriptor does not
+/// consume another fd. We define the move operators so that objects of this
+/// class can reside in stl containers.
 class TableDesc {
  private:
   TableDesc(const TableDesc &that)
       : name(that.name),
-        fd(that.fd.dup()),
+        fd(that.fd),
         fake_fd(that.fake_fd),
         type(that.type),
         key_size(that.key_size),
@@ -53,12 +54,16 @@ class TableDesc {
         flags(that.flags),
         key_desc(that.key_desc),
         leaf_desc(that.leaf_desc),
+        btf_key_tid(that.btf_key_tid),
+        btf_value_tid(that.btf_value_tid),
         key_sscanf(that.key_sscanf),
         leaf_sscanf(that.leaf_sscanf),
         key_snprintf(that.key_snprintf),
         leaf_snprintf(that.leaf_snprintf),
         is_shared(that.is_shared),
-        is_extern(that.is_extern) {}
+        is_extern(that.is_extern),
+        lease_pid(that.lease_pid),
+        lease_heartbeat_ns(that.lease_heartbeat_ns) {}
 
  public:
   TableDesc()
@@ -68,8 +73,12 @@ class TableDesc {
         leaf_size(0),
         max_entries(0),
         flags(0),
+        btf_key_tid(0),
+        btf_value_tid(0),
         is_shared(false),
-        is_extern(false) {}
+        is_extern(false),
+        lease_pid(-1),
+        lease_heartbeat_ns(0) {}
   TableDesc(const std::string &name, FileDesc &&fd, int type, size_t key_size,
             size_t leaf_size, size_t max_entries, int flags)
       : name(name),
@@ -79,8 +88,12 @@ class TableDesc {
         leaf_size(leaf_size),
         max_entries(max_entries),
         flags(flags),
+        btf_key_tid(0),
+        btf_value_tid(0),
         is_shared(false),
-        is_extern(false) {}
+        is_extern(false),
+        lease_pid(-1),
+        lease_heartbeat_ns(0) {}
   TableDesc(TableDesc &&that) = default;
 
   TableDesc &operator=(TableDesc &&that) = default;
@@ -98,12 +111,22 @@ class TableDesc {
   int flags;
   std::string key_desc;
   std::string leaf_desc;
+  // BTF type ids of the key and leaf types, 0 when the module carries no
+  // BTF. Consumers can resolve the layout from the module's in-memory BTF
+  // via these instead of parsing the JSON descriptions above.
+  unsigned btf_key_tid;
+  unsigned btf_value_tid;
   sscanf_fn key_sscanf;
   sscanf_fn leaf_sscanf;
   snprintf_fn key_snprintf;
   snprintf_fn leaf_snprintf;
   bool is_shared;
   bool is_extern;
+  // Ownership lease for shared-namespace entries: the pid that created (or
+  // last heartbeat) the map, and when. -1/0 means unleased and exempt from
+  // TableStorage::Gc(); see Gc() for the reclamation rules.
+  int lease_pid;
+  uint64_t lease_heartbeat_ns;
 };
 
 /// MapTypesVisitor gets notified of new bpf tables, and has a chance to parse
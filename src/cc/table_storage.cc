@@ -14,10 +14,14 @@
  * limitations under the License.
  */
 
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <clang/AST/Type.h>
 
+#include "libbpf.h"
 #include "table_storage_impl.h"
 
 namespace ebpf {
@@ -32,12 +36,14 @@ TableStorage::TableStorage() {}
 TableStorage::~TableStorage() {}
 void TableStorage::Init(unique_ptr<TableStorageImpl> impl) { impl_ = move(impl); }
 bool TableStorage::Find(const Path &path, TableStorage::iterator &result) const {
-  return impl_->Find(path.to_string(), result);
+  return impl_->Find(path.to_string(), path.hash(), result);
 }
 bool TableStorage::Insert(const Path &path, TableDesc &&desc) {
-  return impl_->Insert(path.to_string(), move(desc));
+  return impl_->Insert(path.to_string(), path.hash(), move(desc));
+}
+bool TableStorage::Delete(const Path &path) {
+  return impl_->Delete(path.to_string(), path.hash());
 }
-bool TableStorage::Delete(const Path &path) { return impl_->Delete(path.to_string()); }
 size_t TableStorage::DeletePrefix(const Path &path) {
   size_t i = 0;
   auto it = lower_bound(path);
@@ -58,6 +64,64 @@ void TableStorage::VisitMapType(TableDesc &desc, clang::ASTContext &C, clang::Qu
     v->Visit(desc, C, key_type, leaf_type);
 }
 
+static uint64_t lease_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+bool TableStorage::Heartbeat(const Path &path) {
+  iterator it;
+  if (!Find(path, it))
+    return false;
+  it->second.lease_pid = ::getpid();
+  it->second.lease_heartbeat_ns = lease_now_ns();
+  return true;
+}
+
+size_t TableStorage::Gc(uint64_t max_age_ns) {
+  uint64_t now = lease_now_ns();
+  size_t reclaimed = 0;
+  std::vector<std::string> drop;
+
+  for (auto it = begin(), up = end(); it != up; ++it) {
+    TableDesc &desc = it->second;
+    if (desc.lease_pid < 0 || desc.fd < 0)
+      continue;
+    bool holder_dead =
+        ::kill(desc.lease_pid, 0) < 0 && errno == ESRCH;
+    bool stale = max_age_ns != 0 && desc.lease_heartbeat_ns != 0 &&
+                 now > desc.lease_heartbeat_ns &&
+                 now - desc.lease_heartbeat_ns > max_age_ns;
+    if (!holder_dead && !stale)
+      continue;
+
+    // recreate the table empty so the name stays attachable while the
+    // abandoned map's memory goes back to the kernel
+    struct bcc_create_map_attr attr = {};
+    attr.map_type = (enum bpf_map_type)desc.type;
+    attr.name = desc.name.c_str();
+    attr.key_size = desc.key_size;
+    attr.value_size = desc.leaf_size;
+    attr.max_entries = desc.max_entries;
+    attr.map_flags = desc.flags;
+    int fd = bcc_create_map_xattr(&attr, true);
+    if (fd >= 0) {
+      desc.fd = fd;  // FileDesc drops the old fd's reference
+      desc.lease_pid = -1;
+      desc.lease_heartbeat_ns = 0;
+    } else {
+      // cannot rebuild (e.g. a map type needing BTF): drop the entry so
+      // the next compile re-inserts it fresh
+      drop.push_back(it->first);
+    }
+    reclaimed++;
+  }
+  for (auto &key : drop)
+    Delete(Path::from_string(key));
+  return reclaimed;
+}
+
 TableStorage::iterator TableStorage::begin() { return impl_->begin(); }
 TableStorage::iterator TableStorage::end() { return impl_->end(); }
 TableStorage::iterator TableStorage::lower_bound(const Path &p) {
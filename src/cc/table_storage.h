@@ -17,6 +17,7 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <iterator>
 #include <map>
 #include <memory>
@@ -30,6 +31,18 @@ namespace ebpf {
 typedef std::map<int, std::tuple<int, std::string, int, int, int, int, int, std::string, std::string>>
         fake_fd_map_def;
 
+// One kernel-struct field access whose offset the clang rewriter baked into
+// a compiled program (every external pointer dereference it rewrites into a
+// probe read). Recorded per module so that loading an AOT artifact on a
+// different kernel can verify the layouts still hold; see
+// verify_kernel_field_offsets() in bcc_btf.cc.
+struct field_access_def {
+  std::string struct_name;
+  std::string field_name;
+  uint64_t bit_offset;
+};
+typedef std::vector<field_access_def> field_accesses_def;
+
 class TableStorageImpl;
 class TableStorageIteratorImpl;
 
@@ -46,11 +59,34 @@ class Path {
     path_.reserve(len);
     for (const auto &s : parts)
       path_ += DELIM + s;
+    hash_ = fnv1a(path_);
   }
   const std::string &to_string() const { return path_; }
+  // Reconstruct a Path from the exact string of an existing path (as
+  // returned by to_string()), e.g. for deserialized table keys.
+  static Path from_string(std::string s) {
+    Path p;
+    p.path_ = std::move(s);
+    p.hash_ = fnv1a(p.path_);
+    return p;
+  }
+  // Interned id of the full path, hashed once at construction. Storage
+  // backends index on it so repeated lookups compare integers instead of
+  // walking string comparisons.
+  uint32_t hash() const { return hash_; }
+
+  static uint32_t fnv1a(const std::string &s) {
+    uint32_t h = 0x811c9dc5u;
+    for (char c : s) {
+      h ^= static_cast<unsigned char>(c);
+      h *= 16777619u;
+    }
+    return h;
+  }
 
  private:
   std::string path_;
+  uint32_t hash_ = 0;
 };
 
 class TableStorage {
@@ -95,6 +131,19 @@ class TableStorage {
   bool Delete(const Path &path);
   size_t DeletePrefix(const Path &path);
 
+  // Ownership leases for shared-namespace maps. Map creation stamps shared
+  // entries with the creating pid (see BPFModule::load_maps); long-lived
+  // holders refresh their claim with Heartbeat(). Gc() reclaims entries
+  // whose holder pid no longer exists, or -- when max_age_ns is nonzero --
+  // whose heartbeat is older than max_age_ns (guarding against pid reuse):
+  // the stale map fd is replaced with a freshly created empty map of the
+  // same shape, so the kernel frees the abandoned map's memory while the
+  // name keeps working for future tools. Returns the number of entries
+  // reclaimed. Intended for a supervisor process that imported the shared
+  // namespace; unleased entries are never touched.
+  bool Heartbeat(const Path &path);
+  size_t Gc(uint64_t max_age_ns);
+
   void AddMapTypesVisitor(std::unique_ptr<MapTypesVisitor>);
   void VisitMapType(TableDesc &desc, clang::ASTContext &C, clang::QualType key_type,
                     clang::QualType leaf_type);
@@ -110,4 +159,16 @@ class TableStorage {
 
 std::unique_ptr<TableStorage> createSharedTableStorage();
 std::unique_ptr<TableStorage> createBpfFsTableStorage();
+
+/// Cross-process table sharing for split compiler/reader deployments.
+/// ExportTables serializes every table in ts into a shared-memory blob and
+/// sends it, plus the map fds, over the connected UNIX-domain socket
+/// sock_fd (fds via SCM_RIGHTS). ImportTables maps the blob read-only and
+/// registers each table under its original key with the received fd, so
+/// reader processes attach without compiling anything or re-deriving
+/// metadata. The JITed string converters do not transfer; imported tables
+/// rely on the compile-time codecs of the typed table views. Both return 0
+/// on success, -1 on error.
+int ExportTables(TableStorage &ts, int sock_fd);
+int ImportTables(TableStorage &ts, int sock_fd);
 }
@@ -38,9 +38,13 @@ class TableStorageIteratorImpl {
 class TableStorageImpl {
  public:
   virtual ~TableStorageImpl(){};
-  virtual bool Find(const std::string &name, TableStorage::iterator &result) const = 0;
-  virtual bool Insert(const std::string &name, TableDesc &&desc) = 0;
-  virtual bool Delete(const std::string &name) = 0;
+  // hash is Path::hash() of name, precomputed by the caller; backends may
+  // use it as an interned id to avoid string comparisons on the fast path.
+  virtual bool Find(const std::string &name, uint32_t hash,
+                    TableStorage::iterator &result) const = 0;
+  virtual bool Insert(const std::string &name, uint32_t hash,
+                      TableDesc &&desc) = 0;
+  virtual bool Delete(const std::string &name, uint32_t hash) = 0;
   virtual std::unique_ptr<TableStorageIteratorImpl> begin() = 0;
   virtual std::unique_ptr<TableStorageIteratorImpl> end() = 0;
   virtual std::unique_ptr<TableStorageIteratorImpl> lower_bound(const std::string &k) = 0;
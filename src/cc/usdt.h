@@ -15,8 +15,10 @@
  */
 #pragma once
 
+#include <map>
 #include <memory>
 #include <string>
+#include <tuple>
 #include <unordered_map>
 #include <vector>
 
@@ -37,6 +39,11 @@ using std::experimental::optional;
 using std::experimental::nullopt;
 class ArgumentParser;
 
+// True when the kernel accepts a ref_ctr_offset on uprobe creation and
+// manages USDT semaphores itself; Probe::enable/disable then skip the
+// process_vm writes and attach paths pass the semaphore offset instead.
+bool uprobe_ref_ctr_supported();
+
 static const std::string USDT_PROGRAM_HEADER =
     "#include <uapi/linux/ptrace.h>\n";
 
@@ -167,50 +174,7 @@ public:
 
 class ArgumentParser_x64 : public ArgumentParser {
 private:
-  enum Register {
-    X64_REG_A,
-    X64_REG_B,
-    X64_REG_C,
-    X64_REG_D,
-    X64_REG_SI,
-    X64_REG_DI,
-    X64_REG_BP,
-    X64_REG_SP,
-    X64_REG_8,
-    X64_REG_9,
-    X64_REG_10,
-    X64_REG_11,
-    X64_REG_12,
-    X64_REG_13,
-    X64_REG_14,
-    X64_REG_15,
-    X64_REG_RIP,
-    X64_REG_XMM0,
-    X64_REG_XMM1,
-    X64_REG_XMM2,
-    X64_REG_XMM3,
-    X64_REG_XMM4,
-    X64_REG_XMM5,
-    X64_REG_XMM6,
-    X64_REG_XMM7,
-    X64_REG_XMM8,
-    X64_REG_XMM9,
-    X64_REG_XMM10,
-    X64_REG_XMM11,
-    X64_REG_XMM12,
-    X64_REG_XMM13,
-    X64_REG_XMM14,
-    X64_REG_XMM15,
-  };
-
-  struct RegInfo {
-    Register reg;
-    int size;
-  };
-
-  static const std::unordered_map<std::string, RegInfo> registers_;
   bool normalize_register(std::string *reg, int *reg_size);
-  void reg_to_name(std::string *norm, Register reg);
   ssize_t parse_register(ssize_t pos, std::string &name, int &size);
   ssize_t parse_identifier(ssize_t pos, optional<std::string> *ident);
   ssize_t parse_base_register(ssize_t pos, Argument *dest);
@@ -227,7 +191,18 @@ public:
 struct Location {
   uint64_t address_;
   std::string bin_path_;
+  // raw stapsdt argument format; Argument objects are materialized from it
+  // on first access through arguments(). Enumerating a binary's probes
+  // therefore never parses argument expressions -- only probes actually
+  // selected for attachment (or argument inspection) pay for it.
+  std::string arg_fmt_;
   std::vector<Argument> arguments_;
+  bool arguments_parsed_ = false;
+  // whitespace-separated token count of arg_fmt_, i.e. the argument count,
+  // available without parsing
+  size_t num_arguments_;
+  std::vector<Argument> &arguments();
+  size_t num_arguments() const { return num_arguments_; }
   Location(uint64_t addr, const std::string &bin_path, const char *arg_fmt);
 };
 
@@ -261,16 +236,23 @@ public:
         const optional<int> &pid, uint8_t mod_match_inode_only = 1);
 
   size_t num_locations() const { return locations_.size(); }
-  size_t num_arguments() const { return locations_.front().arguments_.size(); }
+  size_t num_arguments() const { return locations_.front().num_arguments(); }
   uint64_t semaphore()   const { return semaphore_; }
   uint64_t semaphore_offset() const { return semaphore_offset_; }
 
   uint64_t address(size_t n = 0) const { return locations_[n].address_; }
   const char *location_bin_path(size_t n = 0) const { return locations_[n].bin_path_.c_str(); }
-  const Location &location(size_t n) const { return locations_[n]; }
-
-  bool usdt_getarg(std::ostream &stream);
-  bool usdt_getarg(std::ostream &stream, const std::string& probe_func);
+  Location &location(size_t n) { return locations_[n]; }
+
+  bool usdt_getarg(std::ostream &stream,
+                   std::map<std::string, std::string> *shared_args = nullptr);
+  // shared_args, when given, deduplicates accessor bodies across probes:
+  // probes whose argument has the same register/deref access sequence get
+  // thin always_inline wrappers around one shared body (keyed by the
+  // generated body text), so dozens of probes with identical layouts do
+  // not multiply the C text the frontend has to expand.
+  bool usdt_getarg(std::ostream &stream, const std::string& probe_func,
+                   std::map<std::string, std::string> *shared_args = nullptr);
   std::string get_arg_ctype(int arg_index) {
     return largest_arg_type(arg_index);
   }
@@ -298,6 +280,9 @@ public:
 
 class Context {
   std::vector<std::unique_ptr<Probe>> probes_;
+  // "provider:name" -> index into probes_; valid only while enumerating,
+  // callers may later remove probes without updating it
+  std::unordered_map<std::string, size_t> probe_index_;
   std::unordered_set<std::string> modules_;
 
   optional<int> pid_;
@@ -305,10 +290,32 @@ class Context {
   std::string cmd_bin_path_;
   bool loaded_;
 
+  // serialized probe records for the build-id cache; only populated while
+  // enumerating a binary whose cache entry is being written
+  std::string cache_records_;
+
   static void _each_probe(const char *binpath, const struct bcc_elf_usdt *probe,
                           void *p);
+  static void _each_probe_record(const char *binpath,
+                                 const struct bcc_elf_usdt *probe, void *p);
   static int _each_module(mod_info *, int enter_ns, void *p);
 
+  // bcc_elf_foreach_usdt with an optional on-disk cache of parsed probe
+  // metadata keyed by the binary's build-id (enabled by setting
+  // BCC_USDT_CACHE_DIR); repeat instrumentation of an already-seen binary
+  // skips ELF note parsing entirely.
+  int foreach_usdt_cached(const std::string &path);
+  bool load_probes_from_cache(const std::string &cache_path,
+                              const std::string &bin_path);
+  void store_probes_to_cache(const std::string &cache_path);
+
+  // module paths collected by _each_module, scanned by scan_modules():
+  // serially by default, or on a worker team when BCC_USDT_SCAN_THREADS is
+  // set above 1. The thread count doubles as the fd budget, since each
+  // worker holds at most one ELF open at a time.
+  std::vector<std::string> module_paths_;
+  void scan_modules();
+
   void add_probe(const char *binpath, const struct bcc_elf_usdt *probe);
   std::string resolve_bin_path(const std::string &bin_path);
   Probe *get_checked(const std::string &provider_name,
@@ -339,11 +346,21 @@ public:
   bool addsem_probe(const std::string &provider_name,
                     const std::string &probe_name, const std::string &fn_name,
                     int16_t val);
+  // Enable a batch of (provider, probe, fn_name) entries at once. The
+  // semaphore raises for the whole batch are grouped into a single remote
+  // write to the target process, instead of one /proc/<pid>/mem round trip
+  // per probe. Either every entry is enabled or none is.
+  bool enable_probes(
+      const std::vector<std::tuple<std::string, std::string, std::string>>
+          &probes);
 
   typedef void (*each_cb)(struct bcc_usdt *);
   void each(each_cb callback);
 
-  typedef void (*each_uprobe_cb)(const char *, const char *, uint64_t, int);
+  // binpath, fn_name, address, pid, ref_ctr_offset (0 when the semaphore
+  // was already raised in userspace or the probe has none)
+  typedef void (*each_uprobe_cb)(const char *, const char *, uint64_t, int,
+                                 uint64_t);
   void each_uprobe(each_uprobe_cb callback);
 
   friend class ::ebpf::BPF;
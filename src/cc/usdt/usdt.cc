@@ -14,13 +14,22 @@
  * limitations under the License.
  */
 #include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <mutex>
 #include <sstream>
+#include <thread>
+#include <tuple>
 #include <unordered_set>
 
 #include <fcntl.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "bcc_elf.h"
@@ -32,29 +41,79 @@
 
 namespace USDT {
 
+/*
+ * Kernels ~4.20 and later support specifying the ref_ctr_offset as an argument
+ * to attaching a uprobe, which negates the need to seek to this memory offset
+ * in userspace to manage semaphores, as the kernel will do it for us.  This
+ * helper function checks if this support is available by reading the uprobe
+ * format for this value, added in a6ca88b241d5e929e6e60b12ad8cd288f0ffa
+*/
+bool uprobe_ref_ctr_supported() {
+  static bool supported = [] {
+    const char *ref_ctr_pmu_path =
+        "/sys/bus/event_source/devices/uprobe/format/ref_ctr_offset";
+    const char *ref_ctr_pmu_expected = "config:32-63\0";
+    char ref_ctr_pmu_fmt[64];  // in Linux source this buffer is compared vs
+                               // PAGE_SIZE, but 64 is probably ample
+    int fd = ::open(ref_ctr_pmu_path, O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    int ret = ::read(fd, ref_ctr_pmu_fmt, sizeof(ref_ctr_pmu_fmt));
+    ::close(fd);
+    if (ret < 0)
+      return false;
+    return ::strncmp(ref_ctr_pmu_expected, ref_ctr_pmu_fmt,
+                     strlen(ref_ctr_pmu_expected)) == 0;
+  }();
+  return supported;
+}
+
 Location::Location(uint64_t addr, const std::string &bin_path, const char *arg_fmt)
     : address_(addr),
-      bin_path_(bin_path) {
+      bin_path_(bin_path),
+      arg_fmt_(arg_fmt) {
+  // one argument per whitespace-separated token; counting them here keeps
+  // num_arguments() available without parsing the expressions
+  size_t ntokens = 0;
+  bool in_token = false;
+  for (const char *p = arg_fmt; *p; ++p) {
+    if (isspace(*p))
+      in_token = false;
+    else if (!in_token) {
+      ntokens++;
+      in_token = true;
+    }
+  }
+  num_arguments_ = ntokens;
+}
+
+std::vector<Argument> &Location::arguments() {
+  if (arguments_parsed_)
+    return arguments_;
 
 #ifdef __aarch64__
-  ArgumentParser_aarch64 parser(arg_fmt);
+  ArgumentParser_aarch64 parser(arg_fmt_.c_str());
 #elif __loongarch64
-  ArgumentParser_loongarch64 parser(arg_fmt);
+  ArgumentParser_loongarch64 parser(arg_fmt_.c_str());
 #elif __powerpc64__
-  ArgumentParser_powerpc64 parser(arg_fmt);
+  ArgumentParser_powerpc64 parser(arg_fmt_.c_str());
 #elif __s390x__
-  ArgumentParser_s390x parser(arg_fmt);
+  ArgumentParser_s390x parser(arg_fmt_.c_str());
 #elif __riscv
-  ArgumentParser_riscv64 parser(arg_fmt);
+  ArgumentParser_riscv64 parser(arg_fmt_.c_str());
 #else
-  ArgumentParser_x64 parser(arg_fmt);
+  ArgumentParser_x64 parser(arg_fmt_.c_str());
 #endif
+  arguments_.reserve(num_arguments_);
   while (!parser.done()) {
     Argument arg;
     if (!parser.parse(&arg))
       continue;
     arguments_.push_back(std::move(arg));
   }
+  arguments_parsed_ = true;
+  return arguments_;
 }
 
 Probe::Probe(const char *bin_path, const char *provider, const char *name,
@@ -70,10 +129,12 @@ Probe::Probe(const char *bin_path, const char *provider, const char *name,
       {}
 
 bool Probe::in_shared_object(const std::string &bin_path) {
-    if (object_type_map_.find(bin_path) == object_type_map_.end()) {
-      return (object_type_map_[bin_path] = bcc_elf_is_shared_obj(bin_path.c_str()));
-    }
-    return object_type_map_[bin_path];
+    auto it = object_type_map_.find(bin_path);
+    if (it == object_type_map_.end())
+      it = object_type_map_
+               .emplace(bin_path, bcc_elf_is_shared_obj(bin_path.c_str()))
+               .first;
+    return it->second;
 }
 
 bool Probe::resolve_global_address(uint64_t *global, const std::string &bin_path,
@@ -87,9 +148,103 @@ bool Probe::resolve_global_address(uint64_t *global, const std::string &bin_path
   return true;
 }
 
-bool Probe::add_to_semaphore(int16_t val) {
-  assert(pid_);
+namespace {
+// Reference counts for target-side USDT semaphores, keyed by (pid, resolved
+// address), shared by every Context in this process. Several probes may sit
+// behind one semaphore (typically when it lives in a shared library), and the
+// target only tests the counter for non-zero; tracking our references here
+// lets us touch each semaphore once per process instead of once per
+// (probe, pid) pair.
+class SemaphoreRegistry {
+public:
+  static SemaphoreRegistry &instance() {
+    static SemaphoreRegistry registry;
+    return registry;
+  }
+
+  // Adjust our reference count by val and return the increment (+1, -1 or 0)
+  // that actually has to reach the target process: +1 when the count rises
+  // from zero, -1 when it falls back to zero, 0 otherwise.
+  int16_t adjust(int pid, uint64_t addr, int16_t val) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto key = std::make_pair(pid, addr);
+    int previous = counts_[key];
+    int current = previous + val;
+    if (current > 0)
+      counts_[key] = current;
+    else
+      counts_.erase(key);
+    return (current > 0 ? 1 : 0) - (previous > 0 ? 1 : 0);
+  }
+
+private:
+  std::mutex mutex_;
+  std::map<std::pair<int, uint64_t>, int> counts_;
+};
+
+// Apply a batch of int16 semaphore increments to one target process: a single
+// process_vm_readv gathers the current values and a single process_vm_writev
+// stores the updated ones (chunked at IOV_MAX). When process_vm access is
+// denied (e.g. Yama restrictions that still allow /proc access), fall back to
+// one open of /proc/<pid>/mem with a pread/pwrite pair per semaphore.
+bool write_semaphores(int pid, const std::vector<uint64_t> &addrs,
+                      const std::vector<int16_t> &deltas) {
+  size_t total = addrs.size();
+  if (total == 0)
+    return true;
+
+  std::vector<int16_t> values(total);
+  std::vector<struct iovec> local(std::min(total, (size_t)IOV_MAX));
+  std::vector<struct iovec> remote(local.size());
+
+  size_t applied = 0;
+  bool vm_ok = true;
+  for (size_t off = 0; off < total && vm_ok; off += IOV_MAX) {
+    size_t cnt = std::min(total - off, (size_t)IOV_MAX);
+    for (size_t i = 0; i < cnt; ++i) {
+      local[i].iov_base = &values[off + i];
+      local[i].iov_len = 2;
+      remote[i].iov_base = reinterpret_cast<void *>(addrs[off + i]);
+      remote[i].iov_len = 2;
+    }
+    if (::process_vm_readv(pid, local.data(), cnt, remote.data(), cnt, 0) !=
+        static_cast<ssize_t>(cnt * 2)) {
+      vm_ok = false;
+      break;
+    }
+    for (size_t i = 0; i < cnt; ++i)
+      values[off + i] += deltas[off + i];
+    ssize_t written =
+        ::process_vm_writev(pid, local.data(), cnt, remote.data(), cnt, 0);
+    if (written > 0)
+      applied += written / 2;
+    if (written != static_cast<ssize_t>(cnt * 2))
+      vm_ok = false;
+  }
+  if (vm_ok)
+    return true;
+
+  std::string procmem = tfm::format("/proc/%d/mem", pid);
+  int memfd = ::open(procmem.c_str(), O_RDWR);
+  if (memfd < 0)
+    return false;
 
+  for (size_t i = applied; i < total; ++i) {
+    int16_t value;
+    off_t address = static_cast<off_t>(addrs[i]);
+    if (::pread(memfd, &value, 2, address) != 2 ||
+        ::pwrite(memfd, &(value += deltas[i]), 2, address) != 2) {
+      ::close(memfd);
+      return false;
+    }
+  }
+
+  ::close(memfd);
+  return true;
+}
+}  // namespace
+
+bool Probe::lookup_semaphore_addr(uint64_t *address) {
   if (!attached_semaphore_) {
     uint64_t addr;
     if (!resolve_global_address(&addr, bin_path_, semaphore_))
@@ -97,30 +252,25 @@ bool Probe::add_to_semaphore(int16_t val) {
     attached_semaphore_ = addr;
   }
 
-  off_t address = static_cast<off_t>(attached_semaphore_.value());
-
-  std::string procmem = tfm::format("/proc/%d/mem", pid_.value());
-  int memfd = ::open(procmem.c_str(), O_RDWR);
-  if (memfd < 0)
-    return false;
+  *address = attached_semaphore_.value();
+  return true;
+}
 
-  int16_t original;
+bool Probe::add_to_semaphore(int16_t val) {
+  assert(pid_);
 
-  if (::lseek(memfd, address, SEEK_SET) < 0 ||
-      ::read(memfd, &original, 2) != 2) {
-    ::close(memfd);
+  uint64_t address;
+  if (!lookup_semaphore_addr(&address))
     return false;
-  }
 
-  original = original + val;
+  int16_t delta = SemaphoreRegistry::instance().adjust(pid_.value(), address, val);
+  if (delta == 0)
+    return true;
 
-  if (::lseek(memfd, address, SEEK_SET) < 0 ||
-      ::write(memfd, &original, 2) != 2) {
-    ::close(memfd);
+  if (!write_semaphores(pid_.value(), {address}, {delta})) {
+    SemaphoreRegistry::instance().adjust(pid_.value(), address, -val);
     return false;
   }
-
-  ::close(memfd);
   return true;
 }
 
@@ -128,7 +278,10 @@ bool Probe::enable(const std::string &fn_name) {
   if (attached_to_)
     return false;
 
-  if (need_enable()) {
+  // when the kernel manages the semaphore via the uprobe ref_ctr_offset
+  // (each_uprobe hands the offset to the attach), there is nothing to
+  // write into the target process here
+  if (need_enable() && !uprobe_ref_ctr_supported()) {
     if (!pid_)
       return false;
 
@@ -146,7 +299,7 @@ bool Probe::disable() {
 
   attached_to_ = nullopt;
 
-  if (need_enable()) {
+  if (need_enable() && !uprobe_ref_ctr_supported()) {
     assert(pid_);
     return add_to_semaphore(-1);
   }
@@ -156,7 +309,7 @@ bool Probe::disable() {
 const char *Probe::largest_arg_type(size_t arg_n) {
   Argument *largest = nullptr;
   for (Location &location : locations_) {
-    Argument *candidate = &location.arguments_[arg_n];
+    Argument *candidate = &location.arguments()[arg_n];
     if (!largest ||
         std::abs(candidate->arg_size()) > std::abs(largest->arg_size()))
       largest = candidate;
@@ -166,15 +319,17 @@ const char *Probe::largest_arg_type(size_t arg_n) {
   return largest->ctype_name();
 }
 
-bool Probe::usdt_getarg(std::ostream &stream) {
+bool Probe::usdt_getarg(std::ostream &stream,
+                        std::map<std::string, std::string> *shared_args) {
   if (!attached_to_ || attached_to_->empty())
     return false;
 
-  return usdt_getarg(stream, attached_to_.value());
+  return usdt_getarg(stream, attached_to_.value(), shared_args);
 }
 
-bool Probe::usdt_getarg(std::ostream &stream, const std::string& probe_func) {
-  const size_t arg_count = locations_[0].arguments_.size();
+bool Probe::usdt_getarg(std::ostream &stream, const std::string& probe_func,
+                        std::map<std::string, std::string> *shared_args) {
+  const size_t arg_count = locations_[0].num_arguments();
 
   if (arg_count == 0)
     return true;
@@ -188,27 +343,26 @@ bool Probe::usdt_getarg(std::ostream &stream, const std::string& probe_func) {
     std::string ctype = largest_arg_type(arg_n);
     std::string cptr = tfm::format("*((%s *)dest)", ctype);
 
-    tfm::format(stream,
-                "static __always_inline int _bpf_readarg_%s_%d("
-                "struct pt_regs *ctx, void *dest, size_t len) {\n"
-                "  if (len != sizeof(%s)) return -1;\n",
-                probe_func, arg_n + 1, ctype);
+    // generate the accessor body on its own, so identical bodies can be
+    // shared between probes below
+    std::ostringstream body;
+    tfm::format(body, "  if (len != sizeof(%s)) return -1;\n", ctype);
 
     if (locations_.size() == 1) {
       Location &location = locations_.front();
-      stream << "  ";
-      if (!location.arguments_[arg_n].assign_to_local(stream, cptr, location.bin_path_,
+      body << "  ";
+      if (!location.arguments()[arg_n].assign_to_local(body, cptr, location.bin_path_,
                                                       pid_))
         return false;
-      stream << "\n  return 0;\n}\n";
+      body << "\n  return 0;\n";
     } else {
       if (page_offsets.size() == locations_.size())
-        tfm::format(stream, "  switch (PT_REGS_IP(ctx) %% 0x%xULL) {\n", page_size);
+        tfm::format(body, "  switch (PT_REGS_IP(ctx) %% 0x%xULL) {\n", page_size);
       else
-        stream << "  switch (PT_REGS_IP(ctx)) {\n";
+        body << "  switch (PT_REGS_IP(ctx)) {\n";
       for (Location &location : locations_) {
         if (page_offsets.size() == locations_.size()) {
-          tfm::format(stream, "  case 0x%xULL: ", location.address_ % page_size);
+          tfm::format(body, "  case 0x%xULL: ", location.address_ % page_size);
         } else {
           uint64_t global_address;
 
@@ -216,16 +370,44 @@ bool Probe::usdt_getarg(std::ostream &stream, const std::string& probe_func) {
                                       location.address_))
             return false;
 
-          tfm::format(stream, "  case 0x%xULL: ", global_address);
+          tfm::format(body, "  case 0x%xULL: ", global_address);
         }
-        if (!location.arguments_[arg_n].assign_to_local(stream, cptr, location.bin_path_,
+        if (!location.arguments()[arg_n].assign_to_local(body, cptr, location.bin_path_,
                                                         pid_))
           return false;
 
-        stream << " return 0;\n";
+        body << " return 0;\n";
       }
-      stream << "  }\n";
-      stream << "  return -1;\n}\n";
+      body << "  }\n";
+      body << "  return -1;\n";
+    }
+
+    std::string body_str = body.str();
+    if (shared_args) {
+      // probes instrumenting the same library share argument layouts; emit
+      // each distinct access sequence once and alias the per-probe readarg
+      // to it (the wrapper inlines away)
+      auto it = shared_args->find(body_str);
+      if (it == shared_args->end()) {
+        std::string shared_name =
+            tfm::format("_bpf_readarg__body_%d", shared_args->size());
+        tfm::format(stream,
+                    "static __always_inline int %s("
+                    "struct pt_regs *ctx, void *dest, size_t len) {\n%s}\n",
+                    shared_name, body_str);
+        it = shared_args->emplace(std::move(body_str), std::move(shared_name))
+                 .first;
+      }
+      tfm::format(stream,
+                  "static __always_inline int _bpf_readarg_%s_%d("
+                  "struct pt_regs *ctx, void *dest, size_t len) {\n"
+                  "  return %s(ctx, dest, len);\n}\n",
+                  probe_func, arg_n + 1, it->second);
+    } else {
+      tfm::format(stream,
+                  "static __always_inline int _bpf_readarg_%s_%d("
+                  "struct pt_regs *ctx, void *dest, size_t len) {\n%s}\n",
+                  probe_func, arg_n + 1, body_str);
     }
   }
   return true;
@@ -257,6 +439,101 @@ void Context::_each_probe(const char *binpath, const struct bcc_elf_usdt *probe,
   ctx->add_probe(binpath, probe);
 }
 
+void Context::_each_probe_record(const char *binpath,
+                                 const struct bcc_elf_usdt *probe, void *p) {
+  Context *ctx = static_cast<Context *>(p);
+  ctx->add_probe(binpath, probe);
+  // arg_fmt goes last so it may contain spaces; it never contains newlines
+  ctx->cache_records_ +=
+      tfm::format("%x %x %x %x %s %s %s\n", probe->pc, probe->base_addr,
+                  probe->semaphore, probe->semaphore_offset, probe->provider,
+                  probe->name, probe->arg_fmt);
+}
+
+static const char *kUsdtCacheMagic = "bcc-usdt-cache-v1";
+
+// Cache file for the probe metadata of one binary, keyed by its build-id so
+// rebuilt binaries never match a stale entry. Empty if caching is disabled
+// or the binary carries no build-id note.
+static std::string usdt_cache_path(const std::string &bin_path) {
+  const char *dir = ::getenv("BCC_USDT_CACHE_DIR");
+  if (!dir)
+    return "";
+  char buildid[128] = {};
+  if (bcc_elf_get_buildid(bin_path.c_str(), buildid) != 0)
+    return "";
+  return std::string(dir) + "/" + buildid + ".usdt";
+}
+
+int Context::foreach_usdt_cached(const std::string &path) {
+  std::string cache_path = usdt_cache_path(path);
+  if (cache_path.empty())
+    return bcc_elf_foreach_usdt(path.c_str(), _each_probe, this);
+
+  if (load_probes_from_cache(cache_path, path))
+    return 0;
+
+  cache_records_.clear();
+  int res = bcc_elf_foreach_usdt(path.c_str(), _each_probe_record, this);
+  if (res == 0)
+    store_probes_to_cache(cache_path);
+  cache_records_.clear();
+  return res;
+}
+
+bool Context::load_probes_from_cache(const std::string &cache_path,
+                                     const std::string &bin_path) {
+  std::ifstream in(cache_path);
+  std::string line;
+  if (!in || !std::getline(in, line) || line != kUsdtCacheMagic)
+    return false;
+
+  // parse the whole file before adding anything, so a truncated or corrupt
+  // entry never leaves a half-populated context behind
+  std::vector<std::tuple<uint64_t, uint64_t, uint64_t, uint64_t, std::string,
+                         std::string, std::string>> records;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    uint64_t pc, base_addr, semaphore, semaphore_offset;
+    std::string provider, name, arg_fmt;
+    if (!(fields >> std::hex >> pc >> base_addr >> semaphore >>
+          semaphore_offset >> provider >> name))
+      return false;
+    std::getline(fields, arg_fmt);
+    if (!arg_fmt.empty() && arg_fmt[0] == ' ')
+      arg_fmt.erase(0, 1);
+    records.emplace_back(pc, base_addr, semaphore, semaphore_offset,
+                         std::move(provider), std::move(name),
+                         std::move(arg_fmt));
+  }
+
+  for (const auto &r : records) {
+    struct bcc_elf_usdt probe;
+    probe.pc = std::get<0>(r);
+    probe.base_addr = std::get<1>(r);
+    probe.semaphore = std::get<2>(r);
+    probe.semaphore_offset = std::get<3>(r);
+    probe.provider = std::get<4>(r).c_str();
+    probe.name = std::get<5>(r).c_str();
+    probe.arg_fmt = std::get<6>(r).c_str();
+    add_probe(bin_path.c_str(), &probe);
+  }
+  return true;
+}
+
+void Context::store_probes_to_cache(const std::string &cache_path) {
+  // write to a temporary and rename into place, so concurrent readers only
+  // ever see complete entries
+  std::string tmp_path = tfm::format("%s.tmp.%d", cache_path, (int)getpid());
+  std::ofstream out(tmp_path);
+  if (!out)
+    return;
+  out << kUsdtCacheMagic << "\n" << cache_records_;
+  out.close();
+  if (!out || ::rename(tmp_path.c_str(), cache_path.c_str()) != 0)
+    ::unlink(tmp_path.c_str());
+}
+
 int Context::_each_module(mod_info *mod, int enter_ns, void *p) {
   Context *ctx = static_cast<Context *>(p);
 
@@ -269,19 +546,90 @@ int Context::_each_module(mod_info *mod, int enter_ns, void *p) {
   // executable region. We are going to parse the ELF on disk anyway, so we
   // don't need these duplicates.
   if (ctx->modules_.insert(path).second /*inserted new?*/) {
-    bcc_elf_foreach_usdt(path.c_str(), _each_probe, p);
+    ctx->module_paths_.push_back(std::move(path));
   }
   return 0;
 }
 
-void Context::add_probe(const char *binpath, const struct bcc_elf_usdt *probe) {
-  for (auto &p : probes_) {
-    if (p->provider_ == probe->provider && p->name_ == probe->name) {
-      p->add_location(probe->pc, binpath, probe->arg_fmt);
-      return;
+namespace {
+// one stapsdt note copied out of a worker's ELF scan; strings are owned
+// here because bcc_elf_usdt pointers only live for the callback
+struct ScanRecord {
+  uint64_t pc;
+  uint64_t base_addr;
+  uint64_t semaphore;
+  uint64_t semaphore_offset;
+  std::string provider;
+  std::string name;
+  std::string arg_fmt;
+};
+
+void _record_probe(const char *, const struct bcc_elf_usdt *probe, void *p) {
+  auto records = static_cast<std::vector<ScanRecord> *>(p);
+  records->push_back({probe->pc, probe->base_addr, probe->semaphore,
+                      probe->semaphore_offset, probe->provider, probe->name,
+                      probe->arg_fmt});
+}
+}  // namespace
+
+void Context::scan_modules() {
+  int threads = 0;
+  const char *env = ::getenv("BCC_USDT_SCAN_THREADS");
+  if (env)
+    threads = ::atoi(env);
+
+  if (threads <= 1 || module_paths_.size() <= 1) {
+    for (const auto &path : module_paths_)
+      foreach_usdt_cached(path);
+    module_paths_.clear();
+    return;
+  }
+
+  // Parallel mode: each worker scans independent ELFs into its own record
+  // list; the probe list is merged on this thread in module order, so the
+  // result matches the serial scan. The thread count bounds how many ELFs
+  // are open at once. Workers go straight to the ELF notes; the build-id
+  // disk cache only applies to the serial path.
+  size_t nthreads = std::min((size_t)threads, module_paths_.size());
+  std::vector<std::vector<ScanRecord>> results(module_paths_.size());
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < nthreads; t++)
+    workers.emplace_back([&] {
+      for (size_t idx = next++; idx < module_paths_.size(); idx = next++)
+        bcc_elf_foreach_usdt(module_paths_[idx].c_str(), _record_probe,
+                             &results[idx]);
+    });
+  for (auto &w : workers)
+    w.join();
+
+  for (size_t i = 0; i < module_paths_.size(); i++) {
+    for (const auto &rec : results[i]) {
+      struct bcc_elf_usdt probe;
+      probe.pc = rec.pc;
+      probe.base_addr = rec.base_addr;
+      probe.semaphore = rec.semaphore;
+      probe.semaphore_offset = rec.semaphore_offset;
+      probe.provider = rec.provider.c_str();
+      probe.name = rec.name.c_str();
+      probe.arg_fmt = rec.arg_fmt.c_str();
+      add_probe(module_paths_[i].c_str(), &probe);
     }
   }
+  module_paths_.clear();
+}
 
+void Context::add_probe(const char *binpath, const struct bcc_elf_usdt *probe) {
+  // probe_index_ is only maintained during enumeration: processes with many
+  // providers otherwise rescan the whole probe list for every stapsdt note
+  std::string key = std::string(probe->provider) + ":" + probe->name;
+  auto it = probe_index_.find(key);
+  if (it != probe_index_.end()) {
+    probes_[it->second]->add_location(probe->pc, binpath, probe->arg_fmt);
+    return;
+  }
+
+  probe_index_[key] = probes_.size();
   probes_.emplace_back(
     new Probe(binpath, probe->provider, probe->name, probe->semaphore,
               probe->semaphore_offset, pid_, mod_match_inode_only_)
@@ -361,6 +709,59 @@ bool Context::enable_probe(const std::string &provider_name,
   return false;
 }
 
+bool Context::enable_probes(
+    const std::vector<std::tuple<std::string, std::string, std::string>>
+        &probes) {
+  // resolve every (provider, probe, fn) entry before touching the target, so
+  // a bad entry leaves nothing half-enabled
+  std::vector<std::pair<Probe *, const std::string *>> found;
+  for (const auto &req : probes) {
+    Probe *p = get_checked(std::get<0>(req), std::get<1>(req));
+    if (p == nullptr || p->enabled())
+      return false;
+    for (const auto &f : found)
+      if (f.first == p)
+        return false;
+    found.emplace_back(p, &std::get<2>(req));
+  }
+
+  // collect the semaphore raises and apply them as one grouped write; the
+  // registry hands back only the counts that rose from zero, so an address
+  // shared by several probes in the batch reaches the process exactly once
+  std::vector<uint64_t> addrs;
+  std::vector<int16_t> deltas;
+  std::vector<uint64_t> adjusted;
+  bool ok = true;
+  for (const auto &f : found) {
+    if (!f.first->need_enable() || uprobe_ref_ctr_supported())
+      continue;
+    uint64_t addr;
+    if (!pid_ || !f.first->lookup_semaphore_addr(&addr)) {
+      ok = false;
+      break;
+    }
+    int16_t delta = SemaphoreRegistry::instance().adjust(pid_.value(), addr, +1);
+    adjusted.push_back(addr);
+    if (delta != 0) {
+      addrs.push_back(addr);
+      deltas.push_back(delta);
+    }
+  }
+
+  if (ok && !addrs.empty())
+    ok = write_semaphores(pid_.value(), addrs, deltas);
+
+  if (!ok) {
+    for (uint64_t addr : adjusted)
+      SemaphoreRegistry::instance().adjust(pid_.value(), addr, -1);
+    return false;
+  }
+
+  for (const auto &f : found)
+    f.first->attached_to_ = *f.second;
+  return true;
+}
+
 void Context::each(each_cb callback) {
   for (const auto &probe : probes_) {
     struct bcc_usdt info = {0};
@@ -396,9 +797,13 @@ void Context::each_uprobe(each_uprobe_cb callback) {
     if (!p->enabled())
       continue;
 
+    // the semaphore offset only matters when the kernel bumps the counter
+    // at attach time; otherwise enable() already wrote the target process
+    uint64_t ref_ctr_offset =
+        uprobe_ref_ctr_supported() ? p->semaphore_offset() : 0;
     for (Location &loc : p->locations_) {
       callback(loc.bin_path_.c_str(), p->attached_to_->c_str(), loc.address_,
-               pid_.value_or(-1));
+               pid_.value_or(-1), ref_ctr_offset);
     }
   }
 }
@@ -407,7 +812,7 @@ Context::Context(const std::string &bin_path, uint8_t mod_match_inode_only)
     : loaded_(false), mod_match_inode_only_(mod_match_inode_only) {
   std::string full_path = resolve_bin_path(bin_path);
   if (!full_path.empty()) {
-    if (bcc_elf_foreach_usdt(full_path.c_str(), _each_probe, this) == 0) {
+    if (foreach_usdt_cached(full_path) == 0) {
       cmd_bin_path_ = full_path;
       loaded_ = true;
     }
@@ -420,6 +825,7 @@ Context::Context(int pid, uint8_t mod_match_inode_only)
     : pid_(pid), pid_stat_(pid), loaded_(false),
     mod_match_inode_only_(mod_match_inode_only) {
   if (bcc_procutils_each_module(pid, _each_module, this) == 0) {
+    scan_modules();
     cmd_bin_path_ = ebpf::get_pid_exe(pid);
     if (cmd_bin_path_.empty())
       return;
@@ -436,7 +842,7 @@ Context::Context(int pid, const std::string &bin_path,
       mod_match_inode_only_(mod_match_inode_only) {
   std::string full_path = resolve_bin_path(bin_path);
   if (!full_path.empty()) {
-    int res = bcc_elf_foreach_usdt(full_path.c_str(), _each_probe, this);
+    int res = foreach_usdt_cached(full_path);
     if (res == 0) {
       cmd_bin_path_ = ebpf::get_pid_exe(pid);
       if (cmd_bin_path_.empty())
@@ -522,6 +928,18 @@ int bcc_usdt_addsem_fully_specified_probe(void *usdt, const char *provider_name,
   return ctx->addsem_probe(provider_name, probe_name, fn_name, val) ? 0 : -1;
 }
 
+int bcc_usdt_enable_probes(void *usdt, const char **provider_names,
+                           const char **probe_names, const char **fn_names,
+                           int count) {
+  USDT::Context *ctx = static_cast<USDT::Context *>(usdt);
+  std::vector<std::tuple<std::string, std::string, std::string>> probes;
+  probes.reserve(count);
+  for (int i = 0; i < count; i++)
+    probes.emplace_back(provider_names[i] ? provider_names[i] : "",
+                        probe_names[i], fn_names[i]);
+  return ctx->enable_probes(probes) ? 0 : -1;
+}
+
 const char *bcc_usdt_genargs(void **usdt_array, int len) {
   static std::string storage_;
   std::ostringstream stream;
@@ -535,6 +953,10 @@ const char *bcc_usdt_genargs(void **usdt_array, int len) {
   // Each cmd_bin_path + probe_provider + probe_name
   // uniquely identifies a probe.
   std::unordered_set<std::string> generated_probes;
+  // accessor bodies shared across every probe in the batch, keyed by the
+  // generated access sequence; probes with identical argument layouts get
+  // wrappers around one body instead of duplicated C text
+  std::map<std::string, std::string> shared_args;
   for (int i = 0; i < len; i++) {
     USDT::Context *ctx = static_cast<USDT::Context *>(usdt_array[i]);
 
@@ -544,7 +966,7 @@ const char *bcc_usdt_genargs(void **usdt_array, int len) {
         std::string key = ctx->cmd_bin_path() + "*" + p->provider() + "*" + p->name();
         if (generated_probes.find(key) != generated_probes.end())
           continue;
-        if (!p->usdt_getarg(stream))
+        if (!p->usdt_getarg(stream, &shared_args))
           return nullptr;
         generated_probes.insert(key);
       }
@@ -604,8 +1026,8 @@ int bcc_usdt_get_argument(void *usdt, const char *provider_name,
     return -1;
   if (location_index < 0 || (size_t)location_index >= probe->num_locations())
     return -1;
-  auto const &location = probe->location(location_index);
-  auto const &arg = location.arguments_[argument_index];
+  auto &location = probe->location(location_index);
+  auto &arg = location.arguments()[argument_index];
   argument->size = arg.arg_size();
   argument->valid = BCC_USDT_ARGUMENT_NONE;
   if (arg.constant()) {
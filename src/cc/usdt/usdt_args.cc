@@ -14,7 +14,6 @@
  * limitations under the License.
  */
 #include <cmath>
-#include <unordered_map>
 #include <regex>
 
 #include "syms.h"
@@ -675,192 +674,141 @@ bool ArgumentParser_x64::parse(Argument *dest) {
   return true;
 }
 
-const std::unordered_map<std::string, ArgumentParser_x64::RegInfo>
-    ArgumentParser_x64::registers_ = {
-        {"rax", {X64_REG_A, 8}},   {"eax", {X64_REG_A, 4}},
-        {"ax", {X64_REG_A, 2}},    {"al", {X64_REG_A, 1}},
+// x64 register names resolve through a compile-time-verified perfect hash:
+// a name (at most eight bytes, which covers them all) packs little-endian
+// into one u64 key, and slot = (key * kX64RegHashMul) >> 56 is
+// collision-free over all 81 names, so a lookup is one multiply, one shift
+// and one 8-byte compare -- no string hashing, allocation or bucket
+// chains. JVM-sized targets parse thousands of probe locations with
+// several register arguments each, which made the old unordered_map
+// lookups visible in profiles. The static_assert below re-verifies
+// perfection, so a table edit that breaks it fails the build; pick a new
+// multiplier if it ever does.
+struct X64RegEntry {
+  uint64_t key;
+  const char *norm;  // canonical name, as the BPF argument expression uses
+  uint8_t size;
+};
 
-        {"rbx", {X64_REG_B, 8}},   {"ebx", {X64_REG_B, 4}},
-        {"bx", {X64_REG_B, 2}},    {"bl", {X64_REG_B, 1}},
+static constexpr uint64_t x64_reg_key(const char *name) {
+  uint64_t key = 0;
+  for (int i = 0; i < 8 && name[i]; i++)
+    key |= static_cast<uint64_t>(static_cast<unsigned char>(name[i]))
+           << (8 * i);
+  return key;
+}
 
-        {"rcx", {X64_REG_C, 8}},   {"ecx", {X64_REG_C, 4}},
-        {"cx", {X64_REG_C, 2}},    {"cl", {X64_REG_C, 1}},
+static constexpr uint64_t kX64RegHashMul = UINT64_C(0x9e3781312e0e7e65);
 
-        {"rdx", {X64_REG_D, 8}},   {"edx", {X64_REG_D, 4}},
-        {"dx", {X64_REG_D, 2}},    {"dl", {X64_REG_D, 1}},
+static constexpr unsigned x64_reg_slot(uint64_t key) {
+  return static_cast<unsigned>((key * kX64RegHashMul) >> 56);
+}
 
-        {"rsi", {X64_REG_SI, 8}},  {"esi", {X64_REG_SI, 4}},
-        {"si", {X64_REG_SI, 2}},   {"sil", {X64_REG_SI, 1}},
+static constexpr X64RegEntry kX64Regs[] = {
+    {x64_reg_key("rax"), "ax", 8},    {x64_reg_key("eax"), "ax", 4},
+    {x64_reg_key("ax"), "ax", 2},     {x64_reg_key("al"), "ax", 1},
 
-        {"rdi", {X64_REG_DI, 8}},  {"edi", {X64_REG_DI, 4}},
-        {"di", {X64_REG_DI, 2}},   {"dil", {X64_REG_DI, 1}},
+    {x64_reg_key("rbx"), "bx", 8},    {x64_reg_key("ebx"), "bx", 4},
+    {x64_reg_key("bx"), "bx", 2},     {x64_reg_key("bl"), "bx", 1},
 
-        {"rbp", {X64_REG_BP, 8}},  {"ebp", {X64_REG_BP, 4}},
-        {"bp", {X64_REG_BP, 2}},   {"bpl", {X64_REG_BP, 1}},
+    {x64_reg_key("rcx"), "cx", 8},    {x64_reg_key("ecx"), "cx", 4},
+    {x64_reg_key("cx"), "cx", 2},     {x64_reg_key("cl"), "cx", 1},
 
-        {"rsp", {X64_REG_SP, 8}},  {"esp", {X64_REG_SP, 4}},
-        {"sp", {X64_REG_SP, 2}},   {"spl", {X64_REG_SP, 1}},
+    {x64_reg_key("rdx"), "dx", 8},    {x64_reg_key("edx"), "dx", 4},
+    {x64_reg_key("dx"), "dx", 2},     {x64_reg_key("dl"), "dx", 1},
 
-        {"r8", {X64_REG_8, 8}},    {"r8d", {X64_REG_8, 4}},
-        {"r8w", {X64_REG_8, 2}},   {"r8b", {X64_REG_8, 1}},
+    {x64_reg_key("rsi"), "si", 8},    {x64_reg_key("esi"), "si", 4},
+    {x64_reg_key("si"), "si", 2},     {x64_reg_key("sil"), "si", 1},
 
-        {"r9", {X64_REG_9, 8}},    {"r9d", {X64_REG_9, 4}},
-        {"r9w", {X64_REG_9, 2}},   {"r9b", {X64_REG_9, 1}},
+    {x64_reg_key("rdi"), "di", 8},    {x64_reg_key("edi"), "di", 4},
+    {x64_reg_key("di"), "di", 2},     {x64_reg_key("dil"), "di", 1},
 
-        {"r10", {X64_REG_10, 8}},  {"r10d", {X64_REG_10, 4}},
-        {"r10w", {X64_REG_10, 2}}, {"r10b", {X64_REG_10, 1}},
+    {x64_reg_key("rbp"), "bp", 8},    {x64_reg_key("ebp"), "bp", 4},
+    {x64_reg_key("bp"), "bp", 2},     {x64_reg_key("bpl"), "bp", 1},
 
-        {"r11", {X64_REG_11, 8}},  {"r11d", {X64_REG_11, 4}},
-        {"r11w", {X64_REG_11, 2}}, {"r11b", {X64_REG_11, 1}},
+    {x64_reg_key("rsp"), "sp", 8},    {x64_reg_key("esp"), "sp", 4},
+    {x64_reg_key("sp"), "sp", 2},     {x64_reg_key("spl"), "sp", 1},
 
-        {"r12", {X64_REG_12, 8}},  {"r12d", {X64_REG_12, 4}},
-        {"r12w", {X64_REG_12, 2}}, {"r12b", {X64_REG_12, 1}},
+    {x64_reg_key("r8"), "r8", 8},     {x64_reg_key("r8d"), "r8", 4},
+    {x64_reg_key("r8w"), "r8", 2},    {x64_reg_key("r8b"), "r8", 1},
 
-        {"r13", {X64_REG_13, 8}},  {"r13d", {X64_REG_13, 4}},
-        {"r13w", {X64_REG_13, 2}}, {"r13b", {X64_REG_13, 1}},
+    {x64_reg_key("r9"), "r9", 8},     {x64_reg_key("r9d"), "r9", 4},
+    {x64_reg_key("r9w"), "r9", 2},    {x64_reg_key("r9b"), "r9", 1},
 
-        {"r14", {X64_REG_14, 8}},  {"r14d", {X64_REG_14, 4}},
-        {"r14w", {X64_REG_14, 2}}, {"r14b", {X64_REG_14, 1}},
+    {x64_reg_key("r10"), "r10", 8},   {x64_reg_key("r10d"), "r10", 4},
+    {x64_reg_key("r10w"), "r10", 2},  {x64_reg_key("r10b"), "r10", 1},
 
-        {"r15", {X64_REG_15, 8}},  {"r15d", {X64_REG_15, 4}},
-        {"r15w", {X64_REG_15, 2}}, {"r15b", {X64_REG_15, 1}},
+    {x64_reg_key("r11"), "r11", 8},   {x64_reg_key("r11d"), "r11", 4},
+    {x64_reg_key("r11w"), "r11", 2},  {x64_reg_key("r11b"), "r11", 1},
 
-        {"rip", {X64_REG_RIP, 8}},
+    {x64_reg_key("r12"), "r12", 8},   {x64_reg_key("r12d"), "r12", 4},
+    {x64_reg_key("r12w"), "r12", 2},  {x64_reg_key("r12b"), "r12", 1},
 
-        {"xmm0", {X64_REG_XMM0, 16}},
-        {"xmm1", {X64_REG_XMM1, 16}},
-        {"xmm2", {X64_REG_XMM2, 16}},
-        {"xmm3", {X64_REG_XMM3, 16}},
-        {"xmm4", {X64_REG_XMM4, 16}},
-        {"xmm5", {X64_REG_XMM5, 16}},
-        {"xmm6", {X64_REG_XMM6, 16}},
-        {"xmm7", {X64_REG_XMM7, 16}},
-        {"xmm8", {X64_REG_XMM8, 16}},
-        {"xmm9", {X64_REG_XMM9, 16}},
-        {"xmm10", {X64_REG_XMM10, 16}},
-        {"xmm11", {X64_REG_XMM11, 16}},
-        {"xmm12", {X64_REG_XMM12, 16}},
-        {"xmm13", {X64_REG_XMM13, 16}},
-        {"xmm14", {X64_REG_XMM14, 16}},
-        {"xmm15", {X64_REG_XMM15, 16}},
-};
+    {x64_reg_key("r13"), "r13", 8},   {x64_reg_key("r13d"), "r13", 4},
+    {x64_reg_key("r13w"), "r13", 2},  {x64_reg_key("r13b"), "r13", 1},
 
-void ArgumentParser_x64::reg_to_name(std::string *norm, Register reg) {
-  switch (reg) {
-  case X64_REG_A:
-    *norm = "ax";
-    break;
-  case X64_REG_B:
-    *norm = "bx";
-    break;
-  case X64_REG_C:
-    *norm = "cx";
-    break;
-  case X64_REG_D:
-    *norm = "dx";
-    break;
-
-  case X64_REG_SI:
-    *norm = "si";
-    break;
-  case X64_REG_DI:
-    *norm = "di";
-    break;
-  case X64_REG_BP:
-    *norm = "bp";
-    break;
-  case X64_REG_SP:
-    *norm = "sp";
-    break;
-
-  case X64_REG_8:
-    *norm = "r8";
-    break;
-  case X64_REG_9:
-    *norm = "r9";
-    break;
-  case X64_REG_10:
-    *norm = "r10";
-    break;
-  case X64_REG_11:
-    *norm = "r11";
-    break;
-  case X64_REG_12:
-    *norm = "r12";
-    break;
-  case X64_REG_13:
-    *norm = "r13";
-    break;
-  case X64_REG_14:
-    *norm = "r14";
-    break;
-  case X64_REG_15:
-    *norm = "r15";
-    break;
-
-  case X64_REG_RIP:
-    *norm = "ip";
-    break;
-
-  case X64_REG_XMM0:
-    *norm = "xmm0";
-    break;
-  case X64_REG_XMM1:
-    *norm = "xmm1";
-    break;
-  case X64_REG_XMM2:
-    *norm = "xmm2";
-    break;
-  case X64_REG_XMM3:
-    *norm = "xmm3";
-    break;
-  case X64_REG_XMM4:
-    *norm = "xmm4";
-    break;
-  case X64_REG_XMM5:
-    *norm = "xmm5";
-    break;
-  case X64_REG_XMM6:
-    *norm = "xmm6";
-    break;
-  case X64_REG_XMM7:
-    *norm = "xmm7";
-    break;
-  case X64_REG_XMM8:
-    *norm = "xmm8";
-    break;
-  case X64_REG_XMM9:
-    *norm = "xmm9";
-    break;
-  case X64_REG_XMM10:
-    *norm = "xmm10";
-    break;
-  case X64_REG_XMM11:
-    *norm = "xmm11";
-    break;
-  case X64_REG_XMM12:
-    *norm = "xmm12";
-    break;
-  case X64_REG_XMM13:
-    *norm = "xmm13";
-    break;
-  case X64_REG_XMM14:
-    *norm = "xmm14";
-    break;
-  case X64_REG_XMM15:
-    *norm = "xmm15";
-    break;
+    {x64_reg_key("r14"), "r14", 8},   {x64_reg_key("r14d"), "r14", 4},
+    {x64_reg_key("r14w"), "r14", 2},  {x64_reg_key("r14b"), "r14", 1},
 
+    {x64_reg_key("r15"), "r15", 8},   {x64_reg_key("r15d"), "r15", 4},
+    {x64_reg_key("r15w"), "r15", 2},  {x64_reg_key("r15b"), "r15", 1},
+
+    {x64_reg_key("rip"), "ip", 8},
+
+    {x64_reg_key("xmm0"), "xmm0", 16},
+    {x64_reg_key("xmm1"), "xmm1", 16},
+    {x64_reg_key("xmm2"), "xmm2", 16},
+    {x64_reg_key("xmm3"), "xmm3", 16},
+    {x64_reg_key("xmm4"), "xmm4", 16},
+    {x64_reg_key("xmm5"), "xmm5", 16},
+    {x64_reg_key("xmm6"), "xmm6", 16},
+    {x64_reg_key("xmm7"), "xmm7", 16},
+    {x64_reg_key("xmm8"), "xmm8", 16},
+    {x64_reg_key("xmm9"), "xmm9", 16},
+    {x64_reg_key("xmm10"), "xmm10", 16},
+    {x64_reg_key("xmm11"), "xmm11", 16},
+    {x64_reg_key("xmm12"), "xmm12", 16},
+    {x64_reg_key("xmm13"), "xmm13", 16},
+    {x64_reg_key("xmm14"), "xmm14", 16},
+    {x64_reg_key("xmm15"), "xmm15", 16},
+};
+
+static constexpr bool x64_regs_perfect() {
+  bool used[256] = {};
+  for (const auto &e : kX64Regs) {
+    if (used[x64_reg_slot(e.key)])
+      return false;
+    used[x64_reg_slot(e.key)] = true;
   }
+  return true;
+}
+static_assert(x64_regs_perfect(),
+              "x64 register table no longer perfect-hashes; adjust "
+              "kX64RegHashMul");
+
+// slot-indexed view of kX64Regs, materialized once
+static const X64RegEntry *const *x64_reg_table() {
+  struct Table {
+    const X64RegEntry *slots[256];
+    Table() : slots() {
+      for (const auto &e : kX64Regs)
+        slots[x64_reg_slot(e.key)] = &e;
+    }
+  };
+  static Table table;
+  return table.slots;
 }
 
 bool ArgumentParser_x64::normalize_register(std::string *reg, int *reg_size) {
-  auto it = registers_.find(*reg);
-  if (it == registers_.end())
+  if (reg->size() > 8)
+    return false;
+  uint64_t key = x64_reg_key(reg->c_str());
+  const X64RegEntry *entry = x64_reg_table()[x64_reg_slot(key)];
+  if (!entry || entry->key != key)
     return false;
 
-  *reg_size = it->second.size;
-  reg_to_name(reg, it->second.reg);
+  *reg_size = entry->size;
+  *reg = entry->norm;
   return true;
 }
 }
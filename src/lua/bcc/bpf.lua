@@ -191,7 +191,7 @@ function Bpf:attach_uprobe(args)
   local retprobe = args.retprobe and 1 or 0
 
   local res = libbcc.bpf_attach_uprobe(fn.fd, retprobe, ev_name, path, addr,
-    args.pid or -1)
+    args.pid or -1, args.ref_ctr_offset or 0)
 
   assert(res >= 0, "failed to attach BPF to uprobe")
   self:probe_store("uprobe", ev_name, res)
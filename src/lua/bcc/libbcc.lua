@@ -48,7 +48,8 @@ int bpf_attach_kprobe(int progfd, int attach_type, const char *ev_name,
 int bpf_detach_kprobe(const char *ev_name);
 
 int bpf_attach_uprobe(int progfd, int attach_type, const char *ev_name,
-                      const char *binary_path, uint64_t offset, int pid);
+                      const char *binary_path, uint64_t offset, int pid,
+                      uint32_t ref_ctr_offset);
 
 int bpf_detach_uprobe(const char *ev_name);
 
@@ -92,6 +93,8 @@ int bpf_table_key_snprintf(void *program, size_t id, char *buf, size_t buflen, c
 int bpf_table_leaf_snprintf(void *program, size_t id, char *buf, size_t buflen, const void *leaf);
 int bpf_table_key_sscanf(void *program, size_t id, const char *buf, void *key);
 int bpf_table_leaf_sscanf(void *program, size_t id, const char *buf, void *leaf);
+int bpf_table_lookup_batch(void *program, size_t id, void *keys, void *leaves, unsigned int *count);
+int bpf_table_update_batch(void *program, size_t id, void *keys, void *leaves, unsigned int *count);
 ]]
 
 ffi.cdef[[
@@ -137,7 +140,8 @@ void bcc_usdt_close(void *usdt);
 int bcc_usdt_enable_probe(void *, const char *, const char *);
 char *bcc_usdt_genargs(void *);
 
-typedef void (*bcc_usdt_uprobe_cb)(const char *, const char *, uint64_t, int);
+typedef void (*bcc_usdt_uprobe_cb)(const char *, const char *, uint64_t, int,
+                                   uint64_t);
 void bcc_usdt_foreach_uprobe(void *usdt, bcc_usdt_uprobe_cb callback);
 ]]
 
@@ -40,6 +40,8 @@ function BaseTable:initialize(t_type, bpf, map_id, map_fd, key_type, leaf_type)
   self.map_fd = map_fd
   self.c_key = ffi.typeof(key_type.."[1]")
   self.c_leaf = ffi.typeof(leaf_type.."[1]")
+  self.c_key_array = ffi.typeof(key_type.."[?]")
+  self.c_leaf_array = ffi.typeof(leaf_type.."[?]")
 end
 
 function BaseTable:key_sprintf(key)
@@ -128,6 +130,45 @@ function BaseTable:keys()
   end
 end
 
+-- Bulk-copy up to max entries (default: the map capacity) into
+-- preallocated FFI arrays with a single C call. Returns keys, leaves and
+-- the entry count; the arrays are only valid as long as the references
+-- are held.
+function BaseTable:get_batch(max)
+  max = max or tonumber(libbcc.bpf_table_max_entries_id(self.bpf.module, self.map_id))
+  local keys = self.c_key_array(max)
+  local leaves = self.c_leaf_array(max)
+  local pcount = ffi.new("unsigned int[1]", max)
+
+  if libbcc.bpf_table_lookup_batch(self.bpf.module, self.map_id, keys, leaves, pcount) ~= 0 then
+    return nil, nil, 0
+  end
+  return keys, leaves, tonumber(pcount[0])
+end
+
+-- Write count entries from packed FFI arrays (as produced by get_batch or
+-- built with self.c_key_array/c_leaf_array) in a single C call.
+function BaseTable:update_batch(keys, leaves, count)
+  local pcount = ffi.new("unsigned int[1]", count)
+  assert(libbcc.bpf_table_update_batch(self.bpf.module, self.map_id, keys, leaves, pcount) == 0,
+    "could not update table in batch")
+end
+
+-- Same pairs as items(), but the map is fetched with one bulk call up
+-- front and iteration is pure Lua.
+function BaseTable:items_batch()
+  local keys, leaves, n = self:get_batch()
+  local i = -1
+
+  return function()
+    i = i + 1
+    if keys == nil or i >= n then
+      return nil
+    end
+    return keys[i], leaves[i]
+  end
+end
+
 function BaseTable:items()
   local pkey = self:_empty_key()
 
@@ -60,9 +60,10 @@ end
 function Usdt:_attach_uprobes(bpf)
   local uprobes = {}
   local cb = ffi.cast("bcc_usdt_uprobe_cb",
-    function(binpath, fn_name, addr, pid)
+    function(binpath, fn_name, addr, pid, ref_ctr_offset)
       table.insert(uprobes, {name=ffi.string(binpath),
-        addr=addr, fn_name=ffi.string(fn_name), pid=pid})
+        addr=addr, fn_name=ffi.string(fn_name), pid=pid,
+        ref_ctr_offset=tonumber(ref_ctr_offset)})
     end)
 
   libbcc.bcc_usdt_foreach_uprobe(self.context, cb)
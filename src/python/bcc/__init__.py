@@ -1372,9 +1372,9 @@ class BPF(object):
             return b"%s_%s_0x%x_%d" % (prefix, self._probe_repl.sub(b"_", path), addr, pid)
 
     def attach_uprobe(self, name=b"", sym=b"", sym_re=b"", addr=None,
-            fn_name=b"", pid=-1, sym_off=0):
+            fn_name=b"", pid=-1, sym_off=0, ref_ctr_offset=0):
         """attach_uprobe(name="", sym="", sym_re="", addr=None, fn_name=""
-                         pid=-1, sym_off=0)
+                         pid=-1, sym_off=0, ref_ctr_offset=0)
 
         Run the bpf function denoted by fn_name every time the symbol sym in
         the library or binary 'name' is encountered. Optional parameters pid,
@@ -1422,7 +1422,8 @@ class BPF(object):
         self._check_probe_quota(1)
         fn = self.load_func(fn_name, BPF.KPROBE)
         ev_name = self._get_uprobe_evname(b"p", path, addr, pid)
-        fd = lib.bpf_attach_uprobe(fn.fd, 0, ev_name, path, addr, pid)
+        fd = lib.bpf_attach_uprobe(fn.fd, 0, ev_name, path, addr, pid,
+                                   ref_ctr_offset)
         if fd < 0:
             raise Exception("Failed to attach BPF to uprobe")
         self._add_uprobe_fd(ev_name, fd)
@@ -1454,7 +1455,7 @@ class BPF(object):
         self._check_probe_quota(1)
         fn = self.load_func(fn_name, BPF.KPROBE)
         ev_name = self._get_uprobe_evname(b"r", path, addr, pid)
-        fd = lib.bpf_attach_uprobe(fn.fd, 1, ev_name, path, addr, pid)
+        fd = lib.bpf_attach_uprobe(fn.fd, 1, ev_name, path, addr, pid, 0)
         if fd < 0:
             raise Exception("Failed to attach BPF to uretprobe")
         self._add_uprobe_fd(ev_name, fd)
@@ -68,6 +68,18 @@ lib.bpf_table_key_sscanf.argtypes = [ct.c_void_p, ct.c_ulonglong,
 lib.bpf_table_leaf_sscanf.restype = ct.c_int
 lib.bpf_table_leaf_sscanf.argtypes = [ct.c_void_p, ct.c_ulonglong,
         ct.c_char_p, ct.c_void_p]
+lib.bpf_table_key_snprintf_batch.restype = ct.c_int
+lib.bpf_table_key_snprintf_batch.argtypes = [ct.c_void_p, ct.c_ulonglong,
+        ct.c_char_p, ct.c_ulonglong, ct.c_void_p, ct.c_ulonglong]
+lib.bpf_table_leaf_snprintf_batch.restype = ct.c_int
+lib.bpf_table_leaf_snprintf_batch.argtypes = [ct.c_void_p, ct.c_ulonglong,
+        ct.c_char_p, ct.c_ulonglong, ct.c_void_p, ct.c_ulonglong]
+lib.bpf_table_key_sscanf_batch.restype = ct.c_int
+lib.bpf_table_key_sscanf_batch.argtypes = [ct.c_void_p, ct.c_ulonglong,
+        ct.c_void_p, ct.c_void_p, ct.c_ulonglong]
+lib.bpf_table_leaf_sscanf_batch.restype = ct.c_int
+lib.bpf_table_leaf_sscanf_batch.argtypes = [ct.c_void_p, ct.c_ulonglong,
+        ct.c_void_p, ct.c_void_p, ct.c_ulonglong]
 lib.bpf_perf_event_fields.restype = ct.c_ulonglong
 lib.bpf_perf_event_fields.argtypes = [ct.c_void_p, ct.c_char_p]
 lib.bpf_perf_event_field.restype = ct.c_char_p
@@ -112,7 +124,7 @@ lib.bpf_detach_kprobe.restype = ct.c_int
 lib.bpf_detach_kprobe.argtypes = [ct.c_char_p]
 lib.bpf_attach_uprobe.restype = ct.c_int
 lib.bpf_attach_uprobe.argtypes = [ct.c_int, ct.c_int, ct.c_char_p, ct.c_char_p,
-        ct.c_ulonglong, ct.c_int]
+        ct.c_ulonglong, ct.c_int, ct.c_uint]
 lib.bpf_detach_uprobe.restype = ct.c_int
 lib.bpf_detach_uprobe.argtypes = [ct.c_char_p]
 lib.bpf_attach_tracepoint.restype = ct.c_int
@@ -239,6 +251,9 @@ lib.bcc_procutils_free.restype = None
 lib.bcc_procutils_free.argtypes = [ct.c_void_p]
 lib.bcc_procutils_language.restype = ct.POINTER(ct.c_char)
 lib.bcc_procutils_language.argtypes = [ct.c_int]
+lib.bcc_procutils_language_batch.restype = ct.c_int
+lib.bcc_procutils_language_batch.argtypes = [
+    ct.POINTER(ct.c_int), ct.POINTER(ct.c_char_p), ct.c_int]
 
 lib.bcc_resolve_symname.restype = ct.c_int
 lib.bcc_resolve_symname.argtypes = [
@@ -360,7 +375,7 @@ lib.bcc_usdt_get_argument.argtypes = [ct.c_void_p, ct.c_char_p, ct.c_char_p, ct.
                                       ct.c_int, ct.POINTER(bcc_usdt_argument)]
 
 _USDT_PROBE_CB = ct.CFUNCTYPE(None, ct.c_char_p, ct.c_char_p,
-                              ct.c_ulonglong, ct.c_int)
+                              ct.c_ulonglong, ct.c_int, ct.c_ulonglong)
 
 lib.bcc_usdt_foreach_uprobe.restype = None
 lib.bcc_usdt_foreach_uprobe.argtypes = [ct.c_void_p, _USDT_PROBE_CB]
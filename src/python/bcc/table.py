@@ -368,6 +368,52 @@ class TableBase(MutableMapping):
             raise Exception("Could not scanf leaf")
         return leaf
 
+    def key_sprintf_batch(self, keys):
+        """Convert a ctypes array of keys to a list of strings with a
+        single library call, instead of one call per key."""
+        n = len(keys)
+        stride = ct.sizeof(self.Key) * 8
+        buf = ct.create_string_buffer(stride * n)
+        res = lib.bpf_table_key_snprintf_batch(self.bpf.module, self.map_id,
+                buf, stride, keys, n)
+        if res != n:
+            raise Exception("Could not printf key")
+        return [ct.string_at(ct.addressof(buf) + i * stride)
+                for i in range(n)]
+
+    def leaf_sprintf_batch(self, leaves):
+        n = len(leaves)
+        stride = ct.sizeof(self.Leaf) * 8
+        buf = ct.create_string_buffer(stride * n)
+        res = lib.bpf_table_leaf_snprintf_batch(self.bpf.module, self.map_id,
+                buf, stride, leaves, n)
+        if res != n:
+            raise Exception("Could not printf leaf")
+        return [ct.string_at(ct.addressof(buf) + i * stride)
+                for i in range(n)]
+
+    def key_scanf_batch(self, key_strs):
+        """Convert a list of key strings back to a ctypes array of keys
+        with a single library call."""
+        n = len(key_strs)
+        keys = (self.Key * n)()
+        strs = (ct.c_char_p * n)(*key_strs)
+        res = lib.bpf_table_key_sscanf_batch(self.bpf.module, self.map_id,
+                strs, keys, n)
+        if res != n:
+            raise Exception("Could not scanf key")
+        return keys
+
+    def leaf_scanf_batch(self, leaf_strs):
+        n = len(leaf_strs)
+        leaves = (self.Leaf * n)()
+        strs = (ct.c_char_p * n)(*leaf_strs)
+        res = lib.bpf_table_leaf_sscanf_batch(self.bpf.module, self.map_id,
+                strs, leaves, n)
+        if res != n:
+            raise Exception("Could not scanf leaf")
+        return leaves
+
     def __getitem__(self, key):
         leaf = self.Leaf()
         res = lib.bpf_lookup_elem(self.map_fd, ct.byref(key), ct.byref(leaf))
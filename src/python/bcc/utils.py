@@ -44,6 +44,21 @@ def detect_language(candidates, pid):
     language = ct.cast(res, ct.c_char_p).value.decode()
     return language if language in candidates else None
 
+def detect_languages(candidates, pids):
+    """Detect the language of many pids with one library call; results are
+    cached per process lifetime, so repeat sweeps over a mostly-unchanged
+    pid set avoid re-scanning maps files. Returns a dict of pid to
+    language (None when undetected or not in candidates)."""
+    n = len(pids)
+    pid_arr = (ct.c_int * n)(*pids)
+    lang_arr = (ct.c_char_p * n)()
+    lib.bcc_procutils_language_batch(pid_arr, lang_arr, n)
+    result = {}
+    for pid, lang in zip(pids, lang_arr):
+        language = lang.decode() if lang else None
+        result[pid] = language if language in candidates else None
+    return result
+
 FILESYSTEMENCODING = sys.getfilesystemencoding()
 
 def printb(s, file=sys.stdout, nl=1):
@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2022 The BCC Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Microbenchmarks for libbcc's hot paths: program compilation, hash table
+// syscall throughput, perf ring draining and symbol resolution. Most cases
+// need root (they load BPF programs); a case whose setup fails is reported
+// with error_occurred instead of aborting the whole run.
+//
+// Results are printed as JSON in the schema Google Benchmark emits
+// (context + benchmarks array with name/iterations/real_time/
+// items_per_second), so existing dashboards can ingest them unchanged.
+
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "BPF.h"
+#include "bcc_syms.h"
+
+namespace {
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// One case: run `iters` iterations of the measured operation, return the
+// elapsed nanoseconds of the hot loop only (setup excluded), or set err.
+typedef std::function<bool(size_t iters, uint64_t *elapsed_ns,
+                           std::string *err)> bench_fn;
+
+struct BenchResult {
+  std::string name;
+  size_t iterations = 0;
+  uint64_t elapsed_ns = 0;
+  std::string error;
+};
+
+// Calibrating runner: double the iteration count until the hot loop runs
+// long enough (~300ms) for a stable per-iteration figure.
+BenchResult run_bench(const std::string &name, size_t start_iters,
+                      const bench_fn &fn) {
+  static const uint64_t kMinNs = 300000000ull;
+  BenchResult res;
+  res.name = name;
+
+  size_t iters = start_iters;
+  while (true) {
+    uint64_t elapsed = 0;
+    std::string err;
+    if (!fn(iters, &elapsed, &err)) {
+      res.error = err.empty() ? "benchmark failed" : err;
+      return res;
+    }
+    if (elapsed >= kMinNs || iters >= (size_t)1 << 30) {
+      res.iterations = iters;
+      res.elapsed_ns = elapsed;
+      return res;
+    }
+    if (elapsed == 0)
+      iters *= 16;
+    else
+      iters *= 2;
+  }
+}
+
+void json_escape(const std::string &in, std::string *out) {
+  for (char c : in) {
+    if (c == '"' || c == '\\')
+      *out += '\\';
+    if (c == '\n')
+      *out += "\\n";
+    else
+      *out += c;
+  }
+}
+
+void print_results(const std::vector<BenchResult> &results) {
+  printf("{\n");
+  printf("  \"context\": {\n");
+  printf("    \"library\": \"libbcc\",\n");
+  printf("    \"num_cpus\": %ld\n", sysconf(_SC_NPROCESSORS_ONLN));
+  printf("  },\n");
+  printf("  \"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult &r = results[i];
+    printf("    {\n");
+    printf("      \"name\": \"%s\",\n", r.name.c_str());
+    if (!r.error.empty()) {
+      std::string escaped;
+      json_escape(r.error, &escaped);
+      printf("      \"error_occurred\": true,\n");
+      printf("      \"error_message\": \"%s\"\n", escaped.c_str());
+    } else {
+      double per_iter = (double)r.elapsed_ns / r.iterations;
+      printf("      \"iterations\": %zu,\n", r.iterations);
+      printf("      \"real_time\": %.2f,\n", per_iter);
+      printf("      \"cpu_time\": %.2f,\n", per_iter);
+      printf("      \"time_unit\": \"ns\",\n");
+      printf("      \"items_per_second\": %.2f\n", 1e9 / per_iter);
+    }
+    printf("    }%s\n", i + 1 < results.size() ? "," : "");
+  }
+  printf("  ]\n");
+  printf("}\n");
+}
+
+const char kSmallProgram[] = R"(
+  BPF_HASH(bench_hash, u64, u64, 65536);
+  int bench_fn(void *ctx) { return 0; }
+)";
+
+// End-to-end BPFModule compilation: Clang frontend, rewriter and LLVM
+// codegen for a small but representative program. One full init() per
+// iteration; dominated by ClangLoader::parse.
+bool bm_load_string(size_t iters, uint64_t *elapsed_ns, std::string *err) {
+  uint64_t t0 = now_ns();
+  for (size_t i = 0; i < iters; i++) {
+    ebpf::BPF bpf;
+    auto res = bpf.init(kSmallProgram);
+    if (!res.ok()) {
+      *err = res.msg();
+      return false;
+    }
+  }
+  *elapsed_ns = now_ns() - t0;
+  return true;
+}
+
+bool hash_table_setup(ebpf::BPF &bpf, std::string *err) {
+  auto res = bpf.init(kSmallProgram);
+  if (!res.ok()) {
+    *err = res.msg();
+    return false;
+  }
+  return true;
+}
+
+bool bm_hash_update(size_t iters, uint64_t *elapsed_ns, std::string *err) {
+  ebpf::BPF bpf;
+  if (!hash_table_setup(bpf, err))
+    return false;
+  auto t = bpf.get_hash_table<uint64_t, uint64_t>("bench_hash");
+
+  uint64_t t0 = now_ns();
+  for (size_t i = 0; i < iters; i++) {
+    uint64_t k = i & 0xffff, v = i;
+    auto res = t.update_value(k, v);
+    if (!res.ok()) {
+      *err = res.msg();
+      return false;
+    }
+  }
+  *elapsed_ns = now_ns() - t0;
+  return true;
+}
+
+bool bm_hash_lookup(size_t iters, uint64_t *elapsed_ns, std::string *err) {
+  ebpf::BPF bpf;
+  if (!hash_table_setup(bpf, err))
+    return false;
+  auto t = bpf.get_hash_table<uint64_t, uint64_t>("bench_hash");
+  for (uint64_t k = 0; k < 4096; k++) {
+    uint64_t v = k;
+    t.update_value(k, v);
+  }
+
+  uint64_t t0 = now_ns();
+  for (size_t i = 0; i < iters; i++) {
+    uint64_t k = i & 0xfff, v;
+    auto res = t.get_value(k, v);
+    if (!res.ok()) {
+      *err = res.msg();
+      return false;
+    }
+  }
+  *elapsed_ns = now_ns() - t0;
+  return true;
+}
+
+// Full-table walk: one get_table_offline() per iteration over 4096 entries.
+bool bm_hash_walk(size_t iters, uint64_t *elapsed_ns, std::string *err) {
+  ebpf::BPF bpf;
+  if (!hash_table_setup(bpf, err))
+    return false;
+  auto t = bpf.get_hash_table<uint64_t, uint64_t>("bench_hash");
+  for (uint64_t k = 0; k < 4096; k++) {
+    uint64_t v = k;
+    t.update_value(k, v);
+  }
+
+  uint64_t t0 = now_ns();
+  for (size_t i = 0; i < iters; i++) {
+    auto entries = t.get_table_offline();
+    if (entries.size() != 4096) {
+      *err = "unexpected table size";
+      return false;
+    }
+  }
+  *elapsed_ns = now_ns() - t0;
+  return true;
+}
+
+// Drain cost of the perf reader path: poll() over all-CPU rings that carry
+// no data measures the fixed per-wake overhead (epoll_wait + ring head
+// checks) that every real drain pays on top of per-event work.
+bool bm_perf_reader_drain(size_t iters, uint64_t *elapsed_ns,
+                          std::string *err) {
+  const std::string program = R"(
+    BPF_PERF_OUTPUT(bench_events);
+    int bench_fn(void *ctx) { return 0; }
+  )";
+  ebpf::BPF bpf;
+  auto res = bpf.init(program);
+  if (!res.ok()) {
+    *err = res.msg();
+    return false;
+  }
+  res = bpf.open_perf_buffer("bench_events", [](void *, void *, int) {});
+  if (!res.ok()) {
+    *err = res.msg();
+    return false;
+  }
+
+  uint64_t t0 = now_ns();
+  for (size_t i = 0; i < iters; i++)
+    bpf.poll_perf_buffer("bench_events", 0);
+  *elapsed_ns = now_ns() - t0;
+  return true;
+}
+
+// Userspace symbolization throughput against this process's own maps.
+bool bm_symcache_resolve(size_t iters, uint64_t *elapsed_ns,
+                         std::string *err) {
+  void *cache = bcc_symcache_new(getpid(), nullptr);
+  if (!cache) {
+    *err = "bcc_symcache_new failed";
+    return false;
+  }
+  uint64_t addr = (uint64_t)(uintptr_t)&bcc_symcache_new;
+
+  uint64_t t0 = now_ns();
+  for (size_t i = 0; i < iters; i++) {
+    struct bcc_symbol sym;
+    if (bcc_symcache_resolve(cache, addr, &sym) == 0)
+      bcc_symbol_free_demangle_name(&sym);
+  }
+  *elapsed_ns = now_ns() - t0;
+  bcc_free_symcache(cache, getpid());
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  std::vector<BenchResult> results;
+  results.push_back(run_bench("BM_BPFModule_load_string", 1, bm_load_string));
+  results.push_back(run_bench("BM_BPFHashTable_update", 1024, bm_hash_update));
+  results.push_back(run_bench("BM_BPFHashTable_lookup", 1024, bm_hash_lookup));
+  results.push_back(run_bench("BM_BPFHashTable_walk", 4, bm_hash_walk));
+  results.push_back(
+      run_bench("BM_perf_reader_drain", 1024, bm_perf_reader_drain));
+  results.push_back(
+      run_bench("BM_symcache_resolve", 1024, bm_symcache_resolve));
+  print_results(results);
+  return 0;
+}
@@ -0,0 +1,389 @@
+/*
+ * Copyright (c) 2022 The BCC Authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Record/replay harness for benchmarking libbcc against real workloads
+// instead of synthetic event mixes. Record mode attaches a kprobe to a
+// (configurable) busy kernel function, captures a window of the resulting
+// perf-buffer traffic as raw ring bytes (flight-recorder mode, so the
+// recorder itself adds no decode cost), together with a drain timeline and
+// periodic snapshots of a per-pid hash map the probe maintains. Replay
+// mode feeds the captured bytes back through the normal BPFPerfBuffer
+// callback path, sweep by sweep on the recorded timeline at original or
+// accelerated speed, and re-applies the map snapshots to a fresh kernel
+// hash map -- so two libbcc builds can be A/B'd on the identical event
+// stream and map access pattern. Record needs root; replay of the perf
+// stream does not, map replay does. Typical use:
+//
+//   bcc-workload-replay record -o /tmp/window -d 30   # 30s capture window
+//   bcc-workload-replay replay -o /tmp/window         # original pacing
+//   bcc-workload-replay replay -o /tmp/window -x 0    # as fast as possible
+//
+// Capture directory layout: cpu<N>.cap (raw perf records, see
+// perf_capture_hdr in perf_reader.h), timeline.txt (one "t_ns cpu
+// end_offset" line per drain sweep), snapshots.bin (binary map dumps) and
+// meta.txt.
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "BPF.h"
+
+namespace {
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t process_cpu_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+const char kSnapshotMagic[] = "bcc-workload-snapshots-v1";
+
+// the recording probe: submits one fixed-size event per hit and keeps a
+// per-pid hit counter that record mode snapshots periodically
+const char kRecordProg[] = R"(
+struct event_t {
+  u64 ts;
+  u64 pid_tgid;
+  char payload[PAYLOAD_SIZE];
+};
+BPF_PERF_OUTPUT(events);
+BPF_HASH(counts, u64, u64);
+int on_probe(struct pt_regs *ctx) {
+  struct event_t ev = {};
+  ev.ts = bpf_ktime_get_ns();
+  ev.pid_tgid = bpf_get_current_pid_tgid();
+  u64 key = ev.pid_tgid >> 32;
+  u64 zero = 0, *val = counts.lookup_or_try_init(&key, &zero);
+  if (val)
+    (*val)++;
+  events.perf_submit(ctx, &ev, sizeof(ev));
+  return 0;
+}
+)";
+
+struct TimelineEntry {
+  uint64_t t_ns;  // relative to the start of the window
+  int cpu;
+  uint64_t end_offset;  // capture file size after this sweep
+};
+
+struct Options {
+  std::string dir;
+  std::string probe = "finish_task_switch";
+  int payload_size = 64;
+  int duration_sec = 10;
+  int snapshot_ms = 1000;
+  int page_cnt = 64;
+  double speed = 1.0;  // replay: 1.0 = original pacing, 0 = unthrottled
+};
+
+void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s record -o DIR [-k kfunc] [-s payload_bytes] [-d secs]\n"
+          "          [-i snapshot_ms] [-P page_cnt]\n"
+          "       %s replay -o DIR [-x speed  (1 = original, 0 = max)]\n",
+          argv0, argv0);
+}
+
+uint64_t file_size(const std::string &path) {
+  struct stat st;
+  return ::stat(path.c_str(), &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+int do_record(const Options &opt) {
+  std::string text = kRecordProg;
+  size_t pos = text.find("PAYLOAD_SIZE");
+  text.replace(pos, strlen("PAYLOAD_SIZE"), std::to_string(opt.payload_size));
+
+  ebpf::BPF bpf;
+  auto init_res = bpf.init(text);
+  if (!init_res.ok()) {
+    fprintf(stderr, "init: %s\n", init_res.msg().c_str());
+    return 1;
+  }
+  auto open_res = bpf.open_perf_buffer_capture("events", opt.dir, opt.page_cnt);
+  if (!open_res.ok()) {
+    fprintf(stderr, "open capture: %s\n", open_res.msg().c_str());
+    return 1;
+  }
+  auto attach_res = bpf.attach_kprobe(opt.probe, "on_probe");
+  if (!attach_res.ok()) {
+    fprintf(stderr, "attach %s: %s\n", opt.probe.c_str(),
+            attach_res.msg().c_str());
+    return 1;
+  }
+
+  int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  std::vector<uint64_t> last_size(ncpu, sizeof(struct perf_capture_hdr));
+  std::ofstream timeline(opt.dir + "/timeline.txt");
+  std::ofstream snapshots(opt.dir + "/snapshots.bin", std::ios::binary);
+  snapshots << kSnapshotMagic << "\n";
+  auto counts = bpf.get_hash_table<uint64_t, uint64_t>("counts");
+
+  uint64_t t0 = now_ns();
+  uint64_t deadline = t0 + (uint64_t)opt.duration_sec * 1000000000ull;
+  uint64_t next_snapshot = t0;
+  uint64_t events_bytes = 0;
+  while (now_ns() < deadline) {
+    bpf.poll_perf_buffer("events", 100);
+    // a timeline entry per grown capture file records when this sweep's
+    // bytes arrived, giving replay its pacing
+    uint64_t t = now_ns() - t0;
+    for (int cpu = 0; cpu < ncpu; cpu++) {
+      uint64_t sz =
+          file_size(opt.dir + "/cpu" + std::to_string(cpu) + ".cap");
+      if (sz > last_size[cpu]) {
+        timeline << t << " " << cpu << " " << sz << "\n";
+        events_bytes += sz - last_size[cpu];
+        last_size[cpu] = sz;
+      }
+    }
+    if (now_ns() >= next_snapshot) {
+      auto table = counts.get_table_offline();
+      uint64_t cnt = table.size();
+      snapshots.write(reinterpret_cast<const char *>(&t), sizeof(t));
+      snapshots.write(reinterpret_cast<const char *>(&cnt), sizeof(cnt));
+      for (const auto &kv : table) {
+        snapshots.write(reinterpret_cast<const char *>(&kv.first),
+                        sizeof(kv.first));
+        snapshots.write(reinterpret_cast<const char *>(&kv.second),
+                        sizeof(kv.second));
+      }
+      next_snapshot += (uint64_t)opt.snapshot_ms * 1000000ull;
+    }
+  }
+  bpf.detach_kprobe(opt.probe);
+
+  std::ofstream meta(opt.dir + "/meta.txt");
+  meta << "bcc-workload-v1\n"
+       << "probe " << opt.probe << "\n"
+       << "payload_size " << opt.payload_size << "\n"
+       << "duration_ns " << (now_ns() - t0) << "\n";
+  fprintf(stderr, "recorded %.1f MiB of events to %s\n",
+          events_bytes / 1048576.0, opt.dir.c_str());
+  return 0;
+}
+
+struct ReplayCounts {
+  uint64_t events = 0;
+  uint64_t bytes = 0;
+};
+
+void replay_raw_cb(void *cookie, void *data, int size) {
+  auto *c = static_cast<ReplayCounts *>(cookie);
+  c->events++;
+  c->bytes += size;
+}
+
+// Feed one sweep's byte range back through perf_reader_replay: the capture
+// header plus the records of [begin, end) make a self-contained stream
+// (capture sweeps only ever write whole records).
+int64_t replay_sweep(const std::vector<char> &capture, uint64_t begin,
+                     uint64_t end, ReplayCounts *counts) {
+  int fd = memfd_create("bcc-replay-sweep", 0);
+  if (fd < 0)
+    return -1;
+  size_t hdr = sizeof(struct perf_capture_hdr);
+  if (::write(fd, capture.data(), hdr) != (ssize_t)hdr ||
+      ::write(fd, capture.data() + begin, end - begin) !=
+          (ssize_t)(end - begin) ||
+      ::lseek(fd, 0, SEEK_SET) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  int64_t n = perf_reader_replay(fd, replay_raw_cb, nullptr, counts);
+  ::close(fd);
+  return n;
+}
+
+// sleep until the recorded (scaled) timestamp comes around
+void pace(uint64_t t0, uint64_t rec_ns, double speed) {
+  if (speed <= 0)
+    return;
+  uint64_t due = t0 + (uint64_t)(rec_ns / speed);
+  uint64_t now = now_ns();
+  if (due > now) {
+    struct timespec ts = {(time_t)((due - now) / 1000000000ull),
+                          (long)((due - now) % 1000000000ull)};
+    nanosleep(&ts, nullptr);
+  }
+}
+
+int do_replay(const Options &opt) {
+  // load the whole capture up front so replay measures libbcc, not disk
+  std::ifstream timeline(opt.dir + "/timeline.txt");
+  if (!timeline) {
+    fprintf(stderr, "no timeline.txt under %s\n", opt.dir.c_str());
+    return 1;
+  }
+  std::vector<TimelineEntry> entries;
+  std::map<int, std::vector<char>> captures;
+  TimelineEntry e;
+  while (timeline >> e.t_ns >> e.cpu >> e.end_offset) {
+    entries.push_back(e);
+    if (captures.find(e.cpu) == captures.end()) {
+      std::ifstream cap(opt.dir + "/cpu" + std::to_string(e.cpu) + ".cap",
+                        std::ios::binary);
+      captures[e.cpu] = std::vector<char>(
+          std::istreambuf_iterator<char>(cap), std::istreambuf_iterator<char>());
+    }
+  }
+
+  // map snapshots: replayed against a fresh kernel hash map with one
+  // batched update per snapshot, like a collector reloading its state
+  std::ifstream snaps(opt.dir + "/snapshots.bin", std::ios::binary);
+  std::string magic;
+  std::getline(snaps, magic);
+  bool have_snaps = magic == kSnapshotMagic;
+  int map_fd = -1;
+  if (have_snaps) {
+    map_fd = bcc_create_map(BPF_MAP_TYPE_HASH, "replay_counts", 8, 8, 65536, 0);
+    if (map_fd < 0) {
+      fprintf(stderr, "map create failed (%s); skipping map replay\n",
+              strerror(errno));
+      have_snaps = false;
+    }
+  }
+
+  ReplayCounts counts;
+  std::map<int, uint64_t> last_offset;
+  uint64_t map_updates = 0, map_update_ns = 0;
+  uint64_t next_snap_t = 0;
+  std::vector<uint64_t> snap_keys, snap_vals;
+  uint64_t snap_t = 0, snap_cnt = 0;
+  bool snap_pending =
+      have_snaps &&
+      snaps.read(reinterpret_cast<char *>(&snap_t), sizeof(snap_t)) &&
+      snaps.read(reinterpret_cast<char *>(&snap_cnt), sizeof(snap_cnt));
+
+  uint64_t t0 = now_ns();
+  uint64_t cpu0 = process_cpu_ns();
+  for (const auto &entry : entries) {
+    // interleave snapshots at their recorded position in the window
+    while (snap_pending && snap_t <= entry.t_ns) {
+      snap_keys.resize(snap_cnt);
+      snap_vals.resize(snap_cnt);
+      for (uint64_t i = 0; i < snap_cnt; i++) {
+        snaps.read(reinterpret_cast<char *>(&snap_keys[i]), 8);
+        snaps.read(reinterpret_cast<char *>(&snap_vals[i]), 8);
+      }
+      pace(t0, snap_t, opt.speed);
+      uint64_t u0 = now_ns();
+      __u32 n = snap_cnt;
+      if (n && bpf_update_batch(map_fd, snap_keys.data(), snap_vals.data(),
+                                &n) < 0 && errno == EINVAL) {
+        for (n = 0; n < snap_cnt; n++)
+          if (bpf_update_elem(map_fd, &snap_keys[n], &snap_vals[n], 0) < 0)
+            break;
+      }
+      map_update_ns += now_ns() - u0;
+      map_updates += n;
+      snap_pending =
+          snaps.read(reinterpret_cast<char *>(&snap_t), sizeof(snap_t)) &&
+          snaps.read(reinterpret_cast<char *>(&snap_cnt), sizeof(snap_cnt));
+    }
+
+    auto &cap = captures[entry.cpu];
+    uint64_t begin = last_offset.count(entry.cpu)
+                         ? last_offset[entry.cpu]
+                         : sizeof(struct perf_capture_hdr);
+    uint64_t end = entry.end_offset;
+    if (end > cap.size() || begin >= end)
+      continue;
+    last_offset[entry.cpu] = end;
+    pace(t0, entry.t_ns, opt.speed);
+    if (replay_sweep(cap, begin, end, &counts) < 0) {
+      fprintf(stderr, "corrupt capture for cpu%d\n", entry.cpu);
+      return 1;
+    }
+  }
+  uint64_t wall_ns = now_ns() - t0;
+  uint64_t cpu_ns = process_cpu_ns() - cpu0;
+  if (map_fd >= 0)
+    ::close(map_fd);
+  (void)next_snap_t;
+
+  printf("{\n");
+  printf("  \"events\": %llu,\n", (unsigned long long)counts.events);
+  printf("  \"bytes\": %llu,\n", (unsigned long long)counts.bytes);
+  printf("  \"wall_seconds\": %.3f,\n", wall_ns / 1e9);
+  printf("  \"events_per_second\": %.0f,\n",
+         wall_ns ? counts.events / (wall_ns / 1e9) : 0.0);
+  printf("  \"cpu_ns_per_event\": %.1f,\n",
+         counts.events ? (double)cpu_ns / counts.events : 0.0);
+  printf("  \"map_updates\": %llu,\n", (unsigned long long)map_updates);
+  printf("  \"map_updates_per_second\": %.0f\n",
+         map_update_ns ? map_updates / (map_update_ns / 1e9) : 0.0);
+  printf("}\n");
+  return 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    usage(argv[0]);
+    return 1;
+  }
+  std::string mode = argv[1];
+  Options opt;
+  int c;
+  while ((c = getopt(argc - 1, argv + 1, "o:k:s:d:i:P:x:h")) != -1) {
+    switch (c) {
+      case 'o': opt.dir = optarg; break;
+      case 'k': opt.probe = optarg; break;
+      case 's': opt.payload_size = atoi(optarg); break;
+      case 'd': opt.duration_sec = atoi(optarg); break;
+      case 'i': opt.snapshot_ms = atoi(optarg); break;
+      case 'P': opt.page_cnt = atoi(optarg); break;
+      case 'x': opt.speed = atof(optarg); break;
+      default:
+        usage(argv[0]);
+        return c == 'h' ? 0 : 1;
+    }
+  }
+  if (opt.dir.empty()) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (mode == "record")
+    return do_record(opt);
+  if (mode == "replay")
+    return do_replay(opt);
+  usage(argv[0]);
+  return 1;
+}
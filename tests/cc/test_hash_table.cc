@@ -89,6 +89,32 @@ TEST_CASE("test hash table", "[hash_table]") {
     t.clear_table_non_atomic();
     REQUIRE(t.get_table_offline().size() == 0);
   }
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+  SECTION("batch operations") {
+    std::vector<int> keys;
+    std::vector<int> values;
+    for (int i = 1; i <= 10; i++) {
+      keys.push_back(i * 3);
+      values.push_back(i);
+    }
+    res = t.update_value_batch(keys, values);
+    REQUIRE(res.ok());
+
+    std::vector<std::pair<int, int>> offline;
+    res = t.get_table_offline_batch(offline);
+    REQUIRE(res.ok());
+    REQUIRE(offline.size() == 10);
+    for (const auto &pair : offline) {
+      REQUIRE(pair.first % 3 == 0);
+      REQUIRE(pair.first / 3 == pair.second);
+    }
+
+    res = t.remove_value_batch(keys);
+    REQUIRE(res.ok());
+    REQUIRE(t.get_table_offline().size() == 0);
+  }
+#endif
 }
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,6,0)